@@ -0,0 +1,766 @@
+/**
+ * @author Flavien Lallemant
+ * @file bench.c
+ * @brief Decoding benchmarks
+ *
+ * This file contains the benchmarks run by make bench. Each capture is loaded
+ * in memory once, then the full decoding path, the text and JSON output and
+ * every cast_* function are timed on its packets, with the output discarded.
+ * A dissector is timed on the packets reaching it, from the bytes the layer
+ * below hands over, so its time includes the layers it hands them over to.
+ * The results are compared to a JSON baseline, written by make
+ * bench-baseline.
+ *
+ * @see main
+ */
+
+// Global libraries
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <net/ethernet.h>
+#include <pcap.h>
+
+// Local header files
+#include "alloc.h"
+#include "arena.h"
+#include "arp.h"
+#include "bootp.h"
+#include "decode.h"
+#include "dispatch.h"
+#include "dns.h"
+#include "dnsname.h"
+#include "ethernet.h"
+#include "icmp.h"
+#include "icmpv6.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "json.h"
+#include "output.h"
+#include "pcapfile.h"
+#include "render.h"
+#include "tcp.h"
+#include "tls.h"
+#include "udp.h"
+
+#define BENCH_MIN_MS 50 /**< Default time a case runs for, in milliseconds */
+#define BENCH_TRIALS 20 /**< Trials of a case, the fastest one is kept */
+#define BENCH_THRESHOLD 20.0 /**< Default slowdown reported, in percent of the baseline */
+#define BENCH_ALLOC_SLACK 0.005 /**< Allocations per packet over the baseline reported */
+#define BENCH_NAME_LEN 64 /**< Longest capture name, with the null byte */
+#define BENCH_CASE_LEN 16 /**< Longest case name, with the null byte */
+
+
+/**
+ * @brief Packet loaded in memory
+ */
+struct bench_packet {
+    struct packet_info pi;      /**< The packet decoded once */
+    struct pcap_pkthdr header;  /**< The capture header */
+    const u_char *data;         /**< The captured bytes */
+};
+
+/**
+ * @brief Packet handed over to a dissector
+ */
+struct bench_input {
+    struct packet_info pi;      /**< The decoded packet, without the layers from the timed one up */
+    struct packet_view v;       /**< The bytes the layer below hands over */
+};
+
+/**
+ * @brief Benchmark of a decoding step
+ */
+struct bench_case {
+    const char *name;
+    renderer_t render;  /**< Renderer run after decode_packet(), NULL for none */
+    int (*cast)(struct packet_view *v, struct packet_info *pi); /**< Dissector timed alone, NULL for decode_packet() */
+    int (*input)(const struct bench_packet *p, struct bench_input *in); /**< Set the input of the dissector, 0 if the packet doesn't reach it */
+};
+
+/**
+ * @brief Result of a case on a capture
+ */
+struct bench_result {
+    char capture[BENCH_NAME_LEN];
+    char name[BENCH_CASE_LEN];
+    unsigned packets;   /**< Packets the case ran on */
+    double ns;          /**< Nanoseconds per packet */
+    double allocs;      /**< Allocations per packet */
+};
+
+/**
+ * @brief Results of a run or of the baseline
+ */
+struct bench_results {
+    struct bench_result *r;
+    unsigned count;
+    unsigned size;
+};
+
+static struct outbuf sink; /**< The discarded output */
+
+
+/**
+ * @brief Get a monotonic time in nanoseconds
+ *
+ * @return long long The time
+ */
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Start the input of a dissector at an offset of the packet
+ *
+ * @param p The packet
+ * @param in The input to fill
+ * @param off The offset of the first byte handed over
+ * @param end The offset past the last byte handed over
+ * @param below The LAYER_* flags of the layers below the dissector
+ * @return int 1 if the packet reaches the dissector, 0 otherwise
+ */
+static int input_at(const struct bench_packet *p, struct bench_input *in,
+                    uint32_t off, uint32_t end, uint16_t below)
+{
+    if (off > end || end > p->header.caplen)
+        return 0;
+    in->pi = p->pi;
+    in->pi.layers &= below;
+    in->pi.app_proto = APP_NONE;
+    memset(&in->pi.u, 0, sizeof(in->pi.u));
+    view_init(&in->v, p->data, p->header.caplen);
+    view_skip(&in->v, off);
+    view_limit(&in->v, end - off);
+    return 1;
+}
+
+
+/**
+ * @brief Set the input of the link layer
+ *
+ * @param p The packet
+ * @param in The input to fill
+ * @return int 1
+ */
+static int link_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return input_at(p, in, 0, p->header.caplen, 0);
+}
+
+
+/**
+ * @brief Set the input of a network layer
+ *
+ * @param p The packet
+ * @param in The input to fill
+ * @param ethertype The ethertype of the layer
+ * @return int 1 if the packet carries the layer, 0 otherwise
+ */
+static int network_input(const struct bench_packet *p, struct bench_input *in,
+                         uint16_t ethertype)
+{
+    if (!(p->pi.layers & LAYER_ETH) || p->pi.ethertype != ethertype)
+        return 0;
+    return input_at(p, in, sizeof(struct ether_header), p->header.caplen,
+                    LAYER_ETH);
+}
+
+static int ipv4_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return network_input(p, in, ETHERTYPE_IP);
+}
+
+static int ipv6_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return network_input(p, in, ETHERTYPE_IPV6);
+}
+
+static int arp_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return network_input(p, in, ETHERTYPE_ARP);
+}
+
+
+/**
+ * @brief Set the input of a transport layer
+ *
+ * The bytes handed over are limited to the IP payload, as cast_ipv4() and
+ * cast_ipv6() do.
+ *
+ * @param p The packet
+ * @param in The input to fill
+ * @param layer The LAYER_* flag of the layer
+ * @return int 1 if the packet carries the layer, 0 otherwise
+ */
+static int transport_input(const struct bench_packet *p,
+                           struct bench_input *in, uint16_t layer)
+{
+    const struct packet_info *pi = &p->pi;
+    if (!(pi->layers & layer))
+        return 0;
+
+    uint32_t end = (uint32_t)pi->l3_off + pi->l3_len;
+    if (end < pi->l4_off || (end == pi->l4_off && pi->ip_version == 6) ||
+        end > pi->caplen) // Not limited
+        end = pi->caplen;
+    return input_at(p, in, pi->l4_off, end,
+                    LAYER_ETH | LAYER_IPV4 | LAYER_IPV6);
+}
+
+static int tcp_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return transport_input(p, in, LAYER_TCP);
+}
+
+static int udp_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return transport_input(p, in, LAYER_UDP);
+}
+
+static int icmp_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return transport_input(p, in, LAYER_ICMP);
+}
+
+static int icmp6_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return transport_input(p, in, LAYER_ICMP6);
+}
+
+
+/**
+ * @brief Set the input of an application dissector
+ *
+ * @param p The packet
+ * @param in The input to fill
+ * @param app The application protocol, enum app_proto
+ * @param alias Another protocol the dissector decodes, APP_NONE for none
+ * @return int 1 if the packet carries the protocol, 0 otherwise
+ */
+static int app_input(const struct bench_packet *p, struct bench_input *in,
+                     uint8_t app, uint8_t alias)
+{
+    const struct packet_info *pi = &p->pi;
+    if (!(pi->layers & LAYER_APP) ||
+        (pi->app_proto != app && (alias == APP_NONE || pi->app_proto != alias)))
+        return 0;
+    return input_at(p, in, pi->l7_off, (uint32_t)pi->l7_off + pi->l7_len,
+                    pi->layers & ~(LAYER_APP | LAYER_TRUNCATED));
+}
+
+static int dns_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return app_input(p, in, APP_DNS, APP_NONE);
+}
+
+static int bootp_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return app_input(p, in, APP_BOOTP, APP_NONE);
+}
+
+static int tls_input(const struct bench_packet *p, struct bench_input *in)
+{
+    return app_input(p, in, APP_HTTPS, APP_IMAPS);
+}
+
+static const struct bench_case cases[] = {
+    {"decode", NULL, NULL, NULL},
+    {"text", render_text, NULL, NULL},
+    {"ndjson", render_ndjson, NULL, NULL},
+    {"ethernet", NULL, cast_ethernet, link_input},
+    {"ipv4", NULL, cast_ipv4, ipv4_input},
+    {"ipv6", NULL, cast_ipv6, ipv6_input},
+    {"arp", NULL, cast_arp, arp_input},
+    {"tcp", NULL, cast_tcp, tcp_input},
+    {"udp", NULL, cast_udp, udp_input},
+    {"icmp", NULL, cast_icmp, icmp_input},
+    {"icmp6", NULL, cast_icmp6, icmp6_input},
+    {"dns", NULL, cast_dns, dns_input},
+    {"bootp", NULL, cast_bootp, bootp_input},
+    {"tls", NULL, cast_tls, tls_input},
+}; /**< The cases run on each capture */
+
+
+/**
+ * @brief Load the packets of a capture in memory
+ *
+ * The packets are copied out of the mapped file, one after the other, and
+ * decoded once.
+ *
+ * @param file The capture file
+ * @param pkts The packets, set on success
+ * @param buf The bytes of the packets, set on success
+ * @return int The number of packets, 0 if the capture can't be benchmarked,
+ * -1 on error
+ */
+static int load_capture(const char *file, struct bench_packet **pkts,
+                        u_char **buf)
+{
+    struct pcapfile *pf = pcapfile_open(file);
+    if (pf == NULL) {
+        fprintf(stderr, "%s: skipped, not a pcap or pcapng file\n", file);
+        return 0;
+    }
+    if (pf->linktype != DLT_EN10MB) {
+        fprintf(stderr, "%s: skipped, link type %d\n", file, pf->linktype);
+        pcapfile_close(pf);
+        return 0;
+    }
+
+    struct bench_packet *p = NULL;
+    size_t count = 0, size = 0, len = 0;
+    struct pcap_pkthdr header;
+    const unsigned char *data;
+    int ret;
+    while ((ret = pcapfile_next(pf, &header, &data)) == 1) {
+        if (count == size) {
+            size = size ? size * 2 : 1024;
+            struct bench_packet *np = realloc(p, size * sizeof(*p));
+            if (np == NULL) {
+                perror("realloc");
+                break;
+            }
+            p = np;
+        }
+        p[count].header = header;
+        p[count].data = data; // In the mapping until the copy below
+        len += (header.caplen + 15) & ~(size_t)15; // Aligned as a capture buffer
+        count++;
+    }
+
+    u_char *bytes = ret == 0 ? malloc(len ? len : 1) : NULL;
+    if (bytes == NULL) {
+        if (ret == 0)
+            perror("malloc");
+        else if (pf->err[0])
+            fprintf(stderr, "%s: %s\n", file, pf->err);
+        pcapfile_close(pf);
+        free(p);
+        return (-1);
+    }
+    len = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(bytes + len, p[i].data, p[i].header.caplen);
+        p[i].data = bytes + len;
+        len += (p[i].header.caplen + 15) & ~(size_t)15;
+    }
+    pcapfile_close(pf);
+    if (count == 0) {
+        free(p);
+        free(bytes);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        decode_packet(p[i].header.ts, p[i].header.caplen, p[i].header.len,
+                      p[i].data, &p[i].pi);
+    *pkts = p;
+    *buf = bytes;
+    return count;
+}
+
+
+/**
+ * @brief Run a case once on every packet
+ *
+ * @param c The case
+ * @param pkts The packets, for decode_packet()
+ * @param in The inputs, for a dissector
+ * @param n The number of packets or inputs
+ */
+static void run_pass(const struct bench_case *c, const struct bench_packet *pkts,
+                     const struct bench_input *in, unsigned n)
+{
+    struct packet_info pi;
+    if (c->cast != NULL) {
+        for (unsigned i = 0; i < n; i++) {
+            struct packet_view v = in[i].v;
+            pi = in[i].pi;
+            arena_reset(); // As decode_packet() does
+            c->cast(&v, &pi);
+        }
+        return;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        decode_packet(pkts[i].header.ts, pkts[i].header.caplen,
+                      pkts[i].header.len, pkts[i].data, &pi);
+        if (c->render != NULL) {
+            c->render(&pi, decode_data(&pi, pkts[i].data), i + 1);
+            sink.len = 0;
+        }
+    }
+}
+
+
+/**
+ * @brief Time a case
+ *
+ * The case runs once to warm up, then in BENCH_TRIALS trials of at least
+ * min_ms / BENCH_TRIALS each, the fastest one is kept.
+ *
+ * @param c The case
+ * @param pkts The packets
+ * @param in The inputs
+ * @param n The number of packets or inputs
+ * @param min_ms The time to run for, in milliseconds
+ * @param res The result to fill
+ *
+ * @see run_pass
+ */
+static void time_case(const struct bench_case *c,
+                      const struct bench_packet *pkts,
+                      const struct bench_input *in, unsigned n, int min_ms,
+                      struct bench_result *res)
+{
+    long long trial_ns = (long long)min_ms * 1000000LL / BENCH_TRIALS;
+    unsigned long long passes = 0;
+    double best = 0;
+
+    run_pass(c, pkts, in, n);
+    unsigned long long allocs = alloc_count();
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+        unsigned long long k = 0;
+        long long start = now_ns(), elapsed;
+        do {
+            run_pass(c, pkts, in, n);
+            k++;
+            elapsed = now_ns() - start;
+        } while (elapsed < trial_ns);
+        double ns = (double)elapsed / ((double)k * n);
+        if (t == 0 || ns < best)
+            best = ns;
+        passes += k;
+    }
+    res->packets = n;
+    res->ns = best;
+    res->allocs = (double)(alloc_count() - allocs) / ((double)passes * n);
+}
+
+
+/**
+ * @brief Append a result
+ *
+ * @param rs The results
+ * @return struct bench_result* The result to fill, NULL on error
+ */
+static struct bench_result *result_add(struct bench_results *rs)
+{
+    if (rs->count == rs->size) {
+        unsigned size = rs->size ? rs->size * 2 : 64;
+        struct bench_result *r = realloc(rs->r, size * sizeof(*r));
+        if (r == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        rs->r = r;
+        rs->size = size;
+    }
+    struct bench_result *r = &rs->r[rs->count++];
+    memset(r, 0, sizeof(*r));
+    return r;
+}
+
+
+/**
+ * @brief Find a result
+ *
+ * @param rs The results
+ * @param capture The capture name
+ * @param name The case name
+ * @return const struct bench_result* The result, NULL if none
+ */
+static const struct bench_result *result_find(const struct bench_results *rs,
+                                              const char *capture,
+                                              const char *name)
+{
+    for (unsigned i = 0; i < rs->count; i++)
+        if (strcmp(rs->r[i].capture, capture) == 0 &&
+            strcmp(rs->r[i].name, name) == 0)
+            return &rs->r[i];
+    return NULL;
+}
+
+
+/**
+ * @brief Run every case on a capture
+ *
+ * The standard error is discarded while the cases run, as the output is.
+ *
+ * @param file The capture file
+ * @param min_ms The time each case runs for, in milliseconds
+ * @param rs The results to append to
+ * @return int 0 on success, -1 on error
+ *
+ * @see load_capture
+ * @see time_case
+ */
+static int bench_capture(const char *file, int min_ms, struct bench_results *rs)
+{
+    struct bench_packet *pkts;
+    u_char *bytes;
+    int n = load_capture(file, &pkts, &bytes);
+    if (n <= 0)
+        return n;
+
+    struct bench_input *in = malloc(n * sizeof(*in));
+    if (in == NULL) {
+        perror("malloc");
+        free(pkts);
+        free(bytes);
+        return (-1);
+    }
+    const char *name = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+
+    fflush(stderr);
+    int err = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (err >= 0 && null >= 0)
+        dup2(null, STDERR_FILENO);
+
+    int ret = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        unsigned m = n;
+        if (cases[c].cast != NULL) {
+            m = 0;
+            for (int i = 0; i < n; i++)
+                m += cases[c].input(&pkts[i], &in[m]);
+        }
+        if (m == 0)
+            continue;
+        struct bench_result *r = result_add(rs);
+        if (r == NULL) {
+            ret = -1;
+            break;
+        }
+        snprintf(r->capture, sizeof(r->capture), "%s", name);
+        snprintf(r->name, sizeof(r->name), "%s", cases[c].name);
+        time_case(&cases[c], pkts, in, m, min_ms, r);
+    }
+
+    if (err >= 0 && null >= 0)
+        dup2(err, STDERR_FILENO);
+    if (err >= 0)
+        close(err);
+    if (null >= 0)
+        close(null);
+    free(in);
+    free(pkts);
+    free(bytes);
+    return ret;
+}
+
+
+/**
+ * @brief Load a baseline
+ *
+ * The file is read as written by write_results(), one result per line.
+ *
+ * @param file The baseline file
+ * @param rs The results to fill
+ * @return int 0 on success, -1 on error
+ */
+static int load_baseline(const char *file, struct bench_results *rs)
+{
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        return (-1);
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        struct bench_result b;
+        double pps;
+        if (sscanf(line,
+                   " {\"capture\": \"%63[^\"]\", \"case\": \"%15[^\"]\", "
+                   "\"packets\": %u, \"ns_per_packet\": %lf, "
+                   "\"packets_per_s\": %lf, \"allocs_per_packet\": %lf",
+                   b.capture, b.name, &b.packets, &b.ns, &pps, &b.allocs) != 6)
+            continue;
+        struct bench_result *r = result_add(rs);
+        if (r == NULL) {
+            fclose(f);
+            return (-1);
+        }
+        *r = b;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+/**
+ * @brief Write results as JSON
+ *
+ * @param file The file to write
+ * @param rs The results
+ * @return int 0 on success, -1 on error
+ */
+static int write_results(const char *file, const struct bench_results *rs)
+{
+    FILE *f = fopen(file, "w");
+    if (f == NULL) {
+        perror(file);
+        return (-1);
+    }
+    fprintf(f, "{\n  \"results\": [\n");
+    for (unsigned i = 0; i < rs->count; i++) {
+        const struct bench_result *r = &rs->r[i];
+        fprintf(f,
+                "    {\"capture\": \"%s\", \"case\": \"%s\", \"packets\": %u, "
+                "\"ns_per_packet\": %.1f, \"packets_per_s\": %.0f, "
+                "\"allocs_per_packet\": %.3f}%s\n",
+                r->capture, r->name, r->packets, r->ns, 1e9 / r->ns, r->allocs,
+                i + 1 < rs->count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f) != 0) {
+        perror(file);
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Print the results, compared to the baseline
+ *
+ * @param rs The results
+ * @param base The baseline, empty for none
+ * @param threshold The slowdown reported, in percent of the baseline
+ * @return int The number of cases allocating more than in the baseline
+ */
+static int print_results(const struct bench_results *rs,
+                         const struct bench_results *base, double threshold)
+{
+    int slower = 0, allocating = 0;
+    printf("%-44s %-9s %8s %10s %12s %8s %9s\n", "capture", "case", "packets",
+           "ns/packet", "packets/s", "allocs", "baseline");
+    for (unsigned i = 0; i < rs->count; i++) {
+        const struct bench_result *r = &rs->r[i];
+        printf("%-44s %-9s %8u %10.1f %12.0f %8.3f", r->capture, r->name,
+               r->packets, r->ns, 1e9 / r->ns, r->allocs);
+
+        const struct bench_result *b = result_find(base, r->capture, r->name);
+        if (b == NULL || b->ns <= 0) {
+            printf(" %9s\n", base->count ? "new" : "-");
+            continue;
+        }
+        double change = (r->ns - b->ns) * 100 / b->ns;
+        printf(" %+8.1f%%", change);
+        if (change > threshold) {
+            printf("  SLOWER");
+            slower++;
+        }
+        if (r->allocs > b->allocs + BENCH_ALLOC_SLACK) {
+            printf("  ALLOCS (%.3f)", b->allocs);
+            allocating++;
+        }
+        printf("\n");
+    }
+    if (base->count)
+        printf("\n%u cases, %d slower than the baseline by more than %.0f%%, "
+               "%d allocating more\n",
+               rs->count, slower, threshold, allocating);
+    return allocating;
+}
+
+
+/**
+ * @brief Print the usage
+ *
+ * @param name The program name
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-b baseline] [-o output] [-t percent] [-m ms] "
+            "capture...\n"
+            "  -b  Compare to a baseline written by -o\n"
+            "  -o  Write the results as JSON\n"
+            "  -t  Slowdown reported, in percent of the baseline (%.0f)\n"
+            "  -m  Time each case runs for, in milliseconds (%d)\n",
+            name, BENCH_THRESHOLD, BENCH_MIN_MS);
+}
+
+
+/**
+ * @brief Benchmark the decoding of captures
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int 0 on success, 1 if the allocations went up from the baseline
+ * or on error
+ *
+ * @see bench_capture
+ * @see print_results
+ */
+int main(int argc, char **argv)
+{
+    const char *baseline = NULL, *output = NULL;
+    double threshold = BENCH_THRESHOLD;
+    int min_ms = BENCH_MIN_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:o:t:m:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'm':
+            min_ms = atoi(optarg);
+            if (min_ms <= 0) {
+                fprintf(stderr, "Invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct bench_results base = {0}, rs = {0};
+    if (baseline != NULL && load_baseline(baseline, &base) < 0)
+        return 1;
+
+    dispatch_init();
+    render_init(VERBOSE_COMPLETE);
+    ndjson_init(VERBOSE_COMPLETE);
+    out_bind(&sink);
+
+    int ret = 0;
+    for (int i = optind; i < argc && ret == 0; i++)
+        ret = bench_capture(argv[i], min_ms, &rs);
+
+    out_bind(NULL);
+    if (ret == 0 && print_results(&rs, &base, threshold) > 0)
+        ret = -1;
+    if (ret == 0 && output != NULL)
+        ret = write_results(output, &rs);
+
+    free(sink.data);
+    free(rs.r);
+    free(base.r);
+    arena_release();
+    dns_name_release();
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * @author Flavien Lallemant
+ * @file alloc.h
+ * @brief Allocation counter declaration
+ *
+ * This file contains the declaration of the counter of the malloc and free
+ * calls, used to check the capture loop allocates nothing per packet.
+ * The counter is only built with make DEBUG=1 and in the benchmarks, which
+ * link the allocation functions through it; otherwise the functions below do nothing.
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+
+#ifdef ALLOC_COUNT
+
+/**
+ * @brief Start counting the allocations
+ */
+void alloc_mark(void);
+
+/**
+ * @brief Print the allocations counted since alloc_mark()
+ *
+ * @param stream The stream to print to
+ */
+void alloc_report(FILE *stream);
+
+/**
+ * @brief Get the number of allocations counted so far
+ *
+ * @return unsigned long long The calls to malloc, calloc and realloc
+ */
+unsigned long long alloc_count(void);
+
+#else
+
+static inline void alloc_mark(void)
+{
+}
+
+static inline void alloc_report(FILE *stream)
+{
+    (void)stream;
+}
+
+static inline unsigned long long alloc_count(void)
+{
+    return 0;
+}
+
+#endif // ALLOC_COUNT
+
+#endif // ALLOC_H
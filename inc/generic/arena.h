@@ -0,0 +1,42 @@
+/**
+ * @author Flavien Lallemant
+ * @file arena.h
+ * @brief Per-packet scratch memory declaration
+ *
+ * This file contains the declaration of the bump arena the dissectors take
+ * their per-packet scratch memory from.
+ * Each thread has its own arena, rewound when the thread starts decoding the
+ * next packet: an allocation is valid until then, and is never freed on its
+ * own. The blocks are kept across packets, so once the arena has grown to the
+ * largest packet it needs no more malloc.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024) /**< Size of an arena block */
+
+
+/**
+ * @brief Allocate scratch memory for the current packet
+ *
+ * @param size The number of bytes
+ * @return void* The memory, aligned on 16 bytes, NULL if out of memory
+ */
+void *arena_alloc(size_t size);
+
+/**
+ * @brief Rewind the arena of the calling thread
+ *
+ * Every allocation made since the previous reset becomes invalid.
+ */
+void arena_reset(void);
+
+/**
+ * @brief Free the blocks of the calling thread
+ */
+void arena_release(void);
+
+#endif // ARENA_H
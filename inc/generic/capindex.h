@@ -0,0 +1,108 @@
+/**
+ * @author Flavien Lallemant
+ * @file capindex.h
+ * @brief Capture file index declaration
+ *
+ * This file contains the declaration of the index written next to a capture
+ * dump, in <dump>.idx, and of its use to read only a part of the dump.
+ * The index holds the offset of the first record of each non-empty time
+ * bucket, and for each flow the offsets of its records, as varint deltas.
+ * Reading a time range seeks to its first bucket and stops after its last
+ * one; reading a flow jumps from one of its records to the next.
+ * Without an index, a time range is read by skipping the other packets.
+ */
+
+#ifndef CAPINDEX_H
+#define CAPINDEX_H
+
+#include <pcap.h>
+
+#include "flow.h"
+#include "pcapfile.h"
+
+#define CAPINDEX_BUCKET 1 /**< Default seconds per time bucket */
+
+struct capindex_writer;
+
+/**
+ * @brief Part of a capture file to read
+ */
+struct capindex_query {
+    struct timeval from;    /**< First time to read, 0 for the start */
+    struct timeval to;      /**< Last time to read, 0 for the end */
+    struct flow_key flow;   /**< Flow to read */
+    int has_flow;           /**< 1 to read only the flow */
+};
+
+
+/**
+ * @brief Start the index of a dump
+ *
+ * @param dump The path of the dump, the index goes to <dump>.idx
+ * @param linktype The link type of the packets, flows are only indexed for
+ * Ethernet
+ * @param bucket Seconds per time bucket, 0 for the default
+ * @return struct capindex_writer* The index, NULL on error
+ */
+struct capindex_writer *capindex_create(const char *dump, int linktype,
+                                        unsigned bucket);
+
+/**
+ * @brief Index a packet of the dump
+ *
+ * @param w The index
+ * @param header The packet header
+ * @param packet The packet
+ * @param offset The offset of its record in the dump
+ */
+void capindex_add(struct capindex_writer *w, const struct pcap_pkthdr *header,
+                  const u_char *packet, long offset);
+
+/**
+ * @brief Write the index and free it
+ *
+ * @param w The index
+ * @param size The size of the dump, -1 if unknown
+ * @return int 0 on success, -1 on error
+ */
+int capindex_close(struct capindex_writer *w, long size);
+
+/**
+ * @brief Parse a time
+ *
+ * The time is in seconds since the epoch, or YYYY-MM-DD HH:MM:SS in local
+ * time, with a 'T' allowed between date and time. Both take an optional
+ * fraction of a second.
+ *
+ * @param str The time
+ * @param tv The time to fill
+ * @return int 0 on success, -1 on error
+ */
+int capindex_parse_time(const char *str, struct timeval *tv);
+
+/**
+ * @brief Parse a flow
+ *
+ * The flow is written proto,address,port,address,port, with proto among tcp,
+ * udp, sctp, icmp, icmp6 or a number. The endpoints can be in either order.
+ *
+ * @param str The flow
+ * @param key The key to fill
+ * @return int 0 on success, -1 on error
+ */
+int capindex_parse_flow(const char *str, struct flow_key *key);
+
+/**
+ * @brief Limit a reader to a part of its file
+ *
+ * The index of the file is used if there is one. A flow needs the index.
+ *
+ * @param pf The reader, not read yet
+ * @param file The path of the file
+ * @param q The part to read
+ * @return int 0 on success, -1 on error
+ */
+int capindex_select(struct pcapfile *pf, const char *file,
+                    const struct capindex_query *q);
+
+#endif // CAPINDEX_H
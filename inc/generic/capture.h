@@ -0,0 +1,285 @@
+/**
+ * @author Flavien Lallemant
+ * @file capture.h
+ * @brief Capture backend declaration
+ *
+ * This file contains the declaration of the capture backend.
+ * Packets are read from a file or a live interface through libpcap, or on
+ * Linux straight from a TPACKET_V3 ring shared with the kernel, in which case
+ * the callback reads the packets in place, without copy nor system call per
+ * packet. Regular pcap and pcapng files are mapped and read in place the same
+ * way.
+ * The packet headers keep the microsecond times the decoders read, and the
+ * nanoseconds of the time of each packet are kept beside them when the
+ * source has them.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pcap.h>
+#include <signal.h>
+
+#include "pcapfile.h"
+
+#define CAPTURE_SNAPLEN 65535 /**< Default number of bytes to capture per packet */
+#define CAPTURE_TIMEOUT 1000 /**< Default read timeout in milliseconds */
+#define CAPTURE_BLOCK_SIZE (1 << 20) /**< Default size of a ring block */
+#define CAPTURE_FRAME_SIZE 2048 /**< Size of a ring frame */
+#define CAPTURE_FRAME_COUNT 8192 /**< Default number of ring frames */
+#define CAPTURE_BATCH 64 /**< Default number of packets of a batch */
+
+/**
+ * @brief How the packets of an interface are spread over a fanout group
+ */
+enum capture_fanout {
+    CAPTURE_FANOUT_NONE,    /**< No fanout group, the socket gets every packet */
+    CAPTURE_FANOUT_HASH,    /**< By hash of the flow, so a flow stays on one socket */
+    CAPTURE_FANOUT_CPU,     /**< By the CPU the packet was received on */
+    CAPTURE_FANOUT_LB       /**< In turn, regardless of the flow */
+};
+
+/**
+ * @brief Capture configuration
+ */
+struct capture_config {
+    const char *interface;  /**< Interface to capture on */
+    int snaplen;            /**< Bytes captured per packet, 0 for the default */
+    int promisc;            /**< 1 to capture in promiscuous mode */
+    int timeout;            /**< Read timeout in milliseconds, 0 for the default */
+    int buffer_size;        /**< Kernel buffer size in bytes, 0 for the libpcap default */
+    int immediate;          /**< 1 to deliver packets as soon as they arrive */
+    int ring;               /**< 1 to read a TPACKET_V3 ring directly */
+    unsigned block_size;    /**< Size of a ring block, 0 for the default */
+    unsigned frame_count;   /**< Number of ring frames, 0 for the default */
+    int fanout;             /**< How to join the fanout group, enum capture_fanout */
+    unsigned fanout_group;  /**< The fanout group, shared by the sockets of an interface */
+};
+
+/**
+ * @brief Function called when a live capture waits for packets
+ *
+ * It is called from the thread of the loop each time the read timeout
+ * expires without a packet, so what is kept until the next packet, like the
+ * buffered output, doesn't wait for it on an idle link.
+ *
+ * @param user The argument given to capture_set_idle()
+ */
+typedef void (*capture_idle_handler)(u_char *user);
+
+/**
+ * @brief Capture handle
+ *
+ * The pcap handle is a real one, or a dead one used to compile the filters
+ * and write the dump files in ring mode or when the file is mapped.
+ */
+struct capture {
+    pcap_t *pcap;                   /**< The libpcap handle */
+    int snaplen;                    /**< Bytes captured per packet */
+    int timeout;                    /**< Read timeout in milliseconds */
+    int fd;                         /**< The ring socket, -1 without ring */
+    unsigned char *ring;            /**< The mapped ring */
+    unsigned block_size;            /**< Size of a ring block */
+    unsigned block_count;           /**< Number of ring blocks */
+    unsigned block;                 /**< Next block to read */
+    volatile sig_atomic_t stop;     /**< Set to leave the ring loop */
+    int offline;                    /**< 1 if the packets are read from a file */
+    int nano;                       /**< 1 if libpcap gives the times in nanoseconds */
+    struct pcapfile *file;          /**< The mapped file, NULL through libpcap */
+    struct bpf_program filter;      /**< The filter of the mapped file */
+    int part;                       /**< 1 if the handle reads a part of the file of another */
+    int truncate;                   /**< 1 to cut the packets read from a file to snaplen */
+    pcap_handler callback;          /**< The callback of the truncating loop */
+    u_char *user;                   /**< The argument of the truncating loop */
+    unsigned long long ring_packets; /**< Packets the ring received, read from the kernel so far */
+    unsigned long long ring_drops;  /**< Packets the ring dropped, read from the kernel so far */
+    int fanout;                     /**< The PACKET_FANOUT argument of the ring, 0 for none */
+    int vlan;                       /**< 1 to put back the VLAN tags the kernel strips from the Ethernet frames of the ring */
+    capture_idle_handler idle;      /**< Called when the read timeout expires, NULL for none */
+    u_char *idle_user;              /**< Its argument */
+};
+
+/**
+ * @brief Kernel counters of a live capture
+ */
+struct capture_stats {
+    unsigned long long received;    /**< Packets received, dropped ones included */
+    unsigned long long dropped;     /**< Packets dropped for lack of room in the buffer */
+    unsigned long long ifdropped;   /**< Packets dropped by the interface or its driver */
+};
+
+/**
+ * @brief Packet of a batch
+ */
+struct capture_packet {
+    struct pcap_pkthdr header;  /**< The packet header */
+    const u_char *data;         /**< The packet */
+    uint32_t nsec;              /**< Nanoseconds of the second of its time */
+};
+
+/**
+ * @brief Part of a mapped capture file
+ */
+struct capture_part {
+    struct capture *cap;        /**< The handle reading the part */
+    unsigned long long first;   /**< Number of packets of the file before the part */
+    int count;                  /**< Packets to read from the part, 0 for all */
+};
+
+/**
+ * @brief Function called for each batch of packets
+ *
+ * The packets are valid until the function returns.
+ *
+ * @param user The first argument given to capture_loop_batch()
+ * @param pkts The packets, in capture order
+ * @param n The number of packets
+ */
+typedef void (*capture_batch_handler)(u_char *user,
+                                      const struct capture_packet *pkts, int n);
+
+/**
+ * @brief Open a capture file
+ *
+ * @param file The file to read
+ * @param snaplen Bytes kept per packet, 0 to keep what the file holds
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct capture* The handle, NULL on error
+ */
+struct capture *capture_open_offline(const char *file, int snaplen,
+                                     char *errbuf);
+
+/**
+ * @brief Open a live capture
+ *
+ * With a fanout group, on Linux only, the kernel spreads the packets of the
+ * interface over the sockets of the group, each opened by its own call.
+ *
+ * @param cfg The configuration
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct capture* The handle, NULL on error
+ */
+struct capture *capture_open_live(const struct capture_config *cfg,
+                                  char *errbuf);
+
+/**
+ * @brief Compile and set a filter
+ *
+ * The program is optimized. A warning is printed if a live capture has to run
+ * it in userspace, the kernel having refused it.
+ *
+ * @param cap The handle
+ * @param expr The filter expression, NULL for no filter
+ * @param netmask The netmask of the network, PCAP_NETMASK_UNKNOWN if unknown
+ * @param dump 1 to print the program and where it runs
+ * @return int 0 on success, -1 on error
+ */
+int capture_setfilter(struct capture *cap, const char *expr,
+                      bpf_u_int32 netmask, int dump);
+
+/**
+ * @brief Read packets
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+int capture_loop(struct capture *cap, int count, pcap_handler callback,
+                 u_char *user);
+
+/**
+ * @brief Set the function called when a live capture waits for packets
+ *
+ * @param cap The handle
+ * @param idle The function, NULL for none
+ * @param user Its argument
+ */
+void capture_set_idle(struct capture *cap, capture_idle_handler idle,
+                      u_char *user);
+
+/**
+ * @brief Keep the nanoseconds of the packet given on the calling thread
+ *
+ * The capture loops call it before giving each packet, a batch handler
+ * before handing on each packet of its batch.
+ *
+ * @param header The packet header
+ * @param nsec The nanoseconds of the second of its time
+ */
+void capture_set_nsec(const struct pcap_pkthdr *header, uint32_t nsec);
+
+/**
+ * @brief Get the nanoseconds of the time of a packet given on the calling
+ * thread
+ *
+ * @param header The packet header
+ * @return uint32_t The nanoseconds of the second, its microseconds in
+ * nanoseconds if they weren't kept
+ */
+uint32_t capture_nsec(const struct pcap_pkthdr *header);
+
+/**
+ * @brief Read packets by batches
+ *
+ * Through libpcap, each batch is what pcap_dispatch() returns, copied so the
+ * packets stay valid together. From a ring or a mapped file, the packets of a
+ * batch are read in place.
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param batch The largest number of packets of a batch, 0 for the default
+ * @param handler The function called for each batch
+ * @param user The first argument of the handler
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+int capture_loop_batch(struct capture *cap, int count, int batch,
+                       capture_batch_handler handler, u_char *user);
+
+/**
+ * @brief Split a mapped capture file in parts
+ *
+ * The file is scanned once for its record boundaries, and cut in parts of
+ * about the same size. The packets not matching the filter are not counted.
+ * Each part has its own handle, read by capture_loop() from its own thread,
+ * and to close with capture_close() before cap.
+ *
+ * @param cap The handle, of a mapped file not read yet
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param parts The parts to fill
+ * @param n The largest number of parts
+ * @return int The number of parts, -1 on error
+ */
+int capture_split(struct capture *cap, int count, struct capture_part *parts,
+                  int n);
+
+/**
+ * @brief Read the kernel counters of a live capture
+ *
+ * The counters cover the capture since it was opened. The ring doesn't count
+ * the packets dropped by the interface.
+ *
+ * @param cap The handle
+ * @param st The counters to fill
+ * @return int 0 on success, -1 for a capture file or on error
+ */
+int capture_stats(struct capture *cap, struct capture_stats *st);
+
+/**
+ * @brief Stop capture_loop() or capture_loop_batch()
+ *
+ * This function can be called from a signal handler.
+ *
+ * @param cap The handle
+ */
+void capture_breakloop(struct capture *cap);
+
+/**
+ * @brief Close a capture
+ *
+ * @param cap The handle
+ */
+void capture_close(struct capture *cap);
+
+#endif // CAPTURE_H
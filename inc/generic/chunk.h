@@ -0,0 +1,53 @@
+/**
+ * @author Flavien Lallemant
+ * @file chunk.h
+ * @brief Parallel capture file analysis declaration
+ *
+ * This file contains the declaration of the analysis of a mapped capture file
+ * split in parts, one thread per part.
+ * Each thread decodes its part with its own counters and flow table, merged
+ * at the end in file order. The packets keep the number they have in the
+ * whole file, and the text of the parts is written in file order, so the
+ * output is the one of a single thread.
+ */
+
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include "capture.h"
+#include "render.h"
+#include "stats.h"
+
+#define CHUNK_SPILL (256 * 1024) /**< Bytes of text a thread buffers before writing them */
+
+/**
+ * @brief Parallel analysis configuration
+ */
+struct chunk_config {
+    int workers;            /**< Number of parts, 0 or less for one per core */
+    int count;              /**< Number of packets to read, 0 or less for no limit */
+    renderer_t render;      /**< Renderer of the packets, NULL to only count them */
+    struct stats *stats;    /**< Counters the parts are added to without renderer */
+};
+
+
+/**
+ * @brief Decode a mapped capture file on several threads
+ *
+ * The text of the first part is written as it is rendered, the text of the
+ * others goes to temporary files until the parts before them are written.
+ *
+ * @param cap The handle, of a mapped file not read yet
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int chunk_run(struct capture *cap, const struct chunk_config *cfg);
+
+/**
+ * @brief Stop the threads of chunk_run()
+ *
+ * This function can be called from a signal handler.
+ */
+void chunk_stop(void);
+
+#endif // CHUNK_H
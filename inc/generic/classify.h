@@ -0,0 +1,39 @@
+/**
+ * @author Flavien Lallemant
+ * @file classify.h
+ * @brief Payload classifier declaration
+ *
+ * This file contains the declaration of the classifier recognizing the text
+ * protocols from the first bytes of their payload.
+ * The commands, responses and return codes of every protocol are compiled
+ * once into a single prefix trie, so a payload is matched against all of
+ * them in one walk of at most CLASSIFY_LEN bytes.
+ */
+
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include "decode.h"
+#include "types.h"
+
+#define CLASSIFY_LEN 16 /**< Payload bytes looked at by the classifier */
+
+#define CLASSIFY_MASK(app) (1u << (app)) /**< Bit of a protocol in a classification */
+
+
+/**
+ * @brief Compile the protocol signatures
+ */
+void classify_init(void);
+
+/**
+ * @brief Classify a payload
+ *
+ * @param payload The payload
+ * @param size The size of the payload
+ * @return uint16_t The protocols with a signature the payload starts with,
+ * CLASSIFY_MASK() bits
+ */
+uint16_t classify_payload(const u_char *payload, uint32_t size);
+
+#endif // CLASSIFY_H
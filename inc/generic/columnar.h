@@ -0,0 +1,55 @@
+/**
+ * @author Flavien Lallemant
+ * @file columnar.h
+ * @brief Columnar packet export declaration
+ *
+ * This file contains the declaration of the renderer writing the decoded
+ * fields of the packets as an Apache Arrow IPC stream, which analytics tools
+ * load without parsing: a schema message, then record batches of a fixed
+ * number of rows, each column stored as one contiguous buffer.
+ * The columns are the timestamp, the lengths, the MAC addresses, the
+ * Ethernet type, the IP version, addresses, protocol and TTL, the ports, the
+ * TCP flags, the application protocol and the first DNS question of UDP
+ * messages. A field the packet does not have is null.
+ * IPv4 addresses are written mapped in IPv6, ::ffff:a.b.c.d.
+ */
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "decode.h"
+
+#define COLUMNAR_ROWS 65536 /**< Default rows of a record batch */
+
+
+/**
+ * @brief Allocate the columns and write the schema
+ *
+ * The stream is written to the output buffer.
+ *
+ * @param rows Rows of a record batch, 0 for the default
+ * @return int 0 on success, -1 on error
+ */
+int columnar_init(unsigned rows);
+
+/**
+ * @brief Add a decoded packet to the record batch
+ *
+ * The batch is written once full. The packets must be given in capture
+ * order, by one thread.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ */
+void render_columnar(const struct packet_info *pi, const u_char *packet,
+                     unsigned long number);
+
+/**
+ * @brief Write the last record batch and the end of the stream
+ *
+ * The columns are freed.
+ */
+void columnar_close(void);
+
+#endif // COLUMNAR_H
@@ -0,0 +1,311 @@
+/**
+ * @author Flavien Lallemant
+ * @file decode.h
+ * @brief Packet decoding declaration
+ *
+ * This file contains the definition of the structure filled by the decoding
+ * stage, and the declaration of the decoding entry point.
+ * Decoding does no I/O: the result is printed by a renderer, or used by the
+ * filters, statistics and flow tracking directly.
+ * The application protocols are only looked for when something needs them,
+ * the layers stop at the depth recorded in the decoded packet.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <sys/time.h>
+#include "types.h"
+#include "view.h"
+
+/**
+ * @brief Decoded layers
+ *
+ * Flags set in packet_info.layers for each decoded layer.
+ */
+#define LAYER_ETH 0x0001
+#define LAYER_ARP 0x0002
+#define LAYER_IPV4 0x0004
+#define LAYER_IPV6 0x0008
+#define LAYER_ICMP 0x0010
+#define LAYER_ICMP6 0x0020
+#define LAYER_TCP 0x0040
+#define LAYER_UDP 0x0080
+#define LAYER_APP 0x0100
+#define LAYER_STREAM 0x0200 /**< The application layer was decoded from reassembled bytes */
+#define LAYER_PLUGIN 0x0400 /**< A plugin dissector decoded a payload, app_proto is its protocol */
+#define LAYER_SLL 0x0800 /**< Linux cooked capture header, v1 or v2 */
+#define LAYER_ENCAP 0x1000 /**< Encapsulation headers were peeled, see packet_info.encap */
+#define LAYER_FRAG 0x2000 /**< An IP fragment, decoded no further than its IP header */
+#define LAYER_DEFRAG 0x4000 /**< The datagram completed by the packet was decoded, see decode_data() */
+#define LAYER_TRUNCATED 0x8000 /**< Decoding stopped at the end of the captured bytes */
+
+#define DECODE_FILTERED 1 /**< Returned by decode_packet for a packet the display filter rejects */
+#define APP_PLUGINS 8 /**< Application protocols left to the plugin dissectors */
+
+/**
+ * @brief Application protocols
+ *
+ * Application protocols recognized by the transport layers, then the ones
+ * given to the plugin dissectors as they register.
+ */
+enum app_proto {
+    APP_NONE = 0,
+    APP_HTTP,
+    APP_HTTPS,
+    APP_SMTP,
+    APP_FTP,
+    APP_DNS,
+    APP_POP,
+    APP_IMAP,
+    APP_IMAPS,
+    APP_TELNET,
+    APP_BOOTP,
+    APP_PLUGIN,     /**< The first protocol of a plugin dissector */
+    APP_COUNT = APP_PLUGIN + APP_PLUGINS
+};
+
+/**
+ * @brief Decoding depths
+ *
+ * Deepest layer decoded, the transport layers dispatch their payload to the
+ * application dissectors only at DECODE_APP.
+ */
+enum decode_depth {
+    DECODE_TRANSPORT,   /**< Up to the transport headers */
+    DECODE_APP,         /**< Up to the application protocol */
+};
+
+/**
+ * @brief Decoded packet
+ *
+ * This structure contains everything the decoding stage extracts from a packet.
+ * It has a fixed size of two cache lines: the first one holds the fields used
+ * by the filters, statistics and flow tracking, the second one the fields only
+ * needed for display.
+ * Every offset is relative to the start of the packet, addresses and ports are
+ * stored in host byte order except IP addresses which are kept as on the wire.
+ */
+struct packet_info {
+    /* First cache line */
+    uint32_t caplen;            /**< Captured length, of the datagram with LAYER_DEFRAG */
+    uint32_t len;               /**< Length on the wire */
+    uint16_t layers;            /**< Decoded layers, LAYER_* flags */
+    uint16_t ethertype;         /**< Ethernet type */
+    uint8_t ip_version;         /**< IP version, 0 if no IP layer */
+    uint8_t ip_proto;           /**< IP protocol or IPv6 next header */
+    uint8_t ip_ttl;             /**< IPv4 TTL or IPv6 hop limit */
+    uint8_t tcp_flags;          /**< TCP flags */
+    uint16_t sport;             /**< Transport source port */
+    uint16_t dport;             /**< Transport destination port */
+    uint8_t app_proto;          /**< Application protocol, enum app_proto */
+    uint8_t depth;              /**< Deepest layer to decode, enum decode_depth */
+    uint16_t l3_off;            /**< Offset of the network layer */
+    uint16_t l4_off;            /**< Offset of the transport layer */
+    uint16_t l7_off;            /**< Offset of the application layer */
+    uint16_t l7_len;            /**< Length of the application payload */
+    uint16_t tcp_window;        /**< TCP window, not scaled */
+    uint8_t ip_src[16];         /**< Source IP, IPv4 uses the 4 first bytes */
+    uint8_t ip_dst[16];         /**< Destination IP, IPv4 uses the 4 first bytes */
+
+    /* Second cache line */
+    struct timeval ts;          /**< Capture timestamp */
+    union {
+        struct {
+            uint32_t tcp_seq;   /**< TCP sequence number */
+            uint32_t tcp_ack;   /**< TCP acknowledgment number */
+        };
+        struct {
+            uint8_t icmp_type;  /**< ICMP or ICMPv6 type */
+            uint8_t icmp_code;  /**< ICMP or ICMPv6 code */
+            uint16_t arp_opcode; /**< ARP operation */
+        };
+        struct {
+            uint32_t frag_id;   /**< Identification of the datagram of a fragment */
+            uint16_t frag_offset; /**< Offset of the fragment in the datagram, in bytes */
+            uint8_t frag_more;  /**< 1 if more fragments follow */
+        };
+    };                          /**< TCP, ICMP, ARP or fragment fields, never decoded together */
+    uint8_t mac_src[6];         /**< Source MAC address, of the innermost Ethernet header */
+    uint8_t mac_dst[6];         /**< Destination MAC address, of the innermost Ethernet header */
+    uint16_t l3_len;            /**< Length of the network layer and its payload */
+    uint16_t vlan;              /**< TCI of the outer 802.1Q tag, with ENCAP_VLAN */
+    uint8_t encap;              /**< Encapsulations peeled, ENCAP_* flags of encap.h */
+    uint8_t encap_count;        /**< Number of encapsulation headers peeled */
+    union {
+        struct {
+            uint8_t sha[6];     /**< Sender hardware address */
+            uint8_t tha[6];     /**< Target hardware address */
+            uint8_t spa[4];     /**< Sender protocol address */
+            uint8_t tpa[4];     /**< Target protocol address */
+            uint8_t ipv4;       /**< 1 if the addresses above are set */
+        } arp;
+        struct {
+            uint16_t id;        /**< Transaction ID */
+            uint16_t flags;     /**< Flags */
+            uint16_t questions; /**< Number of questions */
+            uint16_t answers;   /**< Number of answers */
+        } dns;
+        struct {
+            uint8_t op;         /**< BOOTP operation */
+            uint8_t dhcp;       /**< 1 if the DHCP magic cookie is present */
+            uint8_t msg_type;   /**< DHCP message type, 0 if none */
+        } bootp;
+        struct {
+            uint8_t type;       /**< Record content type */
+            uint8_t version;    /**< Record minor version */
+            uint8_t handshake;  /**< Handshake type of the hello starting the record, 0 if none */
+            uint8_t sni_len;    /**< Length of the server name, 0 if none */
+            uint16_t hello_version; /**< Version chosen by a ServerHello, highest one offered by a ClientHello */
+            uint16_t cipher;    /**< Cipher suite chosen by a ServerHello */
+            uint16_t sni_off;   /**< Offset of the server name in the record */
+            uint16_t alpn_off;  /**< Offset of the first ALPN protocol in the record */
+            uint8_t alpn_len;   /**< Length of the first ALPN protocol, 0 if none */
+        } tls;
+        uint8_t plugin[16];     /**< Free for the plugin dissector of the packet */
+    } u;                        /**< Protocol specific fields */
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct packet_info) == 128,
+               "struct packet_info must fit in two cache lines");
+
+
+/**
+ * @brief Pull a header from a view
+ *
+ * The packet is marked truncated if the header goes past the captured bytes
+ * of a packet cut by the snapshot length.
+ *
+ * @param pi The decoded packet
+ * @param v The view, advanced past the header
+ * @param len The length of the header
+ * @return const void* The header, NULL if it wasn't captured
+ */
+static inline const void *decode_pull(struct packet_info *pi,
+                                      struct packet_view *v, uint32_t len)
+{
+    const void *hdr = view_pull(v, len);
+    if (__builtin_expect(hdr == NULL, 0) && v->off + len > v->caplen &&
+        pi->caplen < pi->len)
+        pi->layers |= LAYER_TRUNCATED;
+    return hdr;
+}
+
+/**
+ * @brief Restrict a view to the payload length announced by a header
+ *
+ * When less was captured, the view keeps the captured bytes and the packet is
+ * marked truncated if it was cut by the snapshot length.
+ *
+ * @param pi The decoded packet
+ * @param v The view
+ * @param len The announced length
+ */
+static inline void decode_limit(struct packet_info *pi, struct packet_view *v,
+                                uint32_t len)
+{
+    if (view_limit(v, len) < 0 && pi->caplen < pi->len)
+        pi->layers |= LAYER_TRUNCATED;
+}
+
+/**
+ * @brief Decode a packet
+ *
+ * This function decodes a packet into a packet_info structure, without any I/O.
+ * The scratch memory of the packet the thread decoded before is reclaimed.
+ * The display filter, if set, is run on the decoded packet.
+ *
+ * @param ts The capture timestamp
+ * @param caplen The captured length
+ * @param len The length on the wire
+ * @param packet The packet to decode
+ * @param pi The structure to fill
+ * @return int 0 if the packet is well decoded, -1 otherwise, DECODE_FILTERED
+ * if the display filter rejects it
+ */
+int decode_packet(struct timeval ts, uint32_t caplen, uint32_t len,
+                  const u_char *packet, struct packet_info *pi);
+
+/**
+ * @brief Set the depth of the decoding
+ *
+ * It must be set before the packets are decoded, DECODE_APP by default.
+ *
+ * @param depth The deepest layer to decode, enum decode_depth
+ */
+void decode_set_depth(enum decode_depth depth);
+
+/**
+ * @brief Limit the depth of the decoding under overload
+ *
+ * The limit applies to the packets decoded after it is set, by any thread;
+ * the depth of decode_set_depth() is kept.
+ *
+ * @param depth The deepest layer to decode, DECODE_APP for no limit
+ */
+void decode_shed_depth(enum decode_depth depth);
+
+/**
+ * @brief Get the bytes a decoded packet refers to
+ *
+ * The offsets of a packet completing an IP datagram refer to the datagram
+ * rebuilt from its fragments, every other packet to the packet itself.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet given to decode_packet()
+ * @return const u_char* The bytes to print the packet from
+ */
+const u_char *decode_data(const struct packet_info *pi, const u_char *packet);
+
+/**
+ * @brief Set the link type of the packets to decode
+ *
+ * It must be set before the packets are decoded, DLT_EN10MB by default.
+ *
+ * @param linktype The DLT_* link type
+ * @return int 0 on success, -1 if the link type isn't supported
+ */
+int decode_set_linktype(int linktype);
+
+struct dfilter;
+
+/**
+ * @brief Set the display filter run on the decoded packets
+ *
+ * It must be set before the packets are decoded, none by default.
+ *
+ * @param f The filter, NULL for none
+ */
+void decode_set_filter(const struct dfilter *f);
+
+/**
+ * @brief Decode the application protocol of a packet decoded up to the
+ * transport layer
+ *
+ * Nothing is done if it was already decoded.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ */
+void decode_app(struct packet_info *pi, const u_char *packet);
+
+/**
+ * @brief Get the name of an application protocol
+ *
+ * @param app The application protocol, enum app_proto
+ * @return const char* The name of the protocol
+ */
+const char *app_proto_name(uint8_t app);
+
+/**
+ * @brief Get the snapshot length needed to decode the headers only
+ *
+ * The length covers the largest link layer, IP and transport headers, plus
+ * the payload bytes the mapped application dissectors need to recognize
+ * their protocol. The headers of the tunnels aren't counted.
+ *
+ * @return int The snapshot length
+ */
+int decode_headers_snaplen(void);
+
+#endif // DECODE_H
@@ -0,0 +1,64 @@
+/**
+ * @author Flavien Lallemant
+ * @file dfilter.h
+ * @brief Display filter declaration
+ *
+ * This file contains the declaration of the display filters of -Y, which
+ * select the packets on their decoded fields, the application ones included,
+ * where the capture filter only sees the bytes of the headers.
+ * A filter is compiled once into a flat program of tests and jumps, so the
+ * remaining tests of an "and" or an "or" are skipped once its result is
+ * known, and the application protocol of a packet is only decoded when a
+ * test reaches one of its fields.
+ *
+ * The language is the one of Wireshark, reduced:
+ *     expr    := and ( ( "||" | "or" ) and )*
+ *     and     := not ( ( "&&" | "and" ) not )*
+ *     not     := ( "!" | "not" ) not | "(" expr ")" | test
+ *     test    := field [ op value ]
+ *     op      := "==" | "!=" | "<" | "<=" | ">" | ">=" | "contains"
+ * A field alone is true if the packet has it, and for the flags if it is set.
+ * The values are numbers, addresses with an optional /prefix, or strings
+ * between double quotes. ip.addr, eth.addr, tcp.port and udp.port match
+ * either side, and != is true when neither side is equal.
+ */
+
+#ifndef DFILTER_H
+#define DFILTER_H
+
+#include "decode.h"
+
+struct dfilter;
+
+
+/**
+ * @brief Compile a display filter
+ *
+ * The errors are printed on stderr.
+ *
+ * @param expr The expression
+ * @return struct dfilter* The compiled filter, NULL on error
+ */
+struct dfilter *dfilter_compile(const char *expr);
+
+/**
+ * @brief Run a display filter on a decoded packet
+ *
+ * The application protocol is decoded if a test needs it.
+ *
+ * @param f The filter
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 1 if the packet matches, 0 otherwise
+ */
+int dfilter_match(const struct dfilter *f, struct packet_info *pi,
+                  const u_char *packet);
+
+/**
+ * @brief Free a display filter
+ *
+ * @param f The filter, NULL does nothing
+ */
+void dfilter_free(struct dfilter *f);
+
+#endif // DFILTER_H
@@ -0,0 +1,130 @@
+/**
+ * @author Flavien Lallemant
+ * @file dispatch.h
+ * @brief Application protocol dispatch declaration
+ *
+ * This file contains the declaration of the tables mapping the transport
+ * ports to the application dissectors.
+ * The default mappings are loaded once at startup and can be overridden from
+ * the command line, e.g. to decode HTTP on port 8080.
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "decode.h"
+#include "types.h"
+
+#define DISPATCH_TCP 0x01 /**< Mapping of a TCP port */
+#define DISPATCH_UDP 0x02 /**< Mapping of a UDP port */
+
+
+/**
+ * @brief Load the default port mappings
+ */
+void dispatch_init(void);
+
+/**
+ * @brief Add the dissector of a plugin protocol
+ *
+ * @param app The application protocol, from APP_PLUGIN
+ * @param transports The transports the protocol runs on, DISPATCH_* flags
+ * @param match The function recognizing a payload on an unmapped port, NULL
+ * for none
+ * @param match_len The payload bytes match needs
+ * @param decode The dissector
+ */
+void dispatch_add(uint8_t app, int transports,
+                  int (*match)(const u_char *payload, uint32_t len),
+                  uint16_t match_len,
+                  int (*decode)(struct packet_view *v, struct packet_info *pi));
+
+/**
+ * @brief Map a range of ports to an application protocol
+ *
+ * @param transports The transports of the ports, DISPATCH_* flags
+ * @param first The first port of the range
+ * @param last The last port of the range
+ * @param app The application protocol, APP_NONE to remove the mapping
+ * @return int 0 on success, -1 if the protocol can't run on the transports
+ */
+int dispatch_register(int transports, uint16_t first, uint16_t last,
+                      uint8_t app);
+
+/**
+ * @brief Parse and register a port mapping
+ *
+ * The mapping is written proto:port[-port][/tcp|/udp], e.g. http:8080/tcp.
+ * Without a transport, the ports are mapped on every transport the protocol
+ * can run on.
+ *
+ * @param spec The mapping
+ * @return int 0 on success, -1 on error
+ */
+int dispatch_parse(const char *spec);
+
+/**
+ * @brief Enable or disable the payload classification of unmapped ports
+ *
+ * @param enable 1 to classify the payloads of the unmapped TCP ports, 0 to
+ * rely on the ports only
+ */
+void dispatch_guess(int enable);
+
+/**
+ * @brief Get the payload bytes needed to recognize the mapped protocols
+ *
+ * @param transport The transport, DISPATCH_TCP or DISPATCH_UDP
+ * @return int The largest number of bytes needed by a protocol mapped on a
+ * port of the transport
+ */
+int dispatch_classify_len(int transport);
+
+/**
+ * @brief Get the application protocol mapped on the ports of a packet
+ *
+ * The protocol mapped on the lowest port wins, as in dispatch_app(); the
+ * payload is not looked at.
+ *
+ * @param transport The transport, DISPATCH_TCP or DISPATCH_UDP
+ * @param sport The first port
+ * @param dport The second port
+ * @return uint8_t The application protocol, APP_NONE if none is mapped
+ */
+uint8_t dispatch_port(int transport, uint16_t sport, uint16_t dport);
+
+/**
+ * @brief Find and decode the application protocol of a packet
+ *
+ * The protocol mapped on the lowest port is tried first, then the one mapped
+ * on the other port.
+ * When no protocol is mapped on the TCP ports, the payload classifier is
+ * asked instead and its answer kept if only one protocol matches; then, over
+ * TCP and UDP, the match functions of the plugins.
+ * On success, pi->app_proto and the LAYER_APP flag are set.
+ *
+ * @param transport The transport of the packet, DISPATCH_TCP or DISPATCH_UDP
+ * @param payload The view of the application payload
+ * @param pi The decoded packet, with the ports already set
+ * @return int 0 if a protocol is recognized, -1 otherwise
+ */
+int dispatch_app(int transport, const struct packet_view *payload,
+                 struct packet_info *pi);
+
+/**
+ * @brief Decode reassembled bytes with the protocol already found for their
+ * stream
+ *
+ * The bytes of a text protocol keep its label even when they don't start
+ * with a command, e.g. the body of an HTTP response.
+ * On success, pi->app_proto and the LAYER_APP flag are set.
+ *
+ * @param payload The view of the bytes
+ * @param app The application protocol of the stream
+ * @param pi The decoded packet
+ * @return int 0 if the bytes belong to the protocol, -1 otherwise
+ */
+int dispatch_stream(const struct packet_view *payload, uint8_t app,
+                    struct packet_info *pi);
+
+#endif // DISPATCH_H
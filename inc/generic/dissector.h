@@ -0,0 +1,159 @@
+/**
+ * @author Flavien Lallemant
+ * @file dissector.h
+ * @brief Dissector registry declaration
+ *
+ * This file contains the declaration of the tables handing the payload of a
+ * layer to the dissector of the next one, and of the interface of the
+ * dissectors loaded as plugins.
+ * The payload of an Ethernet frame goes to the dissector of its ethertype,
+ * the payload of an IP packet to the one of its protocol, each found with one
+ * lookup in a table indexed by the ethertype or the protocol; the ports are
+ * looked up the same way in the tables of dispatch.h.
+ * A plugin is a shared object exporting netstalker_plugin_init(), which
+ * registers its dissectors with dissector_register(). It can use every
+ * function of the decoding and output headers, out_printf() first.
+ */
+
+#ifndef DISSECTOR_H
+#define DISSECTOR_H
+
+#include <stddef.h>
+#include "decode.h"
+#include "output.h"
+#include "types.h"
+#include "view.h"
+
+#define DISSECTOR_ABI 1 /**< Version of struct dissector_plugin, given to netstalker_plugin_init() */
+#define DISSECTOR_KEYS 8 /**< Largest number of keys of a plugin dissector */
+#define DISSECTOR_FLOWS 4096 /**< Flows a plugin keeps the state of per thread, a power of 2 */
+#define DISSECTOR_INIT "netstalker_plugin_init" /**< Function called when a plugin is loaded */
+
+/**
+ * @brief Layer a plugin dissector hangs on
+ */
+enum dissector_layer {
+    DISSECTOR_ETHERTYPE,    /**< The keys are ethertypes */
+    DISSECTOR_IPPROTO,      /**< The keys are IP protocols, over IPv4 and IPv6 */
+    DISSECTOR_TCP,          /**< The keys are TCP ports */
+    DISSECTOR_UDP           /**< The keys are UDP ports */
+};
+
+/**
+ * @brief Dissector of a payload
+ *
+ * The view starts at the payload and ends where the layer below says it
+ * ends.
+ *
+ * @param v The view of the payload
+ * @param pi The decoded packet to fill
+ * @return int 0 if the payload belongs to the protocol, -1 otherwise
+ */
+typedef int (*dissector_fn)(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Dissector of a plugin
+ *
+ * A packet decoded by a plugin has the LAYER_PLUGIN flag, LAYER_APP too over
+ * TCP and UDP, and the protocol of the plugin in pi->app_proto. The plugin
+ * can keep what it decodes in pi->u.plugin.
+ */
+struct dissector_plugin {
+    const char *name;               /**< Name of the protocol, as printed and mapped with -P */
+    int layer;                      /**< enum dissector_layer */
+    uint16_t keys[DISSECTOR_KEYS];  /**< Ethertypes, IP protocols or ports of the protocol */
+    int key_count;                  /**< Number of keys */
+    int (*match)(const u_char *payload, uint32_t len); /**< Over TCP and UDP, 1 if a payload on another port belongs to the protocol, NULL to rely on the ports */
+    uint16_t match_len;             /**< Payload bytes match needs */
+    dissector_fn decode;            /**< Decode the payload */
+    void (*print)(const struct packet_info *pi, const u_char *payload,
+                  uint32_t len);    /**< Print the rest of the line after the name with out_printf(), without newline, NULL for the length */
+    size_t state_size;              /**< Bytes of state kept per flow, 0 for none */
+};
+
+/**
+ * @brief Function exported by a plugin
+ *
+ * @param abi DISSECTOR_ABI of netstalker
+ * @return int 0 on success, -1 if the plugin can't be used
+ */
+typedef int (*dissector_init_fn)(int abi);
+
+
+/**
+ * @brief Hand the payload of an Ethernet frame to its dissector
+ *
+ * @param v The view of the packet, past the Ethernet header
+ * @param pi The decoded packet, with its ethertype set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+int dissector_ethertype(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Hand the payload of an IP packet to its dissector
+ *
+ * @param v The view of the packet, limited to the IP payload
+ * @param pi The decoded packet, with its IP version and protocol set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+int dissector_ip(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Register a plugin dissector
+ *
+ * A key already taken is taken over. The dissector must stay valid until
+ * dissector_close().
+ *
+ * @param d The dissector
+ * @return int The application protocol given to the dissector, -1 on error
+ */
+int dissector_register(const struct dissector_plugin *d);
+
+/**
+ * @brief Load a plugin
+ *
+ * @param path The shared object
+ * @return int 0 on success, -1 on error
+ */
+int dissector_load(const char *path);
+
+/**
+ * @brief Get the plugin dissector of an application protocol
+ *
+ * @param app The application protocol
+ * @return const struct dissector_plugin* The dissector, NULL if not a plugin one
+ */
+const struct dissector_plugin *dissector_plugin(uint8_t app);
+
+/**
+ * @brief Get the state a plugin dissector keeps for the flow of a packet
+ *
+ * The state is set to zero for the first packet of a flow. A flow whose slot
+ * is taken by another one starts over.
+ *
+ * @param d The dissector
+ * @param pi The decoded packet, with its IP layer
+ * @return void* state_size bytes, NULL without IP layer or state
+ */
+void *dissector_state(const struct dissector_plugin *d,
+                      const struct packet_info *pi);
+
+/**
+ * @brief Print the layer decoded by a plugin
+ *
+ * @param pi The decoded packet, with the LAYER_PLUGIN flag
+ * @param packet The packet
+ */
+void dissector_print(const struct packet_info *pi, const u_char *packet);
+
+/**
+ * @brief Release the plugin states of the calling thread
+ */
+void dissector_release(void);
+
+/**
+ * @brief Unload the plugins
+ */
+void dissector_close(void);
+
+#endif // DISSECTOR_H
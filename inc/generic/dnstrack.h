@@ -0,0 +1,67 @@
+/**
+ * @author Flavien Lallemant
+ * @file dnstrack.h
+ * @brief DNS transaction tracker declaration
+ *
+ * This file contains the declaration of the tracker matching the DNS
+ * responses to their queries, to measure the latency of the resolvers.
+ * A query waits in a table of a fixed size, keyed by its client, server,
+ * client port and transaction ID, until its response comes or it expires.
+ * The round trip times are recorded in a histogram per server and per
+ * response code, printed on stderr at each interval and once at the end.
+ * Like the flow table, the tracker is fed from the decoded packets in capture
+ * order, so it needs no lock, and the times are the capture timestamps, so a
+ * capture file gives the latencies of the network it was recorded on.
+ */
+
+#ifndef DNSTRACK_H
+#define DNSTRACK_H
+
+#include "decode.h"
+
+#define DNSTRACK_SLOTS 16384 /**< Default number of pending queries */
+#define DNSTRACK_INTERVAL 10 /**< Default seconds between two reports */
+#define DNSTRACK_TIMEOUT 5 /**< Default seconds before a query is lost */
+#define DNSTRACK_SERVERS 64 /**< Servers reported, the next ones are added up */
+
+/**
+ * @brief DNS transaction tracker configuration
+ */
+struct dnstrack_config {
+    unsigned slots;     /**< Pending queries, rounded up to a power of 2, 0 for the default */
+    int interval;       /**< Seconds between two reports, 0 for the default, -1 for none */
+    int timeout;        /**< Seconds before a query is lost, 0 for the default */
+};
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int dnstrack_init(const struct dnstrack_config *cfg);
+
+/**
+ * @brief Check if the tracker is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int dnstrack_enabled(void);
+
+/**
+ * @brief Match a decoded DNS message
+ *
+ * A query is kept until its response, which records the round trip time.
+ * The other packets are ignored.
+ *
+ * @param pi The decoded packet
+ */
+void dnstrack_update(const struct packet_info *pi);
+
+/**
+ * @brief Print the latencies of the whole capture and free the tracker
+ */
+void dnstrack_close(void);
+
+#endif // DNSTRACK_H
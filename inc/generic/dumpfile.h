@@ -0,0 +1,112 @@
+/**
+ * @author Flavien Lallemant
+ * @file dumpfile.h
+ * @brief Capture file writer declaration
+ *
+ * This file contains the declaration of the writer of the pcap files of -w.
+ * The capture thread only copies the records to large aligned buffers, which
+ * a thread of the writer writes to the disk, so a slow disk does not stall
+ * the capture until every buffer is waiting to be written.
+ * The output can be rotated, like tcpdump does, once a file reaches a size or
+ * a time period ends: a period rotation expands the strftime() conversions of
+ * the file name with the start of the period, and the files of a period after
+ * the first one get their number appended to the name.
+ * The files are written as pcap, or as pcapng to keep the interface of each
+ * packet: every file then starts with a section header and one interface
+ * description per interface, and the packets are enhanced packet blocks with
+ * nanosecond timestamps, optionally commented with their flow and the
+ * application protocol mapped on their ports.
+ */
+
+#ifndef DUMPFILE_H
+#define DUMPFILE_H
+
+#include <pcap.h>
+#include <stdint.h>
+
+#define DUMPFILE_BUFFERS 8                  /**< Buffers in the queue of the writer thread */
+#define DUMPFILE_BUFFER (1024 * 1024)       /**< Default bytes of a buffer */
+#define DUMPFILE_MIN_BUFFER (512 * 1024)    /**< Smallest buffer, larger than two records */
+
+struct dumpfile;
+
+/**
+ * @brief When the files are flushed to the disk
+ */
+enum dumpfile_sync {
+    DUMPFILE_SYNC_NONE,     /**< Never, left to the kernel */
+    DUMPFILE_SYNC_FILE,     /**< When a file is closed */
+    DUMPFILE_SYNC_BUFFER,   /**< After each buffer */
+};
+
+/**
+ * @brief Format of the files
+ */
+enum dumpfile_format {
+    DUMPFILE_PCAP,      /**< pcap, microsecond timestamps */
+    DUMPFILE_PCAPNG,    /**< pcapng, nanosecond timestamps and an interface per packet */
+};
+
+/**
+ * @brief Capture file writer configuration
+ */
+struct dumpfile_config {
+    const char *path;           /**< File name, - for stdout */
+    int linktype;               /**< Link type of the packets */
+    int snaplen;                /**< Bytes captured per packet */
+    unsigned long long size;    /**< Bytes of a file before the next one, 0 for no limit */
+    int seconds;                /**< Seconds of a period of files, 0 for no limit */
+    enum dumpfile_sync sync;    /**< When the files are flushed to the disk */
+    int direct;                 /**< 1 to write with O_DIRECT, bypassing the page cache */
+    size_t buffer;              /**< Bytes of a buffer, 0 for the default */
+    int live;                   /**< 1 to drop the packets rather than wait for a buffer */
+    int format;                 /**< enum dumpfile_format */
+    const char *const *interfaces; /**< Names of the interfaces of a pcapng file, NULL for one unnamed */
+    int interface_count;        /**< Number of interfaces */
+    int comments;               /**< 1 to comment the pcapng packets with their flow and protocol */
+};
+
+
+/**
+ * @brief Open the first file and start the writer thread
+ *
+ * @param cfg The configuration
+ * @return struct dumpfile* The writer, NULL on error
+ */
+struct dumpfile *dumpfile_open(const struct dumpfile_config *cfg);
+
+/**
+ * @brief Write a packet
+ *
+ * The file is rotated first if the packet does not belong in it.
+ *
+ * @param d The writer
+ * @param header The packet header
+ * @param nsec The nanoseconds of the second of the packet time, only kept in
+ * a pcapng file
+ * @param packet The packet
+ * @param interface The interface of the packet, ignored in a pcap file
+ * @return int 0 on success, -1 if the packet is dropped
+ */
+int dumpfile_write(struct dumpfile *d, const struct pcap_pkthdr *header,
+                   uint32_t nsec, const u_char *packet, int interface);
+
+/**
+ * @brief Get the offset of the next record in the current file
+ *
+ * @param d The writer
+ * @return unsigned long long The offset
+ */
+unsigned long long dumpfile_offset(const struct dumpfile *d);
+
+/**
+ * @brief Write the buffers, close the file and free the writer
+ *
+ * The packets dropped and the errors are printed on stderr.
+ *
+ * @param d The writer
+ * @return int 0 on success, -1 if a write failed
+ */
+int dumpfile_close(struct dumpfile *d);
+
+#endif // DUMPFILE_H
@@ -0,0 +1,119 @@
+/**
+ * @author Flavien Lallemant
+ * @file encap.h
+ * @brief Decapsulation declaration
+ *
+ * This file contains the declaration of the stage peeling the headers
+ * wrapped around the packets between the link layer and the network layer:
+ * 802.1Q and QinQ tags, MPLS labels, and the GRE, VXLAN, GENEVE and IP in IP
+ * tunnels. The headers are peeled in a loop, at most ENCAP_DEPTH of them, so
+ * the layers above decode the innermost packet in place; only the outer VLAN
+ * tag and the kinds of headers peeled are kept in the decoded packet.
+ * The same loop finds the inner flow of a packet before it is decoded.
+ */
+
+#ifndef ENCAP_H
+#define ENCAP_H
+
+#include <pcap.h>
+#include <stdint.h>
+#include "decode.h"
+#include "types.h"
+#include "view.h"
+
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276 /**< Linux cooked capture v2, libpcap 1.10 */
+#endif
+#ifndef DLT_IPV4
+#define DLT_IPV4 228 /**< Raw IPv4 */
+#endif
+#ifndef DLT_IPV6
+#define DLT_IPV6 229 /**< Raw IPv6 */
+#endif
+
+#define ENCAP_DEPTH 8 /**< Largest number of encapsulation headers peeled */
+
+/**
+ * @brief Encapsulations
+ *
+ * Flags set in packet_info.encap for each kind of header peeled.
+ */
+#define ENCAP_VLAN 0x01     /**< 802.1Q tag */
+#define ENCAP_QINQ 0x02     /**< Second 802.1Q or 802.1ad tag */
+#define ENCAP_MPLS 0x04     /**< MPLS label stack */
+#define ENCAP_GRE 0x08      /**< GRE tunnel */
+#define ENCAP_VXLAN 0x10    /**< VXLAN tunnel */
+#define ENCAP_GENEVE 0x20   /**< GENEVE tunnel */
+#define ENCAP_IPIP 0x40     /**< IPv4 in IPv4 or IPv6 */
+
+#define VXLAN_PORT 4789     /**< UDP port of VXLAN */
+#define GENEVE_PORT 6081    /**< UDP port of GENEVE */
+
+/**
+ * @brief Header peeled
+ */
+struct encap_hop {
+    uint8_t kind;   /**< ENCAP_* flag */
+    uint16_t off;   /**< Offset of the header in the packet, of the inner IP header for IP in IP */
+    uint16_t ip;    /**< Offset of the outer IP header of a tunnel */
+};
+
+
+/**
+ * @brief Set the link type of the packets
+ *
+ * @param linktype The DLT_* link type
+ * @return int 0 on success, -1 if the link type isn't supported
+ */
+int encap_set_linktype(int linktype);
+
+/**
+ * @brief Get the link type of the packets
+ *
+ * @return int The DLT_* link type
+ */
+int encap_linktype(void);
+
+/**
+ * @brief Skip the link layer header of a packet
+ *
+ * @param v The view of the packet, moved past the header
+ * @param type The ethertype of the payload
+ * @return int 0 on success, -1 if the header is truncated or carries no
+ * ethertype
+ */
+int encap_link(struct packet_view *v, uint16_t *type);
+
+/**
+ * @brief Peel the encapsulation headers
+ *
+ * Every header is checked before it is peeled; the view is left at the
+ * first one that isn't an encapsulation, or is cut or malformed.
+ *
+ * @param v The view of the payload of type, moved to the innermost payload
+ * @param type The ethertype of the payload, set to the innermost one
+ * @param pi The decoded packet to record the headers in, NULL for none
+ * @param hops The ENCAP_DEPTH headers peeled, NULL for none
+ * @return int The number of headers peeled
+ */
+int encap_peel(struct packet_view *v, uint16_t *type, struct packet_info *pi,
+               struct encap_hop *hops);
+
+/**
+ * @brief Peel the encapsulation headers then decode the network layer
+ *
+ * @param v The view of the packet, past the link layer header
+ * @param pi The decoded packet, with its ethertype set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+int encap_ethertype(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print the encapsulation headers of a packet on one line
+ *
+ * @param pi The decoded packet, with the LAYER_ENCAP flag
+ * @param packet The packet
+ */
+void encap_print(const struct packet_info *pi, const u_char *packet);
+
+#endif // ENCAP_H
@@ -0,0 +1,102 @@
+/**
+ * @author Flavien Lallemant
+ * @file flow.h
+ * @brief Flow key and hash declaration
+ *
+ * This file contains the definition of the key identifying a flow by its
+ * 5-tuple, and the declaration of the functions computing it.
+ * The key is symmetric: both directions of a connection give the same key,
+ * so the same hash, and so the same decoding worker.
+ */
+
+#ifndef FLOW_H
+#define FLOW_H
+
+#include "decode.h"
+#include "types.h"
+
+/**
+ * @brief Flow key
+ *
+ * The endpoint with the lowest address, then lowest port, is always stored
+ * first. Unused bytes are zero so the key can be compared with memcmp().
+ */
+struct flow_key {
+    uint8_t addr[2][16];    /**< Endpoint addresses, IPv4 uses the 4 first bytes */
+    uint16_t port[2];       /**< Endpoint ports, 0 without TCP or UDP */
+    uint8_t proto;          /**< IP protocol */
+    uint8_t ip_version;     /**< IP version */
+    uint16_t pad;
+};
+
+_Static_assert(sizeof(struct flow_key) % 4 == 0,
+               "struct flow_key is hashed by 32-bit words");
+
+/**
+ * @brief Build the flow key of a decoded packet
+ *
+ * @param pi The decoded packet
+ * @param key The key to fill
+ * @return int 0 on success, -1 if the packet has no IP layer
+ */
+int flow_key_pi(const struct packet_info *pi, struct flow_key *key);
+
+/**
+ * @brief Get the direction of a decoded packet in its flow
+ *
+ * @param pi The decoded packet, with an IP layer
+ * @return int 0 if the packet is sent by the first endpoint of its key, 1
+ * otherwise
+ */
+int flow_dir_pi(const struct packet_info *pi);
+
+/**
+ * @brief Build the flow key of a raw packet
+ *
+ * Only the link layer, IP and transport headers are read, which is enough to
+ * pick a worker before the packet is decoded. Like the decoder, the key is
+ * the one of the innermost packet of the tunnels. Fragments are keyed by
+ * their addresses only, so every fragment of a datagram gets the same key.
+ *
+ * @param packet The packet, of the link type of encap_set_linktype()
+ * @param caplen The captured length
+ * @param key The key to fill
+ * @return int 0 on success, -1 if the frame has no IP layer
+ */
+int flow_key_packet(const u_char *packet, uint32_t caplen,
+                    struct flow_key *key);
+
+/**
+ * @brief Build the flow key of two endpoints
+ *
+ * The endpoints can be given in either order.
+ *
+ * @param key The key to fill
+ * @param ip_version The IP version, 4 or 6
+ * @param proto The IP protocol
+ * @param src The first address, 4 or 16 bytes
+ * @param dst The second address, 4 or 16 bytes
+ * @param sport The first port, 0 without TCP or UDP
+ * @param dport The second port, 0 without TCP or UDP
+ */
+void flow_key_set(struct flow_key *key, int ip_version, uint8_t proto,
+                  const uint8_t *src, const uint8_t *dst, uint16_t sport,
+                  uint16_t dport);
+
+/**
+ * @brief Hash a flow key
+ *
+ * @param key The key
+ * @return uint32_t The hash
+ */
+uint32_t flow_hash(const struct flow_key *key);
+
+/**
+ * @brief Hash the addresses and protocol of a flow key
+ *
+ * @param key The key
+ * @return uint32_t The hash, the same for every port
+ */
+uint32_t flow_shard(const struct flow_key *key);
+
+#endif // FLOW_H
@@ -0,0 +1,103 @@
+/**
+ * @author Flavien Lallemant
+ * @file flowtab.h
+ * @brief Flow table declaration
+ *
+ * This file contains the declaration of the table accounting the packets and
+ * bytes of each flow, and exporting them as IPFIX records.
+ * The table is fed from the decoded packets in capture order, by the same
+ * thread as the statistics, so it needs no lock. Its slots are allocated once,
+ * a new flow only takes a free one.
+ * Threads reading their own part of a capture file feed their own table,
+ * merged in the first one at the end; only the writes of the records are
+ * shared.
+ * The records go to a file, in the IPFIX file format, or to a collector over
+ * UDP, written udp:host:port.
+ */
+
+#ifndef FLOWTAB_H
+#define FLOWTAB_H
+
+#include "decode.h"
+
+struct flowtab;
+
+#define FLOWTAB_SLOTS 65536 /**< Default number of slots */
+#define FLOWTAB_INTERVAL 60 /**< Default seconds between two exports */
+#define FLOWTAB_TIMEOUT 30 /**< Default idle timeout of a flow in seconds */
+
+/**
+ * @brief Flow table configuration
+ */
+struct flowtab_config {
+    const char *dest;   /**< File path, or udp:host:port for a collector */
+    unsigned slots;     /**< Number of slots, rounded up to a power of 2, 0 for the default */
+    int interval;       /**< Seconds between two exports, 0 for the default */
+    int timeout;        /**< Idle timeout of a flow in seconds, 0 for the default */
+};
+
+
+/**
+ * @brief Allocate the table and open the destination of the records
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int flowtab_init(const struct flowtab_config *cfg);
+
+/**
+ * @brief Check if the flow table is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int flowtab_enabled(void);
+
+/**
+ * @brief Account a decoded packet to its flow
+ *
+ * The flows are exported each time the timestamp of a packet goes past the
+ * end of the interval: the idle ones for the last time, the others with their
+ * counters since the previous export.
+ *
+ * @param pi The decoded packet
+ */
+void flowtab_update(const struct packet_info *pi);
+
+/**
+ * @brief Export every flow, close the destination and free the table
+ *
+ * The counters of the table are printed on stderr.
+ */
+void flowtab_close(void);
+
+/**
+ * @brief Create an empty table for another thread
+ *
+ * The table has as many slots as the first one, and exports its records to
+ * the same destination.
+ *
+ * @return struct flowtab* The table, NULL if the flow table is disabled or
+ * on error
+ */
+struct flowtab *flowtab_new(void);
+
+/**
+ * @brief Feed a table from the calling thread
+ *
+ * flowtab_update() then accounts the packets of the thread to this table.
+ *
+ * @param t The table, NULL for the table fed in capture order
+ */
+void flowtab_bind(struct flowtab *t);
+
+/**
+ * @brief Merge a table in the one fed in capture order and free it
+ *
+ * The counters of a flow found in both tables are added, so the flow is
+ * exported as one by the first table.
+ *
+ * @param t The table, NULL to do nothing
+ */
+void flowtab_merge(struct flowtab *t);
+
+#endif // FLOWTAB_H
@@ -0,0 +1,55 @@
+/**
+ * @author Flavien Lallemant
+ * @file format.h
+ * @brief Address formatting functions declaration
+ *
+ * This file contains the declaration of the address formatting functions.
+ * They write into a buffer provided by the caller and never allocate.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <netinet/in.h>
+#include "types.h"
+
+#define STR_MAC_ADDR_LEN 18 /**< Size of a formatted MAC address, XX:XX:XX:XX:XX:XX */
+#define STR_IPv4_ADDR_LEN 16 /**< Size of a formatted IPv4 address, A.B.C.D */
+#define STR_IPv6_ADDR_LEN 46 /**< Size of a formatted IPv6 address, same as INET6_ADDRSTRLEN */
+
+
+/**
+ * @brief Format a MAC address
+ *
+ * This function formats a MAC address in the format XX:XX:XX:XX:XX:XX.
+ *
+ * @param dst The buffer to write to, at least STR_MAC_ADDR_LEN bytes
+ * @param mac The MAC address to format
+ * @return char* dst
+ */
+char *format_mac(char *dst, const u_char *mac);
+
+/**
+ * @brief Format an IPv4 address
+ *
+ * This function formats an IPv4 address in the format A.B.C.D.
+ *
+ * @param dst The buffer to write to, at least STR_IPv4_ADDR_LEN bytes
+ * @param ip_addr The IPv4 address to format, in host byte order
+ * @return char* dst
+ */
+char *format_ipv4(char *dst, uint32_t ip_addr);
+
+/**
+ * @brief Format an IPv6 address
+ *
+ * This function formats an IPv6 address as described in RFC 5952,
+ * the output is the same as inet_ntop().
+ *
+ * @param dst The buffer to write to, at least STR_IPv6_ADDR_LEN bytes
+ * @param ip6 The IPv6 address to format
+ * @return char* dst
+ */
+char *format_ipv6(char *dst, const struct in6_addr *ip6);
+
+#endif // FORMAT_H
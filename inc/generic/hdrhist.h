@@ -0,0 +1,59 @@
+/**
+ * @author Flavien Lallemant
+ * @file hdrhist.h
+ * @brief Latency histogram declaration
+ *
+ * This file contains the declaration of the histograms recording latencies
+ * the way HdrHistogram does: the values below 2^(HDR_SUB_BITS + 1) have a
+ * bucket each, then every power of 2 is split in 2^HDR_SUB_BITS buckets, so
+ * any value is known within 1/32 for a fixed size of a few KiB, whatever the
+ * range.
+ */
+
+#ifndef HDRHIST_H
+#define HDRHIST_H
+
+#include <stdint.h>
+
+#define HDR_SUB_BITS 5 /**< Buckets per power of 2, as a power of 2 */
+#define HDR_SUB (1u << HDR_SUB_BITS) /**< Buckets per power of 2 */
+#define HDR_BUCKETS (2 * HDR_SUB + (32 - HDR_SUB_BITS - 1) * HDR_SUB) /**< Buckets of the 32-bit values */
+
+/**
+ * @brief Latency histogram
+ */
+struct hdrhist {
+    uint64_t count;                 /**< Values recorded */
+    uint64_t sum;                   /**< Sum of the values */
+    uint32_t max;                   /**< Largest value */
+    uint32_t buckets[HDR_BUCKETS];  /**< Values recorded in each bucket */
+};
+
+
+/**
+ * @brief Record a value
+ *
+ * @param h The histogram
+ * @param value The value, the ones above UINT32_MAX are recorded as UINT32_MAX
+ */
+void hdr_record(struct hdrhist *h, uint64_t value);
+
+/**
+ * @brief Get a percentile
+ *
+ * @param h The histogram
+ * @param p The percentile, from 0 to 100
+ * @return uint32_t The largest value of the bucket holding the percentile,
+ * never above the largest value recorded, 0 if the histogram is empty
+ */
+uint32_t hdr_percentile(const struct hdrhist *h, double p);
+
+/**
+ * @brief Add the values of a histogram to another
+ *
+ * @param dst The histogram added to
+ * @param src The histogram added
+ */
+void hdr_merge(struct hdrhist *dst, const struct hdrhist *src);
+
+#endif // HDRHIST_H
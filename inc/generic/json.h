@@ -0,0 +1,161 @@
+/**
+ * @author Flavien Lallemant
+ * @file json.h
+ * @brief JSON packet output declaration
+ *
+ * This file contains the declaration of the JSON writer and of the renderer
+ * writing each packet as one JSON object per line, NDJSON, for the log
+ * pipelines.
+ * The writer appends to a buffer of a fixed size, which is passed to the
+ * output writer whenever the next value could not fit, so no document is
+ * built in memory and nothing is allocated per packet.
+ * The keys are written as given, the strings are escaped: the bytes outside
+ * of printable ASCII are written \u00XX, so the output is valid UTF-8 whatever
+ * the packet holds.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "decode.h"
+
+#define JSON_BUFFER (16 * 1024) /**< Bytes of the buffer of a writer */
+#define JSON_DEPTH 8 /**< Deepest nesting of the objects and arrays */
+
+/**
+ * @brief JSON writer
+ *
+ * This structure represents the JSON text of the packet being written.
+ */
+struct json {
+    char *buf;              /**< The buffer */
+    size_t len;             /**< Bytes in the buffer */
+    int comma;              /**< 1 if a value was written at this level */
+    int depth;              /**< Objects and arrays open */
+    char close[JSON_DEPTH]; /**< Closing character of each level */
+};
+
+
+/**
+ * @brief Open an object
+ *
+ * @param j The writer
+ * @param key The key of the object, NULL in an array or at the top level
+ */
+void json_object(struct json *j, const char *key);
+
+/**
+ * @brief Open an array
+ *
+ * @param j The writer
+ * @param key The key of the array, NULL in an array or at the top level
+ */
+void json_array(struct json *j, const char *key);
+
+/**
+ * @brief Close the last object or array opened
+ *
+ * @param j The writer
+ */
+void json_end(struct json *j);
+
+/**
+ * @brief Write a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param s The bytes of the string
+ * @param len The number of bytes
+ */
+void json_strn(struct json *j, const char *key, const char *s, size_t len);
+
+/**
+ * @brief Write a null terminated string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param s The string
+ */
+void json_str(struct json *j, const char *key, const char *s);
+
+/**
+ * @brief Write an unsigned integer
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param v The value
+ */
+void json_uint(struct json *j, const char *key, uint64_t v);
+
+/**
+ * @brief Write a boolean
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param v The value, true if not 0
+ */
+void json_bool(struct json *j, const char *key, int v);
+
+/**
+ * @brief Write bytes as a string of hexadecimal digits
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param data The bytes
+ * @param len The number of bytes
+ */
+void json_hex(struct json *j, const char *key, const uint8_t *data, size_t len);
+
+/**
+ * @brief Write an IPv4 address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param addr The address, as on the wire
+ */
+void json_ipv4(struct json *j, const char *key, const uint8_t *addr);
+
+/**
+ * @brief Write an IPv6 address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param addr The address
+ */
+void json_ipv6(struct json *j, const char *key, const uint8_t *addr);
+
+/**
+ * @brief Write a MAC address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param mac The address
+ */
+void json_mac(struct json *j, const char *key, const uint8_t *mac);
+
+/**
+ * @brief Set the verbose level of the NDJSON output
+ *
+ * At VERBOSE_CONCISE a packet has the addresses, ports and headers of its
+ * layers up to the transport one, VERBOSE_SYNTHETIC adds the application
+ * protocol, the DNS and BOOTP headers and the TLS hellos, VERBOSE_COMPLETE the
+ * DNS questions and answers, the DHCP options, the JA3 strings and the
+ * remaining fields of the headers.
+ *
+ * @param verbose The verbose level, enum verbosity
+ */
+void ndjson_init(int verbose);
+
+/**
+ * @brief Write a decoded packet as a line of JSON
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ */
+void render_ndjson(const struct packet_info *pi, const u_char *packet,
+                   unsigned long number);
+
+#endif // JSON_H
@@ -0,0 +1,29 @@
+/**
+ * @author Flavien Lallemant
+ * @file md5.h
+ * @brief MD5 digest declaration
+ *
+ * This file contains the declaration of the MD5 digest, which the JA3
+ * fingerprints of the TLS hellos are defined with. It is not used for any
+ * security purpose, so the program doesn't need a crypto library.
+ */
+
+#ifndef MD5_H
+#define MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_LEN 16 /**< Length of a digest */
+
+
+/**
+ * @brief Compute the MD5 digest of bytes
+ *
+ * @param data The bytes
+ * @param len The number of bytes
+ * @param digest The buffer to write to, MD5_LEN bytes
+ */
+void md5(const void *data, size_t len, uint8_t digest[MD5_LEN]);
+
+#endif // MD5_H
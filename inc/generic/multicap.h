@@ -0,0 +1,181 @@
+/**
+ * @author Flavien Lallemant
+ * @file multicap.h
+ * @brief Capture from several sources declaration
+ *
+ * This file contains the declaration of the capture from several interfaces
+ * at once, and on Linux from several sockets of an interface sharing a
+ * PACKET_FANOUT group. Each source is read by its own thread, optionally
+ * pinned to a core, which copies the packets into a queue. The thread of the
+ * caller takes the packets out of the queues and gives them to the callback,
+ * merged in time stamp order or as they arrive, so everything after the
+ * callback runs on one thread as with a single source.
+ */
+
+#ifndef MULTICAP_H
+#define MULTICAP_H
+
+#include <pcap.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capture.h"
+
+#define MULTICAP_SOURCES 64         /**< Largest number of sources */
+#define MULTICAP_QUEUE (8 << 20)    /**< Bytes of the queue of a source */
+#define MULTICAP_DELAY 100          /**< Milliseconds a packet waits for the older ones of the other sources, after the read timeout */
+#define MULTICAP_IDLE 2048          /**< Empty merges between two calls of the idle function, about 100 ms */
+
+/**
+ * @brief How the packets of the sources are merged
+ */
+enum multicap_merge {
+    MULTICAP_ORDERED,   /**< In time stamp order, a packet waiting up to the delay for the others */
+    MULTICAP_ARRIVAL    /**< As they arrive, in order within each source only */
+};
+
+/**
+ * @brief Configuration of the sources
+ */
+struct multicap_config {
+    const char *const *interfaces;  /**< Interfaces to capture on */
+    int interface_count;            /**< Number of interfaces */
+    int fanout;                     /**< Sockets per interface, 1 or less without fanout group */
+    int fanout_mode;                /**< How the packets are spread over them, enum capture_fanout */
+    const int *cpus;                /**< Core of the thread of each source, in order, NULL for none */
+    int cpu_count;                  /**< Number of cores, the next sources aren't pinned */
+    int merge;                      /**< enum multicap_merge */
+    int delay;                      /**< Milliseconds of MULTICAP_ORDERED, 0 for the read timeout plus MULTICAP_DELAY */
+};
+
+/**
+ * @brief Source of packets
+ *
+ * The capture thread of the source is the only producer of its queue, the
+ * merging thread the only consumer.
+ */
+struct multicap_source {
+    struct capture *cap;            /**< The handle */
+    char interface[16];             /**< The interface */
+    char name[32];                  /**< The interface, and the socket with a fanout group */
+    int ifindex;                    /**< Number of the interface in the configuration */
+    int cpu;                        /**< The core of the thread, -1 if not pinned */
+    pthread_t thread;               /**< The capture thread */
+    int started;                    /**< 1 once the thread runs */
+    int status;                     /**< The value returned by capture_loop() */
+    unsigned char *queue;           /**< MULTICAP_QUEUE bytes of packet records, in the block of the set */
+    _Atomic uint64_t head __attribute__((aligned(64))); /**< Bytes written by the capture thread */
+    _Atomic uint64_t packets;       /**< Packets queued */
+    _Atomic uint64_t dropped;       /**< Packets dropped because the queue was full */
+    _Atomic int done;               /**< 1 once the capture thread is over */
+    _Atomic uint64_t tail __attribute__((aligned(64))); /**< Bytes read by the merging thread */
+};
+
+/**
+ * @brief Set of sources
+ */
+struct multicap {
+    struct multicap_source *sources;    /**< The sources */
+    unsigned char *queues;              /**< The queues of the sources, one block */
+    int count;                          /**< Number of sources */
+    int merge;                          /**< enum multicap_merge */
+    int delay;                          /**< Milliseconds of MULTICAP_ORDERED */
+    int current;                        /**< Source of the packet given to the callback */
+    capture_idle_handler idle;          /**< Called while no source has a packet, NULL for none */
+    u_char *idle_user;                  /**< Its argument */
+    volatile sig_atomic_t stop;         /**< Set to leave the loop */
+};
+
+
+/**
+ * @brief Open the sources
+ *
+ * Each interface is opened with base, once per socket of its fanout group.
+ * The sources must share a link type.
+ *
+ * @param cfg The sources
+ * @param base The configuration of each handle, its interface and fanout ignored
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct multicap* The sources, NULL on error
+ */
+struct multicap *multicap_open(const struct multicap_config *cfg,
+                               const struct capture_config *base,
+                               char *errbuf);
+
+/**
+ * @brief Compile and set a filter on every source
+ *
+ * @param mc The sources
+ * @param expr The filter expression, NULL for no filter
+ * @param dump 1 to print the program of the first source and where it runs
+ * @return int 0 on success, -1 on error
+ *
+ * @see capture_setfilter
+ */
+int multicap_setfilter(struct multicap *mc, const char *expr, int dump);
+
+/**
+ * @brief Read packets from every source
+ *
+ * The callback is called from the calling thread.
+ *
+ * @param mc The sources
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by multicap_breakloop()
+ */
+int multicap_loop(struct multicap *mc, int count, pcap_handler callback,
+                  u_char *user);
+
+/**
+ * @brief Set the function called while no source has a packet
+ *
+ * The function is called from the thread of multicap_loop().
+ *
+ * @param mc The sources
+ * @param idle The function, NULL for none
+ * @param user Its argument
+ */
+void multicap_set_idle(struct multicap *mc, capture_idle_handler idle,
+                       u_char *user);
+
+/**
+ * @brief Stop multicap_loop()
+ *
+ * This function can be called from a signal handler.
+ *
+ * @param mc The sources
+ */
+void multicap_breakloop(struct multicap *mc);
+
+/**
+ * @brief Print the counters of each source
+ *
+ * @param mc The sources
+ * @param f The stream to print to
+ */
+void multicap_print_stats(struct multicap *mc, FILE *f);
+
+/**
+ * @brief Get how full the queues are
+ *
+ * This function is called by the thread of multicap_loop().
+ *
+ * @param mc The sources
+ * @param dropped The packets dropped by the queues and the kernel, set
+ * @return unsigned The percentage of the fullest queue in use
+ */
+unsigned multicap_fill(struct multicap *mc, unsigned long long *dropped);
+
+/**
+ * @brief Close the sources
+ *
+ * @param mc The sources
+ */
+void multicap_close(struct multicap *mc);
+
+#endif // MULTICAP_H
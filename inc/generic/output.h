@@ -0,0 +1,108 @@
+/**
+ * @author Flavien Lallemant
+ * @file output.h
+ * @brief Buffered output writer declaration
+ *
+ * This file contains the declaration of the buffered output writer.
+ * The layers append their text to an output buffer which is written to
+ * stdout in large batches instead of one stdio call per field.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024) /**< Default size of the output buffer */
+#define OUTPUT_FLUSH_AUTO -2 /**< Flush every packet on a terminal, only when full otherwise */
+#define OUTPUT_FLUSH_FULL -1 /**< Flush only when the buffer is full */
+
+
+/**
+ * @brief Output buffer
+ *
+ * This structure represents a buffer the layers write their output to.
+ */
+struct outbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+    int grow;   /**< 1 if the buffer grows instead of being flushed */
+};
+
+/**
+ * @brief Initialize the output writer
+ *
+ * @param size Size of the output buffer, 0 for the default size
+ * @param flush_interval Minimum time between two flushes in milliseconds,
+ * 0 to flush after every packet, OUTPUT_FLUSH_FULL or OUTPUT_FLUSH_AUTO
+ * @return int 0 on success, -1 on error
+ */
+int output_init(size_t size, int flush_interval);
+
+/**
+ * @brief Flush the output and release the output buffer
+ */
+void output_close(void);
+
+/**
+ * @brief Send the output of the calling thread to a buffer
+ *
+ * The buffer grows as needed and is never written to stdout by the writer.
+ *
+ * @param ob The buffer to append to, NULL to go back to the output buffer
+ */
+void out_bind(struct outbuf *ob);
+
+/**
+ * @brief Append formatted text to the output
+ *
+ * @param fmt The format string, as printf()
+ * @return int The number of characters written
+ */
+int out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Append raw bytes to the output
+ *
+ * @param buf The bytes to append
+ * @param len The number of bytes
+ */
+void out_write(const void *buf, size_t len);
+
+/**
+ * @brief Append a string to the output
+ *
+ * @param s The string to append, no newline is added
+ */
+void out_puts(const char *s);
+
+/**
+ * @brief Append a character to the output
+ *
+ * @param c The character to append
+ */
+void out_putc(char c);
+
+/**
+ * @brief Mark the end of a packet
+ *
+ * This function flushes the output if the flush interval has elapsed.
+ */
+void out_packet_done(void);
+
+/**
+ * @brief Flush the output if the flush interval has elapsed while no packet
+ * comes
+ *
+ * This function is called by the thread writing the output, from the idle
+ * function of the capture loop.
+ */
+void out_idle(void);
+
+/**
+ * @brief Write the buffered output to stdout
+ */
+void out_flush(void);
+
+#endif // OUTPUT_H
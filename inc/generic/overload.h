@@ -0,0 +1,106 @@
+/**
+ * @author Flavien Lallemant
+ * @file overload.h
+ * @brief Overload controller declaration
+ *
+ * This file contains the declaration of the controller shedding the load of
+ * a live capture the decoding can't keep up with.
+ * Every OVERLOAD_PERIOD milliseconds of capture time, it reads the drops of
+ * the kernel and of the queues, and how full the queues of the pipeline or
+ * of the sources are. On pressure it goes one level up: the packets are first
+ * decoded up to the transport layer only, then sampled 1 in 2, 1 in 4, and so
+ * on up to the largest rate; after OVERLOAD_CALM quiet periods it goes one
+ * level down. A sampled out packet is still written to the -w file, it is
+ * just not decoded.
+ * The packets are sampled by count, or by flow hash so a flow is kept or
+ * skipped as a whole and the trackers see complete connections.
+ * The reports print the sampling applied since their previous one with the
+ * factor to scale their counters by, the packets seen over the packets
+ * decoded.
+ */
+
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <pcap.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capture.h"
+#include "multicap.h"
+
+#define OVERLOAD_PERIOD 100 /**< Milliseconds between two checks */
+#define OVERLOAD_CALM 10 /**< Quiet checks before going one level down */
+#define OVERLOAD_HIGH 50 /**< Percentage of a queue in use that is pressure */
+#define OVERLOAD_LOW 10 /**< Percentage of a queue in use below which a check is quiet */
+#define OVERLOAD_RATE 64 /**< Default largest sampling rate */
+
+/**
+ * @brief How the packets are sampled
+ */
+enum overload_sample {
+    OVERLOAD_FLOW = 0,  /**< By flow hash, every packet of a flow or none */
+    OVERLOAD_COUNT      /**< One packet in N, whatever its flow */
+};
+
+/**
+ * @brief Overload controller configuration
+ */
+struct overload_config {
+    int sample;                 /**< enum overload_sample */
+    unsigned max_rate;          /**< Largest 1 in N, rounded up to a power of 2 up to 65536, 0 for the default */
+    struct capture *cap;        /**< The handle read for the kernel drops, NULL with sources */
+    struct multicap *sources;   /**< The sources, NULL for one handle */
+    int pipeline;               /**< 1 if the packets go through the pipeline */
+};
+
+/**
+ * @brief Sampling seen by a report
+ *
+ * A report keeps the counters of its previous call, to print the sampling
+ * applied since.
+ */
+struct overload_mark {
+    uint64_t seen;      /**< Packets offered to the controller */
+    uint64_t kept;      /**< Packets decoded */
+    uint64_t headers;   /**< Packets decoded up to the transport layer only */
+};
+
+
+/**
+ * @brief Enable the controller
+ *
+ * @param cfg The configuration
+ */
+void overload_init(const struct overload_config *cfg);
+
+/**
+ * @brief Check if the controller is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int overload_enabled(void);
+
+/**
+ * @brief Decide if a packet is decoded
+ *
+ * This function is called by the capture thread for every packet, and
+ * checks the load when a period is over.
+ *
+ * @param header The packet header
+ * @param packet The packet
+ * @return int 1 to decode the packet, 0 to skip it
+ */
+int overload_admit(const struct pcap_pkthdr *header, const u_char *packet);
+
+/**
+ * @brief Print the sampling applied since the previous report
+ *
+ * Nothing is printed when the controller is disabled.
+ *
+ * @param f The stream to print to
+ * @param mark The counters of the previous report, updated
+ */
+void overload_report(FILE *f, struct overload_mark *mark);
+
+#endif // OVERLOAD_H
@@ -15,6 +15,9 @@
 #include <getopt.h>
 // #include "lists.h"
 
+#define PARSER_INTERFACES 16 /**< Largest number of interfaces of -i */
+#define PARSER_CPUS 64 /**< Largest number of cores of --cpus */
+
 /**
  * @brief Arguments structure
  * 
@@ -22,11 +25,76 @@
  */
 struct arguments {
     char interface[16];
+    char interfaces[PARSER_INTERFACES][16];
+    int interface_count;
     char *fileInput;
     char *fileOutput;
     char *filter;
+    char *display_filter;
+    int dump_filter;
     int verbose;
     int count;
+    int flush_interval;
+    int stats;
+    int stats_interval;
+    int threads;
+    int ring_slots;
+    int buffer_size;
+    int immediate;
+    int timeout;
+    int ring;
+    unsigned block_size;
+    unsigned frame_count;
+    int snaplen;
+    int reassemble;
+    int reasm_memory;
+    int reasm_timeout;
+    int no_defrag;
+    int defrag_memory;
+    int defrag_timeout;
+    char *flow_dest;
+    int flow_interval;
+    int flow_timeout;
+    unsigned flow_slots;
+    int dns_latency;
+    int dns_interval;
+    int dns_timeout;
+    unsigned dns_slots;
+    int tcp_metrics;
+    int tcp_flows;
+    int tcp_timeout;
+    unsigned tcp_slots;
+    unsigned top_rows;
+    int top_interval;
+    unsigned top_width;
+    int perf;
+    int perf_interval;
+    int overload;
+    int sample_mode;
+    unsigned sample_max;
+    int fanout;
+    int fanout_mode;
+    int cpus[PARSER_CPUS];
+    int cpu_count;
+    int merge;
+    int merge_delay;
+    int batch;
+    int jobs;
+    int index;
+    unsigned index_bucket;
+    char *from;
+    char *to;
+    char *flow_key;
+    unsigned long long rotate_size;
+    int rotate_seconds;
+    int dump_sync;
+    int dump_direct;
+    int dump_buffer;
+    int pcapng;
+    int pcapng_comments;
+    int print;
+    int format;
+    unsigned batch_rows;
 };
 
 /**
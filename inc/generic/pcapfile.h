@@ -0,0 +1,103 @@
+/**
+ * @author Flavien Lallemant
+ * @file pcapfile.h
+ * @brief Mapped capture file reader declaration
+ *
+ * This file contains the declaration of the reader walking a pcap or pcapng
+ * file mapped in memory. The packets are handed over in place in the mapping,
+ * without the copy libpcap makes of each record.
+ * Only regular files in a format the reader knows are mapped: pipes,
+ * compressed files and the other formats are left to libpcap.
+ * A reader can be copied at a record boundary, so several threads read their
+ * own part of the same mapping. It can also be limited to a time range, or to
+ * the records at given offsets of a pcap file.
+ */
+
+#ifndef PCAPFILE_H
+#define PCAPFILE_H
+
+#include <pcap.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAPFILE_READAHEAD (8 * 1024 * 1024) /**< Bytes read ahead of the current record */
+
+/**
+ * @brief Interface of a pcapng section
+ */
+struct pcapfile_if {
+    uint64_t units;     /**< Timestamp units per second */
+    int64_t offset;     /**< Seconds added to the timestamps */
+    uint32_t snaplen;   /**< Bytes captured per packet */
+};
+
+/**
+ * @brief Mapped capture file
+ */
+struct pcapfile {
+    const unsigned char *map;   /**< The mapped file */
+    size_t size;                /**< Size of the file */
+    size_t end;                 /**< End of the records to read */
+    size_t off;                 /**< Offset of the next record */
+    size_t advised;             /**< End of the range read ahead */
+    int ng;                     /**< 1 for pcapng, 0 for pcap */
+    int swap;                   /**< 1 if the byte order is not the host's */
+    int nano;                   /**< 1 for nanosecond pcap timestamps */
+    int linktype;               /**< Link type of the packets */
+    int snaplen;                /**< Bytes captured per packet */
+    struct pcapfile_if *ifs;    /**< Interfaces of the current pcapng section */
+    unsigned if_count;          /**< Number of interfaces */
+    unsigned if_size;           /**< Allocated interfaces */
+    int copy;                   /**< 1 if the mapping belongs to another reader */
+    uint64_t *picks;            /**< Offsets of the only records to read, NULL for all */
+    size_t pick_count;          /**< Number of offsets */
+    size_t pick;                /**< Next offset to read */
+    struct timeval from;        /**< Packets older are skipped */
+    struct timeval to;          /**< Packets newer are skipped, 0 for no limit */
+    uint32_t nsec;              /**< Nanoseconds of the second of the last packet read */
+    char err[PCAP_ERRBUF_SIZE]; /**< The last error */
+};
+
+
+/**
+ * @brief Map a capture file
+ *
+ * @param file The file to read
+ * @return struct pcapfile* The reader, NULL if the file must go to libpcap
+ */
+struct pcapfile *pcapfile_open(const char *file);
+
+/**
+ * @brief Read the next packet
+ *
+ * The packet stays valid until the reader is closed. The packets out of the
+ * time range of the reader are skipped.
+ *
+ * @param pf The reader
+ * @param header The header to fill
+ * @param data The packet, set on success
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+int pcapfile_next(struct pcapfile *pf, struct pcap_pkthdr *header,
+                  const unsigned char **data);
+
+/**
+ * @brief Copy a reader at its next record
+ *
+ * The copy reads the same mapping, up to the same end, and the same offsets
+ * if the reader has some. It must be closed before the reader it was copied
+ * from.
+ *
+ * @param pf The reader
+ * @return struct pcapfile* The copy, NULL on error
+ */
+struct pcapfile *pcapfile_dup(const struct pcapfile *pf);
+
+/**
+ * @brief Unmap a capture file, or free a copy
+ *
+ * @param pf The reader
+ */
+void pcapfile_close(struct pcapfile *pf);
+
+#endif // PCAPFILE_H
@@ -0,0 +1,180 @@
+/**
+ * @author Flavien Lallemant
+ * @file perf.h
+ * @brief Runtime performance counters declaration
+ *
+ * This file contains the declaration of the counters showing where the time
+ * of a capture goes: the packets received and dropped by the kernel, the
+ * packets decoded per layer, and the time spent in each stage of the
+ * processing, from the decoding and each application dissector to the
+ * output.
+ * The stages are timed with the time stamp counter on one call in
+ * PERF_SAMPLE, so the counters stay cheap enough to leave on in production.
+ * Each thread counts in its own counters, only written by it, which the
+ * report adds up. Nothing is counted until perf_init() is called.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "decode.h"
+
+#define PERF_SAMPLE 64 /**< One call of a stage in PERF_SAMPLE is timed, a power of 2 */
+#define PERF_LAYERS 16 /**< Number of LAYER_* flags */
+
+/**
+ * @brief Stages timed
+ *
+ * A stage includes the stages run from it: the decoding includes the filter,
+ * the reassembly and the application dissectors.
+ */
+enum perf_stage {
+    PERF_PACKET,    /**< A packet in the capture thread, from its callback to its return */
+    PERF_DECODE,    /**< decode_packet() */
+    PERF_FILTER,    /**< The display filter */
+    PERF_REASM,     /**< The TCP reassembly */
+    PERF_TRACK,     /**< The flow, DNS and TCP trackers */
+    PERF_RENDER,    /**< The renderer of -o */
+    PERF_OUTPUT,    /**< A write to stdout, every one is timed */
+    PERF_APP,       /**< The first application dissector, one per enum app_proto */
+    PERF_STAGE_COUNT = PERF_APP + APP_COUNT
+};
+
+/**
+ * @brief Counters of a thread
+ */
+struct perf_thread {
+    _Atomic uint64_t layers[PERF_LAYERS];       /**< Packets decoded per LAYER_* flag */
+    _Atomic uint64_t calls[PERF_STAGE_COUNT];   /**< Calls of each stage */
+    _Atomic uint64_t samples[PERF_STAGE_COUNT]; /**< Calls timed */
+    _Atomic uint64_t cycles[PERF_STAGE_COUNT];  /**< Cycles of the calls timed */
+    struct perf_thread *next;                   /**< The counters of the next thread */
+};
+
+struct capture;
+
+extern int perf_enabled; /**< 1 once perf_init() is called */
+extern volatile sig_atomic_t perf_requested; /**< Set when a report is due */
+extern __thread struct perf_thread *perf_self; /**< The counters of the calling thread */
+
+
+/**
+ * @brief Allocate the counters of the calling thread
+ *
+ * @return struct perf_thread* The counters, NULL on error
+ */
+struct perf_thread *perf_attach(void);
+
+/**
+ * @brief Start counting
+ *
+ * A report is asked with SIGUSR1, and every interval seconds if not 0.
+ * The reports are printed with perf_report() by the capture loop, when
+ * perf_requested is set.
+ *
+ * @param interval Seconds between two reports, 0 for none
+ * @return int 0 on success, -1 on error
+ */
+int perf_init(int interval);
+
+/**
+ * @brief Print the counters
+ *
+ * @param f The stream to print to
+ * @param cap The handle to read the kernel counters of, NULL for none
+ * @param title The title of the report
+ */
+void perf_report(FILE *f, struct capture *cap, const char *title);
+
+/**
+ * @brief Stop counting and release the counters
+ */
+void perf_close(void);
+
+/**
+ * @brief Read the time stamp counter
+ *
+ * @return uint64_t The cycles, or nanoseconds without a time stamp counter
+ */
+static inline uint64_t perf_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Add to a counter of the calling thread
+ *
+ * @param c The counter
+ * @param n The value to add
+ */
+static inline void perf_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+/**
+ * @brief Count a call of a stage, and start timing it if it is sampled
+ *
+ * @param stage The stage, enum perf_stage
+ * @return uint64_t The cycles to give to perf_end(), 0 if the call isn't timed
+ */
+static inline uint64_t perf_begin(int stage)
+{
+    if (__builtin_expect(!perf_enabled, 1))
+        return 0;
+    struct perf_thread *t = perf_self ? perf_self : perf_attach();
+    if (t == NULL)
+        return 0;
+    uint64_t n = atomic_load_explicit(&t->calls[stage], memory_order_relaxed);
+    atomic_store_explicit(&t->calls[stage], n + 1, memory_order_relaxed);
+    if (stage != PERF_OUTPUT && (n & (PERF_SAMPLE - 1)) != PERF_SAMPLE - 1)
+        return 0; // Not the first call either, it warms the caches up
+    return perf_cycles();
+}
+
+/**
+ * @brief Stop timing a call of a stage
+ *
+ * @param stage The stage, enum perf_stage
+ * @param start The value returned by perf_begin()
+ */
+static inline void perf_end(int stage, uint64_t start)
+{
+    if (start == 0)
+        return;
+    uint64_t cycles = perf_cycles() - start;
+    perf_add(&perf_self->samples[stage], 1);
+    perf_add(&perf_self->cycles[stage], cycles);
+}
+
+/**
+ * @brief Count the layers of a decoded packet
+ *
+ * @param layers The LAYER_* flags of the packet
+ */
+static inline void perf_layers(uint16_t layers)
+{
+    if (__builtin_expect(!perf_enabled, 1) || perf_self == NULL)
+        return;
+    for (; layers; layers &= layers - 1)
+        perf_add(&perf_self->layers[__builtin_ctz(layers)], 1);
+}
+
+#endif // PERF_H
@@ -0,0 +1,92 @@
+/**
+ * @author Flavien Lallemant
+ * @file pipeline.h
+ * @brief Multi-threaded decoding pipeline declaration
+ *
+ * This file contains the declaration of the decoding pipeline.
+ * The capture thread copies each packet into a pre-allocated ring of slots,
+ * decoding workers decode and render the slots, and an output thread hands
+ * them to a sink in capture order.
+ * Packets are sharded across the workers by their flow hash.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pcap.h>
+#include "decode.h"
+#include "output.h"
+#include "render.h"
+
+#define PIPELINE_SLOTS 4096 /**< Default number of slots of the ring */
+#define PIPELINE_SLOT_DATA 2048 /**< Bytes pre-allocated for the data of a slot */
+#define PIPELINE_IDLE 2048 /**< Waits of the output thread between two calls of the idle function, about 100 ms */
+
+
+/**
+ * @brief Sink of the pipeline
+ *
+ * A function called by the output thread for every packet, in capture order.
+ *
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ * @param packet The packet
+ * @param text The rendered packet, empty without renderer
+ * @param arg The argument given in the configuration
+ */
+typedef void (*pipeline_sink_t)(const struct packet_info *pi, int status,
+                                const u_char *packet,
+                                const struct outbuf *text, void *arg);
+
+/**
+ * @brief Pipeline configuration
+ */
+struct pipeline_config {
+    int workers;            /**< Number of decoding workers, 0 for one per free core */
+    int slots;              /**< Number of slots of the ring, 0 for the default */
+    int live;               /**< 1 to drop packets when the ring is full instead of waiting */
+    renderer_t render;      /**< Renderer run by the workers, NULL to only decode */
+    pipeline_sink_t sink;   /**< Function called by the output thread */
+    void *sink_arg;         /**< Argument of the sink */
+    void (*idle)(void *arg); /**< Function called by the output thread while no packet comes, with sink_arg, NULL for none */
+};
+
+/**
+ * @brief Start the decoding workers and the output thread
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int pipeline_start(const struct pipeline_config *cfg);
+
+/**
+ * @brief Submit a packet to the pipeline
+ *
+ * This function is the pcap_loop() callback of the capture thread.
+ *
+ * @param user Unused
+ * @param header The packet header
+ * @param packet The packet
+ */
+void pipeline_submit(u_char *user, const struct pcap_pkthdr *header,
+                     const u_char *packet);
+
+/**
+ * @brief Get how full the ring is
+ *
+ * This function is called by the capture thread.
+ *
+ * @param dropped The packets dropped because the ring was full, set
+ * @return unsigned The percentage of the slots in use
+ */
+unsigned pipeline_fill(unsigned long long *dropped);
+
+/**
+ * @brief Drain and stop the pipeline
+ *
+ * This function waits for every submitted packet to reach the sink, stops the
+ * threads and prints the counters of each stage on stderr.
+ */
+void pipeline_stop(void);
+
+#endif // PIPELINE_H
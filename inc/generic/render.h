@@ -0,0 +1,67 @@
+/**
+ * @author Flavien Lallemant
+ * @file render.h
+ * @brief Packet rendering declaration
+ *
+ * This file contains the declaration of the renderers, which print a packet
+ * from the result of the decoding stage.
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "decode.h"
+
+/**
+ * @brief Output formats
+ */
+enum render_format {
+    FORMAT_TEXT,    /**< Coloured text, render_text() */
+    FORMAT_ARROW,   /**< Arrow IPC stream, render_columnar() */
+    FORMAT_NDJSON,  /**< One JSON object per line, render_ndjson() */
+};
+
+/**
+ * @brief Verbose levels of -v
+ */
+enum verbosity {
+    VERBOSE_CONCISE = 1,    /**< One line per packet, up to the transport layer */
+    VERBOSE_SYNTHETIC,      /**< One line per layer, with the application protocol */
+    VERBOSE_COMPLETE,       /**< Every field, with the application messages */
+};
+
+/**
+ * @brief Renderer
+ *
+ * A function printing a decoded packet.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ */
+typedef void (*renderer_t)(const struct packet_info *pi, const u_char *packet,
+                           unsigned long number);
+
+/**
+ * @brief Set the verbose level of the text output
+ *
+ * @param verbose The verbose level, enum verbosity
+ */
+void render_init(int verbose);
+
+/**
+ * @brief Print a decoded packet as text
+ *
+ * This function prints a packet as one line at VERBOSE_CONCISE, like tcpdump
+ * does. Otherwise it prints the banner, timestamp and the decoded layers of a
+ * packet, in colour: one line per layer at VERBOSE_SYNTHETIC, every field at
+ * VERBOSE_COMPLETE.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ */
+void render_text(const struct packet_info *pi, const u_char *packet,
+                 unsigned long number);
+
+#endif // RENDER_H
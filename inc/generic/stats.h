@@ -0,0 +1,86 @@
+/**
+ * @author Flavien Lallemant
+ * @file stats.h
+ * @brief Protocol statistics declaration
+ *
+ * This file contains the definition of the per-protocol counters used by the
+ * statistics mode, and the declaration of the functions updating and
+ * printing them.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "decode.h"
+
+/**
+ * @brief Link layer protocols counted separately
+ */
+enum stats_eth {
+    STATS_ETH_IPV4 = 0,
+    STATS_ETH_IPV6,
+    STATS_ETH_ARP,
+    STATS_ETH_REVARP,
+    STATS_ETH_OTHER,
+    STATS_ETH_COUNT
+};
+
+/**
+ * @brief Packet and byte counter
+ */
+struct counter {
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+/**
+ * @brief Per-protocol counters
+ *
+ * This structure counts packets and bytes for each link layer type, IP
+ * protocol and application protocol.
+ */
+struct stats {
+    struct counter total;                   /**< Every packet */
+    struct counter eth[STATS_ETH_COUNT];    /**< Per Ethernet type */
+    struct counter ip[256];                 /**< Per IP protocol */
+    struct counter app[APP_COUNT];          /**< Per application protocol */
+    uint64_t errors;                        /**< Packets not fully decoded */
+    struct timeval first;                   /**< Timestamp of the first packet */
+    struct timeval last;                    /**< Timestamp of the last packet */
+};
+
+
+/**
+ * @brief Count a decoded packet
+ *
+ * @param st The counters to update
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ */
+void stats_update(struct stats *st, const struct packet_info *pi, int status);
+
+/**
+ * @brief Add counters to other counters
+ *
+ * @param dst The counters to add to
+ * @param src The counters to add
+ */
+void stats_merge(struct stats *dst, const struct stats *src);
+
+/**
+ * @brief Print counters
+ *
+ * This function prints every non zero counter with its rate over the time
+ * covered by the counters.
+ *
+ * @param f The stream to print to
+ * @param st The counters to print
+ * @param title The title of the report
+ * @param seconds The time covered by the counters, 0 to use the timestamps of
+ * the first and last packets
+ */
+void stats_print(FILE *f, const struct stats *st, const char *title,
+                 double seconds);
+
+#endif // STATS_H
@@ -0,0 +1,59 @@
+/**
+ * @author Flavien Lallemant
+ * @file tcpmetrics.h
+ * @brief TCP connection metrics declaration
+ *
+ * This file contains the declaration of the tracker measuring the
+ * performance of the TCP connections: the handshake round trip time, the
+ * retransmitted and out of order segments seen from the sequence numbers, the
+ * zero window events and the throughput of each direction.
+ * A connection is kept in a table of a fixed size, keyed by its 5-tuple, and
+ * updated in constant time per segment until it is closed or idle. Like the
+ * flow table, the tracker is fed from the decoded packets in capture order,
+ * so it needs no lock, and the times are the capture timestamps.
+ * The totals of the capture are printed on stderr at the end, and each
+ * connection when it ends if asked.
+ */
+
+#ifndef TCPMETRICS_H
+#define TCPMETRICS_H
+
+#include "decode.h"
+
+#define TCPMETRICS_SLOTS 16384 /**< Default number of connections */
+#define TCPMETRICS_TIMEOUT 120 /**< Default idle seconds before a connection ends */
+
+/**
+ * @brief TCP connection metrics configuration
+ */
+struct tcpmetrics_config {
+    unsigned slots;     /**< Connections, rounded up to a power of 2, 0 for the default */
+    int timeout;        /**< Idle seconds before a connection ends, 0 for the default */
+    int flows;          /**< 1 to print each connection when it ends */
+};
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int tcpmetrics_init(const struct tcpmetrics_config *cfg);
+
+/**
+ * @brief Account a decoded TCP segment to its connection
+ *
+ * The other packets are ignored.
+ *
+ * @param pi The decoded packet
+ */
+void tcpmetrics_update(const struct packet_info *pi);
+
+/**
+ * @brief End the connections, print the totals of the capture and free the
+ * tracker
+ */
+void tcpmetrics_close(void);
+
+#endif // TCPMETRICS_H
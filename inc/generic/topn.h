@@ -0,0 +1,76 @@
+/**
+ * @author Flavien Lallemant
+ * @file topn.h
+ * @brief Heavy hitter tracker declaration
+ *
+ * This file contains the declaration of the tracker ranking the source
+ * addresses, the service ports and the flows by the bytes they sent in the
+ * last interval.
+ * Each ranking estimates the bytes of every key with a Count-Min sketch and
+ * keeps the keys with the largest estimates in a min-heap of a fixed size, so
+ * its memory doesn't grow with the number of hosts and a packet costs a few
+ * counters and a short sift of the heap.
+ * The rankings are printed on stderr at the end of each interval, redrawn in
+ * place on a terminal, and reset for the next one. Like the DNS tracker, the
+ * tracker is fed from the decoded packets in capture order, so it needs no
+ * lock, and the intervals follow the capture timestamps; on an idle live
+ * capture, the loop closes them on the wall clock.
+ */
+
+#ifndef TOPN_H
+#define TOPN_H
+
+#include "decode.h"
+
+#define TOPN_ROWS 20 /**< Default number of keys printed per ranking */
+#define TOPN_INTERVAL 10 /**< Default seconds of an interval */
+#define TOPN_WIDTH 4096 /**< Default counters per row of a sketch */
+
+/**
+ * @brief Heavy hitter tracker configuration
+ */
+struct topn_config {
+    unsigned rows;      /**< Keys printed per ranking, 0 for the default */
+    int interval;       /**< Seconds of an interval, 0 for the default */
+    unsigned width;     /**< Counters per row of a sketch, rounded up to a power of 2, 0 for the default */
+};
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int topn_init(const struct topn_config *cfg);
+
+/**
+ * @brief Check if the tracker is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int topn_enabled(void);
+
+/**
+ * @brief Count the bytes of a decoded packet
+ *
+ * The packets without an IP layer are ignored.
+ *
+ * @param pi The decoded packet
+ */
+void topn_update(const struct packet_info *pi);
+
+/**
+ * @brief Print the interval if it is over while no packet comes
+ *
+ * This function is called from the idle function of a live capture, by the
+ * thread feeding the tracker.
+ */
+void topn_idle(void);
+
+/**
+ * @brief Print the rankings of the last interval and free the tracker
+ */
+void topn_close(void);
+
+#endif // TOPN_H
@@ -0,0 +1,161 @@
+/**
+ * @author Flavien Lallemant
+ * @file view.h
+ * @brief Packet view definition
+ *
+ * This file contains the definition of the cursor the dissectors read a
+ * packet through.
+ * A view holds the current position in the packet and the number of bytes
+ * left from it, so each layer pulls its header, advances past it and hands
+ * the rest to the next layer without any offset arithmetic.
+ * Every read is checked against the remaining bytes with one comparison.
+ */
+
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+#include "types.h"
+
+/**
+ * @brief Packet view
+ */
+struct packet_view {
+    const u_char *ptr;  /**< Current position */
+    uint32_t off;       /**< Offset of the current position in the packet */
+    uint32_t remaining; /**< Bytes readable from the current position */
+    uint32_t caplen;    /**< Captured length of the packet */
+};
+
+
+/**
+ * @brief Make a view of a whole packet
+ *
+ * @param v The view to fill
+ * @param packet The packet
+ * @param caplen The captured length
+ */
+static inline void view_init(struct packet_view *v, const u_char *packet,
+                             uint32_t caplen)
+{
+    v->ptr = packet;
+    v->off = 0;
+    v->remaining = caplen;
+    v->caplen = caplen;
+}
+
+/**
+ * @brief Get the bytes at the current position without advancing
+ *
+ * @param v The view
+ * @param len The number of bytes needed
+ * @return const void* The current position, NULL if less than len bytes remain
+ */
+static inline const void *view_peek(const struct packet_view *v, uint32_t len)
+{
+    if (__builtin_expect(len > v->remaining, 0))
+        return NULL;
+    return v->ptr;
+}
+
+/**
+ * @brief Get the bytes at the current position and advance past them
+ *
+ * @param v The view
+ * @param len The number of bytes needed
+ * @return const void* The bytes, NULL if less than len bytes remain, in which
+ * case the view is left as is
+ */
+static inline const void *view_pull(struct packet_view *v, uint32_t len)
+{
+    const u_char *p = v->ptr;
+    if (__builtin_expect(len > v->remaining, 0))
+        return NULL;
+    v->ptr += len;
+    v->off += len;
+    v->remaining -= len;
+    return p;
+}
+
+/**
+ * @brief Advance past bytes
+ *
+ * @param v The view
+ * @param len The number of bytes to skip
+ * @return int 0 on success, -1 if less than len bytes remain
+ */
+static inline int view_skip(struct packet_view *v, uint32_t len)
+{
+    return view_pull(v, len) ? 0 : -1;
+}
+
+/**
+ * @brief Restrict a view to the length announced by a header
+ *
+ * The view is never extended past what it already covers.
+ *
+ * @param v The view
+ * @param len The length from the current position
+ * @return int 0 if len bytes remain, -1 if the view was shorter
+ */
+static inline int view_limit(struct packet_view *v, uint32_t len)
+{
+    if (__builtin_expect(len > v->remaining, 0))
+        return (-1);
+    v->remaining = len;
+    return 0;
+}
+
+/**
+ * @brief Read a byte and advance past it
+ *
+ * @param v The view
+ * @param val The byte read
+ * @return int 0 on success, -1 if the view is empty
+ */
+static inline int view_u8(struct packet_view *v, uint8_t *val)
+{
+    const uint8_t *p = view_pull(v, 1);
+    if (p == NULL)
+        return (-1);
+    *val = *p;
+    return 0;
+}
+
+/**
+ * @brief Read a big endian 16 bits integer and advance past it
+ *
+ * @param v The view
+ * @param val The integer read, in host byte order
+ * @return int 0 on success, -1 if less than 2 bytes remain
+ */
+static inline int view_be16(struct packet_view *v, uint16_t *val)
+{
+    const void *p = view_pull(v, 2);
+    if (p == NULL)
+        return (-1);
+    memcpy(val, p, 2);
+    *val = be16toh(*val);
+    return 0;
+}
+
+/**
+ * @brief Read a big endian 32 bits integer and advance past it
+ *
+ * @param v The view
+ * @param val The integer read, in host byte order
+ * @return int 0 on success, -1 if less than 4 bytes remain
+ */
+static inline int view_be32(struct packet_view *v, uint32_t *val)
+{
+    const void *p = view_pull(v, 4);
+    if (p == NULL)
+        return (-1);
+    memcpy(val, p, 4);
+    *val = be32toh(*val);
+    return 0;
+}
+
+#endif // VIEW_H
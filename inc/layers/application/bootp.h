@@ -11,6 +11,8 @@
 #ifndef BOOTP_H
 #define BOOTP_H
 
+#include "decode.h"
+#include "json.h"
 #include "types.h"
 
 /**
@@ -42,11 +44,41 @@ struct bootphdr {
  * 
  * Get BOOTP header from packet.
  * 
- * @param packet Pointer to the packet
+ * @param v The view of the message
+ * @param pi The decoded packet to fill
  * @return int 0 on success, -1 on error
  * 
  * @see cast_bootp
  */
-int cast_bootp(const u_char* packet);
+int cast_bootp(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Write a BOOTP message as JSON
+ * 
+ * The header is written as a "bootp" object, with the addresses and the DHCP
+ * options at VERBOSE_COMPLETE.
+ * 
+ * @param j The writer
+ * @param msg The message
+ * @param len The length of the message
+ * @param verbose The verbose level
+ * @return int 0 on success, -1 if the header is cut
+ * 
+ * @see json_bootp
+ */
+int json_bootp(struct json *j, const u_char *msg, uint32_t len, int verbose);
+
+/**
+ * @brief Print BOOTP header
+ * 
+ * Print the BOOTP header and its vendor specific information.
+ * 
+ * @param packet Pointer to the packet
+ * @param data_size Size of the data
+ * @return int 0 on success, -1 if the header is cut
+ * 
+ * @see print_bootp
+ */
+int print_bootp(const u_char* packet, int data_size);
 
 #endif // BOOTP_H
\ No newline at end of file
@@ -11,6 +11,9 @@
 #ifndef DNS_H
 #define DNS_H
 
+#include "decode.h"
+#include "dnsname.h"
+#include "json.h"
 #include "types.h"
 
 /**
@@ -40,12 +43,56 @@ struct dnshdr {
  * 
  * Get DNS header from packet.
  * 
- * @param packet Pointer to the packet
- * @param data_size Size of the data
+ * @param v The view of the message
+ * @param pi The decoded packet to fill
  * @return int 0 on success, -1 on error
  * 
  * @see cast_dns
  */
-int cast_dns(const u_char* packet, int data_size);
+int cast_dns(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Get the first question of a DNS message
+ * 
+ * The name is read as dns_name_read() does.
+ * 
+ * @param msg The message
+ * @param len The length of the message
+ * @param name The buffer to write to, DNS_NAME_LEN bytes
+ * @param type The type of the question
+ * @return int 0 on success, -1 if there is no complete question
+ * 
+ * @see dns_question
+ */
+int dns_question(const u_char *msg, uint32_t len, char *name, uint16_t *type);
+
+/**
+ * @brief Write a DNS message as JSON
+ * 
+ * The header is written as a "dns" object, with the questions and the answers
+ * and their data at VERBOSE_COMPLETE.
+ * 
+ * @param j The writer
+ * @param msg The message
+ * @param len The length of the message
+ * @param verbose The verbose level
+ * @return int 0 on success, -1 if the message is cut
+ * 
+ * @see json_dns
+ */
+int json_dns(struct json *j, const u_char *msg, uint32_t len, int verbose);
+
+/**
+ * @brief Print DNS message
+ * 
+ * Print the header, questions and answers of a DNS message.
+ * 
+ * @param packet Pointer to the packet
+ * @param data_size Size of the data
+ * @return int 0 on success, -1 if the message is cut
+ * 
+ * @see print_dns
+ */
+int print_dns(const u_char* packet, int data_size);
 
 #endif // DNS_H
\ No newline at end of file
@@ -0,0 +1,69 @@
+/**
+ * @author Flavien Lallemant
+ * @file dnsname.h
+ * @brief DNS name decoder declaration
+ * @ingroup application
+ *
+ * This file contains the declaration of the decoder of the names of the DNS
+ * messages, and of the cache interning the decoded names.
+ * A name is read from the message itself, following its compression pointers
+ * at most DNS_NAME_HOPS times, and never written past DNS_NAME_LEN bytes.
+ * Each thread interns the names it reads in a small LRU cache, so a name
+ * seen again is given back as the same string, and its hash comes with it
+ * for the tables keyed by names.
+ */
+
+#ifndef DNSNAME_H
+#define DNSNAME_H
+
+#include <stdint.h>
+#include "types.h"
+
+#define DNS_NAME_LEN 256 /**< Size of a printed name, with the null byte */
+#define DNS_NAME_HOPS 16 /**< Compression pointers followed in a name */
+#define DNS_NAME_CACHE 4096 /**< Names interned per thread */
+
+/**
+ * @brief Interned name
+ */
+struct dns_name {
+    const char *str;    /**< The name, with dots between its labels */
+    uint32_t hash;      /**< Hash of the name */
+    uint16_t len;       /**< Length of the name */
+};
+
+
+/**
+ * @brief Read a name of a message
+ *
+ * The labels are written with dots between them, the non printable bytes
+ * replaced by dots, and the root name as a dot.
+ *
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the name, set to the offset after it
+ * @param name The buffer to write to, DNS_NAME_LEN bytes
+ * @return int The length of the name, -1 if it is cut, too long or loops
+ */
+int dns_name_read(const u_char *msg, uint32_t len, uint32_t *off, char *name);
+
+/**
+ * @brief Read and intern a name of a message
+ *
+ * The name is valid until the calling thread reads another name.
+ *
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the name, set to the offset after it
+ * @return const struct dns_name* The name, NULL if it is cut, too long or
+ * loops
+ */
+const struct dns_name *dns_name_intern(const u_char *msg, uint32_t len,
+                                       uint32_t *off);
+
+/**
+ * @brief Free the name cache of the calling thread
+ */
+void dns_name_release(void);
+
+#endif // DNSNAME_H
@@ -17,8 +17,9 @@
  * @brief Check if the packet is an FTP packet
  * 
  * @param packet The packet
+ * @param size The size of the packet
  * @return int 1 if the packet is an FTP packet, 0 otherwise
  */
-int is_ftp(const u_char *packet);
+int is_ftp(const u_char *packet, uint32_t size);
 
 #endif // FTP_H
\ No newline at end of file
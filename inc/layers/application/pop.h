@@ -17,8 +17,9 @@
  * @brief Check if a packet is a POP packet
  * 
  * @param packet The packet to check
+ * @param size The size of the packet
  * @return 1 if the packet is a POP packet, 0 otherwise
  */
-int is_pop(const u_char *packet);
+int is_pop(const u_char *packet, uint32_t size);
 
 #endif // POP_H
\ No newline at end of file
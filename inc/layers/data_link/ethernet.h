@@ -18,17 +18,30 @@
 
 #include <net/ethernet.h>
 #include <netinet/if_ether.h>
+#include "decode.h"
 #include "types.h"
 
 
 /**
  * @brief Handle an Ethernet frame
  * 
- * This function handles an Ethernet frame.
+ * This function decodes an Ethernet frame and the layers above it.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_ethernet(const u_char* packet);    /* Get ethernet frame from packet then handle the ethernet type */
+int cast_ethernet(struct packet_view *v, struct packet_info *pi);    /* Get ethernet frame from packet then handle the ethernet type */
+
+/**
+ * @brief Print an Ethernet frame
+ * 
+ * This function prints the Ethernet layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the ethertype is known, -1 otherwise
+ */
+int print_ethernet(const struct packet_info *pi, const u_char *packet);
 
 #endif // ETHERNET_H
\ No newline at end of file
@@ -0,0 +1,31 @@
+/**
+ * @author Flavien Lallemant
+ * @file raw.h
+ * @brief Raw IP layer
+ * @ingroup data_link
+ *
+ * This file contains the definition of the raw IP link layer, of the tun
+ * devices and of the captures without link layer header.
+ * It provides the function to handle raw IP packets.
+ */
+
+#ifndef RAW_H
+#define RAW_H
+
+#include "decode.h"
+#include "types.h"
+
+
+/**
+ * @brief Handle a raw IP packet
+ *
+ * This function tells IPv4 from IPv6 by the version of the header, then
+ * decodes the layers.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ */
+int cast_raw(struct packet_view *v, struct packet_info *pi);
+
+#endif // RAW_H
@@ -0,0 +1,56 @@
+/**
+ * @author Flavien Lallemant
+ * @file sll.h
+ * @brief Linux cooked capture layer
+ * @ingroup data_link
+ *
+ * This file contains the definition of the Linux cooked capture layer, the
+ * header libpcap writes in place of the link layer one on the any device,
+ * in its two versions.
+ * It provides the functions to handle cooked packets.
+ */
+
+#ifndef SLL_H
+#define SLL_H
+
+#include "decode.h"
+#include "types.h"
+
+#define SLL_HDR_LEN 16  /**< Length of the header */
+#define SLL2_HDR_LEN 20 /**< Length of the header of the version 2 */
+
+
+/**
+ * @brief Handle a Linux cooked packet
+ *
+ * This function decodes a cooked header and the layers above it.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ */
+int cast_sll(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Handle a Linux cooked packet of the version 2
+ *
+ * This function decodes a cooked header and the layers above it.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ */
+int cast_sll2(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print a Linux cooked header
+ *
+ * This function prints the cooked header of a decoded packet on one line.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ */
+int print_sll(const struct packet_info *pi, const u_char *packet);
+
+#endif // SLL_H
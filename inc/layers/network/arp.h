@@ -13,6 +13,7 @@
 #ifndef ARP_H
 #define ARP_H
 
+#include "decode.h"
 #include "types.h"
 #include <net/if_arp.h>
 #include <net/ethernet.h>
@@ -27,11 +28,23 @@
 /**
  * @brief Handle an ARP packet
  * 
- * This function handles an ARP packet.
+ * This function decodes an ARP packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_arp(const u_char *packet);
+int cast_arp(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print an ARP packet
+ * 
+ * This function prints the ARP layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the packet is well handled, 1 otherwise
+ */
+int print_arp(const struct packet_info *pi, const u_char *packet);
 
 #endif // ARP_H
\ No newline at end of file
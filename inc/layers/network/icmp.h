@@ -12,6 +12,7 @@
 #define ICMP_H
 
 #include <netinet/ip_icmp.h>
+#include "decode.h"
 #include "types.h"
 
 /**
@@ -26,11 +27,23 @@
 /**
  * @brief Handle an ICMP packet
  * 
- * This function handles an ICMP packet.
+ * This function decodes an ICMP packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_icmp(const u_char *packet);
+int cast_icmp(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print an ICMP packet
+ * 
+ * This function prints the ICMP layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the message is well handled, -1 otherwise
+ */
+int print_icmp(const struct packet_info *pi, const u_char *packet);
 
 #endif // ICMP_H
\ No newline at end of file
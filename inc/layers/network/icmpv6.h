@@ -11,6 +11,7 @@
 #ifndef ICMPv6_H
 #define ICMPv6_H
 #include <netinet/icmp6.h>
+#include "decode.h"
 #include "types.h"
 
 /**
@@ -37,11 +38,23 @@
 /**
  * @brief Handle an ICMPv6 packet
  * 
- * This function handles an ICMPv6 packet.
+ * This function decodes an ICMPv6 packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_icmp6(const u_char *packet);
+int cast_icmp6(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print an ICMPv6 packet
+ * 
+ * This function prints the ICMPv6 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the message is well handled, -1 otherwise
+ */
+int print_icmp6(const struct packet_info *pi, const u_char *packet);
 
 #endif // ICMPv6_H
\ No newline at end of file
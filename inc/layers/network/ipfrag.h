@@ -0,0 +1,126 @@
+/**
+ * @author Flavien Lallemant
+ * @file ipfrag.h
+ * @brief IP fragment reassembly declaration
+ * @ingroup network
+ *
+ * This file contains the declaration of the IPv4 and IPv6 fragment
+ * reassembly cache.
+ * A fragment is never decoded past its IP header: when the reassembly is
+ * enabled, its payload is queued with the other fragments of its datagram,
+ * keyed by the addresses, the identification and the protocol, and the
+ * fragment completing the datagram is decoded as the whole datagram.
+ * The memory of every thread is counted against one global cap, the
+ * fragments over it are dropped; the datagrams left incomplete are freed
+ * after the timeout.
+ * Each thread has its own datagrams; the pipeline sends every fragment of a
+ * datagram to the same worker, so they are complete in each of them.
+ */
+
+#ifndef IPFRAG_H
+#define IPFRAG_H
+
+#include <netinet/ip.h>
+#include <stdio.h>
+#include "decode.h"
+#include "types.h"
+#include "view.h"
+
+#define IPFRAG_MEMORY (16 << 20) /**< Default memory cap in bytes */
+#define IPFRAG_TIMEOUT 30 /**< Default lifetime of an incomplete datagram in seconds */
+#define IPFRAG_HDR_MAX 192 /**< Most bytes of headers kept before the payload of a datagram */
+
+/**
+ * @brief Reassembly configuration
+ */
+struct ipfrag_config {
+    size_t memory;  /**< Memory cap shared by every thread, 0 for the default */
+    int timeout;    /**< Lifetime of an incomplete datagram in seconds, 0 for the default */
+};
+
+
+/**
+ * @brief Enable the reassembly
+ *
+ * @param cfg The configuration
+ */
+void ipfrag_init(const struct ipfrag_config *cfg);
+
+/**
+ * @brief Check if the reassembly is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int ipfrag_enabled(void);
+
+/**
+ * @brief Handle an IPv4 fragment
+ *
+ * The IP fields of the decoded packet must be set. The fragment gets the
+ * LAYER_FRAG flag and its fields; if it completes its datagram, the view is
+ * moved to the payload of the datagram and the packet gets the LAYER_DEFRAG
+ * flag instead.
+ *
+ * @param v The view of the fragment payload
+ * @param ip The IPv4 header
+ * @param pi The decoded packet
+ * @return int 1 if the datagram is complete, 0 if the fragment was handled,
+ * -1 if it was dropped
+ */
+int ipfrag_ipv4(struct packet_view *v, const struct iphdr *ip,
+                struct packet_info *pi);
+
+/**
+ * @brief Handle an IPv6 fragment header
+ *
+ * The IP fields of the decoded packet must be set, the protocol becomes the
+ * one following the fragment header. A fragment header alone in its
+ * datagram is just skipped; otherwise the fragment is handled as by
+ * ipfrag_ipv4().
+ *
+ * @param v The view of the IPv6 payload, starting with the fragment header
+ * @param pi The decoded packet
+ * @return int 1 if the payload can be decoded, 0 if the fragment was
+ * handled, -1 if it was dropped
+ */
+int ipfrag_ipv6(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Get the datagram a packet completed
+ *
+ * The datagram starts with the headers of its first fragment; it stays
+ * valid until the next packet is decoded by the same thread.
+ *
+ * @param pi The decoded packet
+ * @param frags The number of fragments of the datagram, NULL if not needed
+ * @return const u_char* The datagram, NULL without the LAYER_DEFRAG flag
+ */
+const u_char *ipfrag_data(const struct packet_info *pi, uint16_t *frags);
+
+/**
+ * @brief Print the fragment or the reassembled datagram of a packet
+ *
+ * This function prints one line for a packet with the LAYER_FRAG or the
+ * LAYER_DEFRAG flag.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ */
+int print_ipfrag(const struct packet_info *pi, const u_char *packet);
+
+/**
+ * @brief Free the datagrams and buffers of the calling thread
+ *
+ * The counters of the thread are added to the global ones.
+ */
+void ipfrag_release(void);
+
+/**
+ * @brief Print the reassembly counters, if any fragment was seen
+ *
+ * @param stream The stream to print to
+ */
+void ipfrag_print_stats(FILE *stream);
+
+#endif // IPFRAG_H
@@ -14,17 +14,30 @@
 #include <netinet/ip.h>
 #include <linux/in.h>
 #include <arpa/inet.h>
+#include "decode.h"
 #include "types.h"
 
 
 /**
  * @brief Handle an IPv4 packet
  * 
- * This function handles an IPv4 packet.
+ * This function decodes an IPv4 packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_ipv4(const u_char* packet);
+int cast_ipv4(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print an IPv4 packet
+ * 
+ * This function prints the IPv4 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the protocol is known, -1 otherwise
+ */
+int print_ipv4(const struct packet_info *pi, const u_char *packet);
 
 #endif // IPv4_H
\ No newline at end of file
@@ -14,17 +14,44 @@
 #include <netinet/ip6.h>
 #include <linux/in6.h>
 #include <arpa/inet.h>
+#include "decode.h"
 #include "types.h"
 
 
+/**
+ * @brief Skip the IPv6 extension headers
+ *
+ * The Hop-by-Hop Options, Routing and Destination Options headers are
+ * skipped; the walk stops at any other header, a fragment header included.
+ *
+ * @param p The header following the IPv6 or the fragment header
+ * @param remain The number of captured bytes from p
+ * @param nxt The type of the header at p, set to the one the walk stops at
+ * unless a header is truncated
+ * @return int64_t The number of bytes skipped, -1 if a header is truncated
+ */
+int64_t ipv6_skip_ext(const u_char *p, int64_t remain, uint8_t *nxt);
+
 /**
  * @brief Handle an IPv6 packet
  * 
- * This function handles an IPv6 packet.
+ * This function decodes an IPv6 packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_ipv6(const u_char* packet);
+int cast_ipv6(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print an IPv6 packet
+ * 
+ * This function prints the IPv6 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the next header is known, -1 otherwise
+ */
+int print_ipv6(const struct packet_info *pi, const u_char *packet);
 
 #endif  // IPv6_H
\ No newline at end of file
@@ -3,19 +3,24 @@
  * @file tls.h
  * @brief TLS layer
  * @ingroup session
- * 
+ *
  * This file contains the definition of the TLS layer.
+ * It provides functions to parse the ClientHello and ServerHello handshake
+ * messages in place, and to fingerprint them with JA3.
  */
 
 #ifndef TLS_H
 #define TLS_H
 
 #include <stdint.h>
+#include "decode.h"
+#include "json.h"
+#include "types.h"
 
 
 /**
  * @brief TLS record layer
- * 
+ *
  * This structure represents the TLS record layer.
  */
 struct tlshdr {
@@ -23,6 +28,141 @@ struct tlshdr {
     uint16_t tls_lv;
     uint16_t tls_len;
 } __attribute__((packed));
-#define TLS_V(tls) (((tls)->tls_lv & 0x00FF)) /**< Get the TLS version */
+#define TLS_V(tls) (be16toh((tls)->tls_lv) & 0x00FF) /**< Get the TLS version */
 
-#endif // TLS_H
\ No newline at end of file
+#define TLS_CT_HANDSHAKE 22 /**< Record content type of the handshake messages */
+#define TLS_HS_CLIENT_HELLO 1 /**< Handshake type of a ClientHello */
+#define TLS_HS_SERVER_HELLO 2 /**< Handshake type of a ServerHello */
+#define TLS_JA3_LEN 2048 /**< Longest JA3 string, with the null byte */
+
+/**
+ * @brief Bytes of a hello, in the message
+ */
+struct tls_bytes {
+    const u_char *ptr;  /**< First byte, NULL if absent */
+    uint16_t len;       /**< Number of bytes */
+};
+
+/**
+ * @brief ClientHello or ServerHello
+ *
+ * The fields point into the record the hello was parsed from.
+ */
+struct tls_hello {
+    uint8_t type;               /**< TLS_HS_CLIENT_HELLO or TLS_HS_SERVER_HELLO */
+    uint8_t truncated;          /**< 1 if the hello goes past the bytes given */
+    uint16_t version;           /**< Legacy version of the hello */
+    uint16_t selected;          /**< Version of the supported_versions of a ServerHello, 0 if none */
+    uint16_t cipher;            /**< Cipher suite of a ServerHello */
+    struct tls_bytes ciphers;   /**< Cipher suites of a ClientHello, 2 bytes each */
+    struct tls_bytes exts;      /**< Extensions */
+    struct tls_bytes sni;       /**< Host name of the server_name extension */
+    struct tls_bytes alpn;      /**< Protocol list of the ALPN extension */
+    struct tls_bytes versions;  /**< Versions of the supported_versions of a ClientHello, 2 bytes each */
+    struct tls_bytes groups;    /**< Groups of the supported_groups extension, 2 bytes each */
+    struct tls_bytes formats;   /**< Formats of the ec_point_formats extension, 1 byte each */
+};
+
+
+/**
+ * @brief Parse the hello starting a TLS record
+ *
+ * Nothing is copied. A hello cut by the end of the bytes keeps its fields up
+ * to the first one cut, and is flagged truncated.
+ *
+ * @param rec The record
+ * @param len The number of bytes of the record available
+ * @param h The hello to fill
+ * @return int 0 on success, -1 if the record doesn't start with a hello
+ */
+int tls_parse_hello(const u_char *rec, uint32_t len, struct tls_hello *h);
+
+/**
+ * @brief Get the version of a hello
+ *
+ * @param h The hello
+ * @return uint16_t The version chosen by a ServerHello, or the highest
+ * offered by a ClientHello
+ */
+uint16_t tls_hello_version(const struct tls_hello *h);
+
+/**
+ * @brief Get the name of a TLS version
+ *
+ * @param version The version, e.g. 0x0303
+ * @return const char* The name, NULL if unknown
+ */
+const char *tls_version_name(uint16_t version);
+
+/**
+ * @brief Build the JA3 string of a hello
+ *
+ * A ServerHello gives the JA3S string.
+ *
+ * @param h The hello
+ * @param text The buffer to write to, TLS_JA3_LEN bytes
+ * @return int The length of the string, -1 if the hello is truncated
+ */
+int tls_ja3(const struct tls_hello *h, char *text);
+
+/**
+ * @brief Compute the JA3 hash of a hello
+ *
+ * @param h The hello
+ * @param hex The buffer to write to, 33 bytes
+ * @return int 0 on success, -1 if the hello is truncated
+ *
+ * @see tls_ja3
+ */
+int tls_ja3_hash(const struct tls_hello *h, char *hex);
+
+/**
+ * @brief Get the TLS bytes of a decoded packet
+ *
+ * With the reassembly, they are the stream bytes handed over with the
+ * packet, the offsets of pi->u.tls are relative to them.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param len The number of bytes
+ * @return const u_char* The bytes
+ */
+const u_char *tls_payload(const struct packet_info *pi, const u_char *packet,
+                          uint32_t *len);
+
+/**
+ * @brief Cast TLS record
+ *
+ * The record header is read, and the hello it starts with if any.
+ *
+ * @param v The view of the record
+ * @param pi The decoded packet to fill
+ * @return int 0 on success, -1 if the payload is too short
+ */
+int cast_tls(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Write a TLS record as JSON
+ *
+ * The record header is written as a "tls" object, with the fields of its
+ * hello, and the JA3 string at VERBOSE_COMPLETE.
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ * @param rec The record
+ * @param len The length of the record
+ * @param verbose The verbose level
+ */
+void json_tls(struct json *j, const struct packet_info *pi, const u_char *rec,
+              uint32_t len, int verbose);
+
+/**
+ * @brief Print a TLS record
+ *
+ * @param pi The decoded packet
+ * @param rec The record
+ * @param len The length of the record
+ */
+void print_tls(const struct packet_info *pi, const u_char *rec, uint32_t len);
+
+#endif // TLS_H
@@ -0,0 +1,90 @@
+/**
+ * @author Flavien Lallemant
+ * @file reasm.h
+ * @brief TCP stream reassembly declaration
+ * @ingroup transport
+ *
+ * This file contains the declaration of the TCP reassembly engine.
+ * When enabled, the payload of each TCP segment is queued in its flow and
+ * direction instead of going straight to the application dissectors.
+ * The bytes are handed to the dissectors in sequence order once the sender
+ * pushed them, or once enough of them are queued, so a request split across
+ * segments is recognized and printed as a whole.
+ * Each thread has its own flows; the pipeline sends every packet of a flow to
+ * the same worker, so the streams are complete in each of them.
+ */
+
+#ifndef REASM_H
+#define REASM_H
+
+#include <stdio.h>
+#include "decode.h"
+#include "types.h"
+
+#define REASM_MEMORY (64 << 20) /**< Default memory budget in bytes */
+#define REASM_TIMEOUT 120 /**< Default idle timeout of a flow in seconds */
+#define REASM_DIR_MAX (256 << 10) /**< Bytes queued in a direction before a gap is skipped */
+#define REASM_DELIVER_MAX (64 << 10) /**< Bytes queued in order before they are handed over unpushed */
+
+/**
+ * @brief Reassembly configuration
+ */
+struct reasm_config {
+    size_t memory;  /**< Memory budget shared by every thread, 0 for the default */
+    int timeout;    /**< Idle timeout of a flow in seconds, 0 for the default */
+};
+
+
+/**
+ * @brief Enable the reassembly
+ *
+ * @param cfg The configuration
+ */
+void reasm_init(const struct reasm_config *cfg);
+
+/**
+ * @brief Check if the reassembly is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int reasm_enabled(void);
+
+/**
+ * @brief Queue a TCP segment and hand the stream bytes it completes over
+ *
+ * The TCP fields of the decoded packet must be set. If bytes are handed
+ * over, they go through the application dissectors and the LAYER_STREAM flag
+ * is set.
+ *
+ * @param payload The view of the segment payload
+ * @param pi The decoded packet
+ * @return int 0 on success, -1 if the segment was dropped
+ */
+int reasm_segment(const struct packet_view *payload, struct packet_info *pi);
+
+/**
+ * @brief Get the stream bytes handed over with a packet
+ *
+ * The bytes stay valid until the next packet is decoded by the same thread.
+ *
+ * @param pi The decoded packet
+ * @param data The bytes, set if there are
+ * @return uint32_t The number of bytes, 0 if none were handed over
+ */
+uint32_t reasm_data(const struct packet_info *pi, const u_char **data);
+
+/**
+ * @brief Free the flows and buffers of the calling thread
+ *
+ * The counters of the thread are added to the global ones.
+ */
+void reasm_release(void);
+
+/**
+ * @brief Print the reassembly counters
+ *
+ * @param stream The stream to print to
+ */
+void reasm_print_stats(FILE *stream);
+
+#endif // REASM_H
@@ -17,18 +17,32 @@
 #endif
 
 #include <netinet/tcp.h> 
+#include "decode.h"
 #include "types.h"
 
 
 /**
  * @brief Handle a TCP packet
  * 
- * This function handles a TCP packet.
+ * This function decodes a TCP packet.
  * 
- * @param packet The packet to handle
- * @param remain_size The remaining size of the packet
+ * @param v The view of the packet, at the start of the header and limited to
+ * the IP payload
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_tcp(const u_char *packet, int remain_size);
+int cast_tcp(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print a TCP packet
+ * 
+ * This function prints the TCP layer of a decoded packet and its application
+ * payload.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ */
+int print_tcp(const struct packet_info *pi, const u_char *packet);
 
 #endif // TCP_H
\ No newline at end of file
@@ -11,17 +11,31 @@
 #define UDP_H
 
 #include <netinet/udp.h>
+#include "decode.h"
 #include "types.h"
 
 
 /**
  * @brief Handle a UDP packet
  * 
- * This function handles a UDP packet.
+ * This function decodes a UDP packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled, -1 otherwise
  */
-int cast_udp(const u_char* packet);
+int cast_udp(struct packet_view *v, struct packet_info *pi);
+
+/**
+ * @brief Print a UDP packet
+ * 
+ * This function prints the UDP layer of a decoded packet and its application
+ * payload.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ */
+int print_udp(const struct packet_info *pi, const u_char *packet);
 
 #endif // UDP_H
\ No newline at end of file
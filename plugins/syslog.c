@@ -0,0 +1,144 @@
+/**
+ * @author Flavien Lallemant
+ * @file syslog.c
+ * @brief Syslog dissector plugin
+ *
+ * This file contains an example of plugin: a dissector of the syslog
+ * messages sent over UDP (RFC 3164 and 5424), on port 514 and, through its
+ * match function, on the other ports too.
+ * It is built with make plugins and loaded with --plugin bin/plugins/syslog.so.
+ *
+ * @see dissector.h
+ */
+
+// Global libraries
+#include <stdio.h>
+#include <string.h>
+
+// Local header files
+#include "dissector.h"
+
+#define SYSLOG_PRI_LEN 5 /**< Longest priority, <191> */
+
+/**
+ * @brief Syslog message, in pi->u.plugin
+ */
+struct syslog_info {
+    uint8_t facility;   /**< The facility */
+    uint8_t severity;   /**< The severity */
+    uint8_t text_off;   /**< Offset of the text in the payload */
+    uint32_t number;    /**< Number of the message in its flow */
+};
+
+/**
+ * @brief State of a flow
+ */
+struct syslog_flow {
+    uint32_t messages;  /**< Messages seen */
+};
+
+static const char *severities[8] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+}; /**< Names of the severities */
+
+static int syslog_decode(struct packet_view *v, struct packet_info *pi);
+
+
+/**
+ * @brief Parse the priority of a message
+ *
+ * @param payload The payload
+ * @param len The length of the payload
+ * @param pri The priority
+ * @return int The length of the priority, 0 if there is none
+ */
+static int syslog_pri(const u_char *payload, uint32_t len, int *pri)
+{
+    if (len < 3 || payload[0] != '<')
+        return 0;
+    int value = 0;
+    uint32_t i = 1;
+    while (i < len && i < SYSLOG_PRI_LEN && payload[i] >= '0' &&
+           payload[i] <= '9')
+        value = value * 10 + payload[i++] - '0';
+    if (i == 1 || i == len || payload[i] != '>' || value > 191)
+        return 0;
+    *pri = value;
+    return i + 1;
+}
+
+
+/**
+ * @brief Recognize a syslog message on another port
+ */
+static int syslog_match(const u_char *payload, uint32_t len)
+{
+    int pri;
+    return syslog_pri(payload, len, &pri) > 0;
+}
+
+
+/**
+ * @brief Print a syslog message
+ */
+static void syslog_print(const struct packet_info *pi, const u_char *payload,
+                         uint32_t len)
+{
+    struct syslog_info info;
+    memcpy(&info, pi->u.plugin, sizeof(info));
+    uint32_t text = info.text_off < len ? len - info.text_off : 0;
+    while (text > 0 && (payload[info.text_off + text - 1] == '\n' ||
+                        payload[info.text_off + text - 1] == '\0'))
+        text--;
+    out_printf("facility %u, %s, message %u of the flow, %.*s",
+               info.facility, severities[info.severity], info.number,
+               (int)text, payload + info.text_off);
+}
+
+
+static const struct dissector_plugin syslog_dissector = {
+    .name = "SYSLOG",
+    .layer = DISSECTOR_UDP,
+    .keys = {514},
+    .key_count = 1,
+    .match = syslog_match,
+    .match_len = SYSLOG_PRI_LEN + 1,
+    .decode = syslog_decode,
+    .print = syslog_print,
+    .state_size = sizeof(struct syslog_flow),
+}; /**< The dissector */
+
+
+/**
+ * @brief Decode a syslog message
+ */
+static int syslog_decode(struct packet_view *v, struct packet_info *pi)
+{
+    int pri;
+    int len = syslog_pri(v->ptr, v->remaining, &pri);
+    if (len == 0)
+        return (-1);
+
+    struct syslog_info info = {pri >> 3, pri & 7, len, 0};
+    struct syslog_flow *flow = dissector_state(&syslog_dissector, pi);
+    if (flow)
+        info.number = ++flow->messages;
+    memcpy(pi->u.plugin, &info, sizeof(info));
+    return 0;
+}
+
+
+/**
+ * @brief Register the dissector
+ *
+ * @param abi The version of the interface
+ * @return int 0 on success, -1 on error
+ */
+int netstalker_plugin_init(int abi)
+{
+    _Static_assert(sizeof(struct syslog_info) <= sizeof(((struct packet_info *)0)->u.plugin),
+                   "syslog_info must fit in pi->u.plugin");
+    if (abi != DISSECTOR_ABI)
+        return (-1);
+    return dissector_register(&syslog_dissector) < 0 ? -1 : 0;
+}
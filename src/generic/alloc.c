@@ -0,0 +1,111 @@
+/**
+ * @author Flavien Lallemant
+ * @file alloc.c
+ * @brief Allocation counter definition
+ *
+ * This file contains the definition of the wrappers counting the calls to
+ * the allocation functions, linked with -Wl,--wrap by make DEBUG=1.
+ * Only the calls made by the program itself are counted, not the ones made
+ * inside libpcap or the C library.
+ *
+ * @see alloc.h
+ * @see alloc_mark
+ * @see alloc_report
+ * @see alloc_count
+ */
+
+#ifdef ALLOC_COUNT
+
+// Global libraries
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Local header files
+#include "alloc.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static atomic_ullong allocs; /**< Calls to malloc, calloc and realloc */
+static atomic_ullong frees; /**< Calls to free with a pointer */
+static unsigned long long mark_allocs; /**< Allocations before alloc_mark() */
+static unsigned long long mark_frees; /**< Frees before alloc_mark() */
+
+
+/**
+ * @brief Count a malloc call
+ */
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+
+/**
+ * @brief Count a calloc call
+ */
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_calloc(nmemb, size);
+}
+
+
+/**
+ * @brief Count a realloc call
+ */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+
+/**
+ * @brief Count a free call
+ */
+void __wrap_free(void *ptr)
+{
+    if (ptr)
+        atomic_fetch_add_explicit(&frees, 1, memory_order_relaxed);
+    __real_free(ptr);
+}
+
+
+/**
+ * @brief Start counting the allocations
+ */
+void alloc_mark(void)
+{
+    mark_allocs = atomic_load(&allocs);
+    mark_frees = atomic_load(&frees);
+}
+
+
+/**
+ * @brief Print the allocations counted since alloc_mark()
+ *
+ * @param stream The stream to print to
+ */
+void alloc_report(FILE *stream)
+{
+    fprintf(stream, "Allocations: %llu allocations, %llu frees since the "
+                    "capture started\n",
+            atomic_load(&allocs) - mark_allocs, atomic_load(&frees) - mark_frees);
+}
+
+
+/**
+ * @brief Get the number of allocations counted so far
+ *
+ * @return unsigned long long The calls to malloc, calloc and realloc
+ */
+unsigned long long alloc_count(void)
+{
+    return atomic_load_explicit(&allocs, memory_order_relaxed);
+}
+
+#endif // ALLOC_COUNT
@@ -0,0 +1,97 @@
+/**
+ * @author Flavien Lallemant
+ * @file arena.c
+ * @brief Per-packet scratch memory definition
+ *
+ * This file contains the definition of the per-thread bump arena.
+ * The arena is a list of blocks: an allocation takes the next bytes of the
+ * current block, or moves to the next block if they don't fit. A block is
+ * only added when the packet needs more than every block so far.
+ *
+ * @see arena.h
+ * @see arena_alloc
+ * @see arena_reset
+ * @see arena_release
+ */
+
+// Global libraries
+#include <stdint.h>
+#include <stdlib.h>
+
+// Local header files
+#include "arena.h"
+
+#define ARENA_ALIGN 16 /**< Alignment of the allocations */
+
+/**
+ * @brief Arena block
+ */
+struct arena_block {
+    struct arena_block *next;   /**< Next block */
+    size_t size;                /**< Bytes of data */
+    size_t used;                /**< Bytes handed out since the last reset */
+    _Alignas(ARENA_ALIGN) unsigned char data[]; /**< The memory */
+};
+
+static __thread struct arena_block *head = NULL; /**< First block of the thread */
+static __thread struct arena_block *cur = NULL; /**< Block allocations are taken from */
+
+
+/**
+ * @brief Allocate scratch memory for the current packet
+ *
+ * @param size The number of bytes
+ * @return void* The memory, aligned on 16 bytes, NULL if out of memory
+ */
+void *arena_alloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (cur == NULL)
+        cur = head;
+    while (cur && cur->used + size > cur->size)
+        cur = cur->next;
+
+    if (cur == NULL) { // No block has room left, add one at the end
+        struct arena_block **link = &head;
+        while (*link)
+            link = &(*link)->next;
+        size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        cur = malloc(sizeof(*cur) + bsize);
+        if (cur == NULL)
+            return NULL;
+        cur->next = NULL;
+        cur->size = bsize;
+        cur->used = 0;
+        *link = cur;
+    }
+    void *p = cur->data + cur->used;
+    cur->used += size;
+    return p;
+}
+
+
+/**
+ * @brief Rewind the arena of the calling thread
+ *
+ * Every allocation made since the previous reset becomes invalid.
+ */
+void arena_reset(void)
+{
+    for (struct arena_block *b = head; b != NULL; b = b->next)
+        b->used = 0;
+    cur = head;
+}
+
+
+/**
+ * @brief Free the blocks of the calling thread
+ */
+void arena_release(void)
+{
+    while (head) {
+        struct arena_block *b = head;
+        head = b->next;
+        free(b);
+    }
+    cur = NULL;
+}
@@ -0,0 +1,718 @@
+/**
+ * @author Flavien Lallemant
+ * @file capindex.c
+ * @brief Capture file index definition
+ *
+ * This file contains the definition of the index of a capture dump.
+ * The index is built in memory while the dump is written: a bucket is added
+ * each time a packet starts a later time bucket than the last one, and each
+ * flow of a hash table appends the distance from its previous record to its
+ * growing postings. Packets are expected in capture order, a packet older
+ * than the last bucket is only found through its flow.
+ * The index file is little endian: a header, the buckets, the flows sorted
+ * by key, then the postings of the flows.
+ *
+ * @see capindex.h
+ * @see capindex_create
+ * @see capindex_add
+ * @see capindex_close
+ * @see capindex_parse_time
+ * @see capindex_parse_flow
+ * @see capindex_select
+ */
+
+// Global libraries
+#define _GNU_SOURCE // strptime()
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "capindex.h"
+#include "encap.h"
+
+#define INDEX_MAGIC "NSTKIDX1"  /**< First bytes of an index file */
+#define INDEX_HEADER 56         /**< Bytes of the header */
+#define INDEX_BUCKET 16         /**< Bytes of a bucket */
+#define INDEX_KEY 40            /**< Bytes of a flow key */
+#define INDEX_FLOW (INDEX_KEY + 16) /**< Bytes of a flow */
+#define INDEX_SLOTS 1024        /**< Initial slots of the flow table */
+
+/**
+ * @brief First record of a time bucket
+ */
+struct index_bucket {
+    int64_t start;  /**< First second of the bucket */
+    uint64_t off;   /**< Offset of the record */
+};
+
+/**
+ * @brief Records of a flow
+ */
+struct index_flow {
+    struct flow_key key;    /**< The flow */
+    uint64_t last;          /**< Offset of the last record */
+    uint32_t packets;       /**< Number of records, 0 for a free slot */
+    uint32_t len;           /**< Bytes of postings */
+    uint32_t size;          /**< Allocated bytes of postings */
+    uint8_t *postings;      /**< Distances between the records, as varints */
+};
+
+/**
+ * @brief Index being built
+ */
+struct capindex_writer {
+    char path[PATH_MAX];            /**< The index file */
+    int linktype;                   /**< Link type of the packets */
+    unsigned bucket;                /**< Seconds per bucket */
+    uint64_t packets;               /**< Packets indexed */
+    struct index_bucket *buckets;   /**< The buckets */
+    size_t bucket_count;            /**< Number of buckets */
+    size_t bucket_size;             /**< Allocated buckets */
+    struct index_flow *flows;       /**< The flow table */
+    size_t flow_count;              /**< Number of flows */
+    size_t flow_size;               /**< Slots of the table, a power of 2 */
+    int errors;                     /**< Allocations that failed */
+};
+
+/**
+ * @brief Flow of a serialized index
+ */
+struct index_entry {
+    uint8_t key[INDEX_KEY];     /**< The key */
+    struct index_flow *flow;    /**< The flow */
+};
+
+
+/**
+ * @brief Write a little endian integer
+ *
+ * @param p Where to write
+ * @param v The integer
+ * @param len The number of bytes
+ */
+static void le_put(uint8_t *p, uint64_t v, int len)
+{
+    for (int i = 0; i < len; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+
+/**
+ * @brief Read a little endian integer
+ *
+ * @param p Where to read
+ * @param len The number of bytes
+ * @return uint64_t The integer
+ */
+static uint64_t le_get(const uint8_t *p, int len)
+{
+    uint64_t v = 0;
+    for (int i = len - 1; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+
+/**
+ * @brief Serialize a flow key
+ *
+ * @param key The key
+ * @param p Where to write, INDEX_KEY bytes
+ */
+static void key_put(const struct flow_key *key, uint8_t *p)
+{
+    memcpy(p, key->addr, 32);
+    le_put(p + 32, key->port[0], 2);
+    le_put(p + 34, key->port[1], 2);
+    p[36] = key->proto;
+    p[37] = key->ip_version;
+    p[38] = 0;
+    p[39] = 0;
+}
+
+
+/**
+ * @brief Get the bucket of a time
+ *
+ * @param sec The time in seconds
+ * @param bucket Seconds per bucket
+ * @return int64_t The first second of the bucket
+ */
+static int64_t bucket_start(int64_t sec, unsigned bucket)
+{
+    int64_t rem = sec % bucket;
+    return sec - (rem < 0 ? rem + bucket : rem);
+}
+
+
+/**
+ * @brief Start the index of a dump
+ *
+ * @param dump The path of the dump, the index goes to <dump>.idx
+ * @param linktype The link type of the packets
+ * @param bucket Seconds per time bucket, 0 for the default
+ * @return struct capindex_writer* The index, NULL on error
+ */
+struct capindex_writer *capindex_create(const char *dump, int linktype,
+                                        unsigned bucket)
+{
+    struct capindex_writer *w = calloc(1, sizeof(struct capindex_writer));
+    if (w == NULL) {
+        fprintf(stderr, "Error allocating the index\n");
+        return NULL;
+    }
+    if ((size_t)snprintf(w->path, sizeof(w->path), "%s.idx", dump) >=
+        sizeof(w->path)) {
+        fprintf(stderr, "Index path too long: %s.idx\n", dump);
+        free(w);
+        return NULL;
+    }
+    w->linktype = linktype;
+    w->bucket = bucket ? bucket : CAPINDEX_BUCKET;
+    w->flow_size = INDEX_SLOTS;
+    w->flows = calloc(w->flow_size, sizeof(struct index_flow));
+    if (w->flows == NULL) {
+        fprintf(stderr, "Error allocating the index\n");
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+
+/**
+ * @brief Find the slot of a flow
+ *
+ * @param flows The table
+ * @param size The number of slots, a power of 2
+ * @param key The flow
+ * @return struct index_flow* The slot of the flow, or the free slot for it
+ */
+static struct index_flow *flow_slot(struct index_flow *flows, size_t size,
+                                    const struct flow_key *key)
+{
+    size_t i = flow_hash(key) & (size - 1);
+    while (flows[i].packets && memcmp(&flows[i].key, key, sizeof(*key)) != 0)
+        i = (i + 1) & (size - 1);
+    return &flows[i];
+}
+
+
+/**
+ * @brief Double the slots of the flow table
+ *
+ * @param w The index
+ * @return int 0 on success, -1 on error
+ */
+static int flows_grow(struct capindex_writer *w)
+{
+    size_t size = w->flow_size * 2;
+    struct index_flow *flows = calloc(size, sizeof(struct index_flow));
+    if (flows == NULL)
+        return (-1);
+    for (size_t i = 0; i < w->flow_size; i++) {
+        if (w->flows[i].packets)
+            *flow_slot(flows, size, &w->flows[i].key) = w->flows[i];
+    }
+    free(w->flows);
+    w->flows = flows;
+    w->flow_size = size;
+    return 0;
+}
+
+
+/**
+ * @brief Add a record to the postings of a flow
+ *
+ * @param flow The flow
+ * @param offset The offset of the record
+ * @return int 0 on success, -1 on error
+ */
+static int flow_append(struct index_flow *flow, uint64_t offset)
+{
+    if (flow->size - flow->len < 10) { // Longest varint of 64 bits
+        uint32_t size = flow->size ? flow->size * 2 : 16;
+        uint8_t *postings = realloc(flow->postings, size);
+        if (postings == NULL)
+            return (-1);
+        flow->postings = postings;
+        flow->size = size;
+    }
+    uint64_t delta = offset - flow->last;
+    while (delta >= 0x80) {
+        flow->postings[flow->len++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    flow->postings[flow->len++] = delta;
+    flow->last = offset;
+    flow->packets++;
+    return 0;
+}
+
+
+/**
+ * @brief Index a packet of the dump
+ *
+ * @param w The index
+ * @param header The packet header
+ * @param packet The packet
+ * @param offset The offset of its record in the dump
+ */
+void capindex_add(struct capindex_writer *w, const struct pcap_pkthdr *header,
+                  const u_char *packet, long offset)
+{
+    if (offset < 0) {
+        w->errors++;
+        return;
+    }
+    w->packets++;
+
+    int64_t start = bucket_start(header->ts.tv_sec, w->bucket);
+    if (w->bucket_count == 0 || start > w->buckets[w->bucket_count - 1].start) {
+        if (w->bucket_count == w->bucket_size) {
+            size_t size = w->bucket_size ? w->bucket_size * 2 : 256;
+            struct index_bucket *buckets =
+                realloc(w->buckets, size * sizeof(struct index_bucket));
+            if (buckets == NULL) {
+                w->errors++;
+                return;
+            }
+            w->buckets = buckets;
+            w->bucket_size = size;
+        }
+        w->buckets[w->bucket_count].start = start;
+        w->buckets[w->bucket_count].off = offset;
+        w->bucket_count++;
+    }
+
+    struct flow_key key;
+    if (w->linktype != encap_linktype() ||
+        flow_key_packet(packet, header->caplen, &key) < 0)
+        return;
+    if (w->flow_count * 2 >= w->flow_size && flows_grow(w) < 0) {
+        w->errors++;
+        return;
+    }
+    struct index_flow *flow = flow_slot(w->flows, w->flow_size, &key);
+    if (flow->packets == 0) {
+        flow->key = key;
+        w->flow_count++;
+    }
+    if (flow_append(flow, offset) < 0) {
+        if (flow->packets == 0)
+            w->flow_count--;
+        w->errors++;
+    }
+}
+
+
+/**
+ * @brief Compare two flows by key
+ *
+ * @param a The first flow
+ * @param b The second flow
+ * @return int The order of the keys
+ */
+static int entry_cmp(const void *a, const void *b)
+{
+    return memcmp(((const struct index_entry *)a)->key,
+                  ((const struct index_entry *)b)->key, INDEX_KEY);
+}
+
+
+/**
+ * @brief Write the index file
+ *
+ * @param w The index
+ * @param size The size of the dump
+ * @param f The index file
+ * @return int 0 on success, -1 on error
+ */
+static int index_write(const struct capindex_writer *w, long size, FILE *f)
+{
+    struct index_entry *entries =
+        malloc((w->flow_count ? w->flow_count : 1) * sizeof(struct index_entry));
+    if (entries == NULL)
+        return (-1);
+    size_t n = 0;
+    uint64_t postings = 0;
+    for (size_t i = 0; i < w->flow_size; i++) {
+        if (w->flows[i].packets == 0)
+            continue;
+        key_put(&w->flows[i].key, entries[n].key);
+        entries[n++].flow = &w->flows[i];
+        postings += w->flows[i].len;
+    }
+    qsort(entries, n, sizeof(struct index_entry), entry_cmp);
+
+    uint8_t buf[INDEX_HEADER];
+    memcpy(buf, INDEX_MAGIC, 8);
+    le_put(buf + 8, w->bucket, 4);
+    le_put(buf + 12, 0, 4);
+    le_put(buf + 16, size, 8);
+    le_put(buf + 24, w->packets, 8);
+    le_put(buf + 32, w->bucket_count, 8);
+    le_put(buf + 40, n, 8);
+    le_put(buf + 48, postings, 8);
+    int status = fwrite(buf, INDEX_HEADER, 1, f) == 1 ? 0 : (-1);
+
+    for (size_t i = 0; status == 0 && i < w->bucket_count; i++) {
+        le_put(buf, w->buckets[i].start, 8);
+        le_put(buf + 8, w->buckets[i].off, 8);
+        if (fwrite(buf, INDEX_BUCKET, 1, f) != 1)
+            status = -1;
+    }
+    postings = 0;
+    for (size_t i = 0; status == 0 && i < n; i++) {
+        memcpy(buf, entries[i].key, INDEX_KEY);
+        le_put(buf + INDEX_KEY, postings, 8);
+        le_put(buf + INDEX_KEY + 8, entries[i].flow->len, 4);
+        le_put(buf + INDEX_KEY + 12, entries[i].flow->packets, 4);
+        if (fwrite(buf, INDEX_FLOW, 1, f) != 1)
+            status = -1;
+        postings += entries[i].flow->len;
+    }
+    for (size_t i = 0; status == 0 && i < n; i++) {
+        if (fwrite(entries[i].flow->postings, 1, entries[i].flow->len, f) !=
+            entries[i].flow->len)
+            status = -1;
+    }
+    free(entries);
+    return status;
+}
+
+
+/**
+ * @brief Write the index and free it
+ *
+ * @param w The index
+ * @param size The size of the dump, -1 if unknown
+ * @return int 0 on success, -1 on error
+ */
+int capindex_close(struct capindex_writer *w, long size)
+{
+    int status = 0;
+    if (w->errors > 0 || size < 0) {
+        fprintf(stderr, "Error indexing %d packets, no index written\n",
+                w->errors);
+        status = -1;
+    } else {
+        FILE *f = fopen(w->path, "wb");
+        if (f == NULL) {
+            perror(w->path);
+            status = -1;
+        } else {
+            status = index_write(w, size, f);
+            if (fclose(f) != 0)
+                status = -1;
+            if (status < 0) {
+                fprintf(stderr, "Error writing the index %s\n", w->path);
+                remove(w->path);
+            }
+        }
+    }
+    if (status == 0)
+        fprintf(stderr, "Index: %llu packets, %zu buckets, %zu flows in %s\n",
+                (unsigned long long)w->packets, w->bucket_count, w->flow_count,
+                w->path);
+    for (size_t i = 0; i < w->flow_size; i++)
+        free(w->flows[i].postings);
+    free(w->flows);
+    free(w->buckets);
+    free(w);
+    return status;
+}
+
+
+/**
+ * @brief Parse a time
+ *
+ * @param str The time
+ * @param tv The time to fill
+ * @return int 0 on success, -1 on error
+ */
+int capindex_parse_time(const char *str, struct timeval *tv)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(str, "%Y-%m-%d", &tm);
+    if (end && (*end == 'T' || *end == ' '))
+        end = strptime(end + 1, "%H:%M:%S", &tm);
+    else
+        end = NULL;
+    if (end) {
+        tm.tm_isdst = -1;
+        tv->tv_sec = mktime(&tm);
+    } else {
+        char *rest;
+        errno = 0;
+        long long sec = strtoll(str, &rest, 10);
+        if (rest == str || errno || sec < 0)
+            return (-1);
+        tv->tv_sec = sec;
+        end = rest;
+    }
+
+    tv->tv_usec = 0;
+    if (*end == '.') {
+        long scale = 100000;
+        for (end++; *end >= '0' && *end <= '9'; end++, scale /= 10)
+            tv->tv_usec += (*end - '0') * scale;
+    }
+    return *end == '\0' ? 0 : (-1);
+}
+
+
+/**
+ * @brief Parse a flow
+ *
+ * @param str The flow
+ * @param key The key to fill
+ * @return int 0 on success, -1 on error
+ */
+int capindex_parse_flow(const char *str, struct flow_key *key)
+{
+    static const struct {
+        const char *name;
+        uint8_t proto;
+    } protos[] = {{"tcp", 6}, {"udp", 17}, {"sctp", 132}, {"icmp", 1},
+                  {"icmp6", 58}};
+    char buf[256];
+    if ((size_t)snprintf(buf, sizeof(buf), "%s", str) >= sizeof(buf))
+        return (-1);
+
+    char *fields[5];
+    char *save = NULL;
+    int n = 0;
+    for (char *tok = strtok_r(buf, ",", &save); tok && n < 5;
+         tok = strtok_r(NULL, ",", &save))
+        fields[n++] = tok;
+    if (n != 5 || strtok_r(NULL, ",", &save))
+        return (-1);
+
+    int proto = -1;
+    for (size_t i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+        if (strcasecmp(fields[0], protos[i].name) == 0)
+            proto = protos[i].proto;
+    }
+    char *end;
+    if (proto < 0) {
+        long v = strtol(fields[0], &end, 10);
+        if (*end || end == fields[0] || v < 0 || v > 255)
+            return (-1);
+        proto = v;
+    }
+
+    uint8_t addr[2][16];
+    uint16_t port[2];
+    int version = strchr(fields[1], ':') ? 6 : 4;
+    for (int i = 0; i < 2; i++) {
+        if (inet_pton(version == 6 ? AF_INET6 : AF_INET, fields[1 + 2 * i],
+                      addr[i]) != 1)
+            return (-1);
+        long v = strtol(fields[2 + 2 * i], &end, 10);
+        if (*end || end == fields[2 + 2 * i] || v < 0 || v > 65535)
+            return (-1);
+        port[i] = v;
+    }
+    flow_key_set(key, version, proto, addr[0], addr[1], port[0], port[1]);
+    return 0;
+}
+
+
+/**
+ * @brief Find the first bucket starting after a time
+ *
+ * @param buckets The buckets
+ * @param count The number of buckets
+ * @param start The first second of a bucket
+ * @param equal 1 to find a bucket starting at the second too
+ * @return uint64_t The index of the bucket, count if none
+ */
+static uint64_t bucket_find(const uint8_t *buckets, uint64_t count,
+                            int64_t start, int equal)
+{
+    uint64_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int64_t s = (int64_t)le_get(buckets + mid * INDEX_BUCKET, 8);
+        if (s > start || (equal && s == start))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+
+/**
+ * @brief Read the records of a flow
+ *
+ * @param pf The reader, limited to the time range
+ * @param flows The flows of the index
+ * @param count The number of flows
+ * @param postings The postings of the index
+ * @param len The bytes of postings
+ * @param key The flow
+ * @return int 0 on success, -1 on error
+ */
+static int flow_select(struct pcapfile *pf, const uint8_t *flows,
+                       uint64_t count, const uint8_t *postings, uint64_t len,
+                       const struct flow_key *key)
+{
+    uint8_t k[INDEX_KEY];
+    key_put(key, k);
+    uint64_t lo = 0, hi = count;
+    const uint8_t *flow = NULL;
+    while (lo < hi && flow == NULL) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(flows + mid * INDEX_FLOW, k, INDEX_KEY);
+        if (cmp == 0)
+            flow = flows + mid * INDEX_FLOW;
+        else if (cmp > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    uint64_t off = flow ? le_get(flow + INDEX_KEY, 8) : 0;
+    uint64_t size = flow ? le_get(flow + INDEX_KEY + 8, 4) : 0;
+    uint32_t packets = flow ? le_get(flow + INDEX_KEY + 12, 4) : 0;
+    if (off > len || size > len - off)
+        return (-1);
+    pf->picks = malloc((packets ? packets : 1) * sizeof(uint64_t));
+    if (pf->picks == NULL)
+        return (-1);
+
+    const uint8_t *p = postings + off, *end = p + size;
+    uint64_t record = 0;
+    for (uint32_t i = 0; i < packets; i++) {
+        uint64_t delta = 0;
+        int shift = 0;
+        do {
+            if (p == end || shift > 63)
+                return (-1);
+            delta |= (uint64_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        record += delta;
+        if (record >= pf->off && record < pf->end)
+            pf->picks[pf->pick_count++] = record;
+    }
+    madvise((void *)pf->map, pf->size, MADV_RANDOM);
+    return 0;
+}
+
+
+/**
+ * @brief Limit a reader to a part of its file with its index
+ *
+ * @param pf The reader
+ * @param path The path of the index
+ * @param idx The mapped index
+ * @param size The size of the index
+ * @param q The part to read
+ * @return int 0 on success, -1 if the index is not the one of the file
+ */
+static int index_select(struct pcapfile *pf, const char *path,
+                        const uint8_t *idx, size_t size,
+                        const struct capindex_query *q)
+{
+    if (size < INDEX_HEADER || memcmp(idx, INDEX_MAGIC, 8) != 0 || pf->ng ||
+        le_get(idx + 16, 8) != pf->size) {
+        fprintf(stderr, "Index %s is not the one of the file\n", path);
+        return (-1);
+    }
+    unsigned bucket = le_get(idx + 8, 4);
+    uint64_t buckets = le_get(idx + 32, 8);
+    uint64_t flows = le_get(idx + 40, 8);
+    uint64_t postings = le_get(idx + 48, 8);
+    if (bucket == 0 || buckets > size / INDEX_BUCKET ||
+        flows > size / INDEX_FLOW || postings > size ||
+        INDEX_HEADER + buckets * INDEX_BUCKET + flows * INDEX_FLOW +
+                postings != size) {
+        fprintf(stderr, "Index %s is corrupted\n", path);
+        return (-1);
+    }
+    const uint8_t *bucket_tab = idx + INDEX_HEADER;
+    const uint8_t *flow_tab = bucket_tab + buckets * INDEX_BUCKET;
+
+    if (q->from.tv_sec) {
+        uint64_t i = bucket_find(bucket_tab, buckets,
+                                 bucket_start(q->from.tv_sec, bucket), 1);
+        if (i == buckets)
+            pf->off = pf->end;
+        else if (le_get(bucket_tab + i * INDEX_BUCKET + 8, 8) > pf->off)
+            pf->off = le_get(bucket_tab + i * INDEX_BUCKET + 8, 8);
+    }
+    if (q->to.tv_sec) {
+        uint64_t i = bucket_find(bucket_tab, buckets,
+                                 bucket_start(q->to.tv_sec, bucket), 0);
+        if (i < buckets && le_get(bucket_tab + i * INDEX_BUCKET + 8, 8) < pf->end)
+            pf->end = le_get(bucket_tab + i * INDEX_BUCKET + 8, 8);
+    }
+    if (pf->off > pf->end)
+        pf->off = pf->end;
+    pf->advised = pf->off & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+
+    if (q->has_flow &&
+        flow_select(pf, flow_tab, flows, flow_tab + flows * INDEX_FLOW,
+                    postings, &q->flow) < 0) {
+        fprintf(stderr, "Index %s is corrupted\n", path);
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Limit a reader to a part of its file
+ *
+ * @param pf The reader, not read yet
+ * @param file The path of the file
+ * @param q The part to read
+ * @return int 0 on success, -1 on error
+ */
+int capindex_select(struct pcapfile *pf, const char *file,
+                    const struct capindex_query *q)
+{
+    pf->from = q->from;
+    pf->to = q->to;
+
+    char path[PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s.idx", file) >= sizeof(path)) {
+        fprintf(stderr, "Index path too long: %s.idx\n", file);
+        return (-1);
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (q->has_flow) {
+            perror(path);
+            return (-1);
+        }
+        fprintf(stderr, "No index %s, reading the whole file\n", path);
+        return 0;
+    }
+    struct stat st;
+    void *idx = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        idx = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (idx == MAP_FAILED) {
+        fprintf(stderr, "Error mapping the index %s\n", path);
+        return (-1);
+    }
+    int status = index_select(pf, path, idx, st.st_size, q);
+    munmap(idx, st.st_size);
+    return status;
+}
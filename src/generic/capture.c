@@ -0,0 +1,1327 @@
+/**
+ * @author Flavien Lallemant
+ * @file capture.c
+ * @brief Capture backend definition
+ *
+ * This file contains the definition of the capture backend.
+ * Live captures go through pcap_create() and pcap_activate() so the kernel
+ * buffer size and the immediate mode can be set. On Linux, the capture can
+ * also read a TPACKET_V3 ring mapped from an AF_PACKET socket: the kernel
+ * fills whole blocks of packets, and each block is handed back once every
+ * packet in it has been given to the callback.
+ * Capture files are mapped when they can be, and their packets handed over in
+ * place; libpcap reads the others.
+ * The packets can also be read by batches, so the caller can prefetch the
+ * next packet while it decodes the current one.
+ * The times are read in nanoseconds from every source that has them: the
+ * headers get the microseconds, and the nanoseconds of the packet being given
+ * are kept for the calling thread.
+ * On Linux, several sockets of an interface can join a PACKET_FANOUT group,
+ * the kernel then gives each packet to one of them only.
+ *
+ * @see capture.h
+ * @see capture_open_live
+ * @see capture_loop
+ * @see capture_setfilter
+ * @see capture_set_idle
+ * @see capture_set_nsec
+ * @see capture_loop_batch
+ * @see capture_split
+ * @see capture_stats
+ */
+
+// Global libraries
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#endif
+
+// Local header files
+#include "capture.h"
+
+#define VLAN_TAG_LEN 4 /**< Bytes of an 802.1Q tag */
+
+/**
+ * @brief Time of the last packet given on a thread
+ */
+struct nstime {
+    struct timeval ts;      /**< The time of its header */
+    uint32_t nsec;          /**< Nanoseconds of the second */
+};
+
+static __thread struct nstime given; /**< The time of the calling thread */
+
+
+/**
+ * @brief Allocate a capture handle
+ *
+ * @param errbuf The buffer to store the error message
+ * @return struct capture* The handle, NULL on error
+ */
+static struct capture *capture_alloc(char *errbuf)
+{
+    struct capture *cap = calloc(1, sizeof(struct capture));
+    if (cap == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        return NULL;
+    }
+    cap->fd = -1;
+    return cap;
+}
+
+
+/**
+ * @brief Open a capture file
+ *
+ * @param file The file to read
+ * @param snaplen Bytes kept per packet, 0 to keep what the file holds
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct capture* The handle, NULL on error
+ */
+struct capture *capture_open_offline(const char *file, int snaplen,
+                                     char *errbuf)
+{
+    struct capture *cap = capture_alloc(errbuf);
+    if (cap == NULL)
+        return NULL;
+    cap->file = pcapfile_open(file);
+    if (cap->file) {
+        cap->pcap = pcap_open_dead(cap->file->linktype, cap->file->snaplen);
+        if (cap->pcap == NULL) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "Error opening a dead handle");
+            capture_close(cap);
+            return NULL;
+        }
+    } else {
+        cap->pcap = pcap_open_offline_with_tstamp_precision(
+            file, PCAP_TSTAMP_PRECISION_NANO, errbuf); // Pipes, other formats
+        if (cap->pcap == NULL) {
+            free(cap);
+            return NULL;
+        }
+        cap->nano = 1;
+    }
+    cap->offline = 1;
+    cap->snaplen = pcap_snapshot(cap->pcap);
+    if (snaplen > 0 && snaplen < cap->snaplen) {
+        cap->snaplen = snaplen;
+        cap->truncate = 1;
+    }
+    return cap;
+}
+
+
+/**
+ * @brief Fix a packet read through libpcap
+ *
+ * The nanoseconds libpcap puts in the header are kept aside and the header
+ * gets the microseconds; a packet read from a file is cut to the snapshot
+ * length if asked.
+ *
+ * @param user The handle
+ * @param header The packet header
+ * @param packet The packet
+ */
+static void libpcap_packet(u_char *user, const struct pcap_pkthdr *header,
+                           const u_char *packet)
+{
+    struct capture *cap = (struct capture *)user;
+    struct pcap_pkthdr fixed = *header;
+    uint32_t nsec = fixed.ts.tv_usec * 1000;
+    if (cap->nano) {
+        nsec = fixed.ts.tv_usec;
+        fixed.ts.tv_usec = nsec / 1000;
+    }
+    if (cap->truncate && fixed.caplen > (bpf_u_int32)cap->snaplen)
+        fixed.caplen = cap->snaplen;
+    capture_set_nsec(&fixed, nsec);
+    cap->callback(cap->user, &fixed, packet);
+}
+
+
+/**
+ * @brief Read the next packet of a mapped file
+ *
+ * The packets not matching the filter are skipped, the others cut to the
+ * snapshot length if asked.
+ *
+ * @param cap The handle
+ * @param p The packet to fill
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+static int file_next(struct capture *cap, struct capture_packet *p)
+{
+    int status;
+    while ((status = pcapfile_next(cap->file, &p->header, &p->data)) > 0) {
+        if (cap->filter.bf_insns &&
+            pcap_offline_filter(&cap->filter, &p->header, p->data) == 0)
+            continue;
+        if (cap->truncate && p->header.caplen > (bpf_u_int32)cap->snaplen)
+            p->header.caplen = cap->snaplen;
+        p->nsec = cap->file->nsec;
+        return 1;
+    }
+    if (status < 0)
+        fprintf(stderr, "Error reading packets: %s\n", cap->file->err);
+    return status;
+}
+
+
+/**
+ * @brief Read packets from a mapped file
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+static int file_loop(struct capture *cap, int count, pcap_handler callback,
+                     u_char *user)
+{
+    struct capture_packet p;
+    for (int n = 0; count <= 0 || n < count; n++) {
+        if (cap->stop) {
+            cap->stop = 0;
+            return (-2);
+        }
+        int status = file_next(cap, &p);
+        if (status <= 0)
+            return status;
+        capture_set_nsec(&p.header, p.nsec);
+        callback(user, &p.header, p.data);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Read packets from a mapped file by batches
+ *
+ * The packets stay in the mapping, so a batch points into it.
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param pkts The batch, batch packets long
+ * @param batch The largest number of packets of a batch
+ * @param handler The function called for each batch
+ * @param user The first argument of the handler
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+static int file_loop_batch(struct capture *cap, int count,
+                           struct capture_packet *pkts, int batch,
+                           capture_batch_handler handler, u_char *user)
+{
+    int n = 0;
+    int status = 1;
+    while (status > 0 && (count <= 0 || n < count)) {
+        if (cap->stop) {
+            cap->stop = 0;
+            return (-2);
+        }
+        int got = 0;
+        while (got < batch && (count <= 0 || n + got < count) &&
+               (status = file_next(cap, &pkts[got])) > 0)
+            got++;
+        if (got > 0)
+            handler(user, pkts, got);
+        n += got;
+    }
+    return status < 0 ? (-1) : 0;
+}
+
+
+#ifdef __linux__
+/**
+ * @brief Get the PACKET_FANOUT argument of a configuration
+ *
+ * A group spread by flow hash defragments the IP packets first, so the
+ * fragments of a datagram reach the same socket.
+ *
+ * @param cfg The configuration
+ * @return int The argument, 0 without fanout group
+ */
+static int fanout_arg(const struct capture_config *cfg)
+{
+    unsigned type;
+    switch (cfg->fanout) {
+    case CAPTURE_FANOUT_HASH:
+        type = PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+        break;
+    case CAPTURE_FANOUT_CPU:
+        type = PACKET_FANOUT_CPU;
+        break;
+    case CAPTURE_FANOUT_LB:
+        type = PACKET_FANOUT_LB;
+        break;
+    default:
+        return 0;
+    }
+    return (int)(type << 16 | (cfg->fanout_group & 0xffff));
+}
+
+
+/**
+ * @brief Join a fanout group
+ *
+ * The socket must already receive packets.
+ *
+ * @param fd The socket
+ * @param arg The PACKET_FANOUT argument
+ * @return int 0 on success, -1 on error
+ */
+static int fanout_join(int fd, int arg)
+{
+    return setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg));
+}
+#endif
+
+
+/**
+ * @brief Open a live capture through libpcap
+ *
+ * @param cap The handle to fill
+ * @param cfg The configuration
+ * @param errbuf The buffer to store the error message
+ * @return int 0 on success, -1 on error
+ */
+static int open_pcap(struct capture *cap, const struct capture_config *cfg,
+                     char *errbuf)
+{
+    cap->pcap = pcap_create(cfg->interface, errbuf);
+    if (cap->pcap == NULL)
+        return (-1);
+
+    pcap_set_snaplen(cap->pcap, cap->snaplen);
+    pcap_set_promisc(cap->pcap, cfg->promisc);
+    pcap_set_tstamp_precision(cap->pcap, PCAP_TSTAMP_PRECISION_NANO); // Microseconds if refused
+    pcap_set_timeout(cap->pcap, cap->timeout);
+    if (cfg->buffer_size > 0)
+        pcap_set_buffer_size(cap->pcap, cfg->buffer_size);
+    if (cfg->immediate)
+        pcap_set_immediate_mode(cap->pcap, 1);
+
+    int status = pcap_activate(cap->pcap);
+    if (status < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s",
+                 status == PCAP_ERROR ? pcap_geterr(cap->pcap)
+                                      : pcap_statustostr(status));
+        pcap_close(cap->pcap);
+        cap->pcap = NULL;
+        return (-1);
+    }
+    if (status > 0)
+        fprintf(stderr, "Warning: %s\n", pcap_statustostr(status));
+    cap->nano = pcap_get_tstamp_precision(cap->pcap) == PCAP_TSTAMP_PRECISION_NANO;
+#ifdef __linux__
+    if (cfg->fanout != CAPTURE_FANOUT_NONE &&
+        fanout_join(pcap_fileno(cap->pcap), fanout_arg(cfg)) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "fanout: %s", strerror(errno));
+        return (-1);
+    }
+#endif
+    return 0;
+}
+
+
+#ifdef __linux__
+/**
+ * @brief Get the link type of the frames of an interface read from a ring
+ *
+ * The ring gives the frames as the device passes them, so only the devices
+ * with Ethernet headers or none at all are read this way.
+ *
+ * @param fd The packet socket
+ * @param interface The interface
+ * @param errbuf The buffer to store the error message
+ * @return int The DLT_* link type, -1 on error
+ */
+static int ring_linktype(int fd, const char *interface, char *errbuf)
+{
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", interface);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", interface,
+                 strerror(errno));
+        return (-1);
+    }
+    switch (ifr.ifr_hwaddr.sa_family) {
+    case ARPHRD_ETHER:
+    case ARPHRD_LOOPBACK:
+        return DLT_EN10MB;
+    case ARPHRD_NONE:
+    case ARPHRD_PPP:
+    case ARPHRD_TUNNEL:
+    case ARPHRD_TUNNEL6:
+    case ARPHRD_RAWIP:
+        return DLT_RAW;
+    default:
+        snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                 "%s: hardware type %u not supported by the ring, capture "
+                 "without --ring", interface, ifr.ifr_hwaddr.sa_family);
+        return (-1);
+    }
+}
+
+
+/**
+ * @brief Open a live capture on a TPACKET_V3 ring
+ *
+ * The socket doesn't receive anything until the capture starts, so the
+ * filter is in place before the first packet.
+ *
+ * @param cap The handle to fill
+ * @param cfg The configuration
+ * @param errbuf The buffer to store the error message
+ * @return int 0 on success, -1 on error
+ */
+static int open_ring(struct capture *cap, const struct capture_config *cfg,
+                     char *errbuf)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned block_size = cfg->block_size ? cfg->block_size : CAPTURE_BLOCK_SIZE;
+    unsigned frames = cfg->frame_count ? cfg->frame_count : CAPTURE_FRAME_COUNT;
+    if (block_size % page != 0 || block_size < CAPTURE_FRAME_SIZE) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                 "the block size must be a multiple of the page size (%ld)",
+                 page);
+        return (-1);
+    }
+    unsigned per_block = block_size / CAPTURE_FRAME_SIZE;
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = (frames + per_block - 1) / per_block;
+    req.tp_frame_size = CAPTURE_FRAME_SIZE;
+    req.tp_frame_nr = req.tp_block_nr * per_block;
+    req.tp_retire_blk_tov = cfg->immediate ? 1 : cap->timeout;
+
+    unsigned ifindex = if_nametoindex(cfg->interface);
+    if (ifindex == 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", cfg->interface,
+                 strerror(errno));
+        return (-1);
+    }
+
+    int version = TPACKET_V3;
+    int reserve = VLAN_TAG_LEN; // Room in front of the frames to put the tag back
+    cap->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (cap->fd < 0 ||
+        setsockopt(cap->fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) < 0 ||
+        setsockopt(cap->fd, SOL_PACKET, PACKET_RESERVE, &reserve,
+                   sizeof(reserve)) < 0 ||
+        setsockopt(cap->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "ring setup: %s", strerror(errno));
+        return (-1);
+    }
+    if (cfg->buffer_size > 0)
+        fprintf(stderr, "Warning: the buffer size is set by the ring size\n");
+    int linktype = ring_linktype(cap->fd, cfg->interface, errbuf);
+    if (linktype < 0)
+        return (-1);
+    cap->vlan = linktype == DLT_EN10MB;
+
+    cap->block_size = req.tp_block_size;
+    cap->block_count = req.tp_block_nr;
+    cap->ring = mmap(NULL, (size_t)cap->block_size * cap->block_count,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, cap->fd,
+                     0);
+    if (cap->ring == MAP_FAILED) {
+        cap->ring = NULL;
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "ring mmap: %s", strerror(errno));
+        return (-1);
+    }
+
+    if (cfg->promisc) {
+        struct packet_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(cap->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                       sizeof(mreq)) < 0)
+            fprintf(stderr, "Warning: promiscuous mode: %s\n", strerror(errno));
+    }
+
+    // The filters are compiled and the dump files written with a dead handle
+    cap->pcap = pcap_open_dead(linktype, cap->snaplen);
+    if (cap->pcap == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "pcap_open_dead failed");
+        return (-1);
+    }
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = 0; // Nothing received before capture_loop()
+    sll.sll_ifindex = ifindex;
+    if (bind(cap->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "bind: %s", strerror(errno));
+        return (-1);
+    }
+    cap->fanout = fanout_arg(cfg); // Joined once the socket receives
+    return 0;
+}
+
+
+/**
+ * @brief Start receiving packets on the ring socket
+ *
+ * The socket joins its fanout group once it receives, which the kernel
+ * requires.
+ *
+ * @param cap The handle
+ * @return int 0 on success, -1 on error
+ *
+ * @see fanout_join
+ */
+static int ring_start(struct capture *cap)
+{
+    struct sockaddr_ll sll;
+    socklen_t len = sizeof(sll);
+    if (getsockname(cap->fd, (struct sockaddr *)&sll, &len) < 0)
+        return (-1);
+    if (sll.sll_protocol != 0)
+        return 0;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    if (bind(cap->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+        return (-1);
+    return cap->fanout ? fanout_join(cap->fd, cap->fanout) : 0;
+}
+
+
+/**
+ * @brief Wait for the kernel to retire the next block of the ring
+ *
+ * @param cap The handle
+ * @param bd The block, set once ready
+ * @return int 1 if the block is ready, 0 if not yet, -1 on error
+ */
+static int ring_wait(struct capture *cap, struct tpacket_block_desc **bd)
+{
+    *bd = (struct tpacket_block_desc *)(cap->ring +
+                                        (size_t)cap->block * cap->block_size);
+    if (__atomic_load_n(&(*bd)->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+        TP_STATUS_USER)
+        return 1;
+    struct pollfd pfd = {cap->fd, POLLIN | POLLERR, 0};
+    if (poll(&pfd, 1, cap->timeout) < 0 && errno != EINTR) {
+        fprintf(stderr, "Error polling the ring: %s\n", strerror(errno));
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Give a block back to the kernel
+ *
+ * @param cap The handle
+ * @param bd The block
+ */
+static void ring_release(struct capture *cap, struct tpacket_block_desc *bd)
+{
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    cap->block = (cap->block + 1) % cap->block_count;
+}
+
+
+/**
+ * @brief Get the packet of a ring frame
+ *
+ * The kernel strips the VLAN tag of most frames and gives it in the frame
+ * header: like libpcap does, the tag is put back in the frame, in the room
+ * reserved in front of it, so the decoding sees the frame as sent.
+ *
+ * @param cap The handle
+ * @param h The frame
+ * @param p The packet to fill
+ */
+static void ring_packet(const struct capture *cap, struct tpacket3_hdr *h,
+                        struct capture_packet *p)
+{
+    struct pcap_pkthdr *header = &p->header;
+    unsigned char *frame = (unsigned char *)h + h->tp_mac;
+    header->ts.tv_sec = h->tp_sec;
+    header->ts.tv_usec = h->tp_nsec / 1000;
+    p->nsec = h->tp_nsec;
+    header->caplen = h->tp_snaplen;
+    header->len = h->tp_len;
+    if (cap->vlan && h->tp_snaplen >= 2 * ETH_ALEN &&
+        (h->hv1.tp_vlan_tci || (h->tp_status & TP_STATUS_VLAN_VALID))) {
+        uint16_t tag[2] = {
+            htons(h->tp_status & TP_STATUS_VLAN_TPID_VALID ? h->hv1.tp_vlan_tpid
+                                                           : ETH_P_8021Q),
+            htons(h->hv1.tp_vlan_tci)};
+        frame -= VLAN_TAG_LEN;
+        memmove(frame, frame + VLAN_TAG_LEN, 2 * ETH_ALEN);
+        memcpy(frame + 2 * ETH_ALEN, tag, VLAN_TAG_LEN);
+        header->caplen += VLAN_TAG_LEN;
+        header->len += VLAN_TAG_LEN;
+    }
+    p->data = frame;
+}
+
+
+/**
+ * @brief Read packets from the ring
+ *
+ * The packets are given to the callback in place, in the ring. A block is
+ * handed back to the kernel once all its packets are read.
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+static int ring_loop(struct capture *cap, int count, pcap_handler callback,
+                     u_char *user)
+{
+    if (ring_start(cap) < 0) {
+        fprintf(stderr, "Error starting the ring capture: %s\n",
+                strerror(errno));
+        return (-1);
+    }
+
+    int n = 0;
+    while (!cap->stop) {
+        struct tpacket_block_desc *bd;
+        int ready = ring_wait(cap, &bd);
+        if (ready < 0)
+            return (-1);
+        if (ready == 0) {
+            if (cap->idle)
+                cap->idle(cap->idle_user);
+            continue;
+        }
+
+        unsigned char *ppd =
+            (unsigned char *)bd + bd->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            struct tpacket3_hdr *h = (struct tpacket3_hdr *)ppd;
+            if (count > 0 && n >= count)
+                break;
+            ppd += h->tp_next_offset;
+            struct capture_packet p;
+            ring_packet(cap, h, &p);
+            if (cap->filter.bf_insns &&
+                pcap_offline_filter(&cap->filter, &p.header, p.data) == 0)
+                continue;
+            capture_set_nsec(&p.header, p.nsec);
+            callback(user, &p.header, p.data);
+            n++;
+        }
+        ring_release(cap, bd);
+        if (count > 0 && n >= count)
+            return 0;
+    }
+    cap->stop = 0;
+    return (-2);
+}
+
+
+/**
+ * @brief Read packets from the ring by batches
+ *
+ * The packets of a batch are given to the handler in place, and never span
+ * two blocks.
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param pkts The batch, batch packets long
+ * @param batch The largest number of packets of a batch
+ * @param handler The function called for each batch
+ * @param user The first argument of the handler
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+static int ring_loop_batch(struct capture *cap, int count,
+                           struct capture_packet *pkts, int batch,
+                           capture_batch_handler handler, u_char *user)
+{
+    if (ring_start(cap) < 0) {
+        fprintf(stderr, "Error starting the ring capture: %s\n",
+                strerror(errno));
+        return (-1);
+    }
+
+    int n = 0;
+    while (!cap->stop) {
+        struct tpacket_block_desc *bd;
+        int ready = ring_wait(cap, &bd);
+        if (ready < 0)
+            return (-1);
+        if (ready == 0) {
+            if (cap->idle)
+                cap->idle(cap->idle_user);
+            continue;
+        }
+
+        unsigned char *ppd =
+            (unsigned char *)bd + bd->hdr.bh1.offset_to_first_pkt;
+        uint32_t left = bd->hdr.bh1.num_pkts;
+        while (left > 0 && !(count > 0 && n >= count)) {
+            int got = 0;
+            while (got < batch && left > 0 && !(count > 0 && n + got >= count)) {
+                struct tpacket3_hdr *h = (struct tpacket3_hdr *)ppd;
+                ppd += h->tp_next_offset;
+                left--;
+                ring_packet(cap, h, &pkts[got]);
+                if (cap->filter.bf_insns &&
+                    pcap_offline_filter(&cap->filter, &pkts[got].header,
+                                        pkts[got].data) == 0)
+                    continue;
+                got++;
+            }
+            if (got > 0)
+                handler(user, pkts, got);
+            n += got;
+        }
+        ring_release(cap, bd);
+        if (count > 0 && n >= count)
+            return 0;
+    }
+    cap->stop = 0;
+    return (-2);
+}
+#endif
+
+
+/**
+ * @brief Open a live capture
+ *
+ * @param cfg The configuration
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct capture* The handle, NULL on error
+ */
+struct capture *capture_open_live(const struct capture_config *cfg,
+                                  char *errbuf)
+{
+    struct capture *cap = capture_alloc(errbuf);
+    if (cap == NULL)
+        return NULL;
+    cap->snaplen = cfg->snaplen > 0 ? cfg->snaplen : CAPTURE_SNAPLEN;
+    cap->timeout = cfg->timeout > 0 ? cfg->timeout : CAPTURE_TIMEOUT;
+
+    int status;
+#ifndef __linux__
+    if (cfg->fanout != CAPTURE_FANOUT_NONE) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                 "fanout groups are only available on Linux");
+        capture_close(cap);
+        return NULL;
+    }
+#endif
+    if (cfg->ring) {
+#ifdef __linux__
+        status = open_ring(cap, cfg, errbuf);
+#else
+        snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                 "TPACKET_V3 rings are only available on Linux");
+        status = -1;
+#endif
+    } else {
+        status = open_pcap(cap, cfg, errbuf);
+    }
+    if (status < 0) {
+        capture_close(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+
+#ifdef __linux__
+/**
+ * @brief Check if the kernel compiles its socket filters to native code
+ *
+ * @return int 1 if the BPF JIT is enabled, 0 otherwise
+ */
+static int filter_jit(void)
+{
+    FILE *f = fopen("/proc/sys/net/core/bpf_jit_enable", "r");
+    if (f == NULL)
+        return 0;
+    int enabled = fgetc(f);
+    fclose(f);
+    return enabled == '1' || enabled == '2';
+}
+
+
+/**
+ * @brief Get the length of the filter attached to a socket
+ *
+ * @param fd The socket
+ * @return int The number of instructions, 0 if none is attached
+ */
+static int filter_attached(int fd)
+{
+    socklen_t len = 0;
+    if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_GET_FILTER, NULL, &len) < 0)
+        return 0;
+    return (int)len;
+}
+
+
+/**
+ * @brief Check if a filter expression looks at the VLAN tags
+ *
+ * The kernel runs the filter of the ring on the frames it stripped the tag
+ * from, and the program of a dead handle reads the tag in the frame.
+ *
+ * @param expr The filter expression
+ * @return int 1 if the expression has the vlan keyword, 0 otherwise
+ */
+static int filter_vlan(const char *expr)
+{
+    for (const char *p = expr; p && (p = strstr(p, "vlan")); p += 4) {
+        if ((p == expr || !(isalnum((unsigned char)p[-1]) || p[-1] == '_')) &&
+            !(isalnum((unsigned char)p[4]) || p[4] == '_'))
+            return 1;
+    }
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief Print a compiled filter
+ *
+ * @param filter The program
+ *
+ * @see bpf_image
+ */
+static void filter_dump(const struct bpf_program *filter)
+{
+    for (u_int i = 0; i < filter->bf_len; i++)
+        printf("%s\n", bpf_image(&filter->bf_insns[i], i));
+    printf("(%u instructions)\n", filter->bf_len);
+}
+
+
+/**
+ * @brief Tell where a filter runs
+ *
+ * A live capture filtering in userspace is always warned about.
+ *
+ * @param cap The handle
+ * @param expr The filter expression
+ * @param kernel 1 if the kernel runs the filter
+ * @param dump 1 to print where the filter runs
+ */
+static void filter_report(const struct capture *cap, const char *expr,
+                          int kernel, int dump)
+{
+    if (dump && kernel) {
+#ifdef __linux__
+        printf("Filter run in the kernel, %s\n",
+               filter_jit() ? "JIT compiled" : "interpreted");
+#else
+        printf("Filter run in the kernel\n");
+#endif
+    } else if (dump) {
+        printf("Filter run in userspace\n");
+    }
+    if (!kernel && !cap->offline && expr && *expr)
+        fprintf(stderr, "Warning: the kernel refused the filter, every packet "
+                        "is copied to userspace to be filtered\n");
+}
+
+
+/**
+ * @brief Compile and set a filter
+ *
+ * The program is optimized by libpcap. In ring mode, it is attached to the
+ * socket, so the kernel drops and truncates the packets before they reach the
+ * ring, unless it looks at the VLAN tags the kernel strips. A mapped file
+ * keeps the program to run it on each packet.
+ * On a live capture, the socket is checked for the program afterwards: libpcap
+ * silently runs the filters the kernel refuses in userspace, after every
+ * packet was copied.
+ *
+ * @param cap The handle
+ * @param expr The filter expression, NULL for no filter
+ * @param netmask The netmask of the network, PCAP_NETMASK_UNKNOWN if unknown
+ * @param dump 1 to print the program and where it runs
+ * @return int 0 on success, -1 on error
+ *
+ * @see filter_dump
+ * @see filter_report
+ */
+int capture_setfilter(struct capture *cap, const char *expr,
+                      bpf_u_int32 netmask, int dump)
+{
+    struct bpf_program filter;
+    if (pcap_compile(cap->pcap, &filter, expr ? expr : "", 1, netmask) == -1) {
+        fprintf(stderr, "Bad filter - %s\n", pcap_geterr(cap->pcap));
+        return (-1);
+    }
+    if (dump)
+        filter_dump(&filter);
+
+    int status = 0;
+    if (cap->file) {
+        pcap_freecode(&cap->filter);
+        cap->filter = filter;
+        filter_report(cap, expr, 0, dump);
+        return 0;
+    }
+#ifdef __linux__
+    if (cap->fd >= 0 && cap->vlan && filter_vlan(expr)) {
+        pcap_freecode(&cap->filter);
+        cap->filter = filter; // Run on the frames with their tag put back
+        if (dump)
+            printf("Filter run in userspace\n");
+        fprintf(stderr, "Warning: the kernel strips the VLAN tags from the "
+                        "ring, every packet is copied to userspace to be "
+                        "filtered\n");
+        return 0;
+    }
+    if (cap->fd >= 0) {
+        struct sock_fprog prog;
+        prog.len = filter.bf_len;
+        prog.filter = (struct sock_filter *)filter.bf_insns;
+        if (prog.len > 0 && setsockopt(cap->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                                       &prog, sizeof(prog)) < 0) {
+            fprintf(stderr, "Error setting filter - %s\n", strerror(errno));
+            status = -1;
+        }
+        pcap_freecode(&filter);
+        if (status == 0)
+            filter_report(cap, expr, filter_attached(cap->fd) > 0, dump);
+        return status;
+    }
+#endif
+    if (pcap_setfilter(cap->pcap, &filter) == -1) {
+        fprintf(stderr, "Error setting filter - %s\n", pcap_geterr(cap->pcap));
+        status = -1;
+    }
+    pcap_freecode(&filter);
+    if (status == 0) {
+#ifdef __linux__
+        int kernel = filter_attached(pcap_fileno(cap->pcap)) > 0;
+#else
+        int kernel = 1; // BPF devices always filter in the kernel
+#endif
+        filter_report(cap, expr, !cap->offline && kernel, dump);
+    }
+    return status;
+}
+
+
+/**
+ * @brief Read packets
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+int capture_loop(struct capture *cap, int count, pcap_handler callback,
+                 u_char *user)
+{
+#ifdef __linux__
+    if (cap->fd >= 0)
+        return ring_loop(cap, count, callback, user);
+#endif
+    if (cap->file)
+        return file_loop(cap, count, callback, user);
+    cap->callback = callback;
+    cap->user = user;
+    if (cap->idle == NULL || cap->offline)
+        return pcap_loop(cap->pcap, count, libpcap_packet, (u_char *)cap);
+
+    int n = 0; // pcap_loop() would not come back on a timeout
+    while (count <= 0 || n < count) {
+        int got = pcap_dispatch(cap->pcap, count > 0 ? count - n : -1,
+                                libpcap_packet, (u_char *)cap);
+        if (got < 0)
+            return got;
+        if (got == 0)
+            cap->idle(cap->idle_user);
+        n += got;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Set the function called when a live capture waits for packets
+ *
+ * @param cap The handle
+ * @param idle The function, NULL for none
+ * @param user Its argument
+ */
+void capture_set_idle(struct capture *cap, capture_idle_handler idle,
+                      u_char *user)
+{
+    cap->idle = idle;
+    cap->idle_user = user;
+}
+
+
+/**
+ * @brief Keep the nanoseconds of the packet given on the calling thread
+ *
+ * The capture loops call it before giving each packet, a batch handler
+ * before handing on each packet of its batch.
+ *
+ * @param header The packet header
+ * @param nsec The nanoseconds of the second of its time
+ */
+void capture_set_nsec(const struct pcap_pkthdr *header, uint32_t nsec)
+{
+    given.ts = header->ts;
+    given.nsec = nsec;
+}
+
+
+/**
+ * @brief Get the nanoseconds of the time of a packet given on the calling
+ * thread
+ *
+ * The nanoseconds kept are only the packet's if they match its header.
+ *
+ * @param header The packet header
+ * @return uint32_t The nanoseconds of the second, its microseconds in
+ * nanoseconds if they weren't kept
+ */
+uint32_t capture_nsec(const struct pcap_pkthdr *header)
+{
+    if (header->ts.tv_sec == given.ts.tv_sec &&
+        header->ts.tv_usec == given.ts.tv_usec &&
+        given.nsec / 1000 == (uint32_t)header->ts.tv_usec)
+        return given.nsec;
+    return (uint32_t)header->ts.tv_usec * 1000;
+}
+
+
+/**
+ * @brief Batch read through libpcap
+ *
+ * The packets of a batch are copied to one buffer, each at a cache line
+ * boundary, since libpcap only keeps a packet until its callback returns.
+ */
+struct pcap_batch {
+    struct capture *cap;            /**< The handle */
+    struct capture_packet *pkts;    /**< The packets of the batch */
+    int batch;                      /**< The largest number of packets */
+    int n;                          /**< The number of packets */
+    u_char *buf;                    /**< The copies of the packets */
+    size_t size;                    /**< Size of the buffer */
+    size_t used;                    /**< Bytes used in the buffer */
+    capture_batch_handler handler;  /**< The function called for each batch */
+    u_char *user;                   /**< The first argument of the handler */
+};
+
+
+/**
+ * @brief Give the packets of a batch to the handler
+ *
+ * @param b The batch
+ */
+static void batch_flush(struct pcap_batch *b)
+{
+    if (b->n > 0)
+        b->handler(b->user, b->pkts, b->n);
+    b->n = 0;
+    b->used = 0;
+}
+
+
+/**
+ * @brief Add a packet to the batch
+ *
+ * A packet larger than the whole buffer is given to the handler alone,
+ * without a copy.
+ *
+ * @param user The batch
+ * @param header The packet header
+ * @param packet The packet
+ */
+static void batch_collect(u_char *user, const struct pcap_pkthdr *header,
+                          const u_char *packet)
+{
+    struct pcap_batch *b = (struct pcap_batch *)user;
+    struct capture_packet p = {*header, packet, header->ts.tv_usec * 1000};
+    if (b->cap->nano) {
+        p.nsec = header->ts.tv_usec;
+        p.header.ts.tv_usec = p.nsec / 1000;
+    }
+    if (b->cap->truncate && p.header.caplen > (bpf_u_int32)b->cap->snaplen)
+        p.header.caplen = b->cap->snaplen;
+
+    size_t len = ((size_t)p.header.caplen + 63) & ~(size_t)63;
+    if (b->n == b->batch || b->used + len > b->size)
+        batch_flush(b);
+    if (len > b->size) {
+        b->handler(b->user, &p, 1);
+        return;
+    }
+    memcpy(b->buf + b->used, packet, p.header.caplen);
+    p.data = b->buf + b->used;
+    b->used += len;
+    b->pkts[b->n++] = p;
+}
+
+
+/**
+ * @brief Read packets by batches
+ *
+ * Through libpcap, each batch is what pcap_dispatch() returns, copied so the
+ * packets stay valid together. From a ring or a mapped file, the packets of a
+ * batch are read in place.
+ *
+ * @param cap The handle
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param batch The largest number of packets of a batch, 0 for the default
+ * @param handler The function called for each batch
+ * @param user The first argument of the handler
+ * @return int 0 when done, -1 on error, -2 if stopped by capture_breakloop()
+ */
+int capture_loop_batch(struct capture *cap, int count, int batch,
+                       capture_batch_handler handler, u_char *user)
+{
+    if (batch <= 0)
+        batch = CAPTURE_BATCH;
+    struct pcap_batch b = {cap, NULL, batch, 0, NULL, 0, 0, handler, user};
+    b.pkts = malloc(batch * sizeof(struct capture_packet));
+    if (b.pkts == NULL) {
+        fprintf(stderr, "Error allocating the batch: %s\n", strerror(errno));
+        return (-1);
+    }
+#ifdef __linux__
+    if (cap->fd >= 0) {
+        int status = ring_loop_batch(cap, count, b.pkts, batch, handler, user);
+        free(b.pkts);
+        return status;
+    }
+#endif
+    if (cap->file) {
+        int status = file_loop_batch(cap, count, b.pkts, batch, handler, user);
+        free(b.pkts);
+        return status;
+    }
+
+    b.size = (size_t)batch * CAPTURE_FRAME_SIZE;
+    if (b.size < (size_t)cap->snaplen)
+        b.size = ((size_t)cap->snaplen + 63) & ~(size_t)63;
+    b.buf = aligned_alloc(64, b.size);
+    if (b.buf == NULL) {
+        fprintf(stderr, "Error allocating the batch: %s\n", strerror(errno));
+        free(b.pkts);
+        return (-1);
+    }
+
+    int status = 0;
+    int n = 0;
+    while (count <= 0 || n < count) {
+        int want = count > 0 && count - n < batch ? count - n : batch;
+        int got = pcap_dispatch(cap->pcap, want, batch_collect, (u_char *)&b);
+        batch_flush(&b);
+        if (got == -1) {
+            fprintf(stderr, "Error reading packets: %s\n",
+                    pcap_geterr(cap->pcap));
+            status = -1;
+            break;
+        }
+        if (got == -2) {
+            status = -2;
+            break;
+        }
+        if (got == 0 && cap->offline) // End of the file
+            break;
+        if (got == 0 && cap->idle)
+            cap->idle(cap->idle_user);
+        n += got;
+    }
+    free(b.buf);
+    free(b.pkts);
+    return status;
+}
+
+
+/**
+ * @brief Open the handle of a part of a mapped file
+ *
+ * @param cap The handle of the file
+ * @param at The reader at the first record of the part
+ * @return struct capture* The handle, NULL on error
+ */
+static struct capture *part_open(const struct capture *cap,
+                                 const struct pcapfile *at)
+{
+    struct capture *part = malloc(sizeof(struct capture));
+    if (part == NULL)
+        return NULL;
+    *part = *cap; // Shares the filter, the dead handle stays with cap
+    part->pcap = NULL;
+    part->part = 1;
+    part->stop = 0;
+    part->file = pcapfile_dup(at);
+    if (part->file == NULL) {
+        free(part);
+        return NULL;
+    }
+    return part;
+}
+
+
+/**
+ * @brief Split a mapped capture file in parts
+ *
+ * @param cap The handle, of a mapped file not read yet
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param parts The parts to fill
+ * @param n The largest number of parts
+ * @return int The number of parts, -1 on error
+ */
+int capture_split(struct capture *cap, int count, struct capture_part *parts,
+                  int n)
+{
+    if (cap->file == NULL || n <= 0)
+        return (-1);
+    struct pcapfile *scan = pcapfile_dup(cap->file);
+    if (scan == NULL)
+        return (-1);
+
+    size_t start = scan->off;
+    size_t len = scan->end - start;
+    unsigned long long packets = 0;
+    int k = 0;
+    struct capture *part = part_open(cap, scan);
+    if (part == NULL)
+        goto fail;
+    parts[k].cap = part;
+    parts[k].first = 0;
+    parts[k++].count = 0;
+
+    struct pcap_pkthdr header;
+    const u_char *data;
+    // A read error ends the scan, the last part then reports it
+    while (pcapfile_next(scan, &header, &data) > 0) {
+        if (cap->filter.bf_insns &&
+            pcap_offline_filter(&cap->filter, &header, data) == 0)
+            continue;
+        if (++packets == (unsigned long long)count && count > 0)
+            break;
+        if (k < n && scan->off < scan->end &&
+            scan->off - start >= len / n * k) { // Next part
+            parts[k - 1].cap->file->end = scan->off;
+            part = part_open(cap, scan);
+            if (part == NULL)
+                goto fail;
+            parts[k].cap = part;
+            parts[k].first = packets;
+            parts[k++].count = 0;
+        }
+    }
+    if (count > 0)
+        parts[k - 1].count = count - parts[k - 1].first;
+    pcapfile_close(scan);
+    return k;
+
+fail:
+    fprintf(stderr, "Error splitting the capture file: %s\n", strerror(errno));
+    while (--k >= 0)
+        capture_close(parts[k].cap);
+    pcapfile_close(scan);
+    return (-1);
+}
+
+
+/**
+ * @brief Read the kernel counters of a live capture
+ *
+ * The counters of the ring are reset by each read, so they are added up in
+ * the handle.
+ *
+ * @param cap The handle
+ * @param st The counters to fill
+ * @return int 0 on success, -1 for a capture file or on error
+ */
+int capture_stats(struct capture *cap, struct capture_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (cap->offline)
+        return (-1);
+#ifdef __linux__
+    if (cap->fd >= 0) {
+        struct tpacket_stats_v3 ts;
+        socklen_t len = sizeof(ts);
+        if (getsockopt(cap->fd, SOL_PACKET, PACKET_STATISTICS, &ts, &len) < 0)
+            return (-1);
+        cap->ring_packets += ts.tp_packets; // Dropped ones included
+        cap->ring_drops += ts.tp_drops;
+        st->received = cap->ring_packets;
+        st->dropped = cap->ring_drops;
+        return 0;
+    }
+#endif
+    struct pcap_stat ps;
+    if (pcap_stats(cap->pcap, &ps) < 0)
+        return (-1);
+    st->received = ps.ps_recv;
+    st->dropped = ps.ps_drop;
+    st->ifdropped = ps.ps_ifdrop;
+    return 0;
+}
+
+
+/**
+ * @brief Stop capture_loop() or capture_loop_batch()
+ *
+ * This function can be called from a signal handler.
+ *
+ * @param cap The handle
+ */
+void capture_breakloop(struct capture *cap)
+{
+    cap->stop = 1;
+    if (cap->fd < 0 && cap->file == NULL)
+        pcap_breakloop(cap->pcap);
+}
+
+
+/**
+ * @brief Close a capture
+ *
+ * @param cap The handle
+ */
+void capture_close(struct capture *cap)
+{
+#ifdef __linux__
+    if (cap->ring)
+        munmap(cap->ring, (size_t)cap->block_size * cap->block_count);
+#endif
+    if (cap->fd >= 0) {
+        close(cap->fd);
+        pcap_freecode(&cap->filter); // The filter run on the ring with VLAN tags
+    }
+    if (cap->file) {
+        if (!cap->part)
+            pcap_freecode(&cap->filter);
+        pcapfile_close(cap->file);
+    }
+    if (cap->pcap)
+        pcap_close(cap->pcap);
+    free(cap);
+}
@@ -0,0 +1,284 @@
+/**
+ * @author Flavien Lallemant
+ * @file chunk.c
+ * @brief Parallel capture file analysis definition
+ *
+ * This file contains the definition of the analysis of a mapped capture file
+ * split in parts.
+ * The file is scanned once for its record boundaries, then every part is read
+ * in place by its own thread, which starts numbering its packets after the
+ * ones of the parts before it. The threads are joined in file order, and the
+ * text, the counters and the flows of each are added to the result then.
+ * A TCP stream running over the end of a part is reassembled as two streams,
+ * and each part reassembles its own IP fragments: a datagram whose fragments
+ * fall in two parts is only printed as its fragments.
+ *
+ * @see chunk.h
+ * @see chunk_run
+ * @see chunk_stop
+ */
+
+// Global libraries
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Local header files
+#include "arena.h"
+#include "chunk.h"
+#include "decode.h"
+#include "dissector.h"
+#include "dnsname.h"
+#include "flowtab.h"
+#include "ipfrag.h"
+#include "output.h"
+#include "perf.h"
+#include "reasm.h"
+
+/**
+ * @brief Thread reading a part of the file
+ */
+struct chunk_worker {
+    pthread_t thread;               /**< The thread */
+    struct capture_part part;       /**< The part */
+    const struct chunk_config *cfg; /**< The configuration */
+    struct flowtab *flows;          /**< The flow table, NULL if disabled */
+    struct stats stats;             /**< The counters, without renderer */
+    struct outbuf text;             /**< The text not written yet */
+    int fd;                         /**< Where the text goes, stdout for the first part */
+    FILE *spill;                    /**< The temporary file of the text, NULL for the first part */
+    unsigned long long number;      /**< Number of the last packet */
+    unsigned long long packets;     /**< Packets decoded */
+    int errors;                     /**< Writes that failed */
+};
+
+static struct chunk_worker *volatile running = NULL; /**< The threads, for chunk_stop() */
+static volatile int running_count = 0; /**< Number of threads */
+
+
+/**
+ * @brief Write bytes to a file descriptor
+ *
+ * @param fd The file descriptor
+ * @param buf The bytes
+ * @param len The number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (-1);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Write the text of a thread
+ *
+ * @param w The thread
+ */
+static void chunk_spill(struct chunk_worker *w)
+{
+    if (w->text.len > 0 && write_all(w->fd, w->text.data, w->text.len) < 0)
+        w->errors++;
+    w->text.len = 0;
+}
+
+
+/**
+ * @brief Analyze a packet of a part
+ *
+ * @param user The thread
+ * @param header The packet header
+ * @param packet The packet
+ *
+ * @see decode_packet
+ * @see flowtab_update
+ */
+static void chunk_packet(u_char *user, const struct pcap_pkthdr *header,
+                         const u_char *packet)
+{
+    struct chunk_worker *w = (struct chunk_worker *)user;
+    struct packet_info pi;
+    int status = decode_packet(header->ts, header->caplen, header->len, packet,
+                               &pi);
+    w->packets++;
+    if (status == DECODE_FILTERED) {
+        w->number++; // The next packets keep their number
+        return;
+    }
+    flowtab_update(&pi);
+    if (w->cfg->render == NULL) {
+        stats_update(&w->stats, &pi, status);
+        return;
+    }
+    uint64_t start = perf_begin(PERF_RENDER);
+    w->cfg->render(&pi, decode_data(&pi, packet), ++w->number);
+    perf_end(PERF_RENDER, start);
+    if (w->text.len >= CHUNK_SPILL)
+        chunk_spill(w);
+}
+
+
+/**
+ * @brief Thread reading a part of the file
+ *
+ * @param arg The thread
+ * @return void* NULL
+ */
+static void *chunk_main(void *arg)
+{
+    struct chunk_worker *w = arg;
+    out_bind(&w->text);
+    flowtab_bind(w->flows);
+    capture_loop(w->part.cap, w->part.count, chunk_packet, (u_char *)w);
+    chunk_spill(w);
+    out_bind(NULL);
+    flowtab_bind(NULL);
+    reasm_release(); // Streams of the part
+    ipfrag_release();
+    arena_release();
+    dns_name_release();
+    dissector_release();
+    return NULL;
+}
+
+
+/**
+ * @brief Copy the text of a part to stdout
+ *
+ * @param w The thread of the part
+ * @return int 0 on success, -1 on error
+ */
+static int chunk_copy(struct chunk_worker *w)
+{
+    char buf[64 * 1024];
+    size_t n;
+    rewind(w->spill);
+    while ((n = fread(buf, 1, sizeof(buf), w->spill)) > 0) {
+        if (write_all(STDOUT_FILENO, buf, n) < 0)
+            return (-1);
+    }
+    return ferror(w->spill) ? (-1) : 0;
+}
+
+
+/**
+ * @brief Decode a mapped capture file on several threads
+ *
+ * @param cap The handle, of a mapped file not read yet
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int chunk_run(struct capture *cap, const struct chunk_config *cfg)
+{
+    int n = cfg->workers;
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (int)cpus : 1;
+    }
+    struct capture_part *parts = calloc(n, sizeof(struct capture_part));
+    struct chunk_worker *workers = calloc(n, sizeof(struct chunk_worker));
+    if (parts == NULL || workers == NULL) {
+        fprintf(stderr, "Error allocating the parts\n");
+        free(parts);
+        free(workers);
+        return (-1);
+    }
+    n = capture_split(cap, cfg->count, parts, n);
+    if (n < 0) {
+        free(parts);
+        free(workers);
+        return (-1);
+    }
+
+    fflush(stdout); // The threads write to its file descriptor
+    int status = 0;
+    int started = 0;
+    running = workers;
+    for (; started < n; started++) {
+        struct chunk_worker *w = &workers[started];
+        w->part = parts[started];
+        w->cfg = cfg;
+        w->number = w->part.first;
+        w->fd = STDOUT_FILENO;
+        w->flows = flowtab_new();
+        if (flowtab_enabled() && w->flows == NULL) {
+            fprintf(stderr, "Error allocating the flow table of a part\n");
+            status = -1;
+            break;
+        }
+        if (cfg->render && started > 0) {
+            FILE *spill = tmpfile();
+            if (spill == NULL) {
+                fprintf(stderr, "Error creating a temporary file: %s\n",
+                        strerror(errno));
+                status = -1;
+                break;
+            }
+            w->spill = spill;
+            w->fd = fileno(spill);
+        }
+        int err = pthread_create(&w->thread, NULL, chunk_main, w);
+        if (err != 0) {
+            fprintf(stderr, "Error starting a thread: %s\n", strerror(err));
+            status = -1;
+            break;
+        }
+        running_count = started + 1;
+    }
+    if (status < 0)
+        chunk_stop();
+
+    for (int i = 0; i < n; i++) {
+        struct chunk_worker *w = &workers[i];
+        if (i < started) {
+            pthread_join(w->thread, NULL);
+            if (w->spill && status == 0 && chunk_copy(w) < 0)
+                w->errors++;
+            if (w->errors > 0) {
+                fprintf(stderr, "Error writing the text of part %d\n", i);
+                status = -1;
+            }
+            if (cfg->stats)
+                stats_merge(cfg->stats, &w->stats);
+        }
+        if (w->spill)
+            fclose(w->spill);
+        flowtab_merge(w->flows);
+        free(w->text.data);
+    }
+    running_count = 0;
+    running = NULL;
+
+    fprintf(stderr, "Chunks: %d parts\n", n);
+    for (int i = 0; i < n; i++) {
+        fprintf(stderr, "  part %d: %llu packets from packet %llu\n", i,
+                workers[i].packets, parts[i].first + 1);
+        capture_close(parts[i].cap);
+    }
+    free(parts);
+    free(workers);
+    return status;
+}
+
+
+/**
+ * @brief Stop the threads of chunk_run()
+ */
+void chunk_stop(void)
+{
+    struct chunk_worker *w = running;
+    for (int i = 0; w && i < running_count; i++)
+        capture_breakloop(w[i].part.cap);
+}
@@ -0,0 +1,213 @@
+/**
+ * @author Flavien Lallemant
+ * @file classify.c
+ * @brief Payload classifier definition
+ *
+ * This file contains the definition of the prefix trie matching the first
+ * bytes of a payload against the signatures of every text protocol.
+ * The bytes are first reduced to a few classes, the upper case letters and
+ * the punctuation used by the signatures, so a node only needs one child per
+ * class. The digits are grouped by the ranges of the return codes, which
+ * keeps the 3 digits codes down to a handful of nodes.
+ * Each node holds the protocols a signature ending there belongs to, e.g.
+ * USER is both an FTP and a POP3 command.
+ * A signature only matches when followed by a space or the end of the line,
+ * so a payload starting with RMD160 or SYSTEM isn't taken for FTP.
+ *
+ * @see classify.h
+ * @see classify_init
+ * @see classify_payload
+ */
+
+// Global libraries
+#include <stdio.h>
+#include <string.h>
+
+// Local header files
+#include "classify.h"
+
+#define CLASS_COUNT 36 /**< Number of byte classes, 0 is every byte no signature uses */
+#define TRIE_NODES 512 /**< Maximum number of trie nodes */
+
+/**
+ * @brief Text signature
+ */
+struct signature {
+    uint8_t app;        /**< Application protocol, enum app_proto */
+    const char *word;   /**< First word of the payload */
+};
+
+/**
+ * @brief Return code signature
+ *
+ * Matches the 3 digits codes whose first digit is in [first_lo, first_hi]
+ * and second digit is at most second_hi, followed by a space, a dash or the
+ * end of the line.
+ */
+struct code_range {
+    uint8_t app;       /**< Application protocol, enum app_proto */
+    uint8_t first_lo;  /**< Lowest first digit */
+    uint8_t first_hi;  /**< Highest first digit */
+    uint8_t second_hi; /**< Highest second digit */
+};
+
+/**
+ * @brief Trie node
+ */
+struct trie_node {
+    uint16_t next[CLASS_COUNT]; /**< Child of each byte class, 0 if none */
+    uint16_t accept;            /**< Protocols of the signatures ending here */
+};
+
+static const struct signature signatures[] = {
+    /* HTTP commands and responses */
+    {APP_HTTP, "GET"}, {APP_HTTP, "POST"}, {APP_HTTP, "HEAD"},
+    {APP_HTTP, "PUT"}, {APP_HTTP, "OPTIONS"}, {APP_HTTP, "CONNECT"},
+    {APP_HTTP, "HTTP/1.1"}, {APP_HTTP, "HTTP/2"}, {APP_HTTP, "HTTP/3"},
+    /* SMTP commands */
+    {APP_SMTP, "HELO"}, {APP_SMTP, "MAIL"}, {APP_SMTP, "RCPT"},
+    {APP_SMTP, "DATA"}, {APP_SMTP, "QUIT"}, {APP_SMTP, "EHLO"},
+    /* FTP commands */
+    {APP_FTP, "ABOR"}, {APP_FTP, "ACCT"}, {APP_FTP, "ADAT"}, {APP_FTP, "ALLO"},
+    {APP_FTP, "APPE"}, {APP_FTP, "AUTH"}, {APP_FTP, "AVBL"}, {APP_FTP, "CCC"},
+    {APP_FTP, "CDUP"}, {APP_FTP, "CONF"}, {APP_FTP, "CSID"}, {APP_FTP, "CWD"},
+    {APP_FTP, "DELE"}, {APP_FTP, "DSIZ"}, {APP_FTP, "ENC"}, {APP_FTP, "EPRT"},
+    {APP_FTP, "EPSV"}, {APP_FTP, "FEAT"}, {APP_FTP, "HELP"}, {APP_FTP, "HOST"},
+    {APP_FTP, "LANG"}, {APP_FTP, "LIST"}, {APP_FTP, "LPRT"}, {APP_FTP, "LPSV"},
+    {APP_FTP, "MDTM"}, {APP_FTP, "MFCT"}, {APP_FTP, "MFF"}, {APP_FTP, "MFMT"},
+    {APP_FTP, "MIC"}, {APP_FTP, "MKD"}, {APP_FTP, "MLSD"}, {APP_FTP, "MLST"},
+    {APP_FTP, "MODE"}, {APP_FTP, "NLST"}, {APP_FTP, "NOOP"}, {APP_FTP, "OPTS"},
+    {APP_FTP, "PASS"}, {APP_FTP, "PASV"}, {APP_FTP, "PBSZ"}, {APP_FTP, "PORT"},
+    {APP_FTP, "PROT"}, {APP_FTP, "PWD"}, {APP_FTP, "QUIT"}, {APP_FTP, "REIN"},
+    {APP_FTP, "REST"}, {APP_FTP, "RETR"}, {APP_FTP, "RMD"}, {APP_FTP, "RMDA"},
+    {APP_FTP, "RNFR"}, {APP_FTP, "RNTO"}, {APP_FTP, "SITE"}, {APP_FTP, "SIZE"},
+    {APP_FTP, "SMNT"}, {APP_FTP, "SPSV"}, {APP_FTP, "STAT"}, {APP_FTP, "STOR"},
+    {APP_FTP, "STOU"}, {APP_FTP, "STRU"}, {APP_FTP, "SYST"}, {APP_FTP, "THMB"},
+    {APP_FTP, "TYPE"}, {APP_FTP, "USER"}, {APP_FTP, "XCUP"}, {APP_FTP, "XMKD"},
+    {APP_FTP, "XPWD"}, {APP_FTP, "XRCP"}, {APP_FTP, "XRMD"}, {APP_FTP, "XRSQ"},
+    {APP_FTP, "XSEM"}, {APP_FTP, "XSEN"},
+    /* POP3 commands and responses */
+    {APP_POP, "USER"}, {APP_POP, "PASS"}, {APP_POP, "STAT"}, {APP_POP, "LIST"},
+    {APP_POP, "UIDL"}, {APP_POP, "RETR"}, {APP_POP, "DELE"}, {APP_POP, "TOP"},
+    {APP_POP, "LAST"}, {APP_POP, "RSET"}, {APP_POP, "NOOP"}, {APP_POP, "QUIT"},
+    {APP_POP, "+OK"}, {APP_POP, "-ERR"},
+}; /**< Signatures of the text protocols */
+
+static const struct code_range code_ranges[] = {
+    {APP_SMTP, 2, 5, 5},
+    {APP_FTP, 1, 5, 5},
+}; /**< Return codes of the text protocols */
+
+static uint8_t byte_class[256];             /**< Class of each byte */
+static struct trie_node trie[TRIE_NODES];   /**< The trie, node 0 is the root */
+static uint16_t trie_size;                  /**< Number of nodes in use */
+
+
+/**
+ * @brief Get the child of a node, adding it if needed
+ *
+ * @param node The node
+ * @param c The byte leading to the child
+ * @return uint16_t The child, 0 if the trie is full
+ */
+static uint16_t trie_child(uint16_t node, char c)
+{
+    uint8_t cls = byte_class[(uint8_t)c];
+    if (trie[node].next[cls] == 0 && trie_size < TRIE_NODES)
+        trie[node].next[cls] = trie_size++;
+    return trie[node].next[cls];
+}
+
+
+/**
+ * @brief Add a signature to the trie
+ *
+ * @param app The application protocol
+ * @param word The first word of the payloads
+ * @param ends The bytes the word can be followed by
+ * @return int 0 on success, -1 if the trie is full
+ */
+static int trie_insert(uint8_t app, const char *word, const char *ends)
+{
+    uint16_t node = 0;
+    for (const char *c = word; *c != '\0'; c++) {
+        node = trie_child(node, *c);
+        if (node == 0)
+            return (-1);
+    }
+    for (const char *c = ends; *c != '\0'; c++) {
+        uint16_t end = trie_child(node, *c); // Shared by the bytes of a class
+        if (end == 0)
+            return (-1);
+        trie[end].accept |= CLASSIFY_MASK(app);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Compile the protocol signatures
+ */
+void classify_init(void)
+{
+    memset(byte_class, 0, sizeof(byte_class));
+    for (int c = 'A'; c <= 'Z'; c++)
+        byte_class[c] = 1 + c - 'A';
+    byte_class['0'] = 27;
+    byte_class['1'] = 28;
+    for (int c = '2'; c <= '5'; c++) // First digits of the return codes
+        byte_class[c] = 29;
+    for (int c = '6'; c <= '9'; c++)
+        byte_class[c] = 30;
+    byte_class['/'] = 31;
+    byte_class['.'] = 32;
+    byte_class['+'] = 33;
+    byte_class['-'] = 34;
+    byte_class[' '] = 35; // End of the first word
+    byte_class['\r'] = 35;
+
+    memset(trie, 0, sizeof(trie));
+    trie_size = 1;
+    int full = 0;
+    for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++)
+        full |= trie_insert(signatures[i].app, signatures[i].word, " \r");
+
+    for (size_t i = 0; i < sizeof(code_ranges) / sizeof(code_ranges[0]); i++) {
+        const struct code_range *r = &code_ranges[i];
+        char code[4] = {0};
+        for (int first = r->first_lo; first <= r->first_hi; first++) {
+            for (int second = 0; second <= r->second_hi; second++) {
+                for (int third = 0; third <= 9; third++) {
+                    code[0] = '0' + first;
+                    code[1] = '0' + second;
+                    code[2] = '0' + third;
+                    full |= trie_insert(r->app, code, " -\r");
+                }
+            }
+        }
+    }
+    if (full)
+        fprintf(stderr, "Too many protocol signatures, some are ignored\n");
+}
+
+
+/**
+ * @brief Classify a payload
+ *
+ * @param payload The payload
+ * @param size The size of the payload
+ * @return uint16_t The protocols with a signature the payload starts with,
+ * CLASSIFY_MASK() bits
+ */
+uint16_t classify_payload(const u_char *payload, uint32_t size)
+{
+    uint32_t len = size < CLASSIFY_LEN ? size : CLASSIFY_LEN;
+    uint16_t node = 0, mask = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        node = trie[node].next[byte_class[payload[i]]];
+        if (node == 0)
+            break;
+        mask |= trie[node].accept;
+    }
+    return mask;
+}
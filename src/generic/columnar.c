@@ -0,0 +1,649 @@
+/**
+ * @author Flavien Lallemant
+ * @file columnar.c
+ * @brief Columnar packet export definition
+ *
+ * This file contains the definition of the Arrow IPC stream writer.
+ * Each column keeps its values, validity bitmap and, for strings, offsets for
+ * the rows of the current batch. A full batch is written as a RecordBatch
+ * message whose body is these buffers one after the other.
+ * The messages are FlatBuffers, laid out front to back: a table is
+ * preceded by its vtable and followed by the objects it refers to, so every
+ * offset points forward as FlatBuffers requires.
+ *
+ * @see columnar.h
+ * @see columnar_init
+ * @see render_columnar
+ * @see columnar_close
+ */
+
+// Global libraries
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local header files
+#include "columnar.h"
+#include "dns.h"
+#include "output.h"
+
+#define ARROW_CONTINUATION 0xffffffff  /**< Marker before each message */
+#define ARROW_V5 4                      /**< MetadataVersion of the messages */
+#define ARROW_SCHEMA 1                  /**< MessageHeader of a schema */
+#define ARROW_RECORD_BATCH 3            /**< MessageHeader of a record batch */
+#define ARROW_INT 2                     /**< Type of an integer */
+#define ARROW_UTF8 5                    /**< Type of a string */
+#define ARROW_TIMESTAMP 10              /**< Type of a timestamp */
+#define ARROW_FIXED_BINARY 15           /**< Type of a fixed size binary */
+#define ARROW_MICROSECOND 2             /**< TimeUnit of the timestamps */
+
+/**
+ * @brief Type of a column
+ */
+enum col_type {
+    COL_UINT,       /**< Unsigned integer */
+    COL_TIMESTAMP,  /**< Microseconds since the epoch, UTC */
+    COL_FIXED,      /**< Bytes of a fixed length */
+    COL_UTF8,       /**< String */
+};
+
+/**
+ * @brief Column of the current batch
+ */
+struct column {
+    const char *name;       /**< The name */
+    enum col_type type;     /**< The type */
+    uint8_t width;          /**< Bytes of a value, 0 for strings */
+    uint8_t nullable;       /**< 1 if a value can be null */
+    uint8_t *valid;         /**< Validity bitmap */
+    uint8_t *data;          /**< The values, or the bytes of the strings */
+    int32_t *offsets;       /**< Offsets of the strings, one more than the rows */
+    size_t size;            /**< Allocated bytes of the strings */
+    uint32_t nulls;         /**< Null values */
+};
+
+/**
+ * @brief Columns
+ */
+enum {
+    C_TS, C_CAPLEN, C_LEN, C_ETH_SRC, C_ETH_DST, C_ETHERTYPE, C_IP_VERSION,
+    C_IP_SRC, C_IP_DST, C_IP_PROTO, C_IP_TTL, C_SPORT, C_DPORT, C_TCP_FLAGS,
+    C_APP, C_DNS_QNAME, C_DNS_QTYPE, C_COUNT
+};
+
+static struct column cols[C_COUNT] = {
+    [C_TS] = {"timestamp", COL_TIMESTAMP, 8, 0},
+    [C_CAPLEN] = {"caplen", COL_UINT, 4, 0},
+    [C_LEN] = {"len", COL_UINT, 4, 0},
+    [C_ETH_SRC] = {"eth_src", COL_FIXED, 6, 1},
+    [C_ETH_DST] = {"eth_dst", COL_FIXED, 6, 1},
+    [C_ETHERTYPE] = {"ethertype", COL_UINT, 2, 1},
+    [C_IP_VERSION] = {"ip_version", COL_UINT, 1, 1},
+    [C_IP_SRC] = {"ip_src", COL_FIXED, 16, 1},
+    [C_IP_DST] = {"ip_dst", COL_FIXED, 16, 1},
+    [C_IP_PROTO] = {"ip_proto", COL_UINT, 1, 1},
+    [C_IP_TTL] = {"ip_ttl", COL_UINT, 1, 1},
+    [C_SPORT] = {"sport", COL_UINT, 2, 1},
+    [C_DPORT] = {"dport", COL_UINT, 2, 1},
+    [C_TCP_FLAGS] = {"tcp_flags", COL_UINT, 1, 1},
+    [C_APP] = {"app_proto", COL_UTF8, 0, 1},
+    [C_DNS_QNAME] = {"dns_qname", COL_UTF8, 0, 1},
+    [C_DNS_QTYPE] = {"dns_qtype", COL_UINT, 2, 1},
+}; /**< The columns, in schema order */
+
+static unsigned batch_rows = 0; /**< Rows of a batch, 0 if disabled */
+static unsigned row = 0; /**< Rows in the current batch */
+
+/**
+ * @brief FlatBuffer being built
+ */
+struct fbb {
+    uint8_t *buf;   /**< The bytes */
+    size_t len;     /**< Number of bytes */
+    size_t cap;     /**< Allocated bytes */
+    int err;        /**< 1 if an allocation failed */
+};
+
+static struct fbb fb; /**< The message being built */
+
+
+/**
+ * @brief Reserve zeroed bytes at the end of the FlatBuffer
+ *
+ * @param b The FlatBuffer
+ * @param pos Where the bytes start, at or after the end
+ * @param len The number of bytes
+ * @return size_t The position, 0 on error
+ */
+static size_t fb_reserve(struct fbb *b, size_t pos, size_t len)
+{
+    if (b->err)
+        return 0;
+    if (pos + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 1024;
+        while (cap < pos + len)
+            cap *= 2;
+        uint8_t *buf = realloc(b->buf, cap);
+        if (buf == NULL) {
+            b->err = 1;
+            return 0;
+        }
+        b->buf = buf;
+        b->cap = cap;
+    }
+    memset(b->buf + b->len, 0, pos + len - b->len);
+    b->len = pos + len;
+    return pos;
+}
+
+
+/**
+ * @brief Reserve aligned bytes at the end of the FlatBuffer
+ *
+ * @param b The FlatBuffer
+ * @param len The number of bytes
+ * @param align The alignment, a power of 2
+ * @return size_t The position, 0 on error
+ */
+static size_t fb_alloc(struct fbb *b, size_t len, size_t align)
+{
+    return fb_reserve(b, (b->len + align - 1) & ~(align - 1), len);
+}
+
+
+/**
+ * @brief Write a little endian scalar
+ *
+ * @param b The FlatBuffer
+ * @param pos The position
+ * @param v The value
+ * @param len The number of bytes
+ */
+static void fb_put(struct fbb *b, size_t pos, uint64_t v, int len)
+{
+    if (b->err)
+        return;
+    for (int i = 0; i < len; i++, v >>= 8)
+        b->buf[pos + i] = v & 0xff;
+}
+
+
+/**
+ * @brief Make an offset field refer to an object after it
+ *
+ * @param b The FlatBuffer
+ * @param at The position of the field
+ * @param target The position of the object
+ */
+static void fb_ref(struct fbb *b, size_t at, size_t target)
+{
+    fb_put(b, at, target - at, 4);
+}
+
+
+/**
+ * @brief Add a table and its vtable
+ *
+ * The fields are laid out in slot order, each aligned to its size.
+ *
+ * @param b The FlatBuffer
+ * @param slots The number of slots
+ * @param sizes The size of the field of each slot, 0 if absent
+ * @param pos The position of the field of each slot, set
+ * @return size_t The position of the table
+ */
+static size_t fb_table(struct fbb *b, int slots, const uint8_t *sizes,
+                       size_t *pos)
+{
+    uint16_t off[8];
+    size_t size = 4; // Offset to the vtable
+    for (int i = 0; i < slots; i++) {
+        off[i] = 0;
+        if (sizes[i] == 0)
+            continue;
+        size = (size + sizes[i] - 1) & ~(size_t)(sizes[i] - 1);
+        off[i] = size;
+        size += sizes[i];
+    }
+    size_t vt = fb_alloc(b, 4 + 2 * slots, 2);
+    size_t t = fb_alloc(b, size, 8);
+    fb_put(b, vt, 4 + 2 * slots, 2);
+    fb_put(b, vt + 2, size, 2);
+    for (int i = 0; i < slots; i++) {
+        fb_put(b, vt + 4 + 2 * i, off[i], 2);
+        pos[i] = t + off[i];
+    }
+    fb_put(b, t, t - vt, 4);
+    return t;
+}
+
+
+/**
+ * @brief Add a string
+ *
+ * @param b The FlatBuffer
+ * @param s The string
+ * @return size_t The position of the string
+ */
+static size_t fb_string(struct fbb *b, const char *s)
+{
+    size_t len = strlen(s);
+    size_t pos = fb_alloc(b, 4 + len + 1, 4);
+    fb_put(b, pos, len, 4);
+    if (!b->err)
+        memcpy(b->buf + pos + 4, s, len);
+    return pos;
+}
+
+
+/**
+ * @brief Add a vector
+ *
+ * @param b The FlatBuffer
+ * @param count The number of elements
+ * @param elem The size of an element
+ * @param align The alignment of the elements, 4 or more
+ * @return size_t The position of the vector, its elements start 4 bytes after
+ */
+static size_t fb_vector(struct fbb *b, size_t count, size_t elem, size_t align)
+{
+    size_t pos = ((b->len + 4 + align - 1) & ~(align - 1)) - 4;
+    fb_reserve(b, pos, 4 + count * elem);
+    fb_put(b, pos, count, 4);
+    return pos;
+}
+
+
+/**
+ * @brief Start a message
+ *
+ * @param b The FlatBuffer, empty
+ * @param type The MessageHeader of the message
+ * @param body The bytes of the body
+ * @return size_t The position of the header field
+ */
+static size_t fb_message(struct fbb *b, int type, uint64_t body)
+{
+    static const uint8_t sizes[] = {2, 1, 4, 8};
+    size_t pos[4];
+    size_t root = fb_alloc(b, 4, 4);
+    size_t t = fb_table(b, 4, sizes, pos);
+    fb_ref(b, root, t);
+    fb_put(b, pos[0], ARROW_V5, 2);
+    fb_put(b, pos[1], type, 1);
+    fb_put(b, pos[3], body, 8);
+    return pos[2];
+}
+
+
+/**
+ * @brief Add the type of a column
+ *
+ * @param b The FlatBuffer
+ * @param c The column
+ * @return size_t The position of the type
+ */
+static size_t fb_type(struct fbb *b, const struct column *c)
+{
+    static const uint8_t int_sizes[] = {4, 1};
+    static const uint8_t ts_sizes[] = {2, 4};
+    static const uint8_t fixed_sizes[] = {4};
+    size_t pos[2];
+    size_t t;
+    switch (c->type) {
+    case COL_UINT:
+        t = fb_table(b, 2, int_sizes, pos);
+        fb_put(b, pos[0], c->width * 8, 4);
+        fb_put(b, pos[1], 0, 1); // Unsigned
+        return t;
+    case COL_TIMESTAMP:
+        t = fb_table(b, 2, ts_sizes, pos);
+        fb_put(b, pos[0], ARROW_MICROSECOND, 2);
+        fb_ref(b, pos[1], fb_string(b, "UTC"));
+        return t;
+    case COL_FIXED:
+        t = fb_table(b, 1, fixed_sizes, pos);
+        fb_put(b, pos[0], c->width, 4);
+        return t;
+    default:
+        return fb_table(b, 0, NULL, pos);
+    }
+}
+
+
+/**
+ * @brief Write the message built, then a body
+ *
+ * @param b The FlatBuffer
+ * @param body The buffers of the body, NULL for none
+ * @param lens The length of each buffer, padded to 8 bytes in the body
+ * @param count The number of buffers
+ */
+static void write_message(struct fbb *b, uint8_t *const *body,
+                          const size_t *lens, int count)
+{
+    static const uint8_t pad[8];
+    fb_alloc(b, 0, 8); // The body starts aligned
+    if (b->err) {
+        fprintf(stderr, "Error allocating an Arrow message\n");
+        return;
+    }
+    uint8_t prefix[8] = {0xff, 0xff, 0xff, 0xff}; // Then the length, little endian
+    for (int i = 0; i < 4; i++)
+        prefix[4 + i] = b->len >> (8 * i);
+    out_write(prefix, sizeof(prefix));
+    out_write(b->buf, b->len);
+    for (int i = 0; i < count; i++) {
+        out_write(body[i], lens[i]);
+        out_write(pad, (8 - lens[i] % 8) % 8);
+    }
+}
+
+
+/**
+ * @brief Write the schema
+ */
+static void write_schema(void)
+{
+    static const uint8_t schema_sizes[] = {2, 4};
+    static const uint8_t field_sizes[] = {4, 1, 1, 4, 0, 4};
+    static const uint8_t types[] = {
+        [COL_UINT] = ARROW_INT,
+        [COL_TIMESTAMP] = ARROW_TIMESTAMP,
+        [COL_FIXED] = ARROW_FIXED_BINARY,
+        [COL_UTF8] = ARROW_UTF8,
+    };
+    size_t pos[6];
+    fb.len = 0;
+    size_t header = fb_message(&fb, ARROW_SCHEMA, 0);
+    size_t schema = fb_table(&fb, 2, schema_sizes, pos);
+    fb_ref(&fb, header, schema);
+    fb_put(&fb, pos[0], __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__, 2);
+    size_t fields = fb_vector(&fb, C_COUNT, 4, 4);
+    fb_ref(&fb, pos[1], fields);
+    for (int i = 0; i < C_COUNT; i++) {
+        size_t field = fb_table(&fb, 6, field_sizes, pos);
+        fb_ref(&fb, fields + 4 + 4 * i, field);
+        fb_ref(&fb, pos[0], fb_string(&fb, cols[i].name));
+        fb_put(&fb, pos[1], cols[i].nullable, 1);
+        fb_put(&fb, pos[2], types[cols[i].type], 1);
+        fb_ref(&fb, pos[3], fb_type(&fb, &cols[i]));
+        fb_ref(&fb, pos[5], fb_vector(&fb, 0, 4, 4)); // No children
+    }
+    write_message(&fb, NULL, NULL, 0);
+}
+
+
+/**
+ * @brief Write the current batch and empty it
+ */
+static void write_batch(void)
+{
+    static const uint8_t batch_sizes[] = {8, 4, 4};
+    uint8_t *bufs[C_COUNT * 3];
+    size_t lens[C_COUNT * 3];
+    int n = 0;
+    for (int i = 0; i < C_COUNT; i++) {
+        struct column *c = &cols[i];
+        bufs[n] = c->valid;
+        lens[n++] = c->nulls ? (row + 7) / 8 : 0;
+        if (c->type == COL_UTF8) {
+            bufs[n] = (uint8_t *)c->offsets;
+            lens[n++] = (row + 1) * sizeof(int32_t);
+            bufs[n] = c->data;
+            lens[n++] = c->offsets[row];
+        } else {
+            bufs[n] = c->data;
+            lens[n++] = (size_t)row * c->width;
+        }
+    }
+    uint64_t body = 0;
+    for (int i = 0; i < n; i++)
+        body += (lens[i] + 7) & ~(size_t)7;
+
+    size_t pos[3];
+    fb.len = 0;
+    size_t header = fb_message(&fb, ARROW_RECORD_BATCH, body);
+    size_t batch = fb_table(&fb, 3, batch_sizes, pos);
+    fb_ref(&fb, header, batch);
+    fb_put(&fb, pos[0], row, 8);
+    size_t nodes = fb_vector(&fb, C_COUNT, 16, 8);
+    fb_ref(&fb, pos[1], nodes);
+    for (int i = 0; i < C_COUNT; i++) {
+        fb_put(&fb, nodes + 4 + 16 * i, row, 8);
+        fb_put(&fb, nodes + 12 + 16 * i, cols[i].nulls, 8);
+    }
+    size_t buffers = fb_vector(&fb, n, 16, 8);
+    fb_ref(&fb, pos[2], buffers);
+    uint64_t off = 0;
+    for (int i = 0; i < n; i++) {
+        fb_put(&fb, buffers + 4 + 16 * i, off, 8);
+        fb_put(&fb, buffers + 12 + 16 * i, lens[i], 8);
+        off += (lens[i] + 7) & ~(size_t)7;
+    }
+    write_message(&fb, bufs, lens, n);
+
+    for (int i = 0; i < C_COUNT; i++) {
+        memset(cols[i].valid, 0, (batch_rows + 7) / 8);
+        cols[i].nulls = 0;
+    }
+    row = 0;
+    out_flush();
+}
+
+
+/**
+ * @brief Allocate the columns and write the schema
+ *
+ * @param rows Rows of a record batch, 0 for the default
+ * @return int 0 on success, -1 on error
+ */
+int columnar_init(unsigned rows)
+{
+    batch_rows = rows ? rows : COLUMNAR_ROWS;
+    for (int i = 0; i < C_COUNT; i++) {
+        struct column *c = &cols[i];
+        c->valid = calloc((batch_rows + 7) / 8, 1);
+        if (c->type == COL_UTF8) {
+            c->size = (size_t)batch_rows * 16;
+            c->data = malloc(c->size);
+            c->offsets = calloc(batch_rows + 1, sizeof(int32_t));
+        } else {
+            c->data = malloc((size_t)batch_rows * c->width);
+        }
+        if (c->valid == NULL || c->data == NULL ||
+            (c->type == COL_UTF8 && c->offsets == NULL)) {
+            fprintf(stderr, "Error allocating the columns\n");
+            columnar_close();
+            return (-1);
+        }
+    }
+    write_schema();
+    return 0;
+}
+
+
+/**
+ * @brief Set the value of the current row
+ *
+ * @param c The column, of fixed width
+ * @param value The value, width bytes
+ */
+static void col_set(struct column *c, const void *value)
+{
+    memcpy(c->data + (size_t)row * c->width, value, c->width);
+    c->valid[row / 8] |= 1 << (row % 8);
+}
+
+
+/**
+ * @brief Set the string of the current row
+ *
+ * @param c The column, of strings
+ * @param s The string, NULL for null
+ */
+static void col_str(struct column *c, const char *s)
+{
+    size_t len = s ? strlen(s) : 0;
+    if (c->offsets[row] + len > c->size) {
+        size_t size = c->size * 2 + len;
+        uint8_t *data = realloc(c->data, size);
+        if (data == NULL)
+            s = NULL, len = 0;
+        else
+            c->data = data, c->size = size;
+    }
+    c->offsets[row + 1] = c->offsets[row] + len;
+    if (s == NULL) {
+        c->nulls++;
+        return;
+    }
+    memcpy(c->data + c->offsets[row], s, len);
+    c->valid[row / 8] |= 1 << (row % 8);
+}
+
+
+/**
+ * @brief Set the current row to null
+ *
+ * @param c The column, of fixed width
+ */
+static void col_null(struct column *c)
+{
+    memset(c->data + (size_t)row * c->width, 0, c->width);
+    c->nulls++;
+}
+
+
+/**
+ * @brief Set an integer of the current row
+ *
+ * @param c The column, of integers
+ * @param v The value
+ */
+static void col_uint(struct column *c, uint64_t v)
+{
+    uint8_t u8 = v;
+    uint16_t u16 = v;
+    uint32_t u32 = v;
+    col_set(c, c->width == 1 ? (const void *)&u8
+               : c->width == 2 ? (const void *)&u16
+               : c->width == 4 ? (const void *)&u32
+                               : (const void *)&v);
+}
+
+
+/**
+ * @brief Set an IP address of the current row
+ *
+ * @param c The column
+ * @param version The IP version
+ * @param addr The address
+ */
+static void col_ip(struct column *c, int version, const uint8_t *addr)
+{
+    uint8_t ip[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (version == 4)
+        memcpy(ip + 12, addr, 4);
+    else
+        memcpy(ip, addr, 16);
+    col_set(c, ip);
+}
+
+
+/**
+ * @brief Add a decoded packet to the record batch
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ *
+ * @see dns_question
+ */
+void render_columnar(const struct packet_info *pi, const u_char *packet,
+                     unsigned long number)
+{
+    (void)number;
+    if (batch_rows == 0)
+        return;
+    col_uint(&cols[C_TS], (uint64_t)pi->ts.tv_sec * 1000000 + pi->ts.tv_usec);
+    col_uint(&cols[C_CAPLEN], pi->caplen);
+    col_uint(&cols[C_LEN], pi->len);
+
+    if (pi->layers & LAYER_ETH) {
+        col_set(&cols[C_ETH_SRC], pi->mac_src);
+        col_set(&cols[C_ETH_DST], pi->mac_dst);
+        col_uint(&cols[C_ETHERTYPE], pi->ethertype);
+    } else {
+        col_null(&cols[C_ETH_SRC]);
+        col_null(&cols[C_ETH_DST]);
+        col_null(&cols[C_ETHERTYPE]);
+    }
+
+    if (pi->ip_version) {
+        col_uint(&cols[C_IP_VERSION], pi->ip_version);
+        col_ip(&cols[C_IP_SRC], pi->ip_version, pi->ip_src);
+        col_ip(&cols[C_IP_DST], pi->ip_version, pi->ip_dst);
+        col_uint(&cols[C_IP_PROTO], pi->ip_proto);
+        col_uint(&cols[C_IP_TTL], pi->ip_ttl);
+    } else {
+        for (int i = C_IP_VERSION; i <= C_IP_TTL; i++)
+            col_null(&cols[i]);
+    }
+
+    if (pi->layers & (LAYER_TCP | LAYER_UDP)) {
+        col_uint(&cols[C_SPORT], pi->sport);
+        col_uint(&cols[C_DPORT], pi->dport);
+    } else {
+        col_null(&cols[C_SPORT]);
+        col_null(&cols[C_DPORT]);
+    }
+    if (pi->layers & LAYER_TCP)
+        col_uint(&cols[C_TCP_FLAGS], pi->tcp_flags);
+    else
+        col_null(&cols[C_TCP_FLAGS]);
+    col_str(&cols[C_APP], pi->app_proto != APP_NONE
+                              ? app_proto_name(pi->app_proto)
+                              : NULL);
+
+    char name[DNS_NAME_LEN];
+    uint16_t type;
+    if (pi->app_proto == APP_DNS && pi->layers & LAYER_UDP &&
+        dns_question(packet + pi->l7_off, pi->l7_len, name, &type) == 0) {
+        col_str(&cols[C_DNS_QNAME], name);
+        col_uint(&cols[C_DNS_QTYPE], type);
+    } else {
+        col_str(&cols[C_DNS_QNAME], NULL);
+        col_null(&cols[C_DNS_QTYPE]);
+    }
+
+    if (++row == batch_rows)
+        write_batch();
+}
+
+
+/**
+ * @brief Write the last record batch and the end of the stream
+ */
+void columnar_close(void)
+{
+    if (batch_rows && cols[C_COUNT - 1].data) { // Fully allocated
+        if (row > 0)
+            write_batch();
+        uint32_t eos[2] = {ARROW_CONTINUATION, 0};
+        out_write(eos, sizeof(eos));
+        out_flush();
+    }
+    for (int i = 0; i < C_COUNT; i++) {
+        free(cols[i].valid);
+        free(cols[i].data);
+        free(cols[i].offsets);
+        cols[i].valid = cols[i].data = NULL;
+        cols[i].offsets = NULL;
+    }
+    free(fb.buf);
+    fb.buf = NULL;
+    fb.len = fb.cap = 0;
+    batch_rows = 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * @author Flavien Lallemant
+ * @file decode.c
+ * @brief Packet decoding definition
+ *
+ * This file contains the definition of the decoding entry point.
+ *
+ * @see decode.h
+ * @see decode_packet
+ * @see decode_set_depth
+ * @see decode_shed_depth
+ * @see decode_set_linktype
+ * @see decode_set_filter
+ * @see decode_app
+ * @see decode_data
+ * @see app_proto_name
+ * @see decode_headers_snaplen
+ */
+
+// Global libraries
+#include <net/ethernet.h>
+#include <netinet/udp.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// Local header files
+#include "arena.h"
+#include "decode.h"
+#include "dfilter.h"
+#include "dispatch.h"
+#include "dissector.h"
+#include "encap.h"
+#include "ethernet.h"
+#include "ipfrag.h"
+#include "perf.h"
+#include "raw.h"
+#include "reasm.h"
+#include "sll.h"
+
+#define MAX_IP_HDR_LEN 60 /**< IPv4 header with options, larger than the IPv6 one */
+#define MAX_TCP_HDR_LEN 60 /**< TCP header with options */
+#define MAX_LINK_HDR_LEN (SLL2_HDR_LEN + 8) /**< Cooked header or Ethernet header, with two VLAN tags */
+
+static const char *app_names[APP_PLUGIN] = {
+    "NONE", "HTTP", "HTTPS", "SMTP", "FTP", "DNS",
+    "POP3", "IMAP", "IMAPS", "TELNET", "BOOTP"}; /**< Names of the application protocols */
+static uint8_t decode_depth = DECODE_APP; /**< Deepest layer to decode, enum decode_depth */
+static _Atomic uint8_t decode_shed = DECODE_APP; /**< Deepest layer to decode under overload, enum decode_depth */
+static const struct dfilter *decode_filter = NULL; /**< The display filter, NULL if none */
+static int (*decode_link)(struct packet_view *v, struct packet_info *pi) = cast_ethernet; /**< Dissector of the link layer */
+
+
+/**
+ * @brief Decode a packet
+ *
+ * This function decodes a packet into a packet_info structure, without any I/O.
+ * The scratch memory of the packet the thread decoded before is reclaimed.
+ * With a display filter, the packet is decoded up to the transport layer
+ * first, and the application protocol only if the filter needs it or the
+ * packet matches, unless the reassembly already consumes the application
+ * bytes.
+ *
+ * @param ts The capture timestamp
+ * @param caplen The captured length
+ * @param len The length on the wire
+ * @param packet The packet to decode
+ * @param pi The structure to fill
+ * @return int 0 if the packet is well decoded, -1 otherwise, DECODE_FILTERED
+ * if the display filter rejects it
+ *
+ * @see decode_set_linktype
+ * @see decode_data
+ * @see dfilter_match
+ * @see decode_app
+ * @see perf_begin
+ */
+int decode_packet(struct timeval ts, uint32_t caplen, uint32_t len,
+                  const u_char *packet, struct packet_info *pi)
+{
+    uint64_t start = perf_begin(PERF_DECODE);
+    arena_reset(); // The scratch memory of the previous packet
+    memset(pi, 0, sizeof(*pi));
+    pi->ts = ts;
+    pi->caplen = caplen;
+    pi->len = len;
+    uint8_t depth = atomic_load_explicit(&decode_shed, memory_order_relaxed);
+    if (depth > decode_depth)
+        depth = decode_depth;
+    pi->depth = decode_filter && !reasm_enabled() ? DECODE_TRANSPORT : depth;
+
+    struct packet_view v;
+    view_init(&v, packet, caplen);
+    int ret = decode_link(&v, pi);
+    packet = decode_data(pi, packet);
+    if (decode_filter) {
+        uint64_t filter = perf_begin(PERF_FILTER);
+        int match = dfilter_match(decode_filter, pi, packet);
+        perf_end(PERF_FILTER, filter);
+        if (!match)
+            ret = DECODE_FILTERED;
+        else if (pi->depth < depth)
+            decode_app(pi, packet);
+    }
+    perf_layers(pi->layers);
+    perf_end(PERF_DECODE, start);
+    return ret;
+}
+
+
+/**
+ * @brief Decode the application protocol of a packet decoded up to the
+ * transport layer
+ *
+ * Nothing is done if it was already decoded.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ *
+ * @see decode_data
+ * @see dispatch_app
+ */
+void decode_app(struct packet_info *pi, const u_char *packet)
+{
+    if (pi->depth >= DECODE_APP)
+        return;
+    pi->depth = DECODE_APP;
+    if (!(pi->layers & (LAYER_TCP | LAYER_UDP)) || pi->l7_len == 0)
+        return;
+
+    packet = decode_data(pi, packet);
+    struct packet_view v;
+    view_init(&v, packet, pi->caplen);
+    view_skip(&v, pi->l7_off);
+    view_limit(&v, pi->l7_len);
+    dispatch_app(pi->layers & LAYER_TCP ? DISPATCH_TCP : DISPATCH_UDP, &v, pi);
+}
+
+
+/**
+ * @brief Get the bytes a decoded packet refers to
+ *
+ * The offsets of a packet completing an IP datagram refer to the datagram
+ * rebuilt from its fragments, every other packet to the packet itself.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet given to decode_packet()
+ * @return const u_char* The bytes to print the packet from
+ *
+ * @see ipfrag_data
+ */
+const u_char *decode_data(const struct packet_info *pi, const u_char *packet)
+{
+    return pi->layers & LAYER_DEFRAG ? ipfrag_data(pi, NULL) : packet;
+}
+
+
+/**
+ * @brief Set the depth of the decoding
+ *
+ * @param depth The deepest layer to decode, enum decode_depth
+ */
+void decode_set_depth(enum decode_depth depth)
+{
+    decode_depth = depth;
+}
+
+
+/**
+ * @brief Limit the depth of the decoding under overload
+ *
+ * The limit applies to the packets decoded after it is set, by any thread;
+ * the depth of decode_set_depth() is kept.
+ *
+ * @param depth The deepest layer to decode, DECODE_APP for no limit
+ */
+void decode_shed_depth(enum decode_depth depth)
+{
+    atomic_store_explicit(&decode_shed, depth, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Set the link type of the packets to decode
+ *
+ * @param linktype The DLT_* link type
+ * @return int 0 on success, -1 if the link type isn't supported
+ *
+ * @see encap_set_linktype
+ */
+int decode_set_linktype(int linktype)
+{
+    if (encap_set_linktype(linktype) < 0)
+        return (-1);
+    switch (linktype) {
+    case DLT_EN10MB:
+        decode_link = cast_ethernet;
+        break;
+    case DLT_LINUX_SLL:
+        decode_link = cast_sll;
+        break;
+    case DLT_LINUX_SLL2:
+        decode_link = cast_sll2;
+        break;
+    default: // Raw IP
+        decode_link = cast_raw;
+        break;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Set the display filter run on the decoded packets
+ *
+ * @param f The filter, NULL for none
+ */
+void decode_set_filter(const struct dfilter *f)
+{
+    decode_filter = f;
+}
+
+
+/**
+ * @brief Get the name of an application protocol
+ *
+ * @param app The application protocol, enum app_proto
+ * @return const char* The name of the protocol
+ */
+const char *app_proto_name(uint8_t app)
+{
+    if (app >= APP_PLUGIN) {
+        const struct dissector_plugin *d = dissector_plugin(app);
+        return d ? d->name : "UNKNOWN";
+    }
+    return app_names[app];
+}
+
+
+/**
+ * @brief Get the snapshot length needed to decode the headers only
+ *
+ * The length covers the largest link layer, IP and transport headers, plus
+ * the payload bytes the mapped application dissectors need to recognize
+ * their protocol. The headers of the tunnels aren't counted.
+ *
+ * @return int The snapshot length
+ *
+ * @see dispatch_classify_len
+ */
+int decode_headers_snaplen(void)
+{
+    int tcp = MAX_TCP_HDR_LEN + dispatch_classify_len(DISPATCH_TCP);
+    int udp = sizeof(struct udphdr) + dispatch_classify_len(DISPATCH_UDP);
+    return MAX_LINK_HDR_LEN + MAX_IP_HDR_LEN + (tcp > udp ? tcp : udp);
+}
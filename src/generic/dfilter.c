@@ -0,0 +1,1236 @@
+/**
+ * @author Flavien Lallemant
+ * @file dfilter.c
+ * @brief Display filter definition
+ *
+ * This file contains the definition of the display filter compiler and of the
+ * machine running the compiled filters.
+ * The parser is a recursive descent one emitting the program as it goes: a
+ * test sets the result, and the operands of an "and" or an "or" are followed
+ * by a jump to its end taken as soon as the result is known, so the program
+ * runs from the start to the end without any stack.
+ * The fields are read from the decoded packet, the few the decoding doesn't
+ * keep, as the DNS question, the HTTP method or the JA3 hash, straight from
+ * the message.
+ *
+ * @see dfilter.h
+ * @see dfilter_compile
+ * @see dfilter_match
+ * @see dfilter_free
+ */
+
+// Global libraries
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Local header files
+#include "dfilter.h"
+#include "dns.h"
+#include "encap.h"
+#include "md5.h"
+#include "tls.h"
+
+#define DFILTER_WORD 256 /**< Longest word or string of an expression */
+#define DFILTER_NESTING 64 /**< Deepest nesting of the parentheses and negations */
+#define NO_JUMP UINT32_MAX /**< End of a list of jumps to patch */
+
+/**
+ * @brief Types of the fields
+ */
+enum ftype {
+    FT_PROTO,   /**< A protocol, only tested for presence */
+    FT_UINT,    /**< An unsigned integer */
+    FT_BOOL,    /**< A flag, true if set */
+    FT_IP,      /**< An IPv4 or IPv6 address */
+    FT_MAC,     /**< A MAC address */
+    FT_STR,     /**< A string */
+};
+
+/**
+ * @brief Fields
+ */
+enum field_id {
+    F_FRAME_LEN, F_FRAME_CAPLEN,
+    F_ETH, F_ETH_SRC, F_ETH_DST, F_ETH_ADDR, F_ETH_TYPE,
+    F_SLL, F_VLAN, F_VLAN_ID, F_VLAN_PRIORITY, F_MPLS, F_GRE, F_VXLAN,
+    F_GENEVE,
+    F_ARP, F_ARP_OPCODE, F_ARP_SPA, F_ARP_TPA,
+    F_IP, F_IP_VERSION, F_IP_SRC, F_IP_DST, F_IP_ADDR, F_IP_PROTO, F_IP_TTL,
+    F_IP_LEN, F_IP_FRAGMENT, F_IP_REASSEMBLED, F_IP_FRAG_OFFSET, F_IP_MF,
+    F_ICMP, F_ICMPV6, F_ICMP_TYPE, F_ICMP_CODE,
+    F_TCP, F_TCP_SRCPORT, F_TCP_DSTPORT, F_TCP_PORT, F_TCP_FLAGS, F_TCP_FIN,
+    F_TCP_SYN, F_TCP_RST, F_TCP_PSH, F_TCP_ACK, F_TCP_SEQ, F_TCP_ACKNUM,
+    F_TCP_LEN,
+    F_UDP, F_UDP_SRCPORT, F_UDP_DSTPORT, F_UDP_PORT, F_UDP_LEN,
+    /* Application fields */
+    F_APP,
+    F_DNS, F_DNS_ID, F_DNS_RESPONSE, F_DNS_RCODE, F_DNS_QUERIES,
+    F_DNS_ANSWERS, F_DNS_QNAME, F_DNS_QTYPE,
+    F_BOOTP, F_DHCP, F_DHCP_TYPE, F_DHCP_MSG_TYPE,
+    F_HTTP, F_HTTP_METHOD, F_HTTP_HOST,
+    F_TLS, F_TLS_VERSION, F_TLS_TYPE, F_TLS_HS_TYPE, F_TLS_HS_VERSION,
+    F_TLS_CIPHER, F_TLS_SNI, F_TLS_ALPN, F_TLS_JA3, F_TLS_JA3S,
+    F_SMTP, F_FTP, F_POP, F_IMAP, F_TELNET,
+    F_COUNT
+};
+
+/**
+ * @brief Description of a field
+ */
+struct field {
+    const char *name;   /**< The name in the expressions */
+    uint8_t type;       /**< The type, enum ftype */
+    uint8_t app;        /**< 1 if the application protocol must be decoded */
+    uint8_t either;     /**< 1 if the field has a source and a destination side */
+    uint8_t nocase;     /**< 1 if the strings are compared ignoring the case */
+};
+
+static const struct field fields[F_COUNT] = {
+    [F_FRAME_LEN] = {"frame.len", FT_UINT, 0, 0, 0},
+    [F_FRAME_CAPLEN] = {"frame.cap_len", FT_UINT, 0, 0, 0},
+    [F_ETH] = {"eth", FT_PROTO, 0, 0, 0},
+    [F_ETH_SRC] = {"eth.src", FT_MAC, 0, 0, 0},
+    [F_ETH_DST] = {"eth.dst", FT_MAC, 0, 0, 0},
+    [F_ETH_ADDR] = {"eth.addr", FT_MAC, 0, 1, 0},
+    [F_ETH_TYPE] = {"eth.type", FT_UINT, 0, 0, 0},
+    [F_SLL] = {"sll", FT_PROTO, 0, 0, 0},
+    [F_VLAN] = {"vlan", FT_PROTO, 0, 0, 0},
+    [F_VLAN_ID] = {"vlan.id", FT_UINT, 0, 0, 0},
+    [F_VLAN_PRIORITY] = {"vlan.priority", FT_UINT, 0, 0, 0},
+    [F_MPLS] = {"mpls", FT_PROTO, 0, 0, 0},
+    [F_GRE] = {"gre", FT_PROTO, 0, 0, 0},
+    [F_VXLAN] = {"vxlan", FT_PROTO, 0, 0, 0},
+    [F_GENEVE] = {"geneve", FT_PROTO, 0, 0, 0},
+    [F_ARP] = {"arp", FT_PROTO, 0, 0, 0},
+    [F_ARP_OPCODE] = {"arp.opcode", FT_UINT, 0, 0, 0},
+    [F_ARP_SPA] = {"arp.src.proto_ipv4", FT_IP, 0, 0, 0},
+    [F_ARP_TPA] = {"arp.dst.proto_ipv4", FT_IP, 0, 0, 0},
+    [F_IP] = {"ip", FT_PROTO, 0, 0, 0},
+    [F_IP_VERSION] = {"ip.version", FT_UINT, 0, 0, 0},
+    [F_IP_SRC] = {"ip.src", FT_IP, 0, 0, 0},
+    [F_IP_DST] = {"ip.dst", FT_IP, 0, 0, 0},
+    [F_IP_ADDR] = {"ip.addr", FT_IP, 0, 1, 0},
+    [F_IP_PROTO] = {"ip.proto", FT_UINT, 0, 0, 0},
+    [F_IP_TTL] = {"ip.ttl", FT_UINT, 0, 0, 0},
+    [F_IP_LEN] = {"ip.len", FT_UINT, 0, 0, 0},
+    [F_IP_FRAGMENT] = {"ip.fragment", FT_PROTO, 0, 0, 0},
+    [F_IP_REASSEMBLED] = {"ip.reassembled", FT_PROTO, 0, 0, 0},
+    [F_IP_FRAG_OFFSET] = {"ip.frag_offset", FT_UINT, 0, 0, 0},
+    [F_IP_MF] = {"ip.flags.mf", FT_BOOL, 0, 0, 0},
+    [F_ICMP] = {"icmp", FT_PROTO, 0, 0, 0},
+    [F_ICMPV6] = {"icmpv6", FT_PROTO, 0, 0, 0},
+    [F_ICMP_TYPE] = {"icmp.type", FT_UINT, 0, 0, 0},
+    [F_ICMP_CODE] = {"icmp.code", FT_UINT, 0, 0, 0},
+    [F_TCP] = {"tcp", FT_PROTO, 0, 0, 0},
+    [F_TCP_SRCPORT] = {"tcp.srcport", FT_UINT, 0, 0, 0},
+    [F_TCP_DSTPORT] = {"tcp.dstport", FT_UINT, 0, 0, 0},
+    [F_TCP_PORT] = {"tcp.port", FT_UINT, 0, 1, 0},
+    [F_TCP_FLAGS] = {"tcp.flags", FT_UINT, 0, 0, 0},
+    [F_TCP_FIN] = {"tcp.flags.fin", FT_BOOL, 0, 0, 0},
+    [F_TCP_SYN] = {"tcp.flags.syn", FT_BOOL, 0, 0, 0},
+    [F_TCP_RST] = {"tcp.flags.reset", FT_BOOL, 0, 0, 0},
+    [F_TCP_PSH] = {"tcp.flags.push", FT_BOOL, 0, 0, 0},
+    [F_TCP_ACK] = {"tcp.flags.ack", FT_BOOL, 0, 0, 0},
+    [F_TCP_SEQ] = {"tcp.seq", FT_UINT, 0, 0, 0},
+    [F_TCP_ACKNUM] = {"tcp.ack", FT_UINT, 0, 0, 0},
+    [F_TCP_LEN] = {"tcp.len", FT_UINT, 0, 0, 0},
+    [F_UDP] = {"udp", FT_PROTO, 0, 0, 0},
+    [F_UDP_SRCPORT] = {"udp.srcport", FT_UINT, 0, 0, 0},
+    [F_UDP_DSTPORT] = {"udp.dstport", FT_UINT, 0, 0, 0},
+    [F_UDP_PORT] = {"udp.port", FT_UINT, 0, 1, 0},
+    [F_UDP_LEN] = {"udp.length", FT_UINT, 0, 0, 0},
+    [F_APP] = {"app", FT_STR, 1, 0, 1},
+    [F_DNS] = {"dns", FT_PROTO, 1, 0, 0},
+    [F_DNS_ID] = {"dns.id", FT_UINT, 1, 0, 0},
+    [F_DNS_RESPONSE] = {"dns.flags.response", FT_BOOL, 1, 0, 0},
+    [F_DNS_RCODE] = {"dns.flags.rcode", FT_UINT, 1, 0, 0},
+    [F_DNS_QUERIES] = {"dns.count.queries", FT_UINT, 1, 0, 0},
+    [F_DNS_ANSWERS] = {"dns.count.answers", FT_UINT, 1, 0, 0},
+    [F_DNS_QNAME] = {"dns.qry.name", FT_STR, 1, 0, 1},
+    [F_DNS_QTYPE] = {"dns.qry.type", FT_UINT, 1, 0, 0},
+    [F_BOOTP] = {"bootp", FT_PROTO, 1, 0, 0},
+    [F_DHCP] = {"dhcp", FT_PROTO, 1, 0, 0},
+    [F_DHCP_TYPE] = {"dhcp.type", FT_UINT, 1, 0, 0},
+    [F_DHCP_MSG_TYPE] = {"dhcp.option.dhcp", FT_UINT, 1, 0, 0},
+    [F_HTTP] = {"http", FT_PROTO, 1, 0, 0},
+    [F_HTTP_METHOD] = {"http.request.method", FT_STR, 1, 0, 0},
+    [F_HTTP_HOST] = {"http.host", FT_STR, 1, 0, 1},
+    [F_TLS] = {"tls", FT_PROTO, 1, 0, 0},
+    [F_TLS_VERSION] = {"tls.record.version", FT_UINT, 1, 0, 0},
+    [F_TLS_TYPE] = {"tls.record.content_type", FT_UINT, 1, 0, 0},
+    [F_TLS_HS_TYPE] = {"tls.handshake.type", FT_UINT, 1, 0, 0},
+    [F_TLS_HS_VERSION] = {"tls.handshake.extensions.supported_version", FT_UINT, 1, 0, 0},
+    [F_TLS_CIPHER] = {"tls.handshake.ciphersuite", FT_UINT, 1, 0, 0},
+    [F_TLS_SNI] = {"tls.handshake.extensions_server_name", FT_STR, 1, 0, 1},
+    [F_TLS_ALPN] = {"tls.handshake.extensions_alpn_str", FT_STR, 1, 0, 0},
+    [F_TLS_JA3] = {"tls.handshake.ja3_hash", FT_STR, 1, 0, 1},
+    [F_TLS_JA3S] = {"tls.handshake.ja3s_hash", FT_STR, 1, 0, 1},
+    [F_SMTP] = {"smtp", FT_PROTO, 1, 0, 0},
+    [F_FTP] = {"ftp", FT_PROTO, 1, 0, 0},
+    [F_POP] = {"pop", FT_PROTO, 1, 0, 0},
+    [F_IMAP] = {"imap", FT_PROTO, 1, 0, 0},
+    [F_TELNET] = {"telnet", FT_PROTO, 1, 0, 0},
+}; /**< Fields of the expressions */
+
+/**
+ * @brief Comparisons
+ */
+enum cmp {
+    CMP_EXISTS, /**< The field is present, or the flag is set */
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE,
+    CMP_CONTAINS,
+};
+
+/**
+ * @brief Operations of the program
+ */
+enum op {
+    OP_TEST,    /**< Set the result to the outcome of a test */
+    OP_NOT,     /**< Negate the result */
+    OP_JF,      /**< Jump if the result is false */
+    OP_JT,      /**< Jump if the result is true */
+};
+
+/**
+ * @brief Instruction of the program
+ */
+struct insn {
+    uint8_t op;         /**< The operation, enum op */
+    uint8_t field;      /**< The field tested, enum field_id */
+    uint8_t cmp;        /**< The comparison, enum cmp */
+    uint8_t version;    /**< 4 or 6 for an IP address */
+    uint8_t prefix;     /**< Bits of the IP address compared */
+    uint32_t target;    /**< Instruction jumped to */
+    uint64_t num;       /**< The integer */
+    uint8_t addr[16];   /**< The address */
+    char *str;          /**< The string */
+    size_t len;         /**< Length of the string */
+};
+
+/**
+ * @brief Compiled display filter
+ */
+struct dfilter {
+    struct insn *code;  /**< The program */
+    size_t count;       /**< Instructions of the program */
+};
+
+/**
+ * @brief Tokens of the expressions
+ */
+enum token {
+    T_END,
+    T_LPAREN,
+    T_RPAREN,
+    T_AND,
+    T_OR,
+    T_NOT,
+    T_CMP,
+    T_WORD,
+    T_STRING,
+    T_ERROR,
+};
+
+/**
+ * @brief State of the compiler
+ */
+struct compiler {
+    const char *expr;           /**< The expression */
+    const char *p;              /**< Next character read */
+    const char *start;          /**< Start of the current token */
+    int tok;                    /**< The current token, enum token */
+    int cmp;                    /**< The comparison of a T_CMP token */
+    char word[DFILTER_WORD];    /**< The word or string of the token */
+    size_t len;                 /**< Length of the word */
+    int nesting;                /**< Parentheses and negations open */
+    int error;                  /**< 1 once an error was printed */
+    struct dfilter *f;          /**< The filter built */
+    size_t cap;                 /**< Instructions allocated */
+};
+
+/**
+ * @brief Value of a field in a packet
+ */
+struct fvalue {
+    uint64_t num;           /**< The integer */
+    const uint8_t *addr;    /**< The address */
+    uint8_t version;        /**< 4 or 6 for an IP address */
+    const char *str;        /**< The string */
+    size_t len;             /**< Length of the string */
+};
+
+/**
+ * @brief State of a run of the program
+ *
+ * The fields read from the messages are kept for the next tests.
+ */
+struct match {
+    struct packet_info *pi;     /**< The decoded packet */
+    const u_char *packet;       /**< The packet */
+    int qname;                  /**< 1 if read, -1 if absent, 0 if not read yet */
+    char name[DNS_NAME_LEN];    /**< The first DNS question */
+    uint16_t qtype;             /**< Type of the first DNS question */
+    int ja3;                    /**< 1 if computed, -1 if absent, 0 if not computed yet */
+    char ja3_hash[MD5_LEN * 2 + 1]; /**< The JA3 or JA3S hash of the TLS hello */
+};
+
+
+/**
+ * @brief Print an error of the expression
+ *
+ * Only the first error is printed.
+ *
+ * @param c The compiler
+ * @param msg The error
+ */
+static void compile_error(struct compiler *c, const char *msg)
+{
+    if (c->error)
+        return;
+    c->error = 1;
+    fprintf(stderr, "Invalid display filter, %s at offset %d: %s\n", msg,
+            (int)(c->start - c->expr), c->start);
+}
+
+
+/**
+ * @brief Read the next token
+ *
+ * @param c The compiler
+ */
+static void next_token(struct compiler *c)
+{
+    while (isspace((unsigned char)*c->p))
+        c->p++;
+    c->start = c->p;
+    const char *p = c->p;
+    c->tok = T_ERROR;
+    switch (*p) {
+    case '\0':
+        c->tok = T_END;
+        return;
+    case '(':
+        c->tok = T_LPAREN;
+        c->p++;
+        return;
+    case ')':
+        c->tok = T_RPAREN;
+        c->p++;
+        return;
+    case '&':
+    case '|':
+        if (p[1] != p[0]) {
+            compile_error(c, "single & or |");
+            return;
+        }
+        c->tok = p[0] == '&' ? T_AND : T_OR;
+        c->p += 2;
+        return;
+    case '!':
+        if (p[1] == '=') {
+            c->tok = T_CMP;
+            c->cmp = CMP_NE;
+            c->p += 2;
+        } else {
+            c->tok = T_NOT;
+            c->p++;
+        }
+        return;
+    case '=':
+        c->tok = T_CMP;
+        c->cmp = CMP_EQ;
+        c->p += p[1] == '=' ? 2 : 1;
+        return;
+    case '<':
+    case '>':
+        c->tok = T_CMP;
+        if (p[1] == '=') {
+            c->cmp = p[0] == '<' ? CMP_LE : CMP_GE;
+            c->p += 2;
+        } else {
+            c->cmp = p[0] == '<' ? CMP_LT : CMP_GT;
+            c->p++;
+        }
+        return;
+    case '"':
+        c->len = 0;
+        for (p++; *p != '"'; p++) {
+            if (*p == '\0') {
+                compile_error(c, "unterminated string");
+                return;
+            }
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            if (c->len == DFILTER_WORD - 1) {
+                compile_error(c, "string too long");
+                return;
+            }
+            c->word[c->len++] = *p;
+        }
+        c->word[c->len] = '\0';
+        c->tok = T_STRING;
+        c->p = p + 1;
+        return;
+    }
+
+    c->len = 0;
+    while (*p && !isspace((unsigned char)*p) && !strchr("()!=<>&|\"", *p)) {
+        if (c->len == DFILTER_WORD - 1) {
+            compile_error(c, "word too long");
+            return;
+        }
+        c->word[c->len++] = *p++;
+    }
+    c->word[c->len] = '\0';
+    c->p = p;
+    c->tok = T_WORD;
+
+    static const struct {
+        const char *word;
+        int tok;
+        int cmp;
+    } keywords[] = {
+        {"and", T_AND, 0},        {"or", T_OR, 0},          {"not", T_NOT, 0},
+        {"eq", T_CMP, CMP_EQ},    {"ne", T_CMP, CMP_NE},    {"lt", T_CMP, CMP_LT},
+        {"le", T_CMP, CMP_LE},    {"gt", T_CMP, CMP_GT},    {"ge", T_CMP, CMP_GE},
+        {"contains", T_CMP, CMP_CONTAINS},
+    };
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        if (strcmp(c->word, keywords[i].word) == 0) {
+            c->tok = keywords[i].tok;
+            c->cmp = keywords[i].cmp;
+            return;
+        }
+    }
+}
+
+
+/**
+ * @brief Append an instruction to the program
+ *
+ * @param c The compiler
+ * @param op The operation, enum op
+ * @return struct insn* The instruction, NULL on error
+ */
+static struct insn *emit(struct compiler *c, int op)
+{
+    if (c->f->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 16;
+        struct insn *code = realloc(c->f->code, cap * sizeof(*code));
+        if (code == NULL) {
+            compile_error(c, "out of memory");
+            return NULL;
+        }
+        c->f->code = code;
+        c->cap = cap;
+    }
+    struct insn *in = &c->f->code[c->f->count++];
+    memset(in, 0, sizeof(*in));
+    in->op = op;
+    in->target = NO_JUMP;
+    return in;
+}
+
+
+/**
+ * @brief Parse the value compared to a field
+ *
+ * @param c The compiler, at the value
+ * @param in The test
+ * @return int 0 on success, -1 on error
+ */
+static int parse_value(struct compiler *c, struct insn *in)
+{
+    const struct field *fd = &fields[in->field];
+    if (c->tok != T_WORD && c->tok != T_STRING) {
+        compile_error(c, "expected a value");
+        return (-1);
+    }
+    switch (fd->type) {
+    case FT_UINT:
+    case FT_BOOL: {
+        char *end;
+        if (strcmp(c->word, "true") == 0 || strcmp(c->word, "false") == 0) {
+            in->num = c->word[0] == 't';
+            return 0;
+        }
+        in->num = strtoull(c->word, &end, 0);
+        if (c->len == 0 || *end != '\0' || c->word[0] == '-') {
+            compile_error(c, "expected a number");
+            return (-1);
+        }
+        return 0;
+    }
+    case FT_IP: {
+        char *slash = strchr(c->word, '/');
+        if (slash)
+            *slash = '\0';
+        if (inet_pton(AF_INET, c->word, in->addr) == 1) {
+            in->version = 4;
+        } else if (inet_pton(AF_INET6, c->word, in->addr) == 1) {
+            in->version = 6;
+        } else {
+            compile_error(c, "expected an IP address");
+            return (-1);
+        }
+        unsigned long prefix = in->version == 4 ? 32 : 128;
+        if (slash) {
+            char *end;
+            unsigned long bits = strtoul(slash + 1, &end, 10);
+            if (slash[1] == '\0' || *end != '\0' || bits > prefix) {
+                compile_error(c, "invalid prefix");
+                return (-1);
+            }
+            prefix = bits;
+        }
+        in->prefix = prefix;
+        return 0;
+    }
+    case FT_MAC: {
+        unsigned int b[6];
+        char sep[5];
+        int end = -1;
+        if (sscanf(c->word, "%2x%c%2x%c%2x%c%2x%c%2x%c%2x%n", &b[0], &sep[0],
+                   &b[1], &sep[1], &b[2], &sep[2], &b[3], &sep[3], &b[4],
+                   &sep[4], &b[5], &end) != 11 ||
+            end != (int)c->len || (sep[0] != ':' && sep[0] != '-')) {
+            compile_error(c, "expected a MAC address");
+            return (-1);
+        }
+        for (int i = 1; i < 5; i++) {
+            if (sep[i] != sep[0]) {
+                compile_error(c, "expected a MAC address");
+                return (-1);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            in->addr[i] = b[i];
+        return 0;
+    }
+    case FT_STR:
+        in->str = malloc(c->len + 1);
+        if (in->str == NULL) {
+            compile_error(c, "out of memory");
+            return (-1);
+        }
+        memcpy(in->str, c->word, c->len + 1);
+        in->len = c->len;
+        return 0;
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Parse a test of a field
+ *
+ * @param c The compiler, at the field
+ * @return int 0 on success, -1 on error
+ */
+static int parse_test(struct compiler *c)
+{
+    int id = -1;
+    for (int i = 0; i < F_COUNT; i++) {
+        if (strcmp(c->word, fields[i].name) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) {
+        compile_error(c, "unknown field");
+        return (-1);
+    }
+    struct insn *in = emit(c, OP_TEST);
+    if (in == NULL)
+        return (-1);
+    in->field = id;
+    next_token(c);
+    if (c->tok != T_CMP) {
+        in->cmp = CMP_EXISTS;
+        return 0;
+    }
+    in->cmp = c->cmp;
+
+    int type = fields[id].type;
+    if (type == FT_PROTO) {
+        compile_error(c, "a protocol can't be compared");
+        return (-1);
+    }
+    if ((type == FT_IP || type == FT_MAC || type == FT_BOOL) &&
+        in->cmp != CMP_EQ && in->cmp != CMP_NE) {
+        compile_error(c, "only == and != compare this field");
+        return (-1);
+    }
+    if (in->cmp == CMP_CONTAINS && type != FT_STR) {
+        compile_error(c, "contains only applies to strings");
+        return (-1);
+    }
+    if (type == FT_STR && in->cmp != CMP_EQ && in->cmp != CMP_NE &&
+        in->cmp != CMP_CONTAINS) {
+        compile_error(c, "only ==, != and contains compare strings");
+        return (-1);
+    }
+    next_token(c);
+    if (parse_value(c, in) < 0)
+        return (-1);
+    next_token(c);
+    return 0;
+}
+
+static int parse_or(struct compiler *c);
+
+
+/**
+ * @brief Parse a negation, a parenthesized expression or a test
+ *
+ * @param c The compiler
+ * @return int 0 on success, -1 on error
+ */
+static int parse_not(struct compiler *c)
+{
+    if (c->tok == T_NOT || c->tok == T_LPAREN) {
+        if (++c->nesting > DFILTER_NESTING) {
+            compile_error(c, "too deeply nested");
+            return (-1);
+        }
+        int ret;
+        if (c->tok == T_NOT) {
+            next_token(c);
+            ret = parse_not(c);
+            if (ret == 0 && emit(c, OP_NOT) == NULL)
+                ret = -1;
+        } else {
+            next_token(c);
+            ret = parse_or(c);
+            if (ret == 0 && c->tok != T_RPAREN) {
+                compile_error(c, "expected )");
+                ret = -1;
+            }
+            if (ret == 0)
+                next_token(c);
+        }
+        c->nesting--;
+        return ret;
+    }
+    if (c->tok != T_WORD) {
+        compile_error(c, "expected a field");
+        return (-1);
+    }
+    return parse_test(c);
+}
+
+
+/**
+ * @brief Parse operands of a binary operator
+ *
+ * Each operand but the last one is followed by a jump to the end of the
+ * operator, taken once the result is known.
+ *
+ * @param c The compiler
+ * @param tok The operator, T_AND or T_OR
+ * @param jump The jump, OP_JF or OP_JT
+ * @param operand The parser of an operand
+ * @return int 0 on success, -1 on error
+ */
+static int parse_binary(struct compiler *c, int tok, int jump,
+                        int (*operand)(struct compiler *))
+{
+    uint32_t jumps = NO_JUMP; // Chained through their targets
+    if (operand(c) < 0)
+        return (-1);
+    while (c->tok == tok) {
+        struct insn *in = emit(c, jump);
+        if (in == NULL)
+            return (-1);
+        in->target = jumps;
+        jumps = c->f->count - 1;
+        next_token(c);
+        if (operand(c) < 0)
+            return (-1);
+    }
+    while (jumps != NO_JUMP) {
+        uint32_t prev = c->f->code[jumps].target;
+        c->f->code[jumps].target = c->f->count;
+        jumps = prev;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Parse the operands of an "and"
+ *
+ * @param c The compiler
+ * @return int 0 on success, -1 on error
+ */
+static int parse_and(struct compiler *c)
+{
+    return parse_binary(c, T_AND, OP_JF, parse_not);
+}
+
+
+/**
+ * @brief Parse the operands of an "or"
+ *
+ * @param c The compiler
+ * @return int 0 on success, -1 on error
+ */
+static int parse_or(struct compiler *c)
+{
+    return parse_binary(c, T_OR, OP_JT, parse_and);
+}
+
+
+/**
+ * @brief Compile a display filter
+ *
+ * @param expr The expression
+ * @return struct dfilter* The compiled filter, NULL on error
+ *
+ * @see parse_or
+ */
+struct dfilter *dfilter_compile(const char *expr)
+{
+    struct compiler c;
+    memset(&c, 0, sizeof(c));
+    c.expr = c.p = c.start = expr;
+    c.f = calloc(1, sizeof(struct dfilter));
+    if (c.f == NULL) {
+        fprintf(stderr, "Error allocating the display filter\n");
+        return NULL;
+    }
+    next_token(&c);
+    if (c.tok == T_END)
+        compile_error(&c, "empty expression");
+    else if (parse_or(&c) == 0 && c.tok != T_END)
+        compile_error(&c, "expected and, or or the end");
+    if (c.error) {
+        dfilter_free(c.f);
+        return NULL;
+    }
+    return c.f;
+}
+
+
+/**
+ * @brief Get the first DNS question of the packet
+ *
+ * @param m The run
+ * @return int 0 if the packet has one, -1 otherwise
+ *
+ * @see dns_question
+ */
+static int match_qname(struct match *m)
+{
+    if (m->qname == 0) {
+        const u_char *msg = m->packet + m->pi->l7_off;
+        uint32_t len = m->pi->l7_len;
+        if (m->pi->layers & LAYER_TCP) { // Length of the message first
+            msg += 2;
+            len = len >= 2 ? len - 2 : 0;
+        }
+        m->qname = dns_question(msg, len, m->name, &m->qtype) == 0 ? 1 : -1;
+    }
+    return m->qname > 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Get the JA3 hash of the TLS hello of the packet
+ *
+ * @param m The run
+ * @return int 0 if the packet has a complete hello, -1 otherwise
+ *
+ * @see tls_ja3_hash
+ */
+static int match_ja3(struct match *m)
+{
+    if (m->ja3 == 0) {
+        struct tls_hello h;
+        uint32_t len;
+        const u_char *rec = tls_payload(m->pi, m->packet, &len);
+        m->ja3 = m->pi->u.tls.handshake && tls_parse_hello(rec, len, &h) == 0 &&
+                         tls_ja3_hash(&h, m->ja3_hash) == 0
+                     ? 1
+                     : -1;
+    }
+    return m->ja3 > 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Get the method of an HTTP request
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param v The value to set
+ * @return int 0 if the packet starts a request, -1 otherwise
+ */
+static int match_method(const struct packet_info *pi, const u_char *packet,
+                        struct fvalue *v)
+{
+    const char *p = (const char *)packet + pi->l7_off;
+    size_t n = 0;
+    while (n < pi->l7_len && n < 16 && p[n] >= 'A' && p[n] <= 'Z')
+        n++;
+    if (n == 0 || n == pi->l7_len || p[n] != ' ')
+        return (-1);
+    v->str = p;
+    v->len = n;
+    return 0;
+}
+
+
+/**
+ * @brief Get the Host header of an HTTP request
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param v The value to set
+ * @return int 0 if the packet has the header, -1 otherwise
+ */
+static int match_host(const struct packet_info *pi, const u_char *packet,
+                      struct fvalue *v)
+{
+    const char *p = (const char *)packet + pi->l7_off;
+    const char *end = p + pi->l7_len;
+    for (const char *line = p; line + 5 <= end;) {
+        const char *nl = memchr(line, '\n', end - line);
+        if (nl == NULL)
+            nl = end;
+        if (strncasecmp(line, "Host:", 5) == 0) {
+            const char *s = line + 5;
+            while (s < nl && (*s == ' ' || *s == '\t'))
+                s++;
+            const char *e = nl;
+            while (e > s && (e[-1] == '\r' || e[-1] == ' '))
+                e--;
+            v->str = s;
+            v->len = e - s;
+            return 0;
+        }
+        if (nl - line <= 1 || (nl - line == 2 && line[0] == '\r'))
+            break; // End of the headers
+        line = nl + 1;
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Get a field of the packet
+ *
+ * @param m The run
+ * @param id The field, enum field_id
+ * @param side 0 for the source, 1 for the destination of an either field
+ * @param v The value to set
+ * @return int 0 if the packet has the field, -1 otherwise
+ *
+ * @see match_qname
+ * @see match_ja3
+ * @see match_method
+ * @see match_host
+ */
+static int field_get(struct match *m, int id, int side, struct fvalue *v)
+{
+    const struct packet_info *pi = m->pi;
+    uint16_t layers = pi->layers;
+    int app = layers & (LAYER_APP | LAYER_PLUGIN) ? pi->app_proto : APP_NONE;
+
+    switch (id) {
+    case F_FRAME_LEN:
+        v->num = pi->len;
+        return 0;
+    case F_FRAME_CAPLEN:
+        v->num = pi->caplen;
+        return 0;
+    case F_ETH:
+        return layers & LAYER_ETH ? 0 : -1;
+    case F_ETH_SRC:
+    case F_ETH_DST:
+    case F_ETH_ADDR:
+        v->addr = id == F_ETH_DST || side ? pi->mac_dst : pi->mac_src;
+        return layers & LAYER_ETH ? 0 : -1;
+    case F_ETH_TYPE:
+        v->num = pi->ethertype;
+        return layers & LAYER_ETH ? 0 : -1;
+    case F_SLL:
+        return layers & LAYER_SLL ? 0 : -1;
+    case F_VLAN:
+        return pi->encap & ENCAP_VLAN ? 0 : -1;
+    case F_VLAN_ID:
+    case F_VLAN_PRIORITY: // Of the outer tag
+        v->num = id == F_VLAN_ID ? pi->vlan & 0x0fff : pi->vlan >> 13;
+        return pi->encap & ENCAP_VLAN ? 0 : -1;
+    case F_MPLS:
+        return pi->encap & ENCAP_MPLS ? 0 : -1;
+    case F_GRE:
+        return pi->encap & ENCAP_GRE ? 0 : -1;
+    case F_VXLAN:
+        return pi->encap & ENCAP_VXLAN ? 0 : -1;
+    case F_GENEVE:
+        return pi->encap & ENCAP_GENEVE ? 0 : -1;
+    case F_ARP:
+        return layers & LAYER_ARP ? 0 : -1;
+    case F_ARP_OPCODE:
+        v->num = pi->arp_opcode;
+        return layers & LAYER_ARP ? 0 : -1;
+    case F_ARP_SPA:
+    case F_ARP_TPA:
+        v->addr = id == F_ARP_SPA ? pi->u.arp.spa : pi->u.arp.tpa;
+        v->version = 4;
+        return layers & LAYER_ARP && pi->u.arp.ipv4 ? 0 : -1;
+    case F_IP:
+        return pi->ip_version ? 0 : -1;
+    case F_IP_VERSION:
+        v->num = pi->ip_version;
+        return pi->ip_version ? 0 : -1;
+    case F_IP_SRC:
+    case F_IP_DST:
+    case F_IP_ADDR:
+        v->addr = id == F_IP_DST || side ? pi->ip_dst : pi->ip_src;
+        v->version = pi->ip_version;
+        return pi->ip_version ? 0 : -1;
+    case F_IP_PROTO:
+        v->num = pi->ip_proto;
+        return pi->ip_version ? 0 : -1;
+    case F_IP_TTL:
+        v->num = pi->ip_ttl;
+        return pi->ip_version ? 0 : -1;
+    case F_IP_LEN:
+        v->num = pi->l3_len;
+        return pi->ip_version ? 0 : -1;
+    case F_IP_FRAGMENT:
+        return layers & LAYER_FRAG ? 0 : -1;
+    case F_IP_REASSEMBLED:
+        return layers & LAYER_DEFRAG ? 0 : -1;
+    case F_IP_FRAG_OFFSET:
+    case F_IP_MF: // 0 for a whole datagram
+        v->num = !(layers & LAYER_FRAG) ? 0
+                 : id == F_IP_MF        ? pi->frag_more
+                                        : pi->frag_offset;
+        return pi->ip_version ? 0 : -1;
+    case F_ICMP:
+        return layers & LAYER_ICMP ? 0 : -1;
+    case F_ICMPV6:
+        return layers & LAYER_ICMP6 ? 0 : -1;
+    case F_ICMP_TYPE:
+        v->num = pi->icmp_type;
+        return layers & (LAYER_ICMP | LAYER_ICMP6) ? 0 : -1;
+    case F_ICMP_CODE:
+        v->num = pi->icmp_code;
+        return layers & (LAYER_ICMP | LAYER_ICMP6) ? 0 : -1;
+    case F_TCP:
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_UDP:
+        return layers & LAYER_UDP ? 0 : -1;
+    case F_TCP_SRCPORT:
+    case F_TCP_DSTPORT:
+    case F_TCP_PORT:
+        v->num = id == F_TCP_DSTPORT || side ? pi->dport : pi->sport;
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_UDP_SRCPORT:
+    case F_UDP_DSTPORT:
+    case F_UDP_PORT:
+        v->num = id == F_UDP_DSTPORT || side ? pi->dport : pi->sport;
+        return layers & LAYER_UDP ? 0 : -1;
+    case F_TCP_FLAGS:
+        v->num = pi->tcp_flags;
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_TCP_FIN:
+    case F_TCP_SYN:
+    case F_TCP_RST:
+    case F_TCP_PSH:
+    case F_TCP_ACK: { // Same order as the bits
+        static const uint8_t bits[] = {0x01, 0x02, 0x04, 0x08, 0x10};
+        v->num = (pi->tcp_flags & bits[id - F_TCP_FIN]) != 0;
+        return layers & LAYER_TCP ? 0 : -1;
+    }
+    case F_TCP_SEQ:
+        v->num = pi->tcp_seq;
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_TCP_ACKNUM:
+        v->num = pi->tcp_ack;
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_TCP_LEN:
+        v->num = pi->l7_len;
+        return layers & LAYER_TCP ? 0 : -1;
+    case F_UDP_LEN:
+        v->num = pi->l7_len + 8;
+        return layers & LAYER_UDP ? 0 : -1;
+
+    case F_APP:
+        v->str = app_proto_name(app);
+        v->len = strlen(v->str);
+        return app != APP_NONE ? 0 : -1;
+    case F_DNS:
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_ID:
+        v->num = pi->u.dns.id;
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_RESPONSE:
+        v->num = (pi->u.dns.flags & DH_QR) != 0;
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_RCODE:
+        v->num = pi->u.dns.flags & DH_RCODE;
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_QUERIES:
+        v->num = pi->u.dns.questions;
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_ANSWERS:
+        v->num = pi->u.dns.answers;
+        return app == APP_DNS ? 0 : -1;
+    case F_DNS_QNAME:
+    case F_DNS_QTYPE:
+        if (app != APP_DNS || match_qname(m) < 0)
+            return (-1);
+        v->str = m->name;
+        v->len = strlen(m->name);
+        v->num = m->qtype;
+        return 0;
+    case F_BOOTP:
+        return app == APP_BOOTP ? 0 : -1;
+    case F_DHCP:
+        return app == APP_BOOTP && pi->u.bootp.dhcp ? 0 : -1;
+    case F_DHCP_TYPE:
+        v->num = pi->u.bootp.op;
+        return app == APP_BOOTP ? 0 : -1;
+    case F_DHCP_MSG_TYPE:
+        v->num = pi->u.bootp.msg_type;
+        return app == APP_BOOTP && pi->u.bootp.msg_type ? 0 : -1;
+    case F_HTTP:
+        return app == APP_HTTP ? 0 : -1;
+    case F_HTTP_METHOD:
+        return app == APP_HTTP ? match_method(pi, m->packet, v) : -1;
+    case F_HTTP_HOST:
+        return app == APP_HTTP ? match_host(pi, m->packet, v) : -1;
+    case F_TLS:
+    case F_TLS_VERSION:
+    case F_TLS_TYPE:
+        v->num = id == F_TLS_TYPE ? pi->u.tls.type : 0x0300 | pi->u.tls.version;
+        return (app == APP_HTTPS || app == APP_IMAPS) && pi->u.tls.type ? 0
+                                                                         : -1;
+    case F_TLS_HS_TYPE:
+    case F_TLS_HS_VERSION:
+        v->num = id == F_TLS_HS_TYPE ? pi->u.tls.handshake : pi->u.tls.hello_version;
+        return (app == APP_HTTPS || app == APP_IMAPS) && pi->u.tls.handshake ? 0
+                                                                              : -1;
+    case F_TLS_CIPHER:
+        v->num = pi->u.tls.cipher;
+        return (app == APP_HTTPS || app == APP_IMAPS) &&
+                       pi->u.tls.handshake == TLS_HS_SERVER_HELLO
+                   ? 0
+                   : -1;
+    case F_TLS_SNI:
+    case F_TLS_ALPN: {
+        uint32_t len;
+        const u_char *rec = tls_payload(pi, m->packet, &len);
+        v->str = (const char *)rec +
+                 (id == F_TLS_SNI ? pi->u.tls.sni_off : pi->u.tls.alpn_off);
+        v->len = id == F_TLS_SNI ? pi->u.tls.sni_len : pi->u.tls.alpn_len;
+        return (app == APP_HTTPS || app == APP_IMAPS) && pi->u.tls.handshake &&
+                       v->len > 0
+                   ? 0
+                   : -1;
+    }
+    case F_TLS_JA3:
+    case F_TLS_JA3S:
+        if ((app != APP_HTTPS && app != APP_IMAPS) ||
+            pi->u.tls.handshake != (id == F_TLS_JA3 ? TLS_HS_CLIENT_HELLO
+                                                    : TLS_HS_SERVER_HELLO) ||
+            match_ja3(m) < 0)
+            return (-1);
+        v->str = m->ja3_hash;
+        v->len = MD5_LEN * 2;
+        return 0;
+    case F_SMTP:
+        return app == APP_SMTP ? 0 : -1;
+    case F_FTP:
+        return app == APP_FTP ? 0 : -1;
+    case F_POP:
+        return app == APP_POP ? 0 : -1;
+    case F_IMAP:
+        return app == APP_IMAP || app == APP_IMAPS ? 0 : -1;
+    case F_TELNET:
+        return app == APP_TELNET ? 0 : -1;
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Search a string in another, ignoring the case or not
+ *
+ * @param s The string searched
+ * @param len The length of s
+ * @param needle The string to find
+ * @param nlen The length of needle
+ * @param nocase 1 to ignore the case
+ * @return int 1 if found, 0 otherwise
+ */
+static int str_contains(const char *s, size_t len, const char *needle,
+                        size_t nlen, int nocase)
+{
+    for (size_t i = 0; i + nlen <= len; i++) {
+        if (nocase ? strncasecmp(s + i, needle, nlen) == 0
+                   : memcmp(s + i, needle, nlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Compare a value of the packet to the one of a test
+ *
+ * @param in The test
+ * @param cmp The comparison, CMP_NE is done as CMP_EQ
+ * @param v The value of the packet
+ * @return int 1 if true, 0 otherwise
+ */
+static int compare(const struct insn *in, int cmp, const struct fvalue *v)
+{
+    const struct field *fd = &fields[in->field];
+    switch (fd->type) {
+    case FT_UINT:
+    case FT_BOOL:
+        switch (cmp) {
+        case CMP_EQ:
+            return v->num == in->num;
+        case CMP_LT:
+            return v->num < in->num;
+        case CMP_LE:
+            return v->num <= in->num;
+        case CMP_GT:
+            return v->num > in->num;
+        case CMP_GE:
+            return v->num >= in->num;
+        }
+        return 0;
+    case FT_IP: {
+        if (v->version != in->version)
+            return 0;
+        int bytes = in->prefix / 8, bits = in->prefix % 8;
+        if (memcmp(v->addr, in->addr, bytes) != 0)
+            return 0;
+        uint8_t mask = (uint8_t)(0xFF << (8 - bits));
+        return bits == 0 || ((v->addr[bytes] ^ in->addr[bytes]) & mask) == 0;
+    }
+    case FT_MAC:
+        return memcmp(v->addr, in->addr, 6) == 0;
+    case FT_STR:
+        if (cmp == CMP_CONTAINS)
+            return str_contains(v->str, v->len, in->str, in->len, fd->nocase);
+        return v->len == in->len &&
+               (fd->nocase ? strncasecmp(v->str, in->str, in->len) == 0
+                           : memcmp(v->str, in->str, in->len) == 0);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Run a test on the packet
+ *
+ * The application protocol is decoded first if the field belongs to it.
+ *
+ * @param m The run
+ * @param in The test
+ * @return int 1 if true, 0 otherwise
+ *
+ * @see decode_app
+ * @see field_get
+ * @see compare
+ */
+static int run_test(struct match *m, const struct insn *in)
+{
+    const struct field *fd = &fields[in->field];
+    if (fd->app && m->pi->depth < DECODE_APP)
+        decode_app(m->pi, m->packet);
+
+    int present = 0;
+    for (int side = 0; side <= fd->either; side++) {
+        struct fvalue v;
+        memset(&v, 0, sizeof(v));
+        if (field_get(m, in->field, side, &v) < 0)
+            continue;
+        present = 1;
+        if (in->cmp == CMP_EXISTS)
+            return fd->type == FT_BOOL ? v.num != 0 : 1;
+        if (compare(in, in->cmp == CMP_NE ? CMP_EQ : in->cmp, &v))
+            return in->cmp != CMP_NE;
+    }
+    return in->cmp == CMP_NE && present;
+}
+
+
+/**
+ * @brief Run a display filter on a decoded packet
+ *
+ * @param f The filter
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 1 if the packet matches, 0 otherwise
+ *
+ * @see run_test
+ */
+int dfilter_match(const struct dfilter *f, struct packet_info *pi,
+                  const u_char *packet)
+{
+    struct match m;
+    m.pi = pi;
+    m.packet = packet;
+    m.qname = 0;
+    m.ja3 = 0;
+    int result = 0;
+    for (size_t pc = 0; pc < f->count;) {
+        const struct insn *in = &f->code[pc];
+        switch (in->op) {
+        case OP_TEST:
+            result = run_test(&m, in);
+            break;
+        case OP_NOT:
+            result = !result;
+            break;
+        case OP_JF:
+            if (!result) {
+                pc = in->target;
+                continue;
+            }
+            break;
+        case OP_JT:
+            if (result) {
+                pc = in->target;
+                continue;
+            }
+            break;
+        }
+        pc++;
+    }
+    return result;
+}
+
+
+/**
+ * @brief Free a display filter
+ *
+ * @param f The filter, NULL does nothing
+ */
+void dfilter_free(struct dfilter *f)
+{
+    if (f == NULL)
+        return;
+    for (size_t i = 0; i < f->count; i++)
+        free(f->code[i].str);
+    free(f->code);
+    free(f);
+}
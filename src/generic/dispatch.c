@@ -0,0 +1,477 @@
+/**
+ * @author Flavien Lallemant
+ * @file dispatch.c
+ * @brief Application protocol dispatch definition
+ *
+ * This file contains the definition of the port tables and of the
+ * application dissectors they point to.
+ * Each transport has a table indexed by the port number, so finding the
+ * dissector of a packet costs two array lookups.
+ * The payloads of the TCP ports no protocol is mapped on go to the payload
+ * classifier, so the text protocols are also found on other ports, then to
+ * the match functions of the plugin dissectors, over TCP and UDP.
+ *
+ * @see dispatch.h
+ * @see dispatch_add
+ * @see dispatch_register
+ * @see dispatch_guess
+ * @see dispatch_classify_len
+ * @see dispatch_port
+ * @see dispatch_app
+ * @see dispatch_stream
+ */
+
+// Global libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Local header files
+#include "bootp.h"
+#include "classify.h"
+#include "dispatch.h"
+#include "dns.h"
+#include "ftp.h"
+#include "http.h"
+#include "perf.h"
+#include "pop.h"
+#include "smtp.h"
+#include "tls.h"
+
+/**
+ * @brief Application dissector
+ *
+ * The decode function returns 0 if the payload belongs to the protocol,
+ * -1 otherwise.
+ * It gets its own copy of the view, so it can move it freely.
+ */
+struct dissector {
+    uint8_t transports; /**< Transports the protocol runs on, DISPATCH_* flags */
+    uint8_t stream; /**< 1 if every byte of a stream belongs to the protocol */
+    uint16_t classify_len; /**< Payload bytes needed to recognize the protocol */
+    int (*decode)(struct packet_view *v, struct packet_info *pi);
+    int (*match)(const u_char *payload, uint32_t len); /**< Recognize the payload of an unmapped port, plugins only */
+};
+
+/**
+ * @brief Default port mapping
+ */
+struct port_mapping {
+    uint8_t transports;
+    uint16_t port;
+    uint8_t app;
+};
+
+static uint8_t tcp_ports[65536]; /**< Application protocol of each TCP port */
+static uint8_t udp_ports[65536]; /**< Application protocol of each UDP port */
+static int guess = 1; /**< 1 to classify the payloads of the unmapped TCP ports */
+
+
+/**
+ * @brief Recognize an HTTP payload
+ */
+static int decode_http(struct packet_view *v, struct packet_info *pi)
+{
+    (void)pi;
+    return is_http(v->ptr, v->remaining) ? 0 : -1;
+}
+
+
+/**
+ * @brief Recognize an SMTP payload
+ */
+static int decode_smtp(struct packet_view *v, struct packet_info *pi)
+{
+    (void)pi;
+    return is_smtp(v->ptr, v->remaining) ? 0 : -1;
+}
+
+
+/**
+ * @brief Recognize an FTP payload
+ */
+static int decode_ftp(struct packet_view *v, struct packet_info *pi)
+{
+    (void)pi;
+    return is_ftp(v->ptr, v->remaining) ? 0 : -1;
+}
+
+
+/**
+ * @brief Recognize a POP3 payload
+ */
+static int decode_pop(struct packet_view *v, struct packet_info *pi)
+{
+    (void)pi;
+    return is_pop(v->ptr, v->remaining) ? 0 : -1;
+}
+
+
+
+
+/**
+ * @brief Decode a DNS payload
+ */
+static int decode_dns(struct packet_view *v, struct packet_info *pi)
+{
+    cast_dns(v, pi);
+    return 0;
+}
+
+
+/**
+ * @brief Decode a BOOTP payload
+ */
+static int decode_bootp(struct packet_view *v, struct packet_info *pi)
+{
+    cast_bootp(v, pi);
+    return 0;
+}
+
+
+/**
+ * @brief Accept any payload
+ *
+ * Used by the protocols only printed as text.
+ */
+static int decode_any(struct packet_view *v, struct packet_info *pi)
+{
+    (void)v;
+    (void)pi;
+    return 0;
+}
+
+
+static struct dissector dissectors[APP_COUNT] = {
+    [APP_HTTP] = {DISPATCH_TCP, 1, CLASSIFY_LEN, decode_http},
+    [APP_HTTPS] = {DISPATCH_TCP, 0, 5, cast_tls},
+    [APP_SMTP] = {DISPATCH_TCP, 1, CLASSIFY_LEN, decode_smtp},
+    [APP_FTP] = {DISPATCH_TCP, 1, CLASSIFY_LEN, decode_ftp},
+    [APP_DNS] = {DISPATCH_TCP | DISPATCH_UDP, 0, 12, decode_dns},
+    [APP_POP] = {DISPATCH_TCP, 1, CLASSIFY_LEN, decode_pop},
+    [APP_IMAP] = {DISPATCH_TCP, 1, 0, decode_any},
+    [APP_IMAPS] = {DISPATCH_TCP, 0, 5, cast_tls},
+    [APP_TELNET] = {DISPATCH_TCP, 1, 0, decode_any},
+    [APP_BOOTP] = {DISPATCH_UDP, 0, 243, decode_bootp}, // Up to the first option
+}; /**< Dissector of each application protocol */
+
+static const struct port_mapping default_mappings[] = {
+    {DISPATCH_TCP, 80, APP_HTTP},
+    {DISPATCH_TCP, 443, APP_HTTPS},
+    {DISPATCH_TCP, 25, APP_SMTP},
+    {DISPATCH_TCP, 20, APP_FTP},
+    {DISPATCH_TCP, 21, APP_FTP},
+    {DISPATCH_TCP | DISPATCH_UDP, 53, APP_DNS},
+    {DISPATCH_TCP, 110, APP_POP},
+    {DISPATCH_TCP, 143, APP_IMAP},
+    {DISPATCH_TCP, 993, APP_IMAPS},
+    {DISPATCH_TCP, 23, APP_TELNET},
+    {DISPATCH_UDP, 67, APP_BOOTP},
+    {DISPATCH_UDP, 68, APP_BOOTP},
+}; /**< Well known ports */
+
+
+/**
+ * @brief Load the default port mappings
+ */
+void dispatch_init(void)
+{
+    classify_init();
+    memset(tcp_ports, APP_NONE, sizeof(tcp_ports));
+    memset(udp_ports, APP_NONE, sizeof(udp_ports));
+    for (size_t i = 0; i < sizeof(default_mappings) / sizeof(default_mappings[0]);
+         i++) {
+        const struct port_mapping *m = &default_mappings[i];
+        dispatch_register(m->transports, m->port, m->port, m->app);
+    }
+}
+
+
+/**
+ * @brief Add the dissector of a plugin protocol
+ *
+ * @param app The application protocol, from APP_PLUGIN
+ * @param transports The transports the protocol runs on, DISPATCH_* flags
+ * @param match The function recognizing a payload on an unmapped port, NULL
+ * for none
+ * @param match_len The payload bytes match needs
+ * @param decode The dissector
+ */
+void dispatch_add(uint8_t app, int transports,
+                  int (*match)(const u_char *payload, uint32_t len),
+                  uint16_t match_len,
+                  int (*decode)(struct packet_view *v, struct packet_info *pi))
+{
+    if (app < APP_PLUGIN || app >= APP_COUNT)
+        return;
+    dissectors[app] = (struct dissector){transports, 0, match_len, decode,
+                                         match};
+}
+
+
+/**
+ * @brief Recognize the payload of an unmapped port with the plugins
+ *
+ * @param transport The transport of the packet, DISPATCH_TCP or DISPATCH_UDP
+ * @param payload The view of the application payload
+ * @param pi The decoded packet
+ * @return int 0 if a plugin decoded the payload, -1 otherwise
+ */
+static int match_plugins(int transport, const struct packet_view *payload,
+                         struct packet_info *pi)
+{
+    for (int app = APP_PLUGIN; app < APP_COUNT; app++) {
+        const struct dissector *d = &dissectors[app];
+        if (d->match == NULL || !(d->transports & transport) ||
+            !d->match(payload->ptr, payload->remaining))
+            continue;
+        struct packet_view v = *payload;
+        uint64_t start = perf_begin(PERF_APP + app);
+        int ret = d->decode(&v, pi);
+        perf_end(PERF_APP + app, start);
+        if (ret == 0) {
+            pi->app_proto = app;
+            pi->layers |= LAYER_APP | LAYER_PLUGIN;
+            return 0;
+        }
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Map a range of ports to an application protocol
+ *
+ * @param transports The transports of the ports, DISPATCH_* flags
+ * @param first The first port of the range
+ * @param last The last port of the range
+ * @param app The application protocol, APP_NONE to remove the mapping
+ * @return int 0 on success, -1 if the protocol can't run on the transports
+ */
+int dispatch_register(int transports, uint16_t first, uint16_t last,
+                      uint8_t app)
+{
+    if (app >= APP_COUNT ||
+        (app != APP_NONE && (transports & ~dissectors[app].transports)))
+        return (-1);
+
+    for (uint32_t port = first; port <= last; port++) {
+        if (transports & DISPATCH_TCP)
+            tcp_ports[port] = app;
+        if (transports & DISPATCH_UDP)
+            udp_ports[port] = app;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Parse and register a port mapping
+ *
+ * The mapping is written proto:port[-port][/tcp|/udp], e.g. http:8080/tcp.
+ * Without a transport, the ports are mapped on every transport the protocol
+ * can run on.
+ *
+ * @param spec The mapping
+ * @return int 0 on success, -1 on error
+ */
+int dispatch_parse(const char *spec)
+{
+    const char *colon = strchr(spec, ':');
+    if (colon == NULL) {
+        fprintf(stderr, "Bad port mapping %s, expected proto:port[/tcp|/udp]\n",
+                spec);
+        return (-1);
+    }
+
+    int app = -1;
+    for (int i = 0; i < APP_COUNT; i++) {
+        if (i >= APP_PLUGIN && dissectors[i].decode == NULL)
+            break; // The plugin protocols are given in order
+        const char *name = app_proto_name(i);
+        if (strlen(name) == (size_t)(colon - spec) &&
+            strncasecmp(spec, name, colon - spec) == 0) {
+            app = i;
+            break;
+        }
+    }
+    if (app < 0 && colon - spec == 3 && strncasecmp(spec, "pop", 3) == 0)
+        app = APP_POP;
+    if (app < 0) {
+        fprintf(stderr, "Unknown protocol in port mapping %s\n", spec);
+        return (-1);
+    }
+
+    char *end;
+    long first = strtol(colon + 1, &end, 10);
+    long last = first;
+    if (*end == '-')
+        last = strtol(end + 1, &end, 10);
+    if (end == colon + 1 || first < 0 || last > 65535 || first > last) {
+        fprintf(stderr, "Bad port in port mapping %s\n", spec);
+        return (-1);
+    }
+
+    int transports = app == APP_NONE ? DISPATCH_TCP | DISPATCH_UDP
+                                     : dissectors[app].transports;
+    if (strcasecmp(end, "/tcp") == 0) {
+        transports = DISPATCH_TCP;
+    } else if (strcasecmp(end, "/udp") == 0) {
+        transports = DISPATCH_UDP;
+    } else if (*end != '\0') {
+        fprintf(stderr, "Bad transport in port mapping %s\n", spec);
+        return (-1);
+    }
+
+    if (dispatch_register(transports, first, last, app) < 0) {
+        fprintf(stderr, "%s can't be decoded over %s\n", app_proto_name(app),
+                transports == DISPATCH_TCP ? "TCP" : "UDP");
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Enable or disable the payload classification of unmapped ports
+ *
+ * @param enable 1 to classify the payloads of the unmapped TCP ports, 0 to
+ * rely on the ports only
+ */
+void dispatch_guess(int enable)
+{
+    guess = enable;
+}
+
+
+/**
+ * @brief Get the payload bytes needed to recognize the mapped protocols
+ *
+ * @param transport The transport, DISPATCH_TCP or DISPATCH_UDP
+ * @return int The largest number of bytes needed by a protocol mapped on a
+ * port of the transport
+ */
+int dispatch_classify_len(int transport)
+{
+    const uint8_t *ports = transport == DISPATCH_TCP ? tcp_ports : udp_ports;
+    uint8_t mapped[APP_COUNT] = {0};
+    for (uint32_t port = 0; port < 65536; port++)
+        mapped[ports[port]] = 1;
+
+    int len = 0;
+    for (int i = APP_NONE + 1; i < APP_COUNT; i++) {
+        if (mapped[i] && dissectors[i].classify_len > len)
+            len = dissectors[i].classify_len;
+    }
+    if (guess && transport == DISPATCH_TCP && len < CLASSIFY_LEN)
+        len = CLASSIFY_LEN;
+    for (int i = APP_PLUGIN; guess && i < APP_COUNT; i++) {
+        if (dissectors[i].match && (dissectors[i].transports & transport) &&
+            dissectors[i].classify_len > len)
+            len = dissectors[i].classify_len;
+    }
+    return len;
+}
+
+
+/**
+ * @brief Get the application protocol mapped on the ports of a packet
+ *
+ * The protocol mapped on the lowest port wins, as in dispatch_app(); the
+ * payload is not looked at.
+ *
+ * @param transport The transport, DISPATCH_TCP or DISPATCH_UDP
+ * @param sport The first port
+ * @param dport The second port
+ * @return uint8_t The application protocol, APP_NONE if none is mapped
+ */
+uint8_t dispatch_port(int transport, uint16_t sport, uint16_t dport)
+{
+    const uint8_t *ports = transport == DISPATCH_TCP ? tcp_ports : udp_ports;
+    uint16_t low = sport < dport ? sport : dport;
+    uint16_t high = sport < dport ? dport : sport;
+    return ports[low] != APP_NONE ? ports[low] : ports[high];
+}
+
+
+/**
+ * @brief Find and decode the application protocol of a packet
+ *
+ * The protocol mapped on the lowest port is tried first, then the one mapped
+ * on the other port.
+ * When no protocol is mapped on the TCP ports, the payload classifier is
+ * asked instead and its answer kept if only one protocol matches; then, over
+ * TCP and UDP, the match functions of the plugins.
+ * On success, pi->app_proto and the LAYER_APP flag are set.
+ *
+ * @param transport The transport of the packet, DISPATCH_TCP or DISPATCH_UDP
+ * @param payload The view of the application payload
+ * @param pi The decoded packet, with the ports already set
+ * @return int 0 if a protocol is recognized, -1 otherwise
+ */
+int dispatch_app(int transport, const struct packet_view *payload,
+                 struct packet_info *pi)
+{
+    const uint8_t *ports = transport == DISPATCH_TCP ? tcp_ports : udp_ports;
+    uint16_t low = pi->sport < pi->dport ? pi->sport : pi->dport;
+    uint16_t high = pi->sport < pi->dport ? pi->dport : pi->sport;
+    uint8_t apps[2] = {ports[low], ports[high]};
+
+    for (int i = 0; i < 2; i++) {
+        if (apps[i] == APP_NONE || (i == 1 && apps[1] == apps[0]))
+            continue;
+        struct packet_view v = *payload;
+        uint64_t start = perf_begin(PERF_APP + apps[i]);
+        int ret = dissectors[apps[i]].decode(&v, pi);
+        perf_end(PERF_APP + apps[i], start);
+        if (ret == 0) {
+            pi->app_proto = apps[i];
+            pi->layers |= apps[i] >= APP_PLUGIN ? LAYER_APP | LAYER_PLUGIN
+                                                : LAYER_APP;
+            return 0;
+        }
+    }
+
+    if (!guess || apps[0] != APP_NONE || apps[1] != APP_NONE)
+        return (-1);
+    if (transport == DISPATCH_TCP) {
+        uint16_t mask = classify_payload(payload->ptr, payload->remaining);
+        if (mask != 0 && (mask & (mask - 1)) == 0) { // Neither none nor ambiguous
+            pi->app_proto = __builtin_ctz(mask);
+            pi->layers |= LAYER_APP;
+            return 0;
+        }
+    }
+    return match_plugins(transport, payload, pi);
+}
+
+
+/**
+ * @brief Decode reassembled bytes with the protocol already found for their
+ * stream
+ *
+ * The bytes of a text protocol keep its label even when they don't start
+ * with a command, e.g. the body of an HTTP response.
+ * On success, pi->app_proto and the LAYER_APP flag are set.
+ *
+ * @param payload The view of the bytes
+ * @param app The application protocol of the stream
+ * @param pi The decoded packet
+ * @return int 0 if the bytes belong to the protocol, -1 otherwise
+ */
+int dispatch_stream(const struct packet_view *payload, uint8_t app,
+                    struct packet_info *pi)
+{
+    if (app == APP_NONE || app >= APP_COUNT)
+        return (-1);
+    struct packet_view v = *payload;
+    uint64_t start = perf_begin(PERF_APP + app);
+    int ret = dissectors[app].decode(&v, pi);
+    perf_end(PERF_APP + app, start);
+    if (ret < 0 && !dissectors[app].stream)
+        return (-1);
+    pi->app_proto = app;
+    pi->layers |= app >= APP_PLUGIN ? LAYER_APP | LAYER_PLUGIN : LAYER_APP;
+    return 0;
+}
@@ -0,0 +1,407 @@
+/**
+ * @author Flavien Lallemant
+ * @file dissector.c
+ * @brief Dissector registry definition
+ *
+ * This file contains the definition of the ethertype and IP protocol tables
+ * and of the plugin loader.
+ * The tables hold the index of a handler, so the 65536 ethertypes take one
+ * byte each; the built-in handlers are set at compile time and need no
+ * initialization. A plugin dissector over a port goes to the port tables of
+ * dispatch.c instead.
+ * The state of the flows is kept per thread, in a table of DISSECTOR_FLOWS
+ * slots per plugin indexed by the flow hash, so the decoding workers need no
+ * lock: the pipeline sends every packet of a flow to the same one.
+ *
+ * @see dissector.h
+ * @see dissector_ethertype
+ * @see dissector_ip
+ * @see dissector_register
+ * @see dissector_load
+ * @see dissector_state
+ * @see dissector_print
+ */
+
+// Global libraries
+#include <dlfcn.h>
+#include <net/ethernet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local header files
+#include "arp.h"
+#include "dispatch.h"
+#include "dissector.h"
+#include "flow.h"
+#include "icmp.h"
+#include "icmpv6.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "perf.h"
+#include "tcp.h"
+#include "udp.h"
+
+#define HANDLERS 32 /**< Largest number of handlers, built-in ones included */
+
+/**
+ * @brief Handler of the payload of a layer
+ */
+struct handler {
+    dissector_fn decode;    /**< The dissector */
+    uint8_t app;            /**< The protocol of a plugin dissector, APP_NONE for a built-in one */
+};
+
+/**
+ * @brief Built-in handlers
+ */
+enum {
+    H_NONE,     /**< No dissector */
+    H_IPV4,
+    H_IPV6,
+    H_ARP,
+    H_TCP,
+    H_UDP,
+    H_ICMP,
+    H_ICMP6,
+    H_6IN4,     /**< IPv6 over IPv4 */
+    H_BUILTIN   /**< The first handler of a plugin */
+};
+
+/**
+ * @brief Slot of the state of a flow, followed by the state
+ */
+struct flow_slot {
+    struct flow_key key;    /**< The flow */
+    uint8_t used;           /**< 1 once the slot holds a flow */
+} __attribute__((aligned(8)));
+
+static int decode_none(struct packet_view *v, struct packet_info *pi);
+static int decode_6in4(struct packet_view *v, struct packet_info *pi);
+
+static struct handler handlers[HANDLERS] = {
+    [H_NONE] = {decode_none, APP_NONE},
+    [H_IPV4] = {cast_ipv4, APP_NONE},
+    [H_IPV6] = {cast_ipv6, APP_NONE},
+    [H_ARP] = {cast_arp, APP_NONE},
+    [H_TCP] = {cast_tcp, APP_NONE},
+    [H_UDP] = {cast_udp, APP_NONE},
+    [H_ICMP] = {cast_icmp, APP_NONE},
+    [H_ICMP6] = {cast_icmp6, APP_NONE},
+    [H_6IN4] = {decode_6in4, APP_NONE},
+}; /**< Handlers the tables point to */
+static int handler_count = H_BUILTIN; /**< Handlers in use */
+
+static uint8_t ethertypes[65536] = {
+    [ETHERTYPE_IP] = H_IPV4,
+    [ETHERTYPE_IPV6] = H_IPV6,
+    [ETHERTYPE_ARP] = H_ARP,
+}; /**< Handler of each ethertype */
+static uint8_t ip4_protos[256] = {
+    [IPPROTO_TCP] = H_TCP,
+    [IPPROTO_UDP] = H_UDP,
+    [IPPROTO_ICMP] = H_ICMP,
+    [IPPROTO_IPV6] = H_6IN4,
+}; /**< Handler of each IPv4 protocol */
+static uint8_t ip6_protos[256] = {
+    [IPPROTO_TCP] = H_TCP,
+    [IPPROTO_UDP] = H_UDP,
+    [IPPROTO_ICMPV6] = H_ICMP6,
+}; /**< Handler of each IPv6 next header */
+
+static const struct dissector_plugin *plugins[APP_PLUGINS]; /**< Dissector of each plugin protocol */
+static int plugin_count = 0; /**< Plugin protocols registered */
+static void *libraries[APP_PLUGINS]; /**< The plugins loaded */
+static int library_count = 0; /**< Number of plugins loaded */
+static __thread unsigned char *states[APP_PLUGINS]; /**< Flow states of each plugin, of the calling thread */
+
+
+/**
+ * @brief Reject a payload no dissector is registered for
+ */
+static int decode_none(struct packet_view *v, struct packet_info *pi)
+{
+    (void)v;
+    (void)pi;
+    return (-1);
+}
+
+
+/**
+ * @brief Decode an IPv6 packet carried by IPv4
+ */
+static int decode_6in4(struct packet_view *v, struct packet_info *pi)
+{
+    pi->l3_off = pi->l4_off;
+    return cast_ipv6(v, pi);
+}
+
+
+/**
+ * @brief Run the handler of a payload
+ *
+ * On success, a plugin dissector sets its protocol and the LAYER_PLUGIN flag.
+ *
+ * @param h The handler
+ * @param v The view of the payload
+ * @param pi The decoded packet to fill
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+static inline int handler_run(const struct handler *h, struct packet_view *v,
+                              struct packet_info *pi)
+{
+    if (__builtin_expect(h->app == APP_NONE, 1))
+        return h->decode(v, pi);
+    uint64_t start = perf_begin(PERF_APP + h->app);
+    int ret = h->decode(v, pi);
+    perf_end(PERF_APP + h->app, start);
+    if (ret == 0) {
+        pi->app_proto = h->app;
+        pi->layers |= LAYER_PLUGIN;
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Hand the payload of an Ethernet frame to its dissector
+ *
+ * @param v The view of the packet, past the Ethernet header
+ * @param pi The decoded packet, with its ethertype set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+int dissector_ethertype(struct packet_view *v, struct packet_info *pi)
+{
+    return handler_run(&handlers[ethertypes[pi->ethertype]], v, pi);
+}
+
+
+/**
+ * @brief Hand the payload of an IP packet to its dissector
+ *
+ * @param v The view of the packet, limited to the IP payload
+ * @param pi The decoded packet, with its IP version and protocol set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ */
+int dissector_ip(struct packet_view *v, struct packet_info *pi)
+{
+    const uint8_t *protos = pi->ip_version == 6 ? ip6_protos : ip4_protos;
+    return handler_run(&handlers[protos[pi->ip_proto]], v, pi);
+}
+
+
+/**
+ * @brief Register a plugin dissector
+ *
+ * A key already taken is taken over. The dissector must stay valid until
+ * dissector_close().
+ *
+ * @param d The dissector
+ * @return int The application protocol given to the dissector, -1 on error
+ *
+ * @see dispatch_add
+ * @see dispatch_register
+ */
+int dissector_register(const struct dissector_plugin *d)
+{
+    if (d->name == NULL || d->decode == NULL || d->key_count < 0 ||
+        d->key_count > DISSECTOR_KEYS ||
+        (d->key_count == 0 && d->match == NULL)) {
+        fprintf(stderr, "Invalid dissector %s\n", d->name ? d->name : "");
+        return (-1);
+    }
+    if (plugin_count == APP_PLUGINS) {
+        fprintf(stderr, "No room for the dissector %s, %d at most\n", d->name,
+                APP_PLUGINS);
+        return (-1);
+    }
+    uint8_t app = APP_PLUGIN + plugin_count;
+
+    switch (d->layer) {
+    case DISSECTOR_ETHERTYPE:
+    case DISSECTOR_IPPROTO:
+        if (handler_count == HANDLERS || d->key_count == 0) {
+            fprintf(stderr, "Invalid dissector %s\n", d->name);
+            return (-1);
+        }
+        for (int i = 0; i < d->key_count; i++) {
+            if (d->layer == DISSECTOR_IPPROTO && d->keys[i] > 255) {
+                fprintf(stderr, "Invalid IP protocol %u of the dissector %s\n",
+                        d->keys[i], d->name);
+                return (-1);
+            }
+        }
+        handlers[handler_count] = (struct handler){d->decode, app};
+        for (int i = 0; i < d->key_count; i++) {
+            if (d->layer == DISSECTOR_ETHERTYPE) {
+                ethertypes[d->keys[i]] = handler_count;
+            } else {
+                ip4_protos[d->keys[i]] = handler_count;
+                ip6_protos[d->keys[i]] = handler_count;
+            }
+        }
+        handler_count++;
+        break;
+    case DISSECTOR_TCP:
+    case DISSECTOR_UDP: {
+        int transport = d->layer == DISSECTOR_TCP ? DISPATCH_TCP : DISPATCH_UDP;
+        dispatch_add(app, transport, d->match, d->match_len, d->decode);
+        for (int i = 0; i < d->key_count; i++)
+            dispatch_register(transport, d->keys[i], d->keys[i], app);
+        break;
+    }
+    default:
+        fprintf(stderr, "Invalid layer %d of the dissector %s\n", d->layer,
+                d->name);
+        return (-1);
+    }
+    plugins[plugin_count++] = d;
+    return app;
+}
+
+
+/**
+ * @brief Load a plugin
+ *
+ * @param path The shared object
+ * @return int 0 on success, -1 on error
+ */
+int dissector_load(const char *path)
+{
+    if (library_count == APP_PLUGINS) {
+        fprintf(stderr, "Too many plugins, %d at most\n", APP_PLUGINS);
+        return (-1);
+    }
+    void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        fprintf(stderr, "Error loading the plugin %s: %s\n", path, dlerror());
+        return (-1);
+    }
+    dissector_init_fn init;
+    *(void **)&init = dlsym(lib, DISSECTOR_INIT);
+    if (init == NULL) {
+        fprintf(stderr, "The plugin %s doesn't export %s()\n", path,
+                DISSECTOR_INIT);
+        dlclose(lib);
+        return (-1);
+    }
+    libraries[library_count++] = lib; // Its dissectors may be registered
+    if (init(DISSECTOR_ABI) < 0) {
+        fprintf(stderr, "The plugin %s can't be used\n", path);
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Get the plugin dissector of an application protocol
+ *
+ * @param app The application protocol
+ * @return const struct dissector_plugin* The dissector, NULL if not a plugin one
+ */
+const struct dissector_plugin *dissector_plugin(uint8_t app)
+{
+    if (app < APP_PLUGIN || app >= APP_PLUGIN + plugin_count)
+        return NULL;
+    return plugins[app - APP_PLUGIN];
+}
+
+
+/**
+ * @brief Get the state a plugin dissector keeps for the flow of a packet
+ *
+ * @param d The dissector
+ * @param pi The decoded packet, with its IP layer
+ * @return void* state_size bytes, NULL without IP layer or state
+ *
+ * @see flow_key_pi
+ * @see flow_hash
+ */
+void *dissector_state(const struct dissector_plugin *d,
+                      const struct packet_info *pi)
+{
+    int i = 0;
+    while (i < plugin_count && plugins[i] != d)
+        i++;
+    struct flow_key key;
+    if (i == plugin_count || d->state_size == 0 || flow_key_pi(pi, &key) < 0)
+        return NULL;
+
+    size_t entry = sizeof(struct flow_slot) + ((d->state_size + 7) & ~(size_t)7);
+    if (states[i] == NULL) {
+        states[i] = calloc(DISSECTOR_FLOWS, entry);
+        if (states[i] == NULL)
+            return NULL;
+    }
+    struct flow_slot *s = (struct flow_slot *)(states[i] +
+        (flow_hash(&key) & (DISSECTOR_FLOWS - 1)) * entry);
+    if (!s->used || memcmp(&s->key, &key, sizeof(key)) != 0) {
+        memset(s, 0, entry);
+        s->key = key;
+        s->used = 1;
+    }
+    return s + 1;
+}
+
+
+/**
+ * @brief Print the layer decoded by a plugin
+ *
+ * The payload handed to the plugin starts where its dissector started, and
+ * ends where the layer below ends.
+ *
+ * @param pi The decoded packet, with the LAYER_PLUGIN flag
+ * @param packet The packet
+ */
+void dissector_print(const struct packet_info *pi, const u_char *packet)
+{
+    const struct dissector_plugin *d = dissector_plugin(pi->app_proto);
+    if (d == NULL)
+        return;
+    uint32_t off, end = pi->caplen;
+    switch (d->layer) {
+    case DISSECTOR_ETHERTYPE:
+        off = pi->l3_off;
+        break;
+    case DISSECTOR_IPPROTO:
+        off = pi->l4_off;
+        if (pi->l3_len && pi->l3_off + pi->l3_len < end)
+            end = pi->l3_off + pi->l3_len;
+        break;
+    default:
+        off = pi->l7_off;
+        end = off + pi->l7_len < end ? off + pi->l7_len : end;
+        break;
+    }
+    uint32_t len = end > off ? end - off : 0;
+    out_printf("%s: ", d->name);
+    if (d->print)
+        d->print(pi, packet + off, len);
+    else
+        out_printf("%u bytes", len);
+    out_putc('\n');
+}
+
+
+/**
+ * @brief Release the plugin states of the calling thread
+ */
+void dissector_release(void)
+{
+    for (int i = 0; i < APP_PLUGINS; i++) {
+        free(states[i]);
+        states[i] = NULL;
+    }
+}
+
+
+/**
+ * @brief Unload the plugins
+ */
+void dissector_close(void)
+{
+    dissector_release();
+    while (library_count > 0)
+        dlclose(libraries[--library_count]);
+}
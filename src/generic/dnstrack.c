@@ -0,0 +1,408 @@
+/**
+ * @author Flavien Lallemant
+ * @file dnstrack.c
+ * @brief DNS transaction tracker definition
+ *
+ * This file contains the definition of the DNS transaction tracker.
+ * The pending queries are kept in an open addressing table: a query takes a
+ * free slot among the DNSTRACK_PROBE following its hash, and a response looks
+ * at those slots only, so a removed query just frees its slot. When they are
+ * all taken by queries still waiting, the new query isn't tracked.
+ * The queries older than the timeout are swept once per timeout, lost.
+ *
+ * @see dnstrack.h
+ * @see dnstrack_init
+ * @see dnstrack_update
+ * @see dnstrack_close
+ */
+
+// Global libraries
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Local header files
+#include "dns.h"
+#include "dnstrack.h"
+#include "hdrhist.h"
+#include "overload.h"
+
+#define DNSTRACK_PROBE 16 /**< Slots a query can take after its hash */
+#define RCODES 16 /**< Response codes of the DNS header */
+
+/**
+ * @brief Pending query
+ */
+struct dns_query {
+    uint8_t client[16];     /**< Client address, IPv4 uses the 4 first bytes */
+    uint8_t server[16];     /**< Server address, IPv4 uses the 4 first bytes */
+    uint16_t port;          /**< Client port */
+    uint16_t id;            /**< Transaction ID */
+    uint8_t version;        /**< IP version, 0 if the slot is free */
+    uint8_t server_idx;     /**< Index of the server in the reported ones */
+    int64_t time;           /**< Capture time of the query in microseconds */
+};
+
+/**
+ * @brief Counters of a server
+ */
+struct dns_counters {
+    uint64_t queries;       /**< Queries tracked */
+    uint64_t answers;       /**< Responses matched */
+    uint64_t lost;          /**< Queries without a response before the timeout */
+    struct hdrhist rtt;     /**< Round trip times in microseconds */
+};
+
+/**
+ * @brief Reported server
+ */
+struct dns_server {
+    uint8_t addr[16];           /**< Address, IPv4 uses the 4 first bytes */
+    uint8_t version;            /**< IP version, 0 for the servers added up */
+    struct dns_counters cur;    /**< Counters of the interval */
+    struct dns_counters all;    /**< Counters of the previous intervals */
+};
+
+/**
+ * @brief Tracker state
+ */
+static struct {
+    struct dns_query *slots;    /**< The pending queries, NULL if disabled */
+    uint32_t mask;              /**< Number of slots minus 1 */
+    int interval;               /**< Seconds between two reports, 0 for none */
+    int64_t timeout;            /**< Microseconds before a query is lost */
+    int64_t first;              /**< Capture time of the interval start, 0 before the first packet */
+    int64_t now;                /**< Capture time of the last message */
+    int64_t next_sweep;         /**< Capture time of the next sweep */
+    struct dns_server *servers; /**< The servers, the added up ones last */
+    unsigned nservers;          /**< Servers reported */
+    struct hdrhist rcode_cur[RCODES]; /**< Round trip times of the interval per response code */
+    struct hdrhist rcode_all[RCODES]; /**< Round trip times of the previous intervals per response code */
+    uint64_t unmatched;         /**< Responses without a query */
+    uint64_t retransmits;       /**< Queries already pending */
+    uint64_t untracked;         /**< Queries not tracked, table full */
+    struct overload_mark mark;  /**< Sampling counters at the previous interval report */
+} dt;
+
+static const char *rcode_names[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+    "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE"}; /**< Names of the response codes */
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int dnstrack_init(const struct dnstrack_config *cfg)
+{
+    uint32_t slots = DNSTRACK_PROBE;
+    while (slots < (cfg->slots ? cfg->slots : DNSTRACK_SLOTS) && slots < (1u << 30))
+        slots <<= 1;
+    dt.interval = cfg->interval == 0 ? DNSTRACK_INTERVAL
+                  : cfg->interval < 0 ? 0 : cfg->interval;
+    dt.timeout = (int64_t)(cfg->timeout > 0 ? cfg->timeout : DNSTRACK_TIMEOUT) *
+                 1000000;
+
+    dt.slots = calloc(slots, sizeof(struct dns_query));
+    dt.servers = calloc(DNSTRACK_SERVERS + 1, sizeof(struct dns_server));
+    if (dt.slots == NULL || dt.servers == NULL) {
+        fprintf(stderr, "Error allocating the DNS transaction table\n");
+        free(dt.slots);
+        free(dt.servers);
+        dt.slots = NULL;
+        dt.servers = NULL;
+        return (-1);
+    }
+    dt.mask = slots - 1;
+    return 0;
+}
+
+
+/**
+ * @brief Check if the tracker is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int dnstrack_enabled(void)
+{
+    return dt.slots != NULL;
+}
+
+
+/**
+ * @brief Hash the key of a query
+ *
+ * @param q The query, with its key set
+ * @return uint32_t The hash
+ */
+static uint32_t query_hash(const struct dns_query *q)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    const uint8_t *p = q->client;
+    for (size_t i = 0; i < offsetof(struct dns_query, server_idx); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+
+/**
+ * @brief Get the index of a server in the reported ones
+ *
+ * The servers past DNSTRACK_SERVERS are added up in the last one.
+ *
+ * @param addr The address
+ * @param version The IP version
+ * @return unsigned The index
+ */
+static unsigned server_index(const uint8_t *addr, uint8_t version)
+{
+    for (unsigned i = 0; i < dt.nservers; i++) {
+        if (dt.servers[i].version == version &&
+            memcmp(dt.servers[i].addr, addr, 16) == 0)
+            return i;
+    }
+    if (dt.nservers == DNSTRACK_SERVERS)
+        return DNSTRACK_SERVERS;
+    struct dns_server *s = &dt.servers[dt.nservers];
+    memcpy(s->addr, addr, 16);
+    s->version = version;
+    return dt.nservers++;
+}
+
+
+/**
+ * @brief Free a query
+ *
+ * @param q The query
+ * @param lost 1 if it didn't get a response
+ */
+static void query_free(struct dns_query *q, int lost)
+{
+    if (lost)
+        dt.servers[q->server_idx].cur.lost++;
+    q->version = 0;
+}
+
+
+/**
+ * @brief Free the queries older than the timeout
+ *
+ * @see query_free
+ */
+static void sweep(void)
+{
+    for (uint32_t i = 0; i <= dt.mask; i++) {
+        struct dns_query *q = &dt.slots[i];
+        if (q->version && dt.now - q->time > dt.timeout)
+            query_free(q, 1);
+    }
+}
+
+
+/**
+ * @brief Print the latencies of the servers and response codes
+ *
+ * @param title The title of the report
+ * @param total 1 for the whole capture, 0 for the interval
+ */
+static void report(const char *title, int total)
+{
+    struct overload_mark start = {0};
+    fprintf(stderr, "DNS latency, %s:\n", title);
+    overload_report(stderr, total ? &start : &dt.mark);
+    fprintf(stderr, "  %-39s %9s %9s %9s %9s %9s %9s\n", "Server", "Queries",
+            "Answers", "Lost", "p50 ms", "p99 ms", "p999 ms");
+    for (unsigned i = 0; i <= DNSTRACK_SERVERS; i++) {
+        const struct dns_server *s = &dt.servers[i];
+        const struct dns_counters *c = total ? &s->all : &s->cur;
+        if (c->queries == 0 && c->answers == 0 && c->lost == 0)
+            continue;
+        char name[INET6_ADDRSTRLEN];
+        if (s->version == 0)
+            snprintf(name, sizeof(name), "other servers");
+        else
+            inet_ntop(s->version == 4 ? AF_INET : AF_INET6, s->addr, name,
+                      sizeof(name));
+        fprintf(stderr, "  %-39s %9llu %9llu %9llu %9.3f %9.3f %9.3f\n", name,
+                (unsigned long long)c->queries, (unsigned long long)c->answers,
+                (unsigned long long)c->lost,
+                hdr_percentile(&c->rtt, 50) / 1000.0,
+                hdr_percentile(&c->rtt, 99) / 1000.0,
+                hdr_percentile(&c->rtt, 99.9) / 1000.0);
+    }
+    for (int r = 0; r < RCODES; r++) {
+        const struct hdrhist *h = total ? &dt.rcode_all[r] : &dt.rcode_cur[r];
+        if (h->count == 0)
+            continue;
+        char name[16];
+        if (r < (int)(sizeof(rcode_names) / sizeof(rcode_names[0])))
+            snprintf(name, sizeof(name), "%s", rcode_names[r]);
+        else
+            snprintf(name, sizeof(name), "RCODE%d", r);
+        fprintf(stderr, "  %-39s %9s %9llu %9s %9.3f %9.3f %9.3f\n", name, "",
+                (unsigned long long)h->count, "", hdr_percentile(h, 50) / 1000.0,
+                hdr_percentile(h, 99) / 1000.0, hdr_percentile(h, 99.9) / 1000.0);
+    }
+}
+
+
+/**
+ * @brief Add the counters of the interval to the previous ones
+ *
+ * @see hdr_merge
+ */
+static void interval_merge(void)
+{
+    for (unsigned i = 0; i <= DNSTRACK_SERVERS; i++) {
+        struct dns_counters *cur = &dt.servers[i].cur, *all = &dt.servers[i].all;
+        all->queries += cur->queries;
+        all->answers += cur->answers;
+        all->lost += cur->lost;
+        hdr_merge(&all->rtt, &cur->rtt);
+        memset(cur, 0, sizeof(*cur));
+    }
+    for (int r = 0; r < RCODES; r++) {
+        hdr_merge(&dt.rcode_all[r], &dt.rcode_cur[r]);
+        memset(&dt.rcode_cur[r], 0, sizeof(dt.rcode_cur[r]));
+    }
+}
+
+
+/**
+ * @brief Advance the capture time, sweeping and reporting when due
+ *
+ * @param now The capture time of the message in microseconds
+ *
+ * @see sweep
+ * @see report
+ */
+static void tick(int64_t now)
+{
+    if (now > dt.now)
+        dt.now = now;
+    if (dt.first == 0) {
+        dt.first = now;
+        dt.next_sweep = now + dt.timeout;
+    }
+    if (dt.now >= dt.next_sweep) {
+        sweep();
+        dt.next_sweep = dt.now + dt.timeout;
+    }
+    if (dt.interval > 0 && now - dt.first >= (int64_t)dt.interval * 1000000) {
+        char title[64];
+        struct tm tm;
+        time_t sec = dt.first / 1000000;
+        size_t len = strftime(title, sizeof(title), "%Y-%m-%d %H:%M:%S",
+                              localtime_r(&sec, &tm));
+        snprintf(title + len, sizeof(title) - len, " (%d s)", dt.interval);
+        report(title, 0);
+        interval_merge();
+        dt.first = now;
+    }
+}
+
+
+/**
+ * @brief Match a decoded DNS message
+ *
+ * A query is kept until its response, which records the round trip time.
+ * The other packets are ignored.
+ *
+ * @param pi The decoded packet
+ *
+ * @see tick
+ * @see query_hash
+ */
+void dnstrack_update(const struct packet_info *pi)
+{
+    if (dt.slots == NULL || !(pi->layers & LAYER_APP) ||
+        pi->app_proto != APP_DNS || pi->ip_version == 0)
+        return;
+    int64_t now = (int64_t)pi->ts.tv_sec * 1000000 + pi->ts.tv_usec;
+    tick(now);
+
+    int response = (pi->u.dns.flags & DH_QR) != 0;
+    struct dns_query key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.client, response ? pi->ip_dst : pi->ip_src, 16);
+    memcpy(key.server, response ? pi->ip_src : pi->ip_dst, 16);
+    key.port = response ? pi->dport : pi->sport;
+    key.id = pi->u.dns.id;
+    key.version = pi->ip_version;
+    uint32_t h = query_hash(&key);
+
+    struct dns_query *q = NULL, *free_slot = NULL;
+    for (uint32_t i = 0; i < DNSTRACK_PROBE; i++) {
+        struct dns_query *s = &dt.slots[(h + i) & dt.mask];
+        if (s->version && now - s->time > dt.timeout)
+            query_free(s, 1);
+        if (s->version == 0) {
+            if (free_slot == NULL)
+                free_slot = s;
+        } else if (memcmp(s, &key, offsetof(struct dns_query, server_idx)) == 0) {
+            q = s;
+            break;
+        }
+    }
+
+    if (!response) {
+        if (q) { // Retransmitted, the time of the first one is kept
+            dt.retransmits++;
+            return;
+        }
+        if (free_slot == NULL) {
+            dt.untracked++;
+            return;
+        }
+        key.server_idx = server_index(key.server, key.version);
+        key.time = now;
+        *free_slot = key;
+        dt.servers[key.server_idx].cur.queries++;
+        return;
+    }
+    if (q == NULL) {
+        dt.unmatched++;
+        return;
+    }
+    int64_t rtt = now > q->time ? now - q->time : 0;
+    struct dns_counters *c = &dt.servers[q->server_idx].cur;
+    c->answers++;
+    hdr_record(&c->rtt, rtt);
+    hdr_record(&dt.rcode_cur[pi->u.dns.flags & DH_RCODE], rtt);
+    query_free(q, 0);
+}
+
+
+/**
+ * @brief Print the latencies of the whole capture and free the tracker
+ *
+ * The queries still pending are not counted as lost, unless they timed out.
+ *
+ * @see report
+ */
+void dnstrack_close(void)
+{
+    if (dt.slots == NULL)
+        return;
+    sweep();
+    uint64_t pending = 0;
+    for (uint32_t i = 0; i <= dt.mask; i++)
+        pending += dt.slots[i].version != 0;
+    interval_merge();
+    report("Total", 1);
+    fprintf(stderr, "  %llu pending, %llu unmatched responses, %llu retransmitted "
+                    "queries, %llu queries not tracked\n",
+            (unsigned long long)pending, (unsigned long long)dt.unmatched,
+            (unsigned long long)dt.retransmits,
+            (unsigned long long)dt.untracked);
+    free(dt.slots);
+    free(dt.servers);
+    dt.slots = NULL;
+    dt.servers = NULL;
+}
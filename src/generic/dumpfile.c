@@ -0,0 +1,658 @@
+/**
+ * @author Flavien Lallemant
+ * @file dumpfile.c
+ * @brief Capture file writer definition
+ *
+ * This file contains the definition of the writer of the pcap files of -w.
+ * The records are appended to a ring of buffers as one stream of bytes, a
+ * record running over the end of a buffer going on in the next one, so every
+ * buffer but the last of a file is full and can be written with O_DIRECT.
+ * The capture thread starts a new file by marking the buffer it begins, the
+ * writer thread closes the previous file and opens the new one before
+ * writing that buffer.
+ * A pcapng file is one section with an interface description block per
+ * interface, written again at the start of each file of a rotation, so every
+ * file can be read on its own.
+ *
+ * @see dumpfile.h
+ * @see dumpfile_open
+ * @see dumpfile_write
+ * @see dumpfile_offset
+ * @see dumpfile_close
+ */
+
+// Global libraries
+#define _GNU_SOURCE // O_DIRECT
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "dispatch.h"
+#include "dumpfile.h"
+#include "flow.h"
+
+#define DUMPFILE_ALIGN 4096 /**< Alignment of the buffers and of their size for O_DIRECT */
+#define PCAP_HEADER 24      /**< Bytes of the file header */
+#define PCAP_RECORD 16      /**< Bytes of a record header */
+#define PCAPNG_SHB 0x0a0d0d0a   /**< pcapng section header block */
+#define PCAPNG_IDB 0x00000001   /**< pcapng interface description block */
+#define PCAPNG_EPB 0x00000006   /**< pcapng enhanced packet block */
+#define PCAPNG_BOM 0x1a2b3c4d   /**< pcapng byte-order magic */
+#define PCAPNG_EPB_HEADER 28    /**< Bytes of an enhanced packet block before the packet */
+#define PCAPNG_COMMENT 64       /**< Largest comment of a packet */
+#define PAD4(n) (((n) + 3) & ~(size_t)3) /**< Length padded to 32 bits */
+
+static const unsigned char zeros[4]; /**< Padding of the pcapng fields */
+
+/**
+ * @brief Buffer of the writer thread
+ */
+struct dump_buf {
+    unsigned char *data;    /**< The bytes */
+    size_t len;             /**< Number of bytes */
+    int open;               /**< 1 to start a new file with the buffer */
+    time_t start;           /**< Period of the new file */
+    unsigned seq;           /**< Number of the new file in its period */
+};
+
+/**
+ * @brief Capture file writer
+ */
+struct dumpfile {
+    struct dumpfile_config cfg;                 /**< The configuration */
+    size_t size;                                /**< Bytes of a buffer */
+    struct dump_buf bufs[DUMPFILE_BUFFERS];     /**< The ring of buffers */
+    pthread_mutex_t lock;                       /**< Protects head, tail and done */
+    pthread_cond_t filled;                      /**< Signaled when a buffer is submitted */
+    pthread_cond_t freed;                       /**< Signaled when a buffer is written */
+    unsigned long long head;                    /**< Buffers submitted */
+    unsigned long long tail;                    /**< Buffers written */
+    int done;                                   /**< 1 once the last buffer is submitted */
+    pthread_t thread;                           /**< The writer thread */
+    struct dump_buf *cur;                       /**< Buffer being filled */
+    unsigned long long off;                     /**< Offset of the next record in its file */
+    size_t header;                              /**< Bytes of the headers starting a file */
+    time_t start;                               /**< Period of the current file, -1 before the first */
+    unsigned seq;                               /**< Number of the current file in its period */
+    unsigned long long packets;                 /**< Packets written */
+    unsigned long long dropped;                 /**< Packets dropped without a free buffer */
+    int fd;                                     /**< The file being written, -1 if none */
+    int direct;                                 /**< 1 while the file is written with O_DIRECT */
+    int files;                                  /**< Files opened */
+    int errors;                                 /**< Opens and writes that failed */
+};
+
+
+/**
+ * @brief Give the buffer being filled to the writer thread
+ *
+ * The next buffer is waited for if the writer thread is still on it.
+ *
+ * @param d The writer
+ */
+static void buf_submit(struct dumpfile *d)
+{
+    pthread_mutex_lock(&d->lock);
+    d->head++;
+    pthread_cond_signal(&d->filled);
+    while (d->head - d->tail == DUMPFILE_BUFFERS)
+        pthread_cond_wait(&d->freed, &d->lock);
+    pthread_mutex_unlock(&d->lock);
+    d->cur = &d->bufs[d->head % DUMPFILE_BUFFERS];
+    d->cur->len = 0;
+    d->cur->open = 0;
+}
+
+
+/**
+ * @brief Check the next buffer can be filled without waiting
+ *
+ * @param d The writer
+ * @return int 1 if it can, or if the writer may wait, 0 otherwise
+ */
+static int buf_ready(struct dumpfile *d)
+{
+    if (!d->cfg.live)
+        return 1;
+    pthread_mutex_lock(&d->lock);
+    int ready = d->head + 1 - d->tail < DUMPFILE_BUFFERS;
+    pthread_mutex_unlock(&d->lock);
+    return ready;
+}
+
+
+/**
+ * @brief Append bytes to the buffers
+ *
+ * @param d The writer
+ * @param data The bytes
+ * @param len The number of bytes
+ */
+static void buf_put(struct dumpfile *d, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    while (len > 0) {
+        size_t n = d->size - d->cur->len < len ? d->size - d->cur->len : len;
+        memcpy(d->cur->data + d->cur->len, p, n);
+        d->cur->len += n;
+        p += n;
+        len -= n;
+        if (d->cur->len == d->size)
+            buf_submit(d);
+    }
+}
+
+
+/**
+ * @brief Append a pcapng option to a block being built
+ *
+ * @param p Where the option goes
+ * @param code The option code
+ * @param value The value
+ * @param len The length of the value
+ * @return size_t The bytes of the option, padded
+ */
+static size_t ng_option(unsigned char *p, uint16_t code, const void *value,
+                        uint16_t len)
+{
+    memcpy(p, &code, 2);
+    memcpy(p + 2, &len, 2);
+    if (len)
+        memcpy(p + 4, value, len);
+    memset(p + 4 + len, 0, PAD4(len) - len);
+    return 4 + PAD4(len);
+}
+
+
+/**
+ * @brief Append a built pcapng block, setting its lengths
+ *
+ * @param d The writer
+ * @param block The block, its options ended, with room for the trailing
+ * length
+ * @param len The bytes of the block without the trailing length
+ * @return size_t The bytes of the block
+ */
+static size_t ng_block(struct dumpfile *d, unsigned char *block, size_t len)
+{
+    uint32_t total = (uint32_t)len + 4;
+    memcpy(block + 4, &total, 4);
+    memcpy(block + len, &total, 4);
+    buf_put(d, block, total);
+    return total;
+}
+
+
+/**
+ * @brief Append the section header and the interface descriptions
+ *
+ * The timestamps of every interface are in nanoseconds.
+ *
+ * @param d The writer
+ * @return size_t The bytes appended
+ */
+static size_t ng_header(struct dumpfile *d)
+{
+    unsigned char block[128];
+    uint32_t shb[6] = {PCAPNG_SHB, 0, PCAPNG_BOM, 1, 0xffffffff, 0xffffffff};
+    memcpy(block, shb, sizeof(shb)); // Version 1.0, section length unknown
+    size_t len = sizeof(shb);
+    len += ng_option(block + len, 4, "NetStalker", 10); // shb_userappl
+    len += ng_option(block + len, 0, NULL, 0);
+    size_t total = ng_block(d, block, len);
+
+    int count = d->cfg.interface_count > 0 ? d->cfg.interface_count : 1;
+    for (int i = 0; i < count; i++) {
+        uint32_t idb[4] = {PCAPNG_IDB, 0, (uint32_t)d->cfg.linktype & 0xffff,
+                           (uint32_t)d->cfg.snaplen};
+        memcpy(block, idb, sizeof(idb));
+        len = sizeof(idb);
+        const char *name = d->cfg.interfaces ? d->cfg.interfaces[i] : NULL;
+        if (name && *name)
+            len += ng_option(block + len, 2, name, strnlen(name, 64)); // if_name
+        uint8_t resol = 9;
+        len += ng_option(block + len, 9, &resol, 1); // if_tsresol
+        len += ng_option(block + len, 0, NULL, 0);
+        total += ng_block(d, block, len);
+    }
+    return total;
+}
+
+
+/**
+ * @brief Write the comment of a packet
+ *
+ * The comment holds the hash of the flow of the packet, the same for both
+ * directions, and the application protocol mapped on its ports.
+ *
+ * @param packet The packet
+ * @param caplen The captured length
+ * @param comment The comment, PCAPNG_COMMENT bytes
+ * @return size_t The length of the comment, 0 for a packet without a flow
+ *
+ * @see flow_key_packet
+ * @see dispatch_port
+ */
+static size_t packet_comment(const u_char *packet, uint32_t caplen,
+                             char *comment)
+{
+    struct flow_key key;
+    if (flow_key_packet(packet, caplen, &key) < 0)
+        return 0;
+    int len = snprintf(comment, PCAPNG_COMMENT, "flow=%08x", flow_hash(&key));
+    uint8_t app = APP_NONE;
+    if (key.proto == IPPROTO_TCP || key.proto == IPPROTO_UDP)
+        app = dispatch_port(key.proto == IPPROTO_TCP ? DISPATCH_TCP
+                                                     : DISPATCH_UDP,
+                            key.port[0], key.port[1]);
+    if (app != APP_NONE)
+        len += snprintf(comment + len, PCAPNG_COMMENT - len, " app=%s",
+                        app_proto_name(app));
+    return len < PCAPNG_COMMENT ? (size_t)len : PCAPNG_COMMENT - 1;
+}
+
+
+/**
+ * @brief Start a new file
+ *
+ * @param d The writer
+ * @param start Period of the file
+ * @param seq Number of the file in its period
+ */
+static void file_next(struct dumpfile *d, time_t start, unsigned seq)
+{
+    if (d->cur->len > 0)
+        buf_submit(d);
+    d->cur->open = 1;
+    d->cur->start = start;
+    d->cur->seq = seq;
+    d->start = start;
+    d->seq = seq;
+
+    if (d->cfg.format == DUMPFILE_PCAPNG) {
+        d->header = ng_header(d);
+    } else {
+        uint32_t header[6] = {0xa1b2c3d4, 2 | 4 << 16, 0, 0,
+                              (uint32_t)d->cfg.snaplen,
+                              (uint32_t)d->cfg.linktype};
+        buf_put(d, header, PCAP_HEADER);
+        d->header = PCAP_HEADER;
+    }
+    d->off = d->header;
+}
+
+
+/**
+ * @brief Write bytes to a file descriptor
+ *
+ * @param fd The file descriptor
+ * @param buf The bytes
+ * @param len The number of bytes
+ * @return int 0 on success, -1 on error
+ */
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (-1);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Close the file being written
+ *
+ * @param d The writer
+ */
+static void file_close(struct dumpfile *d)
+{
+    if (d->fd < 0)
+        return;
+    if (d->cfg.sync != DUMPFILE_SYNC_NONE && fsync(d->fd) < 0 && errno != EINVAL)
+        d->errors++;
+    if (d->fd != STDOUT_FILENO && close(d->fd) < 0)
+        d->errors++;
+    d->fd = -1;
+}
+
+
+/**
+ * @brief Open a file
+ *
+ * @param d The writer
+ * @param start Period of the file
+ * @param seq Number of the file in its period
+ * @return int 0 on success, -1 on error
+ */
+static int file_open(struct dumpfile *d, time_t start, unsigned seq)
+{
+    file_close(d);
+    if (strcmp(d->cfg.path, "-") == 0) {
+        d->fd = STDOUT_FILENO;
+        d->files++;
+        return 0;
+    }
+
+    char name[PATH_MAX] = "";
+    struct tm tm;
+    if (d->cfg.seconds == 0 || localtime_r(&start, &tm) == NULL ||
+        strftime(name, sizeof(name), d->cfg.path, &tm) == 0)
+        snprintf(name, sizeof(name), "%s", d->cfg.path);
+    if (seq > 0) {
+        size_t len = strlen(name);
+        snprintf(name + len, sizeof(name) - len, "%u", seq);
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    d->fd = open(name, flags | (d->cfg.direct ? O_DIRECT : 0), 0644);
+    d->direct = d->cfg.direct && d->fd >= 0;
+    if (d->fd < 0 && d->cfg.direct && errno == EINVAL) { // tmpfs and others
+        fprintf(stderr, "%s does not support O_DIRECT, writing through the page cache\n",
+                name);
+        d->cfg.direct = 0;
+        d->fd = open(name, flags, 0644);
+    }
+    if (d->fd < 0) {
+        fprintf(stderr, "Error opening output file %s: %s\n", name,
+                strerror(errno));
+        d->errors++;
+        return (-1);
+    }
+    d->files++;
+    return 0;
+}
+
+
+/**
+ * @brief Write a buffer to the current file
+ *
+ * @param d The writer
+ * @param buf The buffer
+ */
+static void buf_write(struct dumpfile *d, const struct dump_buf *buf)
+{
+    if (d->fd < 0)
+        return;
+    if (d->direct && buf->len % DUMPFILE_ALIGN != 0) { // The end of the file
+        int flags = fcntl(d->fd, F_GETFL);
+        if (flags >= 0)
+            fcntl(d->fd, F_SETFL, flags & ~O_DIRECT);
+        d->direct = 0;
+    }
+    if (write_all(d->fd, buf->data, buf->len) < 0) {
+        fprintf(stderr, "Error writing the output file: %s\n", strerror(errno));
+        d->errors++;
+        file_close(d); // The rest of the file would be garbage
+        return;
+    }
+    if (d->cfg.sync == DUMPFILE_SYNC_BUFFER && fdatasync(d->fd) < 0 &&
+        errno != EINVAL)
+        d->errors++;
+}
+
+
+/**
+ * @brief Writer thread
+ *
+ * @param arg The writer
+ * @return void* NULL
+ */
+static void *dumpfile_main(void *arg)
+{
+    struct dumpfile *d = arg;
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        while (d->tail == d->head && !d->done)
+            pthread_cond_wait(&d->filled, &d->lock);
+        if (d->tail == d->head) {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        struct dump_buf *buf = &d->bufs[d->tail % DUMPFILE_BUFFERS];
+        pthread_mutex_unlock(&d->lock);
+
+        if (buf->open)
+            file_open(d, buf->start, buf->seq);
+        buf_write(d, buf);
+
+        pthread_mutex_lock(&d->lock);
+        d->tail++;
+        pthread_cond_signal(&d->freed);
+        pthread_mutex_unlock(&d->lock);
+    }
+    file_close(d);
+    return NULL;
+}
+
+
+/**
+ * @brief Free a writer
+ *
+ * @param d The writer
+ */
+static void dumpfile_free(struct dumpfile *d)
+{
+    for (int i = 0; i < DUMPFILE_BUFFERS; i++)
+        free(d->bufs[i].data);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->filled);
+    pthread_cond_destroy(&d->freed);
+    free(d);
+}
+
+
+/**
+ * @brief Open the first file and start the writer thread
+ *
+ * Without a period, the first file is opened here so an error is reported at
+ * once. With one, the name of the first file depends on the first packet.
+ *
+ * @param cfg The configuration
+ * @return struct dumpfile* The writer, NULL on error
+ */
+struct dumpfile *dumpfile_open(const struct dumpfile_config *cfg)
+{
+    if (strcmp(cfg->path, "-") == 0 && (cfg->size || cfg->seconds)) {
+        fprintf(stderr, "The standard output can't be rotated\n");
+        return NULL;
+    }
+    struct dumpfile *d = calloc(1, sizeof(struct dumpfile));
+    if (d == NULL) {
+        fprintf(stderr, "Error allocating the output file writer\n");
+        return NULL;
+    }
+    d->cfg = *cfg;
+    d->fd = -1;
+    d->start = -1;
+    size_t size = cfg->buffer ? cfg->buffer : DUMPFILE_BUFFER;
+    if (size < DUMPFILE_MIN_BUFFER)
+        size = DUMPFILE_MIN_BUFFER;
+    d->size = (size + DUMPFILE_ALIGN - 1) & ~(size_t)(DUMPFILE_ALIGN - 1);
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->filled, NULL);
+    pthread_cond_init(&d->freed, NULL);
+    for (int i = 0; i < DUMPFILE_BUFFERS; i++) {
+        d->bufs[i].data = aligned_alloc(DUMPFILE_ALIGN, d->size);
+        if (d->bufs[i].data == NULL) {
+            fprintf(stderr, "Error allocating the output file buffers\n");
+            dumpfile_free(d);
+            return NULL;
+        }
+    }
+    d->cur = &d->bufs[0];
+
+    if (cfg->seconds == 0) {
+        if (file_open(d, 0, 0) < 0) {
+            dumpfile_free(d);
+            return NULL;
+        }
+        file_next(d, 0, 0);
+        d->cur->open = 0; // Already opened
+    }
+    if (pthread_create(&d->thread, NULL, dumpfile_main, d) != 0) {
+        fprintf(stderr, "Error starting the output file writer\n");
+        file_close(d);
+        dumpfile_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+
+/**
+ * @brief Append the enhanced packet block of a packet
+ *
+ * @param d The writer
+ * @param header The packet header
+ * @param nsec The nanoseconds of the second of the packet time
+ * @param packet The packet
+ * @param interface The interface of the packet
+ * @param comment The comment
+ * @param comment_len The length of the comment, 0 for none
+ * @param len The bytes of the block
+ */
+static void ng_packet(struct dumpfile *d, const struct pcap_pkthdr *header,
+                      uint32_t nsec, const u_char *packet, int interface,
+                      const char *comment, size_t comment_len, size_t len)
+{
+    if (interface < 0 || interface >= d->cfg.interface_count)
+        interface = 0;
+    uint64_t ts = (uint64_t)header->ts.tv_sec * 1000000000 + nsec;
+    uint32_t block[7] = {PCAPNG_EPB, (uint32_t)len, (uint32_t)interface,
+                         (uint32_t)(ts >> 32), (uint32_t)ts, header->caplen,
+                         header->len};
+    buf_put(d, block, PCAPNG_EPB_HEADER);
+    buf_put(d, packet, header->caplen);
+    buf_put(d, zeros, PAD4(header->caplen) - header->caplen);
+    if (comment_len) {
+        uint16_t option[2] = {1, (uint16_t)comment_len}; // opt_comment
+        buf_put(d, option, sizeof(option));
+        buf_put(d, comment, comment_len);
+        buf_put(d, zeros, PAD4(comment_len) - comment_len);
+        buf_put(d, zeros, 4); // opt_endofopt
+    }
+    uint32_t total = (uint32_t)len;
+    buf_put(d, &total, sizeof(total));
+}
+
+
+/**
+ * @brief Write a packet
+ *
+ * @param d The writer
+ * @param header The packet header
+ * @param nsec The nanoseconds of the second of the packet time, only kept in
+ * a pcapng file
+ * @param packet The packet
+ * @param interface The interface of the packet, ignored in a pcap file
+ * @return int 0 on success, -1 if the packet is dropped
+ */
+int dumpfile_write(struct dumpfile *d, const struct pcap_pkthdr *header,
+                   uint32_t nsec, const u_char *packet, int interface)
+{
+    char comment[PCAPNG_COMMENT];
+    size_t comment_len = 0;
+    size_t len = PCAP_RECORD + header->caplen;
+    if (d->cfg.format == DUMPFILE_PCAPNG) {
+        if (d->cfg.comments)
+            comment_len = packet_comment(packet, header->caplen, comment);
+        len = PCAPNG_EPB_HEADER + PAD4(header->caplen) + 4;
+        if (comment_len)
+            len += 4 + PAD4(comment_len) + 4; // The comment and the end of the options
+    }
+    int rotate = 0;
+    time_t start = d->start;
+    unsigned seq = d->seq;
+    if (d->cfg.seconds &&
+        (d->start < 0 || header->ts.tv_sec >= d->start + d->cfg.seconds)) {
+        start = header->ts.tv_sec - header->ts.tv_sec % d->cfg.seconds;
+        seq = 0;
+        rotate = 1;
+    } else if (d->cfg.size && d->off > d->header &&
+               d->off + len > d->cfg.size) {
+        seq++;
+        rotate = 1;
+    }
+
+    // A record spans two buffers at most, the second is needed if it is full
+    int next = rotate ? d->cur->len > 0 : len > d->size - d->cur->len;
+    if (next && !buf_ready(d)) {
+        d->dropped++;
+        return (-1);
+    }
+    if (rotate)
+        file_next(d, start, seq);
+
+    if (d->cfg.format == DUMPFILE_PCAPNG) {
+        ng_packet(d, header, nsec, packet, interface, comment, comment_len,
+                  len);
+    } else {
+        uint32_t record[4] = {(uint32_t)header->ts.tv_sec,
+                              (uint32_t)header->ts.tv_usec, header->caplen,
+                              header->len};
+        buf_put(d, record, PCAP_RECORD);
+        buf_put(d, packet, header->caplen);
+    }
+    d->off += len;
+    d->packets++;
+    return 0;
+}
+
+
+/**
+ * @brief Get the offset of the next record in the current file
+ *
+ * @param d The writer
+ * @return unsigned long long The offset
+ */
+unsigned long long dumpfile_offset(const struct dumpfile *d)
+{
+    return d->off;
+}
+
+
+/**
+ * @brief Write the buffers, close the file and free the writer
+ *
+ * @param d The writer
+ * @return int 0 on success, -1 if a write failed
+ */
+int dumpfile_close(struct dumpfile *d)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->cur->len > 0) {
+        d->head++;
+        pthread_cond_signal(&d->filled);
+    }
+    d->done = 1;
+    pthread_cond_signal(&d->filled);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+
+    if (d->dropped > 0)
+        fprintf(stderr, "Output file: %llu packets dropped waiting for the disk\n",
+                d->dropped);
+    if (d->cfg.size || d->cfg.seconds)
+        fprintf(stderr, "Output file: %llu packets in %d files\n", d->packets,
+                d->files);
+    int status = d->errors > 0 ? (-1) : 0;
+    if (status < 0)
+        fprintf(stderr, "Output file: %d errors\n", d->errors);
+    dumpfile_free(d);
+    return status;
+}
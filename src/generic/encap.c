@@ -0,0 +1,538 @@
+/**
+ * @author Flavien Lallemant
+ * @file encap.c
+ * @brief Decapsulation definition
+ *
+ * This file contains the definition of the loop peeling the VLAN tags, MPLS
+ * labels and tunnel headers, and of the link layers it starts from.
+ * Each turn of the loop looks at the header the current ethertype announces
+ * and peels it only if it is whole and well formed, so a packet that isn't
+ * encapsulated costs one switch on its ethertype, plus a look at the
+ * protocol and UDP port of an IP packet.
+ * The outer IP headers of the tunnels are skipped: the network and
+ * transport layers of a decoded packet are the ones of its innermost packet.
+ *
+ * @see encap.h
+ * @see encap_set_linktype
+ * @see encap_link
+ * @see encap_peel
+ * @see encap_ethertype
+ * @see encap_print
+ */
+
+// Global libraries
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <stdio.h>
+#include <string.h>
+
+// Local header files
+#include "dissector.h"
+#include "encap.h"
+#include "output.h"
+#include "sll.h"
+
+#define VLAN_TAG_LEN 4      /**< 802.1Q tag */
+#define MPLS_LABEL_LEN 4    /**< MPLS label stack entry */
+#define GRE_HDR_LEN 4       /**< GRE header without its optional fields */
+#define VXLAN_HDR_LEN 8     /**< VXLAN header */
+#define GENEVE_HDR_LEN 8    /**< GENEVE header without its options */
+
+#define GRE_CSUM 0x8000     /**< Checksum present */
+#define GRE_KEY 0x2000      /**< Key present */
+#define GRE_SEQ 0x1000      /**< Sequence number present */
+#define GRE_VERSION 0x0007  /**< Version, 0 for the tunnels */
+#define VXLAN_VNI 0x08      /**< The VNI is valid */
+#define MPLS_BOTTOM 0x100   /**< Last label of the stack */
+
+static int link_type = DLT_EN10MB; /**< Link type of the packets */
+
+
+/**
+ * @brief Set the link type of the packets
+ *
+ * @param linktype The DLT_* link type
+ * @return int 0 on success, -1 if the link type isn't supported
+ */
+int encap_set_linktype(int linktype)
+{
+    switch (linktype) {
+    case DLT_EN10MB:
+    case DLT_LINUX_SLL:
+    case DLT_LINUX_SLL2:
+    case DLT_RAW:
+    case DLT_IPV4:
+    case DLT_IPV6:
+        link_type = linktype;
+        return 0;
+    default:
+        return (-1);
+    }
+}
+
+
+/**
+ * @brief Get the link type of the packets
+ *
+ * @return int The DLT_* link type
+ */
+int encap_linktype(void)
+{
+    return link_type;
+}
+
+
+/**
+ * @brief Read a big endian 16 bits integer
+ */
+static inline uint16_t get16(const u_char *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+/**
+ * @brief Skip the link layer header of a packet
+ *
+ * A cooked header whose protocol is below 0x0600, e.g. of a netlink socket,
+ * carries no ethertype.
+ *
+ * @param v The view of the packet, moved past the header
+ * @param type The ethertype of the payload
+ * @return int 0 on success, -1 if the header is truncated or carries no
+ * ethertype
+ */
+int encap_link(struct packet_view *v, uint16_t *type)
+{
+    const u_char *h;
+    switch (link_type) {
+    case DLT_EN10MB:
+        if ((h = view_pull(v, sizeof(struct ether_header))) == NULL)
+            return (-1);
+        *type = get16(h + 12);
+        return 0;
+    case DLT_LINUX_SLL:
+        if ((h = view_pull(v, SLL_HDR_LEN)) == NULL)
+            return (-1);
+        *type = get16(h + 14);
+        return *type >= ETH_P_802_3_MIN ? 0 : -1;
+    case DLT_LINUX_SLL2:
+        if ((h = view_pull(v, SLL2_HDR_LEN)) == NULL)
+            return (-1);
+        *type = get16(h);
+        return *type >= ETH_P_802_3_MIN ? 0 : -1;
+    default: // Raw IP
+        if ((h = view_peek(v, 1)) == NULL)
+            return (-1);
+        if (*h >> 4 == 4)
+            *type = ETHERTYPE_IP;
+        else if (*h >> 4 == 6)
+            *type = ETHERTYPE_IPV6;
+        else
+            return (-1);
+        return 0;
+    }
+}
+
+
+/**
+ * @brief Tell whether a tunnel payload can be decoded
+ *
+ * @param type The protocol of the payload
+ * @return int 1 for IP, MPLS and Ethernet, 0 otherwise
+ */
+static inline int known_payload(uint16_t type)
+{
+    return type == ETHERTYPE_IP || type == ETHERTYPE_IPV6 ||
+           type == ETH_P_TEB || type == ETH_P_MPLS_UC || type == ETH_P_MPLS_MC;
+}
+
+
+/**
+ * @brief Peel the Ethernet header carried by a tunnel
+ *
+ * @param w The view of the header, moved past it
+ * @param type The ethertype of the inner payload
+ * @param pi The decoded packet to record the addresses in, NULL for none
+ * @return int 0 on success, -1 if the header is truncated
+ */
+static int inner_ethernet(struct packet_view *w, uint16_t *type,
+                          struct packet_info *pi)
+{
+    const struct ether_header *eth = view_pull(w, sizeof(*eth));
+    if (eth == NULL)
+        return (-1);
+    *type = get16((const u_char *)&eth->ether_type);
+    if (pi) {
+        memcpy(pi->mac_src, eth->ether_shost, ETH_ALEN);
+        memcpy(pi->mac_dst, eth->ether_dhost, ETH_ALEN);
+        pi->layers |= LAYER_ETH;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Peel an MPLS label
+ *
+ * Below the last label, the payload is told apart by its first nibble: an
+ * IP version, or 0 for the control word of an Ethernet pseudowire.
+ *
+ * @param w The view of the label, moved past it
+ * @param type The ethertype of the payload, unchanged until the last label
+ * @param pi The decoded packet, NULL for none
+ * @return int 0 on success, -1 if the label is truncated or the payload unknown
+ */
+static int peel_mpls(struct packet_view *w, uint16_t *type,
+                     struct packet_info *pi)
+{
+    const u_char *l = view_pull(w, MPLS_LABEL_LEN);
+    if (l == NULL)
+        return (-1);
+    if (!(get16(l + 2) & MPLS_BOTTOM))
+        return 0;
+    const u_char *p = view_peek(w, 1);
+    if (p == NULL)
+        return (-1);
+    switch (*p >> 4) {
+    case 4:
+        *type = ETHERTYPE_IP;
+        return 0;
+    case 6:
+        *type = ETHERTYPE_IPV6;
+        return 0;
+    case 0:
+        return view_skip(w, 4) < 0 ? -1 : inner_ethernet(w, type, pi);
+    default:
+        return (-1);
+    }
+}
+
+
+/**
+ * @brief Peel a GRE header
+ *
+ * @param w The view of the header, moved past it
+ * @param type The protocol of the payload
+ * @param pi The decoded packet, NULL for none
+ * @return int 0 on success, -1 if the header is truncated, not of a tunnel or
+ * its payload unknown
+ */
+static int peel_gre(struct packet_view *w, uint16_t *type,
+                    struct packet_info *pi)
+{
+    const u_char *g = view_pull(w, GRE_HDR_LEN);
+    if (g == NULL)
+        return (-1);
+    uint16_t flags = get16(g);
+    if (flags & GRE_VERSION) // Version 1 carries PPP
+        return (-1);
+    uint32_t opts = (flags & GRE_CSUM ? 4 : 0) + (flags & GRE_KEY ? 4 : 0) +
+                    (flags & GRE_SEQ ? 4 : 0);
+    if (view_skip(w, opts) < 0)
+        return (-1);
+    *type = get16(g + 2);
+    if (!known_payload(*type)) // e.g. ERSPAN or WCCP
+        return (-1);
+    return *type == ETH_P_TEB ? inner_ethernet(w, type, pi) : 0;
+}
+
+
+/**
+ * @brief Peel a VXLAN or GENEVE header
+ *
+ * @param w The view of the UDP header, moved past the tunnel header
+ * @param type The protocol of the payload
+ * @param kind ENCAP_VXLAN or ENCAP_GENEVE, set on success
+ * @param pi The decoded packet, NULL for none
+ * @return int 0 on success, -1 if the datagram is of no tunnel
+ */
+static int peel_udp(struct packet_view *w, uint16_t *type, uint8_t *kind,
+                    struct packet_info *pi)
+{
+    const u_char *u = view_pull(w, 8);
+    if (u == NULL)
+        return (-1);
+    uint16_t dport = get16(u + 2);
+    const u_char *h;
+    if (dport == VXLAN_PORT) {
+        if ((h = view_pull(w, VXLAN_HDR_LEN)) == NULL || !(h[0] & VXLAN_VNI))
+            return (-1);
+        *kind = ENCAP_VXLAN;
+        return inner_ethernet(w, type, pi);
+    }
+    if (dport == GENEVE_PORT) {
+        if ((h = view_pull(w, GENEVE_HDR_LEN)) == NULL || h[0] >> 6 != 0 ||
+            view_skip(w, (h[0] & 0x3f) * 4) < 0) // Version 0, then its options
+            return (-1);
+        *kind = ENCAP_GENEVE;
+        *type = get16(h + 2);
+        if (!known_payload(*type))
+            return (-1);
+        return *type == ETH_P_TEB ? inner_ethernet(w, type, pi) : 0;
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Tell if an IP packet may be of a tunnel
+ *
+ * Most packets aren't, so only the protocol and the UDP port are looked at
+ * before the headers are checked.
+ *
+ * @param v The view of the IP header
+ * @param type The ethertype of the IP header
+ * @return int 1 if the packet may be of a tunnel, 0 otherwise
+ */
+static inline int ip_tunnel(const struct packet_view *v, uint16_t type)
+{
+    const u_char *p = v->ptr;
+    uint32_t off = type == ETHERTYPE_IP ? (p[0] & 0x0f) * 4u : 40;
+    if (v->remaining < (type == ETHERTYPE_IP ? 20 : 40))
+        return 0;
+    uint8_t proto = type == ETHERTYPE_IP ? p[9] : p[6];
+    if (proto == IPPROTO_IPIP || proto == IPPROTO_GRE)
+        return 1;
+    if (proto != IPPROTO_UDP || v->remaining < off + 4)
+        return 0;
+    uint16_t dport = get16(p + off + 2);
+    return dport == VXLAN_PORT || dport == GENEVE_PORT;
+}
+
+
+/**
+ * @brief Peel the IP header of a tunnel and the tunnel header
+ *
+ * The first nibble of the header is trusted to match the ethertype. A
+ * fragment is never peeled: its payload can't be decoded alone.
+ *
+ * @param w The view of the IP header, moved past the tunnel header
+ * @param type The ethertype of the IP header, then of the payload
+ * @param kind The ENCAP_* flag of the tunnel
+ * @param hdr The offset of the tunnel header, of the inner IP header for IP
+ * in IP
+ * @param pi The decoded packet, NULL for none
+ * @return int 0 on success, -1 if the packet isn't of a tunnel
+ */
+static int peel_ip(struct packet_view *w, uint16_t *type, uint8_t *kind,
+                   uint16_t *hdr, struct packet_info *pi)
+{
+    uint8_t proto;
+    if (*type == ETHERTYPE_IP) {
+        const struct iphdr *ip = view_peek(w, sizeof(*ip));
+        if (ip == NULL || ip->ihl < 5 || (ip->protocol != IPPROTO_IPIP &&
+            ip->protocol != IPPROTO_GRE && ip->protocol != IPPROTO_UDP) ||
+            (be16toh(ip->frag_off) & (IP_MF | IP_OFFMASK)) ||
+            view_skip(w, ip->ihl * 4) < 0)
+            return (-1);
+        uint16_t tot_len = be16toh(ip->tot_len);
+        if (tot_len >= ip->ihl * 4)
+            view_limit(w, tot_len - ip->ihl * 4);
+        proto = ip->protocol;
+    } else {
+        const struct ip6_hdr *ip6 = view_peek(w, sizeof(*ip6));
+        if (ip6 == NULL)
+            return (-1);
+        proto = ip6->ip6_nxt;
+        if (proto != IPPROTO_IPIP && proto != IPPROTO_GRE &&
+            proto != IPPROTO_UDP)
+            return (-1);
+        uint16_t plen = be16toh(ip6->ip6_plen);
+        view_skip(w, sizeof(*ip6));
+        if (plen > 0)
+            view_limit(w, plen);
+    }
+
+    *hdr = w->off;
+    switch (proto) {
+    case IPPROTO_IPIP:
+        *kind = ENCAP_IPIP;
+        *type = ETHERTYPE_IP;
+        return view_peek(w, sizeof(struct iphdr)) ? 0 : -1;
+    case IPPROTO_GRE:
+        *kind = ENCAP_GRE;
+        return peel_gre(w, type, pi);
+    default:
+        return peel_udp(w, type, kind, pi);
+    }
+}
+
+
+/**
+ * @brief Peel the encapsulation headers
+ *
+ * Every header is checked before it is peeled; the view is left at the
+ * first one that isn't an encapsulation, or is cut or malformed.
+ * The TCI of the first VLAN tag is kept in pi->vlan, the kinds of headers in
+ * pi->encap.
+ *
+ * @param v The view of the payload of type, moved to the innermost payload
+ * @param type The ethertype of the payload, set to the innermost one
+ * @param pi The decoded packet to record the headers in, NULL for none
+ * @param hops The ENCAP_DEPTH headers peeled, NULL for none
+ * @return int The number of headers peeled
+ *
+ * @see peel_mpls
+ * @see ip_tunnel
+ * @see peel_ip
+ */
+int encap_peel(struct packet_view *v, uint16_t *type, struct packet_info *pi,
+               struct encap_hop *hops)
+{
+    int count = 0;
+    uint8_t seen = 0;
+    while (count < ENCAP_DEPTH) {
+        struct packet_view w = *v;
+        uint16_t next = *type, hdr = v->off, ip = 0;
+        uint8_t kind;
+        const u_char *tag;
+
+        switch (*type) {
+        case ETHERTYPE_VLAN:
+        case ETH_P_8021AD:
+        case ETH_P_QINQ1:
+            if ((tag = view_pull(&w, VLAN_TAG_LEN)) == NULL)
+                return count;
+            kind = seen & ENCAP_VLAN ? ENCAP_QINQ : ENCAP_VLAN;
+            next = get16(tag + 2);
+            if (pi && kind == ENCAP_VLAN)
+                pi->vlan = get16(tag);
+            break;
+        case ETH_P_MPLS_UC:
+        case ETH_P_MPLS_MC:
+            if (peel_mpls(&w, &next, pi) < 0)
+                return count;
+            kind = ENCAP_MPLS;
+            break;
+        case ETHERTYPE_IP:
+        case ETHERTYPE_IPV6:
+            ip = hdr;
+            if (!ip_tunnel(v, *type) || peel_ip(&w, &next, &kind, &hdr, pi) < 0)
+                return count;
+            break;
+        default:
+            return count;
+        }
+
+        if (hops)
+            hops[count] = (struct encap_hop){kind, hdr, ip};
+        if (pi) {
+            pi->encap |= kind;
+            pi->encap_count++;
+            pi->layers |= LAYER_ENCAP;
+        }
+        seen |= kind;
+        *type = next;
+        *v = w;
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * @brief Peel the encapsulation headers then decode the network layer
+ *
+ * The plain IP and ARP packets go straight to their dissector.
+ *
+ * @param v The view of the packet, past the link layer header
+ * @param pi The decoded packet, with its ethertype set
+ * @return int 0 if the payload is well handled, -1 otherwise
+ *
+ * @see encap_peel
+ * @see dissector_ethertype
+ */
+int encap_ethertype(struct packet_view *v, struct packet_info *pi)
+{
+    uint16_t type = pi->ethertype;
+    if (type == ETHERTYPE_IP || type == ETHERTYPE_IPV6 ? ip_tunnel(v, type)
+                                                       : type != ETHERTYPE_ARP) {
+        encap_peel(v, &type, pi, NULL);
+        pi->ethertype = type;
+    }
+    pi->l3_off = v->off;
+    return dissector_ethertype(v, pi);
+}
+
+
+/**
+ * @brief Print the outer addresses of a tunnel
+ *
+ * @param packet The packet
+ * @param off The offset of the outer IP header
+ */
+static void print_endpoints(const u_char *packet, uint16_t off)
+{
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    if (packet[off] >> 4 == 4) {
+        inet_ntop(AF_INET, packet + off + 12, src, sizeof(src));
+        inet_ntop(AF_INET, packet + off + 16, dst, sizeof(dst));
+    } else {
+        inet_ntop(AF_INET6, packet + off + 8, src, sizeof(src));
+        inet_ntop(AF_INET6, packet + off + 24, dst, sizeof(dst));
+    }
+    out_printf(" %s > %s", src, dst);
+}
+
+
+/**
+ * @brief Print the encapsulation headers of a packet on one line
+ *
+ * The headers are found again from the start of the packet, outermost first.
+ *
+ * @param pi The decoded packet, with the LAYER_ENCAP flag
+ * @param packet The packet
+ *
+ * @see encap_peel
+ */
+void encap_print(const struct packet_info *pi, const u_char *packet)
+{
+    struct packet_view v;
+    struct encap_hop hops[ENCAP_DEPTH];
+    uint16_t type;
+    view_init(&v, packet, pi->caplen);
+    if (encap_link(&v, &type) < 0)
+        return;
+    int count = encap_peel(&v, &type, NULL, hops);
+
+    out_puts("ENCAP:");
+    for (int i = 0; i < count; i++) {
+        const u_char *h = packet + hops[i].off;
+        out_puts(i ? "," : "");
+        switch (hops[i].kind) {
+        case ENCAP_VLAN:
+        case ENCAP_QINQ:
+            out_printf(" VLAN %u", get16(h) & 0x0fff);
+            if (get16(h) >> 13)
+                out_printf(" priority %u", get16(h) >> 13);
+            break;
+        case ENCAP_MPLS:
+            out_printf(" MPLS %u ttl %u",
+                       (unsigned)(get16(h) << 4 | h[2] >> 4), h[3]);
+            break;
+        case ENCAP_GRE:
+            out_puts(" GRE");
+            if (get16(h) & GRE_KEY) // After the checksum, if any
+                out_printf(" key %u",
+                           (unsigned)(get16(h + (get16(h) & GRE_CSUM ? 8 : 4)) << 16 |
+                                      get16(h + (get16(h) & GRE_CSUM ? 10 : 6))));
+            print_endpoints(packet, hops[i].ip);
+            break;
+        case ENCAP_VXLAN:
+        case ENCAP_GENEVE:
+            out_printf(" %s %u", hops[i].kind == ENCAP_VXLAN ? "VXLAN" : "GENEVE",
+                       (unsigned)(h[8 + 4] << 16 | h[8 + 5] << 8 | h[8 + 6]));
+            print_endpoints(packet, hops[i].ip);
+            break;
+        default:
+            out_puts(" IPIP");
+            print_endpoints(packet, hops[i].ip);
+        }
+    }
+    if (count == ENCAP_DEPTH)
+        out_puts(", depth limit reached");
+    out_putc('\n');
+}
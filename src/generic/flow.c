@@ -0,0 +1,284 @@
+/**
+ * @author Flavien Lallemant
+ * @file flow.c
+ * @brief Flow key and hash definition
+ *
+ * This file contains the definition of the functions building and hashing
+ * the symmetric 5-tuple of a packet.
+ *
+ * @see flow.h
+ * @see flow_key_pi
+ * @see flow_dir_pi
+ * @see flow_key_packet
+ * @see encap_peel
+ * @see flow_key_set
+ * @see flow_hash
+ * @see flow_shard
+ */
+
+// Global libraries
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <string.h>
+
+// Local header files
+#include "encap.h"
+#include "flow.h"
+#include "ipv6.h"
+
+
+/**
+ * @brief Store the endpoints of a flow in a key
+ *
+ * The lowest endpoint is stored first so both directions give the same key.
+ *
+ * @param key The key to fill, zeroed
+ * @param src The source address
+ * @param dst The destination address
+ * @param len The length of the addresses
+ * @param sport The source port
+ * @param dport The destination port
+ */
+static void set_endpoints(struct flow_key *key, const uint8_t *src,
+                          const uint8_t *dst, size_t len, uint16_t sport,
+                          uint16_t dport)
+{
+    int cmp = memcmp(src, dst, len);
+    if (cmp > 0 || (cmp == 0 && sport > dport)) {
+        const uint8_t *addr = src;
+        src = dst;
+        dst = addr;
+        uint16_t port = sport;
+        sport = dport;
+        dport = port;
+    }
+    memcpy(key->addr[0], src, len);
+    memcpy(key->addr[1], dst, len);
+    key->port[0] = sport;
+    key->port[1] = dport;
+}
+
+
+/**
+ * @brief Build the flow key of a decoded packet
+ *
+ * @param pi The decoded packet
+ * @param key The key to fill
+ * @return int 0 on success, -1 if the packet has no IP layer
+ */
+int flow_key_pi(const struct packet_info *pi, struct flow_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    if (pi->ip_version != 4 && pi->ip_version != 6)
+        return (-1);
+
+    key->ip_version = pi->ip_version;
+    key->proto = pi->ip_proto;
+    uint16_t sport = 0, dport = 0;
+    if (pi->layers & (LAYER_TCP | LAYER_UDP)) {
+        sport = pi->sport;
+        dport = pi->dport;
+    }
+    set_endpoints(key, pi->ip_src, pi->ip_dst, pi->ip_version == 4 ? 4 : 16,
+                  sport, dport);
+    return 0;
+}
+
+
+/**
+ * @brief Get the direction of a decoded packet in its flow
+ *
+ * @param pi The decoded packet, with an IP layer
+ * @return int 0 if the packet is sent by the first endpoint of its key, 1
+ * otherwise
+ */
+int flow_dir_pi(const struct packet_info *pi)
+{
+    int cmp = memcmp(pi->ip_src, pi->ip_dst, pi->ip_version == 4 ? 4 : 16);
+    return cmp > 0 || (cmp == 0 && (pi->layers & (LAYER_TCP | LAYER_UDP)) &&
+                       pi->sport > pi->dport);
+}
+
+
+/**
+ * @brief Read the ports of a TCP or UDP header
+ *
+ * @param l4 The transport header
+ * @param remain The number of captured bytes from the transport header
+ * @param proto The IP protocol
+ * @param sport The source port to fill
+ * @param dport The destination port to fill
+ */
+static void get_ports(const u_char *l4, int64_t remain, uint8_t proto,
+                      uint16_t *sport, uint16_t *dport)
+{
+    *sport = 0;
+    *dport = 0;
+    if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) && remain >= 4) {
+        *sport = (uint16_t)(l4[0] << 8 | l4[1]);
+        *dport = (uint16_t)(l4[2] << 8 | l4[3]);
+    }
+}
+
+
+/**
+ * @brief Build the flow key of a raw IPv6 packet
+ *
+ * The extension headers are skipped as by the decoder, so the protocol and
+ * the ports are the ones flow_key_pi() gives.
+ *
+ * @param ip6 The IPv6 header
+ * @param remain The number of captured bytes from the IPv6 header
+ * @param key The key to fill, zeroed
+ * @return int 0 on success, -1 if the header is truncated
+ */
+static int key_ipv6(const u_char *ip6, int64_t remain, struct flow_key *key)
+{
+    if (remain < (int64_t)sizeof(struct ip6_hdr))
+        return (-1);
+    const struct ip6_hdr *hdr = (const struct ip6_hdr *)ip6;
+    const u_char *p = ip6 + sizeof(struct ip6_hdr);
+    remain -= sizeof(struct ip6_hdr);
+    uint8_t nxt = hdr->ip6_nxt;
+    int64_t len = ipv6_skip_ext(p, remain, &nxt);
+    if (len >= 0 && nxt == IPPROTO_FRAGMENT &&
+        remain - len >= (int64_t)sizeof(struct ip6_frag)) {
+        const struct ip6_frag *f = (const struct ip6_frag *)(p + len);
+        uint16_t offlg = be16toh(f->ip6f_offlg);
+        nxt = f->ip6f_nxt;
+        len += sizeof(struct ip6_frag);
+        int64_t ext = -1; // No ports in a fragment, like for IPv4
+        if ((offlg & ~7) == 0 && !(offlg & 1)) // Atomic fragment
+            ext = ipv6_skip_ext(p + len, remain - len, &nxt);
+        len = ext < 0 ? ext : len + ext;
+    }
+
+    uint16_t sport = 0, dport = 0;
+    key->ip_version = 6;
+    key->proto = nxt;
+    if (len >= 0)
+        get_ports(p + len, remain - len, key->proto, &sport, &dport);
+    set_endpoints(key, (const uint8_t *)&hdr->ip6_src,
+                  (const uint8_t *)&hdr->ip6_dst, 16, sport, dport);
+    return 0;
+}
+
+
+/**
+ * @brief Build the flow key of a raw packet
+ *
+ * Only the link layer, IP and transport headers are read, which is enough to
+ * pick a worker before the packet is decoded. Like the decoder, the key is
+ * the one of the innermost packet of the tunnels. Fragments are keyed by
+ * their addresses only, so every fragment of a datagram gets the same key.
+ *
+ * @param packet The packet, of the link type of encap_set_linktype()
+ * @param caplen The captured length
+ * @param key The key to fill
+ * @return int 0 on success, -1 if the frame has no IP layer
+ */
+int flow_key_packet(const u_char *packet, uint32_t caplen,
+                    struct flow_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    struct packet_view v;
+    uint16_t type;
+    view_init(&v, packet, caplen);
+    if (encap_link(&v, &type) < 0)
+        return (-1);
+    encap_peel(&v, &type, NULL, NULL);
+    const u_char *l3 = v.ptr;
+    int64_t remain = v.remaining;
+
+    if (type == ETHERTYPE_IPV6)
+        return key_ipv6(l3, remain, key);
+    if (type != ETHERTYPE_IP || remain < (int64_t)sizeof(struct iphdr))
+        return (-1);
+
+    const struct iphdr *ip = (const struct iphdr *)l3;
+    int hlen = ip->ihl * 4;
+    if (ip->protocol == IPPROTO_IPV6) // 6in4, keyed like the decoder by the inner header
+        return key_ipv6(l3 + hlen, remain - hlen, key);
+
+    uint16_t sport = 0, dport = 0;
+    key->ip_version = 4;
+    key->proto = ip->protocol;
+    if ((be16toh(ip->frag_off) & (IP_MF | IP_OFFMASK)) == 0)
+        get_ports(l3 + hlen, remain - hlen, key->proto, &sport, &dport);
+    set_endpoints(key, (const uint8_t *)&ip->saddr, (const uint8_t *)&ip->daddr,
+                  4, sport, dport);
+    return 0;
+}
+
+
+/**
+ * @brief Build the flow key of two endpoints
+ *
+ * @param key The key to fill
+ * @param ip_version The IP version, 4 or 6
+ * @param proto The IP protocol
+ * @param src The first address, 4 or 16 bytes
+ * @param dst The second address, 4 or 16 bytes
+ * @param sport The first port, 0 without TCP or UDP
+ * @param dport The second port, 0 without TCP or UDP
+ */
+void flow_key_set(struct flow_key *key, int ip_version, uint8_t proto,
+                  const uint8_t *src, const uint8_t *dst, uint16_t sport,
+                  uint16_t dport)
+{
+    memset(key, 0, sizeof(*key));
+    key->ip_version = ip_version;
+    key->proto = proto;
+    set_endpoints(key, src, dst, ip_version == 4 ? 4 : 16, sport, dport);
+}
+
+
+/**
+ * @brief Hash a flow key
+ *
+ * Each 32-bit word of the key is mixed in as in MurmurHash3.
+ *
+ * @param key The key
+ * @return uint32_t The hash
+ */
+uint32_t flow_hash(const struct flow_key *key)
+{
+    uint32_t words[sizeof(struct flow_key) / 4];
+    memcpy(words, key, sizeof(words));
+
+    uint32_t h = 0x9747b28c;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        uint32_t k = words[i] * 0xcc9e2d51;
+        k = (k << 15) | (k >> 17);
+        h ^= k * 0x1b873593;
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xe6546b64;
+    }
+    h ^= sizeof(words);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+
+/**
+ * @brief Hash the addresses and protocol of a flow key
+ *
+ * The ports are left out, so the fragments of a datagram, keyed without
+ * them, get the same hash as the other packets of their flow.
+ *
+ * @param key The key
+ * @return uint32_t The hash
+ */
+uint32_t flow_shard(const struct flow_key *key)
+{
+    struct flow_key hosts = *key;
+    hosts.port[0] = 0;
+    hosts.port[1] = 0;
+    return flow_hash(&hosts);
+}
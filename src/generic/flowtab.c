@@ -0,0 +1,661 @@
+/**
+ * @author Flavien Lallemant
+ * @file flowtab.c
+ * @brief Flow table definition
+ *
+ * This file contains the definition of the flow table and of its IPFIX
+ * exporter.
+ * The table is an open addressing hash table with linear probing, keyed by
+ * the symmetric flow key: both directions of a connection share a slot, and
+ * each direction has its own counters, exported as its own record. Removed
+ * flows shift the following ones back, so the table never fills with
+ * tombstones.
+ * The records are packed in IPFIX messages of at most FLOWTAB_MSG_MAX bytes,
+ * each starting with the templates, so a collector started late can still
+ * read them.
+ *
+ * @see flowtab.h
+ * @see flowtab_init
+ * @see flowtab_update
+ * @see flowtab_close
+ * @see flowtab_new
+ * @see flowtab_merge
+ */
+
+// Global libraries
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Local header files
+#include "flow.h"
+#include "flowtab.h"
+#include "overload.h"
+
+#define FLOWTAB_MSG_MAX 1400 /**< Size of an IPFIX message, below the Ethernet MTU */
+#define IPFIX_VERSION 10 /**< Version of the IPFIX messages */
+#define IPFIX_DOMAIN 1 /**< Observation domain of the records */
+#define TEMPLATE_SET 2 /**< Set ID of the template sets */
+#define TEMPLATE_V4 256 /**< Template ID of the IPv4 records */
+#define TEMPLATE_V6 257 /**< Template ID of the IPv6 records */
+#define APP_NAME_LEN 8 /**< Bytes of the application name field */
+
+/**
+ * @brief Reason a record is exported, IPFIX flowEndReason values
+ */
+enum end_reason {
+    END_IDLE = 1,   /**< Idle timeout */
+    END_ACTIVE = 2, /**< Export interval of an active flow */
+    END_FLOW = 3,   /**< FIN in both directions, or RST */
+    END_FORCED = 4, /**< Exporter stopped */
+};
+
+/**
+ * @brief IPFIX information element of a template
+ */
+struct field {
+    uint16_t id;    /**< Information element ID */
+    uint16_t len;   /**< Length in the records */
+};
+
+/**
+ * @brief Counters of one direction of a flow since its last export
+ */
+struct flow_counters {
+    uint64_t packets;       /**< Packets */
+    uint64_t bytes;         /**< IP bytes */
+    struct timeval first;   /**< Timestamp of the first packet */
+    struct timeval last;    /**< Timestamp of the last packet */
+    uint16_t flags;         /**< TCP flags seen */
+};
+
+/**
+ * @brief Slot of the flow table
+ */
+struct flow_entry {
+    struct flow_key key;            /**< Flow key */
+    uint32_t hash;                  /**< Hash of the key */
+    uint8_t used;                   /**< 1 if the slot holds a flow */
+    uint8_t app;                    /**< Application protocol, enum app_proto */
+    uint8_t fin;                    /**< Directions a FIN was seen in, one bit each */
+    struct timeval last;            /**< Timestamp of the last packet */
+    struct flow_counters dir[2];    /**< Directions, 0 from the first endpoint of the key */
+};
+
+static const struct field fields_v4[] = {
+    {8, 4},  /* sourceIPv4Address */
+    {12, 4}, /* destinationIPv4Address */
+    {7, 2},  /* sourceTransportPort */
+    {11, 2}, /* destinationTransportPort */
+    {4, 1},  /* protocolIdentifier */
+    {6, 2},  /* tcpControlBits */
+    {1, 8},  /* octetDeltaCount */
+    {2, 8},  /* packetDeltaCount */
+    {152, 8}, /* flowStartMilliseconds */
+    {153, 8}, /* flowEndMilliseconds */
+    {136, 1}, /* flowEndReason */
+    {96, APP_NAME_LEN}, /* applicationName */
+}; /**< Fields of the IPv4 records */
+
+static const struct field fields_v6[] = {
+    {27, 16}, /* sourceIPv6Address */
+    {28, 16}, /* destinationIPv6Address */
+    {7, 2}, {11, 2}, {4, 1}, {6, 2}, {1, 8}, {2, 8}, {152, 8}, {153, 8},
+    {136, 1}, {96, APP_NAME_LEN},
+}; /**< Fields of the IPv6 records, the same after the addresses */
+
+#define FIELD_COUNT (sizeof(fields_v4) / sizeof(fields_v4[0]))
+
+_Static_assert(sizeof(fields_v6) == sizeof(fields_v4),
+               "both templates must have the same fields");
+
+/**
+ * @brief Flow table
+ */
+struct flowtab {
+    struct flow_entry *slots;   /**< The slots, NULL if disabled */
+    uint32_t mask;              /**< Number of slots minus 1 */
+    uint32_t count;             /**< Flows in the table */
+    time_t next_export;         /**< Timestamp of the next export, 0 before the first packet */
+    time_t now;                 /**< Timestamp of the last packet */
+    uint8_t msg[FLOWTAB_MSG_MAX]; /**< Message being filled */
+    size_t msg_len;             /**< Bytes of the message, 0 if none started */
+    size_t set_off;             /**< Offset of the open data set, 0 if none */
+    uint16_t set_id;            /**< Template of the open data set */
+    uint32_t msg_records;       /**< Records in the message */
+    uint64_t flows;             /**< Flows created */
+    uint64_t records;           /**< Records exported */
+    uint64_t dropped;           /**< Packets of flows not tracked, table full */
+};
+
+/**
+ * @brief Exporter state, shared by the tables
+ */
+static struct {
+    int interval;               /**< Seconds between two exports */
+    int timeout;                /**< Idle timeout of a flow in seconds */
+    int fd;                     /**< Destination of the records */
+    uint32_t sequence;          /**< Records exported before the next message */
+    uint64_t messages;          /**< Messages written */
+    uint64_t errors;            /**< Messages not written */
+    pthread_mutex_t lock;       /**< Taken to write a message */
+} ex = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static struct flowtab table; /**< The table fed in capture order */
+static __thread struct flowtab *ft = &table; /**< The table of the calling thread */
+
+
+/**
+ * @brief Write a big endian integer in the message
+ *
+ * @param v The integer
+ * @param len The number of bytes
+ */
+static void put(uint64_t v, int len)
+{
+    for (int i = len - 1; i >= 0; i--) {
+        ft->msg[ft->msg_len + i] = v & 0xff;
+        v >>= 8;
+    }
+    ft->msg_len += len;
+}
+
+
+/**
+ * @brief Write bytes in the message
+ *
+ * @param data The bytes
+ * @param len The number of bytes
+ */
+static void put_bytes(const void *data, size_t len)
+{
+    memcpy(ft->msg + ft->msg_len, data, len);
+    ft->msg_len += len;
+}
+
+
+/**
+ * @brief Open the destination of the records
+ *
+ * @param dest File path, or udp:host:port for a collector
+ * @return int The file descriptor, -1 on error
+ */
+static int dest_open(const char *dest)
+{
+    if (strncmp(dest, "udp:", 4) != 0) {
+        int fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            perror(dest);
+        return fd;
+    }
+
+    char host[256];
+    snprintf(host, sizeof(host), "%s", dest + 4);
+    char *port = strrchr(host, ':');
+    if (port == NULL || port == host) {
+        fprintf(stderr, "Bad collector %s, expected udp:host:port\n", dest);
+        return (-1);
+    }
+    *port++ = '\0';
+    char *name = host;
+    if (name[0] == '[' && port[-2] == ']') { // IPv6 address
+        name++;
+        port[-2] = '\0';
+    }
+
+    struct addrinfo hints = {.ai_socktype = SOCK_DGRAM}, *res;
+    int err = getaddrinfo(name, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "Bad collector %s: %s\n", dest, gai_strerror(err));
+        return (-1);
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        fprintf(stderr, "Couldn't reach collector %s\n", dest);
+    return fd;
+}
+
+
+/**
+ * @brief Allocate the table and open the destination of the records
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int flowtab_init(const struct flowtab_config *cfg)
+{
+    uint32_t slots = 1;
+    while (slots < (cfg->slots ? cfg->slots : FLOWTAB_SLOTS) && slots < (1u << 30))
+        slots <<= 1;
+    ex.interval = cfg->interval > 0 ? cfg->interval : FLOWTAB_INTERVAL;
+    ex.timeout = cfg->timeout > 0 ? cfg->timeout : FLOWTAB_TIMEOUT;
+
+    ex.fd = dest_open(cfg->dest);
+    if (ex.fd < 0)
+        return (-1);
+    table.slots = calloc(slots, sizeof(struct flow_entry));
+    if (table.slots == NULL) {
+        fprintf(stderr, "Error allocating the flow table\n");
+        close(ex.fd);
+        ex.fd = -1;
+        return (-1);
+    }
+    table.mask = slots - 1;
+    return 0;
+}
+
+
+/**
+ * @brief Check if the flow table is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int flowtab_enabled(void)
+{
+    return table.slots != NULL;
+}
+
+
+/**
+ * @brief Start a message with its header and the templates
+ */
+static void msg_begin(void)
+{
+    ft->msg_len = 16; // Header, written once the message is full
+    put(TEMPLATE_SET, 2);
+    put(4 + 2 * (4 + FIELD_COUNT * 4), 2);
+    for (int t = 0; t < 2; t++) {
+        const struct field *fields = t == 0 ? fields_v4 : fields_v6;
+        put(t == 0 ? TEMPLATE_V4 : TEMPLATE_V6, 2);
+        put(FIELD_COUNT, 2);
+        for (size_t i = 0; i < FIELD_COUNT; i++) {
+            put(fields[i].id, 2);
+            put(fields[i].len, 2);
+        }
+    }
+    ft->set_off = 0;
+    ft->msg_records = 0;
+}
+
+
+/**
+ * @brief Close the open data set of the message
+ */
+static void set_close(void)
+{
+    if (ft->set_off == 0)
+        return;
+    size_t len = ft->msg_len - ft->set_off;
+    ft->msg[ft->set_off + 2] = len >> 8;
+    ft->msg[ft->set_off + 3] = len & 0xff;
+    ft->set_off = 0;
+}
+
+
+/**
+ * @brief Write the message to the destination
+ *
+ * The sequence number is taken with the lock, so the messages of the tables
+ * of several threads are numbered in the order they are written.
+ */
+static void msg_flush(void)
+{
+    if (ft->msg_len == 0)
+        return;
+    set_close();
+    size_t len = ft->msg_len;
+    pthread_mutex_lock(&ex.lock);
+    ft->msg_len = 0;
+    put(IPFIX_VERSION, 2);
+    put(len, 2);
+    put((uint32_t)ft->now, 4);
+    put(ex.sequence, 4);
+    put(IPFIX_DOMAIN, 4);
+
+    if (write(ex.fd, ft->msg, len) != (ssize_t)len)
+        ex.errors++;
+    ex.messages++;
+    ex.sequence += ft->msg_records;
+    pthread_mutex_unlock(&ex.lock);
+    ft->msg_len = 0;
+}
+
+
+/**
+ * @brief Export the counters of a direction of a flow and reset them
+ *
+ * @param e The flow
+ * @param d The direction
+ * @param reason The reason of the export, enum end_reason
+ */
+static void record_add(struct flow_entry *e, int d, uint8_t reason)
+{
+    struct flow_counters *c = &e->dir[d];
+    int v6 = e->key.ip_version == 6;
+    size_t alen = v6 ? 16 : 4;
+    size_t rec_len = 2 * alen + 2 + 2 + 1 + 2 + 8 + 8 + 8 + 8 + 1 + APP_NAME_LEN;
+    uint16_t set_id = v6 ? TEMPLATE_V6 : TEMPLATE_V4;
+
+    if (ft->msg_len == 0)
+        msg_begin();
+    if (ft->set_off && ft->set_id != set_id)
+        set_close();
+    if (ft->msg_len + rec_len + (ft->set_off ? 0 : 4) > FLOWTAB_MSG_MAX) {
+        msg_flush();
+        msg_begin();
+    }
+    if (ft->set_off == 0) {
+        ft->set_off = ft->msg_len;
+        ft->set_id = set_id;
+        put(set_id, 2);
+        put(0, 2); // Length, written once the set is closed
+    }
+
+    put_bytes(e->key.addr[d], alen);
+    put_bytes(e->key.addr[!d], alen);
+    put(e->key.port[d], 2);
+    put(e->key.port[!d], 2);
+    put(e->key.proto, 1);
+    put(c->flags, 2);
+    put(c->bytes, 8);
+    put(c->packets, 8);
+    put((uint64_t)c->first.tv_sec * 1000 + c->first.tv_usec / 1000, 8);
+    put((uint64_t)c->last.tv_sec * 1000 + c->last.tv_usec / 1000, 8);
+    put(reason, 1);
+    char name[APP_NAME_LEN] = {0}; // Padded with zeros, full without a '\0'
+    if (e->app != APP_NONE) {
+        const char *app = app_proto_name(e->app);
+        memcpy(name, app, strnlen(app, sizeof(name)));
+    }
+    put_bytes(name, sizeof(name));
+
+    ft->msg_records++;
+    ft->records++;
+    memset(c, 0, sizeof(*c));
+}
+
+
+/**
+ * @brief Export both directions of a flow
+ *
+ * @param e The flow
+ * @param reason The reason of the export, enum end_reason
+ */
+static void flow_export(struct flow_entry *e, uint8_t reason)
+{
+    for (int d = 0; d < 2; d++) {
+        if (e->dir[d].packets > 0)
+            record_add(e, d, reason);
+    }
+}
+
+
+/**
+ * @brief Find the slot of a flow
+ *
+ * @param key The flow key
+ * @param hash The hash of the key
+ * @return uint32_t The slot of the flow, or the free slot to put it in
+ */
+static uint32_t slot_find(const struct flow_key *key, uint32_t hash)
+{
+    uint32_t i = hash & ft->mask;
+    while (ft->slots[i].used && (ft->slots[i].hash != hash ||
+                                 memcmp(&ft->slots[i].key, key, sizeof(*key)) != 0))
+        i = (i + 1) & ft->mask;
+    return i;
+}
+
+
+/**
+ * @brief Free a slot, moving back the flows probed past it
+ *
+ * @param i The slot
+ */
+static void slot_remove(uint32_t i)
+{
+    uint32_t j = i;
+    ft->count--;
+    for (;;) {
+        ft->slots[i].used = 0;
+        for (;;) {
+            j = (j + 1) & ft->mask;
+            if (!ft->slots[j].used)
+                return;
+            uint32_t home = ft->slots[j].hash & ft->mask;
+            // The flow stays if its home slot is in (i, j], with wraparound
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+                continue;
+            break;
+        }
+        ft->slots[i] = ft->slots[j];
+        i = j;
+    }
+}
+
+
+/**
+ * @brief Export every flow, freeing the idle ones
+ */
+static void export_all(void)
+{
+    uint32_t i = 0;
+    while (i <= ft->mask) {
+        struct flow_entry *e = &ft->slots[i];
+        if (!e->used) {
+            i++;
+            continue;
+        }
+        int idle = ft->now - e->last.tv_sec >= ex.timeout;
+        flow_export(e, idle ? END_IDLE : END_ACTIVE);
+        if (idle)
+            slot_remove(i); // Check the flow moved in its place
+        else
+            i++;
+    }
+    msg_flush();
+}
+
+
+/**
+ * @brief Account a decoded packet to its flow
+ *
+ * The flows are exported each time the timestamp of a packet goes past the
+ * end of the interval: the idle ones for the last time, the others with their
+ * counters since the previous export.
+ *
+ * @param pi The decoded packet
+ */
+void flowtab_update(const struct packet_info *pi)
+{
+    if (ft->slots == NULL)
+        return;
+    ft->now = pi->ts.tv_sec;
+    if (ft->next_export == 0) {
+        ft->next_export = ft->now + ex.interval;
+    } else if (ft->now >= ft->next_export) {
+        export_all();
+        ft->next_export = ft->now + ex.interval;
+    }
+
+    struct flow_key key;
+    if (flow_key_pi(pi, &key) < 0)
+        return;
+    uint32_t hash = flow_hash(&key);
+    uint32_t i = slot_find(&key, hash);
+    struct flow_entry *e = &ft->slots[i];
+    if (!e->used) {
+        if (ft->count >= ft->mask - ft->mask / 8) { // Keep the probes short
+            ft->dropped++;
+            return;
+        }
+        memset(e, 0, sizeof(*e));
+        e->key = key;
+        e->hash = hash;
+        e->used = 1;
+        ft->count++;
+        ft->flows++;
+    }
+
+    int d = flow_dir_pi(pi);
+    struct flow_counters *c = &e->dir[d];
+    if (c->packets == 0)
+        c->first = pi->ts;
+    c->packets++;
+    c->bytes += pi->ip_version ? pi->l3_len : pi->len;
+    c->last = pi->ts;
+    e->last = pi->ts;
+    if (pi->app_proto != APP_NONE)
+        e->app = pi->app_proto;
+
+    if (pi->layers & LAYER_TCP) {
+        c->flags |= pi->tcp_flags;
+        if (pi->tcp_flags & TH_FIN)
+            e->fin |= 1 << d;
+        if ((pi->tcp_flags & TH_RST) || e->fin == 3) { // Connection closed
+            flow_export(e, END_FLOW);
+            slot_remove(i);
+        }
+    }
+}
+
+
+/**
+ * @brief Export every flow, close the destination and free the table
+ *
+ * The counters of the table are printed on stderr.
+ */
+void flowtab_close(void)
+{
+    if (table.slots == NULL)
+        return;
+    ft = &table;
+    for (uint32_t i = 0; i <= ft->mask; i++) {
+        if (ft->slots[i].used)
+            flow_export(&ft->slots[i], END_FORCED);
+    }
+    msg_flush();
+    close(ex.fd);
+    ex.fd = -1;
+    free(ft->slots);
+    ft->slots = NULL;
+
+    fprintf(stderr, "Flows: %llu flows, %llu records in %llu messages\n",
+            (unsigned long long)ft->flows, (unsigned long long)ft->records,
+            (unsigned long long)ex.messages);
+    fprintf(stderr, "  %llu packets not tracked, %llu messages not written\n",
+            (unsigned long long)ft->dropped, (unsigned long long)ex.errors);
+    struct overload_mark start = {0};
+    overload_report(stderr, &start);
+}
+
+
+/**
+ * @brief Create an empty table for another thread
+ *
+ * @return struct flowtab* The table, NULL if the flow table is disabled or
+ * on error
+ */
+struct flowtab *flowtab_new(void)
+{
+    if (table.slots == NULL)
+        return NULL;
+    struct flowtab *t = calloc(1, sizeof(struct flowtab));
+    if (t == NULL)
+        return NULL;
+    t->slots = calloc(table.mask + 1, sizeof(struct flow_entry));
+    if (t->slots == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->mask = table.mask;
+    return t;
+}
+
+
+/**
+ * @brief Feed a table from the calling thread
+ *
+ * @param t The table, NULL for the table fed in capture order
+ */
+void flowtab_bind(struct flowtab *t)
+{
+    ft = t ? t : &table;
+}
+
+
+/**
+ * @brief Merge a table in the one fed in capture order and free it
+ *
+ * @param t The table, NULL to do nothing
+ */
+void flowtab_merge(struct flowtab *t)
+{
+    if (t == NULL)
+        return;
+    ft = t; // Its last records go out first
+    msg_flush();
+    ft = &table;
+
+    for (uint32_t i = 0; i <= t->mask; i++) {
+        const struct flow_entry *src = &t->slots[i];
+        if (!src->used)
+            continue;
+        uint32_t j = slot_find(&src->key, src->hash);
+        struct flow_entry *e = &ft->slots[j];
+        if (!e->used) {
+            if (ft->count >= ft->mask - ft->mask / 8) {
+                ft->dropped += src->dir[0].packets + src->dir[1].packets;
+                continue;
+            }
+            *e = *src;
+            ft->count++;
+            continue;
+        }
+
+        t->flows--; // Seen by the table already
+        for (int d = 0; d < 2; d++) {
+            const struct flow_counters *s = &src->dir[d];
+            struct flow_counters *c = &e->dir[d];
+            if (s->packets == 0)
+                continue;
+            if (c->packets == 0 || timercmp(&s->first, &c->first, <))
+                c->first = s->first;
+            if (timercmp(&s->last, &c->last, >))
+                c->last = s->last;
+            c->packets += s->packets;
+            c->bytes += s->bytes;
+            c->flags |= s->flags;
+        }
+        if (timercmp(&src->last, &e->last, >))
+            e->last = src->last;
+        if (e->app == APP_NONE)
+            e->app = src->app;
+        e->fin |= src->fin;
+        if (e->fin == 3) { // Closed by the FIN of the table merged
+            flow_export(e, END_FLOW);
+            slot_remove(j);
+        }
+    }
+    if (t->now > ft->now)
+        ft->now = t->now;
+    ft->flows += t->flows;
+    ft->records += t->records;
+    ft->dropped += t->dropped;
+    free(t->slots);
+    free(t);
+}
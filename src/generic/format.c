@@ -0,0 +1,191 @@
+/**
+ * @author Flavien Lallemant
+ * @file format.c
+ * @brief Address formatting functions definition
+ *
+ * This file contains the definition of the address formatting functions.
+ * The conversions are table driven and write straight into the buffer of the
+ * caller, so no allocation nor sprintf() is done on the decode path.
+ *
+ * @see format.h
+ * @see format_mac
+ * @see format_ipv4
+ * @see format_ipv6
+ */
+
+// Global libraries
+#include <string.h>
+
+// Local header files
+#include "format.h"
+
+static const char hex_upper[] = "0123456789ABCDEF"; /**< Upper case hexadecimal digits */
+static const char hex_lower[] = "0123456789abcdef"; /**< Lower case hexadecimal digits */
+static const char dec_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899"; /**< Two digits decimal representation of 0 to 99 */
+
+
+/**
+ * @brief Write a byte in decimal
+ *
+ * @param p Where to write
+ * @param v The value to write
+ * @return char* The position after the last written digit
+ */
+static char *put_dec8(char *p, uint8_t v)
+{
+    if (v >= 100) {
+        *p++ = '0' + v / 100;
+        v %= 100;
+        memcpy(p, dec_pairs + v * 2, 2);
+        return p + 2;
+    }
+    if (v >= 10) {
+        memcpy(p, dec_pairs + v * 2, 2);
+        return p + 2;
+    }
+    *p++ = '0' + v;
+    return p;
+}
+
+
+/**
+ * @brief Write a 16 bits word in hexadecimal without leading zeros
+ *
+ * @param p Where to write
+ * @param v The value to write
+ * @return char* The position after the last written digit
+ */
+static char *put_hex16(char *p, uint16_t v)
+{
+    int shift = 12;
+    while (shift > 0 && ((v >> shift) & 0xF) == 0)
+        shift -= 4;
+    for (; shift >= 0; shift -= 4)
+        *p++ = hex_lower[(v >> shift) & 0xF];
+    return p;
+}
+
+
+/**
+ * @brief Format a MAC address
+ *
+ * This function formats a MAC address in the format XX:XX:XX:XX:XX:XX.
+ *
+ * @param dst The buffer to write to, at least STR_MAC_ADDR_LEN bytes
+ * @param mac The MAC address to format
+ * @return char* dst
+ */
+char *format_mac(char *dst, const u_char *mac)
+{
+    char *p = dst;
+    for (int i = 0; i < 6; i++) {
+        *p++ = hex_upper[mac[i] >> 4];
+        *p++ = hex_upper[mac[i] & 0xF];
+        *p++ = ':';
+    }
+    p[-1] = '\0';
+    return dst;
+}
+
+
+/**
+ * @brief Format an IPv4 address
+ *
+ * This function formats an IPv4 address in the format A.B.C.D.
+ *
+ * @param dst The buffer to write to, at least STR_IPv4_ADDR_LEN bytes
+ * @param ip_addr The IPv4 address to format, in host byte order
+ * @return char* dst
+ */
+char *format_ipv4(char *dst, uint32_t ip_addr)
+{
+    char *p = dst;
+    p = put_dec8(p, (ip_addr >> 24) & 0xFF);
+    *p++ = '.';
+    p = put_dec8(p, (ip_addr >> 16) & 0xFF);
+    *p++ = '.';
+    p = put_dec8(p, (ip_addr >> 8) & 0xFF);
+    *p++ = '.';
+    p = put_dec8(p, ip_addr & 0xFF);
+    *p = '\0';
+    return dst;
+}
+
+
+/**
+ * @brief Format an IPv6 address
+ *
+ * This function formats an IPv6 address as described in RFC 5952,
+ * the output is the same as inet_ntop().
+ *
+ * @param dst The buffer to write to, at least STR_IPv6_ADDR_LEN bytes
+ * @param ip6 The IPv6 address to format
+ * @return char* dst
+ *
+ * @note The longest run of at least two zero words is compressed to "::".
+ * IPv4-mapped and IPv4-compatible addresses end with a dotted quad.
+ */
+char *format_ipv6(char *dst, const struct in6_addr *ip6)
+{
+    const uint8_t *b = ip6->s6_addr;
+    uint16_t words[8];
+    for (int i = 0; i < 8; i++)
+        words[i] = (uint16_t)(b[2 * i] << 8 | b[2 * i + 1]);
+
+    // Find the longest run of zero words
+    int best_base = -1, best_len = 0;
+    for (int i = 0; i < 8;) {
+        if (words[i] != 0) {
+            i++;
+            continue;
+        }
+        int j = i;
+        while (j < 8 && words[j] == 0)
+            j++;
+        if (j - i > best_len) {
+            best_base = i;
+            best_len = j - i;
+        }
+        i = j;
+    }
+    if (best_len < 2)
+        best_base = -1;
+
+    char *p = dst;
+    for (int i = 0; i < 8; i++) {
+        if (i == best_base) {
+            *p++ = ':';
+            if (i + best_len == 8)
+                *p++ = ':';
+            i += best_len - 1;
+            continue;
+        }
+        if (i != 0)
+            *p++ = ':';
+        // Embedded IPv4 address, as inet_ntop() prints it
+        if (i == 6 && best_base == 0 &&
+            (best_len == 6 || (best_len == 5 && words[5] == 0xffff))) {
+            p = put_dec8(p, b[12]);
+            *p++ = '.';
+            p = put_dec8(p, b[13]);
+            *p++ = '.';
+            p = put_dec8(p, b[14]);
+            *p++ = '.';
+            p = put_dec8(p, b[15]);
+            break;
+        }
+        p = put_hex16(p, words[i]);
+    }
+    *p = '\0';
+    return dst;
+}
@@ -0,0 +1,112 @@
+/**
+ * @author Flavien Lallemant
+ * @file hdrhist.c
+ * @brief Latency histogram definition
+ *
+ * This file contains the definition of the latency histograms.
+ *
+ * @see hdrhist.h
+ * @see hdr_record
+ * @see hdr_percentile
+ * @see hdr_merge
+ */
+
+// Local header files
+#include "hdrhist.h"
+
+
+/**
+ * @brief Get the bucket of a value
+ *
+ * @param v The value
+ * @return unsigned The index of the bucket
+ */
+static unsigned hdr_index(uint32_t v)
+{
+    if (v < 2 * HDR_SUB)
+        return v;
+    unsigned shift = 31 - __builtin_clz(v) - HDR_SUB_BITS; // 1 at least
+    return HDR_SUB * (shift + 1) + (v >> shift) - HDR_SUB;
+}
+
+
+/**
+ * @brief Get the largest value of a bucket
+ *
+ * @param i The index of the bucket
+ * @return uint32_t The largest value
+ */
+static uint32_t hdr_value(unsigned i)
+{
+    if (i < 2 * HDR_SUB)
+        return i;
+    unsigned shift = i / HDR_SUB - 1;
+    uint64_t sub = i % HDR_SUB + HDR_SUB;
+    return (uint32_t)(((sub + 1) << shift) - 1);
+}
+
+
+/**
+ * @brief Record a value
+ *
+ * @param h The histogram
+ * @param value The value, the ones above UINT32_MAX are recorded as UINT32_MAX
+ *
+ * @see hdr_index
+ */
+void hdr_record(struct hdrhist *h, uint64_t value)
+{
+    uint32_t v = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+    h->buckets[hdr_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+
+/**
+ * @brief Get a percentile
+ *
+ * @param h The histogram
+ * @param p The percentile, from 0 to 100
+ * @return uint32_t The largest value of the bucket holding the percentile,
+ * never above the largest value recorded, 0 if the histogram is empty
+ *
+ * @see hdr_value
+ */
+uint32_t hdr_percentile(const struct hdrhist *h, double p)
+{
+    if (h->count == 0)
+        return 0;
+    double r = p / 100.0 * h->count;
+    uint64_t rank = (uint64_t)r;
+    if (rank < r || rank == 0) // Rounded up
+        rank++;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HDR_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint32_t v = hdr_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+/**
+ * @brief Add the values of a histogram to another
+ *
+ * @param dst The histogram added to
+ * @param src The histogram added
+ */
+void hdr_merge(struct hdrhist *dst, const struct hdrhist *src)
+{
+    for (unsigned i = 0; i < HDR_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
@@ -22,6 +22,6 @@
  */
 int helper_function(void)
 {
-    printf("Usage: dumpstalker [ -i interface ] [ -o output ] [ -v verbose ] expression\n");
+    printf("Usage: dumpstalker [ -i interface[,interface...] [ --fanout n[:hash|cpu|lb] ] [ --cpus list ] [ --merge ordered|arrival ] [ --merge-delay ms ] ] [ -w output [ --print ] [ -C million_bytes ] [ -G sec ] [ --dump-sync none|file|buffer ] [ --dump-direct ] [ --dump-buffer kib ] [ --pcapng [ --pcapng-comments ] ] [ --index [ --index-bucket sec ] ] ] [ --from time ] [ --to time ] [ --flow-key proto,addr,port,addr,port ] [ -o text | -o ndjson | -o arrow [ --batch-rows n ] ] [ -v[1|2|3] ] [ -Y display_filter ] [ -d ] [ -F flush_ms ] [ --plugin file.so ] [ -P proto:port[/tcp|/udp] ] [ --port-only ] [ -R [ --reasm-mem mib ] [ --reasm-timeout sec ] ] [ --no-defrag | --defrag-mem mib ] [ --defrag-timeout sec ] [ --flows file|udp:host:port [ --flow-interval sec ] [ --flow-timeout sec ] [ --flow-slots n ] ] [ --dns-latency [ --dns-interval sec ] [ --dns-timeout sec ] [ --dns-slots n ] ] [ --tcp-metrics [ --tcp-flows ] [ --tcp-timeout sec ] [ --tcp-slots n ] ] [ --top n [ --top-interval sec ] [ --top-width n ] ] [ --perf [ --perf-interval sec ] ] [ --overload [ --sample-mode flow|count ] [ --sample-max n ] ] [ -q ] [ --stats-interval sec ] [ -t threads|auto ] [ --ring-slots n ] [ -j jobs|auto ] [ -s snaplen | --headers-only ] [ -b batch ] [ -B buffer_kib ] [ --immediate ] [ --timeout ms ] [ --ring [ --block-size bytes ] [ --frame-count n ] ] expression\n");
     return 0;
 }
\ No newline at end of file
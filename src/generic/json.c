@@ -0,0 +1,587 @@
+/**
+ * @author Flavien Lallemant
+ * @file json.c
+ * @brief JSON packet output definition
+ *
+ * This file contains the definition of the JSON writer and of the NDJSON
+ * renderer.
+ * Each thread writes into its own buffer of JSON_BUFFER bytes: a value first
+ * reserves the most bytes it can take, and the buffer is handed to the
+ * output writer when they are not left, so the values themselves are written
+ * without any check. Long strings are escaped in chunks.
+ * The renderer walks the decoded layers like render_text() does; the DNS
+ * and BOOTP messages are written by their layer.
+ *
+ * @see json.h
+ * @see json_object
+ * @see json_array
+ * @see json_end
+ * @see json_strn
+ * @see json_str
+ * @see json_uint
+ * @see json_bool
+ * @see json_hex
+ * @see json_ipv4
+ * @see json_ipv6
+ * @see json_mac
+ * @see ndjson_init
+ * @see render_ndjson
+ */
+
+// Global libraries
+#include <string.h>
+
+// Local header files
+#include "bootp.h"
+#include "dns.h"
+#include "encap.h"
+#include "format.h"
+#include "ipfrag.h"
+#include "json.h"
+#include "output.h"
+#include "render.h"
+#include "tls.h"
+
+#define JSON_CHUNK 1024 /**< Bytes of a string escaped at once */
+
+static __thread char json_buffer[JSON_BUFFER]; /**< Buffer of the thread */
+static int json_verbose = VERBOSE_COMPLETE; /**< Verbose level of the output */
+
+static const char hex_lower[] = "0123456789abcdef"; /**< Lower case hexadecimal digits */
+
+/**
+ * @brief Escape of each byte in a string
+ *
+ * 0 if the byte is written as is, the character following the backslash
+ * otherwise, u for \u00XX.
+ */
+static const char escapes[256] = {
+    [0 ... 7] = 'u',
+    ['\b'] = 'b',
+    ['\t'] = 't',
+    ['\n'] = 'n',
+    [11] = 'u',
+    ['\f'] = 'f',
+    ['\r'] = 'r',
+    [14 ... 31] = 'u',
+    ['"'] = '"',
+    ['\\'] = '\\',
+    [127 ... 255] = 'u',
+};
+
+
+/**
+ * @brief Make room in the buffer
+ *
+ * The buffer is handed to the output writer if less than len bytes are left.
+ *
+ * @param j The writer
+ * @param len The bytes needed, at most JSON_BUFFER
+ * @return char* Where to write
+ */
+static inline char *json_reserve(struct json *j, size_t len)
+{
+    if (__builtin_expect(j->len + len > JSON_BUFFER, 0)) {
+        out_write(j->buf, j->len);
+        j->len = 0;
+    }
+    return j->buf + j->len;
+}
+
+
+/**
+ * @brief Write the comma and the key before a value
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param len The most bytes the value takes
+ * @return char* Where to write the value
+ */
+static char *json_key(struct json *j, const char *key, size_t len)
+{
+    size_t klen = key ? strlen(key) : 0;
+    char *p = json_reserve(j, klen + len + 4);
+    if (j->comma)
+        *p++ = ',';
+    if (key) {
+        *p++ = '"';
+        memcpy(p, key, klen);
+        p += klen;
+        *p++ = '"';
+        *p++ = ':';
+    }
+    j->comma = 1;
+    return p;
+}
+
+
+/**
+ * @brief Open an object or an array
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array or at the top level
+ * @param open The opening character
+ * @param close The closing character
+ */
+static void json_open(struct json *j, const char *key, char open, char close)
+{
+    char *p = json_key(j, key, 1);
+    *p++ = open;
+    j->len = p - j->buf;
+    if (j->depth < JSON_DEPTH)
+        j->close[j->depth] = close;
+    j->depth++;
+    j->comma = 0;
+}
+
+
+/**
+ * @brief Open an object
+ *
+ * @param j The writer
+ * @param key The key of the object, NULL in an array or at the top level
+ */
+void json_object(struct json *j, const char *key)
+{
+    json_open(j, key, '{', '}');
+}
+
+
+/**
+ * @brief Open an array
+ *
+ * @param j The writer
+ * @param key The key of the array, NULL in an array or at the top level
+ */
+void json_array(struct json *j, const char *key)
+{
+    json_open(j, key, '[', ']');
+}
+
+
+/**
+ * @brief Close the last object or array opened
+ *
+ * @param j The writer
+ */
+void json_end(struct json *j)
+{
+    if (j->depth == 0)
+        return;
+    j->depth--;
+    char *p = json_reserve(j, 1);
+    *p = j->depth < JSON_DEPTH ? j->close[j->depth] : '}';
+    j->len++;
+    j->comma = 1;
+}
+
+
+/**
+ * @brief Escape bytes of a string
+ *
+ * @param p Where to write, 6 bytes per byte escaped
+ * @param s The bytes
+ * @param len The number of bytes
+ * @return char* The position after the last byte written
+ */
+static char *json_escape(char *p, const uint8_t *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char e = escapes[s[i]];
+        if (__builtin_expect(e == 0, 1)) {
+            *p++ = s[i];
+        } else if (e != 'u') {
+            *p++ = '\\';
+            *p++ = e;
+        } else {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex_lower[s[i] >> 4];
+            p[5] = hex_lower[s[i] & 0xF];
+            p += 6;
+        }
+    }
+    return p;
+}
+
+
+/**
+ * @brief Write a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param s The bytes of the string
+ * @param len The number of bytes
+ */
+void json_strn(struct json *j, const char *key, const char *s, size_t len)
+{
+    size_t chunk = len < JSON_CHUNK ? len : JSON_CHUNK;
+    char *p = json_key(j, key, 6 * chunk + 2);
+    *p++ = '"';
+    for (;;) {
+        p = json_escape(p, (const uint8_t *)s, chunk);
+        s += chunk;
+        len -= chunk;
+        if (len == 0)
+            break;
+        chunk = len < JSON_CHUNK ? len : JSON_CHUNK;
+        j->len = p - j->buf;
+        p = json_reserve(j, 6 * chunk + 1);
+    }
+    *p++ = '"';
+    j->len = p - j->buf;
+}
+
+
+/**
+ * @brief Write a null terminated string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param s The string
+ */
+void json_str(struct json *j, const char *key, const char *s)
+{
+    json_strn(j, key, s, strlen(s));
+}
+
+
+/**
+ * @brief Write an unsigned integer in decimal
+ *
+ * @param p Where to write, 20 bytes
+ * @param v The value
+ * @return char* The position after the last digit
+ */
+static char *put_uint(char *p, uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+
+/**
+ * @brief Write an unsigned integer
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param v The value
+ */
+void json_uint(struct json *j, const char *key, uint64_t v)
+{
+    char *p = json_key(j, key, 20);
+    j->len = put_uint(p, v) - j->buf;
+}
+
+
+/**
+ * @brief Write a boolean
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param v The value, true if not 0
+ */
+void json_bool(struct json *j, const char *key, int v)
+{
+    char *p = json_key(j, key, 5);
+    memcpy(p, v ? "true" : "false", v ? 4 : 5);
+    j->len = p + (v ? 4 : 5) - j->buf;
+}
+
+
+/**
+ * @brief Write bytes as a string of hexadecimal digits
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param data The bytes
+ * @param len The number of bytes, at most UINT8_MAX
+ */
+void json_hex(struct json *j, const char *key, const uint8_t *data, size_t len)
+{
+    if (len > UINT8_MAX)
+        len = UINT8_MAX;
+    char *p = json_key(j, key, 2 * len + 2);
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        *p++ = hex_lower[data[i] >> 4];
+        *p++ = hex_lower[data[i] & 0xF];
+    }
+    *p++ = '"';
+    j->len = p - j->buf;
+}
+
+
+/**
+ * @brief Write an IPv4 address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param addr The address, as on the wire
+ */
+void json_ipv4(struct json *j, const char *key, const uint8_t *addr)
+{
+    char str[STR_IPv4_ADDR_LEN];
+    uint32_t ip;
+    memcpy(&ip, addr, 4);
+    json_str(j, key, format_ipv4(str, be32toh(ip)));
+}
+
+
+/**
+ * @brief Write an IPv6 address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param addr The address
+ */
+void json_ipv6(struct json *j, const char *key, const uint8_t *addr)
+{
+    char str[STR_IPv6_ADDR_LEN];
+    struct in6_addr ip6;
+    memcpy(&ip6, addr, 16);
+    json_str(j, key, format_ipv6(str, &ip6));
+}
+
+
+/**
+ * @brief Write a MAC address as a string
+ *
+ * @param j The writer
+ * @param key The key, NULL in an array
+ * @param mac The address
+ */
+void json_mac(struct json *j, const char *key, const uint8_t *mac)
+{
+    char str[STR_MAC_ADDR_LEN];
+    json_str(j, key, format_mac(str, mac));
+}
+
+
+/**
+ * @brief Write the capture timestamp, in seconds with six decimals
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ */
+static void json_ts(struct json *j, const struct packet_info *pi)
+{
+    char *p = json_key(j, "ts", 28);
+    p = put_uint(p, (uint64_t)pi->ts.tv_sec);
+    *p++ = '.';
+    uint32_t usec = (uint32_t)pi->ts.tv_usec % 1000000;
+    for (int i = 5; i >= 0; i--) {
+        p[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    j->len = p + 6 - j->buf;
+}
+
+
+/**
+ * @brief Set the verbose level of the NDJSON output
+ *
+ * @param verbose The verbose level, enum verbosity
+ */
+void ndjson_init(int verbose)
+{
+    json_verbose = verbose;
+}
+
+
+/**
+ * @brief Write the link layer and the encapsulations of a packet
+ *
+ * Past a tunnel carrying Ethernet, the eth object is the inner frame.
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ */
+static void json_link(struct json *j, const struct packet_info *pi)
+{
+    static const char *kinds[] = {"vlan", "qinq", "mpls", "gre", "vxlan",
+                                  "geneve", "ipip"};
+    if ((pi->layers & (LAYER_SLL | LAYER_ETH)) == LAYER_SLL) {
+        json_object(j, "sll");
+        json_mac(j, "src", pi->mac_src);
+        json_uint(j, "type", pi->ethertype);
+        json_end(j);
+    }
+    if (pi->layers & LAYER_ETH) {
+        json_object(j, "eth");
+        json_mac(j, "src", pi->mac_src);
+        json_mac(j, "dst", pi->mac_dst);
+        json_uint(j, "type", pi->ethertype);
+        json_end(j);
+    }
+    if (pi->layers & LAYER_ENCAP) {
+        json_object(j, "encap");
+        if (pi->encap & ENCAP_VLAN)
+            json_uint(j, "vlan", pi->vlan & 0x0fff);
+        json_array(j, "kinds");
+        for (unsigned i = 0; i < sizeof(kinds) / sizeof(*kinds); i++)
+            if (pi->encap & (1 << i))
+                json_str(j, NULL, kinds[i]);
+        json_end(j);
+        json_uint(j, "depth", pi->encap_count);
+        json_end(j);
+    }
+}
+
+
+/**
+ * @brief Write the network layer of a packet
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ */
+static void json_network(struct json *j, const struct packet_info *pi)
+{
+    if (pi->layers & LAYER_ARP) {
+        json_object(j, "arp");
+        json_uint(j, "op", pi->arp_opcode);
+        if (pi->u.arp.ipv4) {
+            json_mac(j, "sha", pi->u.arp.sha);
+            json_ipv4(j, "spa", pi->u.arp.spa);
+            json_mac(j, "tha", pi->u.arp.tha);
+            json_ipv4(j, "tpa", pi->u.arp.tpa);
+        }
+        json_end(j);
+    }
+    if (pi->ip_version == 4 || pi->ip_version == 6) {
+        json_object(j, "ip");
+        json_uint(j, "version", pi->ip_version);
+        if (pi->ip_version == 4) {
+            json_ipv4(j, "src", pi->ip_src);
+            json_ipv4(j, "dst", pi->ip_dst);
+        } else {
+            json_ipv6(j, "src", pi->ip_src);
+            json_ipv6(j, "dst", pi->ip_dst);
+        }
+        json_uint(j, "proto", pi->ip_proto);
+        if (json_verbose >= VERBOSE_COMPLETE) {
+            json_uint(j, "ttl", pi->ip_ttl);
+            json_uint(j, "len", pi->l3_len);
+        }
+        uint16_t frags;
+        if (pi->layers & LAYER_FRAG) {
+            json_object(j, "frag");
+            json_uint(j, "id", pi->frag_id);
+            json_uint(j, "offset", pi->frag_offset);
+            json_bool(j, "more", pi->frag_more);
+            json_end(j);
+        } else if (ipfrag_data(pi, &frags)) {
+            json_object(j, "defrag");
+            json_uint(j, "fragments", frags);
+            json_end(j);
+        }
+        json_end(j);
+    }
+    if (pi->layers & (LAYER_ICMP | LAYER_ICMP6)) {
+        json_object(j, pi->layers & LAYER_ICMP ? "icmp" : "icmp6");
+        json_uint(j, "type", pi->icmp_type);
+        json_uint(j, "code", pi->icmp_code);
+        json_end(j);
+    }
+}
+
+
+/**
+ * @brief Write the transport and application layers of a packet
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ * @param packet The packet
+ *
+ * @see json_dns
+ * @see json_bootp
+ * @see json_tls
+ */
+static void json_transport(struct json *j, const struct packet_info *pi,
+                           const u_char *packet)
+{
+    if (!(pi->layers & (LAYER_TCP | LAYER_UDP)))
+        return;
+    json_object(j, pi->layers & LAYER_TCP ? "tcp" : "udp");
+    json_uint(j, "sport", pi->sport);
+    json_uint(j, "dport", pi->dport);
+    if (pi->layers & LAYER_TCP) {
+        json_uint(j, "flags", pi->tcp_flags);
+        if (json_verbose >= VERBOSE_COMPLETE) {
+            json_uint(j, "seq", pi->tcp_seq);
+            json_uint(j, "ack", pi->tcp_ack);
+        }
+    }
+    if (json_verbose >= VERBOSE_COMPLETE)
+        json_uint(j, "payload", pi->l7_len);
+    json_end(j);
+
+    if (!(pi->layers & LAYER_APP) || json_verbose < VERBOSE_SYNTHETIC)
+        return;
+    json_str(j, "app", app_proto_name(pi->app_proto));
+    const u_char *payload = packet + pi->l7_off;
+    uint32_t len = pi->l7_len;
+    switch (pi->app_proto) {
+    case APP_DNS:
+        if (pi->layers & LAYER_TCP) { // Length of the message first
+            if (len < 2)
+                break;
+            payload += 2;
+            len -= 2;
+        }
+        json_dns(j, payload, len, json_verbose);
+        break;
+    case APP_BOOTP:
+        json_bootp(j, payload, len, json_verbose);
+        break;
+    case APP_HTTPS:
+    case APP_IMAPS:
+        if (pi->u.tls.type == 0)
+            break;
+        payload = tls_payload(pi, packet, &len);
+        json_tls(j, pi, payload, len, json_verbose);
+        break;
+    }
+}
+
+
+/**
+ * @brief Write a decoded packet as a line of JSON
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ *
+ * @see json_link
+ * @see json_network
+ * @see json_transport
+ */
+void render_ndjson(const struct packet_info *pi, const u_char *packet,
+                   unsigned long number)
+{
+    struct json j = {.buf = json_buffer};
+    json_object(&j, NULL);
+    json_uint(&j, "n", number);
+    json_ts(&j, pi);
+    json_uint(&j, "caplen", pi->caplen);
+    json_uint(&j, "len", pi->len);
+    json_link(&j, pi);
+    json_network(&j, pi);
+    json_transport(&j, pi, packet);
+    if ((pi->layers & (LAYER_PLUGIN | LAYER_APP)) == LAYER_PLUGIN &&
+        json_verbose >= VERBOSE_SYNTHETIC) // Below the transport layer
+        json_str(&j, "app", app_proto_name(pi->app_proto));
+    if (pi->layers & LAYER_TRUNCATED)
+        json_bool(&j, "truncated", 1);
+    while (j.depth > 0) // A layer left open
+        json_end(&j);
+    char *p = json_reserve(&j, 1);
+    *p = '\n';
+    out_write(j.buf, j.len + 1);
+}
@@ -8,24 +8,54 @@
  * @see search_devs
  * @see dlt_format
  * @see packet_analyzer
+ * @see stats_analyzer
+ * @see batch_analyzer
+ * @see text_sink
+ * @see stats_sink
  * @see main
  */
 
 // General libraries
 #include <pcap.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
 // Local header files
-#include "ethernet.h"
+#include "alloc.h"
+#include "arena.h"
+#include "capindex.h"
+#include "capture.h"
+#include "chunk.h"
+#include "columnar.h"
+#include "decode.h"
+#include "dfilter.h"
+#include "dispatch.h"
+#include "dissector.h"
+#include "dnsname.h"
+#include "dnstrack.h"
+#include "dumpfile.h"
+#include "encap.h"
+#include "flowtab.h"
+#include "ipfrag.h"
+#include "json.h"
+#include "multicap.h"
+#include "output.h"
+#include "overload.h"
 #include "parser.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "reasm.h"
+#include "render.h"
+#include "stats.h"
+#include "tcpmetrics.h"
+#include "topn.h"
 #include "types.h"
 
-#define PCAP_SNAPLEN 65535 /**< Maximum number of bytes to capture per packet */
-
 
 /**
  * @brief Search for devices and ask the user to choose one
@@ -80,67 +110,91 @@ int search_devs(char *errbuf, pcap_if_t **alldevs, pcap_if_t **dest, char *name)
  * 
  * @param dlt The DLT to format
  * 
- * @return The formatted DLT
+ * @return The formatted DLT, a static string
  */
-char *dlt_format(int dlt)
+const char *dlt_format(int dlt)
 {
-    char *res = malloc(8 * sizeof(char));
-    if (res == NULL)
-        return NULL;
-
     switch (dlt) {
     case DLT_NULL:
-        sprintf(res, "NULL");
-        break;
+        return "NULL";
     case DLT_EN10MB:
-        sprintf(res, "EN10MB");
-        break;
+        return "EN10MB";
     case DLT_EN3MB:
-        sprintf(res, "EN3MB");
-        break;
+        return "EN3MB";
     case DLT_AX25:
-        sprintf(res, "AX25");
-        break;
+        return "AX25";
     case DLT_PRONET:
-        sprintf(res, "PRONET");
-        break;
+        return "PRONET";
     case DLT_CHAOS:
-        sprintf(res, "CHAOS");
-        break;
+        return "CHAOS";
     case DLT_IEEE802:
-        sprintf(res, "IEEE802");
-        break;
+        return "IEEE802";
     case DLT_ARCNET:
-        sprintf(res, "ARCNET");
-        break;
+        return "ARCNET";
     case DLT_SLIP:
-        sprintf(res, "SLIP");
-        break;
+        return "SLIP";
     case DLT_PPP:
-        sprintf(res, "PPP");
-        break;
+        return "PPP";
     case DLT_FDDI:
-        sprintf(res, "FDDI");
-        break;
+        return "FDDI";
+    case DLT_RAW:
+        return "RAW";
+    case DLT_LINUX_SLL:
+        return "LINUX_SLL";
+    case DLT_LINUX_SLL2:
+        return "LINUX_SLL2";
+    case DLT_IPV4:
+        return "IPV4";
+    case DLT_IPV6:
+        return "IPV6";
+    default:
+        return "UNKNOWN";
     }
-    return res;
 }
 
 
-#define NB_COLORS 6
 static long unsigned int compteur = 0;
-static char *colors[NB_COLORS] = {"\033[1;31m", "\033[1;32m", "\033[1;33m", "\033[1;34m", "\033[1;35m", "\033[1;36m"};
+static renderer_t renderer = render_text; /**< The renderer of -o */
+static struct capture *capture = NULL; /**< The handle the loop runs on */
+static struct multicap *sources = NULL; /**< The sources the loop runs on, NULL for one */
+
+
+/**
+ * @brief Account a decoded packet to the trackers
+ * 
+ * The trackers keep state across packets, so they are fed in capture order.
+ * 
+ * @param pi The decoded packet
+ * 
+ * @see flowtab_update
+ * @see dnstrack_update
+ * @see tcpmetrics_update
+ * @see topn_update
+ */
+static void account_packet(const struct packet_info *pi)
+{
+    uint64_t start = perf_begin(PERF_TRACK);
+    flowtab_update(pi);
+    dnstrack_update(pi);
+    tcpmetrics_update(pi);
+    topn_update(pi);
+    perf_end(PERF_TRACK, start);
+}
 
 /**
  * @brief Analyze a packet
  * 
- * This function analyzes a packet.
+ * This function decodes a packet, accounts it to its flow, then prints it.
  * 
  * @param args The arguments
  * @param header The packet header
  * @param packet The packet
  * 
- * @see cast_ethernet
+ * @see decode_packet
+ * @see account_packet
+ * @see render_text
+ * @see render_columnar
+ * @see render_ndjson
  */
 void packet_analyzer(u_char *args, const struct pcap_pkthdr *header,
                      const u_char *packet)
@@ -148,31 +202,518 @@ void packet_analyzer(u_char *args, const struct pcap_pkthdr *header,
     if (args) {
         ;
     }
-    printf("%s", colors[++compteur % NB_COLORS]);
+    struct packet_info pi;
+    ++compteur; // Filtered packets keep their number
+    if (decode_packet(header->ts, header->caplen, header->len, packet, &pi) ==
+        DECODE_FILTERED)
+        return;
+    account_packet(&pi);
+    uint64_t start = perf_begin(PERF_RENDER);
+    renderer(&pi, decode_data(&pi, packet), compteur);
+    perf_end(PERF_RENDER, start);
+    out_packet_done();
+}
 
-    printf("┌───────────────────────────────────────────────┐\n");
-    printf("│\t\tPacket n°%ld\t\t\t│\n", compteur);
-    printf("└───────────────────────────────────────────────┘\n");
-    struct timeval tv = header->ts;
-    time_t sec = tv.tv_sec;
-    suseconds_t usec = tv.tv_usec;
 
-    struct tm *timeinfo = localtime(&sec);
-    if (timeinfo == NULL) {
-        perror("localtime");
-        return;
+static struct stats interval_stats; /**< Counters of the current interval */
+static struct stats total_stats; /**< Counters of the previous intervals */
+static struct overload_mark interval_mark; /**< Sampling counters at the previous interval */
+
+/**
+ * @brief Print the counters of the interval if it is over
+ * 
+ * @param interval The statistics interval in seconds
+ * @param now The current time in seconds
+ * 
+ * @see stats_print
+ * @see overload_report
+ */
+static void stats_tick(int interval, time_t now)
+{
+    if (interval > 0 && interval_stats.total.packets > 0 &&
+        now - interval_stats.first.tv_sec >= interval) {
+        char title[64];
+        struct tm tm;
+        time_t sec = interval_stats.first.tv_sec;
+        strftime(title, sizeof(title), "%Y-%m-%d %H:%M:%S",
+                 localtime_r(&sec, &tm));
+        stats_print(stdout, &interval_stats, title, interval);
+        overload_report(stdout, &interval_mark);
+        stats_merge(&total_stats, &interval_stats);
+        memset(&interval_stats, 0, sizeof(interval_stats));
+        fflush(stdout);
     }
+}
+
+
+/**
+ * @brief Count a decoded packet
+ * 
+ * The counters of the interval are printed each time the timestamp of a packet
+ * goes past the end of the interval.
+ * 
+ * @param interval The statistics interval in seconds
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ * 
+ * @see stats_tick
+ * @see stats_update
+ */
+static void stats_count(int interval, const struct packet_info *pi, int status)
+{
+    stats_tick(interval, pi->ts.tv_sec);
+    stats_update(&interval_stats, pi, status);
+}
 
-    char time_str[64];
-    if (strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo) ==
-        0) {
-        fprintf(stderr, "strftime failed\n");
+
+/**
+ * @brief Count a packet
+ * 
+ * This function decodes a packet and only updates the protocol counters.
+ * 
+ * @param args The statistics interval in seconds
+ * @param header The packet header
+ * @param packet The packet
+ * 
+ * @see decode_packet
+ * @see account_packet
+ * @see stats_count
+ */
+void stats_analyzer(u_char *args, const struct pcap_pkthdr *header,
+                    const u_char *packet)
+{
+    struct packet_info pi;
+    int status = decode_packet(header->ts, header->caplen, header->len, packet,
+                               &pi);
+    if (status == DECODE_FILTERED)
         return;
+    account_packet(&pi);
+    stats_count(*(int *)args, &pi, status);
+}
+
+
+/**
+ * @brief Per-packet function a batch is given to
+ */
+struct batch_target {
+    pcap_handler analyzer;  /**< The function called for each packet */
+    u_char *args;           /**< Its first argument */
+};
+
+/**
+ * @brief Output file written along the analysis
+ */
+struct dump_target {
+    struct dumpfile *file;          /**< The output file, NULL if none */
+    struct capindex_writer *index;  /**< Its index, NULL if none */
+    pcap_handler analyzer;          /**< The function called next for each packet, NULL if none */
+    u_char *args;                   /**< Its first argument */
+};
+
+static struct dump_target dump; /**< The output file of -w */
+static const char *dump_interfaces[PARSER_INTERFACES]; /**< The interfaces of its pcapng headers */
+
+/**
+ * @brief Per-packet function timed by the performance counters
+ */
+struct perf_target {
+    pcap_handler analyzer;  /**< The function called next for each packet, NULL if none */
+    u_char *args;           /**< Its first argument */
+};
+
+static struct perf_target perf; /**< The analyzer timed by --perf */
+
+/**
+ * @brief Per-packet function the overload controller samples for
+ */
+struct overload_target {
+    pcap_handler analyzer;  /**< The function called next for each packet decoded */
+    u_char *args;           /**< Its first argument */
+};
+
+static struct overload_target shed; /**< The analyzer sampled by --overload */
+
+
+/**
+ * @brief Analyze a batch of packets
+ * 
+ * This function gives each packet of the batch to the per-packet analyzer,
+ * after prefetching the headers of the next one so they are in the cache
+ * once its turn comes.
+ * 
+ * @param args The batch target
+ * @param pkts The packets
+ * @param n The number of packets
+ * 
+ * @see packet_analyzer
+ * @see stats_analyzer
+ * @see pipeline_submit
+ */
+void batch_analyzer(u_char *args, const struct capture_packet *pkts, int n)
+{
+    const struct batch_target *t = (const struct batch_target *)args;
+    for (int i = 0; i < n; i++) {
+        if (i + 1 < n) {
+            __builtin_prefetch(pkts[i + 1].data);
+            __builtin_prefetch(pkts[i + 1].data + 64);
+        }
+        capture_set_nsec(&pkts[i].header, pkts[i].nsec);
+        t->analyzer(t->args, &pkts[i].header, pkts[i].data);
     }
+}
 
-    printf("%s.%06ld\n", time_str, (long)usec);
-    cast_ethernet(packet);
-    printf("\033[0m\n");
+
+/**
+ * @brief Write a packet to the output file, then analyze it
+ * 
+ * The packets of several sources are written with the interface of their
+ * source.
+ * 
+ * @param args The output file
+ * @param header The packet header
+ * @param packet The packet
+ * 
+ * @see dumpfile_write
+ * @see capindex_add
+ */
+static void dump_analyzer(u_char *args, const struct pcap_pkthdr *header,
+                          const u_char *packet)
+{
+    const struct dump_target *t = (const struct dump_target *)args;
+    unsigned long long offset = dumpfile_offset(t->file);
+    int interface = sources ? sources->sources[sources->current].ifindex : 0;
+    if (dumpfile_write(t->file, header, capture_nsec(header), packet,
+                       interface) == 0 && t->index)
+        capindex_add(t->index, header, packet, (long)offset);
+    if (t->analyzer)
+        t->analyzer(t->args, header, packet);
+}
+
+
+/**
+ * @brief Time the analysis of a packet
+ * 
+ * The report asked by SIGUSR1 or the interval timer is printed first, from
+ * the capture thread so the kernel counters are read between two reads of
+ * the handle.
+ * 
+ * @param args The timed analyzer
+ * @param header The packet header
+ * @param packet The packet
+ * 
+ * @see perf_report
+ */
+static void perf_analyzer(u_char *args, const struct pcap_pkthdr *header,
+                          const u_char *packet)
+{
+    const struct perf_target *t = (const struct perf_target *)args;
+    if (perf_requested) {
+        char title[64];
+        struct tm tm;
+        time_t sec = header->ts.tv_sec;
+        strftime(title, sizeof(title), "%Y-%m-%d %H:%M:%S",
+                 localtime_r(&sec, &tm));
+        perf_report(stderr, capture, title);
+        struct overload_mark start = {0};
+        overload_report(stderr, &start);
+        if (sources)
+            multicap_print_stats(sources, stderr);
+    }
+    uint64_t start = perf_begin(PERF_PACKET);
+    if (t->analyzer)
+        t->analyzer(t->args, header, packet);
+    perf_end(PERF_PACKET, start);
+}
+
+
+/**
+ * @brief Analyze a packet, unless the overload controller skips it
+ * 
+ * @param args The sampled analyzer
+ * @param header The packet header
+ * @param packet The packet
+ * 
+ * @see overload_admit
+ */
+static void overload_analyzer(u_char *args, const struct pcap_pkthdr *header,
+                              const u_char *packet)
+{
+    const struct overload_target *t = (const struct overload_target *)args;
+    if (overload_admit(header, packet))
+        t->analyzer(t->args, header, packet);
+}
+
+
+/**
+ * @brief Open the output file, and its index if asked
+ * 
+ * @param cap The handle
+ * @param args The arguments
+ * @return int 0 on success, -1 on error
+ */
+static int dump_open(struct capture *cap, const struct arguments *args)
+{
+    if (args->index && (args->rotate_size || args->rotate_seconds)) {
+        fprintf(stderr, "--index can't be used with -C or -G\n");
+        return (-1);
+    }
+    if (args->index && args->pcapng) {
+        fprintf(stderr, "--index needs a pcap output file, not --pcapng\n");
+        return (-1);
+    }
+    int interface_count = args->fileInput ? 0 : args->interface_count;
+    for (int i = 0; i < interface_count; i++)
+        dump_interfaces[i] = args->interfaces[i];
+    struct dumpfile_config cfg = {
+        .path = args->fileOutput,
+        .linktype = pcap_datalink(cap->pcap),
+        .snaplen = pcap_snapshot(cap->pcap),
+        .size = args->rotate_size,
+        .seconds = args->rotate_seconds,
+        .sync = args->dump_sync,
+        .direct = args->dump_direct,
+        .buffer = args->dump_buffer > 0 ? (size_t)args->dump_buffer * 1024 : 0,
+        .live = args->fileInput == NULL,
+        .format = args->pcapng ? DUMPFILE_PCAPNG : DUMPFILE_PCAP,
+        .interfaces = interface_count ? dump_interfaces : NULL,
+        .interface_count = interface_count,
+        .comments = args->pcapng_comments,
+    };
+    dump.file = dumpfile_open(&cfg);
+    if (dump.file == NULL)
+        return (-1);
+    if (args->index) {
+        dump.index = capindex_create(args->fileOutput, cfg.linktype,
+                                     args->index_bucket);
+        if (dump.index == NULL) {
+            dumpfile_close(dump.file);
+            dump.file = NULL;
+            return (-1);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Close the output file, and write its index
+ * 
+ * @see dumpfile_close
+ * @see capindex_close
+ */
+static void dump_close(void)
+{
+    long size = (long)dumpfile_offset(dump.file);
+    if (dumpfile_close(dump.file) < 0)
+        size = -1; // The index would not match the file
+    if (dump.index)
+        capindex_close(dump.index, size);
+    dump.file = NULL;
+    dump.index = NULL;
+}
+
+
+/**
+ * @brief Read packets one at a time or by batches
+ * 
+ * The packets are written to the output file first, if there is one, and
+ * timed with --perf. The overload controller only samples the analysis, every
+ * packet is written. The packets of several sources are merged one at a
+ * time.
+ * 
+ * @param cap The handle
+ * @param args The arguments
+ * @param analyzer The function called for each packet, NULL to only write
+ * them to the output file
+ * @param user The first argument of the analyzer
+ * @return int The value returned by the capture loop
+ * 
+ * @see capture_loop
+ * @see capture_loop_batch
+ * @see multicap_loop
+ */
+static int analyze_loop(struct capture *cap, const struct arguments *args,
+                        pcap_handler analyzer, u_char *user)
+{
+    if (analyzer && overload_enabled()) {
+        shed.analyzer = analyzer;
+        shed.args = user;
+        analyzer = overload_analyzer;
+        user = (u_char *)&shed;
+    }
+    if (dump.file) {
+        dump.analyzer = analyzer;
+        dump.args = user;
+        analyzer = dump_analyzer;
+        user = (u_char *)&dump;
+    }
+    if (args->perf) {
+        perf.analyzer = analyzer;
+        perf.args = user;
+        analyzer = perf_analyzer;
+        user = (u_char *)&perf;
+    }
+    if (sources)
+        return multicap_loop(sources, args->count, analyzer, user);
+    if (args->batch <= 0)
+        return capture_loop(cap, args->count, analyzer, user);
+    struct batch_target t = {analyzer, user};
+    return capture_loop_batch(cap, args->count, args->batch, batch_analyzer,
+                              (u_char *)&t);
+}
+
+
+/**
+ * @brief Limit the input file to a time range or a flow
+ * 
+ * @param cap The handle
+ * @param args The arguments
+ * @return int 0 on success, -1 on error
+ * 
+ * @see capindex_select
+ */
+static int select_input(struct capture *cap, const struct arguments *args)
+{
+    struct capindex_query q;
+    memset(&q, 0, sizeof(q));
+    if ((args->from && capindex_parse_time(args->from, &q.from) < 0) ||
+        (args->to && capindex_parse_time(args->to, &q.to) < 0)) {
+        fprintf(stderr, "Invalid time, expected seconds or YYYY-MM-DD HH:MM:SS\n");
+        return (-1);
+    }
+    if (args->flow_key) {
+        if (capindex_parse_flow(args->flow_key, &q.flow) < 0) {
+            fprintf(stderr, "Invalid flow %s, expected proto,address,port,address,port\n",
+                    args->flow_key);
+            return (-1);
+        }
+        q.has_flow = 1;
+    }
+    if (cap->file == NULL) {
+        fprintf(stderr, "--from, --to and --flow-key need a regular capture file\n");
+        return (-1);
+    }
+    return capindex_select(cap->file, args->fileInput, &q);
+}
+
+
+/**
+ * @brief Write a packet rendered by the pipeline
+ * 
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ * @param packet The packet
+ * @param text The rendered packet
+ * @param arg Unused
+ */
+static void text_sink(const struct packet_info *pi, int status,
+                      const u_char *packet, const struct outbuf *text,
+                      void *arg)
+{
+    (void)status;
+    (void)packet;
+    (void)arg;
+    account_packet(pi);
+    out_write(text->data, text->len);
+    out_packet_done();
+}
+
+
+/**
+ * @brief Count a packet decoded by the pipeline
+ * 
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ * @param packet The packet
+ * @param text Unused
+ * @param arg The statistics interval in seconds
+ */
+static void stats_sink(const struct packet_info *pi, int status,
+                       const u_char *packet, const struct outbuf *text,
+                       void *arg)
+{
+    (void)packet;
+    (void)text;
+    account_packet(pi);
+    stats_count(*(int *)arg, pi, status);
+}
+
+
+/**
+ * @brief Add a packet decoded by the pipeline to the Arrow stream
+ * 
+ * The rows are added by the output thread, in capture order.
+ * 
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ * @param packet The packet
+ * @param text Unused
+ * @param arg Unused
+ */
+static void columnar_sink(const struct packet_info *pi, int status,
+                          const u_char *packet, const struct outbuf *text,
+                          void *arg)
+{
+    (void)status;
+    (void)text;
+    (void)arg;
+    account_packet(pi);
+    uint64_t start = perf_begin(PERF_RENDER);
+    render_columnar(pi, packet, 0);
+    perf_end(PERF_RENDER, start);
+    out_packet_done();
+}
+
+
+/**
+ * @brief Write what waits for the next packet while the capture is idle
+ * 
+ * This function is called by the thread writing the output, when the read
+ * timeout expires without a packet. The statistics of an interval that ended
+ * since the last packet are printed on the clock of the host.
+ * 
+ * @param args The statistics interval in seconds
+ * 
+ * @see out_idle
+ * @see topn_idle
+ * @see stats_tick
+ */
+static void idle_analyzer(u_char *args)
+{
+    out_idle();
+    topn_idle();
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    stats_tick(*(int *)args, now.tv_sec);
+}
+
+
+/**
+ * @brief Write what waits for the next packet while the pipeline is idle
+ * 
+ * @param arg The statistics interval in seconds
+ * 
+ * @see idle_analyzer
+ */
+static void idle_sink(void *arg)
+{
+    idle_analyzer(arg);
+}
+
+
+/**
+ * @brief Stop the capture loop
+ * 
+ * @param sig The signal received
+ */
+static void stop_capture(int sig)
+{
+    (void)sig;
+    if (capture)
+        capture_breakloop(capture);
+    if (sources)
+        multicap_breakloop(sources);
+    chunk_stop();
 }
 
 
@@ -196,6 +737,9 @@ int main(int argc, char **argv)
 {
     struct arguments *args = calloc(1, sizeof(struct arguments));
 
+    // The default port mappings must be loaded before the overrides are parsed
+    dispatch_init();
+
     switch (parse_args(argc, argv, args)) {
     case -1:
         fprintf(stderr, "Error parsing arguments\n");
@@ -205,12 +749,96 @@ int main(int argc, char **argv)
         free(args);
         return 0;
     }
+    if (args->format == FORMAT_ARROW)
+        renderer = render_columnar;
+    if (args->format == FORMAT_NDJSON)
+        renderer = render_ndjson;
+    render_init(args->verbose);
+    ndjson_init(args->verbose);
+    struct dfilter *display = NULL;
+    if (args->display_filter) {
+        display = dfilter_compile(args->display_filter);
+        if (display == NULL) {
+            free(args);
+            return (1);
+        }
+        decode_set_filter(display);
+    }
+    // The application protocols aren't printed in one line, nothing else needs them
+    if (args->verbose == VERBOSE_CONCISE && args->format != FORMAT_ARROW &&
+        !args->stats && !args->reassemble && !args->flow_dest &&
+        !args->dns_latency)
+        decode_set_depth(DECODE_TRANSPORT);
+    if (args->snaplen < 0) // Headers only, once every port mapping is known
+        args->snaplen = decode_headers_snaplen();
+    if (args->reassemble) {
+        struct reasm_config reasm = {
+            .memory = args->reasm_memory > 0 ? (size_t)args->reasm_memory << 20 : 0,
+            .timeout = args->reasm_timeout,
+        };
+        reasm_init(&reasm);
+    }
+    if (!args->no_defrag) {
+        struct ipfrag_config defrag = {
+            .memory = args->defrag_memory > 0 ? (size_t)args->defrag_memory << 20 : 0,
+            .timeout = args->defrag_timeout,
+        };
+        ipfrag_init(&defrag);
+    }
+    if (args->flow_dest) {
+        struct flowtab_config flows = {
+            .dest = args->flow_dest,
+            .slots = args->flow_slots,
+            .interval = args->flow_interval,
+            .timeout = args->flow_timeout,
+        };
+        if (flowtab_init(&flows) < 0) {
+            free(args);
+            return (1);
+        }
+    }
+    if (args->dns_latency) {
+        struct dnstrack_config dns = {
+            .slots = args->dns_slots,
+            .interval = args->dns_interval,
+            .timeout = args->dns_timeout,
+        };
+        if (dnstrack_init(&dns) < 0) {
+            free(args);
+            return (1);
+        }
+    }
+    if (args->perf && perf_init(args->perf_interval) < 0) {
+        free(args);
+        return (1);
+    }
+    if (args->tcp_metrics) {
+        struct tcpmetrics_config tcp = {
+            .slots = args->tcp_slots,
+            .timeout = args->tcp_timeout,
+            .flows = args->tcp_flows,
+        };
+        if (tcpmetrics_init(&tcp) < 0) {
+            free(args);
+            return (1);
+        }
+    }
+    if (args->top_rows) {
+        struct topn_config top = {
+            .rows = args->top_rows,
+            .interval = args->top_interval,
+            .width = args->top_width,
+        };
+        if (topn_init(&top) < 0) {
+            free(args);
+            return (1);
+        }
+    }
 
     char errbuf[PCAP_ERRBUF_SIZE];
-    pcap_t *handle;
-    pcap_dumper_t *dumper;
+    struct capture *handle;
     if (args->fileInput) { // Open the file in offline mode
-        handle = pcap_open_offline(args->fileInput, errbuf);
+        handle = capture_open_offline(args->fileInput, args->snaplen, errbuf);
         if (handle == NULL) {
             fprintf(stderr, "Error opening input file: %s\n", errbuf);
             return (1);
@@ -226,17 +854,43 @@ int main(int argc, char **argv)
             }
             // Free the list of devices
             pcap_freealldevs(alldevs);
-            handle =
-                pcap_open_live(args->interface, PCAP_SNAPLEN, 1, 1000, errbuf);
-            if (handle == NULL) {
-                fprintf(stderr, "Couldn't open device %s: %s\n",
-                        args->interface, errbuf);
+            memcpy(args->interfaces[0], args->interface, sizeof(args->interface));
+            args->interface_count = 1;
+        }
+        struct capture_config cfg = {
+            .interface = args->interface,
+            .snaplen = args->snaplen,
+            .promisc = 1,
+            .timeout = args->timeout,
+            .buffer_size = args->buffer_size,
+            .immediate = args->immediate,
+            .ring = args->ring,
+            .block_size = args->block_size,
+            .frame_count = args->frame_count,
+        };
+        if (args->interface_count > 1 || args->fanout > 1) {
+            const char *interfaces[PARSER_INTERFACES];
+            for (int i = 0; i < args->interface_count; i++)
+                interfaces[i] = args->interfaces[i];
+            struct multicap_config sc = {
+                .interfaces = interfaces,
+                .interface_count = args->interface_count,
+                .fanout = args->fanout,
+                .fanout_mode = args->fanout_mode,
+                .cpus = args->cpus,
+                .cpu_count = args->cpu_count,
+                .merge = args->merge,
+                .delay = args->merge_delay,
+            };
+            sources = multicap_open(&sc, &cfg, errbuf);
+            if (sources == NULL) {
+                fprintf(stderr, "Couldn't open the sources: %s\n", errbuf);
                 free(args);
                 return (2);
             }
-        } else { // If an interface is provided by user, open it in live mode
-            handle =
-                pcap_open_live(args->interface, PCAP_SNAPLEN, 1, 1000, errbuf);
+            handle = sources->sources[0].cap; // Link type and snapshot length of all
+        } else {
+            handle = capture_open_live(&cfg, errbuf);
             if (handle == NULL) {
                 fprintf(stderr, "Couldn't open device %s: %s\n",
                         args->interface, errbuf);
@@ -246,61 +900,241 @@ int main(int argc, char **argv)
         }
     }
 
-    // Check if the device provides Ethernet headers
-    if (pcap_datalink(handle) != DLT_EN10MB) {
-        fprintf(stderr,
-                "Device %s doesn't provide Ethernet headers - not supported\n",
-                args->interface);
+    // Check if the link layer of the device is decoded
+    if (decode_set_linktype(pcap_datalink(handle->pcap)) < 0) {
+        fprintf(stderr, "Link type %s (%d) of %s not supported\n",
+                dlt_format(pcap_datalink(handle->pcap)),
+                pcap_datalink(handle->pcap),
+                args->fileInput ? args->fileInput : args->interface);
         free(args);
         return (2);
     }
 
     // Print the device information if one have been opened in live mode
     if (!args->fileInput) {
-        char *dlt = dlt_format(pcap_datalink(handle));
-        printf("Listening on %s, link-type %s, snapshot length %d bytes\n",
-               args->interface, dlt, PCAP_SNAPLEN);
+        const char *dlt = dlt_format(pcap_datalink(handle->pcap));
+        printf("Listening on %s", args->interface);
+        for (int i = 1; i < args->interface_count; i++)
+            printf(", %s", args->interfaces[i]);
+        if (sources)
+            printf(" (%d sources, %s)", sources->count,
+                   sources->merge == MULTICAP_ARRIVAL ? "merged as they arrive"
+                                                      : "merged in time order");
+        printf(", link-type %s, snapshot length %d bytes%s\n", dlt,
+               handle->snaplen, args->ring ? ", TPACKET_V3 ring" : "");
     }
 
-    struct bpf_program filter;
-    bpf_u_int32 subnet_mask, ip = 0;
+    bpf_u_int32 subnet_mask = PCAP_NETMASK_UNKNOWN, ip;
 
-    // Get the subnet mask and IP of the device if one have been opened in live mode
-    if (!args->fileInput &&
+    // Get the subnet mask of the device if one have been opened in live mode
+    if (!args->fileInput && !sources &&
         pcap_lookupnet(args->interface, &ip, &subnet_mask, errbuf)) {
         fprintf(stderr, "Could not get information for device: %s\n",
                 args->interface);
-        ip = 0;
-        subnet_mask = 0;
+        subnet_mask = PCAP_NETMASK_UNKNOWN;
     }
 
-    // Compile the filter
-    if (pcap_compile(handle, &filter, args->filter, 0, ip) == -1) {
-        fprintf(stderr, "Bad filter - %s\n", pcap_geterr(handle));
+    // Compile and set the filter, on each source with several
+    if (sources ? multicap_setfilter(sources, args->filter, args->dump_filter) < 0
+                : capture_setfilter(handle, args->filter, subnet_mask,
+                                    args->dump_filter) < 0)
         return (2);
+    if (args->dump_filter) { // Only show the filter
+        if (sources)
+            multicap_close(sources);
+        else
+            capture_close(handle);
+        free(args);
+        return 0;
     }
 
-    // Set the filter
-    if (pcap_setfilter(handle, &filter) == -1) {
-        fprintf(stderr, "Error setting filter - %s\n", pcap_geterr(handle));
-        return (2);
+    if (args->index && !args->fileOutput) {
+        fprintf(stderr, "--index needs an output file\n");
+        return (1);
+    }
+    if ((args->from || args->to || args->flow_key) &&
+        select_input(handle, args) < 0)
+        return (1);
+
+    if (args->jobs && handle->file == NULL) {
+        fprintf(stderr, "-j needs a regular capture file, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (args->jobs && args->format == FORMAT_ARROW && !args->stats) {
+        fprintf(stderr, "-j can't write -o arrow, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (args->jobs && args->dns_latency) {
+        fprintf(stderr, "-j can't match the DNS queries of one part to the "
+                        "responses of the next, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (args->jobs && args->tcp_metrics) {
+        fprintf(stderr, "-j can't follow the TCP connections from one part to "
+                        "the next, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (args->jobs && args->top_rows) {
+        fprintf(stderr, "-j can't rank the talkers of an interval split "
+                        "between parts, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (args->jobs && args->fileOutput) {
+        fprintf(stderr, "-j can't write an output file, reading on one thread\n");
+        args->jobs = 0;
+    }
+    if (sources && args->batch > 0) {
+        fprintf(stderr, "-b can't batch the packets of several sources, "
+                        "decoding them one at a time\n");
+        args->batch = 0;
+    }
+
+    if (args->overload && args->fileInput) {
+        fprintf(stderr, "--overload only sheds the load of a live capture, "
+                        "decoding every packet\n");
+        args->overload = 0;
+    }
+    if (args->overload) {
+        struct overload_config ol = {
+            .sample = args->sample_mode,
+            .max_rate = args->sample_max,
+            .cap = sources ? NULL : handle,
+            .sources = sources,
+            .pipeline = args->threads && (!args->fileOutput || args->print),
+        };
+        overload_init(&ol);
+    }
+
+    // Leave the loop cleanly on Ctrl+C so the output and statistics are flushed
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_capture;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (!sources)
+        capture = handle;
+
+    // Flush the output and close the intervals of a live capture when no packet comes
+    if (!args->fileInput &&
+        (!args->threads || (args->fileOutput && !args->print))) {
+        if (sources)
+            multicap_set_idle(sources, idle_analyzer,
+                              (u_char *)&args->stats_interval);
+        else
+            capture_set_idle(handle, idle_analyzer,
+                             (u_char *)&args->stats_interval);
     }
 
-    if (args->fileOutput) { // If an output file is provided, open it in write mode. Then start the loop
-        dumper = pcap_dump_open(handle, args->fileOutput);
-        if (dumper == NULL) {
-            fprintf(stderr, "Error opening output file: %s\n",
-                    pcap_geterr(handle));
+    // Open the output file, the loops write the packets to it before decoding them
+    if (args->fileOutput && dump_open(handle, args) < 0)
+        return (1);
+
+    if (args->fileOutput && !args->print) { // Only write the packets
+        analyze_loop(handle, args, NULL, NULL);
+    } else if (args->jobs) { // Split the file across threads, totals only without a common clock
+        struct chunk_config cfg = {
+            .workers = args->jobs > 0 ? args->jobs : 0,
+            .count = args->count,
+            .render = args->stats ? NULL : renderer,
+            .stats = &total_stats,
+        };
+        alloc_mark();
+        chunk_run(handle, &cfg);
+        alloc_report(stderr);
+        if (args->stats)
+            stats_print(stdout, &total_stats, "Total", 0);
+    } else if (args->threads) { // Decode on several threads
+        struct pipeline_config cfg = {
+            .workers = args->threads > 0 ? args->threads : 0,
+            .slots = args->ring_slots,
+            .live = args->fileInput == NULL,
+            .render = args->stats || renderer == render_columnar ? NULL : renderer,
+            .sink = args->stats                   ? stats_sink
+                    : renderer == render_columnar ? columnar_sink
+                                                  : text_sink,
+            .sink_arg = &args->stats_interval,
+            .idle = args->fileInput ? NULL : idle_sink,
+        };
+        if (!args->stats && output_init(0, args->flush_interval) < 0) {
+            fprintf(stderr, "Error allocating the output buffer\n");
+            return (1);
+        }
+        if (!args->stats && renderer == render_columnar &&
+            columnar_init(args->batch_rows) < 0)
+            return (1);
+        if (pipeline_start(&cfg) < 0)
             return (1);
+        alloc_mark();
+        analyze_loop(handle, args, pipeline_submit, NULL);
+        pipeline_stop();
+        alloc_report(stderr);
+        if (args->stats) {
+            stats_merge(&total_stats, &interval_stats);
+            stats_print(stdout, &total_stats, "Total", 0);
+            struct overload_mark start = {0};
+            overload_report(stdout, &start);
+        } else {
+            if (renderer == render_columnar)
+                columnar_close();
+            output_close();
         }
-        pcap_loop(handle, args->count, pcap_dump, (u_char *)dumper);
-        pcap_dump_close(dumper);
+    } else if (args->stats) { // Only count the packets
+        alloc_mark();
+        analyze_loop(handle, args, stats_analyzer,
+                     (u_char *)&args->stats_interval);
+        alloc_report(stderr);
+        stats_merge(&total_stats, &interval_stats);
+        stats_print(stdout, &total_stats, "Total", 0);
+        struct overload_mark start = {0};
+        overload_report(stdout, &start);
     } else { // If no output file is provided, start the loop
-        pcap_loop(handle, args->count, packet_analyzer, NULL);
+        if (output_init(0, args->flush_interval) < 0) {
+            fprintf(stderr, "Error allocating the output buffer\n");
+            return (1);
+        }
+        if (renderer == render_columnar && columnar_init(args->batch_rows) < 0)
+            return (1);
+        alloc_mark();
+        analyze_loop(handle, args, packet_analyzer, NULL);
+        alloc_report(stderr);
+        if (renderer == render_columnar)
+            columnar_close();
+        output_close();
+    }
+
+    if (dump.file)
+        dump_close();
+    if (args->perf) {
+        perf_report(stderr, sources ? NULL : handle, "Total");
+        struct overload_mark start = {0};
+        overload_report(stderr, &start);
+        perf_close();
+    }
+    if (sources)
+        multicap_print_stats(sources, stderr);
+
+    // The workers released their flows when they stopped, only the serial loop's are left
+    if (args->reassemble) {
+        reasm_release();
+        reasm_print_stats(stderr);
     }
+    ipfrag_release();
+    ipfrag_print_stats(stderr);
+
+    flowtab_close();
+    dnstrack_close();
+    tcpmetrics_close();
+    topn_close();
+    arena_release();
+    dns_name_release();
+    dfilter_free(display);
 
-    // Close the handle
-    pcap_close(handle);
+    // Close the handle, or every source
+    if (sources)
+        multicap_close(sources);
+    else
+        capture_close(handle);
+    dissector_close(); // Last, the plugins' strings were printed until now
 
     // Free args
     free(args);
@@ -0,0 +1,563 @@
+/**
+ * @author Flavien Lallemant
+ * @file multicap.c
+ * @brief Capture from several sources definition
+ *
+ * This file contains the definition of the capture from several sources.
+ * The queue of a source is a ring of bytes holding one record per packet, its
+ * header and its data, so a small packet takes little room whatever the
+ * snapshot length. A record is never split at the end of the ring: the
+ * capture thread leaves a record of size 0 there and goes on from the start.
+ * A packet is dropped, and counted, when its queue is full, the capture
+ * thread never waits for the merging one.
+ * In time stamp order, the merging thread takes the oldest packet at the head
+ * of the queues once every queue has one, or once it is older than the delay,
+ * so a quiet source holds the others back by the delay at most.
+ *
+ * @see multicap.h
+ * @see multicap_open
+ * @see multicap_setfilter
+ * @see multicap_loop
+ * @see multicap_set_idle
+ * @see multicap_breakloop
+ * @see multicap_print_stats
+ * @see multicap_fill
+ * @see multicap_close
+ */
+
+#define _GNU_SOURCE // pthread_setaffinity_np()
+
+// Global libraries
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "multicap.h"
+
+#define RECORD_ALIGN 64     /**< Alignment of the records of a queue */
+#define MERGE_BURST 64      /**< Packets taken from a source in a row as they arrive */
+
+/**
+ * @brief Header of a packet record in a queue
+ */
+struct record {
+    struct pcap_pkthdr header;  /**< The packet header */
+    uint32_t size;              /**< Bytes of the record, 0 to go on from the start of the queue */
+    uint32_t nsec;              /**< Nanoseconds of the second of the packet time */
+};
+
+#define RECORD_DATA (sizeof(struct record) + 2) /**< Offset of the packet, the IP header after Ethernet aligned */
+
+
+/**
+ * @brief Wait a little longer at each call
+ *
+ * @param spins The number of calls since the last progress, updated
+ */
+static void backoff(unsigned *spins)
+{
+    if (*spins < 64) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+    (*spins)++;
+}
+
+
+/**
+ * @brief Queue a packet of a source
+ *
+ * This function is the capture_loop() callback of the capture thread.
+ *
+ * @param user The source
+ * @param header The packet header
+ * @param packet The packet
+ */
+static void source_push(u_char *user, const struct pcap_pkthdr *header,
+                        const u_char *packet)
+{
+    struct multicap_source *s = (struct multicap_source *)user;
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+    uint64_t size = (RECORD_DATA + header->caplen + RECORD_ALIGN - 1) &
+                    ~(uint64_t)(RECORD_ALIGN - 1);
+    uint64_t pos = head % MULTICAP_QUEUE;
+    uint64_t skip = MULTICAP_QUEUE - pos < size ? MULTICAP_QUEUE - pos : 0;
+    if (head + skip + size - tail > MULTICAP_QUEUE) {
+        atomic_fetch_add_explicit(&s->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    if (skip) { // The end of the queue always has room for a record header
+        ((struct record *)(s->queue + pos))->size = 0;
+        pos = 0;
+    }
+    struct record *r = (struct record *)(s->queue + pos);
+    r->header = *header;
+    r->size = size;
+    r->nsec = capture_nsec(header);
+    memcpy((u_char *)r + RECORD_DATA, packet, header->caplen);
+    atomic_fetch_add_explicit(&s->packets, 1, memory_order_relaxed);
+    atomic_store_explicit(&s->head, head + skip + size, memory_order_release);
+}
+
+
+/**
+ * @brief Get the next packet of a source
+ *
+ * @param s The source
+ * @return struct record* The packet, NULL if its queue is empty
+ */
+static struct record *source_peek(struct multicap_source *s)
+{
+    uint64_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+    if (tail == head)
+        return NULL;
+    struct record *r = (struct record *)(s->queue + tail % MULTICAP_QUEUE);
+    if (r->size == 0) {
+        tail += MULTICAP_QUEUE - tail % MULTICAP_QUEUE;
+        atomic_store_explicit(&s->tail, tail, memory_order_release);
+        if (tail == head)
+            return NULL;
+        r = (struct record *)s->queue;
+    }
+    return r;
+}
+
+
+/**
+ * @brief Give the room of the packet returned by source_peek() back
+ *
+ * @param s The source
+ * @param r The packet
+ */
+static void source_pop(struct multicap_source *s, const struct record *r)
+{
+    uint64_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    atomic_store_explicit(&s->tail, tail + r->size, memory_order_release);
+}
+
+
+/**
+ * @brief Capture thread of a source
+ *
+ * @param arg The source
+ * @return void* NULL
+ */
+static void *source_main(void *arg)
+{
+    struct multicap_source *s = arg;
+#ifdef __linux__
+    if (s->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err)
+            fprintf(stderr, "Warning: can't pin %s to core %d: %s\n", s->name,
+                    s->cpu, strerror(err));
+    }
+#endif
+    s->status = capture_loop(s->cap, 0, source_push, (u_char *)s);
+    atomic_store_explicit(&s->done, 1, memory_order_release);
+    return NULL;
+}
+
+
+/**
+ * @brief Open the sources
+ *
+ * The sockets of an interface share a fanout group numbered from the process
+ * and the interface, so two captures don't join the same group.
+ *
+ * @param cfg The sources
+ * @param base The configuration of each handle, its interface and fanout ignored
+ * @param errbuf The buffer to store the error message, PCAP_ERRBUF_SIZE bytes
+ * @return struct multicap* The sources, NULL on error
+ *
+ * @see capture_open_live
+ */
+struct multicap *multicap_open(const struct multicap_config *cfg,
+                               const struct capture_config *base,
+                               char *errbuf)
+{
+    int fanout = cfg->fanout > 1 ? cfg->fanout : 1;
+    int count = cfg->interface_count * fanout;
+    if (cfg->interface_count < 1 || count > MULTICAP_SOURCES) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                 "between 1 and %d sources can be opened, not %d",
+                 MULTICAP_SOURCES, count);
+        return NULL;
+    }
+
+    struct multicap *mc = calloc(1, sizeof(*mc));
+    size_t size = sizeof(struct multicap_source) * count;
+    if (mc == NULL ||
+        (mc->sources = aligned_alloc(RECORD_ALIGN, size)) == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        free(mc);
+        return NULL;
+    }
+    memset(mc->sources, 0, size);
+    mc->queues = malloc((size_t)count * MULTICAP_QUEUE);
+    if (mc->queues == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+        goto fail;
+    }
+    mc->merge = cfg->merge;
+    // A packet can wait in the kernel for the read timeout before reaching a queue
+    mc->delay = cfg->delay;
+    if (mc->delay <= 0)
+        mc->delay = MULTICAP_DELAY +
+                    (base->immediate ? 0
+                                     : base->timeout > 0 ? base->timeout
+                                                         : CAPTURE_TIMEOUT);
+
+    for (int i = 0; i < cfg->interface_count; i++) {
+        struct capture_config c = *base;
+        c.interface = cfg->interfaces[i];
+        c.fanout = CAPTURE_FANOUT_NONE;
+        if (fanout > 1) {
+            c.fanout = cfg->fanout_mode != CAPTURE_FANOUT_NONE
+                           ? cfg->fanout_mode
+                           : CAPTURE_FANOUT_HASH;
+            c.fanout_group = (unsigned)(getpid() + i) & 0xffff;
+        }
+        for (int f = 0; f < fanout; f++) {
+            struct multicap_source *s = &mc->sources[mc->count];
+            snprintf(s->interface, sizeof(s->interface), "%s", c.interface);
+            s->ifindex = i;
+            if (fanout > 1)
+                snprintf(s->name, sizeof(s->name), "%s/%d", s->interface, f);
+            else
+                snprintf(s->name, sizeof(s->name), "%s", s->interface);
+            s->cpu = cfg->cpus && mc->count < cfg->cpu_count
+                         ? cfg->cpus[mc->count]
+                         : -1;
+            mc->count++;
+
+            s->queue = mc->queues + (size_t)(mc->count - 1) * MULTICAP_QUEUE;
+            s->cap = capture_open_live(&c, errbuf);
+            if (s->cap == NULL)
+                goto fail;
+            if (pcap_datalink(s->cap->pcap) !=
+                pcap_datalink(mc->sources[0].cap->pcap)) {
+                snprintf(errbuf, PCAP_ERRBUF_SIZE,
+                         "%s: the link type isn't the one of %s", s->name,
+                         mc->sources[0].name);
+                goto fail;
+            }
+        }
+    }
+    return mc;
+
+fail:
+    multicap_close(mc); // The handles and queues opened so far
+    return NULL;
+}
+
+
+/**
+ * @brief Compile and set a filter on every source
+ *
+ * @param mc The sources
+ * @param expr The filter expression, NULL for no filter
+ * @param dump 1 to print the program of the first source and where it runs
+ * @return int 0 on success, -1 on error
+ *
+ * @see capture_setfilter
+ */
+int multicap_setfilter(struct multicap *mc, const char *expr, int dump)
+{
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        char errbuf[PCAP_ERRBUF_SIZE];
+        bpf_u_int32 ip, netmask;
+        if (pcap_lookupnet(s->interface, &ip, &netmask, errbuf)) {
+            if (i == 0 || strcmp(s->interface, mc->sources[i - 1].interface))
+                fprintf(stderr, "Could not get information for device: %s\n",
+                        s->interface);
+            netmask = PCAP_NETMASK_UNKNOWN;
+        }
+        if (capture_setfilter(s->cap, expr, netmask, dump && i == 0) < 0)
+            return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Give the packets of the sources in time stamp order
+ *
+ * @param mc The sources
+ * @param max The largest number of packets to give
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int The number of packets given, -1 once every source is over
+ */
+static int merge_ordered(struct multicap *mc, int max, pcap_handler callback,
+                         u_char *user)
+{
+    struct timeval limit = {0, 0};
+    int n = 0;
+    while (n < max) {
+        struct multicap_source *first = NULL;
+        struct record *oldest = NULL;
+        int waiting = 0;
+        for (int i = 0; i < mc->count; i++) {
+            struct multicap_source *s = &mc->sources[i];
+            // Read before the queue, a source over has queued its last packet
+            int done = atomic_load_explicit(&s->done, memory_order_acquire);
+            struct record *r = source_peek(s);
+            if (r == NULL) {
+                waiting |= !done;
+                continue;
+            }
+            if (oldest == NULL || timercmp(&r->header.ts, &oldest->header.ts, <)) {
+                first = s;
+                oldest = r;
+            }
+        }
+        if (oldest == NULL)
+            return n || waiting ? n : (-1);
+        if (waiting) { // Only if no packet of the quiet sources can be older
+            if (limit.tv_sec == 0) {
+                struct timeval now, delay = {mc->delay / 1000,
+                                             (mc->delay % 1000) * 1000};
+                gettimeofday(&now, NULL);
+                timersub(&now, &delay, &limit);
+            }
+            if (!timercmp(&oldest->header.ts, &limit, <))
+                return n;
+        }
+        mc->current = first - mc->sources;
+        capture_set_nsec(&oldest->header, oldest->nsec);
+        callback(user, &oldest->header, (const u_char *)oldest + RECORD_DATA);
+        source_pop(first, oldest);
+        n++;
+    }
+    return n;
+}
+
+
+/**
+ * @brief Give the packets of the sources as they arrive
+ *
+ * @param mc The sources
+ * @param max The largest number of packets to give
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int The number of packets given, -1 once every source is over
+ */
+static int merge_arrival(struct multicap *mc, int max, pcap_handler callback,
+                         u_char *user)
+{
+    int n = 0;
+    int running = 0;
+    for (int i = 0; i < mc->count && n < max; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        running |= !atomic_load_explicit(&s->done, memory_order_acquire);
+        struct record *r;
+        for (int k = 0; k < MERGE_BURST && n < max && (r = source_peek(s)); k++) {
+            mc->current = i;
+            capture_set_nsec(&r->header, r->nsec);
+            callback(user, &r->header, (const u_char *)r + RECORD_DATA);
+            source_pop(s, r);
+            n++;
+        }
+    }
+    return n || running ? n : (-1);
+}
+
+
+/**
+ * @brief Read packets from every source
+ *
+ * The capture threads are started with every signal blocked, so the signals
+ * are handled by the calling thread. They are stopped and joined before the
+ * function returns.
+ *
+ * @param mc The sources
+ * @param count The number of packets to read, 0 or less for no limit
+ * @param callback The function called for each packet
+ * @param user The first argument of the callback
+ * @return int 0 when done, -1 on error, -2 if stopped by multicap_breakloop()
+ *
+ * @see merge_ordered
+ * @see merge_arrival
+ */
+int multicap_loop(struct multicap *mc, int count, pcap_handler callback,
+                  u_char *user)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = 0;
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        if (pthread_create(&s->thread, NULL, source_main, s) != 0) {
+            fprintf(stderr, "Error starting the capture thread of %s\n",
+                    s->name);
+            ret = -1;
+            break;
+        }
+        s->started = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    int n = 0;
+    unsigned spins = 0;
+    while (ret == 0 && !mc->stop && (count <= 0 || n < count)) {
+        int max = count > 0 ? count - n : INT_MAX;
+        int got = mc->merge == MULTICAP_ARRIVAL
+                      ? merge_arrival(mc, max, callback, user)
+                      : merge_ordered(mc, max, callback, user);
+        if (got < 0)
+            break;
+        if (got == 0) {
+            if (mc->idle && spins % MULTICAP_IDLE == MULTICAP_IDLE - 1)
+                mc->idle(mc->idle_user);
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        n += got;
+    }
+    if (mc->stop && ret == 0)
+        ret = -2;
+
+    for (int i = 0; i < mc->count; i++)
+        capture_breakloop(mc->sources[i].cap);
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        if (!s->started)
+            continue;
+        pthread_join(s->thread, NULL);
+        s->started = 0;
+        if (s->status == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Set the function called while no source has a packet
+ *
+ * @param mc The sources
+ * @param idle The function, NULL for none
+ * @param user Its argument
+ */
+void multicap_set_idle(struct multicap *mc, capture_idle_handler idle,
+                       u_char *user)
+{
+    mc->idle = idle;
+    mc->idle_user = user;
+}
+
+
+/**
+ * @brief Stop multicap_loop()
+ *
+ * This function can be called from a signal handler.
+ *
+ * @param mc The sources
+ *
+ * @see capture_breakloop
+ */
+void multicap_breakloop(struct multicap *mc)
+{
+    mc->stop = 1;
+    for (int i = 0; i < mc->count; i++)
+        capture_breakloop(mc->sources[i].cap);
+}
+
+
+/**
+ * @brief Print the counters of each source
+ *
+ * @param mc The sources
+ * @param f The stream to print to
+ *
+ * @see capture_stats
+ */
+void multicap_print_stats(struct multicap *mc, FILE *f)
+{
+    if (mc->merge == MULTICAP_ARRIVAL)
+        fprintf(f, "Sources: %d sources, merged as they arrive\n", mc->count);
+    else
+        fprintf(f, "Sources: %d sources, merged in time order within %d ms\n",
+                mc->count, mc->delay);
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        fprintf(f, "  %s: %llu packets, %llu dropped by the queue", s->name,
+                (unsigned long long)atomic_load(&s->packets),
+                (unsigned long long)atomic_load(&s->dropped));
+        struct capture_stats cs;
+        if (capture_stats(s->cap, &cs) == 0)
+            fprintf(f, ", %llu received and %llu dropped by the kernel",
+                    cs.received, cs.dropped);
+        if (s->cpu >= 0)
+            fprintf(f, ", core %d", s->cpu);
+        fprintf(f, "\n");
+    }
+}
+
+
+/**
+ * @brief Get how full the queues are
+ *
+ * This function is called by the thread of multicap_loop().
+ *
+ * @param mc The sources
+ * @param dropped The packets dropped by the queues and the kernel, set
+ * @return unsigned The percentage of the fullest queue in use
+ *
+ * @see capture_stats
+ */
+unsigned multicap_fill(struct multicap *mc, unsigned long long *dropped)
+{
+    unsigned fill = 0;
+    *dropped = 0;
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        uint64_t used = atomic_load_explicit(&s->head, memory_order_relaxed) -
+                        atomic_load_explicit(&s->tail, memory_order_relaxed);
+        unsigned pct = (unsigned)(used * 100 / MULTICAP_QUEUE);
+        if (pct > fill)
+            fill = pct;
+        *dropped += atomic_load_explicit(&s->dropped, memory_order_relaxed);
+        struct capture_stats cs;
+        if (capture_stats(s->cap, &cs) == 0)
+            *dropped += cs.dropped + cs.ifdropped;
+    }
+    return fill;
+}
+
+
+/**
+ * @brief Close the sources
+ *
+ * @param mc The sources
+ */
+void multicap_close(struct multicap *mc)
+{
+    if (mc == NULL)
+        return;
+    for (int i = 0; i < mc->count; i++) {
+        struct multicap_source *s = &mc->sources[i];
+        if (s->cap)
+            capture_close(s->cap);
+    }
+    free(mc->queues);
+    free(mc->sources);
+    free(mc);
+}
@@ -0,0 +1,281 @@
+/**
+ * @author Flavien Lallemant
+ * @file output.c
+ * @brief Buffered output writer definition
+ *
+ * This file contains the definition of the buffered output writer.
+ * The text of the packets is appended to a large buffer which is written
+ * to stdout with a single write() when it is full or when the flush
+ * interval has elapsed.
+ * A thread can bind its own growable buffer instead, the decoding workers
+ * use it to render a packet before the output stage writes it in order.
+ *
+ * @see output.h
+ */
+
+// Global libraries
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "output.h"
+#include "perf.h"
+
+static struct outbuf out = {0}; /**< The output buffer */
+static __thread struct outbuf *cur = &out; /**< The buffer of the calling thread */
+static int flush_interval_ms = OUTPUT_FLUSH_FULL; /**< Flush interval in milliseconds */
+static long long last_flush_ms = 0; /**< Time of the last flush */
+
+
+/**
+ * @brief Get a monotonic time in milliseconds
+ *
+ * @return long long The time in milliseconds
+ */
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @brief Write a whole buffer to stdout
+ *
+ * @param buf The buffer to write
+ * @param len The length of the buffer
+ */
+static void write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+
+/**
+ * @brief Initialize the output writer
+ *
+ * @param size Size of the output buffer, 0 for the default size
+ * @param flush_interval Minimum time between two flushes in milliseconds,
+ * 0 to flush after every packet, OUTPUT_FLUSH_FULL or OUTPUT_FLUSH_AUTO
+ * @return int 0 on success, -1 on error
+ */
+int output_init(size_t size, int flush_interval)
+{
+    if (size == 0)
+        size = OUTPUT_BUFFER_SIZE;
+    out.data = malloc(size);
+    if (out.data == NULL)
+        return (-1);
+    out.len = 0;
+    out.cap = size;
+
+    if (flush_interval == OUTPUT_FLUSH_AUTO)
+        flush_interval = isatty(STDOUT_FILENO) ? 0 : OUTPUT_FLUSH_FULL;
+    flush_interval_ms = flush_interval;
+    last_flush_ms = now_ms();
+
+    // Anything printed before through stdio must come first
+    fflush(stdout);
+    return 0;
+}
+
+
+/**
+ * @brief Flush the output and release the output buffer
+ */
+void output_close(void)
+{
+    out_flush();
+    free(out.data);
+    out.data = NULL;
+    out.cap = 0;
+}
+
+
+/**
+ * @brief Write the buffered output to stdout
+ */
+void out_flush(void)
+{
+    if (cur->grow)
+        return;
+    if (out.len > 0) {
+        uint64_t start = perf_begin(PERF_OUTPUT);
+        write_all(out.data, out.len);
+        perf_end(PERF_OUTPUT, start);
+    }
+    out.len = 0;
+    last_flush_ms = now_ms();
+}
+
+
+/**
+ * @brief Make room in a bound buffer
+ *
+ * @param ob The buffer to grow
+ * @param len The number of bytes to append
+ * @return int 0 on success, -1 on error
+ */
+static int out_grow(struct outbuf *ob, size_t len)
+{
+    size_t cap = ob->cap ? ob->cap : 1024;
+    while (cap < ob->len + len + 1)
+        cap *= 2;
+    char *data = realloc(ob->data, cap);
+    if (data == NULL)
+        return (-1);
+    ob->data = data;
+    ob->cap = cap;
+    return 0;
+}
+
+
+/**
+ * @brief Send the output of the calling thread to a buffer
+ *
+ * The buffer grows as needed and is never written to stdout by the writer.
+ *
+ * @param ob The buffer to append to, NULL to go back to the output buffer
+ */
+void out_bind(struct outbuf *ob)
+{
+    if (ob == NULL) {
+        cur = &out;
+        return;
+    }
+    ob->grow = 1;
+    cur = ob;
+}
+
+
+/**
+ * @brief Append raw bytes to the output
+ *
+ * @param buf The bytes to append
+ * @param len The number of bytes
+ */
+void out_write(const void *buf, size_t len)
+{
+    if (cur->len + len > cur->cap) {
+        if (cur->grow) {
+            if (out_grow(cur, len) < 0)
+                return;
+        } else {
+            out_flush();
+            if (len > out.cap) { // Too large to be buffered
+                write_all(buf, len);
+                return;
+            }
+        }
+    }
+    memcpy(cur->data + cur->len, buf, len);
+    cur->len += len;
+}
+
+
+/**
+ * @brief Append a string to the output
+ *
+ * @param s The string to append, no newline is added
+ */
+void out_puts(const char *s)
+{
+    out_write(s, strlen(s));
+}
+
+
+/**
+ * @brief Append a character to the output
+ *
+ * @param c The character to append
+ */
+void out_putc(char c)
+{
+    if (cur->len == cur->cap) {
+        out_write(&c, 1);
+        return;
+    }
+    cur->data[cur->len++] = c;
+}
+
+
+/**
+ * @brief Append formatted text to the output
+ *
+ * @param fmt The format string, as printf()
+ * @return int The number of characters written
+ */
+int out_printf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(cur->data + cur->len, cur->cap - cur->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return n;
+
+    if ((size_t)n >= cur->cap - cur->len && cur->grow) { // Grow and retry
+        if (out_grow(cur, n) < 0)
+            return (-1);
+        va_start(ap, fmt);
+        vsnprintf(cur->data + cur->len, cur->cap - cur->len, fmt, ap);
+        va_end(ap);
+    } else if ((size_t)n >= cur->cap - cur->len) { // Did not fit, flush and retry
+        out_flush();
+        va_start(ap, fmt);
+        if ((size_t)n < out.cap) {
+            vsnprintf(out.data, out.cap, fmt, ap);
+            va_end(ap);
+        } else { // Too large to be buffered
+            fflush(stdout);
+            n = vprintf(fmt, ap);
+            fflush(stdout);
+            va_end(ap);
+            return n;
+        }
+    }
+    cur->len += n;
+    return n;
+}
+
+
+/**
+ * @brief Mark the end of a packet
+ *
+ * This function flushes the output if the flush interval has elapsed.
+ */
+void out_packet_done(void)
+{
+    if (flush_interval_ms == 0 ||
+        (flush_interval_ms > 0 && now_ms() - last_flush_ms >= flush_interval_ms))
+        out_flush();
+}
+
+
+/**
+ * @brief Flush the output if the flush interval has elapsed while no packet
+ * comes
+ *
+ * Without an interval, the output waits for the buffer to fill as usual.
+ */
+void out_idle(void)
+{
+    if (out.len > 0 && flush_interval_ms >= 0 &&
+        now_ms() - last_flush_ms >= flush_interval_ms)
+        out_flush();
+}
@@ -0,0 +1,231 @@
+/**
+ * @author Flavien Lallemant
+ * @file overload.c
+ * @brief Overload controller definition
+ *
+ * This file contains the definition of the overload controller.
+ * The level of the controller is 0 when every packet is decoded, 1 when they
+ * are decoded up to the transport layer, and each level above halves the
+ * packets decoded. A check is under pressure when packets were dropped since
+ * the previous one, or when a queue is at least OVERLOAD_HIGH percent full.
+ * The counters are written by the capture thread only, and read by the
+ * reports from any thread.
+ *
+ * @see overload.h
+ * @see overload_init
+ * @see overload_admit
+ * @see overload_report
+ */
+
+// Global libraries
+#include <stdatomic.h>
+#include <string.h>
+
+// Local header files
+#include "decode.h"
+#include "flow.h"
+#include "overload.h"
+#include "pipeline.h"
+
+/**
+ * @brief Controller state
+ */
+static struct {
+    int enabled;                /**< 1 once overload_init() is called */
+    struct overload_config cfg; /**< The configuration */
+    unsigned max_level;         /**< Level of the largest sampling rate */
+    _Atomic unsigned level;     /**< Current level */
+    uint32_t rate_mask;         /**< Sampling rate of the level minus 1 */
+    uint64_t count;             /**< Packets seen, for the count sampling */
+    int64_t next_check;         /**< Capture time of the next check in microseconds, 0 before the first packet */
+    unsigned long long dropped; /**< Drops read at the previous check */
+    unsigned calm;              /**< Quiet checks in a row */
+    _Atomic uint64_t seen;      /**< Packets offered */
+    _Atomic uint64_t kept;      /**< Packets decoded */
+    _Atomic uint64_t headers;   /**< Packets decoded up to the transport layer only */
+    _Atomic unsigned peak;      /**< Highest level reached */
+} ol;
+
+
+/**
+ * @brief Enable the controller
+ *
+ * @param cfg The configuration
+ */
+void overload_init(const struct overload_config *cfg)
+{
+    ol.cfg = *cfg;
+    unsigned rate = cfg->max_rate ? cfg->max_rate : OVERLOAD_RATE;
+    ol.max_level = 1;
+    while ((1u << (ol.max_level - 1)) < rate && ol.max_level < 17)
+        ol.max_level++;
+    ol.enabled = 1;
+}
+
+
+/**
+ * @brief Check if the controller is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int overload_enabled(void)
+{
+    return ol.enabled;
+}
+
+
+/**
+ * @brief Get the sampling rate of a level
+ *
+ * @param level The level
+ * @return unsigned The N of 1 in N
+ */
+static unsigned level_rate(unsigned level)
+{
+    return level > 1 ? 1u << (level - 1) : 1;
+}
+
+
+/**
+ * @brief Go to a level
+ *
+ * @param level The level
+ *
+ * @see decode_shed_depth
+ */
+static void set_level(unsigned level)
+{
+    atomic_store_explicit(&ol.level, level, memory_order_relaxed);
+    if (level > atomic_load_explicit(&ol.peak, memory_order_relaxed))
+        atomic_store_explicit(&ol.peak, level, memory_order_relaxed);
+    ol.rate_mask = level_rate(level) - 1;
+    decode_shed_depth(level > 0 ? DECODE_TRANSPORT : DECODE_APP);
+}
+
+
+/**
+ * @brief Read the load and change the level
+ *
+ * @see pipeline_fill
+ * @see multicap_fill
+ * @see capture_stats
+ */
+static void check(void)
+{
+    unsigned long long dropped = 0, n;
+    unsigned fill = 0;
+    if (ol.cfg.pipeline) {
+        fill = pipeline_fill(&n);
+        dropped += n;
+    }
+    if (ol.cfg.sources) {
+        unsigned f = multicap_fill(ol.cfg.sources, &n);
+        if (f > fill)
+            fill = f;
+        dropped += n;
+    } else if (ol.cfg.cap) {
+        struct capture_stats cs;
+        if (capture_stats(ol.cfg.cap, &cs) == 0)
+            dropped += cs.dropped + cs.ifdropped;
+    }
+
+    int pressure = dropped > ol.dropped || fill >= OVERLOAD_HIGH;
+    ol.dropped = dropped;
+    unsigned level = atomic_load_explicit(&ol.level, memory_order_relaxed);
+    if (pressure) {
+        ol.calm = 0;
+        if (level < ol.max_level)
+            set_level(level + 1);
+    } else if (fill < OVERLOAD_LOW && ++ol.calm >= OVERLOAD_CALM) {
+        ol.calm = 0;
+        if (level > 0)
+            set_level(level - 1);
+    }
+}
+
+
+/**
+ * @brief Decide if a packet is decoded
+ *
+ * This function is called by the capture thread for every packet, and
+ * checks the load when a period is over. A packet without a flow is sampled
+ * by count.
+ *
+ * @param header The packet header
+ * @param packet The packet
+ * @return int 1 to decode the packet, 0 to skip it
+ *
+ * @see check
+ * @see flow_key_packet
+ * @see flow_shard
+ */
+int overload_admit(const struct pcap_pkthdr *header, const u_char *packet)
+{
+    int64_t now = (int64_t)header->ts.tv_sec * 1000000 + header->ts.tv_usec;
+    if (now >= ol.next_check) {
+        if (ol.next_check)
+            check();
+        ol.next_check = now + OVERLOAD_PERIOD * 1000;
+    }
+    atomic_fetch_add_explicit(&ol.seen, 1, memory_order_relaxed);
+    ol.count++;
+
+    unsigned level = atomic_load_explicit(&ol.level, memory_order_relaxed);
+    if (level > 1) {
+        struct flow_key key;
+        uint64_t pick = ol.count;
+        if (ol.cfg.sample == OVERLOAD_FLOW &&
+            flow_key_packet(packet, header->caplen, &key) == 0)
+            pick = flow_shard(&key) >> 7; // Low bits pick the pipeline worker
+        if (pick & ol.rate_mask)
+            return 0;
+    }
+    atomic_fetch_add_explicit(&ol.kept, 1, memory_order_relaxed);
+    if (level > 0)
+        atomic_fetch_add_explicit(&ol.headers, 1, memory_order_relaxed);
+    return 1;
+}
+
+
+/**
+ * @brief Print the sampling applied since the previous report
+ *
+ * Nothing is printed when the controller is disabled. The counters of the
+ * report cover the packets decoded; scaled by the packets seen over the
+ * packets decoded, they estimate the packets seen.
+ *
+ * @param f The stream to print to
+ * @param mark The counters of the previous report, updated
+ */
+void overload_report(FILE *f, struct overload_mark *mark)
+{
+    if (!ol.enabled)
+        return;
+    struct overload_mark cur = {
+        .seen = atomic_load_explicit(&ol.seen, memory_order_relaxed),
+        .kept = atomic_load_explicit(&ol.kept, memory_order_relaxed),
+        .headers = atomic_load_explicit(&ol.headers, memory_order_relaxed),
+    };
+    uint64_t seen = cur.seen - mark->seen;
+    uint64_t kept = cur.kept - mark->kept;
+    uint64_t headers = cur.headers - mark->headers;
+    *mark = cur;
+
+    unsigned level = atomic_load_explicit(&ol.level, memory_order_relaxed);
+    if (seen == kept && headers == 0) {
+        fprintf(f, "  Sampling: none, %llu packets decoded\n",
+                (unsigned long long)kept);
+    } else {
+        fprintf(f, "  Sampling: %llu of %llu packets decoded by %s, scale the "
+                   "counters by %.2f; %llu decoded up to the transport layer "
+                   "only\n",
+                (unsigned long long)kept, (unsigned long long)seen,
+                ol.cfg.sample == OVERLOAD_FLOW ? "flow hash" : "count",
+                kept ? (double)seen / kept : 0.0, (unsigned long long)headers);
+    }
+    if (level > 0 || seen != kept || headers)
+        fprintf(f, "  Overload: now 1 in %u%s, at most 1 in %u so far\n",
+                level_rate(level), level > 0 ? ", headers only" : "",
+                level_rate(atomic_load_explicit(&ol.peak, memory_order_relaxed)));
+    fflush(f);
+}
@@ -8,8 +8,238 @@
  */
 
 #include "parser.h"
+#include "capture.h"
+#include "dispatch.h"
+#include "dissector.h"
+#include "dumpfile.h"
 #include "helper.h"
+#include "multicap.h"
+#include "output.h"
+#include "overload.h"
+#include "render.h"
 #include "stdio.h"
+#include <string.h>
+
+/**
+ * @brief Options without a short form
+ */
+enum long_only_options {
+    OPT_STATS_INTERVAL = 256,
+    OPT_RING_SLOTS,
+    OPT_IMMEDIATE,
+    OPT_TIMEOUT,
+    OPT_RING,
+    OPT_BLOCK_SIZE,
+    OPT_FRAME_COUNT,
+    OPT_HEADERS_ONLY,
+    OPT_PORT_ONLY,
+    OPT_REASM_MEM,
+    OPT_REASM_TIMEOUT,
+    OPT_NO_DEFRAG,
+    OPT_DEFRAG_MEM,
+    OPT_DEFRAG_TIMEOUT,
+    OPT_FLOWS,
+    OPT_FLOW_INTERVAL,
+    OPT_FLOW_TIMEOUT,
+    OPT_FLOW_SLOTS,
+    OPT_INDEX,
+    OPT_INDEX_BUCKET,
+    OPT_FROM,
+    OPT_TO,
+    OPT_FLOW_KEY,
+    OPT_DUMP_SYNC,
+    OPT_DUMP_DIRECT,
+    OPT_DUMP_BUFFER,
+    OPT_PCAPNG,
+    OPT_PCAPNG_COMMENTS,
+    OPT_PRINT,
+    OPT_BATCH_ROWS,
+    OPT_DNS_LATENCY,
+    OPT_DNS_INTERVAL,
+    OPT_DNS_TIMEOUT,
+    OPT_DNS_SLOTS,
+    OPT_TCP_METRICS,
+    OPT_TCP_FLOWS,
+    OPT_TCP_TIMEOUT,
+    OPT_TCP_SLOTS,
+    OPT_TOP,
+    OPT_TOP_INTERVAL,
+    OPT_TOP_WIDTH,
+    OPT_PERF,
+    OPT_PERF_INTERVAL,
+    OPT_OVERLOAD,
+    OPT_SAMPLE_MODE,
+    OPT_SAMPLE_MAX,
+    OPT_FANOUT,
+    OPT_CPUS,
+    OPT_MERGE,
+    OPT_MERGE_DELAY,
+    OPT_PLUGIN,
+};
+
+static const struct option long_options[] = {
+    {"port", required_argument, NULL, 'P'},
+    {"stats", no_argument, NULL, 'q'},
+    {"stats-interval", required_argument, NULL, OPT_STATS_INTERVAL},
+    {"threads", required_argument, NULL, 't'},
+    {"ring-slots", required_argument, NULL, OPT_RING_SLOTS},
+    {"buffer-size", required_argument, NULL, 'B'},
+    {"immediate", no_argument, NULL, OPT_IMMEDIATE},
+    {"timeout", required_argument, NULL, OPT_TIMEOUT},
+    {"ring", no_argument, NULL, OPT_RING},
+    {"block-size", required_argument, NULL, OPT_BLOCK_SIZE},
+    {"frame-count", required_argument, NULL, OPT_FRAME_COUNT},
+    {"snaplen", required_argument, NULL, 's'},
+    {"batch", required_argument, NULL, 'b'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"headers-only", no_argument, NULL, OPT_HEADERS_ONLY},
+    {"port-only", no_argument, NULL, OPT_PORT_ONLY},
+    {"reassemble", no_argument, NULL, 'R'},
+    {"reasm-mem", required_argument, NULL, OPT_REASM_MEM},
+    {"reasm-timeout", required_argument, NULL, OPT_REASM_TIMEOUT},
+    {"no-defrag", no_argument, NULL, OPT_NO_DEFRAG},
+    {"defrag-mem", required_argument, NULL, OPT_DEFRAG_MEM},
+    {"defrag-timeout", required_argument, NULL, OPT_DEFRAG_TIMEOUT},
+    {"flows", required_argument, NULL, OPT_FLOWS},
+    {"flow-interval", required_argument, NULL, OPT_FLOW_INTERVAL},
+    {"flow-timeout", required_argument, NULL, OPT_FLOW_TIMEOUT},
+    {"flow-slots", required_argument, NULL, OPT_FLOW_SLOTS},
+    {"dns-latency", no_argument, NULL, OPT_DNS_LATENCY},
+    {"dns-interval", required_argument, NULL, OPT_DNS_INTERVAL},
+    {"dns-timeout", required_argument, NULL, OPT_DNS_TIMEOUT},
+    {"dns-slots", required_argument, NULL, OPT_DNS_SLOTS},
+    {"tcp-metrics", no_argument, NULL, OPT_TCP_METRICS},
+    {"tcp-flows", no_argument, NULL, OPT_TCP_FLOWS},
+    {"tcp-timeout", required_argument, NULL, OPT_TCP_TIMEOUT},
+    {"tcp-slots", required_argument, NULL, OPT_TCP_SLOTS},
+    {"top", required_argument, NULL, OPT_TOP},
+    {"top-interval", required_argument, NULL, OPT_TOP_INTERVAL},
+    {"top-width", required_argument, NULL, OPT_TOP_WIDTH},
+    {"perf", no_argument, NULL, OPT_PERF},
+    {"perf-interval", required_argument, NULL, OPT_PERF_INTERVAL},
+    {"overload", no_argument, NULL, OPT_OVERLOAD},
+    {"sample-mode", required_argument, NULL, OPT_SAMPLE_MODE},
+    {"sample-max", required_argument, NULL, OPT_SAMPLE_MAX},
+    {"fanout", required_argument, NULL, OPT_FANOUT},
+    {"cpus", required_argument, NULL, OPT_CPUS},
+    {"merge", required_argument, NULL, OPT_MERGE},
+    {"merge-delay", required_argument, NULL, OPT_MERGE_DELAY},
+    {"plugin", required_argument, NULL, OPT_PLUGIN},
+    {"index", no_argument, NULL, OPT_INDEX},
+    {"index-bucket", required_argument, NULL, OPT_INDEX_BUCKET},
+    {"from", required_argument, NULL, OPT_FROM},
+    {"to", required_argument, NULL, OPT_TO},
+    {"flow-key", required_argument, NULL, OPT_FLOW_KEY},
+    {"rotate-size", required_argument, NULL, 'C'},
+    {"rotate-seconds", required_argument, NULL, 'G'},
+    {"dump-sync", required_argument, NULL, OPT_DUMP_SYNC},
+    {"dump-direct", no_argument, NULL, OPT_DUMP_DIRECT},
+    {"dump-buffer", required_argument, NULL, OPT_DUMP_BUFFER},
+    {"pcapng", no_argument, NULL, OPT_PCAPNG},
+    {"pcapng-comments", no_argument, NULL, OPT_PCAPNG_COMMENTS},
+    {"print", no_argument, NULL, OPT_PRINT},
+    {"format", required_argument, NULL, 'o'},
+    {"batch-rows", required_argument, NULL, OPT_BATCH_ROWS},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}}; /**< Long options */
+
+/**
+ * @brief Add the interfaces of a -i, separated by commas
+ *
+ * @param list The interfaces
+ * @param args Arguments structure
+ * @return int 0 on success, -1 on error
+ */
+static int parse_interfaces(const char *list, struct arguments *args)
+{
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len == 0 || len >= sizeof(args->interface)) {
+            fprintf(stderr, "Invalid interface in -i %s\n", list);
+            return -1;
+        }
+        if (args->interface_count == PARSER_INTERFACES) {
+            fprintf(stderr, "At most %d interfaces can be captured on\n",
+                    PARSER_INTERFACES);
+            return -1;
+        }
+        snprintf(args->interfaces[args->interface_count++],
+                 sizeof(args->interface), "%.*s", (int)len, list);
+        list += len + (list[len] == ',');
+    }
+    snprintf(args->interface, sizeof(args->interface), "%s", args->interfaces[0]);
+    return 0;
+}
+
+
+/**
+ * @brief Parse the sockets per interface of --fanout, and how they share the packets
+ *
+ * @param arg The number of sockets, then :hash, :cpu or :lb
+ * @param args Arguments structure
+ * @return int 0 on success, -1 on error
+ */
+static int parse_fanout(const char *arg, struct arguments *args)
+{
+    char *end;
+    args->fanout = strtol(arg, &end, 10);
+    args->fanout_mode = CAPTURE_FANOUT_HASH;
+    if (*end == ':' && strcmp(end + 1, "cpu") == 0)
+        args->fanout_mode = CAPTURE_FANOUT_CPU;
+    else if (*end == ':' && strcmp(end + 1, "lb") == 0)
+        args->fanout_mode = CAPTURE_FANOUT_LB;
+    else if (*end && strcmp(end, ":hash") != 0)
+        args->fanout = 0;
+    if (args->fanout < 1 || args->fanout > MULTICAP_SOURCES) {
+        fprintf(stderr, "Invalid --fanout %s, expected 1 to %d sockets, then "
+                        ":hash, :cpu or :lb\n", arg, MULTICAP_SOURCES);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Parse the cores of --cpus, like 0,2-5
+ *
+ * @param list The cores and ranges of cores, separated by commas
+ * @param args Arguments structure
+ * @return int 0 on success, -1 on error
+ */
+static int parse_cpus(const char *list, struct arguments *args)
+{
+    const char *p = list;
+    args->cpu_count = 0;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || first < 0)
+            break;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                break;
+        }
+        for (long c = first; c <= last; c++) {
+            if (args->cpu_count == PARSER_CPUS) {
+                fprintf(stderr, "At most %d cores can be given to --cpus\n",
+                        PARSER_CPUS);
+                return -1;
+            }
+            args->cpus[args->cpu_count++] = (int)c;
+        }
+        if (*end != ',' && *end != '\0')
+            break;
+        p = end + (*end == ',');
+    }
+    if (*p || args->cpu_count == 0) {
+        fprintf(stderr, "Invalid --cpus %s, expected cores like 0,2-5\n", list);
+        return -1;
+    }
+    return 0;
+}
+
 
 /**
  * @brief Parser function
@@ -22,14 +252,22 @@
  * @return int 0 on success, -1 on error, 1 on help
  * 
  * @see helper_function
+ * @see parse_interfaces
+ * @see parse_fanout
+ * @see parse_cpus
  */
 int parse_args(int argc, char **argv, struct arguments* args)
 {
     int opt;
-    while ((opt = getopt(argc, argv, "i:w:r:v::c:h")) != -1) {
+    args->flush_interval = OUTPUT_FLUSH_AUTO;
+    args->stats_interval = 1;
+    args->verbose = VERBOSE_COMPLETE;
+    while ((opt = getopt_long(argc, argv, "i:w:r:o:v::c:F:P:qt:j:B:s:b:RC:G:Y:dh", long_options,
+                              NULL)) != -1) {
         switch (opt) {
-        case 'i':           // Interface
-            snprintf(args->interface, 16, "%s", optarg);
+        case 'i':           // Interfaces, separated by commas
+            if (parse_interfaces(optarg, args) < 0)
+                return -1;
             break;
         case 'w':           // Output file
             args->fileOutput = optarg;
@@ -41,11 +279,269 @@ int parse_args(int argc, char **argv, struct arguments* args)
             if (optarg)
                 args->verbose = atoi(optarg);
             else
-                args->verbose = 1;
+                args->verbose = VERBOSE_CONCISE;
+            if (args->verbose < VERBOSE_CONCISE ||
+                args->verbose > VERBOSE_COMPLETE) {
+                fprintf(stderr, "Invalid verbose level %s, expected 1 to 3\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case 'Y':           // Display filter
+            args->display_filter = optarg;
+            break;
+        case 'd':           // Print the compiled capture filter
+            args->dump_filter = 1;
             break;
         case 'c':           // Number of packets to capture
             args->count = atoi(optarg);
             break;
+        case 'F':           // Output flush interval in milliseconds
+            args->flush_interval = atoi(optarg);
+            if (args->flush_interval < 0)
+                args->flush_interval = OUTPUT_FLUSH_FULL;
+            break;
+        case 'P':           // Port mapping of an application protocol
+            if (dispatch_parse(optarg) < 0)
+                return -1;
+            break;
+        case OPT_PLUGIN:    // Dissectors of a shared object, before the -P using them
+            if (dissector_load(optarg) < 0)
+                return -1;
+            break;
+        case 'q':           // Statistics only
+            args->stats = 1;
+            break;
+        case OPT_STATS_INTERVAL: // Seconds between two statistics reports
+            args->stats_interval = atoi(optarg);
+            break;
+        case 't':           // Number of decoding workers
+            if (strcmp(optarg, "auto") == 0)
+                args->threads = -1;
+            else
+                args->threads = atoi(optarg);
+            break;
+        case 'j':           // Number of parts of the input file
+            if (strcmp(optarg, "auto") == 0)
+                args->jobs = -1;
+            else
+                args->jobs = atoi(optarg);
+            break;
+        case OPT_RING_SLOTS: // Number of slots of the pipeline ring
+            args->ring_slots = atoi(optarg);
+            break;
+        case 'B':           // Kernel buffer size in KiB
+            args->buffer_size = atoi(optarg) * 1024;
+            break;
+        case OPT_IMMEDIATE: // Deliver the packets as soon as they arrive
+            args->immediate = 1;
+            break;
+        case OPT_TIMEOUT:   // Read timeout in milliseconds
+            args->timeout = atoi(optarg);
+            break;
+        case OPT_RING:      // Read a TPACKET_V3 ring directly
+            args->ring = 1;
+            break;
+        case OPT_BLOCK_SIZE: // Size of a ring block in bytes
+            args->block_size = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_FRAME_COUNT: // Number of ring frames
+            args->frame_count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':           // Bytes captured per packet, 0 for the default
+            args->snaplen = atoi(optarg);
+            break;
+        case 'b':           // Packets decoded per batch, 0 for one at a time
+            args->batch = atoi(optarg);
+            break;
+        case OPT_HEADERS_ONLY: // Capture only what the dissectors need
+            args->snaplen = -1;
+            break;
+        case OPT_PORT_ONLY: // Don't classify the payloads of unmapped ports
+            dispatch_guess(0);
+            break;
+        case 'R':           // Reassemble the TCP streams
+            args->reassemble = 1;
+            break;
+        case OPT_REASM_MEM: // Reassembly memory budget in MiB
+            args->reasm_memory = atoi(optarg);
+            break;
+        case OPT_REASM_TIMEOUT: // Idle timeout of a reassembled flow in seconds
+            args->reasm_timeout = atoi(optarg);
+            break;
+        case OPT_NO_DEFRAG: // Decode the IP fragments one by one
+            args->no_defrag = 1;
+            break;
+        case OPT_DEFRAG_MEM: // Fragment reassembly memory cap in MiB
+            args->defrag_memory = atoi(optarg);
+            break;
+        case OPT_DEFRAG_TIMEOUT: // Lifetime of an incomplete datagram in seconds
+            args->defrag_timeout = atoi(optarg);
+            break;
+        case OPT_FLOWS:     // Export the flow records to a file or collector
+            args->flow_dest = optarg;
+            break;
+        case OPT_FLOW_INTERVAL: // Seconds between two flow exports
+            args->flow_interval = atoi(optarg);
+            break;
+        case OPT_FLOW_TIMEOUT: // Idle timeout of a flow in seconds
+            args->flow_timeout = atoi(optarg);
+            break;
+        case OPT_FLOW_SLOTS: // Number of slots of the flow table
+            args->flow_slots = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_DNS_LATENCY: // Match the DNS responses to their queries
+            args->dns_latency = 1;
+            break;
+        case OPT_DNS_INTERVAL: // Seconds between two DNS latency reports
+            args->dns_interval = atoi(optarg);
+            break;
+        case OPT_DNS_TIMEOUT: // Seconds before a DNS query is lost
+            args->dns_timeout = atoi(optarg);
+            break;
+        case OPT_DNS_SLOTS: // Number of pending DNS queries
+            args->dns_slots = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_TCP_METRICS: // Measure the TCP connections
+            args->tcp_metrics = 1;
+            break;
+        case OPT_TCP_FLOWS: // Print each TCP connection when it ends
+            args->tcp_metrics = 1;
+            args->tcp_flows = 1;
+            break;
+        case OPT_TCP_TIMEOUT: // Idle seconds before a TCP connection ends
+            args->tcp_timeout = atoi(optarg);
+            break;
+        case OPT_TCP_SLOTS: // Number of tracked TCP connections
+            args->tcp_slots = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_TOP:       // Rank the top talkers of each interval
+            args->top_rows = strtoul(optarg, NULL, 0);
+            if (args->top_rows == 0) {
+                fprintf(stderr, "Invalid number of top talkers: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_TOP_INTERVAL: // Seconds of a top talkers interval
+            args->top_interval = atoi(optarg);
+            break;
+        case OPT_TOP_WIDTH: // Counters per row of the top talkers sketches
+            args->top_width = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_PERF:      // Count the drops and time the stages
+            args->perf = 1;
+            break;
+        case OPT_PERF_INTERVAL: // Seconds between two performance reports
+            args->perf = 1;
+            args->perf_interval = atoi(optarg);
+            break;
+        case OPT_OVERLOAD:  // Shed the load of a live capture
+            args->overload = 1;
+            break;
+        case OPT_SAMPLE_MODE: // How the overload controller samples
+            args->overload = 1;
+            if (strcmp(optarg, "flow") == 0)
+                args->sample_mode = OVERLOAD_FLOW;
+            else if (strcmp(optarg, "count") == 0)
+                args->sample_mode = OVERLOAD_COUNT;
+            else {
+                fprintf(stderr, "Invalid --sample-mode %s, expected flow or count\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case OPT_SAMPLE_MAX: // Largest 1 in N of the overload controller
+            args->overload = 1;
+            args->sample_max = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_FANOUT:    // Sockets per interface in a fanout group
+            if (parse_fanout(optarg, args) < 0)
+                return -1;
+            break;
+        case OPT_CPUS:      // Cores of the capture threads
+            if (parse_cpus(optarg, args) < 0)
+                return -1;
+            break;
+        case OPT_MERGE:     // How the packets of several sources are merged
+            if (strcmp(optarg, "ordered") == 0)
+                args->merge = MULTICAP_ORDERED;
+            else if (strcmp(optarg, "arrival") == 0)
+                args->merge = MULTICAP_ARRIVAL;
+            else {
+                fprintf(stderr, "Invalid --merge %s, expected ordered or arrival\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case OPT_MERGE_DELAY: // Milliseconds a packet waits for the other sources
+            args->merge_delay = atoi(optarg);
+            break;
+        case OPT_INDEX:     // Index the output file
+            args->index = 1;
+            break;
+        case OPT_INDEX_BUCKET: // Seconds per time bucket of the index
+            args->index_bucket = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_FROM:      // First time to read of the input file
+            args->from = optarg;
+            break;
+        case OPT_TO:        // Last time to read of the input file
+            args->to = optarg;
+            break;
+        case OPT_FLOW_KEY:  // Flow to read of the input file
+            args->flow_key = optarg;
+            break;
+        case 'C':           // Millions of bytes of an output file before the next one
+            args->rotate_size = strtoull(optarg, NULL, 0) * 1000000;
+            break;
+        case 'G':           // Seconds of packets of an output file before the next one
+            args->rotate_seconds = atoi(optarg);
+            break;
+        case OPT_DUMP_SYNC: // When the output files are flushed to the disk
+            if (strcmp(optarg, "none") == 0)
+                args->dump_sync = DUMPFILE_SYNC_NONE;
+            else if (strcmp(optarg, "file") == 0)
+                args->dump_sync = DUMPFILE_SYNC_FILE;
+            else if (strcmp(optarg, "buffer") == 0)
+                args->dump_sync = DUMPFILE_SYNC_BUFFER;
+            else {
+                fprintf(stderr, "Invalid --dump-sync %s, expected none, file or buffer\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case OPT_DUMP_DIRECT: // Write the output files with O_DIRECT
+            args->dump_direct = 1;
+            break;
+        case OPT_DUMP_BUFFER: // Output file buffer size in KiB
+            args->dump_buffer = atoi(optarg);
+            break;
+        case OPT_PCAPNG:    // Write the output files as pcapng
+            args->pcapng = 1;
+            break;
+        case OPT_PCAPNG_COMMENTS: // Comment the pcapng packets with their flow and protocol
+            args->pcapng = 1;
+            args->pcapng_comments = 1;
+            break;
+        case OPT_PRINT:     // Decode the packets written to the output file too
+            args->print = 1;
+            break;
+        case 'o':           // Output format
+            if (strcmp(optarg, "text") == 0)
+                args->format = FORMAT_TEXT;
+            else if (strcmp(optarg, "arrow") == 0)
+                args->format = FORMAT_ARROW;
+            else if (strcmp(optarg, "ndjson") == 0)
+                args->format = FORMAT_NDJSON;
+            else {
+                fprintf(stderr, "Invalid format %s, expected text, arrow or ndjson\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case OPT_BATCH_ROWS: // Rows of an Arrow record batch
+            args->batch_rows = strtoul(optarg, NULL, 0);
+            break;
         case 'h':           // Help
             helper_function();
             return 1;
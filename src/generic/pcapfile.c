@@ -0,0 +1,548 @@
+/**
+ * @author Flavien Lallemant
+ * @file pcapfile.c
+ * @brief Mapped capture file reader definition
+ *
+ * This file contains the definition of the reader walking a pcap or pcapng
+ * file mapped in memory.
+ * The whole file is mapped at once and read sequentially: the kernel is told
+ * so, and the range following the current record is asked for ahead of time
+ * so the decoding seldom waits on a page fault.
+ * The records are checked against the end of the file before they are handed
+ * over, and the errors reported the way libpcap does.
+ *
+ * @see pcapfile.h
+ * @see pcapfile_open
+ * @see pcapfile_next
+ * @see pcapfile_dup
+ * @see pcapfile_close
+ */
+
+// Global libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local header files
+#include "pcapfile.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4       /**< pcap file, microsecond timestamps */
+#define PCAP_MAGIC_NSEC 0xa1b23c4d  /**< pcap file, nanosecond timestamps */
+#define PCAPNG_SHB 0x0a0d0d0a       /**< pcapng section header block */
+#define PCAPNG_IDB 0x00000001       /**< pcapng interface description block */
+#define PCAPNG_PB 0x00000002        /**< pcapng obsolete packet block */
+#define PCAPNG_SPB 0x00000003       /**< pcapng simple packet block */
+#define PCAPNG_EPB 0x00000006       /**< pcapng enhanced packet block */
+#define PCAPNG_BOM 0x1a2b3c4d       /**< pcapng byte-order magic */
+#define PCAPFILE_MAX_SNAPLEN 262144 /**< Largest packet libpcap reads */
+
+
+/**
+ * @brief Read a 32-bit value of the file
+ *
+ * @param pf The reader
+ * @param off The offset of the value
+ * @return uint32_t The value in host order
+ */
+static uint32_t rd32(const struct pcapfile *pf, size_t off)
+{
+    uint32_t v;
+    memcpy(&v, pf->map + off, sizeof(v));
+    return pf->swap ? __builtin_bswap32(v) : v;
+}
+
+
+/**
+ * @brief Read a 16-bit value of the file
+ *
+ * @param pf The reader
+ * @param off The offset of the value
+ * @return uint16_t The value in host order
+ */
+static uint16_t rd16(const struct pcapfile *pf, size_t off)
+{
+    uint16_t v;
+    memcpy(&v, pf->map + off, sizeof(v));
+    return pf->swap ? __builtin_bswap16(v) : v;
+}
+
+
+/**
+ * @brief Ask the kernel for the range following the current record
+ *
+ * @param pf The reader
+ */
+static void readahead_file(struct pcapfile *pf)
+{
+    if (pf->off + PCAPFILE_READAHEAD / 2 < pf->advised || pf->advised >= pf->end)
+        return;
+    size_t len = pf->end - pf->advised < PCAPFILE_READAHEAD
+                     ? pf->end - pf->advised
+                     : PCAPFILE_READAHEAD;
+    madvise((void *)(pf->map + pf->advised), len, MADV_WILLNEED);
+    pf->advised += len;
+}
+
+
+/**
+ * @brief Check a link type can be given as a DLT
+ *
+ * @param linktype The link type of the file
+ * @return int 1 if the DLT has the same value, 0 if libpcap must map it
+ */
+static int linktype_is_dlt(uint32_t linktype)
+{
+    return linktype < 100 || linktype == 105 || linktype > 107;
+}
+
+
+/**
+ * @brief Set the snapshot length the way libpcap does
+ *
+ * @param pf The reader
+ * @param snaplen The snapshot length of the file
+ */
+static void set_snaplen(struct pcapfile *pf, uint32_t snaplen)
+{
+    pf->snaplen = snaplen == 0 || snaplen > PCAPFILE_MAX_SNAPLEN
+                      ? PCAPFILE_MAX_SNAPLEN
+                      : (int)snaplen;
+}
+
+
+/**
+ * @brief Check the bounds of the pcapng block at the current offset
+ *
+ * The byte order of a section header block is read first, since it sets how
+ * its length is read.
+ *
+ * @param pf The reader
+ * @param type The type of the block, set on success
+ * @param len The length of the block, set on success
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+static int ng_block(struct pcapfile *pf, uint32_t *type, uint32_t *len)
+{
+    if (pf->off == pf->end)
+        return 0;
+    if (pf->end - pf->off < 12) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "truncated pcapng dump file; tried to read 12 header bytes, only got %zu",
+                 pf->end - pf->off);
+        return (-1);
+    }
+    *type = rd32(pf, pf->off);
+    if (*type == PCAPNG_SHB) {
+        uint32_t bom;
+        memcpy(&bom, pf->map + pf->off + 8, sizeof(bom));
+        if (bom != PCAPNG_BOM && bom != __builtin_bswap32(PCAPNG_BOM)) {
+            snprintf(pf->err, sizeof(pf->err),
+                     "section header block has a bad byte-order magic 0x%08x",
+                     bom);
+            return (-1);
+        }
+        pf->swap = bom != PCAPNG_BOM;
+    }
+    *len = rd32(pf, pf->off + 4);
+    if (*len < 12 || *len % 4 != 0) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "block in pcapng dump file has a length of %u", *len);
+        return (-1);
+    }
+    if (*len > pf->end - pf->off) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "truncated pcapng dump file; tried to read %u bytes, only got %zu",
+                 *len, pf->end - pf->off);
+        return (-1);
+    }
+    return 1;
+}
+
+
+/**
+ * @brief Add the interface of an interface description block
+ *
+ * @param pf The reader
+ * @param len The length of the block, at the current offset
+ * @return int 0 on success, -1 on error
+ */
+static int ng_interface(struct pcapfile *pf, uint32_t len)
+{
+    if (len < 20) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "interface description block is too short");
+        return (-1);
+    }
+    uint32_t linktype = rd16(pf, pf->off + 8);
+    if (pf->if_count > 0 && (int)linktype != pf->linktype) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "an interface has a type %u different from the type of the first interface",
+                 linktype);
+        return (-1);
+    }
+    if (pf->if_count == pf->if_size) {
+        unsigned size = pf->if_size ? pf->if_size * 2 : 4;
+        struct pcapfile_if *ifs = realloc(pf->ifs, size * sizeof(*ifs));
+        if (ifs == NULL) {
+            snprintf(pf->err, sizeof(pf->err), "%s", strerror(errno));
+            return (-1);
+        }
+        pf->ifs = ifs;
+        pf->if_size = size;
+    }
+
+    struct pcapfile_if *ifp = &pf->ifs[pf->if_count];
+    ifp->units = 1000000;
+    ifp->offset = 0;
+    ifp->snaplen = rd32(pf, pf->off + 12);
+    size_t opt = pf->off + 16;
+    size_t end = pf->off + len - 4;
+    while (end - opt >= 4) {
+        uint16_t code = rd16(pf, opt);
+        uint16_t olen = rd16(pf, opt + 2);
+        opt += 4;
+        if (code == 0 || olen > end - opt) // End of options
+            break;
+        if (code == 9 && olen >= 1) { // if_tsresol
+            uint8_t res = pf->map[opt];
+            unsigned exp = res & 0x7f;
+            if ((res & 0x80) ? exp > 63 : exp > 19) {
+                snprintf(pf->err, sizeof(pf->err),
+                         "interface has a timestamp resolution of 0x%02x", res);
+                return (-1);
+            }
+            ifp->units = 1;
+            for (unsigned i = 0; i < exp; i++)
+                ifp->units *= (res & 0x80) ? 2 : 10;
+        } else if (code == 14 && olen == 8) { // if_tsoffset
+            uint64_t v = (uint64_t)rd32(pf, opt) | (uint64_t)rd32(pf, opt + 4) << 32;
+            if (pf->swap) // Stored as one 64-bit value
+                v = v << 32 | v >> 32;
+            ifp->offset = (int64_t)v;
+        }
+        opt += (olen + 3u) & ~3u;
+    }
+
+    if (pf->if_count++ == 0) {
+        pf->linktype = linktype;
+        set_snaplen(pf, ifp->snaplen);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Convert a pcapng timestamp
+ *
+ * @param ifp The interface of the packet
+ * @param ts The timestamp, in units of the interface
+ * @param tv The time to fill, in microseconds
+ * @param nsec The nanoseconds of the second to fill
+ */
+static void ng_time(const struct pcapfile_if *ifp, uint64_t ts,
+                    struct timeval *tv, uint32_t *nsec)
+{
+    uint64_t frac = ts % ifp->units;
+    tv->tv_sec = (time_t)(ts / ifp->units + ifp->offset);
+    *nsec = (uint32_t)((unsigned __int128)frac * 1000000000 / ifp->units);
+    tv->tv_usec = *nsec / 1000;
+}
+
+
+/**
+ * @brief Read the next packet of a pcapng file
+ *
+ * @param pf The reader
+ * @param header The header to fill
+ * @param data The packet, set on success
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+static int ng_next(struct pcapfile *pf, struct pcap_pkthdr *header,
+                   const unsigned char **data)
+{
+    uint32_t type, len;
+    int status;
+    while ((status = ng_block(pf, &type, &len)) > 0) {
+        size_t body = pf->off + 8;
+        uint32_t room = len - 12; // Bytes between the header and the trailing length
+        const struct pcapfile_if *ifp = NULL;
+        uint32_t caplen = 0;
+        size_t start = 0;
+
+        switch (type) {
+        case PCAPNG_SHB: // New section, new interfaces
+            pf->if_count = 0;
+            break;
+        case PCAPNG_IDB:
+            if (ng_interface(pf, len) < 0)
+                return (-1);
+            break;
+        case PCAPNG_EPB:
+        case PCAPNG_PB: {
+            if (room < 20)
+                goto short_block;
+            uint32_t id = type == PCAPNG_EPB ? rd32(pf, body) : rd16(pf, body);
+            if (id >= pf->if_count) {
+                snprintf(pf->err, sizeof(pf->err),
+                         "a packet arrived on interface %u, but there's no such interface",
+                         id);
+                return (-1);
+            }
+            ifp = &pf->ifs[id];
+            caplen = rd32(pf, body + 12);
+            header->len = rd32(pf, body + 16);
+            if (caplen > room - 20)
+                goto short_block;
+            uint64_t ts = (uint64_t)rd32(pf, body + 4) << 32 | rd32(pf, body + 8);
+            ng_time(ifp, ts, &header->ts, &pf->nsec);
+            start = body + 20;
+            break;
+        }
+        case PCAPNG_SPB:
+            if (room < 4)
+                goto short_block;
+            if (pf->if_count == 0) {
+                snprintf(pf->err, sizeof(pf->err),
+                         "a simple packet arrived, but there's no interface");
+                return (-1);
+            }
+            ifp = &pf->ifs[0];
+            header->len = rd32(pf, body);
+            caplen = header->len;
+            if (ifp->snaplen && caplen > ifp->snaplen)
+                caplen = ifp->snaplen;
+            if (caplen > room - 4)
+                caplen = room - 4;
+            header->ts.tv_sec = 0; // Simple packets have no timestamp
+            header->ts.tv_usec = 0;
+            pf->nsec = 0;
+            start = body + 4;
+            break;
+        }
+        pf->off += len;
+        if (ifp == NULL)
+            continue;
+        if (caplen > (uint32_t)pf->snaplen)
+            caplen = pf->snaplen;
+        header->caplen = caplen;
+        *data = pf->map + start;
+        return 1;
+    }
+    return status;
+
+short_block:
+    snprintf(pf->err, sizeof(pf->err),
+             "block of type 0x%08x is too short for its packet", type);
+    return (-1);
+}
+
+
+/**
+ * @brief Read the next packet of a pcap file
+ *
+ * @param pf The reader
+ * @param header The header to fill
+ * @param data The packet, set on success
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+static int pcap_next_record(struct pcapfile *pf, struct pcap_pkthdr *header,
+                            const unsigned char **data)
+{
+    size_t left = pf->end - pf->off;
+    if (left == 0)
+        return 0;
+    if (left < 16) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "truncated dump file; tried to read 16 header bytes, only got %zu",
+                 left);
+        return (-1);
+    }
+    uint32_t caplen = rd32(pf, pf->off + 8);
+    if (caplen > PCAPFILE_MAX_SNAPLEN && caplen > (uint32_t)pf->snaplen) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "invalid packet capture length %u, bigger than maximum of %u",
+                 caplen, PCAPFILE_MAX_SNAPLEN);
+        return (-1);
+    }
+    if (caplen > left - 16) {
+        snprintf(pf->err, sizeof(pf->err),
+                 "truncated dump file; tried to read %u captured bytes, only got %zu",
+                 caplen, left - 16);
+        return (-1);
+    }
+    header->ts.tv_sec = rd32(pf, pf->off);
+    header->ts.tv_usec = rd32(pf, pf->off + 4);
+    pf->nsec = pf->nano ? header->ts.tv_usec : header->ts.tv_usec * 1000;
+    if (pf->nano)
+        header->ts.tv_usec /= 1000;
+    header->len = rd32(pf, pf->off + 12);
+    header->caplen = caplen > (uint32_t)pf->snaplen ? (uint32_t)pf->snaplen
+                                                    : caplen;
+    *data = pf->map + pf->off + 16;
+    pf->off += 16 + (size_t)caplen;
+    return 1;
+}
+
+
+/**
+ * @brief Read the file header
+ *
+ * A pcapng file is read up to its first interface, which gives the link type
+ * of the packets.
+ *
+ * @param pf The reader
+ * @return int 0 on success, -1 if the file must go to libpcap
+ */
+static int read_header(struct pcapfile *pf)
+{
+    uint32_t magic;
+    memcpy(&magic, pf->map, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        pf->ng = 1;
+        uint32_t type, len;
+        while (pf->if_count == 0) {
+            if (ng_block(pf, &type, &len) <= 0)
+                return (-1);
+            if (type == PCAPNG_IDB && ng_interface(pf, len) < 0)
+                return (-1);
+            if (type == PCAPNG_EPB || type == PCAPNG_PB || type == PCAPNG_SPB)
+                return (-1); // A packet before any interface
+            pf->off += len;
+        }
+        return linktype_is_dlt(pf->linktype) ? 0 : (-1);
+    }
+
+    if (magic == __builtin_bswap32(PCAP_MAGIC) ||
+        magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        pf->swap = 1;
+        magic = __builtin_bswap32(magic);
+    }
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+        return (-1);
+    if (rd16(pf, 4) != 2) // Major version
+        return (-1);
+    pf->nano = magic == PCAP_MAGIC_NSEC;
+    uint32_t linktype = rd32(pf, 20) & 0x03ffffff; // Without the FCS bits
+    if (!linktype_is_dlt(linktype))
+        return (-1);
+    pf->linktype = linktype;
+    set_snaplen(pf, rd32(pf, 16));
+    pf->off = 24;
+    return 0;
+}
+
+
+/**
+ * @brief Map a capture file
+ *
+ * @param file The file to read
+ * @return struct pcapfile* The reader, NULL if the file must go to libpcap
+ */
+struct pcapfile *pcapfile_open(const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 24 ||
+        (uintmax_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    struct pcapfile *pf = calloc(1, sizeof(struct pcapfile));
+    if (pf == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    pf->map = map;
+    pf->size = st.st_size;
+    pf->end = pf->size;
+    if (read_header(pf) < 0) {
+        pcapfile_close(pf);
+        return NULL;
+    }
+    readahead_file(pf);
+    return pf;
+}
+
+
+/**
+ * @brief Read the next packet
+ *
+ * @param pf The reader
+ * @param header The header to fill
+ * @param data The packet, set on success
+ * @return int 1 on success, 0 at the end of the file, -1 on error
+ */
+int pcapfile_next(struct pcapfile *pf, struct pcap_pkthdr *header,
+                  const unsigned char **data)
+{
+    int status;
+    do {
+        if (pf->picks) { // Random access, nothing to read ahead
+            if (pf->pick == pf->pick_count || pf->picks[pf->pick] >= pf->end)
+                return 0;
+            pf->off = pf->picks[pf->pick++];
+        } else {
+            readahead_file(pf);
+        }
+        status = pf->ng ? ng_next(pf, header, data)
+                        : pcap_next_record(pf, header, data);
+    } while (status > 0 && (timercmp(&header->ts, &pf->from, <) ||
+                            (pf->to.tv_sec && timercmp(&header->ts, &pf->to, >))));
+    return status;
+}
+
+
+/**
+ * @brief Copy a reader at its next record
+ *
+ * @param pf The reader
+ * @return struct pcapfile* The copy, NULL on error
+ */
+struct pcapfile *pcapfile_dup(const struct pcapfile *pf)
+{
+    struct pcapfile *dup = malloc(sizeof(struct pcapfile));
+    if (dup == NULL)
+        return NULL;
+    *dup = *pf;
+    dup->copy = 1;
+    // Each reader asks for the range it is about to read, from a page boundary
+    dup->advised = pf->off & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    if (pf->if_size > 0) {
+        dup->ifs = malloc(pf->if_size * sizeof(struct pcapfile_if));
+        if (dup->ifs == NULL) {
+            free(dup);
+            return NULL;
+        }
+        memcpy(dup->ifs, pf->ifs, pf->if_count * sizeof(struct pcapfile_if));
+    }
+    return dup;
+}
+
+
+/**
+ * @brief Unmap a capture file, or free a copy
+ *
+ * @param pf The reader
+ */
+void pcapfile_close(struct pcapfile *pf)
+{
+    if (!pf->copy) {
+        munmap((void *)pf->map, pf->size);
+        free(pf->picks);
+    }
+    free(pf->ifs);
+    free(pf);
+}
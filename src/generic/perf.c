@@ -0,0 +1,255 @@
+/**
+ * @author Flavien Lallemant
+ * @file perf.c
+ * @brief Runtime performance counters definition
+ *
+ * This file contains the definition of the runtime performance counters.
+ * The counters of each thread are allocated the first time it counts, and
+ * kept in a list until perf_close(). A report adds them up; the cycles of
+ * the calls timed give the average time of a call of each stage, and with
+ * the number of calls an estimate of the time spent in it. The time stamp
+ * counter is calibrated against the monotonic clock over the whole capture.
+ *
+ * @see perf.h
+ * @see perf_init
+ * @see perf_attach
+ * @see perf_report
+ * @see perf_close
+ */
+
+// Global libraries
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Local header files
+#include "capture.h"
+#include "perf.h"
+
+int perf_enabled = 0;
+volatile sig_atomic_t perf_requested = 0;
+__thread struct perf_thread *perf_self = NULL;
+
+/**
+ * @brief Counters of every thread added up
+ */
+struct perf_totals {
+    uint64_t layers[PERF_LAYERS];
+    uint64_t calls[PERF_STAGE_COUNT];
+    uint64_t samples[PERF_STAGE_COUNT];
+    uint64_t cycles[PERF_STAGE_COUNT];
+    int threads;    /**< Threads that counted */
+};
+
+static struct perf_thread *threads = NULL; /**< The counters of every thread */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER; /**< Guards threads */
+static uint64_t start_cycles; /**< The time stamp counter when the counting started */
+static long long start_ns; /**< The monotonic clock when the counting started */
+static int timer_armed = 0; /**< 1 if the report timer runs */
+
+static const char *stage_names[PERF_APP] = {
+    "packet", "decode", "filter", "reasm", "track", "render",
+    "output"}; /**< Names of the stages before the application dissectors */
+static const char *layer_names[PERF_LAYERS] = {
+    "eth", "arp", "ipv4", "ipv6", "icmp", "icmp6", "tcp", "udp", "app",
+    "stream", "plugin", "sll", "encap", "frag", "defrag", "truncated"}; /**< Names of the LAYER_* flags */
+
+
+/**
+ * @brief Get a monotonic time in nanoseconds
+ *
+ * @return long long The time
+ */
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Ask for a report
+ *
+ * @param sig The signal received
+ */
+static void request_report(int sig)
+{
+    (void)sig;
+    perf_requested = 1;
+}
+
+
+/**
+ * @brief Allocate the counters of the calling thread
+ *
+ * @return struct perf_thread* The counters, NULL on error
+ */
+struct perf_thread *perf_attach(void)
+{
+    struct perf_thread *t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    pthread_mutex_lock(&threads_lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&threads_lock);
+    perf_self = t;
+    return t;
+}
+
+
+/**
+ * @brief Start counting
+ *
+ * @param interval Seconds between two reports, 0 for none
+ * @return int 0 on success, -1 on error
+ *
+ * @see request_report
+ */
+int perf_init(int interval)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_report;
+    sa.sa_flags = SA_RESTART; // The capture goes on after the signal
+    if (sigaction(SIGUSR1, &sa, NULL) < 0 ||
+        (interval > 0 && sigaction(SIGALRM, &sa, NULL) < 0)) {
+        perror("sigaction");
+        return (-1);
+    }
+    if (interval > 0) {
+        struct itimerval it = {{interval, 0}, {interval, 0}};
+        if (setitimer(ITIMER_REAL, &it, NULL) < 0) {
+            perror("setitimer");
+            return (-1);
+        }
+        timer_armed = 1;
+    }
+    start_ns = now_ns();
+    start_cycles = perf_cycles();
+    perf_enabled = 1;
+    return 0;
+}
+
+
+/**
+ * @brief Print the time spent in each stage
+ *
+ * @param f The stream to print to
+ * @param sum The counters of every thread added up
+ * @param elapsed The nanoseconds since the counting started
+ * @param ns_per_cycle The length of a cycle in nanoseconds
+ */
+static void print_stages(FILE *f, const struct perf_totals *sum,
+                         double elapsed, double ns_per_cycle)
+{
+    fprintf(f, "  %-10s %14s %12s %10s %8s\n", "stage", "calls", "ns/call",
+            "total s", "share");
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        uint64_t calls = sum->calls[s];
+        uint64_t samples = sum->samples[s];
+        if (calls == 0)
+            continue;
+        const char *name = s < PERF_APP ? stage_names[s]
+                                        : app_proto_name(s - PERF_APP);
+        if (samples == 0) {
+            fprintf(f, "  %-10s %14llu %12s\n", name,
+                    (unsigned long long)calls, "-");
+            continue;
+        }
+        double ns = sum->cycles[s] * ns_per_cycle / samples;
+        double total = ns * calls;
+        fprintf(f, "  %-10s %14llu %12.1f %10.3f %7.1f%%\n", name,
+                (unsigned long long)calls, ns, total / 1e9,
+                elapsed > 0 ? total * 100 / elapsed : 0);
+    }
+}
+
+
+/**
+ * @brief Print the counters
+ *
+ * The share of a stage is the time spent in it over the time since the
+ * counting started, so with several threads the shares can add up to more
+ * than 100%.
+ *
+ * @param f The stream to print to
+ * @param cap The handle to read the kernel counters of, NULL for none
+ * @param title The title of the report
+ *
+ * @see capture_stats
+ * @see print_stages
+ */
+void perf_report(FILE *f, struct capture *cap, const char *title)
+{
+    perf_requested = 0;
+    if (!perf_enabled)
+        return;
+
+    struct perf_totals sum;
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&threads_lock);
+    for (struct perf_thread *t = threads; t; t = t->next) {
+        sum.threads++;
+        for (int l = 0; l < PERF_LAYERS; l++)
+            sum.layers[l] += atomic_load_explicit(&t->layers[l],
+                                                  memory_order_relaxed);
+        for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+            sum.calls[s] += atomic_load_explicit(&t->calls[s],
+                                                 memory_order_relaxed);
+            sum.samples[s] += atomic_load_explicit(&t->samples[s],
+                                                   memory_order_relaxed);
+            sum.cycles[s] += atomic_load_explicit(&t->cycles[s],
+                                                  memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+
+    double elapsed = now_ns() - start_ns;
+    uint64_t cycles = perf_cycles() - start_cycles;
+    double ns_per_cycle = cycles > 0 ? elapsed / cycles : 0;
+    fprintf(f, "Performance, %s: %.3f s, %d thread%s, 1 call in %d timed\n",
+            title, elapsed / 1e9, sum.threads, sum.threads > 1 ? "s" : "",
+            PERF_SAMPLE);
+
+    struct capture_stats cs;
+    if (cap && capture_stats(cap, &cs) == 0)
+        fprintf(f, "  Kernel: %llu received, %llu dropped (%.2f%%), %llu "
+                   "dropped by the interface\n",
+                cs.received, cs.dropped,
+                cs.received ? cs.dropped * 100.0 / cs.received : 0,
+                cs.ifdropped);
+
+    fprintf(f, "  Layers:");
+    for (int l = 0; l < PERF_LAYERS; l++)
+        if (layer_names[l] && sum.layers[l])
+            fprintf(f, " %s %llu", layer_names[l],
+                    (unsigned long long)sum.layers[l]);
+    fprintf(f, "\n");
+    print_stages(f, &sum, elapsed, ns_per_cycle);
+}
+
+
+/**
+ * @brief Stop counting and release the counters
+ */
+void perf_close(void)
+{
+    if (timer_armed) {
+        struct itimerval it;
+        memset(&it, 0, sizeof(it));
+        setitimer(ITIMER_REAL, &it, NULL);
+        timer_armed = 0;
+    }
+    perf_enabled = 0;
+    pthread_mutex_lock(&threads_lock);
+    while (threads) {
+        struct perf_thread *t = threads;
+        threads = t->next;
+        free(t);
+    }
+    pthread_mutex_unlock(&threads_lock);
+    perf_self = NULL;
+}
@@ -0,0 +1,460 @@
+/**
+ * @author Flavien Lallemant
+ * @file pipeline.c
+ * @brief Multi-threaded decoding pipeline definition
+ *
+ * This file contains the definition of the decoding pipeline.
+ * Packets are numbered by the capture thread and stored in the slot of their
+ * number in a ring. Each worker has its own single producer single consumer
+ * queue of slots, and marks a slot done once decoded. IP packets are sent to
+ * the worker of the hash of their addresses and protocol, so every packet of a
+ * connection, in both directions and fragments included, is decoded by the
+ * same worker and per-flow state needs no lock. The output thread waits
+ * for the slots in number order, so the sink sees the packets in capture
+ * order whatever worker decoded them, then gives the slot back to the capture
+ * thread.
+ *
+ * @see pipeline.h
+ * @see pipeline_start
+ * @see pipeline_submit
+ * @see pipeline_fill
+ * @see pipeline_stop
+ */
+
+// Global libraries
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "arena.h"
+#include "dissector.h"
+#include "dnsname.h"
+#include "flow.h"
+#include "ipfrag.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "reasm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define SLOT_FREE 0     /**< The slot can be filled by the capture thread */
+#define SLOT_FILLED 1   /**< The slot waits for a worker */
+#define SLOT_DONE 2     /**< The slot waits for the output thread */
+
+/**
+ * @brief Slot of the ring
+ */
+struct slot {
+    struct packet_info pi;      /**< The decoded packet */
+    struct pcap_pkthdr header;  /**< The copied header */
+    u_char *data;               /**< The copied packet */
+    uint32_t data_cap;          /**< Size of the data buffer */
+    int status;                 /**< The value returned by decode_packet() */
+    struct outbuf text;         /**< The rendered packet */
+    _Atomic int state;          /**< SLOT_* state */
+};
+
+/**
+ * @brief Queue of slot numbers
+ *
+ * A single producer single consumer queue between the capture thread and a
+ * worker.
+ */
+struct queue {
+    uint64_t *seq;              /**< Numbers of the queued slots */
+    uint64_t mask;              /**< Size of the queue minus one */
+    _Atomic uint64_t head;      /**< Next number pushed by the capture thread */
+    _Atomic uint64_t tail;      /**< Next number popped by the worker */
+};
+
+/**
+ * @brief Decoding worker
+ */
+struct worker {
+    pthread_t thread;
+    struct queue queue;
+    uint64_t packets;           /**< Packets decoded */
+    uint64_t max_depth;         /**< Highest number of queued slots */
+} __attribute__((aligned(64)));
+
+/**
+ * @brief The pipeline
+ */
+static struct {
+    struct pipeline_config cfg;
+    struct slot *slots;
+    uint64_t mask;              /**< Number of slots minus one */
+    struct worker *workers;
+    pthread_t output;
+    _Atomic uint64_t head;      /**< Number of packets submitted */
+    _Atomic uint64_t tail;      /**< Number of packets given to the sink */
+    _Atomic int done;           /**< 1 once the capture is over */
+    /* Capture stage counters */
+    uint64_t dropped;           /**< Packets dropped because the ring was full */
+    uint64_t ring_waits;        /**< Times the capture waited for a free slot */
+    uint64_t max_ring;          /**< Highest number of slots in use */
+    /* Output stage counters */
+    uint64_t output_waits;      /**< Times the output waited for the next slot */
+} pl;
+
+
+/**
+ * @brief Wait a little longer at each call
+ *
+ * @param spins The number of calls since the last progress, updated
+ */
+static void backoff(unsigned *spins)
+{
+    if (*spins < 64) {
+        cpu_relax();
+    } else if (*spins < 128) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+    (*spins)++;
+}
+
+
+/**
+ * @brief Decoding worker thread
+ *
+ * @param arg The worker
+ * @return void* NULL
+ */
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct queue *q = &w->queue;
+    unsigned spins = 0;
+
+    for (;;) {
+        uint64_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == head) {
+            if (atomic_load_explicit(&pl.done, memory_order_acquire) &&
+                tail == atomic_load_explicit(&q->head, memory_order_acquire))
+                break;
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        if (head - tail > w->max_depth)
+            w->max_depth = head - tail;
+
+        uint64_t seq = q->seq[tail & q->mask];
+        struct slot *s = &pl.slots[seq & pl.mask];
+        s->status = decode_packet(s->header.ts, s->header.caplen,
+                                  s->header.len, s->data, &s->pi);
+        if (s->pi.layers & LAYER_DEFRAG) {
+            // The datagram is in the scratch memory of the worker, which the
+            // next packet reuses before the output thread reads the slot
+            u_char *data = s->data;
+            if (s->pi.caplen > s->data_cap) {
+                data = realloc(s->data, s->pi.caplen);
+                if (data != NULL) {
+                    s->data = data;
+                    s->data_cap = s->pi.caplen;
+                }
+            }
+            if (data == NULL)
+                s->status = DECODE_FILTERED;
+            else
+                memcpy(data, ipfrag_data(&s->pi, NULL), s->pi.caplen);
+        }
+        s->text.len = 0;
+        if (pl.cfg.render && s->status != DECODE_FILTERED) {
+            out_bind(&s->text);
+            uint64_t start = perf_begin(PERF_RENDER);
+            pl.cfg.render(&s->pi, s->data, seq + 1);
+            perf_end(PERF_RENDER, start);
+            out_bind(NULL);
+        }
+        w->packets++;
+        atomic_store_explicit(&s->state, SLOT_DONE, memory_order_release);
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    }
+    reasm_release(); // Flows of the worker, if any
+    ipfrag_release();
+    arena_release();
+    dns_name_release();
+    dissector_release();
+    return NULL;
+}
+
+
+/**
+ * @brief Output thread
+ *
+ * @param arg Unused
+ * @return void* NULL
+ */
+static void *output_main(void *arg)
+{
+    (void)arg;
+    unsigned spins = 0;
+
+    for (;;) {
+        uint64_t tail = atomic_load_explicit(&pl.tail, memory_order_relaxed);
+        struct slot *s = &pl.slots[tail & pl.mask];
+        if (atomic_load_explicit(&s->state, memory_order_acquire) != SLOT_DONE) {
+            if (atomic_load_explicit(&pl.done, memory_order_acquire) &&
+                tail == atomic_load_explicit(&pl.head, memory_order_acquire))
+                break;
+            if (spins == 0)
+                pl.output_waits++;
+            if (pl.cfg.idle && spins % PIPELINE_IDLE == PIPELINE_IDLE - 1)
+                pl.cfg.idle(pl.cfg.sink_arg);
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        if (s->status != DECODE_FILTERED)
+            pl.cfg.sink(&s->pi, s->status, s->data, &s->text, pl.cfg.sink_arg);
+        atomic_store_explicit(&s->state, SLOT_FREE, memory_order_relaxed);
+        atomic_store_explicit(&pl.tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Release a set of slots and queues
+ *
+ * @param slots The slots, NULL if none
+ * @param nslots The number of slots
+ * @param workers The workers, NULL if none
+ * @param nworkers The number of workers
+ */
+static void pipeline_release(struct slot *slots, uint64_t nslots,
+                             struct worker *workers, int nworkers)
+{
+    for (uint64_t i = 0; slots && i < nslots; i++) {
+        free(slots[i].data);
+        free(slots[i].text.data);
+    }
+    for (int i = 0; workers && i < nworkers; i++)
+        free(workers[i].queue.seq);
+    free(slots);
+    free(workers);
+}
+
+
+/**
+ * @brief Release the slots and the queues of the pipeline
+ */
+static void pipeline_free(void)
+{
+    pipeline_release(pl.slots, pl.slots ? pl.mask + 1 : 0, pl.workers,
+                     pl.cfg.workers);
+    pl.slots = NULL;
+    pl.workers = NULL;
+}
+
+
+/**
+ * @brief Allocate the slots and the queues
+ *
+ * Everything is built before it is given to the pipeline, and released on
+ * the first allocation that fails.
+ *
+ * @param nslots The number of slots, a power of two
+ * @return int 0 on success, -1 on error
+ */
+static int pipeline_alloc(uint64_t nslots)
+{
+    int nworkers = pl.cfg.workers;
+    struct slot *slots = aligned_alloc(64, nslots * sizeof(struct slot));
+    struct worker *workers = aligned_alloc(64, nworkers * sizeof(struct worker));
+    if (slots == NULL || workers == NULL)
+        goto fail;
+    memset(slots, 0, nslots * sizeof(struct slot));
+    memset(workers, 0, nworkers * sizeof(struct worker));
+
+    for (uint64_t i = 0; i < nslots; i++) {
+        u_char *data = malloc(PIPELINE_SLOT_DATA);
+        if (data == NULL)
+            goto fail;
+        slots[i].data = data;
+        slots[i].data_cap = PIPELINE_SLOT_DATA;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        uint64_t *seq = malloc(nslots * sizeof(uint64_t));
+        if (seq == NULL)
+            goto fail;
+        workers[i].queue.seq = seq;
+        workers[i].queue.mask = nslots - 1;
+    }
+    pl.mask = nslots - 1;
+    pl.slots = slots;
+    pl.workers = workers;
+    return 0;
+
+fail:
+    pipeline_release(slots, nslots, workers, nworkers);
+    return (-1);
+}
+
+
+/**
+ * @brief Start the decoding workers and the output thread
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int pipeline_start(const struct pipeline_config *cfg)
+{
+    memset(&pl, 0, sizeof(pl));
+    pl.cfg = *cfg;
+    if (pl.cfg.workers <= 0) { // Keep a core for the capture and the output
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        pl.cfg.workers = cores > 3 ? cores - 2 : 1;
+    }
+
+    uint64_t nslots = 1;
+    while (nslots < (uint64_t)(pl.cfg.slots > 0 ? pl.cfg.slots : PIPELINE_SLOTS))
+        nslots <<= 1;
+    if (pipeline_alloc(nslots) < 0) {
+        fprintf(stderr, "Error allocating the pipeline\n");
+        return (-1);
+    }
+
+    int started = 0;
+    for (; started < pl.cfg.workers; started++) {
+        if (pthread_create(&pl.workers[started].thread, NULL, worker_main,
+                           &pl.workers[started]) != 0)
+            break;
+    }
+    if (started < pl.cfg.workers ||
+        pthread_create(&pl.output, NULL, output_main, NULL) != 0) {
+        fprintf(stderr, "Error starting the pipeline threads\n");
+        atomic_store(&pl.done, 1);
+        for (int i = 0; i < started; i++)
+            pthread_join(pl.workers[i].thread, NULL);
+        pipeline_free();
+        return (-1);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Submit a packet to the pipeline
+ *
+ * This function is the pcap_loop() callback of the capture thread.
+ * When the ring is full, a live capture drops the packet and an offline one
+ * waits for a slot.
+ *
+ * @see flow_key_packet
+ * @see flow_shard
+ *
+ * @param user Unused
+ * @param header The packet header
+ * @param packet The packet
+ */
+void pipeline_submit(u_char *user, const struct pcap_pkthdr *header,
+                     const u_char *packet)
+{
+    (void)user;
+    uint64_t head = atomic_load_explicit(&pl.head, memory_order_relaxed);
+    unsigned spins = 0;
+
+    while (head - atomic_load_explicit(&pl.tail, memory_order_acquire) > pl.mask) {
+        if (pl.cfg.live) {
+            pl.dropped++;
+            return;
+        }
+        if (spins == 0)
+            pl.ring_waits++;
+        backoff(&spins);
+    }
+    uint64_t used = head - atomic_load_explicit(&pl.tail, memory_order_relaxed);
+    if (used + 1 > pl.max_ring)
+        pl.max_ring = used + 1;
+
+    struct slot *s = &pl.slots[head & pl.mask];
+    if (header->caplen > s->data_cap) { // Only for packets above the slot size
+        u_char *data = realloc(s->data, header->caplen);
+        if (data == NULL) {
+            pl.dropped++;
+            return;
+        }
+        s->data = data;
+        s->data_cap = header->caplen;
+    }
+    s->header = *header;
+    memcpy(s->data, packet, header->caplen);
+    atomic_store_explicit(&s->state, SLOT_FILLED, memory_order_relaxed);
+
+    struct flow_key key;
+    uint64_t shard = head; // Packets without flow are spread evenly
+    if (flow_key_packet(packet, header->caplen, &key) == 0)
+        shard = flow_shard(&key);
+    struct worker *w = &pl.workers[shard % pl.cfg.workers];
+    uint64_t qhead = atomic_load_explicit(&w->queue.head, memory_order_relaxed);
+    w->queue.seq[qhead & w->queue.mask] = head;
+    atomic_store_explicit(&w->queue.head, qhead + 1, memory_order_release);
+    atomic_store_explicit(&pl.head, head + 1, memory_order_release);
+}
+
+
+/**
+ * @brief Get how full the ring is
+ *
+ * This function is called by the capture thread.
+ *
+ * @param dropped The packets dropped because the ring was full, set
+ * @return unsigned The percentage of the slots in use
+ */
+unsigned pipeline_fill(unsigned long long *dropped)
+{
+    uint64_t used = atomic_load_explicit(&pl.head, memory_order_relaxed) -
+                    atomic_load_explicit(&pl.tail, memory_order_relaxed);
+    *dropped = pl.dropped;
+    return (unsigned)(used * 100 / (pl.mask + 1));
+}
+
+
+/**
+ * @brief Drain and stop the pipeline
+ *
+ * This function waits for every submitted packet to reach the sink, stops the
+ * threads and prints the counters of each stage on stderr.
+ */
+void pipeline_stop(void)
+{
+    atomic_store_explicit(&pl.done, 1, memory_order_release);
+    for (int i = 0; i < pl.cfg.workers; i++)
+        pthread_join(pl.workers[i].thread, NULL);
+    pthread_join(pl.output, NULL);
+
+    fprintf(stderr, "Pipeline: %d workers, %llu slots\n", pl.cfg.workers,
+            (unsigned long long)(pl.mask + 1));
+    fprintf(stderr, "  capture: %llu packets, %llu dropped, %llu waits, "
+                    "max ring depth %llu\n",
+            (unsigned long long)atomic_load(&pl.head),
+            (unsigned long long)pl.dropped,
+            (unsigned long long)pl.ring_waits,
+            (unsigned long long)pl.max_ring);
+    for (int i = 0; i < pl.cfg.workers; i++)
+        fprintf(stderr, "  worker %d: %llu packets, max queue depth %llu\n", i,
+                (unsigned long long)pl.workers[i].packets,
+                (unsigned long long)pl.workers[i].max_depth);
+    fprintf(stderr, "  output: %llu packets, %llu waits\n",
+            (unsigned long long)atomic_load(&pl.tail),
+            (unsigned long long)pl.output_waits);
+
+    pipeline_free();
+}
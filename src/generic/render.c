@@ -0,0 +1,370 @@
+/**
+ * @author Flavien Lallemant
+ * @file render.c
+ * @brief Packet rendering definition
+ *
+ * This file contains the definition of the renderers.
+ * They walk the decoded layers of a packet and call the print function of
+ * each layer.
+ *
+ * @see render.h
+ * @see render_init
+ * @see render_text
+ */
+
+// Global libraries
+#include <net/if_arp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Local header files
+#include "arp.h"
+#include "dissector.h"
+#include "dns.h"
+#include "encap.h"
+#include "ethernet.h"
+#include "format.h"
+#include "icmp.h"
+#include "icmpv6.h"
+#include "ipfrag.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "output.h"
+#include "render.h"
+#include "sll.h"
+#include "tcp.h"
+#include "tls.h"
+#include "udp.h"
+
+#define NB_COLORS 6
+static const char *colors[NB_COLORS] = {"\033[1;31m", "\033[1;32m", "\033[1;33m", "\033[1;34m", "\033[1;35m", "\033[1;36m"};
+static int text_verbose = VERBOSE_COMPLETE; /**< Verbose level of the output */
+
+
+/**
+ * @brief Set the verbose level of the text output
+ *
+ * @param verbose The verbose level, enum verbosity
+ */
+void render_init(int verbose)
+{
+    text_verbose = verbose;
+}
+
+
+/**
+ * @brief Format the TCP flags as tcpdump does
+ *
+ * @param dst The buffer to write to, at least 9 bytes
+ * @param flags The TCP flags
+ * @return char* dst
+ */
+static char *format_tcp_flags(char *dst, uint8_t flags)
+{
+    static const struct {
+        uint8_t bit;
+        char c;
+    } names[] = {{0x01, 'F'}, {0x02, 'S'}, {0x04, 'R'}, {0x08, 'P'},
+                 {0x20, 'U'}, {0x40, 'E'}, {0x80, 'W'}, {0x10, '.'}};
+    char *p = dst;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (flags & names[i].bit)
+            *p++ = names[i].c;
+    if (p == dst)
+        return strcpy(dst, "none");
+    *p = '\0';
+    return dst;
+}
+
+
+/**
+ * @brief Format an IP address of a packet
+ *
+ * @param dst The buffer to write to, at least STR_IPv6_ADDR_LEN bytes
+ * @param pi The decoded packet
+ * @param addr The address, pi->ip_src or pi->ip_dst
+ * @return char* dst
+ */
+static char *format_ip(char *dst, const struct packet_info *pi,
+                       const uint8_t *addr)
+{
+    if (pi->ip_version == 6) {
+        struct in6_addr ip6;
+        memcpy(&ip6, addr, 16);
+        return format_ipv6(dst, &ip6);
+    }
+    uint32_t ip;
+    memcpy(&ip, addr, 4);
+    return format_ipv4(dst, be32toh(ip));
+}
+
+
+/**
+ * @brief Print the ARP operation of a packet
+ *
+ * @param pi The decoded packet
+ */
+static void print_arp_summary(const struct packet_info *pi)
+{
+    char spa[STR_IPv4_ADDR_LEN], tpa[STR_IPv4_ADDR_LEN], sha[STR_MAC_ADDR_LEN];
+    if (!pi->u.arp.ipv4) {
+        out_printf("ARP, opcode %u", pi->arp_opcode);
+        return;
+    }
+    format_ipv4(spa, be32toh(*(const uint32_t *)pi->u.arp.spa));
+    format_ipv4(tpa, be32toh(*(const uint32_t *)pi->u.arp.tpa));
+    switch (pi->arp_opcode) {
+    case ARPOP_REQUEST:
+        out_printf("ARP, Request who-has %s tell %s", tpa, spa);
+        break;
+    case ARPOP_REPLY:
+        out_printf("ARP, Reply %s is-at %s", spa,
+                   format_mac(sha, pi->u.arp.sha));
+        break;
+    default:
+        out_printf("ARP, opcode %u, %s > %s", pi->arp_opcode, spa, tpa);
+    }
+}
+
+
+/**
+ * @brief Print a decoded packet on one line
+ *
+ * The line has the time, the addresses and ports and the transport protocol,
+ * as tcpdump prints it.
+ *
+ * @param pi The decoded packet
+ *
+ * @see print_arp_summary
+ */
+static void render_line(const struct packet_info *pi)
+{
+    time_t sec = pi->ts.tv_sec;
+    struct tm tm;
+    if (localtime_r(&sec, &tm) == NULL)
+        memset(&tm, 0, sizeof(tm));
+    out_printf("%02d:%02d:%02d.%06ld ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+               (long)pi->ts.tv_usec);
+
+    char src[STR_IPv6_ADDR_LEN], dst[STR_IPv6_ADDR_LEN];
+    if (pi->layers & LAYER_ARP) {
+        print_arp_summary(pi);
+    } else if (pi->layers & (LAYER_IPV4 | LAYER_IPV6)) {
+        const char *ip = pi->ip_version == 6 ? "IP6" : "IP";
+        format_ip(src, pi, pi->ip_src);
+        format_ip(dst, pi, pi->ip_dst);
+        if (pi->layers & LAYER_TCP) {
+            char flags[9];
+            out_printf("%s %s.%u > %s.%u: TCP [%s], seq %u, ack %u, length %u",
+                       ip, src, pi->sport, dst, pi->dport,
+                       format_tcp_flags(flags, pi->tcp_flags), pi->tcp_seq,
+                       pi->tcp_ack, pi->l7_len);
+        } else if (pi->layers & LAYER_UDP) {
+            out_printf("%s %s.%u > %s.%u: UDP, length %u", ip, src, pi->sport,
+                       dst, pi->dport, pi->l7_len);
+        } else if (pi->layers & (LAYER_ICMP | LAYER_ICMP6)) {
+            out_printf("%s %s > %s: %s type %u, code %u", ip, src, dst,
+                       pi->layers & LAYER_ICMP ? "ICMP" : "ICMP6",
+                       pi->icmp_type, pi->icmp_code);
+        } else if (pi->layers & LAYER_FRAG) {
+            out_printf("%s %s > %s: proto %u, fragment id %u, offset %u%s", ip,
+                       src, dst, pi->ip_proto, pi->frag_id, pi->frag_offset,
+                       pi->frag_more ? ", more" : "");
+        } else {
+            out_printf("%s %s > %s: proto %u", ip, src, dst, pi->ip_proto);
+        }
+    } else if (pi->layers & LAYER_ETH) {
+        format_mac(src, pi->mac_src);
+        format_mac(dst, pi->mac_dst);
+        out_printf("%s > %s, ethertype 0x%04x", src, dst, pi->ethertype);
+    } else {
+        out_puts("unknown");
+    }
+    out_printf(", %u bytes%s%s\n", pi->len,
+               pi->layers & LAYER_DEFRAG ? ", reassembled" : "",
+               pi->layers & LAYER_TRUNCATED ? " [|truncated]" : "");
+}
+
+
+/**
+ * @brief Print the decoded layers of a packet, one line each
+ *
+ * The application layer is summed up from the fields found by its
+ * dissector, the message itself is not read again, only the strings it
+ * points to.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ *
+ * @see print_arp_summary
+ * @see encap_print
+ * @see print_ipfrag
+ * @see tls_payload
+ * @see dissector_print
+ */
+static void render_layers(const struct packet_info *pi, const u_char *packet)
+{
+    char src[STR_IPv6_ADDR_LEN], dst[STR_IPv6_ADDR_LEN];
+    if (pi->layers & LAYER_SLL)
+        print_sll(pi, packet);
+    if (pi->layers & LAYER_ETH)
+        out_printf("ETH: %s > %s, type 0x%04x\n",
+                   format_mac(src, pi->mac_src), format_mac(dst, pi->mac_dst),
+                   pi->ethertype);
+    if (pi->layers & LAYER_ENCAP)
+        encap_print(pi, packet);
+    if (pi->layers & LAYER_ARP) {
+        print_arp_summary(pi);
+        out_putc('\n');
+    }
+    if (pi->layers & (LAYER_IPV4 | LAYER_IPV6))
+        out_printf("IPv%u: %s > %s, proto %u, ttl %u, length %u\n",
+                   pi->ip_version, format_ip(src, pi, pi->ip_src),
+                   format_ip(dst, pi, pi->ip_dst), pi->ip_proto, pi->ip_ttl,
+                   pi->l3_len);
+    if (pi->layers & (LAYER_FRAG | LAYER_DEFRAG))
+        print_ipfrag(pi, packet);
+    if (pi->layers & LAYER_TCP) {
+        char flags[9];
+        out_printf("TCP: %u > %u [%s], seq %u, ack %u, length %u\n",
+                   pi->sport, pi->dport, format_tcp_flags(flags, pi->tcp_flags),
+                   pi->tcp_seq, pi->tcp_ack, pi->l7_len);
+    }
+    if (pi->layers & LAYER_UDP)
+        out_printf("UDP: %u > %u, length %u\n", pi->sport, pi->dport,
+                   pi->l7_len);
+    if (pi->layers & (LAYER_ICMP | LAYER_ICMP6))
+        out_printf("%s: type %u, code %u\n",
+                   pi->layers & LAYER_ICMP ? "ICMP" : "ICMP6", pi->icmp_type,
+                   pi->icmp_code);
+    if (pi->layers & LAYER_PLUGIN) {
+        dissector_print(pi, packet);
+        return;
+    }
+    if (!(pi->layers & LAYER_APP))
+        return;
+    switch (pi->app_proto) {
+    case APP_DNS:
+        out_printf("DNS: %s, id 0x%04x, %u question(s), %u answer(s)\n",
+                   pi->u.dns.flags & DH_QR ? "reply" : "query", pi->u.dns.id,
+                   pi->u.dns.questions, pi->u.dns.answers);
+        break;
+    case APP_BOOTP:
+        out_printf("BOOTP: %s", pi->u.bootp.op == 1   ? "request"
+                                : pi->u.bootp.op == 2 ? "reply"
+                                                      : "unknown");
+        if (pi->u.bootp.msg_type)
+            out_printf(", DHCP message type %u", pi->u.bootp.msg_type);
+        out_putc('\n');
+        break;
+    case APP_HTTPS:
+    case APP_IMAPS:
+        if (pi->u.tls.type) {
+            out_printf("%s: TLS record type %u, version 0x03%02x",
+                       app_proto_name(pi->app_proto), pi->u.tls.type,
+                       pi->u.tls.version);
+            if (pi->u.tls.handshake) {
+                uint32_t len;
+                const u_char *rec = tls_payload(pi, packet, &len);
+                out_printf(", %s Hello, version 0x%04x",
+                           pi->u.tls.handshake == TLS_HS_CLIENT_HELLO ? "Client"
+                                                                      : "Server",
+                           pi->u.tls.hello_version);
+                if (pi->u.tls.sni_len)
+                    out_printf(", SNI %.*s", pi->u.tls.sni_len,
+                               rec + pi->u.tls.sni_off);
+                if (pi->u.tls.alpn_len)
+                    out_printf(", ALPN %.*s", pi->u.tls.alpn_len,
+                               rec + pi->u.tls.alpn_off);
+            }
+            out_putc('\n');
+            break;
+        }
+        // fall through
+    default:
+        out_printf("%s: %u bytes\n", app_proto_name(pi->app_proto),
+                   pi->l7_len);
+    }
+}
+
+
+/**
+ * @brief Print a decoded packet as text
+ *
+ * This function prints a packet as one line at VERBOSE_CONCISE, like tcpdump
+ * does. Otherwise it prints the banner, timestamp and the decoded layers of a
+ * packet, in colour: one line per layer at VERBOSE_SYNTHETIC, every field at
+ * VERBOSE_COMPLETE.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param number The number of the packet
+ *
+ * @see render_line
+ * @see render_layers
+ * @see print_ethernet
+ */
+void render_text(const struct packet_info *pi, const u_char *packet,
+                 unsigned long number)
+{
+    if (text_verbose == VERBOSE_CONCISE) {
+        render_line(pi);
+        return;
+    }
+    out_puts(colors[number % NB_COLORS]);
+
+    out_puts("┌───────────────────────────────────────────────┐\n");
+    out_printf("│\t\tPacket n°%ld\t\t\t│\n", number);
+    out_puts("└───────────────────────────────────────────────┘\n");
+    time_t sec = pi->ts.tv_sec;
+    suseconds_t usec = pi->ts.tv_usec;
+
+    struct tm tm;
+    struct tm *timeinfo = localtime_r(&sec, &tm); // The workers render in parallel
+    if (timeinfo == NULL) {
+        perror("localtime");
+        return;
+    }
+
+    char time_str[64];
+    if (strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo) ==
+        0) {
+        fprintf(stderr, "strftime failed\n");
+        return;
+    }
+    out_printf("%s.%06ld\n", time_str, (long)usec);
+
+    if (text_verbose == VERBOSE_SYNTHETIC) {
+        render_layers(pi, packet);
+    } else {
+        if (pi->layers & LAYER_SLL)
+            print_sll(pi, packet);
+        if (pi->layers & LAYER_ETH)
+            print_ethernet(pi, packet);
+        if (pi->layers & LAYER_ENCAP)
+            encap_print(pi, packet);
+        if (pi->layers & LAYER_ARP)
+            print_arp(pi, packet);
+        if (pi->layers & LAYER_IPV4 && pi->ip_version == 4)
+            print_ipv4(pi, packet);
+        if (pi->layers & LAYER_IPV6)
+            print_ipv6(pi, packet);
+        if (pi->layers & (LAYER_FRAG | LAYER_DEFRAG))
+            print_ipfrag(pi, packet);
+        if (pi->layers & LAYER_TCP)
+            print_tcp(pi, packet);
+        if (pi->layers & LAYER_UDP)
+            print_udp(pi, packet);
+        if (pi->layers & LAYER_ICMP)
+            print_icmp(pi, packet);
+        if (pi->layers & LAYER_ICMP6)
+            print_icmp6(pi, packet);
+        if (pi->layers & LAYER_PLUGIN)
+            dissector_print(pi, packet);
+    }
+    if (pi->layers & LAYER_TRUNCATED)
+        out_printf("TRUNCATED: %u of %u bytes captured\n", pi->caplen, pi->len);
+
+    out_puts("\033[0m\n");
+}
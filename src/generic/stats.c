@@ -0,0 +1,213 @@
+/**
+ * @author Flavien Lallemant
+ * @file stats.c
+ * @brief Protocol statistics definition
+ *
+ * This file contains the definition of the functions updating and printing
+ * the per-protocol counters.
+ *
+ * @see stats.h
+ * @see stats_update
+ * @see stats_print
+ */
+
+// Global libraries
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+// Local header files
+#include "stats.h"
+
+static const char *eth_names[STATS_ETH_COUNT] = {"IPv4", "IPv6", "ARP", "RARP",
+                                                 "OTHER"}; /**< Names of the link layer protocols */
+
+
+/**
+ * @brief Get the name of an IP protocol
+ *
+ * @param proto The IP protocol number
+ * @return const char* The name of the protocol, NULL if unknown
+ */
+static const char *ip_proto_name(int proto)
+{
+    switch (proto) {
+    case IPPROTO_ICMP:
+        return "ICMP";
+    case IPPROTO_IGMP:
+        return "IGMP";
+    case IPPROTO_TCP:
+        return "TCP";
+    case IPPROTO_UDP:
+        return "UDP";
+    case IPPROTO_IPV6:
+        return "IPv6";
+    case IPPROTO_GRE:
+        return "GRE";
+    case IPPROTO_ESP:
+        return "ESP";
+    case IPPROTO_ICMPV6:
+        return "ICMPv6";
+    case IPPROTO_SCTP:
+        return "SCTP";
+    default:
+        return NULL;
+    }
+}
+
+
+/**
+ * @brief Count a decoded packet
+ *
+ * @param st The counters to update
+ * @param pi The decoded packet
+ * @param status The value returned by decode_packet()
+ */
+void stats_update(struct stats *st, const struct packet_info *pi, int status)
+{
+    if (st->total.packets == 0)
+        st->first = pi->ts;
+    st->last = pi->ts;
+    st->total.packets++;
+    st->total.bytes += pi->len;
+    if (status < 0)
+        st->errors++;
+
+    struct counter *c;
+    switch (pi->ethertype) {
+    case ETHERTYPE_IP:
+        c = &st->eth[STATS_ETH_IPV4];
+        break;
+    case ETHERTYPE_IPV6:
+        c = &st->eth[STATS_ETH_IPV6];
+        break;
+    case ETHERTYPE_ARP:
+        c = &st->eth[STATS_ETH_ARP];
+        break;
+    case ETHERTYPE_REVARP:
+        c = &st->eth[STATS_ETH_REVARP];
+        break;
+    default:
+        c = &st->eth[STATS_ETH_OTHER];
+    }
+    c->packets++;
+    c->bytes += pi->len;
+
+    if (pi->ip_version) {
+        st->ip[pi->ip_proto].packets++;
+        st->ip[pi->ip_proto].bytes += pi->len;
+    }
+    if (pi->app_proto != APP_NONE) {
+        st->app[pi->app_proto].packets++;
+        st->app[pi->app_proto].bytes += pi->len;
+    }
+}
+
+
+/**
+ * @brief Add a counter to another counter
+ *
+ * @param dst The counter to add to
+ * @param src The counter to add
+ */
+static void counter_merge(struct counter *dst, const struct counter *src)
+{
+    dst->packets += src->packets;
+    dst->bytes += src->bytes;
+}
+
+
+/**
+ * @brief Add counters to other counters
+ *
+ * @param dst The counters to add to
+ * @param src The counters to add
+ */
+void stats_merge(struct stats *dst, const struct stats *src)
+{
+    if (src->total.packets == 0)
+        return;
+    if (dst->total.packets == 0 || timercmp(&src->first, &dst->first, <))
+        dst->first = src->first;
+    if (dst->total.packets == 0 || timercmp(&src->last, &dst->last, >))
+        dst->last = src->last;
+    counter_merge(&dst->total, &src->total);
+    for (int i = 0; i < STATS_ETH_COUNT; i++)
+        counter_merge(&dst->eth[i], &src->eth[i]);
+    for (int i = 0; i < 256; i++)
+        counter_merge(&dst->ip[i], &src->ip[i]);
+    for (int i = 0; i < APP_COUNT; i++)
+        counter_merge(&dst->app[i], &src->app[i]);
+    dst->errors += src->errors;
+}
+
+
+/**
+ * @brief Print a counter line
+ *
+ * @param f The stream to print to
+ * @param name The name of the counter
+ * @param c The counter
+ * @param seconds The time covered by the counter
+ */
+static void print_counter(FILE *f, const char *name, const struct counter *c,
+                          double seconds)
+{
+    if (c->packets == 0)
+        return;
+    fprintf(f, "  %-10s %12llu pkts %15llu bytes", name,
+            (unsigned long long)c->packets, (unsigned long long)c->bytes);
+    if (seconds > 0)
+        fprintf(f, " %12.1f pkt/s %10.3f Mbit/s", c->packets / seconds,
+                c->bytes * 8 / seconds / 1e6);
+    fputc('\n', f);
+}
+
+
+/**
+ * @brief Print counters
+ *
+ * This function prints every non zero counter with its rate over the time
+ * covered by the counters.
+ *
+ * @param f The stream to print to
+ * @param st The counters to print
+ * @param title The title of the report
+ * @param seconds The time covered by the counters, 0 to use the timestamps of
+ * the first and last packets
+ */
+void stats_print(FILE *f, const struct stats *st, const char *title,
+                 double seconds)
+{
+    if (seconds <= 0) {
+        struct timeval span;
+        timersub(&st->last, &st->first, &span);
+        seconds = span.tv_sec + span.tv_usec / 1e6;
+    }
+
+    fprintf(f, "=== %s (%.3f s) ===\n", title, seconds);
+    print_counter(f, "TOTAL", &st->total, seconds);
+    if (st->errors)
+        fprintf(f, "  %-10s %12llu pkts\n", "NOT DECODED",
+                (unsigned long long)st->errors);
+
+    fprintf(f, " Link layer:\n");
+    for (int i = 0; i < STATS_ETH_COUNT; i++)
+        print_counter(f, eth_names[i], &st->eth[i], seconds);
+
+    fprintf(f, " Network layer:\n");
+    for (int i = 0; i < 256; i++) {
+        const char *name = ip_proto_name(i);
+        char buf[16];
+        if (name == NULL) {
+            snprintf(buf, sizeof(buf), "PROTO %d", i);
+            name = buf;
+        }
+        print_counter(f, name, &st->ip[i], seconds);
+    }
+
+    fprintf(f, " Application layer:\n");
+    for (int i = APP_NONE + 1; i < APP_COUNT; i++)
+        print_counter(f, app_proto_name(i), &st->app[i], seconds);
+    fflush(f);
+}
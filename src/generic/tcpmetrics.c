@@ -0,0 +1,557 @@
+/**
+ * @author Flavien Lallemant
+ * @file tcpmetrics.c
+ * @brief TCP connection metrics definition
+ *
+ * This file contains the definition of the TCP connection tracker.
+ * The connections are kept in an open addressing table, like the DNS queries:
+ * a connection takes a free slot among the TCPMETRICS_PROBE following its
+ * hash, and a segment looks at those slots only, so an ended connection just
+ * frees its slot. A connection ends on a reset, on the FIN of its second
+ * direction, or after the timeout without a segment.
+ * Each direction keeps the sequence number following its highest segment and
+ * the last TCPMETRICS_HOLES holes a segment starting after it left below it.
+ * A segment filling a hole soon after it opened is out of order, as is one
+ * arriving late after a reordering; any other segment starting below the
+ * highest one is retransmitted, a lost segment sent again included.
+ * The handshake times skip the connections with a retransmitted SYN or
+ * SYN-ACK, whose answer can't be told apart.
+ *
+ * @see tcpmetrics.h
+ * @see tcpmetrics_init
+ * @see tcpmetrics_update
+ * @see tcpmetrics_close
+ */
+
+// Global libraries
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+// Local header files
+#include "flow.h"
+#include "hdrhist.h"
+#include "overload.h"
+#include "tcpmetrics.h"
+
+#define TCPMETRICS_PROBE 16 /**< Slots a connection can take after its hash */
+#define TCPMETRICS_HOLES 4 /**< Holes kept below the highest segment of a direction */
+#define TCPMETRICS_REORDER 3000 /**< Microseconds a hole is filled by reordering without a handshake time */
+
+/**
+ * @brief Reasons a connection ends
+ */
+enum tcp_end {
+    END_CLOSED,     /**< FIN in both directions */
+    END_RESET,      /**< RST */
+    END_IDLE,       /**< No segment before the timeout */
+    END_OPEN,       /**< Still open at the end of the capture */
+    END_COUNT,
+};
+
+static const char *end_names[END_COUNT] = {"closed", "reset", "idle", "open"}; /**< Names of the reasons */
+
+/**
+ * @brief Sequence numbers not seen yet below the highest segment
+ */
+struct tcp_hole {
+    uint32_t start;         /**< First missing sequence number */
+    uint32_t end;           /**< Sequence number following the missing ones, start if unused */
+    int64_t opened;         /**< Capture time the hole opened in microseconds */
+};
+
+/**
+ * @brief Direction of a connection
+ */
+struct tcp_dir {
+    uint64_t packets;       /**< Segments */
+    uint64_t bytes;         /**< Payload bytes */
+    uint32_t segments;      /**< Segments using sequence numbers */
+    uint32_t next_seq;      /**< Sequence number following the highest segment */
+    uint32_t retrans;       /**< Retransmitted segments */
+    uint32_t ooo;           /**< Out of order segments */
+    uint32_t zero_windows;  /**< Times the window closed */
+    struct tcp_hole holes[TCPMETRICS_HOLES]; /**< The last holes left below next_seq */
+    uint8_t seen;           /**< 1 once next_seq is set */
+    uint8_t zero;           /**< 1 while the window is closed */
+    uint8_t fin;            /**< 1 once a FIN is sent */
+};
+
+/**
+ * @brief Tracked connection
+ */
+struct tcp_conn {
+    struct flow_key key;    /**< 5-tuple */
+    uint8_t used;           /**< 1 if the slot is taken */
+    uint8_t client;         /**< Direction of the client in the key */
+    uint8_t ambiguous;      /**< 1 if the SYN or SYN-ACK was retransmitted */
+    int64_t first;          /**< Capture time of the first segment in microseconds */
+    int64_t last;           /**< Capture time of the last segment in microseconds */
+    int64_t syn;            /**< Capture time of the SYN, 0 if not seen */
+    int64_t synack;         /**< Capture time of the SYN-ACK, 0 if not seen */
+    int64_t ack;            /**< Capture time of the handshake ACK, 0 if not seen */
+    struct tcp_dir dir[2];  /**< Directions, indexed like the key */
+};
+
+/**
+ * @brief Counters of the ended connections
+ */
+struct tcp_totals {
+    uint64_t ended[END_COUNT];  /**< Connections per reason */
+    uint64_t packets;           /**< Segments */
+    uint64_t bytes;             /**< Payload bytes */
+    uint64_t segments;          /**< Segments using sequence numbers */
+    uint64_t retrans;           /**< Retransmitted segments */
+    uint64_t ooo;               /**< Out of order segments */
+    uint64_t zero_windows;      /**< Times a window closed */
+    struct hdrhist rtt;         /**< SYN to ACK in microseconds */
+    struct hdrhist server;      /**< SYN to SYN-ACK in microseconds */
+    struct hdrhist client;      /**< SYN-ACK to ACK in microseconds */
+    struct hdrhist throughput;  /**< Throughput of the directions with data in kbit/s */
+};
+
+/**
+ * @brief Tracker state
+ */
+static struct {
+    struct tcp_conn *slots;     /**< The connections, NULL if disabled */
+    uint32_t mask;              /**< Number of slots minus 1 */
+    int64_t timeout;            /**< Idle microseconds before a connection ends */
+    int flows;                  /**< 1 to print each connection when it ends */
+    int64_t now;                /**< Capture time of the last segment */
+    int64_t next_sweep;         /**< Capture time of the next sweep, 0 before the first segment */
+    uint64_t untracked;         /**< Segments not tracked, table full */
+    struct tcp_totals total;    /**< Counters of the ended connections */
+} tm;
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int tcpmetrics_init(const struct tcpmetrics_config *cfg)
+{
+    uint32_t slots = TCPMETRICS_PROBE;
+    while (slots < (cfg->slots ? cfg->slots : TCPMETRICS_SLOTS) && slots < (1u << 30))
+        slots <<= 1;
+    tm.timeout = (int64_t)(cfg->timeout > 0 ? cfg->timeout : TCPMETRICS_TIMEOUT) *
+                 1000000;
+    tm.flows = cfg->flows;
+
+    tm.slots = calloc(slots, sizeof(struct tcp_conn));
+    if (tm.slots == NULL) {
+        fprintf(stderr, "Error allocating the TCP connection table\n");
+        return (-1);
+    }
+    tm.mask = slots - 1;
+    return 0;
+}
+
+
+/**
+ * @brief Format an endpoint of a connection
+ *
+ * @param key The key of the connection
+ * @param side The endpoint in the key
+ * @param buf The buffer to write to
+ * @param size The size of the buffer
+ */
+static void format_endpoint(const struct flow_key *key, int side, char *buf,
+                            size_t size)
+{
+    char addr[INET6_ADDRSTRLEN];
+    inet_ntop(key->ip_version == 4 ? AF_INET : AF_INET6, key->addr[side], addr,
+              sizeof(addr));
+    snprintf(buf, size, key->ip_version == 4 ? "%s:%u" : "[%s]:%u", addr,
+             key->port[side]);
+}
+
+
+/**
+ * @brief Throughput of a direction
+ *
+ * @param d The direction
+ * @param duration The duration of the connection in microseconds
+ * @return double The throughput in kbit/s, 0 for an instant connection
+ */
+static double dir_throughput(const struct tcp_dir *d, int64_t duration)
+{
+    return duration > 0 ? d->bytes * 8000.0 / duration : 0;
+}
+
+
+/**
+ * @brief Print the metrics of a direction of an ended connection
+ *
+ * @param d The direction
+ * @param duration The duration of the connection in microseconds
+ */
+static void print_dir(const struct tcp_dir *d, int64_t duration)
+{
+    fprintf(stderr, "%llu pkts %llu B %.1f kbit/s %u retr %u ooo %u zwin",
+            (unsigned long long)d->packets, (unsigned long long)d->bytes,
+            dir_throughput(d, duration), d->retrans, d->ooo, d->zero_windows);
+}
+
+
+/**
+ * @brief End a connection
+ *
+ * Its counters are added to the totals, and it is printed if asked.
+ *
+ * @param c The connection
+ * @param end The reason it ends
+ *
+ * @see print_dir
+ */
+static void conn_end(struct tcp_conn *c, enum tcp_end end)
+{
+    int64_t duration = c->last - c->first;
+    struct tcp_totals *t = &tm.total;
+    t->ended[end]++;
+    for (int i = 0; i < 2; i++) {
+        const struct tcp_dir *d = &c->dir[i];
+        t->packets += d->packets;
+        t->bytes += d->bytes;
+        t->segments += d->segments;
+        t->retrans += d->retrans;
+        t->ooo += d->ooo;
+        t->zero_windows += d->zero_windows;
+        if (d->bytes > 0 && duration > 0)
+            hdr_record(&t->throughput, dir_throughput(d, duration) + 0.5);
+    }
+
+    if (tm.flows) {
+        char client[INET6_ADDRSTRLEN + 8], server[INET6_ADDRSTRLEN + 8];
+        format_endpoint(&c->key, c->client, client, sizeof(client));
+        format_endpoint(&c->key, !c->client, server, sizeof(server));
+        fprintf(stderr, "TCP %s > %s %s after %.3f s, ", client, server,
+                end_names[end], duration / 1e6);
+        if (c->ack && c->syn && !c->ambiguous)
+            fprintf(stderr, "handshake %.3f ms", (c->ack - c->syn) / 1000.0);
+        else
+            fprintf(stderr, "no handshake");
+        fprintf(stderr, ", > ");
+        print_dir(&c->dir[c->client], duration);
+        fprintf(stderr, ", < ");
+        print_dir(&c->dir[!c->client], duration);
+        fputc('\n', stderr);
+    }
+    c->used = 0;
+}
+
+
+/**
+ * @brief End the connections idle for longer than the timeout
+ *
+ * @see conn_end
+ */
+static void sweep(void)
+{
+    for (uint32_t i = 0; i <= tm.mask; i++) {
+        struct tcp_conn *c = &tm.slots[i];
+        if (c->used && tm.now - c->last > tm.timeout)
+            conn_end(c, END_IDLE);
+    }
+}
+
+
+/**
+ * @brief Time the handshake of a connection
+ *
+ * The round trip is recorded when the client acknowledges the SYN-ACK.
+ *
+ * @param c The connection
+ * @param dir The direction of the segment
+ * @param flags The TCP flags of the segment
+ * @param now The capture time of the segment in microseconds
+ */
+static void handshake(struct tcp_conn *c, int dir, uint8_t flags, int64_t now)
+{
+    if ((flags & (TH_SYN | TH_ACK)) == TH_SYN) {
+        if (dir != c->client)
+            return;
+        if (c->syn)
+            c->ambiguous = 1;
+        else
+            c->syn = now;
+    } else if ((flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK)) {
+        if (dir == c->client)
+            return;
+        if (c->synack)
+            c->ambiguous = 1;
+        else
+            c->synack = now;
+    } else if ((flags & TH_ACK) && dir == c->client && c->synack && !c->ack) {
+        c->ack = now;
+        if (c->syn == 0 || c->ambiguous || c->synack < c->syn || now < c->synack)
+            return;
+        hdr_record(&tm.total.rtt, now - c->syn);
+        hdr_record(&tm.total.server, c->synack - c->syn);
+        hdr_record(&tm.total.client, now - c->synack);
+    }
+}
+
+
+/**
+ * @brief Remember the hole a segment starting after the highest one leaves
+ *
+ * The oldest hole is forgotten when they are all used.
+ *
+ * @param d The direction of the segment
+ * @param start The first missing sequence number
+ * @param end The sequence number of the segment
+ * @param now The capture time of the segment in microseconds
+ */
+static void hole_open(struct tcp_dir *d, uint32_t start, uint32_t end,
+                      int64_t now)
+{
+    struct tcp_hole *h = &d->holes[0];
+    for (int i = 0; i < TCPMETRICS_HOLES; i++) {
+        if (d->holes[i].start == d->holes[i].end) {
+            h = &d->holes[i];
+            break;
+        }
+        if (d->holes[i].opened < h->opened)
+            h = &d->holes[i];
+    }
+    h->start = start;
+    h->end = end;
+    h->opened = now;
+}
+
+
+/**
+ * @brief Fill the hole a segment starting below the highest one falls in
+ *
+ * The part of the hole the segment covers is removed; when the segment is in
+ * its middle, only the part before the segment is kept.
+ *
+ * @param d The direction of the segment
+ * @param seq The sequence number of the segment
+ * @param len The sequence numbers the segment takes
+ * @param opened The capture time the hole opened to fill
+ * @return int 1 if the segment falls in a hole, 0 otherwise
+ */
+static int hole_fill(struct tcp_dir *d, uint32_t seq, uint32_t len,
+                     int64_t *opened)
+{
+    for (int i = 0; i < TCPMETRICS_HOLES; i++) {
+        struct tcp_hole *h = &d->holes[i];
+        if (h->start == h->end || (int32_t)(seq + len - h->start) <= 0 ||
+            (int32_t)(seq - h->end) >= 0)
+            continue;
+        *opened = h->opened;
+        if ((int32_t)(seq - h->start) > 0)
+            h->end = seq;
+        else if ((int32_t)(seq + len - h->end) < 0)
+            h->start = seq + len;
+        else
+            h->end = h->start;
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Check the sequence number of a segment against its direction
+ *
+ * A segment starting after the highest one only opens a hole. A keep-alive,
+ * one byte before the next sequence number, isn't counted as retransmitted.
+ *
+ * @param d The direction of the segment
+ * @param seq The sequence number of the segment
+ * @param payload The payload length of the segment
+ * @param flags The TCP flags of the segment
+ * @param now The capture time of the segment in microseconds
+ * @param reorder The microseconds a hole is filled by reordering
+ *
+ * @see hole_open
+ * @see hole_fill
+ */
+static void sequence(struct tcp_dir *d, uint32_t seq, uint32_t payload,
+                     uint8_t flags, int64_t now, int64_t reorder)
+{
+    uint32_t len = payload + ((flags & TH_SYN) != 0) + ((flags & TH_FIN) != 0);
+    if (len == 0)
+        return;
+    d->segments++;
+    if (!d->seen) {
+        d->seen = 1;
+        d->next_seq = seq + len;
+        return;
+    }
+    int32_t gap = (int32_t)(seq - d->next_seq);
+    if (gap > 0) {
+        hole_open(d, d->next_seq, seq, now);
+    } else if (gap < 0 && !(gap == -1 && len == 1 && payload == 1)) {
+        int64_t opened;
+        if (hole_fill(d, seq, len, &opened) && now - opened <= reorder)
+            d->ooo++;
+        else
+            d->retrans++;
+    }
+    if ((int32_t)(seq + len - d->next_seq) > 0)
+        d->next_seq = seq + len;
+}
+
+
+/**
+ * @brief Account a decoded TCP segment to its connection
+ *
+ * The other packets are ignored.
+ *
+ * @param pi The decoded packet
+ *
+ * @see handshake
+ * @see sequence
+ * @see conn_end
+ */
+void tcpmetrics_update(const struct packet_info *pi)
+{
+    struct flow_key key;
+    if (tm.slots == NULL || !(pi->layers & LAYER_TCP) ||
+        flow_key_pi(pi, &key) < 0)
+        return;
+    int64_t now = (int64_t)pi->ts.tv_sec * 1000000 + pi->ts.tv_usec;
+    if (now > tm.now)
+        tm.now = now;
+    if (tm.next_sweep == 0)
+        tm.next_sweep = tm.now + tm.timeout;
+    if (tm.now >= tm.next_sweep) {
+        sweep();
+        tm.next_sweep = tm.now + tm.timeout;
+    }
+
+    // The length of the IP header gives the payload even past the snapshot length
+    uint32_t end = (uint32_t)pi->l3_off + pi->l3_len;
+    uint32_t payload = end > pi->l7_off ? end - pi->l7_off : 0;
+    uint8_t flags = pi->tcp_flags;
+    int dir = flow_dir_pi(pi);
+    uint32_t h = flow_hash(&key);
+
+    struct tcp_conn *c = NULL, *free_slot = NULL;
+    for (uint32_t i = 0; i < TCPMETRICS_PROBE; i++) {
+        struct tcp_conn *s = &tm.slots[(h + i) & tm.mask];
+        if (s->used && now - s->last > tm.timeout)
+            conn_end(s, END_IDLE);
+        if (!s->used) {
+            if (free_slot == NULL)
+                free_slot = s;
+        } else if (memcmp(&s->key, &key, sizeof(key)) == 0) {
+            c = s;
+            break;
+        }
+    }
+    if (c == NULL) {
+        // The last segments of an ended connection don't start a new one
+        if ((flags & TH_RST) || (!(flags & TH_SYN) && payload == 0))
+            return;
+        if (free_slot == NULL) {
+            tm.untracked++;
+            return;
+        }
+        c = free_slot;
+        memset(c, 0, sizeof(*c));
+        c->key = key;
+        c->used = 1;
+        c->client = (flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK) ? !dir : dir;
+        c->first = now;
+    }
+    if (now > c->last)
+        c->last = now;
+
+    struct tcp_dir *d = &c->dir[dir];
+    d->packets++;
+    d->bytes += payload;
+    handshake(c, dir, flags, now);
+    // Reordered within a round trip, the one of the handshake when known
+    int64_t reorder = TCPMETRICS_REORDER;
+    if (c->ack && c->syn && !c->ambiguous && c->ack - c->syn > reorder)
+        reorder = c->ack - c->syn;
+    sequence(d, pi->tcp_seq, payload, flags, now, reorder);
+    if (pi->tcp_window == 0 && !(flags & (TH_SYN | TH_RST))) {
+        if (!d->zero)
+            d->zero_windows++;
+        d->zero = 1;
+    } else {
+        d->zero = 0;
+    }
+
+    if (flags & TH_RST) {
+        conn_end(c, END_RESET);
+    } else if (flags & TH_FIN) {
+        d->fin = 1;
+        if (c->dir[!dir].fin)
+            conn_end(c, END_CLOSED);
+    }
+}
+
+
+/**
+ * @brief Print a row of the handshake table
+ *
+ * @param name The name of the row
+ * @param h The times in microseconds
+ */
+static void print_times(const char *name, const struct hdrhist *h)
+{
+    fprintf(stderr, "  %-24s %9llu %9.3f %9.3f %9.3f\n", name,
+            (unsigned long long)h->count, hdr_percentile(h, 50) / 1000.0,
+            hdr_percentile(h, 99) / 1000.0, hdr_percentile(h, 99.9) / 1000.0);
+}
+
+
+/**
+ * @brief End the connections, print the totals of the capture and free the
+ * tracker
+ *
+ * @see conn_end
+ * @see print_times
+ */
+void tcpmetrics_close(void)
+{
+    if (tm.slots == NULL)
+        return;
+    sweep();
+    for (uint32_t i = 0; i <= tm.mask; i++) {
+        if (tm.slots[i].used)
+            conn_end(&tm.slots[i], END_OPEN);
+    }
+
+    const struct tcp_totals *t = &tm.total;
+    struct overload_mark start = {0};
+    fprintf(stderr, "TCP metrics, Total:\n");
+    overload_report(stderr, &start);
+    fprintf(stderr, "  %llu closed, %llu reset, %llu idle, %llu open connections\n",
+            (unsigned long long)t->ended[END_CLOSED],
+            (unsigned long long)t->ended[END_RESET],
+            (unsigned long long)t->ended[END_IDLE],
+            (unsigned long long)t->ended[END_OPEN]);
+    fprintf(stderr, "  %-24s %9s %9s %9s %9s\n", "Handshake", "Samples",
+            "p50 ms", "p99 ms", "p999 ms");
+    print_times("SYN to ACK", &t->rtt);
+    print_times("SYN to SYN-ACK (server)", &t->server);
+    print_times("SYN-ACK to ACK (client)", &t->client);
+    fprintf(stderr, "  %-24s %9llu %9u %9u %9u\n", "Throughput kbit/s",
+            (unsigned long long)t->throughput.count,
+            hdr_percentile(&t->throughput, 50), hdr_percentile(&t->throughput, 99),
+            hdr_percentile(&t->throughput, 99.9));
+    fprintf(stderr, "  %llu packets, %llu bytes, %llu segments, %llu "
+                    "retransmitted (%.2f %%), %llu out of order, %llu zero "
+                    "windows, %llu segments not tracked\n",
+            (unsigned long long)t->packets, (unsigned long long)t->bytes,
+            (unsigned long long)t->segments,
+            (unsigned long long)t->retrans,
+            t->segments ? t->retrans * 100.0 / t->segments : 0,
+            (unsigned long long)t->ooo, (unsigned long long)t->zero_windows,
+            (unsigned long long)tm.untracked);
+    free(tm.slots);
+    tm.slots = NULL;
+}
@@ -0,0 +1,561 @@
+/**
+ * @author Flavien Lallemant
+ * @file topn.c
+ * @brief Heavy hitter tracker definition
+ *
+ * This file contains the definition of the heavy hitter tracker.
+ * A sketch has TOPN_DEPTH rows of counters; a key adds its bytes to one
+ * counter per row, picked by a hash seeded per row, and its estimate is the smallest
+ * of them. The update is conservative: only the counters below the new
+ * estimate are raised, which keeps the estimates of the small keys sharing
+ * them closer to their real value.
+ * The keys with the largest estimates are kept in a min-heap of TOPN_TRACKED
+ * times the printed rows, found by an open addressing index: a packet of a
+ * key in the heap raises its entry, another key takes the place of the
+ * smallest entry once its estimate is larger.
+ *
+ * @see topn.h
+ * @see topn_init
+ * @see topn_update
+ * @see topn_idle
+ * @see topn_close
+ */
+
+// Global libraries
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local header files
+#include "flow.h"
+#include "overload.h"
+#include "topn.h"
+
+#define TOPN_DEPTH 4 /**< Rows of a sketch */
+#define TOPN_TRACKED 4 /**< Keys kept in a heap per printed row */
+
+/**
+ * @brief Rankings of the tracker
+ */
+enum topn_kind {
+    TOPN_SRC = 0,   /**< Source addresses */
+    TOPN_PORT,      /**< Service ports */
+    TOPN_FLOW,      /**< Flows */
+    TOPN_KINDS
+};
+
+/**
+ * @brief Key kept in a heap
+ */
+struct topn_entry {
+    struct flow_key key;    /**< The key */
+    uint32_t hash;          /**< Its hash */
+    uint64_t bytes;         /**< Its estimate at its last packet */
+};
+
+/**
+ * @brief Ranking of one kind of key
+ */
+struct topn_table {
+    uint64_t *sketch;           /**< TOPN_DEPTH rows of counters */
+    struct topn_entry *heap;    /**< The keys with the largest estimates, smallest first */
+    uint32_t *index;            /**< Heap position plus 1 of the keys by hash, 0 if free */
+    unsigned size;              /**< Keys in the heap */
+};
+
+/**
+ * @brief Tracker state
+ */
+static struct {
+    struct topn_table tables[TOPN_KINDS]; /**< The rankings, sketches NULL if disabled */
+    uint32_t width_mask;        /**< Counters per row minus 1 */
+    uint32_t index_mask;        /**< Slots of an index minus 1 */
+    unsigned rows;              /**< Keys printed per ranking */
+    unsigned tracked;           /**< Keys kept per heap */
+    int interval;               /**< Seconds of an interval */
+    int64_t first;              /**< Capture time of the interval start in microseconds, 0 before the first packet */
+    int64_t now;                /**< Capture time of the last packet */
+    uint64_t packets;           /**< IP packets of the interval */
+    uint64_t bytes;             /**< IP bytes of the interval */
+    int redraw;                 /**< 1 if stderr is a terminal the reports are redrawn on */
+    struct overload_mark mark;  /**< Sampling counters at the previous report */
+} tn;
+
+static const char *kind_names[TOPN_KINDS] = {"Source", "Port", "Flow"}; /**< Titles of the rankings */
+
+
+/**
+ * @brief Allocate the tracker
+ *
+ * @param cfg The configuration
+ * @return int 0 on success, -1 on error
+ */
+int topn_init(const struct topn_config *cfg)
+{
+    uint32_t width = 64;
+    while (width < (cfg->width ? cfg->width : TOPN_WIDTH) && width < (1u << 24))
+        width <<= 1;
+    tn.rows = cfg->rows ? cfg->rows : TOPN_ROWS;
+    tn.tracked = tn.rows * TOPN_TRACKED;
+    tn.interval = cfg->interval > 0 ? cfg->interval : TOPN_INTERVAL;
+    tn.width_mask = width - 1;
+    uint32_t slots = 4;
+    while (slots < tn.tracked * 4) // At most a quarter full
+        slots <<= 1;
+    tn.index_mask = slots - 1;
+    tn.redraw = isatty(STDERR_FILENO);
+
+    for (int k = 0; k < TOPN_KINDS; k++) {
+        struct topn_table *t = &tn.tables[k];
+        t->sketch = calloc((size_t)TOPN_DEPTH * width, sizeof(uint64_t));
+        t->heap = calloc(tn.tracked, sizeof(struct topn_entry));
+        t->index = calloc(slots, sizeof(uint32_t));
+        if (t->sketch == NULL || t->heap == NULL || t->index == NULL) {
+            fprintf(stderr, "Error allocating the heavy hitter sketches\n");
+            topn_close();
+            return (-1);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Check if the tracker is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int topn_enabled(void)
+{
+    return tn.tables[0].sketch != NULL;
+}
+
+
+/**
+ * @brief Find the index slot of a key
+ *
+ * @param t The ranking
+ * @param key The key
+ * @param hash The hash of the key
+ * @return uint32_t The slot of the key, or the free slot it would take
+ */
+static uint32_t index_find(const struct topn_table *t,
+                           const struct flow_key *key, uint32_t hash)
+{
+    uint32_t i = hash & tn.index_mask;
+    while (t->index[i]) {
+        const struct topn_entry *e = &t->heap[t->index[i] - 1];
+        if (e->hash == hash && memcmp(&e->key, key, sizeof(*key)) == 0)
+            break;
+        i = (i + 1) & tn.index_mask;
+    }
+    return i;
+}
+
+
+/**
+ * @brief Remove a key from the index
+ *
+ * The following keys are shifted back, so a lookup never stops at the freed
+ * slot before reaching them.
+ *
+ * @param t The ranking
+ * @param slot The slot of the key
+ */
+static void index_remove(struct topn_table *t, uint32_t slot)
+{
+    uint32_t i = slot;
+    for (;;) {
+        t->index[slot] = 0;
+        uint32_t home;
+        do {
+            i = (i + 1) & tn.index_mask;
+            if (t->index[i] == 0)
+                return;
+            home = t->heap[t->index[i] - 1].hash & tn.index_mask;
+        } while (((i - home) & tn.index_mask) < ((i - slot) & tn.index_mask));
+        t->index[slot] = t->index[i];
+        slot = i;
+    }
+}
+
+
+/**
+ * @brief Move an entry to another heap position
+ *
+ * The index slot of the entry is looked up before the entry is copied,
+ * while its old position still holds it.
+ *
+ * @param t The ranking
+ * @param to The new heap position
+ * @param from The heap position of the entry
+ */
+static void heap_move(struct topn_table *t, unsigned to, unsigned from)
+{
+    uint32_t slot = index_find(t, &t->heap[from].key, t->heap[from].hash);
+    t->heap[to] = t->heap[from];
+    t->index[slot] = to + 1;
+}
+
+
+/**
+ * @brief Move an entry toward the leaves while a child is smaller
+ *
+ * @param t The ranking
+ * @param pos The heap position of the entry
+ */
+static void heap_down(struct topn_table *t, unsigned pos)
+{
+    struct topn_entry e = t->heap[pos];
+    uint32_t slot = index_find(t, &e.key, e.hash);
+    for (;;) {
+        unsigned child = 2 * pos + 1;
+        if (child >= t->size)
+            break;
+        if (child + 1 < t->size && t->heap[child + 1].bytes < t->heap[child].bytes)
+            child++;
+        if (t->heap[child].bytes >= e.bytes)
+            break;
+        heap_move(t, pos, child);
+        pos = child;
+    }
+    t->heap[pos] = e;
+    t->index[slot] = pos + 1;
+}
+
+
+/**
+ * @brief Move an entry toward the root while its parent is larger
+ *
+ * @param t The ranking
+ * @param pos The heap position of the entry
+ */
+static void heap_up(struct topn_table *t, unsigned pos)
+{
+    struct topn_entry e = t->heap[pos];
+    uint32_t slot = index_find(t, &e.key, e.hash);
+    while (pos > 0) {
+        unsigned parent = (pos - 1) / 2;
+        if (t->heap[parent].bytes <= e.bytes)
+            break;
+        heap_move(t, pos, parent);
+        pos = parent;
+    }
+    t->heap[pos] = e;
+    t->index[slot] = pos + 1;
+}
+
+
+/**
+ * @brief Hash a key for a row of a sketch
+ *
+ * Each row mixes the hash of the key with its own seed, with the finalizer
+ * of MurmurHash3, so two keys sharing a counter in one row rarely share one
+ * in the others.
+ *
+ * @param hash The hash of the key
+ * @param row The row
+ * @return uint32_t The hash for the row
+ */
+static uint32_t row_hash(uint32_t hash, int row)
+{
+    uint32_t h = hash ^ (row * 0x9e3779b9u);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+
+/**
+ * @brief Add the bytes of a packet to a key
+ *
+ * @param t The ranking
+ * @param key The key
+ * @param bytes The bytes of the packet
+ *
+ * @see flow_hash
+ * @see heap_down
+ * @see heap_up
+ */
+static void table_add(struct topn_table *t, const struct flow_key *key,
+                      uint32_t bytes)
+{
+    uint32_t hash = flow_hash(key);
+    uint64_t *counters[TOPN_DEPTH];
+    uint64_t est = UINT64_MAX;
+    for (int r = 0; r < TOPN_DEPTH; r++) {
+        counters[r] = &t->sketch[(size_t)r * (tn.width_mask + 1) +
+                                 (row_hash(hash, r) & tn.width_mask)];
+        if (*counters[r] < est)
+            est = *counters[r];
+    }
+    est += bytes;
+    for (int r = 0; r < TOPN_DEPTH; r++) { // Conservative update
+        if (*counters[r] < est)
+            *counters[r] = est;
+    }
+
+    uint32_t slot = index_find(t, key, hash);
+    if (t->index[slot]) {
+        unsigned pos = t->index[slot] - 1;
+        t->heap[pos].bytes = est;
+        heap_down(t, pos);
+        return;
+    }
+    struct topn_entry e = {.key = *key, .hash = hash, .bytes = est};
+    if (t->size < tn.tracked) {
+        t->heap[t->size] = e;
+        t->index[slot] = ++t->size;
+        heap_up(t, t->size - 1);
+    } else if (est > t->heap[0].bytes) {
+        index_remove(t, index_find(t, &t->heap[0].key, t->heap[0].hash));
+        t->heap[0] = e;
+        t->index[index_find(t, key, hash)] = 1;
+        heap_down(t, 0);
+    }
+}
+
+
+/**
+ * @brief Compare two entries by decreasing estimate, for qsort
+ *
+ * @param a The first entry
+ * @param b The second entry
+ * @return int The order of the entries
+ */
+static int entry_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const struct topn_entry *)a)->bytes;
+    uint64_t y = ((const struct topn_entry *)b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+
+/**
+ * @brief Get the name of an IP protocol of a key
+ *
+ * @param proto The IP protocol
+ * @param buf The buffer the unknown protocols are printed to
+ * @param size The size of the buffer
+ * @return const char* The name
+ */
+static const char *proto_name(uint8_t proto, char *buf, size_t size)
+{
+    switch (proto) {
+    case IPPROTO_TCP:
+        return "tcp";
+    case IPPROTO_UDP:
+        return "udp";
+    case IPPROTO_ICMP:
+        return "icmp";
+    case IPPROTO_ICMPV6:
+        return "icmp6";
+    default:
+        snprintf(buf, size, "proto %u", proto);
+        return buf;
+    }
+}
+
+
+/**
+ * @brief Print a key
+ *
+ * @param kind The ranking of the key
+ * @param key The key
+ * @param buf The buffer to print to
+ * @param size The size of the buffer
+ */
+static void key_print(int kind, const struct flow_key *key, char *buf,
+                      size_t size)
+{
+    int af = key->ip_version == 4 ? AF_INET : AF_INET6;
+    char a[INET6_ADDRSTRLEN], b[INET6_ADDRSTRLEN], p[16];
+    const char *proto = proto_name(key->proto, p, sizeof(p));
+    switch (kind) {
+    case TOPN_SRC:
+        inet_ntop(af, key->addr[0], buf, size);
+        break;
+    case TOPN_PORT:
+        snprintf(buf, size, "%s/%u", proto, key->port[0]);
+        break;
+    default:
+        inet_ntop(af, key->addr[0], a, sizeof(a));
+        inet_ntop(af, key->addr[1], b, sizeof(b));
+        if (key->proto == IPPROTO_TCP || key->proto == IPPROTO_UDP)
+            snprintf(buf, size, "%s %s:%u <-> %s:%u", proto, a, key->port[0],
+                     b, key->port[1]);
+        else
+            snprintf(buf, size, "%s %s <-> %s", proto, a, b);
+    }
+}
+
+
+/**
+ * @brief Print the rankings of the interval
+ *
+ * The estimates are upper bounds: a key is counted with the bytes of the
+ * keys sharing its counters. Under overload, they cover the packets decoded.
+ *
+ * @param title The title of the report
+ * @param seconds The time covered by the interval
+ */
+static void report(const char *title, double seconds)
+{
+    if (tn.redraw)
+        fputs("\033[H\033[J", stderr); // Redrawn from the top left corner
+    fprintf(stderr, "Top talkers, %s: %llu packets, %llu bytes\n", title,
+            (unsigned long long)tn.packets, (unsigned long long)tn.bytes);
+    overload_report(stderr, &tn.mark);
+    for (int k = 0; k < TOPN_KINDS; k++) {
+        struct topn_table *t = &tn.tables[k];
+        qsort(t->heap, t->size, sizeof(*t->heap), entry_cmp); // Rebuilt by the reset
+        fprintf(stderr, "  %-55s %15s %10s %7s\n", kind_names[k], "Bytes",
+                "Mbit/s", "Share");
+        for (unsigned i = 0; i < t->size && i < tn.rows; i++) {
+            const struct topn_entry *e = &t->heap[i];
+            char name[128];
+            key_print(k, &e->key, name, sizeof(name));
+            fprintf(stderr, "  %-55s %15llu %10.3f %6.1f%%\n", name,
+                    (unsigned long long)e->bytes,
+                    seconds > 0 ? e->bytes * 8 / seconds / 1e6 : 0.0,
+                    tn.bytes ? 100.0 * e->bytes / tn.bytes : 0.0);
+        }
+    }
+    fflush(stderr);
+}
+
+
+/**
+ * @brief Clear the sketches and heaps for the next interval
+ */
+static void reset(void)
+{
+    for (int k = 0; k < TOPN_KINDS; k++) {
+        struct topn_table *t = &tn.tables[k];
+        memset(t->sketch, 0,
+               (size_t)TOPN_DEPTH * (tn.width_mask + 1) * sizeof(uint64_t));
+        memset(t->index, 0, (size_t)(tn.index_mask + 1) * sizeof(uint32_t));
+        t->size = 0;
+    }
+    tn.packets = 0;
+    tn.bytes = 0;
+}
+
+
+/**
+ * @brief Print the interval and start the next one when due
+ *
+ * @param now The capture time of the packet in microseconds
+ *
+ * @see report
+ * @see reset
+ */
+static void tick(int64_t now)
+{
+    if (now > tn.now)
+        tn.now = now;
+    if (tn.first == 0)
+        tn.first = now;
+    if (now - tn.first < (int64_t)tn.interval * 1000000)
+        return;
+    char title[64];
+    struct tm tm;
+    time_t sec = tn.first / 1000000;
+    size_t len = strftime(title, sizeof(title), "%Y-%m-%d %H:%M:%S",
+                          localtime_r(&sec, &tm));
+    snprintf(title + len, sizeof(title) - len, " (%d s)", tn.interval);
+    report(title, tn.interval);
+    reset();
+    tn.first = now;
+}
+
+
+/**
+ * @brief Count the bytes of a decoded packet
+ *
+ * The packets without an IP layer are ignored. The service port of a TCP or
+ * UDP packet is the lower of its ports.
+ *
+ * @param pi The decoded packet
+ *
+ * @see tick
+ * @see table_add
+ */
+void topn_update(const struct packet_info *pi)
+{
+    if (tn.tables[0].sketch == NULL || pi->ip_version == 0)
+        return;
+    tick((int64_t)pi->ts.tv_sec * 1000000 + pi->ts.tv_usec);
+    tn.packets++;
+    tn.bytes += pi->len;
+
+    struct flow_key key;
+    memset(&key, 0, sizeof(key));
+    key.ip_version = pi->ip_version;
+    memcpy(key.addr[0], pi->ip_src, sizeof(key.addr[0]));
+    table_add(&tn.tables[TOPN_SRC], &key, pi->len);
+
+    if (pi->layers & (LAYER_TCP | LAYER_UDP)) {
+        memset(&key, 0, sizeof(key));
+        key.ip_version = pi->ip_version;
+        key.proto = pi->ip_proto;
+        key.port[0] = pi->sport < pi->dport ? pi->sport : pi->dport;
+        table_add(&tn.tables[TOPN_PORT], &key, pi->len);
+    }
+
+    flow_key_pi(pi, &key);
+    table_add(&tn.tables[TOPN_FLOW], &key, pi->len);
+}
+
+
+/**
+ * @brief Print the interval if it is over while no packet comes
+ *
+ * The capture time of a live capture follows the wall clock, which stands
+ * for the time of the packet that would have closed the interval.
+ *
+ * @see tick
+ */
+void topn_idle(void)
+{
+    if (tn.tables[0].sketch == NULL || tn.packets == 0)
+        return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    tick((int64_t)now.tv_sec * 1000000 + now.tv_usec);
+}
+
+
+/**
+ * @brief Print the rankings of the last interval and free the tracker
+ *
+ * @see report
+ */
+void topn_close(void)
+{
+    if (tn.tables[0].sketch && tn.packets > 0) {
+        char title[64];
+        struct tm tm;
+        time_t sec = tn.first / 1000000;
+        strftime(title, sizeof(title), "%Y-%m-%d %H:%M:%S, last interval",
+                 localtime_r(&sec, &tm));
+        tn.redraw = 0; // Kept under the previous reports
+        report(title, (tn.now - tn.first) / 1e6);
+    }
+    for (int k = 0; k < TOPN_KINDS; k++) {
+        free(tn.tables[k].sketch);
+        free(tn.tables[k].heap);
+        free(tn.tables[k].index);
+        tn.tables[k].sketch = NULL;
+        tn.tables[k].heap = NULL;
+        tn.tables[k].index = NULL;
+    }
+}
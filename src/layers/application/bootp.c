@@ -8,6 +8,8 @@
  * 
  * @see bootp.h
  * @see cast_bootp
+ * @see json_bootp
+ * @see print_bootp
  */
 
 // Global libraries
@@ -16,6 +18,9 @@
 
 // Local header files
 #include "bootp.h"
+#include "format.h"
+#include "output.h"
+#include "render.h"
 
 #define DHCP_MCOOKIE 0x63825363 /**< DHCP magic cookie */
 #define VENDOR_OFF 236 /**< Vendor specific information offset */
@@ -27,23 +32,16 @@
  * Format hardware address from BOOTP header.
  * 
  * @param bootp BOOTP header
- * @return char* Formatted hardware address
+ * @param dst The buffer to write to, at least STR_MAC_ADDR_LEN bytes
+ * @return char* dst, NULL if the hardware type is not supported
  * 
  * @note This function doesn't check for all errors.
- * @note The returned string must be freed by the caller
  */
-char *format_haddr(const struct bootphdr *bootp)
+char *format_haddr(const struct bootphdr *bootp, char *dst)
 {
     switch (bootp->bh_htype) {
-    case 1: {
-        char *res = malloc(3 * 6 * sizeof(char));
-        if (res == NULL)
-            return NULL;
-        sprintf(res, "%02X:%02X:%02X:%02X:%02X:%02X", bootp->bh_chaddr[0],
-                bootp->bh_chaddr[1], bootp->bh_chaddr[2], bootp->bh_chaddr[3],
-                bootp->bh_chaddr[4], bootp->bh_chaddr[5]);
-        return res;
-    }
+    case 1:
+        return format_mac(dst, bootp->bh_chaddr);
     default:
         fprintf(stderr, "Unsupported hardware type 0x%x\n", bootp->bh_htype);
         return NULL;
@@ -63,118 +61,118 @@ void dhcp_tlv_analyze(uint8_t T, uint8_t L, uint8_t *V)
 {
     switch (T) {
     case 1:
-        printf("\t- SUBNET MASK: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
+        out_printf("\t- SUBNET MASK: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
         break;
     case 2:
-        printf("\t- TIME OFFSET: %s\n", V);
+        out_printf("\t- TIME OFFSET: %s\n", V);
         break;
     case 3:
-        printf("\t- ROUTER: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
+        out_printf("\t- ROUTER: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
         break;
     case 6:
-        printf("\t- DNS: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
+        out_printf("\t- DNS: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
         break;
     case 12:
-        printf("\t- HOST NAME: %s\n", V);
+        out_printf("\t- HOST NAME: %s\n", V);
         break;
     case 15:
-        printf("\t- DOMAIN NAME: %s\n", V);
+        out_printf("\t- DOMAIN NAME: %s\n", V);
         break;
     case 28:
-        printf("\t- BROADCAST ADDRESS: %s\n", V);
+        out_printf("\t- BROADCAST ADDRESS: %s\n", V);
         break;
     case 44:
-        printf("\t- NETBIOS OVER TCP/IP NAME SERVER: %s\n", V);
+        out_printf("\t- NETBIOS OVER TCP/IP NAME SERVER: %s\n", V);
         break;
     case 47:
-        printf("\t- NETBIOS OVER TCP/IP SCOPE: %s\n", V);
+        out_printf("\t- NETBIOS OVER TCP/IP SCOPE: %s\n", V);
         break;
     case 50:
-        printf("\t- REQUESTED IP ADDRESS: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
+        out_printf("\t- REQUESTED IP ADDRESS: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
         break;
     case 51:
-        printf("\t- LEASE TIME: %d\n", be32toh(*(uint32_t *)V));
+        out_printf("\t- LEASE TIME: %d\n", be32toh(*(uint32_t *)V));
         break;
     case 53: {
-        printf("\t- MESSAGE TYPE: ");
+        out_puts("\t- MESSAGE TYPE: ");
         switch (V[0]) {
         case 1:
-            printf("DISCOVER\n");
+            out_puts("DISCOVER\n");
             break;
         case 2:
-            printf("OFFER\n");
+            out_puts("OFFER\n");
             break;
         case 3:
-            printf("REQUEST\n");
+            out_puts("REQUEST\n");
             break;
         case 5:
-            printf("ACK\n");
+            out_puts("ACK\n");
             break;
         case 7:
-            printf("RELEASE\n");
+            out_puts("RELEASE\n");
             break;
         default:
-            printf("UNKNOWN\n");
+            out_puts("UNKNOWN\n");
         }
         break;
     }
     case 54:
-        printf("\t- SERVER IDENTIFIER: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
+        out_printf("\t- SERVER IDENTIFIER: %u.%u.%u.%u\n", V[0], V[1], V[2], V[3]);
         break;
     case 55: {
-        printf("\t- PARAMETER REQUEST LIST: \n");
+        out_puts("\t- PARAMETER REQUEST LIST: \n");
         for (int i = 0; i < L; i++) {
             switch(V[i]) {
                 case 1:
-                    printf("\t\t(1)\tSUBNET MASK\n");
+                    out_puts("\t\t(1)\tSUBNET MASK\n");
                     break;
                 case 2:
-                    printf("\t\t(2)\tTIME OFFSET\n");
+                    out_puts("\t\t(2)\tTIME OFFSET\n");
                     break;
                 case 3:
-                    printf("\t\t(3)\tROUTER\n");
+                    out_puts("\t\t(3)\tROUTER\n");
                     break;
                 case 6:
-                    printf("\t\t(6)\tDNS\n");
+                    out_puts("\t\t(6)\tDNS\n");
                     break;
                 case 12:
-                    printf("\t\t(12)\tHOST NAME\n");
+                    out_puts("\t\t(12)\tHOST NAME\n");
                     break;
                 case 15:
-                    printf("\t\t(15)\tDOMAIN NAME\n");
+                    out_puts("\t\t(15)\tDOMAIN NAME\n");
                     break;
                 case 42:
-                    printf("\t\t(42)\tNETWORK TIME PROTOCOL SERVERS\n");
+                    out_puts("\t\t(42)\tNETWORK TIME PROTOCOL SERVERS\n");
                     break;
                 case 44:
-                    printf("\t\t(44)\tNETBIOS OVER TCP/IP NAME SERVER\n");
+                    out_puts("\t\t(44)\tNETBIOS OVER TCP/IP NAME SERVER\n");
                     break;
                 case 47:
-                    printf("\t\t(47)\tNETBIOS OVER TCP/IP SCOPE\n");
+                    out_puts("\t\t(47)\tNETBIOS OVER TCP/IP SCOPE\n");
                     break;
                 case 51:
-                    printf("\t\t(51)\tLEASE TIME\n");
+                    out_puts("\t\t(51)\tLEASE TIME\n");
                     break;
                 case 54:
-                    printf("\t\t(54)\tSERVER IDENTIFIER\n");
+                    out_puts("\t\t(54)\tSERVER IDENTIFIER\n");
                     break;
                 default:
-                    printf("\t\tPARAMETER NOT IMPLEMENTED YET %d\n", V[i]);
+                    out_printf("\t\tPARAMETER NOT IMPLEMENTED YET %d\n", V[i]);
             }
         }
         break;
     }
     case 58: 
-        printf("\t- REBINDING TIME VALUE: %d\n", be32toh(*(uint32_t*)V));
+        out_printf("\t- REBINDING TIME VALUE: %d\n", be32toh(*(uint32_t*)V));
         break;
     case 61: {
-        printf("\t- CLIENT IDENTIFIER: ");
+        out_puts("\t- CLIENT IDENTIFIER: ");
         uint8_t htype = (uint8_t)V[0];
         if (htype == 1) {
-            printf("%02X:%02X:%02X:%02X:%02X:%02X\n", V[1], V[2], V[3], V[4],
-                   V[5], V[6]);
+            out_printf("%02X:%02X:%02X:%02X:%02X:%02X\n", V[1], V[2], V[3], V[4],
+                       V[5], V[6]);
         } else {
-            printf("UNKNOWN HTYPE\n");
+            out_puts("UNKNOWN HTYPE\n");
         }
         break;
     }
@@ -185,37 +183,33 @@ void dhcp_tlv_analyze(uint8_t T, uint8_t L, uint8_t *V)
  * @brief Walk vendor specific information
  * 
  * Walk vendor specific information.
+ * Each value is copied to a zeroed buffer, so the analysis never reads past
+ * the option and the strings are always terminated.
  * 
- * @param packet Pointer to the packet
+ * @param v The view of the options
  * @param magic_cookie Magic cookie
  */
-void walk_vendor(const u_char *packet, uint32_t magic_cookie)
+void walk_vendor(struct packet_view *v, uint32_t magic_cookie)
 {
-    printf("OPTIONS:\n");
-    int off = 0;
+    out_puts("OPTIONS:\n");
     while (1) {
-        uint8_t T;
-        T = *(uint8_t *)(packet + off);
-        if (T == 0x00) { // End of options
+        uint8_t T, L;
+        if (view_u8(v, &T) < 0 || T == 0x00 || T == 0xFF) { // Padding or end
             break;
         }
-        off++;
-        uint8_t L;
-        L = *(uint8_t *)(packet + off);
-        off++;
-        uint8_t *V = malloc(L * sizeof(uint8_t));
-        if (V == NULL) {
-            continue;
+        const u_char *value;
+        if (view_u8(v, &L) < 0 || (value = view_pull(v, L)) == NULL) {
+            break;
         }
-        memcpy(V, packet + off, L);
+        uint8_t V[UINT8_MAX + 1];
+        memcpy(V, value, L);
+        memset(V + L, 0, sizeof(V) - L);
 
-        off += L;
         switch (magic_cookie) {
         case DHCP_MCOOKIE:
             dhcp_tlv_analyze(T, L, V);
             break;
         }
-        free(V);
     }
 }
 
@@ -225,37 +219,228 @@ void walk_vendor(const u_char *packet, uint32_t magic_cookie)
  * 
  * Get BOOTP header from packet.
  * 
- * @param packet Pointer to the packet
- * @return int 0 on success
+ * @param v The view of the message
+ * @param pi The decoded packet to fill
+ * @return int 0 on success, -1 on error
  * 
  * @see bootp.h
  */
-int cast_bootp(const u_char *packet)
+int cast_bootp(struct packet_view *v, struct packet_info *pi)
+{
+    const struct bootphdr *bootp;
+    uint32_t cookie;
+    bootp = view_pull(v, VENDOR_OFF);
+    if (bootp == NULL || view_be32(v, &cookie) < 0)
+        return (-1);
+    pi->u.bootp.op = bootp->bh_op;
+    if (cookie != DHCP_MCOOKIE)
+        return 0;
+    pi->u.bootp.dhcp = 1;
+
+    // Look for the message type option
+    uint8_t T, L;
+    while (view_u8(v, &T) == 0 && T != 0x00 && T != 0xFF &&
+           view_u8(v, &L) == 0) {
+        if (T == 53 && L >= 1) {
+            view_u8(v, &pi->u.bootp.msg_type);
+            break;
+        }
+        if (view_skip(v, L) < 0)
+            break;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Write the value of a DHCP option as JSON
+ * 
+ * Addresses, numbers and strings are written as such, the other options in
+ * hexadecimal.
+ * 
+ * @param j The writer
+ * @param T Type
+ * @param L Length
+ * @param V Value
+ */
+static void json_dhcp_value(struct json *j, uint8_t T, uint8_t L,
+                            const uint8_t *V)
+{
+    switch (T) {
+    case 1:  // Subnet mask
+    case 28: // Broadcast address
+    case 50: // Requested IP address
+    case 54: // Server identifier
+        if (L == 4) {
+            json_ipv4(j, "value", V);
+            return;
+        }
+        break;
+    case 3:  // Routers
+    case 6:  // DNS servers
+    case 42: // NTP servers
+    case 44: // NetBIOS name servers
+        if (L > 0 && L % 4 == 0) {
+            json_array(j, "value");
+            for (int i = 0; i < L; i += 4)
+                json_ipv4(j, NULL, V + i);
+            json_end(j);
+            return;
+        }
+        break;
+    case 51: // Lease time
+    case 58: // Renewal time
+    case 59: // Rebinding time
+        if (L == 4) {
+            json_uint(j, "value", (uint32_t)V[0] << 24 | (uint32_t)V[1] << 16 |
+                                      (uint32_t)V[2] << 8 | V[3]);
+            return;
+        }
+        break;
+    case 57: // Maximum message size
+        if (L == 2) {
+            json_uint(j, "value", (uint16_t)V[0] << 8 | V[1]);
+            return;
+        }
+        break;
+    case 53: // Message type
+        if (L == 1) {
+            json_uint(j, "value", V[0]);
+            return;
+        }
+        break;
+    case 12: // Host name
+    case 15: // Domain name
+    case 47: // NetBIOS scope
+    case 56: // Message
+    case 60: // Vendor class identifier
+    case 66: // TFTP server name
+    case 67: // Boot file name
+        json_strn(j, "value", (const char *)V, L);
+        return;
+    case 55: // Parameter request list
+        json_array(j, "value");
+        for (int i = 0; i < L; i++)
+            json_uint(j, NULL, V[i]);
+        json_end(j);
+        return;
+    }
+    json_hex(j, "value", V, L);
+}
+
+
+/**
+ * @brief Write a BOOTP message as JSON
+ * 
+ * @param j The writer
+ * @param msg The message
+ * @param len The length of the message
+ * @param verbose The verbose level, the addresses and DHCP options are
+ * written at VERBOSE_COMPLETE
+ * @return int 0 on success, -1 if the header is cut
+ * 
+ * @see json_dhcp_value
+ */
+int json_bootp(struct json *j, const u_char *msg, uint32_t len, int verbose)
+{
+    struct packet_view v;
+    view_init(&v, msg, len);
+    const struct bootphdr *bootp;
+    uint32_t cookie;
+    bootp = view_pull(&v, VENDOR_OFF);
+    if (bootp == NULL || view_be32(&v, &cookie) < 0)
+        return (-1);
+
+    json_object(j, "bootp");
+    json_uint(j, "op", bootp->bh_op);
+    json_uint(j, "xid", be32toh(bootp->bh_xid));
+    if (bootp->bh_htype == 1 && bootp->bh_hlen == 6)
+        json_mac(j, "chaddr", bootp->bh_chaddr);
+    if (verbose >= VERBOSE_COMPLETE) {
+        json_ipv4(j, "ciaddr", (const uint8_t *)&bootp->bh_ciaddr);
+        json_ipv4(j, "yiaddr", (const uint8_t *)&bootp->bh_yiaddr);
+        json_ipv4(j, "siaddr", (const uint8_t *)&bootp->bh_siaddr);
+        json_ipv4(j, "giaddr", (const uint8_t *)&bootp->bh_giaddr);
+        json_uint(j, "hops", bootp->bh_hops);
+        json_uint(j, "secs", be16toh(bootp->bh_secs));
+    }
+    json_bool(j, "dhcp", cookie == DHCP_MCOOKIE);
+    if (cookie != DHCP_MCOOKIE) {
+        json_end(j);
+        return 0;
+    }
+
+    uint8_t msg_type = 0;
+    if (verbose >= VERBOSE_COMPLETE)
+        json_array(j, "options");
+    while (1) {
+        uint8_t T, L;
+        const u_char *value;
+        if (view_u8(&v, &T) < 0 || T == 0xFF) // End
+            break;
+        if (T == 0x00) // Padding
+            continue;
+        if (view_u8(&v, &L) < 0 || (value = view_pull(&v, L)) == NULL)
+            break;
+        if (T == 53 && L >= 1)
+            msg_type = value[0];
+        if (verbose >= VERBOSE_COMPLETE) {
+            json_object(j, NULL);
+            json_uint(j, "code", T);
+            json_dhcp_value(j, T, L, value);
+            json_end(j);
+        }
+    }
+    if (verbose >= VERBOSE_COMPLETE)
+        json_end(j);
+    if (msg_type)
+        json_uint(j, "msg_type", msg_type);
+    json_end(j);
+    return 0;
+}
+
+
+/**
+ * @brief Print BOOTP header
+ * 
+ * Print the BOOTP header and its vendor specific information.
+ * 
+ * @param packet Pointer to the packet
+ * @param data_size Size of the data
+ * @return int 0 on success, -1 if the header is cut
+ * 
+ * @see walk_vendor
+ */
+int print_bootp(const u_char *packet, int data_size)
 {
+    struct packet_view v;
+    view_init(&v, packet, data_size);
     const struct bootphdr *bootp;
-    bootp = (struct bootphdr *)packet;
+    uint32_t cookie;
+    bootp = view_pull(&v, VENDOR_OFF);
+    if (bootp == NULL || view_be32(&v, &cookie) < 0)
+        return (-1);
     if (bootp->bh_op == 1 || bootp->bh_op == 2) {
-        switch (be32toh(*(uint32_t *)(packet + VENDOR_OFF))) {
+        switch (cookie) {
         case DHCP_MCOOKIE:
-            printf("BOOTP/DHCP ");
+            out_puts("BOOTP/DHCP ");
             break;
         default:
-            printf("BOOTP ");
+            out_puts("BOOTP ");
         }
         switch (bootp->bh_op) {
         case 1: {
-            char *chaddr = format_haddr(bootp);
-            printf("REQUEST from %s\n", chaddr ? chaddr : "");
-            free(chaddr);
+            char buf[STR_MAC_ADDR_LEN];
+            char *chaddr = format_haddr(bootp, buf);
+            out_printf("REQUEST from %s\n", chaddr ? chaddr : "");
             break;
         }
         case 2:
-            printf("REPLY\n");
+            out_puts("REPLY\n");
             break;
         }
 
-        walk_vendor(packet + VENDOR_OFF + 4,
-                    be32toh(*(uint32_t *)(packet + VENDOR_OFF)));
+        walk_vendor(&v, cookie);
     }
     return 0;
 }
\ No newline at end of file
@@ -8,6 +8,9 @@
  * 
  * @see dns.h
  * @see cast_dns
+ * @see dns_question
+ * @see json_dns
+ * @see print_dns
  */
 
 // Global libraries
@@ -16,212 +19,227 @@
 
 // Local header files
 #include "dns.h"
+#include "format.h"
+#include "output.h"
+#include "render.h"
+
+
+/**
+ * @brief Read the name field of a question or an answer
+ *
+ * @param msg The message the view was made of
+ * @param v The view of the message, advanced past the name
+ * @return const struct dns_name* The name, NULL if it is cut, too long or
+ * loops
+ *
+ * @see dns_name_intern
+ */
+static const struct dns_name *view_name(const u_char *msg,
+                                        struct packet_view *v)
+{
+    uint32_t off = v->off;
+    const struct dns_name *name = dns_name_intern(msg, v->off + v->remaining,
+                                                  &off);
+    if (name == NULL)
+        return NULL;
+    view_skip(v, off - v->off);
+    return name;
+}
 
 
 /**
  * @brief Check question segment of DNS header
  * 
- * @param packet Pointer to the packet
+ * @param msg The message
+ * @param v The view of the message, advanced past the question segment
  * @param questions Number of questions
- * @return int Offset at the end of the question segment
+ * @return int 0 on success, -1 if the segment is cut
  */
-int check_question(const u_char *packet, int questions)
+static int check_question(const u_char *msg, struct packet_view *v,
+                          int questions)
 {
-    printf("\t- %dx QUERIE(S):\n", questions);
-    int off = 0;
+    out_printf("\t- %dx QUERIE(S):\n", questions);
     for (int i = 0; i < questions; i++) { // Loop over questions
-        char name[256];
-        int j = 0;
+        uint16_t type, class;
         // Parse name field of the question
-        while (1) {
-            if (packet[j] == 0) {
-                break;
-            }
-            if (packet[j] >= 32 && packet[j] <= 126) {
-                name[j] = packet[j];
-            } else {
-                name[j] = '.';
-            }
-            j++;
-        }
-        name[j] = '\0';
-        printf("\t\t- NAME: %s\n", name);
-        off = j + 1; // Skip the null byte
+        const struct dns_name *name = view_name(msg, v);
+        if (name == NULL)
+            return (-1);
+        out_printf("\t\t- NAME: %s\n", name->str);
 
         // Parse type field of the question
-        uint16_t type = be16toh(*(uint16_t *)(packet + off));
+        if (view_be16(v, &type) < 0)
+            return (-1);
         switch (type) {
         case 1:
-            printf("\t\t- TYPE: A\n");
+            out_puts("\t\t- TYPE: A\n");
             break;
         case 2:
-            printf("\t\t- TYPE: NS\n");
+            out_puts("\t\t- TYPE: NS\n");
             break;
         case 5:
-            printf("\t\t- TYPE: CNAME\n");
+            out_puts("\t\t- TYPE: CNAME\n");
             break;
         case 6:
-            printf("\t\t- TYPE: SOA\n");
+            out_puts("\t\t- TYPE: SOA\n");
             break;
         case 12:
-            printf("\t\t- TYPE: PTR\n");
+            out_puts("\t\t- TYPE: PTR\n");
             break;
         case 15:
-            printf("\t\t- TYPE: MX\n");
+            out_puts("\t\t- TYPE: MX\n");
             break;
         case 16:
-            printf("\t\t- TYPE: TXT\n");
+            out_puts("\t\t- TYPE: TXT\n");
             break;
         case 28:
-            printf("\t\t- TYPE: AAAA\n");
+            out_puts("\t\t- TYPE: AAAA\n");
             break;
         case 33:
-            printf("\t\t- TYPE: SRV\n");
+            out_puts("\t\t- TYPE: SRV\n");
             break;
         }
-        off += 2; // Skip the 2 bytes of the type field
 
         // Parse class field of the question
-        uint16_t class = be16toh(*(uint16_t *)(packet + off));
+        if (view_be16(v, &class) < 0)
+            return (-1);
         switch (class) {
         case 0:
-            printf("\t\t- CLASS: RESERVED\n");
+            out_puts("\t\t- CLASS: RESERVED\n");
             break;
         case 1:
-            printf("\t\t- CLASS: IN\n");
+            out_puts("\t\t- CLASS: IN\n");
             break;
         case 3:
-            printf("\t\t- CLASS: CH\n");
+            out_puts("\t\t- CLASS: CH\n");
             break;
         case 4:
-            printf("\t\t- CLASS: HS\n");
+            out_puts("\t\t- CLASS: HS\n");
             break;
         case 254:
-            printf("\t\t- CLASS: QCLASS NONE\n");
+            out_puts("\t\t- CLASS: QCLASS NONE\n");
             break;
         case 255:
-            printf("\t\t- CLASS: QCLASS *\n");
+            out_puts("\t\t- CLASS: QCLASS *\n");
             break;
         }
-        off += 2; // Skip the 2 bytes of the class field
     }
-    return off;
+    return 0;
 }
 
 
 /**
  * @brief Check answer segment of DNS header
  * 
- * @param packet Pointer to the packet
+ * @param msg The message
+ * @param v The view of the message, advanced past the answer segment
  * @param answers Number of answers
- * @return int Offset at the end of the answer segment
+ * @return int 0 on success, -1 if the segment is cut
  */
-int check_answer(const u_char *packet, int answers)
+static int check_answer(const u_char *msg, struct packet_view *v, int answers)
 {
-    printf("\t- %dx ANSWER(S):\n", answers);
-    int off = 0;
+    out_printf("\t- %dx ANSWER(S):\n", answers);
     for (int i = 0; i < answers; i++) { // Loop over answers
-        char name[256];
-        int j = 0;
+        uint16_t type, class, rdlength;
+        uint32_t ttl;
         // Parse name field of the answer
-        while (1) {
-            if (packet[j] == 0) {
-                break;
-            }
-            if (packet[j] >= 32 && packet[j] <= 126) {
-                name[j] = packet[j];
-            } else {
-                name[j] = '.';
-            }
-            j++;
-        }
-        name[j] = '\0';
-        printf("\t\t- NAME: %s\n", name);
-        off = j + 1; // Skip the null byte
+        const struct dns_name *name = view_name(msg, v);
+        if (name == NULL)
+            return (-1);
+        out_printf("\t\t- NAME: %s\n", name->str);
 
         // Parse type field of the answer
-        uint16_t type = be16toh(*(uint16_t *)(packet + off));
+        if (view_be16(v, &type) < 0)
+            return (-1);
         switch (type) {
         case 1:
-            printf("\t\t- TYPE: A\n");
+            out_puts("\t\t- TYPE: A\n");
             break;
         case 2:
-            printf("\t\t- TYPE: NS\n");
+            out_puts("\t\t- TYPE: NS\n");
             break;
         case 5:
-            printf("\t\t- TYPE: CNAME\n");
+            out_puts("\t\t- TYPE: CNAME\n");
             break;
         case 6:
-            printf("\t\t- TYPE: SOA\n");
+            out_puts("\t\t- TYPE: SOA\n");
             break;
         case 12:
-            printf("\t\t- TYPE: PTR\n");
+            out_puts("\t\t- TYPE: PTR\n");
             break;
         case 15:
-            printf("\t\t- TYPE: MX\n");
+            out_puts("\t\t- TYPE: MX\n");
             break;
         case 16:
-            printf("\t\t- TYPE: TXT\n");
+            out_puts("\t\t- TYPE: TXT\n");
             break;
         case 28:
-            printf("\t\t- TYPE: AAAA\n");
+            out_puts("\t\t- TYPE: AAAA\n");
             break;
         case 33:
-            printf("\t\t- TYPE: SRV\n");
+            out_puts("\t\t- TYPE: SRV\n");
             break;
         }
-        off += 2; // Skip the 2 bytes of the type field
 
         // Parse class field of the answer
-        uint16_t class = be16toh(*(uint16_t *)(packet + off));
+        if (view_be16(v, &class) < 0)
+            return (-1);
         switch (class) {
         case 0:
-            printf("\t\t- CLASS: RESERVED\n");
+            out_puts("\t\t- CLASS: RESERVED\n");
             break;
         case 1:
-            printf("\t\t- CLASS: IN\n");
+            out_puts("\t\t- CLASS: IN\n");
             break;
         case 3:
-            printf("\t\t- CLASS: CH\n");
+            out_puts("\t\t- CLASS: CH\n");
             break;
         case 4:
-            printf("\t\t- CLASS: HS\n");
+            out_puts("\t\t- CLASS: HS\n");
             break;
         case 254:
-            printf("\t\t- CLASS: QCLASS NONE\n");
+            out_puts("\t\t- CLASS: QCLASS NONE\n");
             break;
         case 255:
-            printf("\t\t- CLASS: QCLASS *\n");
+            out_puts("\t\t- CLASS: QCLASS *\n");
             break;
         }
-        off += 2; // Skip the 2 bytes of the class field
 
         // Parse TTL field of the answer
-        uint32_t ttl = be32toh(*(uint32_t *)(packet + off));
-        printf("\t\t- TTL: %d\n", ttl);
-        off += 4; // Skip the 4 bytes of the TTL field
+        if (view_be32(v, &ttl) < 0)
+            return (-1);
+        out_printf("\t\t- TTL: %d\n", ttl);
 
         // Parse RDLENGTH field of the answer
-        int rdlength = be16toh(*(uint16_t *)(packet + off));
-        printf("\t\t- RDATA LENGTH: %d\n", rdlength);
-        off += 2; // Skip the 2 bytes of the RDLENGTH field
+        if (view_be16(v, &rdlength) < 0)
+            return (-1);
+        out_printf("\t\t- RDATA LENGTH: %d\n", rdlength);
 
+        const u_char *rdata = view_pull(v, rdlength);
+        if (rdata == NULL)
+            return (-1);
         switch (type) {
-        case 1: // A
-            printf("\t\t- ADDRESS: %u.%u.%u.%u\n", packet[off], packet[off + 1],
-                   packet[off + 2], packet[off + 3]);
-            off += 4;
-            break;
-        case 28: // AAAA
-            printf("\t\t- ADDRESS: %04x:%04x:%04x:%04x:%04x:%04x:%04x:%04x\n",
-                   packet[off], packet[off + 1], packet[off + 2],
-                   packet[off + 3], packet[off + 4], packet[off + 5],
-                   packet[off + 6], packet[off + 7]);
-            off += 16;
+        case 1: { // A
+            if (rdlength < 4)
+                break;
+            char addr[STR_IPv4_ADDR_LEN];
+            uint32_t ip;
+            memcpy(&ip, rdata, 4);
+            out_printf("\t\t- ADDRESS: %s\n", format_ipv4(addr, be32toh(ip)));
+            break;
+        }
+        case 28: { // AAAA
+            if (rdlength < 16)
+                break;
+            char addr[STR_IPv6_ADDR_LEN];
+            struct in6_addr ip6;
+            memcpy(&ip6, rdata, 16);
+            out_printf("\t\t- ADDRESS: %s\n", format_ipv6(addr, &ip6));
             break;
         }
+        }
     }
-    return off;
+    return 0;
 }
 
 
@@ -230,97 +248,290 @@ int check_answer(const u_char *packet, int answers)
  * 
  * Get DNS header from packet.
  * 
+ * @param v The view of the message
+ * @param pi The decoded packet to fill
+ * @return int 0 on success, -1 on error
+ */
+int cast_dns(struct packet_view *v, struct packet_info *pi)
+{
+    const struct dnshdr *dns;
+    dns = view_pull(v, sizeof(struct dnshdr));
+    if (dns == NULL)
+        return (-1);
+    pi->u.dns.id = be16toh(dns->dh_xid);
+    pi->u.dns.flags = be16toh(dns->dh_flags);
+    pi->u.dns.questions = be16toh(dns->dh_questions);
+    pi->u.dns.answers = be16toh(dns->dh_answers);
+    return 0;
+}
+
+
+/**
+ * @brief Get the first question of a DNS message
+ * 
+ * @param msg The message
+ * @param len The length of the message
+ * @param name The buffer to write to, DNS_NAME_LEN bytes
+ * @param type The type of the question
+ * @return int 0 on success, -1 if there is no complete question
+ * 
+ * @see dns_name_read
+ */
+int dns_question(const u_char *msg, uint32_t len, char *name, uint16_t *type)
+{
+    if (len < sizeof(struct dnshdr) ||
+        be16toh(((const struct dnshdr *)msg)->dh_questions) == 0)
+        return (-1);
+    uint32_t off = sizeof(struct dnshdr);
+    if (dns_name_read(msg, len, &off, name) < 0 || off + 2 > len)
+        return (-1);
+    *type = (uint16_t)msg[off] << 8 | msg[off + 1];
+    return 0;
+}
+
+
+/**
+ * @brief Write the data of a resource record as JSON
+ * 
+ * Addresses and names are written as strings, the other types in
+ * hexadecimal.
+ * 
+ * @param j The writer
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the data
+ * @param type The type of the record
+ * @param rdlength The length of the data
+ */
+static void json_rdata(struct json *j, const u_char *msg, uint32_t len,
+                       uint32_t off, uint16_t type, uint16_t rdlength)
+{
+    const struct dns_name *name;
+    uint32_t pos = off;
+    switch (type) {
+    case 1: // A
+        if (rdlength == 4) {
+            json_ipv4(j, "data", msg + off);
+            return;
+        }
+        break;
+    case 28: // AAAA
+        if (rdlength == 16) {
+            json_ipv6(j, "data", msg + off);
+            return;
+        }
+        break;
+    case 2:  // NS
+    case 5:  // CNAME
+    case 12: // PTR
+        if ((name = dns_name_intern(msg, len, &pos)) != NULL) {
+            json_strn(j, "data", name->str, name->len);
+            return;
+        }
+        break;
+    case 15: // MX
+        pos += 2;
+        if (rdlength > 2 && (name = dns_name_intern(msg, len, &pos)) != NULL) {
+            json_uint(j, "preference", (uint16_t)msg[off] << 8 | msg[off + 1]);
+            json_strn(j, "data", name->str, name->len);
+            return;
+        }
+        break;
+    case 16: // TXT, the first string
+        if (rdlength > 0 && msg[off] < rdlength) {
+            json_strn(j, "data", (const char *)msg + off + 1, msg[off]);
+            return;
+        }
+        break;
+    }
+    json_hex(j, "data", msg + off, rdlength);
+}
+
+
+/**
+ * @brief Write a DNS message as JSON
+ * 
+ * @param j The writer
+ * @param msg The message
+ * @param len The length of the message
+ * @param verbose The verbose level, the questions and answers are written at
+ * VERBOSE_COMPLETE
+ * @return int 0 on success, -1 if the message is cut
+ * 
+ * @see dns_name_intern
+ * @see json_rdata
+ */
+int json_dns(struct json *j, const u_char *msg, uint32_t len, int verbose)
+{
+    if (len < sizeof(struct dnshdr))
+        return (-1);
+    const struct dnshdr *dns = (const struct dnshdr *)msg;
+    uint16_t flags = be16toh(dns->dh_flags);
+    uint16_t questions = be16toh(dns->dh_questions);
+    uint16_t answers = be16toh(dns->dh_answers);
+
+    json_object(j, "dns");
+    json_uint(j, "id", be16toh(dns->dh_xid));
+    json_bool(j, "response", flags & DH_QR);
+    json_uint(j, "opcode", (flags & DH_OP) >> 11);
+    json_uint(j, "rcode", flags & DH_RCODE);
+    json_uint(j, "qdcount", questions);
+    json_uint(j, "ancount", answers);
+    if (verbose >= VERBOSE_COMPLETE) {
+        json_uint(j, "flags", flags);
+        json_uint(j, "nscount", be16toh(dns->dh_autorityRRs));
+        json_uint(j, "arcount", be16toh(dns->dh_additionalRRs));
+    }
+    if (verbose < VERBOSE_COMPLETE) {
+        json_end(j);
+        return 0;
+    }
+
+    const struct dns_name *name;
+    uint32_t off = sizeof(struct dnshdr);
+    int ret = 0;
+    json_array(j, "questions");
+    for (int i = 0; i < questions; i++) {
+        if ((name = dns_name_intern(msg, len, &off)) == NULL || off + 4 > len) {
+            ret = -1;
+            break;
+        }
+        json_object(j, NULL);
+        json_strn(j, "name", name->str, name->len);
+        json_uint(j, "type", (uint16_t)msg[off] << 8 | msg[off + 1]);
+        json_uint(j, "class", (uint16_t)msg[off + 2] << 8 | msg[off + 3]);
+        json_end(j);
+        off += 4;
+    }
+    json_end(j);
+
+    json_array(j, "answers");
+    for (int i = 0; ret == 0 && i < answers; i++) {
+        if ((name = dns_name_intern(msg, len, &off)) == NULL || off + 10 > len) {
+            ret = -1;
+            break;
+        }
+        const u_char *rr = msg + off;
+        uint16_t type = (uint16_t)rr[0] << 8 | rr[1];
+        uint16_t rdlength = (uint16_t)rr[8] << 8 | rr[9];
+        off += 10;
+        if (off + rdlength > len) {
+            ret = -1;
+            break;
+        }
+        json_object(j, NULL);
+        json_strn(j, "name", name->str, name->len);
+        json_uint(j, "type", type);
+        json_uint(j, "class", (uint16_t)rr[2] << 8 | rr[3]);
+        json_uint(j, "ttl", (uint32_t)rr[4] << 24 | (uint32_t)rr[5] << 16 |
+                                (uint32_t)rr[6] << 8 | rr[7]);
+        json_rdata(j, msg, len, off, type, rdlength);
+        json_end(j);
+        off += rdlength;
+    }
+    json_end(j);
+    if (ret < 0)
+        json_bool(j, "truncated", 1);
+    json_end(j);
+    return ret;
+}
+
+
+/**
+ * @brief Print DNS message
+ * 
+ * Print the header, questions and answers of a DNS message.
+ * 
  * @param packet Pointer to the packet
  * @param data_size Size of the data
- * @return int 0 on success
+ * @return int 0 on success, -1 if the message is cut
  */
-int cast_dns(const u_char *packet, int data_size)
+int print_dns(const u_char *packet, int data_size)
 {
-    if (data_size) { // To pass unused parameter warning
-        ;
-    }
+    struct packet_view v;
+    view_init(&v, packet, data_size);
     const struct dnshdr *dns;
-    dns = (struct dnshdr *)packet;
-    printf("\t- TRANSACTION ID: 0x%04x\n", be16toh(dns->dh_xid));
+    dns = view_pull(&v, sizeof(struct dnshdr));
+    if (dns == NULL)
+        return (-1);
+    out_printf("\t- TRANSACTION ID: 0x%04x\n", be16toh(dns->dh_xid));
 
     uint16_t flags = be16toh(dns->dh_flags);
-    printf("\t- FLAGS: 0x%04x\n", flags);
+    out_printf("\t- FLAGS: 0x%04x\n", flags);
 
     switch ((flags & DH_QR) >> 15) {
     case 0:
-        printf("\t- QR: (0) QUERY\n");
+        out_puts("\t- QR: (0) QUERY\n");
         break;
     case 1:
-        printf("\t- QR: (1) REPLY\n");
+        out_puts("\t- QR: (1) REPLY\n");
         break;
     }
     switch ((flags & DH_OP) >> 11) {
     case 0:
-        printf("\t- OP: (0) QUERY\n");
+        out_puts("\t- OP: (0) QUERY\n");
         break;
     case 1:
-        printf("\t- OP: (1) IQUERY\n");
+        out_puts("\t- OP: (1) IQUERY\n");
         break;
     case 2:
-        printf("\t- OP: (2) STATUS\n");
+        out_puts("\t- OP: (2) STATUS\n");
         break;
     }
     if (flags & DH_AA)
-        printf("\t- AA: (1) AUTHORITATIVE ANSWER\n");
+        out_puts("\t- AA: (1) AUTHORITATIVE ANSWER\n");
     if (flags & DH_TC)
-        printf("\t- TC: (1) TRUNCATED\n");
+        out_puts("\t- TC: (1) TRUNCATED\n");
     if (flags & DH_RD)
-        printf("\t- RD: (1) RECURSION DESIRED\n");
+        out_puts("\t- RD: (1) RECURSION DESIRED\n");
     if (flags & DH_RA)
-        printf("\t- RA: (1) RECURSION AVAILABLE\n");
+        out_puts("\t- RA: (1) RECURSION AVAILABLE\n");
     
     switch (flags & DH_RCODE) {
     case 0:
-        printf("\t- RCODE: (0) NO ERROR\n");
+        out_puts("\t- RCODE: (0) NO ERROR\n");
         break;
     case 1:
-        printf("\t- RCODE: (1) FORMAT ERROR\n");
+        out_puts("\t- RCODE: (1) FORMAT ERROR\n");
         break;
     case 2:
-        printf("\t- RCODE: (2) SERVER FAILURE\n");
+        out_puts("\t- RCODE: (2) SERVER FAILURE\n");
         break;
     case 3:
-        printf("\t- RCODE: (3) NAME ERROR\n");
+        out_puts("\t- RCODE: (3) NAME ERROR\n");
         break;
     case 4:
-        printf("\t- RCODE: (4) NOT IMPLEMENTED\n");
+        out_puts("\t- RCODE: (4) NOT IMPLEMENTED\n");
         break;
     case 5:
-        printf("\t- RCODE: (5) REFUSED\n");
+        out_puts("\t- RCODE: (5) REFUSED\n");
         break;
     case 6:
-        printf("\t- RCODE: (6) YXDOMAIN\n");
+        out_puts("\t- RCODE: (6) YXDOMAIN\n");
         break;
     case 7:
-        printf("\t- RCODE: (7) YXRRSET\n");
+        out_puts("\t- RCODE: (7) YXRRSET\n");
         break;
     case 8:
-        printf("\t- RCODE: (8) NOTAUTH\n");
+        out_puts("\t- RCODE: (8) NOTAUTH\n");
         break;
     case 9:
-        printf("\t- RCODE: (9) NOTZONE\n");
+        out_puts("\t- RCODE: (9) NOTZONE\n");
         break;
     }
 
-    int off = 12; // Start after the static part of the header
-    if (dns->dh_questions > 0) {
-        off += check_question(packet + off, be16toh(dns->dh_questions));
-    }
-    if (dns->dh_answers > 0) {
-        off += check_answer(packet + off, be16toh(dns->dh_answers));
-    }
+    int ret = 0; // The counts below are printed even if a segment is cut
+    if (dns->dh_questions > 0)
+        ret = check_question(packet, &v, be16toh(dns->dh_questions));
+    if (ret == 0 && dns->dh_answers > 0)
+        ret = check_answer(packet, &v, be16toh(dns->dh_answers));
     if (dns->dh_autorityRRs > 0) {
-        printf("\t- %dx AUTHORITY RRs:\n", dns->dh_autorityRRs);
-        printf("\t\t- NOT IMPLEMENTED YET\n");
+        out_printf("\t- %dx AUTHORITY RRs:\n", be16toh(dns->dh_autorityRRs));
+        out_puts("\t\t- NOT IMPLEMENTED YET\n");
     }
     if (dns->dh_additionalRRs > 0) {
-        printf("\t- %dx ADDITIONAL RRs:\n", dns->dh_additionalRRs);
-        printf("\t\t- NOT IMPLEMENTED YET\n");
+        out_printf("\t- %dx ADDITIONAL RRs:\n", be16toh(dns->dh_additionalRRs));
+        out_puts("\t\t- NOT IMPLEMENTED YET\n");
     }
-    return 0;
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+/**
+ * @author Flavien Lallemant
+ * @file dnsname.c
+ * @brief DNS name decoder definition
+ * @ingroup application
+ *
+ * This file contains the definition of the DNS name decoder and of the name
+ * cache.
+ * The cache is set associative: the hash of a name picks a set of
+ * CACHE_WAYS entries, and a new name takes the least recently used entry of
+ * its set. It is allocated by each thread on its first name, the names too
+ * long to fit an entry are given back uninterned.
+ *
+ * @see dnsname.h
+ * @see dns_name_read
+ * @see dns_name_intern
+ * @see dns_name_release
+ */
+
+// Global libraries
+#include <stdlib.h>
+#include <string.h>
+
+// Local header files
+#include "dnsname.h"
+
+#define CACHE_WAYS 4 /**< Entries of a set */
+#define CACHE_SETS (DNS_NAME_CACHE / CACHE_WAYS) /**< Sets of the cache, a power of 2 */
+#define CACHE_TEXT 64 /**< Longest name interned, with the null byte */
+
+_Static_assert((CACHE_SETS & (CACHE_SETS - 1)) == 0,
+               "the number of sets must be a power of 2");
+
+/**
+ * @brief Entry of the cache
+ */
+struct cache_entry {
+    struct dns_name name;   /**< The name, pointing to the text below */
+    uint64_t stamp;         /**< Last use of the entry, 0 if free */
+    char text[CACHE_TEXT];  /**< The text of the name */
+};
+
+/**
+ * @brief Name cache of a thread
+ */
+struct name_cache {
+    struct cache_entry *entries;    /**< The entries, NULL before the first name */
+    uint64_t clock;                 /**< Names interned */
+    struct dns_name spare;          /**< The last name not interned */
+    char text[DNS_NAME_LEN];        /**< The text of the last name read */
+};
+
+static __thread struct name_cache cache; /**< The cache of the calling thread */
+
+
+/**
+ * @brief Decode a name of a message
+ *
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the name, set to the offset after it
+ * @param name The buffer to write to, DNS_NAME_LEN bytes
+ * @param hash The hash of the name
+ * @return int The length of the name, -1 if it is cut, too long or loops
+ */
+static int name_decode(const u_char *msg, uint32_t len, uint32_t *off,
+                       char *name, uint32_t *hash)
+{
+    uint32_t pos = *off;
+    uint32_t end = 0; // Offset after the name, set at the first pointer
+    uint32_t h = 2166136261u; // FNV-1a
+    int n = 0;
+    for (int hops = 0; hops <= DNS_NAME_HOPS;) {
+        if (pos >= len)
+            return (-1);
+        uint8_t c = msg[pos];
+        if (c == 0) {
+            *off = end ? end : pos + 1;
+            if (n == 0) {
+                name[n++] = '.';
+                h = (h ^ '.') * 16777619u;
+            }
+            name[n] = '\0';
+            *hash = h;
+            return n;
+        }
+        if ((c & 0xc0) == 0xc0) { // Compression pointer
+            if (pos + 2 > len)
+                return (-1);
+            if (end == 0)
+                end = pos + 2;
+            pos = (c & 0x3f) << 8 | msg[pos + 1];
+            hops++;
+            continue;
+        }
+        if (c > 63 || pos + 1 + c > len || n + c + 2 > DNS_NAME_LEN)
+            return (-1);
+        if (n > 0) {
+            name[n++] = '.';
+            h = (h ^ '.') * 16777619u;
+        }
+        for (const u_char *p = msg + pos + 1; p <= msg + pos + c; p++) {
+            char ch = *p >= 32 && *p <= 126 ? *p : '.';
+            name[n++] = ch;
+            h = (h ^ (uint8_t)ch) * 16777619u;
+        }
+        pos += 1 + c;
+    }
+    return (-1);
+}
+
+
+/**
+ * @brief Read a name of a message
+ *
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the name, set to the offset after it
+ * @param name The buffer to write to, DNS_NAME_LEN bytes
+ * @return int The length of the name, -1 if it is cut, too long or loops
+ *
+ * @see name_decode
+ */
+int dns_name_read(const u_char *msg, uint32_t len, uint32_t *off, char *name)
+{
+    uint32_t hash;
+    return name_decode(msg, len, off, name, &hash);
+}
+
+
+/**
+ * @brief Read and intern a name of a message
+ *
+ * The name is valid until the calling thread reads another name.
+ *
+ * @param msg The message
+ * @param len The length of the message
+ * @param off The offset of the name, set to the offset after it
+ * @return const struct dns_name* The name, NULL if it is cut, too long or
+ * loops
+ *
+ * @see name_decode
+ */
+const struct dns_name *dns_name_intern(const u_char *msg, uint32_t len,
+                                       uint32_t *off)
+{
+    uint32_t hash;
+    int n = name_decode(msg, len, off, cache.text, &hash);
+    if (n < 0)
+        return NULL;
+    if (cache.entries == NULL && n < CACHE_TEXT)
+        cache.entries = calloc(CACHE_SETS * CACHE_WAYS, sizeof(struct cache_entry));
+    if (cache.entries == NULL || n >= CACHE_TEXT) {
+        cache.spare.str = cache.text;
+        cache.spare.hash = hash;
+        cache.spare.len = n;
+        return &cache.spare;
+    }
+
+    struct cache_entry *set = &cache.entries[(hash & (CACHE_SETS - 1)) * CACHE_WAYS];
+    struct cache_entry *victim = set;
+    for (int w = 0; w < CACHE_WAYS; w++) {
+        struct cache_entry *e = &set[w];
+        if (e->stamp && e->name.hash == hash && e->name.len == n &&
+            memcmp(e->text, cache.text, n) == 0) {
+            e->stamp = ++cache.clock;
+            return &e->name;
+        }
+        if (e->stamp < victim->stamp)
+            victim = e;
+    }
+    memcpy(victim->text, cache.text, n + 1);
+    victim->name.str = victim->text;
+    victim->name.hash = hash;
+    victim->name.len = n;
+    victim->stamp = ++cache.clock;
+    return &victim->name;
+}
+
+
+/**
+ * @brief Free the name cache of the calling thread
+ */
+void dns_name_release(void)
+{
+    free(cache.entries);
+    cache.entries = NULL;
+    cache.clock = 0;
+}
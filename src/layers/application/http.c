@@ -10,71 +10,23 @@
  * @see is_http
  */
 
-// Global libraries
-#include <string.h>
-
 // Local header files
+#include "classify.h"
 #include "http.h"
 
-const char *http_command[] = {"GET", "POST",    "HEAD",
-                              "PUT", "OPTIONS", "CONNECT"}; /**< List of HTTP commands */
-const char *http_response[] = {"HTTP/1.1", "HTTP/2", "HTTP/3"}; /**< List of HTTP responses */
-
 
 /**
- * @brief Check if a packet is an HTTP command
- * 
- * @param packet The packet to check
- * @return 1 if the packet is an HTTP command, 0 otherwise
+ * @brief Check if a packet is an HTTP packet
  * 
- * @note This function doesn't check for errors.
- */
-static int is_command(const u_char *packet)
-{
-    for (int i = 0; i < 6; i++) {
-        if (strncmp((char *)packet, http_command[i], strlen(http_command[i])) ==
-            0) {
-            return 1;
-        }
-    }
-    return 0;
-}
-
-
-/**
- * @brief Check if a packet is an HTTP response
+ * The payload is matched against the signatures of every protocol at once.
  * 
  * @param packet The packet to check
- * @return 1 if the packet is an HTTP response, 0 otherwise
+ * @param size The size of the packet
+ * @return int 1 if the packet is an HTTP packet, 0 otherwise
  * 
- * @note This function doesn't check for errors.
+ * @see classify_payload
  */
-static int is_response(const u_char *packet)
+int is_http(const u_char *packet, uint32_t size)
 {
-    for (int i = 0; i < 3; i++) {
-        if (strncmp((char *)packet, http_response[i],
-                    strlen(http_response[i])) == 0) {
-            return 1;
-        }
-    }
-    return 0;
+    return (classify_payload(packet, size) & CLASSIFY_MASK(APP_HTTP)) != 0;
 }
-
-/**
- * @brief Check if a packet is an HTTP packet
- * 
- * @param packet The packet to check
- * @return 1 if the packet is an HTTP packet, 0 otherwise
- */
-int is_http(const u_char *packet)
-{
-    if (is_command(packet)) {
-        return 1;
-    }
-    else if (is_response(packet)) {
-        return 1;
-    }
-    else {
-        return 0;
-    }
-}
\ No newline at end of file
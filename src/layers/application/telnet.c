@@ -17,6 +17,7 @@
 
 // Local header files
 #include "telnet.h"
+#include "output.h"
 
 /**
  * @brief Handle a Telnet packet
@@ -30,6 +31,6 @@ int telnet_handler(const u_char *packet) {
     if (packet) {
         ;
     }
-    printf("No handling yet\n");
+    out_puts("No handling yet\n");
     return 0;
 }
\ No newline at end of file
@@ -8,103 +8,98 @@
  * 
  * @see ethernet.h
  * @see cast_ethernet
+ * @see print_ethernet
  */
 
 // Global libraries
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Local header files
 #include "ethernet.h"
-#include "arp.h"
-#include "ipv4.h"
-#include "ipv6.h"
+#include "encap.h"
+#include "format.h"
+#include "output.h"
 
 
 /**
- * @brief Format a MAC address
+ * @brief Handle the ethertype
  * 
- * This function formats a MAC address in the format XX:XX:XX:XX:XX:XX.
+ * This function handles the ethertype of an Ethernet frame, past its VLAN
+ * tags and tunnels.
  * 
- * @param ether_host The MAC address to format
- * @return char* The formatted MAC address
+ * @param v The view of the packet, past the Ethernet header
+ * @param ethernet The Ethernet frame
+ * @param pi The decoded packet to fill
+ * @return int 0 if the ethertype is well handled, -1 otherwise
  * 
- * @note The returned string must be freed by the caller
+ * @see encap_ethertype
  */
-static char *format_mac(const u_char ether_host[ETH_ALEN])
+int ethertype_handler(struct packet_view *v,
+                      const struct ether_header *ethernet,
+                      struct packet_info *pi)
 {
-    char *res = malloc(3 * ETH_ALEN * sizeof(char));
-    if (res == NULL)
-        return NULL;
-
-    sprintf(res, "%02X:%02X:%02X:%02X:%02X:%02X", ether_host[0], ether_host[1],
-            ether_host[2], ether_host[3], ether_host[4], ether_host[5]);
+    memcpy(pi->mac_src, ethernet->ether_shost, ETH_ALEN);
+    memcpy(pi->mac_dst, ethernet->ether_dhost, ETH_ALEN);
+    pi->ethertype = be16toh(ethernet->ether_type);
+    pi->layers |= LAYER_ETH;
 
-    return res;
+    return encap_ethertype(v, pi);
 }
 
 
 /**
- * @brief Handle the ethertype
+ * @brief Handle an Ethernet frame
  * 
- * This function handles the ethertype of an Ethernet frame.
+ * This function decodes an Ethernet frame and the layers above it.
  * 
- * @param packet The packet to handle
- * @param ethernet The Ethernet frame
- * @return int 0 if the ethertype is well handled, 1 otherwise
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ * @see ethertype_handler
+ */
+int cast_ethernet(struct packet_view *v, struct packet_info *pi)
+{
+    const struct ether_header *ethernet;
+    ethernet = decode_pull(pi, v, sizeof(struct ether_header));
+    if (ethernet == NULL)
+        return (-1);
+    return ethertype_handler(v, ethernet, pi);
+}
+
+
+/**
+ * @brief Print an Ethernet frame
+ * 
+ * This function prints the Ethernet layer of a decoded packet.
  * 
- * @see cast_ipv4
- * @see cast_ipv6
- * @see cast_arp
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the ethertype is known, -1 otherwise
  */
-int ethertype_handler(const u_char *packet, const struct ether_header *ethernet)
+int print_ethernet(const struct packet_info *pi, const u_char *packet)
 {
-    char *mac_shost = format_mac(ethernet->ether_shost);
-    char *mac_dhost = format_mac(ethernet->ether_dhost);
-    if (mac_shost == NULL || mac_dhost == NULL) {
-        fprintf(stderr, "malloc\n");
-        return 1;
-    }
+    (void)packet;
+    char mac_shost[STR_MAC_ADDR_LEN], mac_dhost[STR_MAC_ADDR_LEN];
+    format_mac(mac_shost, pi->mac_src);
+    format_mac(mac_dhost, pi->mac_dst);
+    out_printf("LINK: %s -> %s\n", mac_shost, mac_dhost);
 
-    printf("LINK: %s -> %s\n", mac_shost, mac_dhost);
-    free(mac_shost);
-    free(mac_dhost);
-    
-    switch (be16toh((ethernet->ether_type))) {
+    switch (pi->ethertype) {
     case ETHERTYPE_IP:
-        cast_ipv4(packet + sizeof(struct ether_header));
-        break;
     case ETHERTYPE_IPV6:
-        cast_ipv6(packet + sizeof(struct ether_header));
-        break;
     case ETHERTYPE_ARP:
-        cast_arp(packet + sizeof(struct ether_header));
         break;
     case ETHERTYPE_REVARP:
         fprintf(stderr, "No RARP handling yet.\n");
         break;
     default:
+        if (pi->layers & LAYER_PLUGIN)
+            break;
         fprintf(stderr, "Unknown protocol on link layer. ETHERTYPE: 0x%x\n",
-                be16toh(ethernet->ether_type));
+                pi->ethertype);
         return (-1);
     }
     return 0;
 }
-
-
-/**
- * @brief Handle an Ethernet frame
- * 
- * This function handles an Ethernet frame.
- * 
- * @param packet The packet to handle
- * @return int 0 if the packet is well handled, -1 otherwise
- * @see ethertype_handler
- */
-int cast_ethernet(const u_char *packet)
-{
-    const struct ether_header *ethernet;
-    ethernet = (struct ether_header *)packet;
-    ethertype_handler(packet, ethernet);
-    return 0;
-}
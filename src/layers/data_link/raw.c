@@ -0,0 +1,49 @@
+/**
+ * @author Flavien Lallemant
+ * @file raw.c
+ * @brief Raw IP layer
+ * @ingroup data_link
+ *
+ * This file contains the implementation of the raw IP link layer.
+ *
+ * @see raw.h
+ * @see cast_raw
+ */
+
+// Global libraries
+#include <net/ethernet.h>
+
+// Local header files
+#include "encap.h"
+#include "raw.h"
+
+
+/**
+ * @brief Handle a raw IP packet
+ *
+ * This function tells IPv4 from IPv6 by the version of the header, then
+ * decodes the layers.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ *
+ * @see encap_ethertype
+ */
+int cast_raw(struct packet_view *v, struct packet_info *pi)
+{
+    const uint8_t *version = view_peek(v, 1);
+    if (version == NULL)
+        return (-1);
+    switch (*version >> 4) {
+    case 4:
+        pi->ethertype = ETHERTYPE_IP;
+        break;
+    case 6:
+        pi->ethertype = ETHERTYPE_IPV6;
+        break;
+    default:
+        return (-1);
+    }
+    return encap_ethertype(v, pi);
+}
@@ -0,0 +1,136 @@
+/**
+ * @author Flavien Lallemant
+ * @file sll.c
+ * @brief Linux cooked capture layer
+ * @ingroup data_link
+ *
+ * This file contains the implementation of the Linux cooked capture layer.
+ * The header holds the direction of the packet, the hardware type and
+ * address of its interface instead of its link layer header, then the
+ * ethertype of the payload. The version 2 adds the interface index.
+ * Only the addresses of 6 bytes are kept, as the source MAC address.
+ *
+ * @see sll.h
+ * @see cast_sll
+ * @see cast_sll2
+ * @see print_sll
+ */
+
+// Global libraries
+#include <net/ethernet.h>
+#include <stdio.h>
+#include <string.h>
+
+// Local header files
+#include "encap.h"
+#include "format.h"
+#include "output.h"
+#include "sll.h"
+
+static const char *packet_types[] = {
+    "incoming", "broadcast", "multicast", "promiscuous", "outgoing"
+}; /**< Names of the packet types, PACKET_HOST to PACKET_OUTGOING */
+
+
+/**
+ * @brief Handle the payload of a cooked header
+ *
+ * @param v The view of the packet, past the header
+ * @param protocol The protocol of the header
+ * @param addr The address of the header
+ * @param addr_len The length of the address
+ * @param pi The decoded packet to fill
+ * @return int 0 if the payload is well handled, -1 otherwise
+ *
+ * @see encap_ethertype
+ */
+static int sll_handler(struct packet_view *v, uint16_t protocol,
+                       const u_char *addr, uint16_t addr_len,
+                       struct packet_info *pi)
+{
+    if (addr_len == ETH_ALEN)
+        memcpy(pi->mac_src, addr, ETH_ALEN);
+    pi->ethertype = protocol;
+    pi->layers |= LAYER_SLL;
+    if (protocol < ETH_P_802_3_MIN) // A length, or the protocol of a netlink socket
+        return (-1);
+    return encap_ethertype(v, pi);
+}
+
+
+/**
+ * @brief Handle a Linux cooked packet
+ *
+ * This function decodes a cooked header and the layers above it.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ *
+ * @see sll_handler
+ */
+int cast_sll(struct packet_view *v, struct packet_info *pi)
+{
+    const u_char *h = decode_pull(pi, v, SLL_HDR_LEN);
+    if (h == NULL)
+        return (-1);
+    return sll_handler(v, (uint16_t)(h[14] << 8 | h[15]), h + 6,
+                       (uint16_t)(h[4] << 8 | h[5]), pi);
+}
+
+
+/**
+ * @brief Handle a Linux cooked packet of the version 2
+ *
+ * This function decodes a cooked header and the layers above it.
+ *
+ * @param v The view of the packet
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ *
+ * @see sll_handler
+ */
+int cast_sll2(struct packet_view *v, struct packet_info *pi)
+{
+    const u_char *h = decode_pull(pi, v, SLL2_HDR_LEN);
+    if (h == NULL)
+        return (-1);
+    return sll_handler(v, (uint16_t)(h[0] << 8 | h[1]), h + 12, h[11], pi);
+}
+
+
+/**
+ * @brief Print a Linux cooked header
+ *
+ * This function prints the cooked header of a decoded packet on one line.
+ * The header is read again, as an inner Ethernet frame takes over the
+ * addresses and the ethertype of the decoded packet.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet, starting with the header
+ * @return int 0 on success
+ */
+int print_sll(const struct packet_info *pi, const u_char *packet)
+{
+    (void)pi;
+    int v2 = encap_linktype() == DLT_LINUX_SLL2;
+    unsigned type = v2 ? packet[10] : (unsigned)(packet[0] << 8 | packet[1]);
+    unsigned addr_len = v2 ? packet[11] : (unsigned)(packet[4] << 8 | packet[5]);
+    unsigned proto = v2 ? (unsigned)(packet[0] << 8 | packet[1])
+                        : (unsigned)(packet[14] << 8 | packet[15]);
+
+    if (type < sizeof(packet_types) / sizeof(packet_types[0]))
+        out_printf("SLL: %s", packet_types[type]);
+    else
+        out_printf("SLL: type %u", type);
+    if (addr_len == ETH_ALEN) {
+        char mac[STR_MAC_ADDR_LEN];
+        out_printf(", from %s", format_mac(mac, packet + (v2 ? 12 : 6)));
+    }
+    if (v2)
+        out_printf(", interface %u",
+                   (unsigned)(packet[4] << 24 | packet[5] << 16 |
+                              packet[6] << 8 | packet[7]));
+    out_printf(", protocol 0x%04x\n", proto);
+    return 0;
+}
@@ -8,6 +8,7 @@
  * 
  * @see icmp.h
  * @see cast_icmp
+ * @see print_icmp
  */
 
 // Global libraries
@@ -16,6 +17,7 @@
 
 // Local header files
 #include "icmp.h"
+#include "output.h"
 
 
 static const char *destination_unreachable_message[] = {
@@ -54,145 +56,144 @@ static const char *extended_echo_reply_message[] = {
  * 
  * This function handles an ICMP message.
  * 
- * @param hdr The ICMP header
+ * @param type The ICMP type
+ * @param code The ICMP code
  * @return int 0 if the message is well handled, -1 otherwise
  */
-static int message_handler(const void *hdr)
+static int message_handler(uint8_t type, uint8_t code)
 {
-    const struct icmphdr *icmp;
-    icmp = (const struct icmphdr *)(hdr);
-    switch (icmp->type) { // ICMP type
+    switch (type) { // ICMP type
     case ICMP_ECHOREPLY: // ICMP Echo Reply
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP ECHO\n");
+        out_puts("ICMP ECHO\n");
         break;
     case ICMP_DEST_UNREACH: // ICMP Destination Unreachable
-        if (icmp->code > 15) {
+        if (code > 15) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Destination Unreachable: %s\n",
-               destination_unreachable_message[icmp->code]);
+        out_printf("ICMP Destination Unreachable: %s\n",
+                   destination_unreachable_message[code]);
         break;
     case ICMP_SOURCE_QUENCH: // ICMP Source Quench
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Source Quench\n");
+        out_puts("ICMP Source Quench\n");
         break;
     case ICMP_REDIRECT: // ICMP Redirect
-        if (icmp->code > 3) {
+        if (code > 3) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Redirect Message: %s\n",
-               redirect_datagram_message[icmp->code]);
+        out_printf("ICMP Redirect Message: %s\n",
+                   redirect_datagram_message[code]);
         break;
     case ICMP_ECHO: // ICMP Echo Request
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Echo Request\n");
+        out_puts("ICMP Echo Request\n");
         break;
     case ICMP_ROUTER_ADVERT: // ICMP Router Advertisement
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Router Advertisement\n");
+        out_puts("ICMP Router Advertisement\n");
         break;
     case ICMP_ROUTER_SOLICIT: // ICMP Router Solicitation
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Router discovery/selection/solicitation\n");
+        out_puts("ICMP Router discovery/selection/solicitation\n");
         break;
     case ICMP_TIME_EXCEEDED: // ICMP Time Exceeded
-        if (icmp->code > 1) {
+        if (code > 1) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Time Exceeded: %s\n", time_exceeded_message[icmp->code]);
+        out_printf("ICMP Time Exceeded: %s\n", time_exceeded_message[code]);
         break;
     case ICMP_PARAMETERPROB: // ICMP Parameter Problem
-        if (icmp->code > 2) {
+        if (code > 2) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Bad IP header: %s\n", bad_ip_header_message[icmp->code]);
+        out_printf("ICMP Bad IP header: %s\n", bad_ip_header_message[code]);
         break;
     case ICMP_TIMESTAMP: // ICMP Timestamp Request
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Timestamp Request\n");
+        out_puts("ICMP Timestamp Request\n");
         break;
     case ICMP_TIMESTAMPREPLY: // ICMP Timestamp Reply
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Timestamp Response\n");
+        out_puts("ICMP Timestamp Response\n");
         break;
     case ICMP_INFO_REQUEST: // ICMP Information Request
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Information Request\n");
+        out_puts("ICMP Information Request\n");
         break;
     case ICMP_INFO_REPLY: // ICMP Information Reply
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Information Reply\n");
+        out_puts("ICMP Information Reply\n");
         break;
     case ICMP_ADDRESS: // ICMP Address Mask Request
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Address mask request\n");
+        out_puts("ICMP Address mask request\n");
         break;
     case ICMP_ADDRESSREPLY: // ICMP Address Mask Reply
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Address mask reply\n");
+        out_puts("ICMP Address mask reply\n");
         break;
     case ICMP_TRACEROUTE: // ICMP Traceroute
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Information Requestion (Traceroute)\n");
+        out_puts("ICMP Information Requestion (Traceroute)\n");
         break;
     case ICMP_EXT_ECHO: // ICMP Extended Echo Request
-        if (icmp->code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Request Extended Echo\n");
+        out_puts("ICMP Request Extended Echo\n");
         break;
     case ICMP_EXT_ECHOREPLY: // ICMP Extended Echo Reply
-        if (icmp->code > 4) {
+        if (code > 4) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP Reply Extended Echo: %s\n",
-               extended_echo_reply_message[icmp->code]);
+        out_printf("ICMP Reply Extended Echo: %s\n",
+                   extended_echo_reply_message[code]);
         break;
     default:
-        fprintf(stderr, "Unknown ICMP type. ICMP TYPE: %x\n", icmp->type);
+        fprintf(stderr, "Unknown ICMP type. ICMP TYPE: %x\n", type);
         break;
     }
 
@@ -203,16 +204,37 @@ static int message_handler(const void *hdr)
 /**
  * @brief Handle an ICMP packet
  * 
- * This function handles an ICMP packet.
+ * This function decodes an ICMP packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled
- * @see message_handler
  */
-int cast_icmp(const u_char *packet)
+int cast_icmp(struct packet_view *v, struct packet_info *pi)
 {
     const struct icmphdr *icmp;
-    icmp = (struct icmphdr *)(packet);
-    message_handler(icmp);
+    icmp = decode_pull(pi, v, 2); // Type and code
+    if (icmp == NULL)
+        return (-1);
+    pi->icmp_type = icmp->type;
+    pi->icmp_code = icmp->code;
+    pi->layers |= LAYER_ICMP;
     return 0;
 }
+
+
+/**
+ * @brief Print an ICMP packet
+ * 
+ * This function prints the ICMP layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the message is well handled, -1 otherwise
+ * @see message_handler
+ */
+int print_icmp(const struct packet_info *pi, const u_char *packet)
+{
+    (void)packet;
+    return message_handler(pi->icmp_type, pi->icmp_code);
+}
@@ -8,6 +8,7 @@
  * 
  * @see icmpv6.h
  * @see cast_icmp6
+ * @see print_icmp6
  */
 
 // Global libraries
@@ -16,6 +17,7 @@
 
 // Local header files
 #include "icmpv6.h"
+#include "output.h"
 
 static const char *destination_unreachable_message_v6[] = {
     "No route to destination",
@@ -41,243 +43,244 @@ static const char *extended_echo_reply_message_v6[] = {
  * 
  * This function handles an ICMPv6 message.
  * 
- * @param icmp6 The ICMPv6 header
+ * @param type The ICMPv6 type
+ * @param code The ICMPv6 code
  * @return int 0 if the message is well handled, -1 otherwise
  */
-static int message_handler(const struct icmp6_hdr *icmp6)
+static int message_handler(uint8_t type, uint8_t code)
 {
-    switch (icmp6->icmp6_type) {
+    switch (type) {
     case ICMP6_DST_UNREACH: // ICMPv6 Destination Unreachable
-        if (icmp6->icmp6_code > 7) {
+        if (code > 7) {
             fprintf(stderr, "Bad ICMP6 code\n");
             return (-1);
         }
-        printf("ICMP6 Destination Unreachable: %s\n",
-               destination_unreachable_message_v6[icmp6->icmp6_code]);
+        out_printf("ICMP6 Destination Unreachable: %s\n",
+                   destination_unreachable_message_v6[code]);
         break;
     case ICMP6_PACKET_TOO_BIG: // ICMPv6 Packet too big
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP6 code\n");
             return (-1);
         }
-        printf("ICMP6 Packet too big\n");
+        out_puts("ICMP6 Packet too big\n");
         break;
     case ICMP6_TIME_EXCEEDED: // ICMPv6 Time Exceeded
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Time Exceeded: %s\n",
-               time_exceeded_message_v6[icmp6->icmp6_code]);
+        out_printf("ICMP6 Time Exceeded: %s\n",
+                   time_exceeded_message_v6[code]);
         break;
     case ICMP6_PARAM_PROB: // ICMPv6 Parameter Problem
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Bad IP header: %s\n",
-               bad_ip_header_message_v6[icmp6->icmp6_code]);
+        out_printf("ICMP6 Bad IP header: %s\n",
+                   bad_ip_header_message_v6[code]);
         break;
     case ICMP6_ECHO_REQUEST: // ICMPv6 Echo Request
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Echo Request");
+        out_puts("ICMP6 Echo Request");
         break;
     case ICMP6_ECHO_REPLY: // ICMPv6 Echo Reply
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Echo Reply\n");
+        out_puts("ICMP6 Echo Reply\n");
         break;
     case MLD_LISTENER_QUERY: // MLD Multicast Listener Query
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("MLD Multicast Listener Query\n");
+        out_puts("MLD Multicast Listener Query\n");
         break;
     case MLD_LISTENER_REPORT: // MLD Multicast Listener Report
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("MLD Multicast Listener Report\n");
+        out_puts("MLD Multicast Listener Report\n");
         break;
     case MLD_LISTENER_REDUCTION: // MLD Multicast Listener Reduction
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("MLD Multicast Listener Done\n");
+        out_puts("MLD Multicast Listener Done\n");
         break;
     case ND_ROUTER_SOLICIT: // NDP Router Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("NDP Router Solicitation\n");
+        out_puts("NDP Router Solicitation\n");
         break;
     case ND_ROUTER_ADVERT: // NDP Router Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("NDP Router Advertisement\n");
+        out_puts("NDP Router Advertisement\n");
         break;
     case ND_NEIGHBOR_SOLICIT: // NDP Neighbor Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("NDP Neighbor Solicitation\n");
+        out_puts("NDP Neighbor Solicitation\n");
         break;
     case ND_NEIGHBOR_ADVERT: // NDP Neighbor Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("NDP Neighbor Advertisement\n");
+        out_puts("NDP Neighbor Advertisement\n");
         break;
     case ND_REDIRECT: // NDP Redirect Message
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("NDP Redirect Message\n");
+        out_puts("NDP Redirect Message\n");
         break;
     case ICMP6_ROUTER_RENUMBERING: // ICMPv6 Router Renumbering
-        if (icmp6->icmp6_code > 1 && icmp6->icmp6_code < 255) {
+        if (code > 1 && code < 255) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Router Renumbering\n");
+        out_puts("ICMP6 Router Renumbering\n");
         break;
     case ICMP6_NODE_INFORMATION_QUERY: // ICMPv6 Node Information Query
-        if (icmp6->icmp6_code > 2) {
+        if (code > 2) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Node Information Query\n");
+        out_puts("ICMP6 Node Information Query\n");
         break;
     case ICMP6_NODE_INFORMATION_RESPONSE: // ICMPv6 Node Information Response
-        if (icmp6->icmp6_code > 2) {
+        if (code > 2) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Node Information Response\n");
+        out_puts("ICMP6 Node Information Response\n");
         break;
     case ICMP6_INVERSE_NEIGHBOR_DISCOVERY_SOLICITATION_MESSAGE: // ICMPv6 Inverse Neighbor Discovery Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Inverse Neighbor Discovery Solicitation message\n");
+        out_puts("ICMP6 Inverse Neighbor Discovery Solicitation message\n");
         break;
     case ICMP6_INVERSE_NEIGHBOR_DISCOVERY_ADVERTISEMENT_MESSAGE: // ICMPv6 Inverse Neighbor Discovery Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Inverse Neighbor Discovery Advertisement messsage\n");
+        out_puts("ICMP6 Inverse Neighbor Discovery Advertisement messsage\n");
         break;
     case ICMP6_MULTICAST_LISTENER_DISCOVERY_REPORTS: // ICMPv6 Multicast Listener Discovery Reports
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Multicast Listener Discovery Reports\n");
+        out_puts("ICMP6 Multicast Listener Discovery Reports\n");
         break;
     case ICMP6_HOME_AGENT_ADDRESS_DISCOVERY_REQUEST: // ICMPv6 Home Agent Address Discovery Request
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Home Agent Address Discovery Request\n");
+        out_puts("ICMP6 Home Agent Address Discovery Request\n");
         break;
     case ICMP6_HOME_AGENT_ADDRESS_DISCOVERY_REPLY: // ICMPv6 Home Agent Address Discovery Reply
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Home Agent Address Discovery Reply\n");
+        out_puts("ICMP6 Home Agent Address Discovery Reply\n");
         break;
     case ICMP6_MOBILE_PREFIX_SOLICITATION: // ICMPv6 Mobile Prefix Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Mobile Prefix Solicitation\n");
+        out_puts("ICMP6 Mobile Prefix Solicitation\n");
         break;
     case ICMP6_MOBILE_PREFIX_ADVERTISEMENT: // ICMPv6 Mobile Prefix Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Mobile Prefix Advertisement\n");
+        out_puts("ICMP6 Mobile Prefix Advertisement\n");
         break;
     case ICMP6_CERTIFICATION_PATH_SOLICITATION: // ICMPv6 Certification Path Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Certififcation Path Solicitation\n");
+        out_puts("ICMP6 Certififcation Path Solicitation\n");
         break;
     case ICMP6_CERTIFICATION_PATH_ADVERTISEMENT: // ICMPv6 Certification Path Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Certification Path Advertisement\n");
+        out_puts("ICMP6 Certification Path Advertisement\n");
         break;
     case ICMP6_MULTICAST_ROUTER_SOLICITATION: // ICMPv6 Multicast Router Solicitation
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Multicast Router Solicitation\n");
+        out_puts("ICMP6 Multicast Router Solicitation\n");
         break;
     case ICMP6_MULTICAST_ROUTER_ADVERTISEMENT: // ICMPv6 Multicast Router Advertisement
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Multicast Router Advertisement\n");
+        out_puts("ICMP6 Multicast Router Advertisement\n");
         break;
     case ICMP6_MULTICAST_ROUTER_TERMINATION: // ICMPv6 Multicast Router Termination
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Multicast Router Termination\n");
+        out_puts("ICMP6 Multicast Router Termination\n");
         break;
     case ICMP6_RPL_CONTROL_MESSAGE: // ICMPv6 RPL Control Message
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 RPL Control Message\n");
+        out_puts("ICMP6 RPL Control Message\n");
         break;
     case ICMPV6_EXT_ECHO_REQUEST: // ICMPv6 Extended Echo Request
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Extended Echo Request\n");
+        out_puts("ICMP6 Extended Echo Request\n");
         break;
     case ICMPV6_EXT_ECHO_REPLY: // ICMPv6 Extended Echo Reply
-        if (icmp6->icmp6_code > 0) {
+        if (code > 0) {
             fprintf(stderr, "Bad ICMP code\n");
             return (-1);
         }
-        printf("ICMP6 Extended Echo Reply: %s\n",
-               extended_echo_reply_message_v6[icmp6->icmp6_code]);
+        out_printf("ICMP6 Extended Echo Reply: %s\n",
+                   extended_echo_reply_message_v6[code]);
         break;
     default:
         fprintf(stderr, "Unknown ICMP type. ICMP TYPE: 0x%x\n",
-                icmp6->icmp6_code);
+                code);
         break;
     }
     return 0;
@@ -287,16 +290,37 @@ static int message_handler(const struct icmp6_hdr *icmp6)
 /**
  * @brief Handle an ICMPv6 packet
  * 
- * This function handles an ICMPv6 packet.
+ * This function decodes an ICMPv6 packet.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled
- * @see message_handler
  */
-int cast_icmp6(const u_char *packet)
+int cast_icmp6(struct packet_view *v, struct packet_info *pi)
 {
     const struct icmp6_hdr *icmp6;
-    icmp6 = (struct icmp6_hdr *)(packet);
-    message_handler(icmp6);
+    icmp6 = decode_pull(pi, v, 2); // Type and code
+    if (icmp6 == NULL)
+        return (-1);
+    pi->icmp_type = icmp6->icmp6_type;
+    pi->icmp_code = icmp6->icmp6_code;
+    pi->layers |= LAYER_ICMP6;
     return 0;
 }
+
+
+/**
+ * @brief Print an ICMPv6 packet
+ * 
+ * This function prints the ICMPv6 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the message is well handled, -1 otherwise
+ * @see message_handler
+ */
+int print_icmp6(const struct packet_info *pi, const u_char *packet)
+{
+    (void)packet;
+    return message_handler(pi->icmp_type, pi->icmp_code);
+}
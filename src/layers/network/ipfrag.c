@@ -0,0 +1,744 @@
+/**
+ * @author Flavien Lallemant
+ * @file ipfrag.c
+ * @brief IP fragment reassembly definition
+ * @ingroup network
+ *
+ * This file contains the definition of the IPv4 and IPv6 fragment
+ * reassembly cache.
+ * Each thread keeps its datagrams in a hash table and a list in arrival
+ * order, and the payload of each datagram in a list of segments sorted by
+ * offset. Only the bytes no segment covers yet are queued, so the first
+ * fragment received for a range wins over the overlapping ones.
+ * The segments are fixed size buffers taken from a per-thread pool,
+ * allocated by chunks and kept for the next datagrams, so queuing a fragment
+ * never calls malloc once the pool is warm. The datagrams are kept the same
+ * way. A complete datagram is rebuilt in the scratch memory of the packet,
+ * after the headers of its first fragment.
+ * The memory of the pools and datagrams of every thread is counted against
+ * one global cap: a fragment over it is dropped with its datagram, which
+ * can't be completed anymore.
+ *
+ * @see ipfrag.h
+ * @see ipfrag_init
+ * @see ipfrag_ipv4
+ * @see ipfrag_ipv6
+ * @see ipfrag_data
+ * @see print_ipfrag
+ * @see ipfrag_release
+ */
+
+// Global libraries
+#include <netinet/ip6.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local header files
+#include "arena.h"
+#include "ipfrag.h"
+#include "output.h"
+
+#define IPFRAG_BUCKETS 1024 /**< Number of hash buckets, a power of 2 */
+#define IPFRAG_SEG_SIZE 2048 /**< Size of a segment buffer */
+#define IPFRAG_POOL_CHUNK 32 /**< Segments allocated at once */
+#define IPFRAG_MAX_LEN 65535 /**< Largest payload of a datagram */
+
+/**
+ * @brief Queued bytes of a datagram
+ */
+struct ipfrag_seg {
+    struct ipfrag_seg *next; /**< Next segment by offset */
+    uint32_t off;           /**< Offset of the first byte in the payload */
+    uint32_t len;           /**< Number of bytes */
+    u_char data[IPFRAG_SEG_SIZE - sizeof(void *) - 2 * sizeof(uint32_t)]; /**< The bytes */
+};
+
+_Static_assert(sizeof(struct ipfrag_seg) == IPFRAG_SEG_SIZE,
+               "struct ipfrag_seg must fill its buffer exactly");
+
+/**
+ * @brief Block of segments allocated at once
+ */
+struct ipfrag_chunk {
+    struct ipfrag_chunk *next;                  /**< Next chunk of the pool */
+    struct ipfrag_seg segs[IPFRAG_POOL_CHUNK];  /**< The segments */
+};
+
+/**
+ * @brief Key of a datagram
+ */
+struct ipfrag_key {
+    uint8_t src[16];    /**< Source IP, IPv4 uses the 4 first bytes */
+    uint8_t dst[16];    /**< Destination IP, IPv4 uses the 4 first bytes */
+    uint32_t id;        /**< Identification */
+    uint8_t proto;      /**< Protocol of the payload */
+    uint8_t version;    /**< IP version */
+    uint8_t pad[2];     /**< Zero */
+};
+
+/**
+ * @brief Datagram being reassembled
+ */
+struct ipfrag_dgram {
+    struct ipfrag_key key;      /**< Datagram key */
+    uint32_t hash;              /**< Hash of the key */
+    struct ipfrag_dgram *hnext; /**< Next datagram of the bucket */
+    struct ipfrag_dgram *prev;  /**< Datagram received after */
+    struct ipfrag_dgram *next;  /**< Datagram received before */
+    struct timeval first;       /**< Timestamp of the first fragment received */
+    uint32_t total;             /**< Payload length once the last fragment is received, 0 before */
+    uint32_t queued;            /**< Payload bytes queued */
+    uint32_t end;               /**< End of the last byte queued */
+    uint16_t frags;             /**< Fragments received */
+    uint16_t ip_off;            /**< Offset of the IP header in the headers */
+    uint16_t hdr_len;           /**< Bytes of headers before the payload, 0 before the first fragment */
+    u_char hdr[IPFRAG_HDR_MAX]; /**< Headers of the first fragment */
+    struct ipfrag_seg *segs;    /**< Queued bytes, sorted by offset */
+};
+
+/**
+ * @brief Reassembly counters
+ */
+struct ipfrag_stats {
+    uint64_t fragments;     /**< Fragments received */
+    uint64_t datagrams;     /**< Datagrams reassembled */
+    uint64_t overlaps;      /**< Fragments overlapping bytes already queued */
+    uint64_t malformed;     /**< Fragments with inconsistent lengths */
+    uint64_t truncated;     /**< Fragments cut by the snapshot length */
+    uint64_t dropped;       /**< Fragments dropped over the memory cap */
+    uint64_t expired;       /**< Datagrams freed incomplete */
+};
+
+/**
+ * @brief Reassembly state of a thread
+ */
+struct ipfrag_ctx {
+    struct ipfrag_dgram *buckets[IPFRAG_BUCKETS]; /**< Hash table of the datagrams */
+    struct ipfrag_dgram *newest;    /**< Datagram received last */
+    struct ipfrag_dgram *oldest;    /**< Datagram received first */
+    struct ipfrag_seg *free_segs;   /**< Free segments of the pool */
+    struct ipfrag_dgram *free_dgrams; /**< Freed datagrams, linked by hnext */
+    struct ipfrag_chunk *chunks;    /**< Chunks of the pool */
+    const u_char *out;              /**< Datagram completed by the last packet, in the arena */
+    uint16_t out_frags;             /**< Its number of fragments */
+    struct ipfrag_stats stats;      /**< Counters of the thread */
+};
+
+static int enabled = 0; /**< 1 if the reassembly is enabled */
+static size_t cap = IPFRAG_MEMORY; /**< Memory cap of every thread */
+static int timeout = IPFRAG_TIMEOUT; /**< Lifetime of an incomplete datagram in seconds */
+static atomic_size_t used; /**< Memory taken by every thread */
+static struct ipfrag_stats total; /**< Counters of the released threads */
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects total */
+static __thread struct ipfrag_ctx *ctx = NULL; /**< State of the thread */
+
+
+/**
+ * @brief Take memory from the global cap
+ *
+ * @param size The number of bytes
+ * @return int 0 on success, -1 if the cap is reached
+ */
+static int cap_take(size_t size)
+{
+    size_t cur = atomic_load_explicit(&used, memory_order_relaxed);
+    do {
+        if (cur + size > cap)
+            return (-1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &used, &cur, cur + size, memory_order_relaxed, memory_order_relaxed));
+    return 0;
+}
+
+
+/**
+ * @brief Give memory back to the global cap
+ *
+ * @param size The number of bytes
+ */
+static void cap_give(size_t size)
+{
+    atomic_fetch_sub_explicit(&used, size, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Enable the reassembly
+ *
+ * @param cfg The configuration
+ */
+void ipfrag_init(const struct ipfrag_config *cfg)
+{
+    cap = cfg->memory ? cfg->memory : IPFRAG_MEMORY;
+    timeout = cfg->timeout > 0 ? cfg->timeout : IPFRAG_TIMEOUT;
+    enabled = 1;
+}
+
+
+/**
+ * @brief Check if the reassembly is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int ipfrag_enabled(void)
+{
+    return enabled;
+}
+
+
+/**
+ * @brief Grow the segment pool by a chunk
+ *
+ * @return int 0 on success, -1 if the cap is reached or out of memory
+ */
+static int pool_grow(void)
+{
+    struct ipfrag_chunk *c;
+    if (cap_take(sizeof(*c)) < 0)
+        return (-1);
+    c = malloc(sizeof(*c));
+    if (c == NULL) {
+        cap_give(sizeof(*c));
+        return (-1);
+    }
+    c->next = ctx->chunks;
+    ctx->chunks = c;
+    for (int i = 0; i < IPFRAG_POOL_CHUNK; i++) {
+        c->segs[i].next = ctx->free_segs;
+        ctx->free_segs = &c->segs[i];
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Get the state of the calling thread, creating it with its first
+ * chunk of segments
+ *
+ * @return int 0 on success, -1 if out of memory
+ */
+static int ctx_get(void)
+{
+    if (ctx)
+        return 0;
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return (-1);
+    pool_grow(); // Grown again on demand if it fails
+    return 0;
+}
+
+
+/**
+ * @brief Free a datagram
+ *
+ * The datagram and its segments are kept for the next ones, their memory
+ * stays counted.
+ *
+ * @param d The datagram
+ */
+static void dgram_free(struct ipfrag_dgram *d)
+{
+    struct ipfrag_dgram **link = &ctx->buckets[d->hash & (IPFRAG_BUCKETS - 1)];
+    while (*link != d)
+        link = &(*link)->hnext;
+    *link = d->hnext;
+
+    if (d->prev)
+        d->prev->next = d->next;
+    else
+        ctx->newest = d->next;
+    if (d->next)
+        d->next->prev = d->prev;
+    else
+        ctx->oldest = d->prev;
+
+    while (d->segs) {
+        struct ipfrag_seg *s = d->segs;
+        d->segs = s->next;
+        s->next = ctx->free_segs;
+        ctx->free_segs = s;
+    }
+    d->hnext = ctx->free_dgrams;
+    ctx->free_dgrams = d;
+}
+
+
+/**
+ * @brief Free the datagrams left incomplete for longer than the timeout
+ *
+ * @param now The timestamp of the current packet
+ */
+static void dgram_expire(struct timeval now)
+{
+    while (ctx->oldest && now.tv_sec - ctx->oldest->first.tv_sec > timeout) {
+        dgram_free(ctx->oldest);
+        ctx->stats.expired++;
+    }
+}
+
+
+/**
+ * @brief Hash the key of a datagram
+ *
+ * @param key The key
+ * @return uint32_t The hash, FNV-1a
+ */
+static uint32_t key_hash(const struct ipfrag_key *key)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(*key); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+
+/**
+ * @brief Find the datagram of a fragment, creating it if unknown
+ *
+ * @param key The key of the datagram
+ * @param now The timestamp of the fragment
+ * @return struct ipfrag_dgram* The datagram, NULL if the cap is reached
+ */
+static struct ipfrag_dgram *dgram_get(const struct ipfrag_key *key,
+                                      struct timeval now)
+{
+    uint32_t hash = key_hash(key);
+    struct ipfrag_dgram **bucket = &ctx->buckets[hash & (IPFRAG_BUCKETS - 1)];
+    for (struct ipfrag_dgram *d = *bucket; d != NULL; d = d->hnext) {
+        if (d->hash == hash && memcmp(&d->key, key, sizeof(*key)) == 0)
+            return d;
+    }
+
+    struct ipfrag_dgram *d = ctx->free_dgrams;
+    if (d) {
+        ctx->free_dgrams = d->hnext;
+    } else {
+        if (cap_take(sizeof(*d)) < 0)
+            return NULL;
+        d = malloc(sizeof(*d));
+        if (d == NULL) {
+            cap_give(sizeof(*d));
+            return NULL;
+        }
+    }
+    d->key = *key;
+    d->hash = hash;
+    d->first = now;
+    d->total = d->queued = d->end = 0;
+    d->frags = d->ip_off = d->hdr_len = 0;
+    d->segs = NULL;
+    d->hnext = *bucket;
+    *bucket = d;
+    d->prev = NULL;
+    d->next = ctx->newest;
+    if (ctx->newest)
+        ctx->newest->prev = d;
+    ctx->newest = d;
+    if (ctx->oldest == NULL)
+        ctx->oldest = d;
+    return d;
+}
+
+
+/**
+ * @brief Queue bytes of a datagram, before a segment
+ *
+ * The bytes are split over as many segments as needed.
+ *
+ * @param link The link to insert at
+ * @param off The offset of the first byte
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return struct ipfrag_seg** The link following the inserted segments, NULL
+ * if the cap is reached
+ */
+static struct ipfrag_seg **seg_insert(struct ipfrag_seg **link, uint32_t off,
+                                      const u_char *data, uint32_t len)
+{
+    while (len > 0) {
+        if (ctx->free_segs == NULL && pool_grow() < 0)
+            return NULL;
+        struct ipfrag_seg *s = ctx->free_segs;
+        ctx->free_segs = s->next;
+        s->off = off;
+        s->len = len < sizeof(s->data) ? len : sizeof(s->data);
+        memcpy(s->data, data, s->len);
+        s->next = *link;
+        *link = s;
+        link = &s->next;
+        off += s->len;
+        data += s->len;
+        len -= s->len;
+    }
+    return link;
+}
+
+
+/**
+ * @brief Queue the payload of a fragment
+ *
+ * Only the bytes no queued segment covers yet are copied, so the segments of
+ * a datagram never overlap.
+ *
+ * @param d The datagram
+ * @param off The offset of the first byte
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return int 1 if part of the bytes were already queued, 0 otherwise, -1 if
+ * the cap is reached
+ */
+static int dgram_queue(struct ipfrag_dgram *d, uint32_t off,
+                       const u_char *data, uint32_t len)
+{
+    int overlap = 0;
+    struct ipfrag_seg **link = &d->segs;
+    while (len > 0) {
+        struct ipfrag_seg *s = *link;
+        if (s == NULL || off < s->off) { // Uncovered bytes before s
+            uint32_t n = len;
+            if (s && s->off < off + len)
+                n = s->off - off;
+            link = seg_insert(link, off, data, n);
+            if (link == NULL)
+                return (-1);
+            d->queued += n;
+            off += n;
+            data += n;
+            len -= n;
+        } else if (off < s->off + s->len) { // Covered by s
+            uint32_t n = s->off + s->len - off;
+            if (n > len)
+                n = len;
+            overlap = 1;
+            off += n;
+            data += n;
+            len -= n;
+        } else {
+            link = &s->next;
+        }
+    }
+    return overlap;
+}
+
+
+/**
+ * @brief Rebuild a complete datagram in the scratch memory of the packet
+ *
+ * The headers of the first fragment are followed by the payload, and the
+ * length and fragment fields of the IP header are set for the whole
+ * datagram.
+ *
+ * @param d The datagram
+ * @return u_char* The datagram, NULL if out of memory
+ */
+static u_char *dgram_build(const struct ipfrag_dgram *d)
+{
+    u_char *out = arena_alloc(d->hdr_len + d->total);
+    if (out == NULL)
+        return NULL;
+    memcpy(out, d->hdr, d->hdr_len);
+    for (const struct ipfrag_seg *s = d->segs; s != NULL; s = s->next)
+        memcpy(out + d->hdr_len + s->off, s->data, s->len);
+
+    uint16_t ip_len = d->hdr_len - d->ip_off;
+    if (d->key.version == 4) {
+        struct iphdr ip;
+        memcpy(&ip, out + d->ip_off, sizeof(ip));
+        ip.tot_len = htobe16(ip_len + d->total);
+        ip.frag_off &= htobe16(IP_DF);
+        memcpy(out + d->ip_off, &ip, sizeof(ip));
+    } else {
+        struct ip6_hdr ip6;
+        memcpy(&ip6, out + d->ip_off, sizeof(ip6));
+        ip6.ip6_plen = htobe16(ip_len - sizeof(ip6) + d->total);
+        ip6.ip6_nxt = d->key.proto;
+        memcpy(out + d->ip_off, &ip6, sizeof(ip6));
+    }
+    return out;
+}
+
+
+/**
+ * @brief Queue a fragment and rebuild the datagram it completes
+ *
+ * @param v The view of the fragment payload, moved to the payload of the
+ * datagram if complete
+ * @param pi The decoded packet, with its IP fields
+ * @param id The identification of the datagram
+ * @param off The offset of the fragment in the payload of the datagram
+ * @param len The payload length announced by the IP header
+ * @param hdr_len The bytes of headers before the payload to keep from the
+ * first fragment
+ * @return int 1 if the datagram is complete, 0 if the fragment was handled,
+ * -1 if it was dropped
+ *
+ * @see dgram_get
+ * @see dgram_queue
+ * @see dgram_build
+ */
+static int frag_queue(struct packet_view *v, struct packet_info *pi,
+                      uint32_t id, uint32_t off, uint32_t len,
+                      uint32_t hdr_len)
+{
+    pi->frag_id = id;
+    pi->frag_offset = off;
+    pi->layers |= LAYER_FRAG;
+    if (!enabled)
+        return 0;
+    if (ctx_get() < 0)
+        return (-1);
+    dgram_expire(pi->ts);
+    ctx->stats.fragments++;
+
+    int more = pi->frag_more;
+    if (v->remaining < len) {
+        ctx->stats.truncated++;
+        return 0;
+    }
+    if (off + len > IPFRAG_MAX_LEN || (more && len % 8 != 0) ||
+        (more && len == 0)) {
+        ctx->stats.malformed++;
+        return 0;
+    }
+
+    struct ipfrag_key key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.src, pi->ip_src, pi->ip_version == 4 ? 4 : 16);
+    memcpy(key.dst, pi->ip_dst, pi->ip_version == 4 ? 4 : 16);
+    key.id = id;
+    key.proto = pi->ip_proto;
+    key.version = pi->ip_version;
+    struct ipfrag_dgram *d = dgram_get(&key, pi->ts);
+    if (d == NULL) {
+        ctx->stats.dropped++;
+        return (-1);
+    }
+
+    if ((d->total && off + len > d->total) ||
+        (!more && (d->total ? off + len != d->total : off + len < d->end))) {
+        ctx->stats.malformed++;
+        return 0;
+    }
+    if (!more)
+        d->total = off + len;
+    if (off == 0 && d->hdr_len == 0) {
+        if (hdr_len > IPFRAG_HDR_MAX) {
+            ctx->stats.dropped++;
+            dgram_free(d);
+            return (-1);
+        }
+        memcpy(d->hdr, v->ptr - v->off, hdr_len);
+        d->ip_off = pi->l3_off;
+        d->hdr_len = hdr_len;
+    }
+
+    int overlap = dgram_queue(d, off, v->ptr, len);
+    if (overlap < 0) { // The datagram can't be completed anymore
+        ctx->stats.dropped++;
+        dgram_free(d);
+        return (-1);
+    }
+    ctx->stats.overlaps += overlap;
+    if (off + len > d->end)
+        d->end = off + len;
+    d->frags++;
+    if (d->total == 0 || d->hdr_len == 0 || d->queued < d->total)
+        return 0;
+
+    u_char *out;
+    if (d->hdr_len + d->total > UINT16_MAX || (out = dgram_build(d)) == NULL) {
+        ctx->stats.dropped++;
+        dgram_free(d);
+        return (-1);
+    }
+    ctx->out = out;
+    ctx->out_frags = d->frags;
+    ctx->stats.datagrams++;
+    v->ptr = out + d->hdr_len;
+    v->off = d->hdr_len;
+    v->remaining = d->total;
+    v->caplen = d->hdr_len + d->total;
+    pi->caplen = v->caplen;
+    pi->l3_off = d->ip_off;
+    pi->l3_len = d->hdr_len - d->ip_off + d->total;
+    pi->layers = (pi->layers & ~LAYER_FRAG) | LAYER_DEFRAG;
+    pi->frag_id = pi->frag_offset = pi->frag_more = 0; // Shared with the transport fields
+    dgram_free(d);
+    return 1;
+}
+
+
+/**
+ * @brief Handle an IPv4 fragment
+ *
+ * The IP fields of the decoded packet must be set. The fragment gets the
+ * LAYER_FRAG flag and its fields; if it completes its datagram, the view is
+ * moved to the payload of the datagram and the packet gets the LAYER_DEFRAG
+ * flag instead.
+ *
+ * @param v The view of the fragment payload
+ * @param ip The IPv4 header
+ * @param pi The decoded packet
+ * @return int 1 if the datagram is complete, 0 if the fragment was handled,
+ * -1 if it was dropped
+ *
+ * @see frag_queue
+ */
+int ipfrag_ipv4(struct packet_view *v, const struct iphdr *ip,
+                struct packet_info *pi)
+{
+    uint16_t frag = be16toh(ip->frag_off);
+    uint32_t hlen = ip->ihl * 4u;
+    uint32_t len = pi->l3_len > hlen ? pi->l3_len - hlen
+                                     : v->remaining; // 0 with segmentation offload
+    pi->frag_more = (frag & IP_MF) != 0;
+    return frag_queue(v, pi, be16toh(ip->id), (frag & IP_OFFMASK) * 8u, len,
+                      v->off);
+}
+
+
+/**
+ * @brief Handle an IPv6 fragment header
+ *
+ * The IP fields of the decoded packet must be set, the protocol becomes the
+ * one following the fragment header. A fragment header alone in its
+ * datagram is just skipped; otherwise the fragment is handled as by
+ * ipfrag_ipv4().
+ *
+ * @param v The view of the IPv6 payload, starting with the fragment header
+ * @param pi The decoded packet
+ * @return int 1 if the payload can be decoded, 0 if the fragment was
+ * handled, -1 if it was dropped
+ *
+ * @see frag_queue
+ */
+int ipfrag_ipv6(struct packet_view *v, struct packet_info *pi)
+{
+    const struct ip6_frag *f = decode_pull(pi, v, sizeof(*f));
+    if (f == NULL)
+        return (-1);
+    uint16_t offlg = be16toh(f->ip6f_offlg);
+    pi->ip_proto = f->ip6f_nxt;
+    if ((offlg & ~7) == 0 && !(offlg & 1)) // Atomic fragment
+        return 1;
+    uint32_t plen = pi->l3_len - sizeof(struct ip6_hdr);
+    uint32_t len = plen > sizeof(*f) ? plen - sizeof(*f) : v->remaining;
+    pi->frag_more = offlg & 1;
+    return frag_queue(v, pi, be32toh(f->ip6f_ident), offlg & ~7u, len,
+                      v->off - sizeof(*f));
+}
+
+
+/**
+ * @brief Get the datagram a packet completed
+ *
+ * The datagram starts with the headers of its first fragment; it stays
+ * valid until the next packet is decoded by the same thread.
+ *
+ * @param pi The decoded packet
+ * @param frags The number of fragments of the datagram, NULL if not needed
+ * @return const u_char* The datagram, NULL without the LAYER_DEFRAG flag
+ */
+const u_char *ipfrag_data(const struct packet_info *pi, uint16_t *frags)
+{
+    if (!(pi->layers & LAYER_DEFRAG) || ctx == NULL)
+        return NULL;
+    if (frags)
+        *frags = ctx->out_frags;
+    return ctx->out;
+}
+
+
+/**
+ * @brief Print the fragment or the reassembled datagram of a packet
+ *
+ * This function prints one line for a packet with the LAYER_FRAG or the
+ * LAYER_DEFRAG flag.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ */
+int print_ipfrag(const struct packet_info *pi, const u_char *packet)
+{
+    (void)packet;
+    uint16_t frags;
+    if (pi->layers & LAYER_FRAG)
+        out_printf("FRAG: id 0x%x, offset %u, %s\n", pi->frag_id,
+                   pi->frag_offset,
+                   pi->frag_more ? "more fragments" : "last fragment");
+    else if (ipfrag_data(pi, &frags))
+        out_printf("DEFRAG: %u fragments, %u bytes\n", frags, pi->l3_len);
+    return 0;
+}
+
+
+/**
+ * @brief Free the datagrams and buffers of the calling thread
+ *
+ * The counters of the thread are added to the global ones, the datagrams
+ * left incomplete are counted as expired.
+ */
+void ipfrag_release(void)
+{
+    if (ctx == NULL)
+        return;
+    while (ctx->oldest) {
+        dgram_free(ctx->oldest);
+        ctx->stats.expired++;
+    }
+    while (ctx->free_dgrams) {
+        struct ipfrag_dgram *d = ctx->free_dgrams;
+        ctx->free_dgrams = d->hnext;
+        free(d);
+        cap_give(sizeof(*d));
+    }
+    while (ctx->chunks) {
+        struct ipfrag_chunk *c = ctx->chunks;
+        ctx->chunks = c->next;
+        free(c);
+        cap_give(sizeof(*c));
+    }
+
+    pthread_mutex_lock(&total_lock);
+    total.fragments += ctx->stats.fragments;
+    total.datagrams += ctx->stats.datagrams;
+    total.overlaps += ctx->stats.overlaps;
+    total.malformed += ctx->stats.malformed;
+    total.truncated += ctx->stats.truncated;
+    total.dropped += ctx->stats.dropped;
+    total.expired += ctx->stats.expired;
+    pthread_mutex_unlock(&total_lock);
+
+    free(ctx);
+    ctx = NULL;
+}
+
+
+/**
+ * @brief Print the reassembly counters, if any fragment was seen
+ *
+ * @param stream The stream to print to
+ */
+void ipfrag_print_stats(FILE *stream)
+{
+    pthread_mutex_lock(&total_lock);
+    if (total.fragments > 0) {
+        fprintf(stream, "Defragmentation: %llu fragments, %llu datagrams "
+                        "reassembled, %llu expired incomplete\n",
+                (unsigned long long)total.fragments,
+                (unsigned long long)total.datagrams,
+                (unsigned long long)total.expired);
+        fprintf(stream, "  %llu overlapping, %llu malformed, %llu truncated, "
+                        "%llu dropped over the memory cap\n",
+                (unsigned long long)total.overlaps,
+                (unsigned long long)total.malformed,
+                (unsigned long long)total.truncated,
+                (unsigned long long)total.dropped);
+    }
+    pthread_mutex_unlock(&total_lock);
+}
@@ -8,102 +8,116 @@
  * 
  * @see ipv4.h
  * @see cast_ipv4
+ * @see print_ipv4
  */
 
 // Global libraries
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Local header files
-#include "icmp.h"
+#include "dissector.h"
+#include "format.h"
+#include "ipfrag.h"
 #include "ipv4.h"
-#include "ipv6.h"
-#include "tcp.h"
-#include "udp.h"
+#include "output.h"
 
 
 /**
- * @brief Format an IPv4 address
- * 
- * This function formats an IPv4 address in the format A.B.C.D.
+ * @brief Handle an IPv4 packet
  * 
- * @param ip_addr The IPv4 address to format
- * @return char* The formatted IPv4 address
+ * This function decodes an IPv4 packet and hands its payload to the next layer.
+ * A fragment stops here, unless it completes its datagram, whose payload is
+ * handed over instead.
  * 
- * @note The returned string must be freed by the caller
+ * @param v The view of the packet, limited to the IPv4 payload
+ * @param ip The IPv4 header
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ * @see ipfrag_ipv4
+ * @see dissector_ip
  */
-#define STR_IPv4_ADDR_LEN 16
-static char *format_ipv4(uint32_t ip_addr)
+int ip_handler(struct packet_view *v, const struct iphdr *ip,
+               struct packet_info *pi)
 {
-    char *res = malloc(STR_IPv4_ADDR_LEN * sizeof(char));
-    if (res == NULL) {
-        return NULL;
+    pi->ip_version = 4;
+    pi->ip_proto = ip->protocol;
+    pi->ip_ttl = ip->ttl;
+    pi->l3_len = be16toh(ip->tot_len);
+    memcpy(pi->ip_src, &ip->saddr, 4);
+    memcpy(pi->ip_dst, &ip->daddr, 4);
+    pi->layers |= LAYER_IPV4;
+    if (be16toh(ip->frag_off) & (IP_MF | IP_OFFMASK)) {
+        int ret = ipfrag_ipv4(v, ip, pi);
+        if (ret <= 0)
+            return ret;
     }
-    sprintf(res, "%u.%u.%u.%u", (ip_addr >> 24) & 0xFF, (ip_addr >> 16) & 0xFF,
-            (ip_addr >> 8) & 0xFF, (ip_addr) & 0xFF);
+    pi->l4_off = v->off;
 
-    return res;
+    return dissector_ip(v, pi);
 }
 
+
 /**
  * @brief Handle an IPv4 packet
  * 
- * This function handles an IPv4 packet.
+ * This function decodes an IPv4 packet.
+ * The view is then limited to the total length of the packet, so the link
+ * layer padding is never taken for payload.
+ * A total length of 0, as written by segmentation offload, is ignored.
  * 
- * @param packet The packet to handle
- * @param ip The IPv4 header
- * @return int 0 if the packet is well handled
- * @see cast_tcp
- * @see cast_udp
- * @see cast_icmp
- * @see cast_ipv6
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ * @see ip_handler
  */
-int ip_handler(const u_char *packet, const struct iphdr *ip)
+int cast_ipv4(struct packet_view *v, struct packet_info *pi)
 {
+    const struct iphdr *ip;
+    ip = decode_pull(pi, v, sizeof(struct iphdr));
+    if (ip == NULL || ip->ihl < 5 ||
+        decode_pull(pi, v, ip->ihl * 4 - sizeof(struct iphdr)) == NULL) // Options
+        return (-1);
+
+    uint16_t tot_len = be16toh(ip->tot_len);
+    if (tot_len >= ip->ihl * 4)
+        decode_limit(pi, v, tot_len - ip->ihl * 4);
+    return ip_handler(v, ip, pi);
+}
+
+
+/**
+ * @brief Print an IPv4 packet
+ * 
+ * This function prints the IPv4 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the protocol is known, -1 otherwise
+ */
+int print_ipv4(const struct packet_info *pi, const u_char *packet)
+{
+    (void)packet;
     /* Print IPv4 source and destination */
-    char *ipv4_src, *ipv4_dst;
-    ipv4_src = format_ipv4(ntohl(ip->saddr));
-    ipv4_dst = format_ipv4(ntohl(ip->daddr));
-    printf("IP: %s -> %s\n", ipv4_src, ipv4_dst);
-    free(ipv4_src);
-    free(ipv4_dst);
+    char ipv4_src[STR_IPv4_ADDR_LEN], ipv4_dst[STR_IPv4_ADDR_LEN];
+    format_ipv4(ipv4_src, be32toh(*(uint32_t *)pi->ip_src));
+    format_ipv4(ipv4_dst, be32toh(*(uint32_t *)pi->ip_dst));
+    out_printf("IP: %s -> %s\n", ipv4_src, ipv4_dst);
 
-    switch (ip->protocol) {
+    switch (pi->ip_proto) {
     case IPPROTO_TCP:
-        cast_tcp(packet + ip->ihl * 4, be16toh(ip->tot_len) - ip->ihl * 4);
-        break;
     case IPPROTO_UDP:
-        cast_udp(packet + ip->ihl * 4);
-        break;
     case IPPROTO_ICMP:
-        cast_icmp(packet + ip->ihl * 4);
-        break;
     case IPPROTO_IPV6:
-        cast_ipv6(packet + ip->ihl * 4);
         break;
     default:
+        if (pi->layers & LAYER_PLUGIN)
+            break;
         fprintf(stderr,
                 "Unknown protocol on network layer. IP PROTOCOL: 0X%x\n",
-                ip->protocol);
+                pi->ip_proto);
         return (-1);
     }
     return 0;
 }
-
-
-/**
- * @brief Handle an IPv4 packet
- * 
- * This function handles an IPv4 packet.
- * 
- * @param packet The packet to handle
- * @return int 0 if the packet is well handled
- * @see ip_handler
- */
-int cast_ipv4(const u_char *packet)
-{
-    const struct iphdr *ip;
-    ip = (struct iphdr *)(packet);
-    ip_handler(packet, ip);
-    return 0;
-}
\ No newline at end of file
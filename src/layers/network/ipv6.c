@@ -7,96 +7,157 @@
  * This file contains the implementation of the IPv6 layer.
  * 
  * @see ipv6.h
+ * @see ipv6_skip_ext
  * @see cast_ipv6
+ * @see print_ipv6
  */
 
 // Global libraries
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Local header files
+#include "dissector.h"
+#include "format.h"
+#include "ipfrag.h"
 #include "ipv6.h"
-#include "tcp.h"
-#include "udp.h"
-#include "icmpv6.h"
+#include "output.h"
 
 
 /**
- * @brief Format an IPv6 address
- * 
- * This function format an IPv6 address in the format XXXX:XXXX:XXXX:XXXX:XXXX:XXXX.
- * 
- * @param ip6 The IPv6 header
- * @return char* The formatted IPv6 address
- * 
- * @note The returned string must be freed by the caller
+ * @brief Skip the IPv6 extension headers
+ *
+ * The Hop-by-Hop Options, Routing and Destination Options headers are
+ * skipped; the walk stops at any other header, a fragment header included.
+ *
+ * @param p The header following the IPv6 or the fragment header
+ * @param remain The number of captured bytes from p
+ * @param nxt The type of the header at p, set to the one the walk stops at
+ * unless a header is truncated
+ * @return int64_t The number of bytes skipped, -1 if a header is truncated
  */
-#define STR_IPv6_ADDR_LEN 5*8
-static char *format_ipv6(const struct in6_addr ip6) {
-    char *res = malloc(STR_IPv6_ADDR_LEN * sizeof(char));
-    if (res == NULL)
-        return NULL;
-    
-    if (inet_ntop(AF_INET6, &ip6, res, STR_IPv6_ADDR_LEN) == NULL) {
-        free(res);
-        return NULL;
+int64_t ipv6_skip_ext(const u_char *p, int64_t remain, uint8_t *nxt) {
+    uint8_t type = *nxt;
+    int64_t len = 0;
+    while (type == IPPROTO_HOPOPTS || type == IPPROTO_ROUTING ||
+           type == IPPROTO_DSTOPTS) {
+        if (remain - len < 2 || remain - len < (p[len + 1] + 1) * 8)
+            return (-1);
+        type = p[len];
+        len += (p[len + 1] + 1) * 8;
     }
+    *nxt = type;
+    return len;
+}
+
 
-    return res;
+/**
+ * @brief Skip the extension headers of a decoded IPv6 packet
+ *
+ * @param v The view of the packet, at the header of type pi->ip_proto
+ * @param pi The decoded packet, its protocol set to the upper layer
+ * @return int 0 on success, -1 if a header is truncated
+ * @see ipv6_skip_ext
+ */
+static int ip6_ext(struct packet_view *v, struct packet_info *pi) {
+    uint8_t nxt = pi->ip_proto;
+    int64_t len = ipv6_skip_ext(v->ptr, v->remaining, &nxt);
+    if (len < 0 || (len > 0 && decode_pull(pi, v, len) == NULL))
+        return (-1);
+    pi->ip_proto = nxt;
+    return 0;
 }
 
 
 /**
  * @brief Handle an IPv6 packet
  * 
- * This function handles an IPv6 packet.
+ * This function decodes an IPv6 packet and hands its payload to the next layer.
+ * The extension headers are skipped, and a fragment header among them is
+ * handled like an IPv4 fragment.
  * 
- * @param packet The packet to handle
+ * @param v The view of the packet, limited to the IPv6 payload
  * @param ip6 The IPv6 header
- * @return int 0 if the packet is well handled
- * @see cast_tcp
- * @see cast_udp
- * @see cast_icmp6
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
+ * @see ip6_ext
+ * @see ipfrag_ipv6
+ * @see dissector_ip
  */
-int ip6_handler (const u_char* packet, const struct ip6_hdr* ip6) {
-    char *ipv6_src, *ipv6_dst;
-    ipv6_src = format_ipv6(ip6->ip6_src);
-    ipv6_dst = format_ipv6(ip6->ip6_dst);
-    printf("IPv6: %s -> %s\n", ipv6_src, ipv6_dst);
-    free(ipv6_src);
-    free(ipv6_dst);
+int ip6_handler (struct packet_view *v, const struct ip6_hdr* ip6, struct packet_info *pi) {
+    uint16_t plen = be16toh(ip6->ip6_ctlun.ip6_un1.ip6_un1_plen);
 
-    switch (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt) {
-        case IPPROTO_TCP:
-            cast_tcp(packet + sizeof(struct ip6_hdr), ip6->ip6_ctlun.ip6_un1.ip6_un1_plen - sizeof(struct ip6_hdr));
-            break;
-        case IPPROTO_UDP:
-            cast_udp(packet + sizeof(struct ip6_hdr));
-            break;
-        case IPPROTO_ICMPV6:
-            cast_icmp6(packet + sizeof(struct ip6_hdr));
-            break;
-        default:
-            fprintf(stderr, "Unknown protocol on network layer. IP PROTOCOL: 0X%x\n", ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt);
+    pi->ip_version = 6;
+    pi->ip_proto = ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt;
+    pi->ip_ttl = ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim;
+    pi->l3_len = sizeof(struct ip6_hdr) + plen;
+    memcpy(pi->ip_src, &ip6->ip6_src, 16);
+    memcpy(pi->ip_dst, &ip6->ip6_dst, 16);
+    pi->layers |= LAYER_IPV6;
+    if (plen > 0) // 0 for a jumbogram or with segmentation offload
+        decode_limit(pi, v, plen);
+    if (ip6_ext(v, pi) < 0)
+        return (-1);
+    if (pi->ip_proto == IPPROTO_FRAGMENT) {
+        int ret = ipfrag_ipv6(v, pi);
+        if (ret <= 0)
+            return ret;
+        if (ip6_ext(v, pi) < 0) // Those of the fragmentable part
             return (-1);
     }
-    return 0;
+    pi->l4_off = v->off;
+
+    return dissector_ip(v, pi);
 }
 
 
 /**
  * @brief Handle an IPv6 packet
  * 
- * This function handles an IPv6 packet.
+ * This function decodes an IPv6 packet.
  * 
- * @param packet The packet to handle
- * @return int 0 if the packet is well handled
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
+ * @return int 0 if the packet is well handled, -1 otherwise
  * 
  * @see ip6_handler
  */
-int cast_ipv6(const u_char* packet) {
+int cast_ipv6(struct packet_view *v, struct packet_info *pi) {
     const struct ip6_hdr* ip;
-    ip = (struct ip6_hdr*)(packet);
-    ip6_handler(packet, ip);
+    ip = decode_pull(pi, v, sizeof(struct ip6_hdr));
+    if (ip == NULL)
+        return (-1);
+    return ip6_handler(v, ip, pi);
+}
+
+
+/**
+ * @brief Print an IPv6 packet
+ * 
+ * This function prints the IPv6 layer of a decoded packet.
+ * 
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 if the next header is known, -1 otherwise
+ */
+int print_ipv6(const struct packet_info *pi, const u_char *packet) {
+    (void)packet;
+    char ipv6_src[STR_IPv6_ADDR_LEN], ipv6_dst[STR_IPv6_ADDR_LEN];
+    format_ipv6(ipv6_src, (const struct in6_addr *)pi->ip_src);
+    format_ipv6(ipv6_dst, (const struct in6_addr *)pi->ip_dst);
+    out_printf("IPv6: %s -> %s\n", ipv6_src, ipv6_dst);
+
+    switch (pi->ip_proto) {
+        case IPPROTO_TCP:
+        case IPPROTO_UDP:
+        case IPPROTO_ICMPV6:
+            break;
+        default:
+            if (pi->layers & LAYER_PLUGIN)
+                break;
+            fprintf(stderr, "Unknown protocol on network layer. IP PROTOCOL: 0X%x\n", pi->ip_proto);
+            return (-1);
+    }
     return 0;
-}
\ No newline at end of file
+}
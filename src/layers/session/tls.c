@@ -0,0 +1,550 @@
+/**
+ * @author Flavien Lallemant
+ * @file tls.c
+ * @brief TLS layer functions
+ * @ingroup session
+ *
+ * This file contains the functions to parse the TLS hellos and fingerprint
+ * them.
+ * A hello is read in place through a view: its fields point into the record,
+ * and the packet only keeps their offsets, so nothing is copied. The JA3
+ * string and its hash are only built when an output or a filter asks for
+ * them, once per hello, which is once per connection.
+ *
+ * @see tls.h
+ * @see tls_parse_hello
+ * @see tls_hello_version
+ * @see tls_version_name
+ * @see tls_ja3
+ * @see tls_ja3_hash
+ * @see tls_payload
+ * @see cast_tls
+ * @see json_tls
+ * @see print_tls
+ */
+
+// Global libraries
+#include <stdio.h>
+#include <string.h>
+
+// Local header files
+#include "md5.h"
+#include "output.h"
+#include "reasm.h"
+#include "render.h"
+#include "tls.h"
+
+#define EXT_SERVER_NAME 0 /**< server_name extension */
+#define EXT_SUPPORTED_GROUPS 10 /**< supported_groups extension */
+#define EXT_EC_POINT_FORMATS 11 /**< ec_point_formats extension */
+#define EXT_ALPN 16 /**< application_layer_protocol_negotiation extension */
+#define EXT_SUPPORTED_VERSIONS 43 /**< supported_versions extension */
+
+/**
+ * @brief Check if a value is a GREASE one of RFC 8701
+ *
+ * The GREASE values are left out of the fingerprints.
+ */
+#define IS_GREASE(v) (((v) & 0x0f0f) == 0x0a0a && ((v) >> 8) == ((v) & 0xff))
+
+
+/**
+ * @brief Read a big endian 16-bit value
+ *
+ * @param p The bytes
+ * @return uint16_t The value
+ */
+static inline uint16_t get_be16(const u_char *p)
+{
+    return (uint16_t)p[0] << 8 | p[1];
+}
+
+
+/**
+ * @brief Keep the fields of an extension of a hello
+ *
+ * @param h The hello
+ * @param type The type of the extension
+ * @param d The data of the extension
+ * @param n The length of the data
+ */
+static void parse_extension(struct tls_hello *h, uint16_t type,
+                            const u_char *d, uint16_t n)
+{
+    switch (type) {
+    case EXT_SERVER_NAME: // List length, name type, name length, name
+        if (n >= 5 && d[2] == 0 && 5 + get_be16(d + 3) <= n) {
+            h->sni.ptr = d + 5;
+            h->sni.len = get_be16(d + 3);
+        }
+        break;
+    case EXT_ALPN: // List length, then length and name of each protocol
+        if (n >= 2 && 2 + get_be16(d) <= n) {
+            h->alpn.ptr = d + 2;
+            h->alpn.len = get_be16(d);
+        }
+        break;
+    case EXT_SUPPORTED_VERSIONS: // A list in a ClientHello, the version in a ServerHello
+        if (h->type == TLS_HS_SERVER_HELLO && n >= 2) {
+            h->selected = get_be16(d);
+        } else if (h->type == TLS_HS_CLIENT_HELLO && n >= 1 && 1 + d[0] <= n) {
+            h->versions.ptr = d + 1;
+            h->versions.len = d[0];
+        }
+        break;
+    case EXT_SUPPORTED_GROUPS:
+        if (n >= 2 && 2 + get_be16(d) <= n) {
+            h->groups.ptr = d + 2;
+            h->groups.len = get_be16(d);
+        }
+        break;
+    case EXT_EC_POINT_FORMATS:
+        if (n >= 1 && 1 + d[0] <= n) {
+            h->formats.ptr = d + 1;
+            h->formats.len = d[0];
+        }
+        break;
+    }
+}
+
+
+/**
+ * @brief Parse the body of a hello
+ *
+ * @param v The view of the body
+ * @param h The hello to fill, with its type set
+ * @return int 0 on success, -1 if the body is cut
+ *
+ * @see parse_extension
+ */
+static int parse_body(struct packet_view *v, struct tls_hello *h)
+{
+    uint8_t n8;
+    uint16_t n16;
+    if (view_be16(v, &h->version) < 0 || view_skip(v, 32) < 0 || // Random
+        view_u8(v, &n8) < 0 || view_skip(v, n8) < 0) // Session ID
+        return (-1);
+    if (h->type == TLS_HS_CLIENT_HELLO) {
+        if (view_be16(v, &n16) < 0 || (h->ciphers.ptr = view_pull(v, n16)) == NULL)
+            return (-1);
+        h->ciphers.len = n16;
+        if (view_u8(v, &n8) < 0 || view_skip(v, n8) < 0) // Compression methods
+            return (-1);
+    } else if (view_be16(v, &h->cipher) < 0 || view_skip(v, 1) < 0) {
+        return (-1);
+    }
+    if (v->remaining == 0) // No extension
+        return 0;
+
+    if (view_be16(v, &n16) < 0)
+        return (-1);
+    int cut = view_limit(v, n16) < 0;
+    h->exts.ptr = v->ptr;
+    while (v->remaining > 0) {
+        uint16_t type, len;
+        const u_char *d;
+        if (view_be16(v, &type) < 0 || view_be16(v, &len) < 0 ||
+            (d = view_pull(v, len)) == NULL)
+            return (-1);
+        parse_extension(h, type, d, len);
+        h->exts.len = v->ptr - h->exts.ptr; // The complete extensions only
+    }
+    return cut ? -1 : 0;
+}
+
+
+/**
+ * @brief Parse the hello starting a TLS record
+ *
+ * Nothing is copied. A hello cut by the end of the bytes keeps its fields up
+ * to the first one cut, and is flagged truncated.
+ *
+ * @param rec The record
+ * @param len The number of bytes of the record available
+ * @param h The hello to fill
+ * @return int 0 on success, -1 if the record doesn't start with a hello
+ *
+ * @see parse_body
+ */
+int tls_parse_hello(const u_char *rec, uint32_t len, struct tls_hello *h)
+{
+    struct packet_view v;
+    const struct tlshdr *tls;
+    const u_char *hs;
+    memset(h, 0, sizeof(*h));
+    view_init(&v, rec, len);
+    if ((tls = view_pull(&v, sizeof(struct tlshdr))) == NULL ||
+        tls->tls_ct != TLS_CT_HANDSHAKE)
+        return (-1);
+    int cut = view_limit(&v, be16toh(tls->tls_len)) < 0;
+    if ((hs = view_pull(&v, 4)) == NULL ||
+        (hs[0] != TLS_HS_CLIENT_HELLO && hs[0] != TLS_HS_SERVER_HELLO))
+        return (-1);
+    h->type = hs[0];
+    cut |= view_limit(&v, (uint32_t)hs[1] << 16 | get_be16(hs + 2)) < 0;
+    h->truncated = parse_body(&v, h) < 0 || cut;
+    return 0;
+}
+
+
+/**
+ * @brief Get the version of a hello
+ *
+ * @param h The hello
+ * @return uint16_t The version chosen by a ServerHello, or the highest
+ * offered by a ClientHello
+ */
+uint16_t tls_hello_version(const struct tls_hello *h)
+{
+    if (h->type == TLS_HS_SERVER_HELLO)
+        return h->selected ? h->selected : h->version;
+    uint16_t best = 0;
+    for (uint16_t i = 0; i + 2 <= h->versions.len; i += 2) {
+        uint16_t v = get_be16(h->versions.ptr + i);
+        if (!IS_GREASE(v) && v > best)
+            best = v;
+    }
+    return best ? best : h->version;
+}
+
+
+/**
+ * @brief Get the name of a TLS version
+ *
+ * @param version The version, e.g. 0x0303
+ * @return const char* The name, NULL if unknown
+ */
+const char *tls_version_name(uint16_t version)
+{
+    switch (version) {
+    case 0x0300:
+        return "SSL 3.0";
+    case 0x0301:
+        return "TLS 1.0";
+    case 0x0302:
+        return "TLS 1.1";
+    case 0x0303:
+        return "TLS 1.2";
+    case 0x0304:
+        return "TLS 1.3";
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Append a field of values to a JA3 string
+ *
+ * The field starts with a comma, then the values are written in decimal,
+ * separated by dashes, without the GREASE ones.
+ *
+ * @param text The string
+ * @param n The length of the string
+ * @param b The values
+ * @param width The size of a value, 1 or 2 bytes
+ * @return int The new length of the string, TLS_JA3_LEN if it is full
+ */
+static int ja3_field(char *text, int n, const struct tls_bytes *b, int width)
+{
+    if (n >= TLS_JA3_LEN - 1)
+        return TLS_JA3_LEN;
+    text[n++] = ',';
+    text[n] = '\0';
+    const char *sep = "";
+    for (uint16_t i = 0; i + width <= b->len && n < TLS_JA3_LEN; i += width) {
+        uint16_t v = width == 2 ? get_be16(b->ptr + i) : b->ptr[i];
+        if (width == 2 && IS_GREASE(v))
+            continue;
+        n += snprintf(text + n, TLS_JA3_LEN - n, "%s%u", sep, v);
+        sep = "-";
+    }
+    return n < TLS_JA3_LEN ? n : TLS_JA3_LEN;
+}
+
+
+/**
+ * @brief Build the JA3 string of a hello
+ *
+ * A ServerHello gives the JA3S string.
+ *
+ * @param h The hello
+ * @param text The buffer to write to, TLS_JA3_LEN bytes
+ * @return int The length of the string, -1 if the hello is truncated
+ *
+ * @see ja3_field
+ */
+int tls_ja3(const struct tls_hello *h, char *text)
+{
+    if (h->truncated)
+        return (-1);
+    // The extension types, in their order
+    u_char types[TLS_JA3_LEN / 2];
+    struct tls_bytes exts = {types, 0};
+    for (uint16_t off = 0; off + 4 <= h->exts.len && exts.len < sizeof(types);
+         off += 4 + get_be16(h->exts.ptr + off + 2)) {
+        memcpy(types + exts.len, h->exts.ptr + off, 2);
+        exts.len += 2;
+    }
+
+    int n = snprintf(text, TLS_JA3_LEN, "%u", h->version);
+    if (h->type == TLS_HS_CLIENT_HELLO) {
+        n = ja3_field(text, n, &h->ciphers, 2);
+        n = ja3_field(text, n, &exts, 2);
+        n = ja3_field(text, n, &h->groups, 2);
+        n = ja3_field(text, n, &h->formats, 1);
+    } else {
+        u_char suite[2] = {h->cipher >> 8, h->cipher & 0xff};
+        struct tls_bytes cipher = {suite, 2};
+        n = ja3_field(text, n, &cipher, 2);
+        n = ja3_field(text, n, &exts, 2);
+    }
+    return n < TLS_JA3_LEN ? n : -1;
+}
+
+
+/**
+ * @brief Hash a JA3 string
+ *
+ * @param text The string
+ * @param n The length of the string
+ * @param hex The buffer to write the MD5 digest to in hexadecimal, 33 bytes
+ */
+static void ja3_hex(const char *text, int n, char *hex)
+{
+    uint8_t digest[MD5_LEN];
+    md5(text, n, digest);
+    for (int i = 0; i < MD5_LEN; i++)
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+}
+
+
+/**
+ * @brief Compute the JA3 hash of a hello
+ *
+ * @param h The hello
+ * @param hex The buffer to write to, 33 bytes
+ * @return int 0 on success, -1 if the hello is truncated
+ *
+ * @see tls_ja3
+ * @see ja3_hex
+ */
+int tls_ja3_hash(const struct tls_hello *h, char *hex)
+{
+    char text[TLS_JA3_LEN];
+    int n = tls_ja3(h, text);
+    if (n < 0)
+        return (-1);
+    ja3_hex(text, n, hex);
+    return 0;
+}
+
+
+/**
+ * @brief Get the TLS bytes of a decoded packet
+ *
+ * With the reassembly, they are the stream bytes handed over with the
+ * packet, the offsets of pi->u.tls are relative to them.
+ *
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @param len The number of bytes
+ * @return const u_char* The bytes
+ *
+ * @see reasm_data
+ */
+const u_char *tls_payload(const struct packet_info *pi, const u_char *packet,
+                          uint32_t *len)
+{
+    const u_char *data;
+    uint32_t n = reasm_enabled() ? reasm_data(pi, &data) : 0;
+    if (n > 0) {
+        *len = n;
+        return data;
+    }
+    *len = pi->l7_len;
+    return packet + pi->l7_off;
+}
+
+
+/**
+ * @brief Cast TLS record
+ *
+ * The record header is read, and the hello it starts with if any. The server
+ * name and the first ALPN protocol are kept as offsets in the record.
+ *
+ * @param v The view of the record
+ * @param pi The decoded packet to fill
+ * @return int 0 on success, -1 if the payload is too short
+ *
+ * @see tls_parse_hello
+ */
+int cast_tls(struct packet_view *v, struct packet_info *pi)
+{
+    const struct tlshdr *tls = view_peek(v, 3); // Content type and version
+    if (tls == NULL)
+        return (-1);
+    pi->u.tls.type = tls->tls_ct;
+    pi->u.tls.version = TLS_V(tls);
+
+    struct tls_hello h;
+    if (tls_parse_hello(v->ptr, v->remaining, &h) < 0)
+        return 0;
+    pi->u.tls.handshake = h.type;
+    pi->u.tls.hello_version = tls_hello_version(&h);
+    pi->u.tls.cipher = h.cipher;
+    if (h.sni.len > 0 && h.sni.len <= 255) {
+        pi->u.tls.sni_off = h.sni.ptr - v->ptr;
+        pi->u.tls.sni_len = h.sni.len;
+    }
+    if (h.alpn.len > 0 && h.alpn.ptr[0] > 0 && 1 + h.alpn.ptr[0] <= h.alpn.len) {
+        pi->u.tls.alpn_off = h.alpn.ptr + 1 - v->ptr;
+        pi->u.tls.alpn_len = h.alpn.ptr[0];
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Write a TLS record as JSON
+ *
+ * @param j The writer
+ * @param pi The decoded packet
+ * @param rec The record
+ * @param len The length of the record
+ * @param verbose The verbose level, the JA3 string is written at
+ * VERBOSE_COMPLETE
+ *
+ * @see tls_parse_hello
+ * @see tls_ja3
+ * @see ja3_hex
+ */
+void json_tls(struct json *j, const struct packet_info *pi, const u_char *rec,
+              uint32_t len, int verbose)
+{
+    struct tls_hello h;
+    json_object(j, "tls");
+    json_uint(j, "type", pi->u.tls.type);
+    json_uint(j, "version", 0x0300 | pi->u.tls.version);
+    if (pi->u.tls.handshake == 0 || tls_parse_hello(rec, len, &h) < 0) {
+        json_end(j);
+        return;
+    }
+    int client = h.type == TLS_HS_CLIENT_HELLO;
+    json_str(j, "handshake", client ? "client_hello" : "server_hello");
+    json_uint(j, "hello_version", tls_hello_version(&h));
+    if (!client)
+        json_uint(j, "cipher", h.cipher);
+    if (h.sni.ptr)
+        json_strn(j, "sni", (const char *)h.sni.ptr, h.sni.len);
+    if (h.alpn.ptr) {
+        json_array(j, "alpn");
+        for (uint16_t off = 0; off < h.alpn.len && off + 1 + h.alpn.ptr[off] <= h.alpn.len;
+             off += 1 + h.alpn.ptr[off])
+            json_strn(j, NULL, (const char *)h.alpn.ptr + off + 1, h.alpn.ptr[off]);
+        json_end(j);
+    }
+    if (h.truncated)
+        json_bool(j, "truncated", 1);
+
+    char text[TLS_JA3_LEN], hex[MD5_LEN * 2 + 1];
+    int n = tls_ja3(&h, text);
+    if (n >= 0) {
+        ja3_hex(text, n, hex);
+        json_str(j, client ? "ja3" : "ja3s", hex);
+        if (verbose >= VERBOSE_COMPLETE)
+            json_strn(j, client ? "ja3_string" : "ja3s_string", text, n);
+    }
+    json_end(j);
+}
+
+
+/**
+ * @brief Print bytes of a hello as text
+ *
+ * The bytes not printable are replaced by dots.
+ *
+ * @param p The bytes
+ * @param len The number of bytes
+ */
+static void print_text(const u_char *p, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++)
+        out_putc(p[i] >= 32 && p[i] <= 126 ? p[i] : '.');
+}
+
+
+/**
+ * @brief Print a TLS version
+ *
+ * @param version The version
+ */
+static void print_version(uint16_t version)
+{
+    const char *name = tls_version_name(version);
+    if (name)
+        out_puts(name);
+    else
+        out_printf("version 0x%04x", version);
+}
+
+
+/**
+ * @brief Print a TLS record
+ *
+ * @param pi The decoded packet
+ * @param rec The record
+ * @param len The length of the record
+ *
+ * @see tls_parse_hello
+ * @see tls_ja3
+ * @see ja3_hex
+ */
+void print_tls(const struct packet_info *pi, const u_char *rec, uint32_t len)
+{
+    out_puts("Encryption with ");
+    print_version(0x0300 | pi->u.tls.version);
+    out_putc('\n');
+
+    struct tls_hello h;
+    if (pi->u.tls.handshake == 0 || tls_parse_hello(rec, len, &h) < 0)
+        return;
+    int client = h.type == TLS_HS_CLIENT_HELLO;
+    out_puts(client ? "Client Hello, " : "Server Hello, ");
+    print_version(tls_hello_version(&h));
+    if (!client)
+        out_printf(", cipher suite 0x%04x", h.cipher);
+    out_puts(h.truncated ? " [|truncated]\n" : "\n");
+    if (h.sni.ptr) {
+        out_puts("Server name: ");
+        print_text(h.sni.ptr, h.sni.len);
+        out_putc('\n');
+    }
+    if (h.alpn.ptr) {
+        out_puts("ALPN:");
+        for (uint16_t off = 0; off < h.alpn.len && off + 1 + h.alpn.ptr[off] <= h.alpn.len;
+             off += 1 + h.alpn.ptr[off]) {
+            out_putc(' ');
+            print_text(h.alpn.ptr + off + 1, h.alpn.ptr[off]);
+        }
+        out_putc('\n');
+    }
+    if (h.versions.ptr) {
+        out_puts("Supported versions:");
+        for (uint16_t i = 0; i + 2 <= h.versions.len; i += 2) {
+            uint16_t v = get_be16(h.versions.ptr + i);
+            if (IS_GREASE(v))
+                continue;
+            out_putc(' ');
+            print_version(v);
+        }
+        out_putc('\n');
+    }
+
+    char text[TLS_JA3_LEN], hex[MD5_LEN * 2 + 1];
+    int n = tls_ja3(&h, text);
+    if (n < 0)
+        return;
+    ja3_hex(text, n, hex);
+    out_printf("%s: %.*s\n%s hash: %s\n", client ? "JA3" : "JA3S", n, text,
+               client ? "JA3" : "JA3S", hex);
+}
@@ -0,0 +1,695 @@
+/**
+ * @author Flavien Lallemant
+ * @file reasm.c
+ * @brief TCP stream reassembly definition
+ * @ingroup transport
+ *
+ * This file contains the definition of the TCP reassembly engine.
+ * Each thread keeps its flows in a hash table and an LRU list, and the bytes
+ * of each direction in a list of segments sorted by sequence number. The
+ * first segments of the list are the in order bytes not handed over yet, the
+ * others the bytes received after a hole.
+ * The segments are fixed size buffers taken from a per-thread pool, so
+ * queuing a payload never calls malloc once the pool is warm. The freed flows
+ * are kept for the next ones the same way. The bytes handed
+ * over are copied to the scratch memory of the packet.
+ * The memory of the pools and flows of every thread is counted against one
+ * global budget: when it runs out, the least recently used flows are freed,
+ * and the segment is dropped if there is none left to free.
+ *
+ * @see reasm.h
+ * @see reasm_init
+ * @see reasm_segment
+ * @see reasm_data
+ * @see reasm_release
+ */
+
+// Global libraries
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local header files
+#include "arena.h"
+#include "dispatch.h"
+#include "flow.h"
+#include "reasm.h"
+
+#define REASM_BUCKETS 4096 /**< Number of hash buckets, a power of 2 */
+#define REASM_SEG_SIZE 2048 /**< Size of a segment buffer */
+#define REASM_POOL_CHUNK 32 /**< Segments allocated at once */
+
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0) /**< a before b, with wraparound */
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0) /**< a before or at b, with wraparound */
+
+/**
+ * @brief Queued bytes of a direction
+ */
+struct reasm_seg {
+    struct reasm_seg *next; /**< Next segment by sequence number */
+    uint32_t seq;           /**< Sequence number of the first byte */
+    uint32_t len;           /**< Number of bytes */
+    u_char data[REASM_SEG_SIZE - sizeof(void *) - 2 * sizeof(uint32_t)]; /**< The bytes */
+};
+
+_Static_assert(sizeof(struct reasm_seg) == REASM_SEG_SIZE,
+               "struct reasm_seg must fill its buffer exactly");
+
+/**
+ * @brief Block of segments allocated at once
+ */
+struct reasm_chunk {
+    struct reasm_chunk *next;                   /**< Next chunk of the pool */
+    struct reasm_seg segs[REASM_POOL_CHUNK];    /**< The segments */
+};
+
+/**
+ * @brief One direction of a flow
+ */
+struct reasm_dir {
+    uint32_t base;          /**< Sequence number of the first byte not handed over */
+    uint32_t next;          /**< Sequence number following the in order bytes */
+    uint32_t fin;           /**< Sequence number of the FIN */
+    uint32_t queued;        /**< Bytes in the segment list */
+    uint8_t synced;         /**< 1 once the first sequence number is known */
+    uint8_t fin_seen;       /**< 1 once a FIN was sent */
+    uint8_t closed;         /**< 1 once every byte up to the FIN was handed over */
+    struct reasm_seg *segs; /**< Queued bytes, sorted by sequence number */
+};
+
+/**
+ * @brief Reassembled flow
+ */
+struct reasm_flow {
+    struct flow_key key;        /**< Flow key */
+    uint32_t hash;              /**< Hash of the key */
+    uint8_t app;                /**< Application protocol of the streams */
+    struct reasm_flow *hnext;   /**< Next flow of the bucket */
+    struct reasm_flow *prev;    /**< More recently used flow */
+    struct reasm_flow *next;    /**< Less recently used flow */
+    struct timeval last;        /**< Timestamp of the last packet */
+    struct reasm_dir dir[2];    /**< Directions, 0 from the first endpoint of the key */
+};
+
+/**
+ * @brief Reassembly counters
+ */
+struct reasm_stats {
+    uint64_t flows;         /**< Flows created */
+    uint64_t segments;      /**< Segments with a payload */
+    uint64_t delivered;     /**< Bytes handed over */
+    uint64_t deliveries;    /**< Times bytes were handed over */
+    uint64_t retransmits;   /**< Segments already handed over or queued */
+    uint64_t out_of_order;  /**< Segments received after a hole */
+    uint64_t gaps;          /**< Holes skipped */
+    uint64_t evicted;       /**< Flows freed to get memory back */
+    uint64_t expired;       /**< Flows freed after the idle timeout */
+    uint64_t dropped;       /**< Segments dropped for lack of memory */
+};
+
+/**
+ * @brief Reassembly state of a thread
+ */
+struct reasm_ctx {
+    struct reasm_flow *buckets[REASM_BUCKETS]; /**< Hash table of the flows */
+    struct reasm_flow *lru_head;    /**< Most recently used flow */
+    struct reasm_flow *lru_tail;    /**< Least recently used flow */
+    struct reasm_seg *free_segs;    /**< Free segments of the pool */
+    struct reasm_flow *free_flows;  /**< Freed flows, linked by hnext */
+    struct reasm_chunk *chunks;     /**< Chunks of the pool */
+    u_char *out;                    /**< Bytes handed over with the last packet, in the arena */
+    uint32_t out_len;               /**< Number of bytes handed over */
+    struct reasm_stats stats;       /**< Counters of the thread */
+};
+
+static int enabled = 0; /**< 1 if the reassembly is enabled */
+static size_t budget = REASM_MEMORY; /**< Memory budget of every thread */
+static int timeout = REASM_TIMEOUT; /**< Idle timeout of a flow in seconds */
+static atomic_size_t used; /**< Memory taken by every thread */
+static struct reasm_stats total; /**< Counters of the released threads */
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects total */
+static __thread struct reasm_ctx *ctx = NULL; /**< State of the thread */
+
+
+/**
+ * @brief Take memory from the global budget
+ *
+ * @param size The number of bytes
+ * @return int 0 on success, -1 if the budget is exhausted
+ */
+static int budget_take(size_t size)
+{
+    size_t cur = atomic_load_explicit(&used, memory_order_relaxed);
+    do {
+        if (cur + size > budget)
+            return (-1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &used, &cur, cur + size, memory_order_relaxed, memory_order_relaxed));
+    return 0;
+}
+
+
+/**
+ * @brief Give memory back to the global budget
+ *
+ * @param size The number of bytes
+ */
+static void budget_give(size_t size)
+{
+    atomic_fetch_sub_explicit(&used, size, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Enable the reassembly
+ *
+ * @param cfg The configuration
+ */
+void reasm_init(const struct reasm_config *cfg)
+{
+    budget = cfg->memory ? cfg->memory : REASM_MEMORY;
+    timeout = cfg->timeout > 0 ? cfg->timeout : REASM_TIMEOUT;
+    enabled = 1;
+}
+
+
+/**
+ * @brief Check if the reassembly is enabled
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int reasm_enabled(void)
+{
+    return enabled;
+}
+
+
+/**
+ * @brief Give the segments of a direction back to the pool
+ *
+ * @param d The direction
+ */
+static void dir_clear(struct reasm_dir *d)
+{
+    while (d->segs) {
+        struct reasm_seg *s = d->segs;
+        d->segs = s->next;
+        s->next = ctx->free_segs;
+        ctx->free_segs = s;
+    }
+    d->queued = 0;
+}
+
+
+/**
+ * @brief Free a flow
+ *
+ * The flow is kept for the next one, its memory stays in the budget.
+ *
+ * @param f The flow
+ */
+static void flow_free(struct reasm_flow *f)
+{
+    struct reasm_flow **link = &ctx->buckets[f->hash & (REASM_BUCKETS - 1)];
+    while (*link != f)
+        link = &(*link)->hnext;
+    *link = f->hnext;
+
+    if (f->prev)
+        f->prev->next = f->next;
+    else
+        ctx->lru_head = f->next;
+    if (f->next)
+        f->next->prev = f->prev;
+    else
+        ctx->lru_tail = f->prev;
+
+    dir_clear(&f->dir[0]);
+    dir_clear(&f->dir[1]);
+    f->hnext = ctx->free_flows;
+    ctx->free_flows = f;
+}
+
+
+/**
+ * @brief Free the least recently used flow
+ *
+ * @param keep The flow of the current packet, never freed
+ * @return int 0 on success, -1 if there is no other flow
+ */
+static int flow_evict(const struct reasm_flow *keep)
+{
+    struct reasm_flow *f = ctx->lru_tail;
+    if (f == keep)
+        f = f ? f->prev : NULL;
+    if (f == NULL)
+        return (-1);
+    flow_free(f);
+    ctx->stats.evicted++;
+    return 0;
+}
+
+
+/**
+ * @brief Take a segment from the pool
+ *
+ * The pool grows by a chunk when empty, if the budget allows it. Otherwise
+ * the least recently used flows are freed until one of their segments is.
+ *
+ * @param keep The flow of the current packet, never freed
+ * @return struct reasm_seg* The segment, NULL if there is no memory left
+ */
+static struct reasm_seg *seg_alloc(const struct reasm_flow *keep)
+{
+    while (ctx->free_segs == NULL) {
+        struct reasm_chunk *c = NULL;
+        if (budget_take(sizeof(*c)) == 0) {
+            c = malloc(sizeof(*c));
+            if (c == NULL)
+                budget_give(sizeof(*c));
+        }
+        if (c) {
+            c->next = ctx->chunks;
+            ctx->chunks = c;
+            for (int i = 0; i < REASM_POOL_CHUNK; i++) {
+                c->segs[i].next = ctx->free_segs;
+                ctx->free_segs = &c->segs[i];
+            }
+        } else if (flow_evict(keep) < 0) {
+            return NULL;
+        }
+    }
+    struct reasm_seg *s = ctx->free_segs;
+    ctx->free_segs = s->next;
+    return s;
+}
+
+
+/**
+ * @brief Take a flow from the freed ones
+ *
+ * A new flow is allocated if none is left and the budget allows it.
+ * Otherwise the least recently used flow is freed to be reused.
+ *
+ * @return struct reasm_flow* The flow, NULL if there is no memory left
+ */
+static struct reasm_flow *flow_alloc(void)
+{
+    if (ctx->free_flows == NULL) {
+        struct reasm_flow *f = NULL;
+        if (budget_take(sizeof(*f)) == 0) {
+            f = malloc(sizeof(*f));
+            if (f == NULL)
+                budget_give(sizeof(*f));
+        }
+        if (f)
+            return f;
+        if (flow_evict(NULL) < 0)
+            return NULL;
+    }
+    struct reasm_flow *f = ctx->free_flows;
+    ctx->free_flows = f->hnext;
+    return f;
+}
+
+
+/**
+ * @brief Find the flow of a packet, creating it if asked
+ *
+ * @param key The key of the flow
+ * @param create 1 to create the flow if unknown
+ * @return struct reasm_flow* The flow, NULL if unknown or out of memory
+ */
+static struct reasm_flow *flow_get(const struct flow_key *key, int create)
+{
+    uint32_t hash = flow_hash(key);
+    struct reasm_flow **bucket = &ctx->buckets[hash & (REASM_BUCKETS - 1)];
+    struct reasm_flow *f;
+    for (f = *bucket; f != NULL; f = f->hnext) {
+        if (f->hash == hash && memcmp(&f->key, key, sizeof(*key)) == 0)
+            break;
+    }
+
+    if (f == NULL) {
+        if (!create)
+            return NULL;
+        f = flow_alloc();
+        if (f == NULL) {
+            ctx->stats.dropped++;
+            return NULL;
+        }
+        memset(f, 0, sizeof(*f));
+        f->key = *key;
+        f->hash = hash;
+        f->hnext = *bucket;
+        *bucket = f;
+        ctx->stats.flows++;
+    } else { // Unlink it from the LRU list
+        if (f->prev)
+            f->prev->next = f->next;
+        else
+            ctx->lru_head = f->next;
+        if (f->next)
+            f->next->prev = f->prev;
+        else
+            ctx->lru_tail = f->prev;
+    }
+
+    f->prev = NULL;
+    f->next = ctx->lru_head;
+    if (ctx->lru_head)
+        ctx->lru_head->prev = f;
+    ctx->lru_head = f;
+    if (ctx->lru_tail == NULL)
+        ctx->lru_tail = f;
+    return f;
+}
+
+
+/**
+ * @brief Free the flows idle for longer than the timeout
+ *
+ * @param now The timestamp of the current packet
+ */
+static void flow_expire(struct timeval now)
+{
+    while (ctx->lru_tail && now.tv_sec - ctx->lru_tail->last.tv_sec > timeout) {
+        flow_free(ctx->lru_tail);
+        ctx->stats.expired++;
+    }
+}
+
+
+/**
+ * @brief Queue bytes in a direction, before a segment
+ *
+ * The bytes are split over as many segments as needed.
+ *
+ * @param f The flow
+ * @param link The link to insert at
+ * @param seq The sequence number of the first byte
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return struct reasm_seg** The link following the inserted segments, NULL
+ * if there is no memory left
+ */
+static struct reasm_seg **seg_insert(struct reasm_flow *f,
+                                     struct reasm_seg **link, uint32_t seq,
+                                     const u_char *data, uint32_t len)
+{
+    while (len > 0) {
+        struct reasm_seg *s = seg_alloc(f);
+        if (s == NULL)
+            return NULL;
+        s->seq = seq;
+        s->len = len < sizeof(s->data) ? len : sizeof(s->data);
+        memcpy(s->data, data, s->len);
+        s->next = *link;
+        *link = s;
+        link = &s->next;
+        seq += s->len;
+        data += s->len;
+        len -= s->len;
+    }
+    return link;
+}
+
+
+/**
+ * @brief Queue a payload in a direction
+ *
+ * Only the bytes no queued segment covers yet are copied, so the segments of
+ * a direction never overlap.
+ *
+ * @param f The flow
+ * @param d The direction
+ * @param seq The sequence number of the first byte, not before d->next
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return int 0 on success, -1 if part of the bytes were dropped
+ */
+static int dir_queue(struct reasm_flow *f, struct reasm_dir *d, uint32_t seq,
+                     const u_char *data, uint32_t len)
+{
+    struct reasm_seg **link = &d->segs;
+    while (len > 0) {
+        struct reasm_seg *s = *link;
+        if (s == NULL || SEQ_LT(seq, s->seq)) { // Uncovered bytes before s
+            uint32_t n = len;
+            if (s && SEQ_LT(s->seq, seq + len))
+                n = s->seq - seq;
+            link = seg_insert(f, link, seq, data, n);
+            if (link == NULL)
+                return (-1);
+            d->queued += n;
+            seq += n;
+            data += n;
+            len -= n;
+        } else if (SEQ_LT(seq, s->seq + s->len)) { // Covered by s
+            uint32_t n = s->seq + s->len - seq;
+            if (n > len)
+                n = len;
+            seq += n;
+            data += n;
+            len -= n;
+        } else {
+            link = &s->next;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Move the end of the in order bytes past the segments following it
+ *
+ * @param d The direction
+ */
+static void dir_advance(struct reasm_dir *d)
+{
+    for (struct reasm_seg *s = d->segs; s != NULL; s = s->next) {
+        if (s->seq == d->next)
+            d->next += s->len;
+        else if (SEQ_LT(d->next, s->seq))
+            break;
+    }
+}
+
+
+/**
+ * @brief Copy the in order bytes of a direction to the scratch memory of the
+ * packet
+ *
+ * @param d The direction
+ * @return int 0 on success, -1 if out of memory
+ */
+static int dir_deliver(struct reasm_dir *d)
+{
+    ctx->out = arena_alloc(d->next - d->base);
+    if (ctx->out == NULL)
+        return (-1);
+
+    ctx->out_len = 0;
+    while (d->segs && SEQ_LT(d->segs->seq, d->next)) {
+        struct reasm_seg *s = d->segs;
+        memcpy(ctx->out + ctx->out_len, s->data, s->len);
+        ctx->out_len += s->len;
+        d->queued -= s->len;
+        d->segs = s->next;
+        s->next = ctx->free_segs;
+        ctx->free_segs = s;
+    }
+    d->base = d->next;
+    ctx->stats.delivered += ctx->out_len;
+    ctx->stats.deliveries++;
+    return 0;
+}
+
+
+/**
+ * @brief Queue a TCP segment and hand the stream bytes it completes over
+ *
+ * The TCP fields of the decoded packet must be set. If bytes are handed
+ * over, they go through the application dissectors and the LAYER_STREAM flag
+ * is set.
+ *
+ * @param payload The view of the segment payload
+ * @param pi The decoded packet
+ * @return int 0 on success, -1 if the segment was dropped
+ *
+ * @see dispatch_app
+ * @see dispatch_stream
+ */
+int reasm_segment(const struct packet_view *payload, struct packet_info *pi)
+{
+    if (ctx == NULL) {
+        ctx = calloc(1, sizeof(*ctx));
+        if (ctx == NULL)
+            return (-1);
+    }
+    ctx->out_len = 0;
+    flow_expire(pi->ts);
+
+    struct flow_key key;
+    if (flow_key_pi(pi, &key) < 0)
+        return (-1);
+    uint32_t len = payload->remaining;
+    uint8_t flags = pi->tcp_flags;
+    struct reasm_flow *f = flow_get(&key, len > 0 || (flags & TH_SYN));
+    if (f == NULL)
+        return len > 0 ? -1 : 0;
+    f->last = pi->ts;
+
+    struct reasm_dir *d = &f->dir[flow_dir_pi(pi)];
+
+    uint32_t seq = pi->tcp_seq;
+    const u_char *data = payload->ptr;
+    if (flags & TH_SYN) { // The data starts after the SYN
+        seq++;
+        if (!d->synced || d->segs == NULL) {
+            d->base = d->next = seq;
+            d->synced = 1;
+        }
+    } else if (!d->synced) { // Joined in the middle of the connection
+        d->base = d->next = seq;
+        d->synced = 1;
+    }
+
+    int ret = 0;
+    if (len > 0) {
+        ctx->stats.segments++;
+        if (SEQ_LEQ(seq + len, d->next)) { // Every byte already queued
+            ctx->stats.retransmits++;
+            len = 0;
+        } else if (SEQ_LT(seq, d->next)) { // Start already queued
+            data += d->next - seq;
+            len -= d->next - seq;
+            seq = d->next;
+        }
+        if (len > 0 && SEQ_LT(d->next, seq))
+            ctx->stats.out_of_order++;
+        if (len > 0 && dir_queue(f, d, seq, data, len) < 0) {
+            ctx->stats.dropped++;
+            ret = -1;
+        }
+        dir_advance(d);
+    }
+    if (flags & TH_FIN) {
+        d->fin = pi->tcp_seq + (flags & TH_SYN ? 1 : 0) + payload->remaining;
+        d->fin_seen = 1;
+    }
+
+    uint32_t ready = d->next - d->base;
+    if (ready > 0 && ((flags & (TH_PUSH | TH_FIN | TH_RST)) ||
+                      ready >= REASM_DELIVER_MAX || d->queued > REASM_DIR_MAX) &&
+        dir_deliver(d) == 0) {
+        struct packet_view v;
+        view_init(&v, ctx->out, ctx->out_len);
+        pi->layers |= LAYER_STREAM;
+        if (f->app != APP_NONE)
+            dispatch_stream(&v, f->app, pi);
+        else if (dispatch_app(DISPATCH_TCP, &v, pi) == 0)
+            f->app = pi->app_proto;
+    }
+    if (d->queued > REASM_DIR_MAX && d->segs && d->next == d->base &&
+        SEQ_LT(d->next, d->segs->seq)) { // Waited too long for the hole
+        d->base = d->next = d->segs->seq;
+        ctx->stats.gaps++;
+        dir_advance(d);
+    }
+    if (d->fin_seen && d->base == d->fin)
+        d->closed = 1;
+
+    if ((flags & TH_RST) || (f->dir[0].closed && f->dir[1].closed))
+        flow_free(f);
+    return ret;
+}
+
+
+/**
+ * @brief Get the stream bytes handed over with a packet
+ *
+ * The bytes stay valid until the next packet is decoded by the same thread.
+ *
+ * @param pi The decoded packet
+ * @param data The bytes, set if there are
+ * @return uint32_t The number of bytes, 0 if none were handed over
+ */
+uint32_t reasm_data(const struct packet_info *pi, const u_char **data)
+{
+    if (!(pi->layers & LAYER_STREAM) || ctx == NULL)
+        return 0;
+    *data = ctx->out;
+    return ctx->out_len;
+}
+
+
+/**
+ * @brief Free the flows and buffers of the calling thread
+ *
+ * The counters of the thread are added to the global ones.
+ */
+void reasm_release(void)
+{
+    if (ctx == NULL)
+        return;
+    while (ctx->lru_head)
+        flow_free(ctx->lru_head);
+    while (ctx->free_flows) {
+        struct reasm_flow *f = ctx->free_flows;
+        ctx->free_flows = f->hnext;
+        free(f);
+        budget_give(sizeof(*f));
+    }
+    while (ctx->chunks) {
+        struct reasm_chunk *c = ctx->chunks;
+        ctx->chunks = c->next;
+        free(c);
+        budget_give(sizeof(*c));
+    }
+
+    pthread_mutex_lock(&total_lock);
+    total.flows += ctx->stats.flows;
+    total.segments += ctx->stats.segments;
+    total.delivered += ctx->stats.delivered;
+    total.deliveries += ctx->stats.deliveries;
+    total.retransmits += ctx->stats.retransmits;
+    total.out_of_order += ctx->stats.out_of_order;
+    total.gaps += ctx->stats.gaps;
+    total.evicted += ctx->stats.evicted;
+    total.expired += ctx->stats.expired;
+    total.dropped += ctx->stats.dropped;
+    pthread_mutex_unlock(&total_lock);
+
+    free(ctx);
+    ctx = NULL;
+}
+
+
+/**
+ * @brief Print the reassembly counters
+ *
+ * @param stream The stream to print to
+ */
+void reasm_print_stats(FILE *stream)
+{
+    pthread_mutex_lock(&total_lock);
+    fprintf(stream, "Reassembly: %llu flows, %llu segments, %llu bytes in "
+                    "%llu deliveries\n",
+            (unsigned long long)total.flows,
+            (unsigned long long)total.segments,
+            (unsigned long long)total.delivered,
+            (unsigned long long)total.deliveries);
+    fprintf(stream, "  %llu retransmits, %llu out of order, %llu gaps skipped, "
+                    "%llu dropped\n",
+            (unsigned long long)total.retransmits,
+            (unsigned long long)total.out_of_order,
+            (unsigned long long)total.gaps,
+            (unsigned long long)total.dropped);
+    fprintf(stream, "  %llu flows evicted, %llu expired\n",
+            (unsigned long long)total.evicted,
+            (unsigned long long)total.expired);
+    pthread_mutex_unlock(&total_lock);
+}
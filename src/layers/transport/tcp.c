@@ -8,21 +8,23 @@
  * 
  * @see tcp.h
  * @see cast_tcp
+ * @see print_tcp
  */
 
 // Global libraries
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <string.h>
 
 // Local header files
-#include "tls.h"
+#include "dispatch.h"
 #include "dns.h"
-#include "ftp.h"
-#include "http.h"
-#include "pop.h"
-#include "smtp.h"
+#include "perf.h"
+#include "reasm.h"
 #include "telnet.h"
 #include "tcp.h"
+#include "tls.h"
+#include "output.h"
 
 /**
  * @brief Check the flags of a TCP packet
@@ -33,167 +35,135 @@
  */
 void check_flags(const struct tcphdr *tcp)
 {
-    if (tcp->th_flags & TH_FIN)
-        printf("FIN ");
-    if (tcp->th_flags & TH_SYN)
-        printf("SYN ");
-    if (tcp->th_flags & TH_RST)
-        printf("RST ");
-    if (tcp->th_flags & TH_PUSH)
-        printf("PSH ");
-    if (tcp->th_flags & TH_ACK)
-        printf("ACK ");
-    if (tcp->th_flags & TH_URG)
-        printf("URG ");
-    printf("\n");
+    static const struct {
+        uint8_t mask;
+        char name[4];
+    } flags[] = {{TH_FIN, "FIN "}, {TH_SYN, "SYN "}, {TH_RST, "RST "},
+                 {TH_PUSH, "PSH "}, {TH_ACK, "ACK "}, {TH_URG, "URG "}};
+
+    char buf[sizeof(flags) / sizeof(flags[0]) * 4 + 1];
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        if (tcp->th_flags & flags[i].mask) {
+            memcpy(buf + len, flags[i].name, 4);
+            len += 4;
+        }
+    }
+    buf[len++] = '\n';
+    out_write(buf, len); // One write for all the flags
 }
 
 
 /**
- * @brief Handle a TCP packet
+ * @brief Cast TCP header
  * 
- * This function handles a TCP packet.
+ * Get TCP header from packet.
  * 
- * @param packet The packet to handle
- * @param tcp The TCP header
- * @param remain_size The remaining size of the packet
- * @return int 0 if the packet is well handled
+ * @param v The view of the packet, at the start of the header and limited to
+ * the IP payload
+ * @param pi The decoded packet to fill
+ * @return int 0 on success, -1 on error
  * 
- * @see is_http
- * @see is_smtp
- * @see is_ftp
- * @see cast_dns
- * @see is_pop
- * @see telnet_handler
+ * @see dispatch_app
+ * @see reasm_segment
  */
-int tcp_handling(const u_char *packet, const struct tcphdr *tcp,
-                 int remain_size)
+int cast_tcp(struct packet_view *v, struct packet_info *pi)
 {
-    if (be16toh(tcp->th_sport) == 80 || be16toh(tcp->th_dport) == 80) {
-        if (is_http(packet + tcp->doff * 4)) {
-            printf("\t\tHTTP\n");
-            printf("------------------------------------------------\n");
-            printf("%.*s\n", remain_size, packet + tcp->doff * 4);
-            printf("------------------------------------------------\n");
-        }
-    } else if (be16toh(tcp->th_sport) == 443 || be16toh(tcp->th_dport) == 443) {
-        const struct tlshdr *tls;
-        tls = (struct tlshdr *)(packet + tcp->th_off * 4);
-        printf("\t\tHTTPS\n");
-        printf("------------------------------------------------\n");
-        printf("Encryption with ");
-        switch (TLS_V(tls)) {
-        case 0x00:
-            printf("SSL 3.0\n");
-            break;
-        case 0x01:
-            printf("TLS 1.0\n");
-            break;
-        case 0x02:
-            printf("TLS 1.1\n");
-            break;
-        case 0x03:
-            printf("TLS 1.2\n");
-            break;
-        case 0x04:
-            printf("TLS 1.3\n");
-            break;
-        default:
-            fprintf(stderr, "Unknown SSL/TLS version. VERSION: 0x%x\n",
-                    TLS_V(tls));
-        }
-        // printf("%s\n", packet + tcp->th_off * 4 + sizeof(struct tlshdr));
-        printf("------------------------------------------------\n");
-    } else if (be16toh(tcp->th_sport) == 25 || be16toh(tcp->th_dport) == 25) {
-        if (is_smtp(packet + tcp->doff * 4)) {
-            printf("\t\tSMTP\n");
-            printf("------------------------------------------------\n");
-            printf("%.*s\n", remain_size, packet + tcp->doff * 4);
-            printf("------------------------------------------------\n");
-        }
-    } else if (be16toh(tcp->th_sport) == 21 || be16toh(tcp->th_dport) == 21 ||
-               be16toh(tcp->th_sport) == 20 || be16toh(tcp->th_dport) == 20) {
-        if (is_ftp(packet + tcp->doff * 4)) {
-            printf("\t\tFTP\n");
-            printf("------------------------------------------------\n");
-            printf("%.*s\n", remain_size, packet + tcp->doff * 4);
-            printf("------------------------------------------------\n");
-        }
-    } else if (be16toh(tcp->th_sport) == 53 || be16toh(tcp->th_dport) == 53) {
-        printf("\t\tDNS\n");
-        printf("------------------------------------------------\n");
-        cast_dns(packet + tcp->doff * 4, remain_size);
-        printf("------------------------------------------------\n");
-    } else if (be16toh(tcp->th_sport) == 110 || be16toh(tcp->th_dport) == 110) {
-        if (is_pop(packet + tcp->doff * 4)) {
-            printf("\t\tPOP3\n");
-            printf("------------------------------------------------\n");
-            printf("%.*s\n", remain_size, packet + tcp->doff * 4);
-            printf("------------------------------------------------\n");
-        }
-    } else if (be16toh(tcp->th_sport) == 143 || be16toh(tcp->th_dport) == 143) {
-        printf("\t\tIMAP\n");
-        printf("------------------------------------------------\n");
-        printf("%s\n", packet + tcp->doff * 4);
-        printf("------------------------------------------------\n");
-    } else if (be16toh(tcp->th_sport) == 993 || be16toh(tcp->th_dport) == 993) {
-        const struct tlshdr *tls;
-        tls = (struct tlshdr *)(packet + tcp->th_off * 4);
-        printf("\t\tIMAP\n");
-        printf("------------------------------------------------\n");
-        printf("Encryption with ");
-        switch (TLS_V(tls)) {
-        case 0x00:
-            printf("SSL 3.0\n");
-            break;
-        case 0x01:
-            printf("TLS 1.0\n");
-            break;
-        case 0x02:
-            printf("TLS 1.1\n");
-            break;
-        case 0x03:
-            printf("TLS 1.2\n");
-            break;
-        case 0x04:
-            printf("TLS 1.3\n");
-            break;
-        default:
-            fprintf(stderr, "Unknown SSL/TLS version. VERSION: 0x%x\n",
-                    TLS_V(tls));
-        }
-    } else if (be16toh(tcp->th_sport) == 23 || be16toh(tcp->th_dport) == 23) {
-        printf("\t\ttelnet\n");
-        printf("------------------------------------------------\n");
-        telnet_handler(packet + tcp->doff * 4);
-        printf("------------------------------------------------\n");
-    }
+    const struct tcphdr *tcp;
+    tcp = decode_pull(pi, v, sizeof(struct tcphdr));
+    if (tcp == NULL || tcp->doff < 5 ||
+        decode_pull(pi, v, tcp->doff * 4 - sizeof(struct tcphdr)) == NULL) // Options
+        return (-1);
+    pi->sport = be16toh(tcp->th_sport);
+    pi->dport = be16toh(tcp->th_dport);
+    pi->tcp_flags = tcp->th_flags;
+    pi->tcp_seq = be32toh(tcp->th_seq);
+    pi->tcp_ack = be32toh(tcp->th_ack);
+    pi->tcp_window = be16toh(tcp->th_win);
+    pi->l7_off = v->off;
+    pi->l7_len = v->remaining;
+    pi->layers |= LAYER_TCP;
+    if (reasm_enabled()) {
+        uint64_t start = perf_begin(PERF_REASM);
+        reasm_segment(v, pi); // Every segment, the flags drive the streams
+        perf_end(PERF_REASM, start);
+    } else if (pi->l7_len > 0 && pi->depth >= DECODE_APP)
+        dispatch_app(DISPATCH_TCP, v, pi);
     return 0;
 }
 
 
 /**
- * @brief Cast TCP header
+ * @brief Print a TCP packet
  * 
- * Get TCP header from packet.
+ * This function prints the TCP layer of a decoded packet and its application
+ * payload. With the reassembly, the payload is the stream bytes handed over
+ * with the packet, if any.
  * 
- * @param packet Pointer to the packet
- * @param remain_size Remaining size of the packet
- * @return int 0 on success, -1 on error
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
  * 
  * @see check_flags
- * @see tcp_handling
+ * @see reasm_data
+ * @see print_dns
+ * @see print_tls
+ * @see telnet_handler
  */
-int cast_tcp(const u_char *packet, int remain_size)
+int print_tcp(const struct packet_info *pi, const u_char *packet)
 {
-    const struct tcphdr *tcp;
-    tcp = (struct tcphdr *)packet;
-    printf("TCP.port: %d->%d\n", be16toh(tcp->th_sport),
-           be16toh(tcp->th_dport));
-    if (remain_size != tcp->doff * 4) {
-        tcp_handling(packet, tcp, remain_size - tcp->doff * 4);
-    } else {
+    const struct tcphdr *tcp = (const struct tcphdr *)(packet + pi->l4_off);
+    const u_char *payload = packet + pi->l7_off;
+    uint32_t len = reasm_enabled() ? reasm_data(pi, &payload) : pi->l7_len;
+
+    out_printf("TCP.port: %d->%d\n", pi->sport, pi->dport);
+    if (len == 0) {
         check_flags(tcp);
+        return 0;
+    }
+
+    switch (pi->app_proto) {
+    case APP_HTTP:
+    case APP_SMTP:
+    case APP_FTP:
+    case APP_POP:
+        out_printf("\t\t%s\n", pi->app_proto == APP_HTTP   ? "HTTP"
+                                : pi->app_proto == APP_SMTP ? "SMTP"
+                                : pi->app_proto == APP_FTP  ? "FTP"
+                                                            : "POP3");
+        out_puts("------------------------------------------------\n");
+        out_printf("%.*s\n", (int)len, payload);
+        out_puts("------------------------------------------------\n");
+        break;
+    case APP_HTTPS:
+        out_puts("\t\tHTTPS\n");
+        out_puts("------------------------------------------------\n");
+        print_tls(pi, payload, len);
+        out_puts("------------------------------------------------\n");
+        break;
+    case APP_DNS:
+        out_puts("\t\tDNS\n");
+        out_puts("------------------------------------------------\n");
+        print_dns(payload, len);
+        out_puts("------------------------------------------------\n");
+        break;
+    case APP_IMAP:
+        out_puts("\t\tIMAP\n");
+        out_puts("------------------------------------------------\n");
+        out_printf("%.*s\n", (int)len, payload);
+        out_puts("------------------------------------------------\n");
+        break;
+    case APP_IMAPS:
+        out_puts("\t\tIMAP\n");
+        out_puts("------------------------------------------------\n");
+        print_tls(pi, payload, len);
+        break;
+    case APP_TELNET:
+        out_puts("\t\ttelnet\n");
+        out_puts("------------------------------------------------\n");
+        telnet_handler(payload);
+        out_puts("------------------------------------------------\n");
+        break;
     }
     return 0;
-}
\ No newline at end of file
+}
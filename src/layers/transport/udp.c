@@ -8,6 +8,7 @@
  * 
  * @see udp.h
  * @see cast_udp
+ * @see print_udp
  */
 
 // Global libraries
@@ -16,52 +17,68 @@
 // Local header files
 #include "udp.h"
 #include "bootp.h"
+#include "dispatch.h"
 #include "dns.h"
+#include "output.h"
 
 /**
  * @brief Handle a UDP packet
  * 
- * This function handles a UDP packet.
+ * This function decodes a UDP packet.
  * 
- * @param packet The packet to handle
- * @param udp The UDP header
- * @param data_size The size of the data
+ * @param v The view of the packet, at the start of the header
+ * @param pi The decoded packet to fill
  * @return int 0 if the packet is well handled
- * 
- * @see cast_bootp
- * @see cast_dns
+ *
+ * @see dispatch_app
  */
-int udp_handling(const u_char *packet, const struct udphdr *udp, int data_size)
+int cast_udp(struct packet_view *v, struct packet_info *pi)
 {
-    if (be16toh(udp->uh_sport) == 67 || be16toh(udp->uh_dport) == 67 ||
-        be16toh(udp->uh_dport) == 68 || be16toh(udp->uh_dport) == 68) {
-        printf("------------------------------------------------\n");
-        cast_bootp(packet + 8);
-        printf("------------------------------------------------\n");
-    } else if (be16toh(udp->uh_sport) == 53 || be16toh(udp->uh_dport) == 53) {
-        printf("------------------------------------------------\n");
-        cast_dns(packet + 8, data_size);
-        printf("------------------------------------------------\n");
-    }
+    const struct udphdr *udp;
+    udp = decode_pull(pi, v, sizeof(struct udphdr));
+    if (udp == NULL)
+        return (-1);
+    pi->sport = be16toh(udp->uh_sport);
+    pi->dport = be16toh(udp->uh_dport);
+    pi->l7_off = v->off;
+    pi->layers |= LAYER_UDP;
+    if (be16toh(udp->uh_ulen) < sizeof(struct udphdr))
+        return 0;
+    decode_limit(pi, v, be16toh(udp->uh_ulen) - sizeof(struct udphdr));
+    pi->l7_len = v->remaining;
+    if (pi->l7_len > 0 && pi->depth >= DECODE_APP)
+        dispatch_app(DISPATCH_UDP, v, pi);
     return 0;
 }
 
 
 /**
- * @brief Handle a UDP packet
+ * @brief Print a UDP packet
  * 
- * This function handles a UDP packet.
+ * This function prints the UDP layer of a decoded packet and its application
+ * payload.
  * 
- * @param packet The packet to handle
- * @return int 0 if the packet is well handled
+ * @param pi The decoded packet
+ * @param packet The packet
+ * @return int 0 on success
+ * 
+ * @see print_bootp
+ * @see print_dns
  */
-int cast_udp(const u_char *packet)
+int print_udp(const struct packet_info *pi, const u_char *packet)
 {
-    const struct udphdr *udp;
-    udp = (struct udphdr *)packet;
-    printf("UDP.port: %d->%d\n", be16toh(udp->uh_sport), be16toh(udp->uh_dport));
-    if (be16toh(udp->uh_ulen) > 8) {
-        udp_handling(packet, udp, be16toh(udp->uh_ulen) - 8);
+    out_printf("UDP.port: %d->%d\n", pi->sport, pi->dport);
+    switch (pi->app_proto) {
+    case APP_BOOTP:
+        out_puts("------------------------------------------------\n");
+        print_bootp(packet + pi->l7_off, pi->l7_len);
+        out_puts("------------------------------------------------\n");
+        break;
+    case APP_DNS:
+        out_puts("------------------------------------------------\n");
+        print_dns(packet + pi->l7_off, pi->l7_len);
+        out_puts("------------------------------------------------\n");
+        break;
     }
     return 0;
-}
\ No newline at end of file
+}